@@ -79,11 +79,13 @@
 #define NS_CONN_ZIPACCEPTED         0x10000u /* The request accepts zip compression */
 #define NS_CONN_BROTLIACCEPTED      0x20000u /* The request accept brotli compression */
 #define NS_CONN_CONTINUE            0x40000u /* The request got "Expect: 100-continue" */
+#define NS_CONN_ZSTDACCEPTED        0x80000u /* The request accepts zstd compression */
 #define NS_CONN_ENTITYTOOLARGE    0x0100000u /* The sent entity was too large */
 #define NS_CONN_REQUESTURITOOLONG 0x0200000u /* Request-URI too long */
 #define NS_CONN_LINETOOLONG       0x0400000u /* Request header line too long */
 #define NS_CONN_CONFIGURED        0x1000000u /* The connection is fully configured */
 #define NS_CONN_SSL_WANT_WRITE    0x2000000u /* Flag SSL_ERROR_WANT_WRITE */
+#define NS_CONN_SSL_KTLS          0x4000000u /* Kernel TLS send offload is active */
 
 
 /*
@@ -244,8 +246,10 @@ typedef enum {
  */
 
 typedef struct Ns_CacheSearch {
-    Ns_Time        now;
-    Tcl_HashSearch hsearch;
+    Ns_Time          now;
+    Tcl_HashSearch   hsearch;
+    struct Ns_Cache *cache;   /* Searched cache */
+    int              shard;   /* Current shard of a sharded cache */
 } Ns_CacheSearch;
 
 typedef struct Ns_Cache         Ns_Cache;
@@ -267,6 +271,11 @@ typedef struct Ns_CacheTransactionStack {
     unsigned int depth;
 } Ns_CacheTransactionStack;
 
+typedef enum {
+    NS_CACHE_POLICY_LRU =       0, /* Least recently used entries are evicted */
+    NS_CACHE_POLICY_TINYLFU =   1  /* Frequency based admission (W-TinyLFU) */
+} Ns_CachePolicy;
+
 
 /*
  * This is used for logging messages.
@@ -874,6 +883,15 @@ Ns_CacheCreateEx(const char *name, int keys, time_t ttl, size_t maxSize,
                  Ns_FreeProc *freeProc)
     NS_GNUC_NONNULL(1);
 
+NS_EXTERN Ns_Cache *
+Ns_CacheCreateSharded(const char *name, int keys, size_t maxSize, int nshards,
+                      Ns_FreeProc *freeProc)
+    NS_GNUC_RETURNS_NONNULL NS_GNUC_NONNULL(1);
+
+NS_EXTERN Ns_Cache *
+Ns_CacheShard(Ns_Cache *cache, const char *key)
+    NS_GNUC_RETURNS_NONNULL NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(2);
+
 NS_EXTERN void
 Ns_CacheDestroy(Ns_Cache *cache)
     NS_GNUC_NONNULL(1);
@@ -1034,6 +1052,18 @@ NS_EXTERN TCL_SIZE_T
 Ns_CacheGetNrUncommittedEntries(const Ns_Cache *cache)
     NS_GNUC_NONNULL(1) NS_GNUC_PURE;
 
+NS_EXTERN void
+Ns_CacheSetPolicy(Ns_Cache *cache, Ns_CachePolicy policy)
+    NS_GNUC_NONNULL(1);
+
+NS_EXTERN Ns_CachePolicy
+Ns_CacheGetPolicy(const Ns_Cache *cache)
+    NS_GNUC_NONNULL(1) NS_GNUC_PURE;
+
+NS_EXTERN int
+Ns_CacheGetShards(const Ns_Cache *cache)
+    NS_GNUC_NONNULL(1) NS_GNUC_PURE;
+
 /*
  * callbacks.c:
  */
@@ -1062,6 +1092,8 @@ typedef struct Ns_CompressStream {
 #ifdef HAVE_ZLIB_H
     z_stream   z;
 #endif
+    void        *brotli;  /* Brotli encoder state of the current response */
+    void        *zstd;    /* Zstandard encoder or decoder state */
     unsigned int flags;
 
 } Ns_CompressStream;
@@ -1084,6 +1116,40 @@ NS_EXTERN Ns_ReturnCode
 Ns_CompressGzip(const char *buf, int len, Tcl_DString *dsPtr, int level)
     NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(3);
 
+NS_EXTERN Ns_ReturnCode
+Ns_CompressBufsBrotli(Ns_CompressStream *cStream, struct iovec *bufs, int nbufs,
+                      Tcl_DString *dsPtr, int quality, int window, bool flush)
+    NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(4);
+
+NS_EXTERN Ns_ReturnCode
+Ns_CompressBrotli(const char *buf, int len, Tcl_DString *dsPtr, int quality)
+    NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(3);
+
+NS_EXTERN Ns_ReturnCode
+Ns_CompressBufsZstd(Ns_CompressStream *cStream, struct iovec *bufs, int nbufs,
+                    Tcl_DString *dsPtr, int level, bool flush)
+    NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(4);
+
+NS_EXTERN Ns_ReturnCode
+Ns_CompressZstd(const char *buf, int len, Tcl_DString *dsPtr, int level)
+    NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(3);
+
+NS_EXTERN Ns_ReturnCode
+Ns_ZstdDecompressInit(Ns_CompressStream *cStream)
+    NS_GNUC_NONNULL(1);
+
+NS_EXTERN Ns_ReturnCode
+Ns_ZstdDecompressBufferInit(Ns_CompressStream *cStream, const char *buffer, size_t inSize)
+    NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(2);
+
+NS_EXTERN int
+Ns_ZstdDecompressBuffer(Ns_CompressStream *cStream, const char *buffer, size_t outSize, size_t *nrBytes)
+    NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(2) NS_GNUC_NONNULL(4);
+
+NS_EXTERN Ns_ReturnCode
+Ns_ZstdDecompressEnd(Ns_CompressStream *cStream)
+    NS_GNUC_NONNULL(1);
+
 NS_EXTERN Ns_ReturnCode
 Ns_InflateInit(Ns_CompressStream *cStream)
     NS_GNUC_NONNULL(1);
@@ -0,0 +1,88 @@
+#------------------------------------------------------------------------
+# AX_CHECK_BROTLI --
+#
+#       Check for the Brotli encoder library, used for on-the-fly
+#       compression of responses with the "br" content encoding,
+#       possibly using a special directory.
+#
+# Arguments:
+#       none
+#
+# Results:
+#
+#       Adds the following arguments to configure:
+#               --with-brotli=[dir]
+#
+#       When no argument is given, Brotli is used if it is found in
+#       the default locations. With --with-brotli=no, Brotli support
+#       is not compiled in.
+#
+#       Defines the following vars:
+#               BROTLI_INCLUDES    Full path to the directory containing
+#                                  the brotli/encode.h file if a brotli
+#                                  directory was specified.
+#               BROTLI_LIBS        Linker line for libbrotlienc.
+#
+#       Defines HAVE_BROTLI when the header and the library are usable.
+#------------------------------------------------------------------------
+
+AC_DEFUN([AX_CHECK_BROTLI], [
+AC_MSG_CHECKING([for brotli encoder library (br content encoding)])
+AC_ARG_WITH([brotli],
+  AS_HELP_STRING(--with-brotli=DIR,Build and link with the Brotli encoder for on-the-fly compression),
+  [
+    ac_brotli=$withval
+    ac_brotli_required=yes
+    BROTLI_INCLUDES=""
+    BROTLI_LIBS="-lbrotlienc"
+    if test "${ac_brotli}" != "no" ; then
+      ac_brotli=yes
+      if test -d "$withval" ; then
+        BROTLI_INCLUDES="-I$withval/include"
+        BROTLI_LIBS="-L$withval/lib -lbrotlienc"
+      fi
+    fi
+  ],
+  [
+    ac_brotli="yes"
+    ac_brotli_required=no
+    BROTLI_INCLUDES=""
+    BROTLI_LIBS="-lbrotlienc"
+  ])
+AC_MSG_RESULT([$ac_brotli])
+
+if test "${ac_brotli}" = "yes" ; then
+  save_CPPFLAGS="$CPPFLAGS"
+  save_LIBS="$LIBS"
+  CPPFLAGS="$BROTLI_INCLUDES $CPPFLAGS"
+  LIBS="$BROTLI_LIBS $LIBS"
+
+  AC_CHECK_HEADER([brotli/encode.h], [ac_brotli_header=yes], [ac_brotli_header=no])
+  AC_MSG_CHECKING([for BrotliEncoderCreateInstance in -lbrotlienc])
+  AC_LINK_IFELSE([AC_LANG_PROGRAM([[#include <brotli/encode.h>]],
+                                  [[return BrotliEncoderCreateInstance(NULL, NULL, NULL) == NULL;]])],
+                 [ac_brotli_lib=yes], [ac_brotli_lib=no])
+  AC_MSG_RESULT([$ac_brotli_lib])
+
+  if test "${ac_brotli_header}" = "yes" -a "${ac_brotli_lib}" = "yes" ; then
+    AC_DEFINE([HAVE_BROTLI], 1, [Define to 1 when the Brotli encoder is available for on-the-fly compression])
+  else
+    if test "${ac_brotli_required}" = "yes" ; then
+      AC_MSG_ERROR([brotli support requested but not available])
+    fi
+    AC_MSG_NOTICE([brotli not found, building without on-the-fly Brotli compression])
+    BROTLI_INCLUDES=""
+    BROTLI_LIBS=""
+  fi
+
+  CPPFLAGS="$save_CPPFLAGS"
+  LIBS="$save_LIBS"
+else
+  BROTLI_INCLUDES=""
+  BROTLI_LIBS=""
+fi
+
+AC_SUBST([BROTLI_INCLUDES])
+AC_SUBST([BROTLI_LIBS])
+
+])
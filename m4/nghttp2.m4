@@ -0,0 +1,87 @@
+#------------------------------------------------------------------------
+# AX_CHECK_NGHTTP2 --
+#
+#       Check for the nghttp2 library, used for the HTTP/2 protocol
+#       engine of the driver, possibly using a special directory.
+#
+# Arguments:
+#       none
+#
+# Results:
+#
+#       Adds the following arguments to configure:
+#               --with-nghttp2=[dir]
+#
+#       When no argument is given, nghttp2 is used if it is found in
+#       the default locations. With --with-nghttp2=no, HTTP/2 support
+#       is not compiled in.
+#
+#       Defines the following vars:
+#               NGHTTP2_INCLUDES   Full path to the directory containing
+#                                  the nghttp2/nghttp2.h file if an nghttp2
+#                                  directory was specified.
+#               NGHTTP2_LIBS       Linker line for libnghttp2.
+#
+#       Defines HAVE_NGHTTP2 when the header and the library are usable.
+#------------------------------------------------------------------------
+
+AC_DEFUN([AX_CHECK_NGHTTP2], [
+AC_MSG_CHECKING([for nghttp2 library (HTTP/2 support)])
+AC_ARG_WITH([nghttp2],
+  AS_HELP_STRING(--with-nghttp2=DIR,Build and link with nghttp2 for HTTP/2 support),
+  [
+    ac_nghttp2=$withval
+    ac_nghttp2_required=yes
+    NGHTTP2_INCLUDES=""
+    NGHTTP2_LIBS="-lnghttp2"
+    if test "${ac_nghttp2}" != "no" ; then
+      ac_nghttp2=yes
+      if test -d "$withval" ; then
+        NGHTTP2_INCLUDES="-I$withval/include"
+        NGHTTP2_LIBS="-L$withval/lib -lnghttp2"
+      fi
+    fi
+  ],
+  [
+    ac_nghttp2="yes"
+    ac_nghttp2_required=no
+    NGHTTP2_INCLUDES=""
+    NGHTTP2_LIBS="-lnghttp2"
+  ])
+AC_MSG_RESULT([$ac_nghttp2])
+
+if test "${ac_nghttp2}" = "yes" ; then
+  save_CPPFLAGS="$CPPFLAGS"
+  save_LIBS="$LIBS"
+  CPPFLAGS="$NGHTTP2_INCLUDES $CPPFLAGS"
+  LIBS="$NGHTTP2_LIBS $LIBS"
+
+  AC_CHECK_HEADER([nghttp2/nghttp2.h], [ac_nghttp2_header=yes], [ac_nghttp2_header=no])
+  AC_MSG_CHECKING([for nghttp2_session_server_new in -lnghttp2])
+  AC_LINK_IFELSE([AC_LANG_PROGRAM([[#include <nghttp2/nghttp2.h>]],
+                                  [[nghttp2_session *s; return nghttp2_session_server_new(&s, NULL, NULL);]])],
+                 [ac_nghttp2_lib=yes], [ac_nghttp2_lib=no])
+  AC_MSG_RESULT([$ac_nghttp2_lib])
+
+  if test "${ac_nghttp2_header}" = "yes" -a "${ac_nghttp2_lib}" = "yes" ; then
+    AC_DEFINE([HAVE_NGHTTP2], 1, [Define to 1 when nghttp2 is available for HTTP/2 support])
+  else
+    if test "${ac_nghttp2_required}" = "yes" ; then
+      AC_MSG_ERROR([nghttp2 support requested but not available])
+    fi
+    AC_MSG_NOTICE([nghttp2 not found, building without HTTP/2 support])
+    NGHTTP2_INCLUDES=""
+    NGHTTP2_LIBS=""
+  fi
+
+  CPPFLAGS="$save_CPPFLAGS"
+  LIBS="$save_LIBS"
+else
+  NGHTTP2_INCLUDES=""
+  NGHTTP2_LIBS=""
+fi
+
+AC_SUBST([NGHTTP2_INCLUDES])
+AC_SUBST([NGHTTP2_LIBS])
+
+])
@@ -0,0 +1,88 @@
+#------------------------------------------------------------------------
+# AX_CHECK_ZSTD --
+#
+#       Check for the Zstandard library, used for on-the-fly
+#       compression and decompression of content with the "zstd"
+#       content encoding, possibly using a special directory.
+#
+# Arguments:
+#       none
+#
+# Results:
+#
+#       Adds the following arguments to configure:
+#               --with-zstd=[dir]
+#
+#       When no argument is given, Zstandard is used if it is found in
+#       the default locations. With --with-zstd=no, Zstandard support
+#       is not compiled in.
+#
+#       Defines the following vars:
+#               ZSTD_INCLUDES    Full path to the directory containing
+#                                the zstd.h file if a zstd
+#                                directory was specified.
+#               ZSTD_LIBS        Linker line for libzstd.
+#
+#       Defines HAVE_ZSTD when the header and the library are usable.
+#------------------------------------------------------------------------
+
+AC_DEFUN([AX_CHECK_ZSTD], [
+AC_MSG_CHECKING([for zstd library (zstd content encoding)])
+AC_ARG_WITH([zstd],
+  AS_HELP_STRING(--with-zstd=DIR,Build and link with the Zstandard library for the zstd content encoding),
+  [
+    ac_zstd=$withval
+    ac_zstd_required=yes
+    ZSTD_INCLUDES=""
+    ZSTD_LIBS="-lzstd"
+    if test "${ac_zstd}" != "no" ; then
+      ac_zstd=yes
+      if test -d "$withval" ; then
+        ZSTD_INCLUDES="-I$withval/include"
+        ZSTD_LIBS="-L$withval/lib -lzstd"
+      fi
+    fi
+  ],
+  [
+    ac_zstd="yes"
+    ac_zstd_required=no
+    ZSTD_INCLUDES=""
+    ZSTD_LIBS="-lzstd"
+  ])
+AC_MSG_RESULT([$ac_zstd])
+
+if test "${ac_zstd}" = "yes" ; then
+  save_CPPFLAGS="$CPPFLAGS"
+  save_LIBS="$LIBS"
+  CPPFLAGS="$ZSTD_INCLUDES $CPPFLAGS"
+  LIBS="$ZSTD_LIBS $LIBS"
+
+  AC_CHECK_HEADER([zstd.h], [ac_zstd_header=yes], [ac_zstd_header=no])
+  AC_MSG_CHECKING([for ZSTD_createCCtx in -lzstd])
+  AC_LINK_IFELSE([AC_LANG_PROGRAM([[#include <zstd.h>]],
+                                  [[return ZSTD_createCCtx() == NULL;]])],
+                 [ac_zstd_lib=yes], [ac_zstd_lib=no])
+  AC_MSG_RESULT([$ac_zstd_lib])
+
+  if test "${ac_zstd_header}" = "yes" -a "${ac_zstd_lib}" = "yes" ; then
+    AC_DEFINE([HAVE_ZSTD], 1, [Define to 1 when the Zstandard library is available for the zstd content encoding])
+  else
+    if test "${ac_zstd_required}" = "yes" ; then
+      AC_MSG_ERROR([zstd support requested but not available])
+    fi
+    AC_MSG_NOTICE([zstd not found, building without support for the zstd content encoding])
+    ZSTD_INCLUDES=""
+    ZSTD_LIBS=""
+  fi
+
+  CPPFLAGS="$save_CPPFLAGS"
+  LIBS="$save_LIBS"
+else
+  ZSTD_INCLUDES=""
+  ZSTD_LIBS=""
+fi
+
+AC_SUBST([ZSTD_INCLUDES])
+AC_SUBST([ZSTD_LIBS])
+
+])
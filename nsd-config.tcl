@@ -210,6 +210,9 @@ ns_section ns/fastpath {
     ns_param    brotli_refresh      true       ;# refresh stale .br files on the fly using ::ns_brotlifile
     ns_param    brotli_cmd          "/usr/bin/brotli -f -Z"  ;# use for re-compressing
     #ns_param   brotli_cmd          "/opt/local/bin/brotli -f -Z"  ;# use for re-compressing (macOS + ports)
+    #ns_param   zstd_static         true       ;# check for static zstd files; default: false
+    #ns_param   zstd_refresh        true       ;# refresh stale .zst files on the fly using ::ns_zstdfile
+    #ns_param   zstd_cmd            "/usr/bin/zstd -q -19"  ;# use for re-compressing
 }
 
 ns_section ns/servers {
@@ -240,6 +243,7 @@ if {[info exists httpport] && $httpport ne ""} {
                                              ;# receives more than this threshold number of sockets
         #ns_param closewait     0s           ;# default: 2s; timeout for close on socket
         #ns_param keepwait      5s           ;# 5s, timeout for keep-alive
+        #ns_param http2         true         ;# false; accept HTTP/2 with prior knowledge (requires nghttp2)
         #ns_param maxqueuesize  1024         ;# default: 1024; maximum size of the queue
 
         #ns_param readahead     1MB          ;# default: 16384; size of readahead for requests
@@ -350,6 +354,8 @@ if {[info exists httpsport] && $httpsport ne ""} {
         ns_param OCSPstapling   on        ;# off; activate OCSP stapling
         # ns_param OCSPstaplingVerbose  on ;# off; make OCSP stapling more verbose
         # ns_param OCSPcheckInterval 15m   ;# default 5m; OCSP (re)check intervale
+        # ns_param ktls  true              ;# false; kernel TLS offload, enables zero-copy sendfile over HTTPS (Linux, OpenSSL 3)
+        # ns_param http2 true              ;# false; offer HTTP/2 via ALPN (requires nghttp2)
     }
     #
     # Define, which "host" (as supplied by the "host:" header field)
@@ -536,6 +542,10 @@ ns_section ns/server/default/httpclient {
 ns_section ns/server/default/tcl {
     ns_param    nsvbuckets          16       ;# default: 8
     ns_param    nsvrwlocks          false    ;# default: true
+    #ns_param   nsvreadmostly       {}       ;# default: {}, glob patterns of arrays read without locks
+    #ns_param   nsvcounters         {}       ;# default: {}, glob patterns of arrays with lock-free counters
+    #ns_param   snapshotfile        logs/snapshot.bin ;# default: none, nsv/cache snapshot restored at startup
+    #ns_param   snapshotthreads     4        ;# default: 4
     ns_param    library             modules/tcl
     #
     # Example for initcmds (to be executed, when this server is fully initialized).
@@ -502,7 +502,7 @@ AdpSource(NsInterp *itPtr, TCL_SIZE_T objc, Tcl_Obj *const* objv, const char *fi
      * Verify the file is an existing, ordinary file and get page code.
      */
 
-    if (stat(file, &st) != 0) {
+    if (!NsStatCached(file, &st)) {
         Ns_TclPrintfResult(interp, "could not stat \"%s\": %s",
                            file, Tcl_PosixError(interp));
     } else if (!S_ISREG(st.st_mode)) {
@@ -14,6 +14,25 @@
  * cache.c --
  *
  *      Size and time limited caches.
+ *
+ *      A cache might be split into shards, where every shard is a cache
+ *      with its own lock, hash table, LRU list and a part of the maximum
+ *      size. The entries are distributed over the shards by the hash value
+ *      of the key. Operations on a single key lock only the shard obtained
+ *      via Ns_CacheShard(), while locking the sharded cache itself locks
+ *      all shards, such that operations on all entries (searches, flushes,
+ *      commits and rollbacks of transactions, statistics) work unchanged.
+ *
+ *      Every cache (or shard) evicts entries according to its policy. The
+ *      default policy evicts the least recently used entries. The policy
+ *      NS_CACHE_POLICY_TINYLFU follows W-TinyLFU: new entries are placed
+ *      into a small LRU admission window. Entries leaving the window enter
+ *      the main region only when their access frequency, estimated by a
+ *      count-min sketch, is higher than the frequency of the entry which
+ *      would be evicted instead. The main region is segmented into a
+ *      probation and a protected segment, entries are promoted to the
+ *      protected segment on a hit in probation. Therefore, a scan over many
+ *      cold keys cannot flush the frequently used entries.
  */
 
 #include "nsd.h"
@@ -22,8 +41,8 @@ struct Cache;
 
 /*
  * An Entry is a node in a linked list as well as being a
- * hash table entry. The linked list is there to keep track of
- * usage for the purposes of cache pruning.
+ * hash table entry. The linked lists (one per segment) are there to
+ * keep track of usage for the purposes of cache pruning.
  */
 
 typedef struct Entry {
@@ -38,15 +57,70 @@ typedef struct Entry {
     void           *value;            /* Will appear NULL for concurrent updates. */
     void           *uncommittedValue; /* Used for transactional mode */
     uintptr_t       transactionEpoch; /* Used for identifying transaction */
+    uint32_t        hash;             /* hash value of the key (TinyLFU) */
+    int             segment;          /* segment containing the entry */
 } Entry;
 
+/*
+ * Segments of a cache. With the LRU policy, all entries are in
+ * CACHE_WINDOW.
+ */
+
+#define CACHE_WINDOW      0   /* LRU list or admission window */
+#define CACHE_PROBATION   1   /* main region, not yet reused */
+#define CACHE_PROTECTED   2   /* main region, reused entries */
+#define CACHE_SEGMENTS    3
+
+typedef struct EntryList {
+    struct Entry   *firstEntryPtr;
+    struct Entry   *lastEntryPtr;
+    size_t          size;             /* sum of the value sizes */
+} EntryList;
+
+/*
+ * Count-min sketch for estimating the access frequency of keys. The
+ * counters saturate at SKETCH_MAX_COUNT and are halved after
+ * SKETCH_SAMPLE_FACTOR * width increments, such that old popularity fades.
+ * Increments are conservative (only the minimal counters of a key are
+ * incremented), which reduces the overestimation of rarely used keys.
+ */
+
+#define SKETCH_DEPTH          4
+#define SKETCH_MAX_COUNT      15u
+#define SKETCH_SAMPLE_FACTOR  10u
+#define SKETCH_MIN_WIDTH      1024u
+#define SKETCH_MAX_WIDTH      (1u << 22)
+
+typedef struct FrequencySketch {
+    unsigned char  *counters;         /* SKETCH_DEPTH rows of width counters */
+    uint32_t        width;            /* power of two */
+    unsigned long   additions;        /* increments since last aging */
+} FrequencySketch;
+
+/*
+ * The following structure defines the statistics of a cache
+ */
+
+typedef struct CacheStats {
+    unsigned long   nhit;      /* Successful gets. */
+    unsigned long   nmiss;     /* Unsuccessful gets. */
+    unsigned long   nexpired;  /* Unsuccessful gets due to entry expiry. */
+    unsigned long   nflushed;  /* Explicit flushes by user code. */
+    unsigned long   npruned;   /* Evictions due to size constraint. */
+    unsigned long   ncommit;   /* number of commits. */
+    unsigned long   nrollback; /* number of rollback operations. */
+    unsigned long   nadmitted; /* Candidates which won against the victim (TinyLFU). */
+    unsigned long   nrejected; /* Candidates which were evicted instead (TinyLFU). */
+} CacheStats;
+
 /*
  * The following structure defines a cache
  */
 
 typedef struct Cache {
-    Entry         *firstEntryPtr;
-    Entry         *lastEntryPtr;
+    EntryList      segments[CACHE_SEGMENTS];
+    Ns_CachePolicy policy;
+    FrequencySketch sketch;
     int            keys;
     size_t         maxSize;
     size_t         currentSize;
@@ -56,15 +130,10 @@ typedef struct Cache {
     Tcl_HashTable  entriesTable;
     uintptr_t      transactionEpoch;
     Tcl_HashTable  uncommittedTable;
-    struct {
-        unsigned long   nhit;      /* Successful gets. */
-        unsigned long   nmiss;     /* Unsuccessful gets. */
-        unsigned long   nexpired;  /* Unsuccessful gets due to entry expiry. */
-        unsigned long   nflushed;  /* Explicit flushes by user code. */
-        unsigned long   npruned;   /* Evictions due to size constraint. */
-        unsigned long   ncommit;   /* number of commits. */
-        unsigned long   nrollback; /* number of rollback operations. */
-    } stats;
+    struct Cache  *parentPtr;  /* Sharded cache, when this is a shard. */
+    struct Cache **shards;     /* Shards of a sharded cache. */
+    int            nshards;    /* Number of shards or 0. */
+    CacheStats     stats;
 
     char name[1];
 
@@ -84,10 +153,53 @@ static void Remove(Entry *ePtr)
 static void Push(Entry *ePtr)
     NS_GNUC_NONNULL(1);
 
+static void Touch(Entry *ePtr)
+    NS_GNUC_NONNULL(1);
+
+static void Prune(Cache *cachePtr, const Entry *keepPtr, size_t maxSize)
+    NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(2);
+
+static Entry *Victim(const Cache *cachePtr, const Entry *keepPtr, const Entry *candidatePtr, bool withWindow)
+    NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(2) NS_GNUC_PURE;
+
+static inline bool Evictable(const Entry *ePtr, const Entry *keepPtr)
+    NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(2) NS_GNUC_PURE;
+
+static size_t ShardMaxSize(const Cache *cachePtr)
+    NS_GNUC_NONNULL(1) NS_GNUC_PURE;
+
+static void SetPolicy(Cache *cachePtr, Ns_CachePolicy policy)
+    NS_GNUC_NONNULL(1);
+
+static uint32_t KeyHash(int keys, const char *key)
+    NS_GNUC_NONNULL(2) NS_GNUC_PURE;
+
+static inline uint32_t SketchIndex(uint32_t hash, int row, uint32_t width)
+    NS_GNUC_PURE;
+
+static void SketchIncrement(Cache *cachePtr, uint32_t hash)
+    NS_GNUC_NONNULL(1);
+
+static unsigned int SketchFrequency(const Cache *cachePtr, uint32_t hash)
+    NS_GNUC_NONNULL(1) NS_GNUC_PURE;
+
 static unsigned long
 CacheTransaction(Cache *cachePtr, uintptr_t epoch, bool commit)
     NS_GNUC_NONNULL(1);
 
+static Cache *CacheCreate(const char *name, int keys, size_t maxSize, Ns_FreeProc *freeProc)
+    NS_GNUC_NONNULL(1) NS_GNUC_RETURNS_NONNULL;
+
+static Cache *GetShard(const Cache *cachePtr, const char *key)
+    NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(2) NS_GNUC_PURE;
+
+static Ns_Entry *NextEntry(Ns_CacheSearch *search, const Tcl_HashEntry *hPtr,
+                           const Ns_CacheTransactionStack *transactionStackPtr)
+    NS_GNUC_NONNULL(1);
+
+static Ns_ReturnCode WaitShard(Cache *cachePtr, Cache *shardPtr, const Ns_Time *timePtr)
+    NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(2);
+
 
 /*
  *----------------------------------------------------------------------
@@ -107,6 +219,65 @@ CacheTransaction(Cache *cachePtr, uintptr_t epoch, bool commit)
 
 Ns_Cache *
 Ns_CacheCreateSz(const char *name, int keys, size_t maxSize, Ns_FreeProc *freeProc)
+{
+    NS_NONNULL_ASSERT(name != NULL);
+
+    return (Ns_Cache *) CacheCreate(name, keys, maxSize, freeProc);
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * Ns_CacheCreateSharded --
+ *
+ *      Create a new size limited cache consisting of "nshards"
+ *      independently locked shards. Every shard receives an equal part of
+ *      the maximum size. With less than two shards, a plain cache is
+ *      created.
+ *
+ * Results:
+ *      A pointer to the new cache.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+Ns_Cache *
+Ns_CacheCreateSharded(const char *name, int keys, size_t maxSize, int nshards,
+                      Ns_FreeProc *freeProc)
+{
+    Cache *cachePtr;
+
+    NS_NONNULL_ASSERT(name != NULL);
+
+    cachePtr = CacheCreate(name, keys, maxSize, freeProc);
+    if (nshards > 1) {
+        Tcl_DString ds;
+        int         i;
+
+        Tcl_DStringInit(&ds);
+        cachePtr->nshards = nshards;
+        cachePtr->shards = ns_calloc((size_t)nshards, sizeof(Cache *));
+        for (i = 0; i < nshards; i++) {
+            Cache *shardPtr = CacheCreate(name, keys, maxSize, freeProc);
+
+            shardPtr->parentPtr = cachePtr;
+            Tcl_DStringSetLength(&ds, 0);
+            Ns_DStringPrintf(&ds, "%s:%d", name, i);
+            Ns_MutexSetName2(&shardPtr->lock, "ns:cache", ds.string);
+            cachePtr->shards[i] = shardPtr;
+        }
+        Tcl_DStringFree(&ds);
+    }
+
+    return (Ns_Cache *) cachePtr;
+}
+
+static Cache *
+CacheCreate(const char *name, int keys, size_t maxSize, Ns_FreeProc *freeProc)
 {
     Cache *cachePtr;
     size_t nameLength;
@@ -122,6 +293,9 @@ Ns_CacheCreateSz(const char *name, int keys, size_t maxSize, Ns_FreeProc *freePr
     cachePtr->maxSize         = maxSize;
     cachePtr->currentSize     = 0u;
     cachePtr->keys            = keys;
+    cachePtr->parentPtr       = NULL;
+    cachePtr->shards          = NULL;
+    cachePtr->nshards         = 0;
     cachePtr->stats.nhit      = 0u;
     cachePtr->stats.nmiss     = 0u;
     cachePtr->stats.nexpired  = 0u;
@@ -129,6 +303,9 @@ Ns_CacheCreateSz(const char *name, int keys, size_t maxSize, Ns_FreeProc *freePr
     cachePtr->stats.npruned   = 0u;
     cachePtr->stats.ncommit   = 0u;
     cachePtr->stats.nrollback = 0u;
+    cachePtr->stats.nadmitted = 0u;
+    cachePtr->stats.nrejected = 0u;
+    cachePtr->policy          = NS_CACHE_POLICY_LRU;
 
     Ns_MutexInit(&cachePtr->lock);
     Ns_MutexSetName2(&cachePtr->lock, "ns:cache", name);
@@ -137,10 +314,107 @@ Ns_CacheCreateSz(const char *name, int keys, size_t maxSize, Ns_FreeProc *freePr
     Tcl_InitHashTable(&cachePtr->entriesTable, keys);
     Tcl_InitHashTable(&cachePtr->uncommittedTable, TCL_ONE_WORD_KEYS);
 
-    return (Ns_Cache *) cachePtr;
+    return cachePtr;
 }
 
-
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * Ns_CacheShard --
+ *
+ *      Return the shard of a sharded cache responsible for the given key.
+ *      The result can be used like a cache for all operations on this
+ *      key, locking only the shard. For caches without shards, the cache
+ *      itself is returned.
+ *
+ * Results:
+ *      Cache or shard.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+Ns_Cache *
+Ns_CacheShard(Ns_Cache *cache, const char *key)
+{
+    NS_NONNULL_ASSERT(cache != NULL);
+    NS_NONNULL_ASSERT(key != NULL);
+
+    return (Ns_Cache *) GetShard((Cache *) cache, key);
+}
+
+static Cache *
+GetShard(const Cache *cachePtr, const char *key)
+{
+    Cache *result;
+
+    NS_NONNULL_ASSERT(cachePtr != NULL);
+    NS_NONNULL_ASSERT(key != NULL);
+
+    if (likely(cachePtr->nshards == 0)) {
+        result = (Cache *) cachePtr;
+    } else {
+        result = cachePtr->shards[KeyHash(cachePtr->keys, key) % (uint32_t)cachePtr->nshards];
+    }
+    return result;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * KeyHash --
+ *
+ *      Compute the hash value of a key, used for selecting the shard and
+ *      for the frequency sketch. Use FNV-1a, which differs from the hash
+ *      function of the Tcl hash tables, such that the entries of a shard
+ *      are still distributed over all buckets of its table.
+ *
+ * Results:
+ *      Hash value.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static uint32_t
+KeyHash(int keys, const char *key)
+{
+    uint32_t hash = 2166136261u;
+
+    NS_NONNULL_ASSERT(key != NULL);
+
+    if (keys == TCL_STRING_KEYS) {
+        const unsigned char *p;
+
+        for (p = (const unsigned char *)key; *p != '\0'; p++) {
+            hash = (hash ^ *p) * 16777619u;
+        }
+    } else if (keys == TCL_ONE_WORD_KEYS) {
+        uintptr_t word = (uintptr_t)key;
+        size_t    i;
+
+        for (i = 0u; i < sizeof(word); i++) {
+            hash = (hash ^ (uint32_t)(word & 0xffu)) * 16777619u;
+            word >>= 8;
+        }
+    } else {
+        const unsigned char *p = (const unsigned char *)key;
+        size_t               i, length = (size_t)keys * sizeof(int);
+
+        for (i = 0u; i < length; i++) {
+            hash = (hash ^ p[i]) * 16777619u;
+        }
+    }
+    return hash;
+}
+
+
 /*
  *----------------------------------------------------------------------
  *
@@ -165,10 +439,19 @@ Ns_CacheDestroy(Ns_Cache *cache)
     NS_NONNULL_ASSERT(cache != NULL);
 
     (void) Ns_CacheFlush(cache);
+    if (cachePtr->nshards > 0) {
+        int i;
+
+        for (i = 0; i < cachePtr->nshards; i++) {
+            Ns_CacheDestroy((Ns_Cache *) cachePtr->shards[i]);
+        }
+        ns_free(cachePtr->shards);
+    }
     Ns_MutexDestroy(&cachePtr->lock);
     Ns_CondDestroy(&cachePtr->cond);
     Tcl_DeleteHashTable(&cachePtr->entriesTable);
     Tcl_DeleteHashTable(&cachePtr->uncommittedTable);
+    ns_free(cachePtr->sketch.counters);
     ns_free(cachePtr);
 }
 
@@ -205,6 +488,7 @@ Ns_CacheFindEntryT(Ns_Cache *cache, const char *key, const Ns_CacheTransactionSt
     NS_NONNULL_ASSERT(cache != NULL);
     NS_NONNULL_ASSERT(key != NULL);
 
+    cachePtr = GetShard(cachePtr, key);
     hPtr = Tcl_FindHashEntry(&cachePtr->entriesTable, key);
     if (unlikely(hPtr == NULL)) {
         /*
@@ -246,9 +530,8 @@ Ns_CacheFindEntryT(Ns_Cache *cache, const char *key, const Ns_CacheTransactionSt
                  * Entry is valid.
                  */
                 ++cachePtr->stats.nhit;
-                Remove(ePtr);
                 ePtr->count ++;
-                Push(ePtr);
+                Touch(ePtr);
                 result = (Ns_Entry *) ePtr;
             }
         }
@@ -286,6 +569,7 @@ Ns_CacheCreateEntry(Ns_Cache *cache, const char *key, int *newPtr)
     NS_NONNULL_ASSERT(key != NULL);
     NS_NONNULL_ASSERT(newPtr != NULL);
 
+    cachePtr = GetShard(cachePtr, key);
     hPtr = Tcl_CreateHashEntry(&cachePtr->entriesTable, key, &isNew);
     if (isNew != 0) {
         ePtr = ns_calloc(1u, sizeof(Entry));
@@ -294,19 +578,25 @@ Ns_CacheCreateEntry(Ns_Cache *cache, const char *key, int *newPtr)
         Tcl_SetHashValue(hPtr, ePtr);
         cachePtr->currentSize += (sizeof(Entry) + sizeof(Tcl_HashEntry) + strlen(key));
         ++cachePtr->stats.nmiss;
+        if (cachePtr->policy == NS_CACHE_POLICY_TINYLFU) {
+            ePtr->hash = KeyHash(cachePtr->keys, key);
+            SketchIncrement(cachePtr, ePtr->hash);
+        }
+        Push(ePtr);
     } else {
         ePtr = Tcl_GetHashValue(hPtr);
         if (Expired(ePtr, NULL)) {
             ++cachePtr->stats.nexpired;
             Ns_CacheUnsetValue((Ns_Entry *) ePtr);
             isNew = 1;
+            Remove(ePtr);
+            Push(ePtr);
         } else {
             ePtr->count ++;
             ++cachePtr->stats.nhit;
+            Touch(ePtr);
         }
-        Remove(ePtr);
     }
-    Push(ePtr);
     *newPtr = isNew;
 
     return (Ns_Entry *) ePtr;
@@ -368,7 +658,15 @@ Ns_CacheWaitCreateEntryT(Ns_Cache *cache, const char *key, int *newPtr,
                        ((Cache*)cache)->name, key,
                        (int64_t)relTimePtr->sec, relTimePtr->usec);
             }
-            status = Ns_CacheTimedWait(cache, timeoutPtr);
+            if (((Entry *) entry)->cachePtr == (Cache *) cache) {
+                status = Ns_CacheTimedWait(cache, timeoutPtr);
+            } else {
+                /*
+                 * The sharded cache is locked, wait for the shard of the
+                 * entry.
+                 */
+                status = WaitShard((Cache *) cache, ((Entry *) entry)->cachePtr, timeoutPtr);
+            }
 
             entry = Ns_CacheCreateEntry(cache, key, &isNew);
         } while (status == NS_OK
@@ -561,11 +859,17 @@ TCL_SIZE_T
 Ns_CacheGetNrUncommittedEntries(const Ns_Cache *cache)
 {
     const Cache *cachePtr;
+    TCL_SIZE_T   result;
+    int          i;
 
     NS_NONNULL_ASSERT(cache != NULL);
 
     cachePtr = (const Cache *)cache;
-    return cachePtr->uncommittedTable.numEntries;
+    result = cachePtr->uncommittedTable.numEntries;
+    for (i = 0; i < cachePtr->nshards; i++) {
+        result += cachePtr->shards[i]->uncommittedTable.numEntries;
+    }
+    return result;
 }
 
 
@@ -644,18 +948,15 @@ Ns_CacheSetValueExpires(Ns_Entry *entry, void *value, size_t size,
         ePtr->expires = *timeoutPtr;
     }
     cachePtr->currentSize += size;
+    cachePtr->segments[ePtr->segment].size += size;
 
-    if (maxSize == 0u) {
-        /*
-         * Use the maxSize setting as configured in cPtr
-         */
-        maxSize = cachePtr->maxSize;
-    } else if (maxSize != cachePtr->maxSize) {
+    if (maxSize != 0u && maxSize != cachePtr->maxSize) {
         /*
          * Update the cache max size via the provided setting
          */
         cachePtr->maxSize = maxSize;
     }
+    maxSize = ShardMaxSize(cachePtr);
 
     if (maxSize > 0u) {
         /*
@@ -665,13 +966,7 @@ Ns_CacheSetValueExpires(Ns_Entry *entry, void *value, size_t size,
          * created.  There might be concurrent updates, since
          * e.g. nscache_eval releases its mutex.
          */
-        while (cachePtr->currentSize > maxSize
-               && cachePtr->lastEntryPtr != ePtr
-               && cachePtr->lastEntryPtr->value != NULL
-               ) {
-            Ns_CacheDeleteEntry((Ns_Entry *) cachePtr->lastEntryPtr);
-            ++cachePtr->stats.npruned;
-        }
+        Prune(cachePtr, ePtr, maxSize);
     }
     return result;
 }
@@ -725,6 +1020,7 @@ Ns_CacheUnsetValue(Ns_Entry *entry)
 
         cachePtr = ePtr->cachePtr;
         cachePtr->currentSize -= ePtr->size;
+        cachePtr->segments[ePtr->segment].size -= ePtr->size;
         ePtr->size = 0u;
         ePtr->expires.sec = ePtr->expires.usec = 0;
 
@@ -823,6 +1119,10 @@ Ns_CacheFlush(Ns_Cache *cache)
         entry = Ns_CacheNextEntry(&search);
         nflushed++;
     }
+    /*
+     * For sharded caches, the flush is counted in the statistics of the
+     * sharded cache.
+     */
     ++cachePtr->stats.nflushed;
 
     return nflushed;
@@ -856,27 +1156,19 @@ Ns_CacheFirstEntryT(Ns_Cache *cache, Ns_CacheSearch *search, const Ns_CacheTrans
 {
     Cache               *cachePtr = (Cache *) cache;
     const Tcl_HashEntry *hPtr;
-    Ns_Entry            *result = NULL;
 
     NS_NONNULL_ASSERT(cache != NULL);
     NS_NONNULL_ASSERT(search != NULL);
 
     Ns_GetTime(&search->now);
+    search->cache = cache;
+    search->shard = 0;
+    if (cachePtr->nshards > 0) {
+        cachePtr = cachePtr->shards[0];
+    }
     hPtr = Tcl_FirstHashEntry(&cachePtr->entriesTable, &search->hsearch);
-    while (hPtr != NULL) {
-        Ns_Entry  *entry = Tcl_GetHashValue(hPtr);
 
-        if (Ns_CacheGetValueT(entry, transactionStackPtr) != NULL) {
-            if (!Expired((Entry *) entry, &search->now)) {
-                result = entry;
-                break;
-            }
-            ++cachePtr->stats.nexpired;
-            Ns_CacheDeleteEntry(entry);
-        }
-        hPtr = Tcl_NextHashEntry(&search->hsearch);
-    }
-    return result;
+    return NextEntry(search, hPtr, transactionStackPtr);
 }
 
 
@@ -967,6 +1259,15 @@ CacheTransaction(Cache *cachePtr, uintptr_t epoch, bool commit)
 
     NS_NONNULL_ASSERT(cachePtr != NULL);
 
+    if (cachePtr->nshards > 0) {
+        int i;
+
+        for (i = 0; i < cachePtr->nshards; i++) {
+            count += CacheTransaction(cachePtr->shards[i], epoch, commit);
+        }
+        return count;
+    }
+
     hPtr = Tcl_FirstHashEntry(&cachePtr->uncommittedTable, &search.hsearch);
     while (hPtr != NULL) {
         Ns_Entry  *entry = (Ns_Entry *)Tcl_GetHashKey(&cachePtr->uncommittedTable, hPtr);
@@ -1020,24 +1321,43 @@ Ns_CacheNextEntry(Ns_CacheSearch *search)
 Ns_Entry *
 Ns_CacheNextEntryT(Ns_CacheSearch *search, const Ns_CacheTransactionStack *transactionStackPtr)
 {
-    const Tcl_HashEntry  *hPtr;
-    Ns_Entry             *result = NULL;
+    NS_NONNULL_ASSERT(search != NULL);
+
+    return NextEntry(search, Tcl_NextHashEntry(&search->hsearch), transactionStackPtr);
+}
+
+static Ns_Entry *
+NextEntry(Ns_CacheSearch *search, const Tcl_HashEntry *hPtr,
+          const Ns_CacheTransactionStack *transactionStackPtr)
+{
+    const Cache *cachePtr;
+    Ns_Entry    *result = NULL;
 
     NS_NONNULL_ASSERT(search != NULL);
 
-    hPtr = Tcl_NextHashEntry(&search->hsearch);
-    while (hPtr != NULL) {
-        Ns_Entry *entry = Tcl_GetHashValue(hPtr);
+    cachePtr = (const Cache *) search->cache;
+    for (;;) {
+        while (hPtr != NULL) {
+            Ns_Entry *entry = Tcl_GetHashValue(hPtr);
 
-        if (Ns_CacheGetValueT(entry, transactionStackPtr) != NULL) {
-            if (!Expired((Entry *) entry, &search->now)) {
-                result = entry;
-                break;
+            if (Ns_CacheGetValueT(entry, transactionStackPtr) != NULL) {
+                if (!Expired((Entry *) entry, &search->now)) {
+                    result = entry;
+                    break;
+                }
+                ((Entry *) entry)->cachePtr->stats.nexpired++;
+                Ns_CacheDeleteEntry(entry);
             }
-            ((Entry *) entry)->cachePtr->stats.nexpired++;
-            Ns_CacheDeleteEntry(entry);
+            hPtr = Tcl_NextHashEntry(&search->hsearch);
+        }
+        /*
+         * Continue with the next shard of a sharded cache.
+         */
+        if (result != NULL || cachePtr == NULL || search->shard + 1 >= cachePtr->nshards) {
+            break;
         }
-        hPtr = Tcl_NextHashEntry(&search->hsearch);
+        search->shard++;
+        hPtr = Tcl_FirstHashEntry(&cachePtr->shards[search->shard]->entriesTable, &search->hsearch);
     }
     return result;
 }
@@ -1065,7 +1385,18 @@ Ns_CacheLock(Ns_Cache *cache)
     Cache *cachePtr = (Cache *) cache;
 
     NS_NONNULL_ASSERT(cache != NULL);
-    Ns_MutexLock(&cachePtr->lock);
+    if (unlikely(cachePtr->nshards > 0)) {
+        int i;
+
+        /*
+         * Lock all shards, always in the same order.
+         */
+        for (i = 0; i < cachePtr->nshards; i++) {
+            Ns_MutexLock(&cachePtr->shards[i]->lock);
+        }
+    } else {
+        Ns_MutexLock(&cachePtr->lock);
+    }
 }
 
 
@@ -1088,10 +1419,27 @@ Ns_CacheLock(Ns_Cache *cache)
 Ns_ReturnCode
 Ns_CacheTryLock(Ns_Cache *cache)
 {
-    Cache *cachePtr = (Cache *) cache;
+    Cache        *cachePtr = (Cache *) cache;
+    Ns_ReturnCode status;
 
     NS_NONNULL_ASSERT(cache != NULL);
-    return Ns_MutexTryLock(&cachePtr->lock);
+    if (unlikely(cachePtr->nshards > 0)) {
+        int i;
+
+        status = NS_OK;
+        for (i = 0; i < cachePtr->nshards; i++) {
+            status = Ns_MutexTryLock(&cachePtr->shards[i]->lock);
+            if (status != NS_OK) {
+                while (i-- > 0) {
+                    Ns_MutexUnlock(&cachePtr->shards[i]->lock);
+                }
+                break;
+            }
+        }
+    } else {
+        status = Ns_MutexTryLock(&cachePtr->lock);
+    }
+    return status;
 }
 
 
@@ -1117,7 +1465,15 @@ Ns_CacheUnlock(Ns_Cache *cache)
     Cache *cachePtr = (Cache *) cache;
 
     NS_NONNULL_ASSERT(cache != NULL);
-    Ns_MutexUnlock(&cachePtr->lock);
+    if (unlikely(cachePtr->nshards > 0)) {
+        int i;
+
+        for (i = cachePtr->nshards; i > 0; i--) {
+            Ns_MutexUnlock(&cachePtr->shards[i - 1]->lock);
+        }
+    } else {
+        Ns_MutexUnlock(&cachePtr->lock);
+    }
 }
 
 
@@ -1129,6 +1485,13 @@ Ns_CacheUnlock(Ns_Cache *cache)
  *      Wait for the cache's condition variable to be signaled or for
  *      the given absolute timeout if timePtr is not NULL.
  *
+ *      A sharded cache has no condition variable of its own. The wait
+ *      uses the condition variable of the first shard, which is signaled
+ *      by Ns_CacheSignal() and Ns_CacheBroadcast() on the sharded cache,
+ *      but not by signals on the handle of another shard obtained via
+ *      Ns_CacheShard(). To wait for the entry of a key, use
+ *      Ns_CacheWaitCreateEntry(), which waits on the shard of the key.
+ *
  * Results:
  *      NS_OK or NS_TIMEOUT if timeout specified.
  *
@@ -1148,10 +1511,57 @@ Ns_CacheWait(Ns_Cache *cache)
 Ns_ReturnCode
 Ns_CacheTimedWait(Ns_Cache *cache, const Ns_Time *timePtr)
 {
-    Cache *cachePtr = (Cache *) cache;
+    Cache        *cachePtr = (Cache *) cache;
+    Ns_ReturnCode status;
 
     NS_NONNULL_ASSERT(cache != NULL);
-    return Ns_CondTimedWait(&cachePtr->cond, &cachePtr->lock, timePtr);
+    if (unlikely(cachePtr->nshards > 0)) {
+        status = WaitShard(cachePtr, cachePtr->shards[0], timePtr);
+    } else {
+        status = Ns_CondTimedWait(&cachePtr->cond, &cachePtr->lock, timePtr);
+    }
+    return status;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * WaitShard --
+ *
+ *      Wait on the condition variable of a shard, while all shards of the
+ *      sharded cache are locked. The other shards are released during the
+ *      wait and all shards are locked again in the usual order
+ *      afterwards.
+ *
+ * Results:
+ *      NS_OK or NS_TIMEOUT if timeout specified.
+ *
+ * Side effects:
+ *      Thread is suspended until condition is signaled or timeout.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static Ns_ReturnCode
+WaitShard(Cache *cachePtr, Cache *shardPtr, const Ns_Time *timePtr)
+{
+    Ns_ReturnCode status;
+    int           i;
+
+    NS_NONNULL_ASSERT(cachePtr != NULL);
+    NS_NONNULL_ASSERT(shardPtr != NULL);
+
+    for (i = 0; i < cachePtr->nshards; i++) {
+        if (cachePtr->shards[i] != shardPtr) {
+            Ns_MutexUnlock(&cachePtr->shards[i]->lock);
+        }
+    }
+    status = Ns_CondTimedWait(&shardPtr->cond, &shardPtr->lock, timePtr);
+    Ns_MutexUnlock(&shardPtr->lock);
+    Ns_CacheLock((Ns_Cache *) cachePtr);
+
+    return status;
 }
 
 
@@ -1181,7 +1591,15 @@ Ns_CacheSignal(Ns_Cache *cache)
     Cache *cachePtr = (Cache *) cache;
 
     NS_NONNULL_ASSERT(cache != NULL);
-    Ns_CondSignal(&cachePtr->cond);
+    if (unlikely(cachePtr->nshards > 0)) {
+        int i;
+
+        for (i = 0; i < cachePtr->nshards; i++) {
+            Ns_CondSignal(&cachePtr->shards[i]->cond);
+        }
+    } else {
+        Ns_CondSignal(&cachePtr->cond);
+    }
 }
 
 
@@ -1208,7 +1626,15 @@ Ns_CacheBroadcast(Ns_Cache *cache)
     Cache *cachePtr = (Cache *) cache;
 
     NS_NONNULL_ASSERT(cache != NULL);
-    Ns_CondBroadcast(&cachePtr->cond);
+    if (unlikely(cachePtr->nshards > 0)) {
+        int i;
+
+        for (i = 0; i < cachePtr->nshards; i++) {
+            Ns_CondBroadcast(&cachePtr->shards[i]->cond);
+        }
+    } else {
+        Ns_CondBroadcast(&cachePtr->cond);
+    }
 }
 
 
@@ -1217,7 +1643,8 @@ Ns_CacheBroadcast(Ns_Cache *cache)
  *
  * Ns_CacheStats --
  *
- *      Append statistics about cache usage to Tcl_DString.
+ *      Append statistics about cache usage to Tcl_DString. The
+ *      statistics of a sharded cache are summed up over its shards.
  *
  * Results:
  *      Pointer to current string value.
@@ -1232,17 +1659,47 @@ char *
 Ns_CacheStats(Ns_Cache *cache, Tcl_DString *dest)
 {
     const Cache    *cachePtr;
+    CacheStats      stats;
     unsigned long   count;
+    size_t          maxSize, currentSize;
+    TCL_SIZE_T      entries;
     const Entry    *ePtr;
     Ns_CacheSearch  search;
     double          savedCost = 0.0, hitrate;
+    int             i;
 
     NS_NONNULL_ASSERT(cache != NULL);
     NS_NONNULL_ASSERT(dest != NULL);
 
     cachePtr = (Cache *)cache;
-    count = cachePtr->stats.nhit + cachePtr->stats.nmiss;
-    hitrate = ((count != 0u) ? ((double)cachePtr->stats.nhit * 100.0) / (double)count : 0.0);
+    stats = cachePtr->stats;
+    maxSize = cachePtr->maxSize;
+    currentSize = cachePtr->currentSize;
+    entries = cachePtr->entriesTable.numEntries;
+    for (i = 0; i < cachePtr->nshards; i++) {
+        const Cache *shardPtr = cachePtr->shards[i];
+
+        stats.nhit      += shardPtr->stats.nhit;
+        stats.nmiss     += shardPtr->stats.nmiss;
+        stats.nexpired  += shardPtr->stats.nexpired;
+        stats.nflushed  += shardPtr->stats.nflushed;
+        stats.npruned   += shardPtr->stats.npruned;
+        stats.ncommit   += shardPtr->stats.ncommit;
+        stats.nrollback += shardPtr->stats.nrollback;
+        stats.nadmitted += shardPtr->stats.nadmitted;
+        stats.nrejected += shardPtr->stats.nrejected;
+        currentSize     += shardPtr->currentSize;
+        entries         += shardPtr->entriesTable.numEntries;
+        /*
+         * The shards keep the size of the sharded cache, which might be
+         * updated when values are set.
+         */
+        if (shardPtr->maxSize > maxSize) {
+            maxSize = shardPtr->maxSize;
+        }
+    }
+    count = stats.nhit + stats.nmiss;
+    hitrate = ((count != 0u) ? ((double)stats.nhit * 100.0) / (double)count : 0.0);
 
     ePtr = (Entry *)Ns_CacheFirstEntry(cache, &search);
     while (ePtr != NULL) {
@@ -1252,14 +1709,17 @@ Ns_CacheStats(Ns_Cache *cache, Tcl_DString *dest)
 
     return Ns_DStringPrintf(dest, "maxsize %lu size %lu entries %" PRITcl_Size
                " flushed %lu hits %lu missed %lu hitrate %.2f"
-               " expired %lu pruned %lu commit %lu rollback %lu saved %.6f",
-               (unsigned long) cachePtr->maxSize,
-               (unsigned long) cachePtr->currentSize,
-               cachePtr->entriesTable.numEntries, cachePtr->stats.nflushed,
-               cachePtr->stats.nhit, cachePtr->stats.nmiss, hitrate,
-                            cachePtr->stats.nexpired, cachePtr->stats.npruned,
-                            cachePtr->stats.ncommit, cachePtr->stats.nrollback,
-                            savedCost);
+               " expired %lu pruned %lu commit %lu rollback %lu saved %.6f"
+               " policy %s admitted %lu rejected %lu shards %d",
+               (unsigned long) maxSize,
+               (unsigned long) currentSize,
+               entries, stats.nflushed,
+               stats.nhit, stats.nmiss, hitrate,
+                            stats.nexpired, stats.npruned,
+                            stats.ncommit, stats.nrollback,
+                            savedCost,
+               cachePtr->policy == NS_CACHE_POLICY_TINYLFU ? "tinylfu" : "lru",
+               stats.nadmitted, stats.nrejected, MAX(cachePtr->nshards, 1));
 }
 
 
@@ -1283,9 +1743,13 @@ void
 Ns_CacheResetStats(Ns_Cache *cache)
 {
     Cache *cachePtr = (Cache *) cache;
+    int    i;
 
     NS_NONNULL_ASSERT(cache != NULL);
     memset(&cachePtr->stats, 0, sizeof(cachePtr->stats));
+    for (i = 0; i < cachePtr->nshards; i++) {
+        memset(&cachePtr->shards[i]->stats, 0, sizeof(cachePtr->shards[i]->stats));
+    }
 }
 
 
@@ -1308,9 +1772,15 @@ Ns_CacheResetStats(Ns_Cache *cache)
 void
 Ns_CacheSetMaxSize(Ns_Cache *cache, size_t maxSize)
 {
+    Cache *cachePtr = (Cache *) cache;
+    int    i;
+
     NS_NONNULL_ASSERT(cache != NULL);
 
-    ((Cache *) cache)->maxSize = maxSize;
+    cachePtr->maxSize = maxSize;
+    for (i = 0; i < cachePtr->nshards; i++) {
+        cachePtr->shards[i]->maxSize = maxSize;
+    }
 }
 
 size_t
@@ -1322,41 +1792,106 @@ Ns_CacheGetMaxSize(const Ns_Cache *cache)
 }
 
 
-
 /*
  *----------------------------------------------------------------------
  *
- * Expired --
+ * Ns_CacheSetPolicy, Ns_CacheGetPolicy --
  *
- *      Has the absolute TTL expired?
+ *      Set/get the eviction policy of the specified cache. The policy
+ *      can be changed for a populated cache, the cache must be locked.
  *
  * Results:
- *      NS_TRUE if entry has expired, NS_FALSE otherwise.
+ *      Ns_CacheGetPolicy() returns the policy.
  *
  * Side effects:
- *      None.
+ *      Entries might be moved between the segments of the cache.
  *
  *----------------------------------------------------------------------
  */
 
-static bool
-Expired(const Entry *ePtr, const Ns_Time *nowPtr)
+void
+Ns_CacheSetPolicy(Ns_Cache *cache, Ns_CachePolicy policy)
 {
-    Ns_Time  now;
-    bool     expired = NS_FALSE;
+    Cache *cachePtr = (Cache *) cache;
+    int    i;
 
-    NS_NONNULL_ASSERT(ePtr != NULL);
+    NS_NONNULL_ASSERT(cache != NULL);
 
-    if (unlikely(ePtr->expires.sec > 0)) {
-        if (nowPtr == NULL) {
-            Ns_GetTime(&now);
-            nowPtr = &now;
-        }
-        if (Ns_DiffTime(&ePtr->expires, nowPtr, NULL) < 0) {
-            expired = NS_TRUE;
-        }
+    for (i = 0; i < cachePtr->nshards; i++) {
+        SetPolicy(cachePtr->shards[i], policy);
     }
-    return expired;
+    SetPolicy(cachePtr, policy);
+}
+
+Ns_CachePolicy
+Ns_CacheGetPolicy(const Ns_Cache *cache)
+{
+    NS_NONNULL_ASSERT(cache != NULL);
+
+    return ((const Cache *) cache)->policy;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * Ns_CacheGetShards --
+ *
+ *      Get the number of shards of the specified cache.
+ *
+ * Results:
+ *      Number of shards, 1 for a cache without shards.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+int
+Ns_CacheGetShards(const Ns_Cache *cache)
+{
+    NS_NONNULL_ASSERT(cache != NULL);
+
+    return MAX(((const Cache *) cache)->nshards, 1);
+}
+
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * Expired --
+ *
+ *      Has the absolute TTL expired?
+ *
+ * Results:
+ *      NS_TRUE if entry has expired, NS_FALSE otherwise.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static bool
+Expired(const Entry *ePtr, const Ns_Time *nowPtr)
+{
+    Ns_Time  now;
+    bool     expired = NS_FALSE;
+
+    NS_NONNULL_ASSERT(ePtr != NULL);
+
+    if (unlikely(ePtr->expires.sec > 0)) {
+        if (nowPtr == NULL) {
+            Ns_GetTime(&now);
+            nowPtr = &now;
+        }
+        if (Ns_DiffTime(&ePtr->expires, nowPtr, NULL) < 0) {
+            expired = NS_TRUE;
+        }
+    }
+    return expired;
 }
 
 
@@ -1381,18 +1916,22 @@ Expired(const Entry *ePtr, const Ns_Time *nowPtr)
 static void
 Remove(Entry *ePtr)
 {
+    EntryList *listPtr;
+
     NS_NONNULL_ASSERT(ePtr != NULL);
 
+    listPtr = &ePtr->cachePtr->segments[ePtr->segment];
     if (ePtr->prevPtr != NULL) {
         ePtr->prevPtr->nextPtr = ePtr->nextPtr;
     } else {
-        ePtr->cachePtr->firstEntryPtr = ePtr->nextPtr;
+        listPtr->firstEntryPtr = ePtr->nextPtr;
     }
     if (ePtr->nextPtr != NULL) {
         ePtr->nextPtr->prevPtr = ePtr->prevPtr;
     } else {
-        ePtr->cachePtr->lastEntryPtr = ePtr->prevPtr;
+        listPtr->lastEntryPtr = ePtr->prevPtr;
     }
+    listPtr->size -= ePtr->size;
     ePtr->prevPtr = ePtr->nextPtr = NULL;
 }
 
@@ -1402,8 +1941,8 @@ Remove(Entry *ePtr)
  *
  * Push --
  *
- *      Push an entry to the top of the linked list of entries, making
- *      it the Most Recently Used
+ *      Push an entry to the top of the linked list of entries of its
+ *      segment, making it the Most Recently Used
  *
  * Results:
  *      None.
@@ -1417,17 +1956,462 @@ Remove(Entry *ePtr)
 static void
 Push(Entry *ePtr)
 {
+    EntryList *listPtr;
+
     NS_NONNULL_ASSERT(ePtr != NULL);
 
-    if (likely(ePtr->cachePtr->firstEntryPtr != NULL)) {
-        ePtr->cachePtr->firstEntryPtr->prevPtr = ePtr;
+    listPtr = &ePtr->cachePtr->segments[ePtr->segment];
+    if (likely(listPtr->firstEntryPtr != NULL)) {
+        listPtr->firstEntryPtr->prevPtr = ePtr;
     }
     ePtr->prevPtr = NULL;
-    ePtr->nextPtr = ePtr->cachePtr->firstEntryPtr;
-    ePtr->cachePtr->firstEntryPtr = ePtr;
-    if (unlikely(ePtr->cachePtr->lastEntryPtr == NULL)) {
-        ePtr->cachePtr->lastEntryPtr = ePtr;
+    ePtr->nextPtr = listPtr->firstEntryPtr;
+    listPtr->firstEntryPtr = ePtr;
+    if (unlikely(listPtr->lastEntryPtr == NULL)) {
+        listPtr->lastEntryPtr = ePtr;
     }
+    listPtr->size += ePtr->size;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * Touch --
+ *
+ *      Record a hit of an entry. With the LRU policy, the entry becomes
+ *      the most recently used one. With TinyLFU, the frequency of the key
+ *      is incremented and an entry in the probation segment is promoted
+ *      to the protected segment. When the protected segment grows beyond
+ *      80% of the main region, its least recently used entries are
+ *      demoted to probation.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Entries might change their segments.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+Touch(Entry *ePtr)
+{
+    Cache *cachePtr;
+
+    NS_NONNULL_ASSERT(ePtr != NULL);
+
+    cachePtr = ePtr->cachePtr;
+    Remove(ePtr);
+
+    if (cachePtr->policy == NS_CACHE_POLICY_TINYLFU) {
+        SketchIncrement(cachePtr, ePtr->hash);
+
+        if (ePtr->segment == CACHE_PROBATION) {
+            size_t maxSize = ShardMaxSize(cachePtr);
+
+            ePtr->segment = CACHE_PROTECTED;
+            if (maxSize > 0u) {
+                EntryList *protectedPtr = &cachePtr->segments[CACHE_PROTECTED];
+                size_t     protectedMax = ((maxSize - maxSize / 100u) / 5u) * 4u;
+
+                while (protectedPtr->size + ePtr->size > protectedMax
+                       && protectedPtr->lastEntryPtr != NULL) {
+                    Entry *demotePtr = protectedPtr->lastEntryPtr;
+
+                    Remove(demotePtr);
+                    demotePtr->segment = CACHE_PROBATION;
+                    Push(demotePtr);
+                }
+            }
+        }
+    }
+    Push(ePtr);
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * Prune --
+ *
+ *      Evict entries until the cache is not larger than maxSize. The
+ *      entry keepPtr and entries under construction (with a value of
+ *      NULL) are never evicted.
+ *
+ *      With TinyLFU, the admission window is limited to 1% of the size.
+ *      Entries leaving the window are moved to the head of the probation
+ *      segment. For every eviction from the main region, the newest entry
+ *      of the probation segment (the candidate) competes against the
+ *      victim (the least recently used entry of the main region): the
+ *      victim is evicted only, when the candidate was used more
+ *      frequently.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Entries are deleted, statistics are updated.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+Prune(Cache *cachePtr, const Entry *keepPtr, size_t maxSize)
+{
+    Entry *victimPtr;
+
+    NS_NONNULL_ASSERT(cachePtr != NULL);
+    NS_NONNULL_ASSERT(keepPtr != NULL);
+
+    if (cachePtr->policy == NS_CACHE_POLICY_TINYLFU) {
+        EntryList *windowPtr = &cachePtr->segments[CACHE_WINDOW];
+        EntryList *probationPtr = &cachePtr->segments[CACHE_PROBATION];
+        size_t     windowMax = maxSize / 100u;
+
+        Entry     *ePtr = windowPtr->lastEntryPtr;
+
+        /*
+         * Entries, which cannot be evicted, stay in the window, older
+         * entries are moved nevertheless.
+         */
+        while (windowPtr->size > windowMax && ePtr != NULL) {
+            Entry *prevPtr = ePtr->prevPtr;
+
+            if (Evictable(ePtr, keepPtr)) {
+                Remove(ePtr);
+                ePtr->segment = CACHE_PROBATION;
+                Push(ePtr);
+            }
+            ePtr = prevPtr;
+        }
+
+        while (cachePtr->currentSize > maxSize) {
+            Entry *candidatePtr = probationPtr->firstEntryPtr;
+
+            while (candidatePtr != NULL && !Evictable(candidatePtr, keepPtr)) {
+                candidatePtr = candidatePtr->nextPtr;
+            }
+            victimPtr = Victim(cachePtr, keepPtr, candidatePtr, NS_FALSE);
+
+            if (victimPtr == NULL) {
+                if (candidatePtr == NULL) {
+                    break;
+                }
+                victimPtr = candidatePtr;
+
+            } else if (candidatePtr != NULL) {
+                if (SketchFrequency(cachePtr, candidatePtr->hash)
+                    > SketchFrequency(cachePtr, victimPtr->hash)) {
+                    ++cachePtr->stats.nadmitted;
+                } else {
+                    ++cachePtr->stats.nrejected;
+                    victimPtr = candidatePtr;
+                }
+            }
+            Ns_CacheDeleteEntry((Ns_Entry *) victimPtr);
+            ++cachePtr->stats.npruned;
+        }
+    }
+
+    /*
+     * Evict the least recently used entries. With TinyLFU, this is only
+     * needed when the main region has no evictable entries left.
+     */
+    while (cachePtr->currentSize > maxSize
+           && (victimPtr = Victim(cachePtr, keepPtr, NULL, NS_TRUE)) != NULL) {
+        Ns_CacheDeleteEntry((Ns_Entry *) victimPtr);
+        ++cachePtr->stats.npruned;
+    }
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * Victim --
+ *
+ *      Return the entry to be evicted next: the least recently used
+ *      evictable entry of the probation segment, then of the protected
+ *      segment and, when withWindow is set, of the window. Entries under
+ *      construction, keepPtr and candidatePtr are skipped.
+ *
+ * Results:
+ *      Entry or NULL, when no entry can be evicted.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static Entry *
+Victim(const Cache *cachePtr, const Entry *keepPtr, const Entry *candidatePtr, bool withWindow)
+{
+    static const int order[] = {CACHE_PROBATION, CACHE_PROTECTED, CACHE_WINDOW};
+    Entry           *result = NULL;
+    size_t           i, n = withWindow ? 3u : 2u;
+
+    NS_NONNULL_ASSERT(cachePtr != NULL);
+    NS_NONNULL_ASSERT(keepPtr != NULL);
+
+    for (i = 0u; i < n && result == NULL; i++) {
+        Entry *ePtr;
+
+        for (ePtr = cachePtr->segments[order[i]].lastEntryPtr; ePtr != NULL; ePtr = ePtr->prevPtr) {
+            if (ePtr != candidatePtr && Evictable(ePtr, keepPtr)) {
+                result = ePtr;
+                break;
+            }
+        }
+    }
+    return result;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * Evictable --
+ *
+ *      Check, whether an entry might be evicted. Entries under
+ *      construction (with a value of NULL) and the entry keepPtr are
+ *      never evicted.
+ *
+ * Results:
+ *      Boolean value.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static inline bool
+Evictable(const Entry *ePtr, const Entry *keepPtr)
+{
+    return (ePtr != keepPtr && ePtr->value != NULL);
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * ShardMaxSize --
+ *
+ *      Return the maximum size of a cache. Every shard gets an equal part
+ *      of the size of the sharded cache.
+ *
+ * Results:
+ *      Size in bytes, 0 for unlimited.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static size_t
+ShardMaxSize(const Cache *cachePtr)
+{
+    size_t maxSize;
+
+    NS_NONNULL_ASSERT(cachePtr != NULL);
+
+    maxSize = cachePtr->maxSize;
+    if (cachePtr->parentPtr != NULL && maxSize > 0u) {
+        maxSize = maxSize / (size_t)cachePtr->parentPtr->nshards;
+        if (maxSize == 0u) {
+            maxSize = 1u;
+        }
+    }
+    return maxSize;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * SetPolicy --
+ *
+ *      Change the eviction policy of a single cache or shard. When
+ *      switching to LRU, the segments are merged into the LRU list, the
+ *      protected entries becoming the most recently used ones. When
+ *      switching to TinyLFU, all entries start in the window.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      The frequency sketch is freed when switching to LRU.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+SetPolicy(Cache *cachePtr, Ns_CachePolicy policy)
+{
+    NS_NONNULL_ASSERT(cachePtr != NULL);
+
+    if (policy != cachePtr->policy) {
+        if (policy == NS_CACHE_POLICY_LRU) {
+            int segment;
+
+            for (segment = CACHE_PROBATION; segment <= CACHE_PROTECTED; segment++) {
+                Entry *ePtr;
+
+                while ((ePtr = cachePtr->segments[segment].lastEntryPtr) != NULL) {
+                    Remove(ePtr);
+                    ePtr->segment = CACHE_WINDOW;
+                    Push(ePtr);
+                }
+            }
+            ns_free(cachePtr->sketch.counters);
+            memset(&cachePtr->sketch, 0, sizeof(cachePtr->sketch));
+        } else {
+            Tcl_HashSearch       search;
+            const Tcl_HashEntry *hPtr;
+
+            for (hPtr = Tcl_FirstHashEntry(&cachePtr->entriesTable, &search);
+                 hPtr != NULL;
+                 hPtr = Tcl_NextHashEntry(&search)) {
+                Entry *ePtr = Tcl_GetHashValue(hPtr);
+
+                ePtr->hash = KeyHash(cachePtr->keys,
+                                     Tcl_GetHashKey(&cachePtr->entriesTable, hPtr));
+            }
+        }
+        cachePtr->policy = policy;
+    }
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * SketchIncrement, SketchFrequency --
+ *
+ *      Increment and estimate the access frequency of a key in the
+ *      count-min sketch of the cache. The sketch is (re)allocated on
+ *      demand with at least twice as many counters per row as the cache
+ *      has entries. When the sketch grows, every old counter is copied
+ *      to all new counters sharing its index bits, such that the
+ *      estimated frequencies are kept. After SKETCH_SAMPLE_FACTOR
+ *      increments per counter of a row, all counters are halved.
+ *
+ * Results:
+ *      SketchFrequency() returns the estimated frequency.
+ *
+ * Side effects:
+ *      SketchIncrement() might allocate the sketch.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static inline uint32_t
+SketchIndex(uint32_t hash, int row, uint32_t width)
+{
+    static const uint32_t seeds[SKETCH_DEPTH] = {
+        0x97cb3127u, 0xab0e9789u, 0x38b0a1c5u, 0x7a4c1e33u
+    };
+    uint32_t h = hash * seeds[row];
+
+    h ^= h >> 16;
+    return ((uint32_t)row * width) + (h & (width - 1u));
+}
+
+static void
+SketchIncrement(Cache *cachePtr, uint32_t hash)
+{
+    FrequencySketch *sketchPtr;
+    uint32_t         needed;
+    unsigned int     frequency;
+
+    NS_NONNULL_ASSERT(cachePtr != NULL);
+
+    sketchPtr = &cachePtr->sketch;
+    needed = (uint32_t)cachePtr->entriesTable.numEntries * 2u;
+    if (sketchPtr->counters == NULL
+        || (needed > sketchPtr->width && sketchPtr->width < SKETCH_MAX_WIDTH)) {
+        uint32_t       width = SKETCH_MIN_WIDTH;
+        unsigned char *counters;
+
+        while (width < needed && width < SKETCH_MAX_WIDTH) {
+            width <<= 1;
+        }
+        counters = ns_calloc((size_t)width * SKETCH_DEPTH, 1u);
+        if (sketchPtr->counters != NULL) {
+            /*
+             * SketchIndex() uses the low bits of the hash, so the counter
+             * of a key in the old sketch is at index "i", in the new
+             * sketch at one of the indices "i + k * oldWidth".
+             */
+            uint32_t oldWidth = sketchPtr->width;
+            int      row;
+
+            for (row = 0; row < SKETCH_DEPTH; row++) {
+                const unsigned char *fromPtr = &sketchPtr->counters[(size_t)row * oldWidth];
+                unsigned char       *toPtr = &counters[(size_t)row * width];
+                uint32_t             offset;
+
+                for (offset = 0u; offset < width; offset += oldWidth) {
+                    memcpy(toPtr + offset, fromPtr, (size_t)oldWidth);
+                }
+            }
+            ns_free(sketchPtr->counters);
+        } else {
+            sketchPtr->additions = 0u;
+        }
+        sketchPtr->counters = counters;
+        sketchPtr->width = width;
+    }
+
+    frequency = SketchFrequency(cachePtr, hash);
+    if (frequency < SKETCH_MAX_COUNT) {
+        int row;
+
+        for (row = 0; row < SKETCH_DEPTH; row++) {
+            unsigned char *counterPtr = &sketchPtr->counters[SketchIndex(hash, row, sketchPtr->width)];
+
+            if (*counterPtr == frequency) {
+                (*counterPtr)++;
+            }
+        }
+
+        if (++sketchPtr->additions >= SKETCH_SAMPLE_FACTOR * sketchPtr->width) {
+            size_t i, n = (size_t)sketchPtr->width * SKETCH_DEPTH;
+
+            for (i = 0u; i < n; i++) {
+                sketchPtr->counters[i] >>= 1;
+            }
+            sketchPtr->additions /= 2u;
+        }
+    }
+}
+
+static unsigned int
+SketchFrequency(const Cache *cachePtr, uint32_t hash)
+{
+    const FrequencySketch *sketchPtr;
+    unsigned int           result = 0u;
+
+    NS_NONNULL_ASSERT(cachePtr != NULL);
+
+    sketchPtr = &cachePtr->sketch;
+    if (sketchPtr->counters != NULL) {
+        int row;
+
+        result = SKETCH_MAX_COUNT;
+        for (row = 0; row < SKETCH_DEPTH; row++) {
+            unsigned int count = sketchPtr->counters[SketchIndex(hash, row, sketchPtr->width)];
+
+            if (count < result) {
+                result = count;
+            }
+        }
+    }
+    return result;
 }
 
 
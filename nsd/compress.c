@@ -12,14 +12,78 @@
 /*
  * compress.c --
  *
- *      Support for gzip compression using Zlib.
+ *      Support for gzip compression using Zlib, for on-the-fly Brotli
+ *      compression using the Brotli encoder library, and for zstd
+ *      compression and decompression using the Zstandard library. The
+ *      compression streams of the connections are kept in a pool.
  */
 
 #include "nsd.h"
 
-#ifdef HAVE_ZLIB_H
+#ifdef HAVE_BROTLI
+# include <brotli/encode.h>
+
+static void *BrotliAlloc(void *UNUSED(opaque), size_t size);
+static void BrotliFree(void *UNUSED(opaque), void *address);
+#endif
+
+#ifdef HAVE_ZSTD
+# include <zstd.h>
+
+/*
+ * State of a zstd stream, kept in Ns_CompressStream.zstd. A stream is
+ * either used for compression or for decompression; the input buffer is
+ * used only for decompression. The compression context of a pooled
+ * stream is kept between frames, "inFrame" tells whether a frame was
+ * started.
+ */
+typedef struct ZstdStream {
+    ZSTD_CCtx      *cctx;
+    ZSTD_DCtx      *dctx;
+    ZSTD_inBuffer   input;
+    bool            inFrame;
+} ZstdStream;
+#endif
 
-# define COMPRESS_SENT_HEADER 0x01u
+#define COMPRESS_SENT_HEADER 0x01u
+#define COMPRESS_POOLED      0x02u
+
+/*
+ * Pool of idle compression streams. A stream is returned to the pool
+ * after a response with its deflate state (about 400KB) and its zstd
+ * context, such that these are not allocated and initialized for every
+ * compressed response.
+ */
+static struct {
+    Ns_Mutex            lock;
+    Ns_CompressStream **idle;      /* stack of idle streams */
+    int                 nidle;
+    int                 size;      /* max number of idle streams */
+    int                 inuse;
+    unsigned long       gets;
+    unsigned long       reused;
+    unsigned long       created;
+    unsigned long       discarded;
+} compressPool;
+
+static void CompressStreamReset(Ns_CompressStream *cStream)
+    NS_GNUC_NONNULL(1);
+
+static double AdaptLoad(double *valuePtr, Ns_Mutex *lockPtr)
+    NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(2);
+static double AdaptSmooth(double *valuePtr, double sample, Ns_Mutex *lockPtr)
+    NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(3);
+
+static TCL_OBJCMDPROC_T CompressStatsObjCmd;
+
+/*
+ * Adaptive compression: number of steps for lowering the levels, and
+ * weight of a new sample in the smoothed load.
+ */
+#define COMPRESS_ADAPT_MAXSTEP 4
+#define COMPRESS_ADAPT_ALPHA   0.2
+
+#ifdef HAVE_ZLIB_H
 
 
 /*
@@ -55,6 +119,8 @@ Ns_CompressInit(Ns_CompressStream *cStream)
     Ns_ReturnCode status = NS_OK;
 
     cStream->flags = 0u;
+    cStream->brotli = NULL;
+    cStream->zstd = NULL;
     z->zalloc = ZAlloc;
     z->zfree = ZFree;
     z->opaque = Z_NULL;
@@ -103,6 +169,8 @@ Ns_CompressFree(Ns_CompressStream *cStream)
                    status, zError(status), (z->msg != NULL) ? z->msg : "(unknown)");
         }
     }
+    NsCompressBrotliEnd(cStream);
+    NsCompressZstdEnd(cStream);
 }
 
 /*
@@ -285,7 +353,7 @@ Ns_CompressBufsGzip(Ns_CompressStream *cStream, struct iovec *bufs, int nbufs,
 
     if (flush) {
         (void) deflateReset(z);
-        cStream->flags = 0u;
+        cStream->flags &= ~COMPRESS_SENT_HEADER;
     }
 
     return NS_OK;
@@ -311,18 +379,18 @@ Ns_CompressBufsGzip(Ns_CompressStream *cStream, struct iovec *bufs, int nbufs,
 Ns_ReturnCode
 Ns_CompressGzip(const char *buf, int len, Tcl_DString *dsPtr, int level)
 {
-    Ns_CompressStream  cStream;
+    Ns_CompressStream *cStream;
     struct iovec       iov;
-    Ns_ReturnCode      status;
+    Ns_ReturnCode      status = NS_ERROR;
 
     NS_NONNULL_ASSERT(buf != NULL);
     NS_NONNULL_ASSERT(dsPtr != NULL);
 
-    status = Ns_CompressInit(&cStream);
-    if (status == NS_OK) {
+    cStream = NsCompressStreamGet();
+    if (cStream != NULL) {
         (void)Ns_SetVec(&iov, 0, buf, (size_t)len);
-        status = Ns_CompressBufsGzip(&cStream, &iov, 1, dsPtr, level, NS_TRUE);
-        Ns_CompressFree(&cStream);
+        status = Ns_CompressBufsGzip(cStream, &iov, 1, dsPtr, level, NS_TRUE);
+        NsCompressStreamRelease(cStream);
     }
 
     return status;
@@ -396,15 +464,19 @@ ZFree(voidpf UNUSED(arg), voidpf address)
 #else /* ! HAVE_ZLIB_H */
 
 Ns_ReturnCode
-Ns_CompressInit(Ns_CompressStream *UNUSED(cStream))
+Ns_CompressInit(Ns_CompressStream *cStream)
 {
+    cStream->flags = 0u;
+    cStream->brotli = NULL;
+    cStream->zstd = NULL;
     return NS_ERROR;
 }
 
 void
-Ns_CompressFree(Ns_CompressStream *UNUSED(cStream))
+Ns_CompressFree(Ns_CompressStream *cStream)
 {
-    return;
+    NsCompressBrotliEnd(cStream);
+    NsCompressZstdEnd(cStream);
 }
 
 Ns_ReturnCode
@@ -446,6 +518,1037 @@ Ns_InflateEnd(Ns_CompressStream *UNUSED(cStream))
 
 #endif
 
+#ifdef HAVE_BROTLI
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * Ns_CompressBufsBrotli --
+ *
+ *      Compress a vector of bufs with Brotli and append the result to
+ *      the dstring. The encoder is created on the first call of a
+ *      response and destroyed when "flush" is true, i.e. when the last
+ *      chunk was compressed. Without "flush", the output is flushed so
+ *      that every streamed chunk can be decoded by the client right away.
+ *
+ * Results:
+ *      NS_OK or NS_ERROR, when the encoder could not be created or
+ *      failed.
+ *
+ * Side effects:
+ *      Allocates and frees the encoder state in cStream->brotli.
+ *
+ *----------------------------------------------------------------------
+ */
+
+Ns_ReturnCode
+Ns_CompressBufsBrotli(Ns_CompressStream *cStream, struct iovec *bufs, int nbufs,
+                      Tcl_DString *dsPtr, int quality, int window, bool flush)
+{
+    BrotliEncoderState *state;
+    BrotliEncoderOperation op;
+    Ns_ReturnCode       status = NS_OK;
+    int                 i;
+
+    NS_NONNULL_ASSERT(cStream != NULL);
+    NS_NONNULL_ASSERT(dsPtr != NULL);
+
+    state = cStream->brotli;
+    if (state == NULL) {
+        state = BrotliEncoderCreateInstance(BrotliAlloc, BrotliFree, NULL);
+        if (state == NULL) {
+            Ns_Log(Error, "Ns_CompressBufsBrotli: cannot create encoder");
+            return NS_ERROR;
+        }
+        (void) BrotliEncoderSetParameter(state, BROTLI_PARAM_QUALITY,
+                                         (uint32_t)MIN(MAX(quality, BROTLI_MIN_QUALITY),
+                                                       BROTLI_MAX_QUALITY));
+        (void) BrotliEncoderSetParameter(state, BROTLI_PARAM_LGWIN,
+                                         (uint32_t)MIN(MAX(window, BROTLI_MIN_WINDOW_BITS),
+                                                       BROTLI_MAX_WINDOW_BITS));
+        cStream->brotli = state;
+    }
+
+    /*
+     * Feed all buffers to the encoder and finally flush or finish the
+     * stream. The output is collected from the encoder's internal
+     * buffer, so no output size estimate is needed.
+     */
+    for (i = 0; i <= nbufs && status == NS_OK; i++) {
+        const uint8_t *nextIn;
+        size_t         availIn;
+
+        if (i < nbufs) {
+            nextIn  = (const uint8_t *)bufs[i].iov_base;
+            availIn = bufs[i].iov_len;
+            op = BROTLI_OPERATION_PROCESS;
+        } else {
+            nextIn  = NULL;
+            availIn = 0u;
+            op = flush ? BROTLI_OPERATION_FINISH : BROTLI_OPERATION_FLUSH;
+        }
+        for (;;) {
+            size_t         availOut = 0u, outSize = 0u;
+            const uint8_t *out;
+
+            if (BrotliEncoderCompressStream(state, op, &availIn, &nextIn,
+                                            &availOut, NULL, NULL) == BROTLI_FALSE) {
+                Ns_Log(Error, "Ns_CompressBufsBrotli: compression failed");
+                status = NS_ERROR;
+                break;
+            }
+            out = BrotliEncoderTakeOutput(state, &outSize);
+            if (outSize > 0u) {
+                Tcl_DStringAppend(dsPtr, (const char *)out, (TCL_SIZE_T)outSize);
+            }
+            if (op == BROTLI_OPERATION_FINISH) {
+                if (BrotliEncoderIsFinished(state) == BROTLI_TRUE) {
+                    break;
+                }
+            } else if (availIn == 0u && BrotliEncoderHasMoreOutput(state) == BROTLI_FALSE) {
+                break;
+            }
+        }
+    }
+
+    if (flush || status != NS_OK) {
+        NsCompressBrotliEnd(cStream);
+    }
+    return status;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * Ns_CompressBrotli --
+ *
+ *      Compress a buffer with Brotli in one step.
+ *
+ * Results:
+ *      NS_OK or NS_ERROR.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+Ns_ReturnCode
+Ns_CompressBrotli(const char *buf, int len, Tcl_DString *dsPtr, int quality)
+{
+    Ns_CompressStream  cStream;
+    struct iovec       iov;
+
+    NS_NONNULL_ASSERT(buf != NULL);
+    NS_NONNULL_ASSERT(dsPtr != NULL);
+
+    memset(&cStream, 0, sizeof(cStream));
+    (void)Ns_SetVec(&iov, 0, buf, (size_t)len);
+
+    return Ns_CompressBufsBrotli(&cStream, &iov, 1, dsPtr, quality,
+                                 BROTLI_DEFAULT_WINDOW, NS_TRUE);
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * NsCompressBrotliEnd --
+ *
+ *      Destroy a Brotli encoder left in the stream, e.g. when a
+ *      streamed response was not finished due to a client abort.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Frees the encoder state.
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+NsCompressBrotliEnd(Ns_CompressStream *cStream)
+{
+    NS_NONNULL_ASSERT(cStream != NULL);
+
+    if (cStream->brotli != NULL) {
+        BrotliEncoderDestroyInstance(cStream->brotli);
+        cStream->brotli = NULL;
+    }
+}
+
+static void *
+BrotliAlloc(void *UNUSED(opaque), size_t size)
+{
+    return ns_malloc(size);
+}
+
+static void
+BrotliFree(void *UNUSED(opaque), void *address)
+{
+    ns_free(address);
+}
+
+#else /* ! HAVE_BROTLI */
+
+Ns_ReturnCode
+Ns_CompressBufsBrotli(Ns_CompressStream *UNUSED(cStream), struct iovec *UNUSED(bufs), int UNUSED(nbufs),
+                      Tcl_DString *UNUSED(dsPtr), int UNUSED(quality), int UNUSED(window),
+                      bool UNUSED(flush))
+{
+    return NS_ERROR;
+}
+
+Ns_ReturnCode
+Ns_CompressBrotli(const char *UNUSED(buf), int UNUSED(len), Tcl_DString *UNUSED(dsPtr), int UNUSED(quality))
+{
+    return NS_ERROR;
+}
+
+void
+NsCompressBrotliEnd(Ns_CompressStream *UNUSED(cStream))
+{
+    return;
+}
+
+#endif
+
+#ifdef HAVE_ZSTD
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * Ns_CompressBufsZstd --
+ *
+ *      Compress a vector of bufs with zstd and append the result to the
+ *      dstring. The compression context is created on the first call of
+ *      a response and freed when "flush" is true, i.e. when the frame was
+ *      completed; the context of a pooled stream is kept for the next
+ *      frame. Without "flush", the output is flushed so that every
+ *      streamed chunk can be decoded by the client right away.
+ *
+ * Results:
+ *      NS_OK or NS_ERROR, when the context could not be created or the
+ *      compression failed.
+ *
+ * Side effects:
+ *      Allocates and frees the compression state in cStream->zstd.
+ *
+ *----------------------------------------------------------------------
+ */
+
+Ns_ReturnCode
+Ns_CompressBufsZstd(Ns_CompressStream *cStream, struct iovec *bufs, int nbufs,
+                    Tcl_DString *dsPtr, int level, bool flush)
+{
+    ZstdStream    *zsPtr;
+    Ns_ReturnCode  status = NS_OK;
+    size_t         outChunk = ZSTD_CStreamOutSize();
+    int            i;
+
+    NS_NONNULL_ASSERT(cStream != NULL);
+    NS_NONNULL_ASSERT(dsPtr != NULL);
+
+    zsPtr = cStream->zstd;
+    if (zsPtr == NULL) {
+        zsPtr = ns_calloc(1u, sizeof(ZstdStream));
+        cStream->zstd = zsPtr;
+    }
+    if (zsPtr->cctx == NULL) {
+        zsPtr->cctx = ZSTD_createCCtx();
+        if (zsPtr->cctx == NULL) {
+            Ns_Log(Error, "Ns_CompressBufsZstd: cannot create compression context");
+            NsCompressZstdEnd(cStream);
+            return NS_ERROR;
+        }
+    }
+    if (!zsPtr->inFrame) {
+        (void) ZSTD_CCtx_setParameter(zsPtr->cctx, ZSTD_c_compressionLevel,
+                                      MIN(MAX(level, 1), ZSTD_maxCLevel()));
+        zsPtr->inFrame = NS_TRUE;
+    }
+
+    /*
+     * Feed all buffers to the compressor and finally flush the data or
+     * end the frame. Every call writes at most "outChunk" bytes, so the
+     * dstring is extended step by step.
+     */
+    for (i = 0; i <= nbufs && status == NS_OK; i++) {
+        ZSTD_inBuffer     input = {NULL, 0u, 0u};
+        ZSTD_EndDirective mode;
+        bool              finished;
+
+        if (i < nbufs) {
+            input.src  = bufs[i].iov_base;
+            input.size = bufs[i].iov_len;
+            mode = ZSTD_e_continue;
+        } else {
+            mode = flush ? ZSTD_e_end : ZSTD_e_flush;
+        }
+        do {
+            TCL_SIZE_T     offset = dsPtr->length;
+            ZSTD_outBuffer output;
+            size_t         remaining;
+
+            Tcl_DStringSetLength(dsPtr, offset + (TCL_SIZE_T)outChunk);
+            output.dst  = dsPtr->string + offset;
+            output.size = outChunk;
+            output.pos  = 0u;
+
+            remaining = ZSTD_compressStream2(zsPtr->cctx, &output, &input, mode);
+            Tcl_DStringSetLength(dsPtr, offset + (TCL_SIZE_T)output.pos);
+
+            if (ZSTD_isError(remaining)) {
+                Ns_Log(Error, "Ns_CompressBufsZstd: compression failed: %s",
+                       ZSTD_getErrorName(remaining));
+                status = NS_ERROR;
+                break;
+            }
+            finished = (mode == ZSTD_e_continue) ? (input.pos == input.size) : (remaining == 0u);
+        } while (!finished);
+    }
+
+    if (status != NS_OK || (flush && (cStream->flags & COMPRESS_POOLED) == 0u)) {
+        NsCompressZstdEnd(cStream);
+    } else if (flush) {
+        zsPtr->inFrame = NS_FALSE;
+    }
+    return status;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * Ns_CompressZstd --
+ *
+ *      Compress a buffer with zstd in one step.
+ *
+ * Results:
+ *      NS_OK or NS_ERROR.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+Ns_ReturnCode
+Ns_CompressZstd(const char *buf, int len, Tcl_DString *dsPtr, int level)
+{
+    Ns_CompressStream *cStream;
+    struct iovec       iov;
+    Ns_ReturnCode      status = NS_ERROR;
+
+    NS_NONNULL_ASSERT(buf != NULL);
+    NS_NONNULL_ASSERT(dsPtr != NULL);
+
+    cStream = NsCompressStreamGet();
+    if (cStream != NULL) {
+        (void)Ns_SetVec(&iov, 0, buf, (size_t)len);
+        status = Ns_CompressBufsZstd(cStream, &iov, 1, dsPtr, level, NS_TRUE);
+        NsCompressStreamRelease(cStream);
+    }
+
+    return status;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * Ns_ZstdDecompressInit, Ns_ZstdDecompressBufferInit,
+ * Ns_ZstdDecompressBuffer, Ns_ZstdDecompressEnd --
+ *
+ *      Initialize a zstd decompression stream, decompress from the
+ *      stream and terminate the stream. The functions follow the
+ *      conventions of the Ns_Inflate* functions: Ns_ZstdDecompressBuffer()
+ *      returns TCL_CONTINUE, when the output buffer was filled and has to
+ *      be called again.
+ *
+ * Results:
+ *      Ns_ReturnCode or Tcl result code.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+Ns_ReturnCode
+Ns_ZstdDecompressInit(Ns_CompressStream *cStream)
+{
+    ZstdStream    *zsPtr;
+    Ns_ReturnCode  status = NS_OK;
+
+    NS_NONNULL_ASSERT(cStream != NULL);
+
+    zsPtr = ns_calloc(1u, sizeof(ZstdStream));
+    zsPtr->dctx = ZSTD_createDCtx();
+    if (zsPtr->dctx == NULL) {
+        Ns_Log(Error, "Ns_ZstdDecompressInit: cannot create decompression context");
+        ns_free(zsPtr);
+        zsPtr = NULL;
+        status = NS_ERROR;
+    }
+    cStream->zstd = zsPtr;
+
+    return status;
+}
+
+Ns_ReturnCode
+Ns_ZstdDecompressBufferInit(Ns_CompressStream *cStream, const char *buffer, size_t inSize)
+{
+    ZstdStream *zsPtr = cStream->zstd;
+
+    if (zsPtr == NULL) {
+        return NS_ERROR;
+    }
+    zsPtr->input.src  = buffer;
+    zsPtr->input.size = inSize;
+    zsPtr->input.pos  = 0u;
+
+    return NS_OK;
+}
+
+int
+Ns_ZstdDecompressBuffer(Ns_CompressStream *cStream, const char *buffer, size_t outSize, size_t *nrBytes)
+{
+    ZstdStream     *zsPtr = cStream->zstd;
+    ZSTD_outBuffer  output;
+    size_t          rc;
+    int             tclStatus = TCL_OK;
+
+    if (zsPtr == NULL || zsPtr->dctx == NULL) {
+        *nrBytes = 0u;
+        return TCL_ERROR;
+    }
+    output.dst  = (void *)buffer;
+    output.size = outSize;
+    output.pos  = 0u;
+
+    rc = ZSTD_decompressStream(zsPtr->dctx, &output, &zsPtr->input);
+    if (ZSTD_isError(rc)) {
+        Ns_Log(Error, "Ns_ZstdDecompressBuffer: %s", ZSTD_getErrorName(rc));
+        tclStatus = TCL_ERROR;
+    } else if (output.pos == outSize || zsPtr->input.pos < zsPtr->input.size) {
+        /*
+         * Output buffer is full, or the input contains a further frame.
+         */
+        tclStatus = TCL_CONTINUE;
+    }
+    *nrBytes = output.pos;
+
+    return tclStatus;
+}
+
+Ns_ReturnCode
+Ns_ZstdDecompressEnd(Ns_CompressStream *cStream)
+{
+    NsCompressZstdEnd(cStream);
+    return NS_OK;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * NsCompressZstdEnd --
+ *
+ *      Free the zstd state of a stream, e.g. when a streamed response
+ *      was not finished due to a client abort.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Frees the compression or decompression context.
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+NsCompressZstdEnd(Ns_CompressStream *cStream)
+{
+    ZstdStream *zsPtr;
+
+    NS_NONNULL_ASSERT(cStream != NULL);
+
+    zsPtr = cStream->zstd;
+    if (zsPtr != NULL) {
+        if (zsPtr->cctx != NULL) {
+            (void) ZSTD_freeCCtx(zsPtr->cctx);
+        }
+        if (zsPtr->dctx != NULL) {
+            (void) ZSTD_freeDCtx(zsPtr->dctx);
+        }
+        ns_free(zsPtr);
+        cStream->zstd = NULL;
+    }
+}
+
+#else /* ! HAVE_ZSTD */
+
+Ns_ReturnCode
+Ns_CompressBufsZstd(Ns_CompressStream *UNUSED(cStream), struct iovec *UNUSED(bufs), int UNUSED(nbufs),
+                    Tcl_DString *UNUSED(dsPtr), int UNUSED(level), bool UNUSED(flush))
+{
+    return NS_ERROR;
+}
+
+Ns_ReturnCode
+Ns_CompressZstd(const char *UNUSED(buf), int UNUSED(len), Tcl_DString *UNUSED(dsPtr), int UNUSED(level))
+{
+    return NS_ERROR;
+}
+
+Ns_ReturnCode
+Ns_ZstdDecompressInit(Ns_CompressStream *UNUSED(cStream))
+{
+    return NS_ERROR;
+}
+
+Ns_ReturnCode
+Ns_ZstdDecompressBufferInit(Ns_CompressStream *UNUSED(cStream), const char *UNUSED(buffer),
+                            size_t UNUSED(inSize))
+{
+    return NS_ERROR;
+}
+
+int
+Ns_ZstdDecompressBuffer(Ns_CompressStream *UNUSED(cStream), const char *UNUSED(buffer),
+                        size_t UNUSED(outSize), size_t *UNUSED(nrBytes))
+{
+    return TCL_ERROR;
+}
+
+Ns_ReturnCode
+Ns_ZstdDecompressEnd(Ns_CompressStream *UNUSED(cStream))
+{
+    return NS_ERROR;
+}
+
+void
+NsCompressZstdEnd(Ns_CompressStream *UNUSED(cStream))
+{
+    return;
+}
+
+#endif
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * NsConfigCompress --
+ *
+ *      Configure the pool of compression streams from the global
+ *      section "ns/compress".
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Allocates the stack of idle streams.
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+NsConfigCompress(void)
+{
+    const char *section = Ns_ConfigSectionPath(NULL, NULL, NULL, "compress", NS_SENTINEL);
+
+    Ns_MutexInit(&compressPool.lock);
+    Ns_MutexSetName2(&compressPool.lock, "ns:compress", "pool");
+    compressPool.size = Ns_ConfigIntRange(section, "poolsize", 16, 0, INT_MAX);
+    compressPool.idle = ns_calloc((size_t)MAX(compressPool.size, 1), sizeof(Ns_CompressStream *));
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * NsCompressStreamGet, NsCompressStreamRelease --
+ *
+ *      Get a compression stream from the pool of idle streams or create
+ *      a new one, and return it after use. A returned stream is reset
+ *      and kept in the pool, unless the pool is full. The deflate state
+ *      and the zstd context are reset and reused; Brotli encoders cannot
+ *      be reset and are freed.
+ *
+ * Results:
+ *      Compression stream or NULL, when the deflate state could not be
+ *      initialized (NsCompressStreamGet).
+ *
+ * Side effects:
+ *      Might allocate or free a stream.
+ *
+ *----------------------------------------------------------------------
+ */
+
+Ns_CompressStream *
+NsCompressStreamGet(void)
+{
+    Ns_CompressStream *cStream = NULL;
+
+    Ns_MutexLock(&compressPool.lock);
+    compressPool.gets++;
+    compressPool.inuse++;
+    if (compressPool.nidle > 0) {
+        cStream = compressPool.idle[--compressPool.nidle];
+        compressPool.reused++;
+    } else {
+        compressPool.created++;
+    }
+    Ns_MutexUnlock(&compressPool.lock);
+
+    if (cStream == NULL) {
+        cStream = ns_malloc(sizeof(Ns_CompressStream));
+#ifdef HAVE_ZLIB_H
+        if (Ns_CompressInit(cStream) != NS_OK) {
+            ns_free(cStream);
+            Ns_MutexLock(&compressPool.lock);
+            compressPool.inuse--;
+            compressPool.created--;
+            Ns_MutexUnlock(&compressPool.lock);
+            return NULL;
+        }
+#else
+        (void) Ns_CompressInit(cStream);
+#endif
+        cStream->flags = COMPRESS_POOLED;
+    }
+    return cStream;
+}
+
+void
+NsCompressStreamRelease(Ns_CompressStream *cStream)
+{
+    bool keep;
+
+    NS_NONNULL_ASSERT(cStream != NULL);
+
+    CompressStreamReset(cStream);
+
+    Ns_MutexLock(&compressPool.lock);
+    compressPool.inuse--;
+    keep = (compressPool.nidle < compressPool.size);
+    if (keep) {
+        compressPool.idle[compressPool.nidle++] = cStream;
+    } else {
+        compressPool.discarded++;
+    }
+    Ns_MutexUnlock(&compressPool.lock);
+
+    if (!keep) {
+        Ns_CompressFree(cStream);
+        ns_free(cStream);
+    }
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * NsCompressPoolFill --
+ *
+ *      Create idle compression streams in advance, until the pool
+ *      contains "n" streams or is full.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Allocates streams.
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+NsCompressPoolFill(int n)
+{
+    int i, missing;
+
+    Ns_MutexLock(&compressPool.lock);
+    missing = MIN(n, compressPool.size) - compressPool.nidle;
+    Ns_MutexUnlock(&compressPool.lock);
+
+    for (i = 0; i < missing; i++) {
+        Ns_CompressStream *cStream = NsCompressStreamGet();
+
+        if (cStream == NULL) {
+            break;
+        }
+        NsCompressStreamRelease(cStream);
+    }
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * AdaptLoad, AdaptSmooth --
+ *
+ *      Read resp. update a smoothed load value of the adaptive
+ *      compression controller. With atomic builtins, the values are
+ *      accessed without locking; concurrent updates may drop a sample,
+ *      which is irrelevant for a moving average. Otherwise, the
+ *      controller lock is used.
+ *
+ * Results:
+ *      Current resp. new value.
+ *
+ * Side effects:
+ *      AdaptSmooth() updates the value.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static double
+AdaptLoad(double *valuePtr, Ns_Mutex *lockPtr)
+{
+    double value;
+
+#ifdef NS_HAVE_ATOMIC_BUILTINS
+    (void)lockPtr;
+    __atomic_load(valuePtr, &value, __ATOMIC_RELAXED);
+#else
+    Ns_MutexLock(lockPtr);
+    value = *valuePtr;
+    Ns_MutexUnlock(lockPtr);
+#endif
+    return value;
+}
+
+static double
+AdaptSmooth(double *valuePtr, double sample, Ns_Mutex *lockPtr)
+{
+    double value;
+
+#ifdef NS_HAVE_ATOMIC_BUILTINS
+    (void)lockPtr;
+    __atomic_load(valuePtr, &value, __ATOMIC_RELAXED);
+    value += COMPRESS_ADAPT_ALPHA * (sample - value);
+    __atomic_store(valuePtr, &value, __ATOMIC_RELAXED);
+#else
+    Ns_MutexLock(lockPtr);
+    value = *valuePtr + COMPRESS_ADAPT_ALPHA * (sample - *valuePtr);
+    *valuePtr = value;
+    Ns_MutexUnlock(lockPtr);
+#endif
+    return value;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * NsCompressAdapt --
+ *
+ *      Feed the load at the time of a compressed response into the
+ *      adaptive compression controller of the server and return the
+ *      step by which the compression levels are lowered. The load is
+ *      the queueing delay of the request and the percentage of busy
+ *      connection threads of its pool, both smoothed. When the load is
+ *      above "compressadaptivedelay" or "compressadaptivebusy", the step
+ *      is increased, when it is below half of both, the step is
+ *      decreased. The controller is evaluated at most once per
+ *      "compressadaptiveinterval"; only this evaluation takes the lock,
+ *      all other responses just feed the load and read the step.
+ *
+ * Results:
+ *      Step (0 for the configured levels), or -1, when the response
+ *      should not be compressed.
+ *
+ * Side effects:
+ *      Updates the controller state and statistics of the server.
+ *
+ *----------------------------------------------------------------------
+ */
+
+int
+NsCompressAdapt(NsServer *servPtr, const Conn *connPtr, size_t length, bool streaming)
+{
+    const ConnPool *poolPtr = connPtr->poolPtr;
+    Ns_Mutex       *lockPtr = &servPtr->compress.adaptive.lock;
+    Ns_Time         delay, now;
+    double          delaySec, queueDelay, busyPercent, busy;
+    Tcl_WideInt     nowUs;
+    int             step, current, idle;
+
+    NS_NONNULL_ASSERT(servPtr != NULL);
+    NS_NONNULL_ASSERT(connPtr != NULL);
+
+    (void)Ns_DiffTime(&connPtr->requestDequeueTime, &connPtr->requestQueueTime, &delay);
+    delaySec = (double)delay.sec + (double)delay.usec / 1000000.0;
+
+    current = NsAtomicLoad(&poolPtr->threads.current);
+    idle = NsAtomicLoad(&poolPtr->threads.idle);
+    busy = (poolPtr->threads.max > 0)
+        ? (double)MAX(current - idle, 0) * 100.0 / (double)poolPtr->threads.max
+        : 0.0;
+
+    queueDelay = AdaptSmooth(&servPtr->compress.adaptive.queueDelay, delaySec, lockPtr);
+    busyPercent = AdaptSmooth(&servPtr->compress.adaptive.busyPercent, busy, lockPtr);
+
+    Ns_GetTime(&now);
+    nowUs = (Tcl_WideInt)now.sec * 1000000 + (Tcl_WideInt)now.usec;
+
+    if (nowUs >= NsAtomicLoad(&servPtr->compress.adaptive.nextUpdate)) {
+        Ns_MutexLock(lockPtr);
+        if (nowUs >= servPtr->compress.adaptive.nextUpdate) {
+            double      limitSec, busyLimit = (double)servPtr->compress.adaptive.busy;
+            int         oldStep = servPtr->compress.adaptive.step, newStep = oldStep;
+            Tcl_WideInt intervalUs = (Tcl_WideInt)servPtr->compress.adaptive.interval.sec * 1000000
+                + (Tcl_WideInt)servPtr->compress.adaptive.interval.usec;
+
+            limitSec = (double)servPtr->compress.adaptive.delay.sec
+                + (double)servPtr->compress.adaptive.delay.usec / 1000000.0;
+
+            if ((queueDelay > limitSec || busyPercent >= busyLimit)
+                && oldStep < COMPRESS_ADAPT_MAXSTEP) {
+                newStep++;
+                servPtr->compress.adaptive.lowered++;
+
+            } else if (queueDelay < limitSec / 2.0
+                       && busyPercent < busyLimit / 2.0
+                       && oldStep > 0) {
+                newStep--;
+                servPtr->compress.adaptive.raised++;
+            }
+            if (newStep != oldStep) {
+                Ns_Log(Notice, "compress: server %s changes adaptive step %d -> %d"
+                       " (queue delay %.6f, busy %.1f%%)",
+                       servPtr->server, oldStep, newStep, queueDelay, busyPercent);
+            }
+#ifdef NS_HAVE_ATOMIC_BUILTINS
+            __atomic_store_n(&servPtr->compress.adaptive.step, newStep, __ATOMIC_RELAXED);
+            __atomic_store_n(&servPtr->compress.adaptive.nextUpdate, nowUs + intervalUs,
+                             __ATOMIC_RELAXED);
+#else
+            servPtr->compress.adaptive.step = newStep;
+            servPtr->compress.adaptive.nextUpdate = nowUs + intervalUs;
+#endif
+        }
+        Ns_MutexUnlock(lockPtr);
+    }
+
+    step = NsAtomicLoad(&servPtr->compress.adaptive.step);
+    if (step == COMPRESS_ADAPT_MAXSTEP
+        && !streaming
+        && MAX(length, (size_t)MAX(connPtr->responseLength, 0)) < (size_t)servPtr->compress.adaptive.skipsize) {
+#ifdef NS_HAVE_ATOMIC_BUILTINS
+        (void) __atomic_fetch_add(&servPtr->compress.adaptive.skipped, 1u, __ATOMIC_RELAXED);
+#else
+        Ns_MutexLock(lockPtr);
+        servPtr->compress.adaptive.skipped++;
+        Ns_MutexUnlock(lockPtr);
+#endif
+        step = -1;
+    } else if (step > 0) {
+#ifdef NS_HAVE_ATOMIC_BUILTINS
+        (void) __atomic_fetch_add(&servPtr->compress.adaptive.reduced, 1u, __ATOMIC_RELAXED);
+#else
+        Ns_MutexLock(lockPtr);
+        servPtr->compress.adaptive.reduced++;
+        Ns_MutexUnlock(lockPtr);
+#endif
+    }
+
+    return step;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * NsCompressAdaptLevel --
+ *
+ *      Lower a compression level according to the adaptive step. Every
+ *      step halves the distance to the minimum level.
+ *
+ * Results:
+ *      Compression level.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+int
+NsCompressAdaptLevel(int level, int minLevel, int step)
+{
+    return (level > minLevel && step > 0)
+        ? minLevel + ((level - minLevel) >> MIN(step, COMPRESS_ADAPT_MAXSTEP))
+        : level;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * CompressStreamReset --
+ *
+ *      Reset the state of a stream, which might still contain an
+ *      unfinished response, e.g. after a client abort.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Frees the Brotli encoder.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+CompressStreamReset(Ns_CompressStream *cStream)
+{
+#ifdef HAVE_ZLIB_H
+    if ((cStream->flags & COMPRESS_SENT_HEADER) != 0u) {
+        (void) deflateReset(&cStream->z);
+        cStream->flags &= ~COMPRESS_SENT_HEADER;
+    }
+#endif
+    NsCompressBrotliEnd(cStream);
+#ifdef HAVE_ZSTD
+    {
+        ZstdStream *zsPtr = cStream->zstd;
+
+        if (zsPtr != NULL && zsPtr->inFrame) {
+            (void) ZSTD_CCtx_reset(zsPtr->cctx, ZSTD_reset_session_only);
+            zsPtr->inFrame = NS_FALSE;
+        }
+    }
+#endif
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * CompressStatsObjCmd --
+ *
+ *      Implements "ns_compress stats". Returns the size and the usage
+ *      statistics of the pool of compression streams and the state of
+ *      the adaptive compression of the server as a dict.
+ *
+ * Results:
+ *      Tcl result.
+ *
+ * Side effects:
+ *      With "-reset", the statistics are set to zero.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+CompressStatsObjCmd(ClientData clientData, Tcl_Interp *interp, TCL_SIZE_T objc, Tcl_Obj *const* objv)
+{
+    const NsInterp *itPtr = clientData;
+    NsServer       *servPtr = itPtr->servPtr;
+    int             reset = (int)NS_FALSE, result = TCL_OK;
+    Ns_ObjvSpec     opts[] = {
+        {"-reset",  Ns_ObjvBool,   &reset,   INT2PTR(NS_TRUE)},
+        {"-server", Ns_ObjvServer, &servPtr, NULL},
+        {NULL, NULL, NULL, NULL}
+    };
+
+    if (Ns_ParseObjv(opts, NULL, interp, 2, objc, objv) != NS_OK) {
+        result = TCL_ERROR;
+
+    } else {
+        Tcl_DString ds;
+
+        Tcl_DStringInit(&ds);
+        Ns_MutexLock(&compressPool.lock);
+        Ns_DStringPrintf(&ds, "poolsize %d idle %d inuse %d"
+                         " gets %lu reused %lu created %lu discarded %lu",
+                         compressPool.size, compressPool.nidle, compressPool.inuse,
+                         compressPool.gets, compressPool.reused,
+                         compressPool.created, compressPool.discarded);
+        if (reset != 0) {
+            compressPool.gets = compressPool.reused = 0u;
+            compressPool.created = compressPool.discarded = 0u;
+        }
+        Ns_MutexUnlock(&compressPool.lock);
+
+        if (servPtr != NULL) {
+            double queueDelay, busyPercent;
+            int    step;
+
+            /*
+             * Report the levels currently used for the content encodings
+             * of the server.
+             */
+            queueDelay = AdaptLoad(&servPtr->compress.adaptive.queueDelay,
+                                   &servPtr->compress.adaptive.lock);
+            busyPercent = AdaptLoad(&servPtr->compress.adaptive.busyPercent,
+                                    &servPtr->compress.adaptive.lock);
+            Ns_MutexLock(&servPtr->compress.adaptive.lock);
+            step = NsAtomicLoad(&servPtr->compress.adaptive.step);
+            Ns_DStringPrintf(&ds, " adaptive {enabled %d step %d"
+                             " gziplevel %d brotlilevel %d zstdlevel %d skipping %d"
+                             " queuedelay %.6f busy %.1f"
+                             " lowered %lu raised %lu reduced %lu skipped %lu}",
+                             servPtr->compress.adaptive.enable, step,
+                             NsCompressAdaptLevel(servPtr->compress.level, 1, step),
+                             NsCompressAdaptLevel(servPtr->compress.brotliLevel, 1, step),
+                             NsCompressAdaptLevel(servPtr->compress.zstdLevel, 1, step),
+                             step == COMPRESS_ADAPT_MAXSTEP,
+                             queueDelay, busyPercent,
+                             servPtr->compress.adaptive.lowered,
+                             servPtr->compress.adaptive.raised,
+                             NsAtomicLoad(&servPtr->compress.adaptive.reduced),
+                             NsAtomicLoad(&servPtr->compress.adaptive.skipped));
+            if (reset != 0) {
+                servPtr->compress.adaptive.lowered = servPtr->compress.adaptive.raised = 0u;
+#ifdef NS_HAVE_ATOMIC_BUILTINS
+                __atomic_store_n(&servPtr->compress.adaptive.reduced, 0u, __ATOMIC_RELAXED);
+                __atomic_store_n(&servPtr->compress.adaptive.skipped, 0u, __ATOMIC_RELAXED);
+#else
+                servPtr->compress.adaptive.reduced = servPtr->compress.adaptive.skipped = 0u;
+#endif
+            }
+            Ns_MutexUnlock(&servPtr->compress.adaptive.lock);
+        }
+        Tcl_DStringResult(interp, &ds);
+    }
+    return result;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * NsTclCompressObjCmd --
+ *
+ *      Implements "ns_compress" with the subcommand "stats".
+ *
+ * Results:
+ *      Tcl result.
+ *
+ * Side effects:
+ *      Depends on the subcommand.
+ *
+ *----------------------------------------------------------------------
+ */
+
+int
+NsTclCompressObjCmd(ClientData clientData, Tcl_Interp *interp, TCL_SIZE_T objc, Tcl_Obj *const* objv)
+{
+    const Ns_SubCmdSpec subcmds[] = {
+        {"stats", CompressStatsObjCmd},
+        {NULL, NULL}
+    };
+
+    return Ns_SubcmdObjv(subcmds, clientData, interp, objc, objv);
+}
+
 /*
  * Local Variables:
  * mode: c
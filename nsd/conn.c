@@ -90,6 +90,7 @@ DStringAppendConnFlags(Tcl_DString *dsPtr, unsigned int flags)
         { NS_CONN_ZIPACCEPTED,       "ZIPACCEPTED" },
         { NS_CONN_BROTLIACCEPTED,    "BROTLIACCEPTED" },
         { NS_CONN_CONTINUE,          "CONTINUE" },
+        { NS_CONN_ZSTDACCEPTED,      "ZSTDACCEPTED" },
         { NS_CONN_ENTITYTOOLARGE,    "ENTITYTOOLARGE" },
         { NS_CONN_REQUESTURITOOLONG, "REQUESTURITOOLONG" },
         { NS_CONN_LINETOOLONG,       "LINETOOLONG" },
@@ -2862,6 +2863,9 @@ ConnNoArg(int opt, unsigned int required_flags, Conn *connPtr, NsInterp *itPtr,
             if ((connPtr->flags & NS_CONN_ZIPACCEPTED) != 0u) {
                 Tcl_ListObjAppendElement(interp, listObj, Tcl_NewStringObj("gzip", 4));
             }
+            if ((connPtr->flags & NS_CONN_ZSTDACCEPTED) != 0u) {
+                Tcl_ListObjAppendElement(interp, listObj, Tcl_NewStringObj("zstd", 4));
+            }
 
             Tcl_SetObjResult(interp, listObj);
         }
@@ -3106,6 +3110,9 @@ MakeConnChannel(const NsInterp *itPtr, Ns_Conn *conn)
         if (connPtr->sockPtr->sock == NS_INVALID_SOCKET) {
             Ns_TclPrintfResult(itPtr->interp, "no socket for connection");
 
+        } else if (connPtr->sockPtr->h2StreamPtr != NULL) {
+            Ns_TclPrintfResult(itPtr->interp, "no channel for HTTP/2 streams");
+
         } else {
 
             /*
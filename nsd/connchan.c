@@ -1118,6 +1118,10 @@ ConnChanDetachObjCmd(ClientData clientData, Tcl_Interp *interp, TCL_SIZE_T objc,
         Ns_TclPrintfResult(interp, "no current connection");
         result = TCL_ERROR;
 
+    } else if (connPtr->sockPtr != NULL && connPtr->sockPtr->h2StreamPtr != NULL) {
+        Ns_TclPrintfResult(interp, "cannot detach an HTTP/2 stream");
+        result = TCL_ERROR;
+
     } else {
         NsServer         *servPtr = itPtr->servPtr;
         const NsConnChan *connChanPtr;
@@ -49,7 +49,9 @@ static Ns_ReturnCode ConnCopy(const Ns_Conn *conn, size_t toCopy, Tcl_Channel ch
 static bool CheckKeep(const Conn *connPtr)
     NS_GNUC_NONNULL(1);
 
-static int CheckCompress(const Conn *connPtr, const struct iovec *bufs, int nbufs, unsigned int ioflags)
+static int CheckCompress(Conn *connPtr, const struct iovec *bufs, int nbufs, unsigned int ioflags)
+    NS_GNUC_NONNULL(1);
+static bool CompressSizeOk(const Conn *connPtr, bool streaming, size_t length, int minsize)
     NS_GNUC_NONNULL(1);
 
 static bool HdrEq(const Ns_Set *set, const char *name, const char *value, size_t valueLength)
@@ -136,10 +138,37 @@ Ns_ConnWriteVChars(Ns_Conn *conn, struct iovec *bufs, int nbufs, unsigned int fl
     if (connPtr->compress > 0
         && (nbufs > 0 || (flags & NS_CONN_STREAM_CLOSE) != 0u)
         ) {
-        bool flush = ((flags & NS_CONN_STREAM) == 0u);
+        bool          flush = ((flags & NS_CONN_STREAM) == 0u);
+        Ns_ReturnCode compressStatus = NS_ERROR;
+
+        const NsServer *servPtr = connPtr->poolPtr->servPtr;
 
-        if (Ns_CompressBufsGzip(&connPtr->cStream, bufs, nbufs, &gzDs,
-                                connPtr->compress, flush) == NS_OK) {
+        if (connPtr->cStreamPtr == NULL) {
+            /*
+             * Get a stream from the pool, it is returned after the
+             * connection was closed.
+             */
+            connPtr->cStreamPtr = NsCompressStreamGet();
+        }
+        if (connPtr->cStreamPtr != NULL) {
+            switch (connPtr->compressEncoding) {
+            case NS_COMPRESS_BROTLI:
+                compressStatus = Ns_CompressBufsBrotli(connPtr->cStreamPtr, bufs, nbufs, &gzDs,
+                                                       connPtr->compressLevel,
+                                                       servPtr->compress.brotliWindow, flush);
+                break;
+            case NS_COMPRESS_ZSTD:
+                compressStatus = Ns_CompressBufsZstd(connPtr->cStreamPtr, bufs, nbufs, &gzDs,
+                                                     connPtr->compressLevel, flush);
+                break;
+            case NS_COMPRESS_GZIP: /* fall through */
+            default:
+                compressStatus = Ns_CompressBufsGzip(connPtr->cStreamPtr, bufs, nbufs, &gzDs,
+                                                     connPtr->compressLevel, flush);
+                break;
+            }
+        }
+        if (compressStatus == NS_OK) {
             /* NB: Compression will always succeed. */
             (void)Ns_SetVec(&iov, 0, gzDs.string, (size_t)gzDs.length);
             bufs = &iov;
@@ -162,22 +191,26 @@ Ns_ConnWriteVChars(Ns_Conn *conn, struct iovec *bufs, int nbufs, unsigned int fl
  *
  * CheckCompress --
  *
- *      Is compression enabled, and at what level.
+ *      Is compression enabled, and at what level. When Brotli or zstd
+ *      are enabled for the server and accepted by the client, these are
+ *      preferred over gzip (in this order). With adaptive compression,
+ *      the level of the chosen encoding is lowered under load.
  *
  * Results:
  *      compress level 0-9
  *
  * Side effects:
- *      May set the content-encoding and Vary headers.
+ *      May set the content-encoding and Vary headers and the
+ *      compressEncoding and compressLevel of the connection.
  *
  *----------------------------------------------------------------------
  */
 
 static int
-CheckCompress(const Conn *connPtr, const struct iovec *bufs, int nbufs, unsigned int ioflags)
+CheckCompress(Conn *connPtr, const struct iovec *bufs, int nbufs, unsigned int ioflags)
 {
     const Ns_Conn  *conn = (Ns_Conn *) connPtr;
-    const NsServer *servPtr;
+    NsServer       *servPtr;
     int             configuredCompressionLevel, compressionLevel = 0;
 
     NS_NONNULL_ASSERT(connPtr != NULL);
@@ -194,18 +227,63 @@ CheckCompress(const Conn *connPtr, const struct iovec *bufs, int nbufs, unsigned
          * Make sure the length is above the minimum threshold, or
          * we're streaming (assume length is long enough for streams).
          */
-        if (((ioflags & NS_CONN_STREAM) != 0u)
-            || (bufs != NULL && Ns_SumVec(bufs, nbufs) >= (size_t)servPtr->compress.minsize)
-            || connPtr->responseLength >= servPtr->compress.minsize) {
+        bool   streaming = ((ioflags & NS_CONN_STREAM) != 0u);
+        size_t length = (bufs != NULL) ? Ns_SumVec(bufs, nbufs) : 0u;
+
+        if (streaming
+            || length >= (size_t)servPtr->compress.minsize
+            || connPtr->responseLength >= servPtr->compress.minsize
+            || (servPtr->compress.brotli && length >= (size_t)servPtr->compress.brotliMinsize)
+            || (servPtr->compress.zstd && length >= (size_t)servPtr->compress.zstdMinsize)) {
             /*
              * We won't be compressing if there are no headers or body.
              */
             if (((connPtr->flags & NS_CONN_SENTHDRS) == 0u)
                 && ((connPtr->flags & NS_CONN_SKIPBODY) == 0u)) {
+                bool brotli, zstd, gzip;
+                int  step = 0;
+
                 Ns_ConnSetHeadersSz(conn, "vary", 4, "accept-encoding", 15);
 
-                if ((connPtr->flags & NS_CONN_ZIPACCEPTED) != 0u) {
+                brotli = (servPtr->compress.brotli
+                          && (connPtr->flags & NS_CONN_BROTLIACCEPTED) != 0u
+                          && CompressSizeOk(connPtr, streaming, length, servPtr->compress.brotliMinsize));
+                zstd = (!brotli
+                        && servPtr->compress.zstd
+                        && (connPtr->flags & NS_CONN_ZSTDACCEPTED) != 0u
+                        && CompressSizeOk(connPtr, streaming, length, servPtr->compress.zstdMinsize));
+                gzip = (!brotli && !zstd
+                        && (connPtr->flags & NS_CONN_ZIPACCEPTED) != 0u
+                        && CompressSizeOk(connPtr, streaming, length, servPtr->compress.minsize));
+
+                /*
+                 * Under load, adaptive compression lowers the levels or
+                 * skips the compression.
+                 */
+                if ((brotli || zstd || gzip) && servPtr->compress.adaptive.enable) {
+                    step = NsCompressAdapt(servPtr, connPtr, length, streaming);
+                }
+
+                if (step < 0) {
+                    /*
+                     * Send uncompressed.
+                     */
+                } else if (brotli) {
+                    Ns_ConnSetHeadersSz(conn, "content-encoding", 16, "br", 2);
+                    connPtr->compressEncoding = NS_COMPRESS_BROTLI;
+                    connPtr->compressLevel = NsCompressAdaptLevel(servPtr->compress.brotliLevel, 1, step);
+                    compressionLevel = configuredCompressionLevel;
+
+                } else if (zstd) {
+                    Ns_ConnSetHeadersSz(conn, "content-encoding", 16, "zstd", 4);
+                    connPtr->compressEncoding = NS_COMPRESS_ZSTD;
+                    connPtr->compressLevel = NsCompressAdaptLevel(servPtr->compress.zstdLevel, 1, step);
+                    compressionLevel = configuredCompressionLevel;
+
+                } else if (gzip) {
                     Ns_ConnSetHeadersSz(conn, "content-encoding", 16, "gzip", 4);
+                    connPtr->compressEncoding = NS_COMPRESS_GZIP;
+                    connPtr->compressLevel = NsCompressAdaptLevel(configuredCompressionLevel, 1, step);
                     compressionLevel = configuredCompressionLevel;
                 }
             }
@@ -214,6 +292,33 @@ CheckCompress(const Conn *connPtr, const struct iovec *bufs, int nbufs, unsigned
     return compressionLevel;
 }
 
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * CompressSizeOk --
+ *
+ *      Check, whether the response is large enough for compressing it
+ *      with a content encoding with the specified minimum size. Streamed
+ *      responses are assumed to be large enough.
+ *
+ * Results:
+ *      Boolean.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static bool
+CompressSizeOk(const Conn *connPtr, bool streaming, size_t length, int minsize)
+{
+    return (streaming
+            || length >= (size_t)minsize
+            || connPtr->responseLength >= minsize);
+}
+
 
 /*
  *----------------------------------------------------------------------
@@ -375,6 +480,21 @@ Ns_ConnWriteVData(Ns_Conn *conn, struct iovec *bufs, int nbufs, unsigned int fla
 
     nwrote = Ns_ConnSend(conn, sbufPtr, nsbufs);
 
+    /*
+     * A complete response sent in one operation might be stored in the
+     * micro-cache of the server.
+     */
+    if (((Conn *)conn)->microcacheKey != NULL) {
+        if (ds.length > 0
+            && nwrote == (ssize_t)toWrite
+            && (conn->flags & (NS_CONN_STREAM|NS_CONN_CHUNK|NS_CONN_SKIPBODY)) == 0u) {
+            NsMicroCacheStore((Conn *)conn, ds.string, (size_t)ds.length, bufs, nbufs, bodyLength);
+        } else {
+            ns_free(((Conn *)conn)->microcacheKey);
+            ((Conn *)conn)->microcacheKey = NULL;
+        }
+    }
+
     Tcl_DStringFree(&ds);
     if (sbufPtr != sbufs && sbufPtr != bufs) {
         ns_free(sbufPtr);
@@ -1268,6 +1388,7 @@ Ns_CompleteHeaders(Ns_Conn *conn, size_t dataLength,
 
             if ((connPtr->responseLength < 0)
                 && (conn->request.version > 1.0)
+                && (conn->request.version < 2.0)
                 && (connPtr->keep != 0)
                 && (HdrEq(connPtr->outputheaders, "content-type",
                           "multipart/byteranges", 20 ) == NS_FALSE)) {
@@ -18,6 +18,21 @@
 
 #define Ns_LogAccessDebug_DEFINED_ALREADY
 #include "nsd.h"
+
+#ifdef HAVE_SYS_EPOLL_H
+# include <sys/epoll.h>
+#endif
+
+#ifdef HAVE_LINUX_IO_URING_H
+# include <linux/io_uring.h>
+# include <sys/syscall.h>
+# include <sys/mman.h>
+# include <sys/eventfd.h>
+# if defined(__NR_io_uring_setup) && defined(__NR_io_uring_register) && defined(IORING_FEAT_RW_CUR_POS)
+#  define NS_WRITER_IO_URING 1
+# endif
+#endif
+
 NS_EXPORT Ns_LogSeverity Ns_LogAccessDebug;
 
 /*
@@ -112,6 +127,13 @@ static const SpoolerStateMap spoolerStateMap[] = {
 /*
  * The following structure manages polling.  The PollIn macro is
  * used for the common case of checking for readability.
+ *
+ * With the poll() backend, the pfds array is rebuilt on every spin of the
+ * thread. With the epoll backends, the "fixed" file descriptors (trigger
+ * pipe and listen sockets) are registered once, while the sockets are
+ * registered via SockPoll() and stay registered until PollSockRemove() is
+ * called. Their events are delivered to sockPtr->revents and can be
+ * queried via PollSockEvents().
  */
 
 typedef struct PollData {
@@ -119,12 +141,48 @@ typedef struct PollData {
     unsigned int   maxfds;     /* Max fds (will grow as needed). */
     struct pollfd *pfds;        /* Dynamic array of poll structs. */
     Ns_Time        timeout;     /* Min timeout, if any, for next spin. */
+#ifdef HAVE_SYS_EPOLL_H
+    int            epfd;        /* epoll instance, NS_INVALID_FD for poll() */
+    unsigned int   nfixed;      /* Number of fixed fds registered in epfd */
+    unsigned int   nsocks;      /* Number of socks registered in epfd */
+    unsigned int   maxevents;   /* Size of the events array */
+    struct epoll_event *events; /* Events returned by epoll_wait() */
+#endif
 } PollData;
 
 #define PollIn(ppd, i)           (((ppd)->pfds[(i)].revents & POLLIN)  == POLLIN )
 #define PollOut(ppd, i)          (((ppd)->pfds[(i)].revents & POLLOUT) == POLLOUT)
 #define PollHup(ppd, i)          (((ppd)->pfds[(i)].revents & POLLHUP) == POLLHUP)
 
+/*
+ * Flags in sockPtr->pollEvents (beyond the 16 bits of the POLL* event
+ * mask) indicating that the socket is registered in the epoll instance.
+ */
+#define POLL_REGISTERED          0x10000u
+
+/*
+ * The following structure defines a hierarchical timing wheel for the
+ * deadlines of the sockets parked in the driver thread (read-ahead,
+ * keep-alive and closing sockets). A tick is one millisecond. Level 0
+ * has one slot per tick, every further level covers WHEEL_SLOTS slots of
+ * the level below. Sockets in higher levels are cascaded down when the
+ * lower levels wrap around, such that the sockets of a level 0 slot are
+ * due when this slot is reached. Deadlines beyond the range of the wheel
+ * (about 4.6 hours) are placed in the last slot and requeued on expiry.
+ */
+#define WHEEL_BITS               6u
+#define WHEEL_SLOTS              (1u << WHEEL_BITS)
+#define WHEEL_MASK               (WHEEL_SLOTS - 1u)
+#define WHEEL_LEVELS             4u
+#define WHEEL_RANGE              ((uint64_t)1u << (WHEEL_BITS * WHEEL_LEVELS))
+
+typedef struct SockWheel {
+    uint64_t  tick;                              /* Next tick to be processed */
+    size_t    count;                             /* Number of queued socks */
+    uint64_t  occupied[WHEEL_LEVELS];            /* Bitmap of non-empty slots */
+    Sock     *slots[WHEEL_LEVELS][WHEEL_SLOTS];  /* Doubly linked lists of socks */
+} SockWheel;
+
 /*
  * Collected informationof writer threads for per pool rates, necessary for
  * per pool bandwidth management.
@@ -184,10 +242,51 @@ typedef struct WriterSock {
     int                rateLimit;
     int                currentRate;
     ConnPoolInfo      *infoPtr;
+    unsigned int       ringFlags;     /* WRITER_RING_* flags for io_uring operations */
+    SpoolerState       ringStatus;    /* Status of the last io_uring operation */
+    int                ringErr;       /* Error of the last io_uring operation */
     bool               keep;
 
 } WriterSock;
 
+/*
+ * Flags for the io_uring operations of a writer job. The operation flags
+ * are also used as tag bits in the user_data of SQEs.
+ */
+#define WRITER_RING_READ         0x01u  /* Read operation in flight */
+#define WRITER_RING_SEND         0x02u  /* Send operation in flight */
+#define WRITER_RING_OPS          (WRITER_RING_READ|WRITER_RING_SEND)
+#define WRITER_RING_FILLED       0x04u  /* Buffer was filled since the last send */
+#define WRITER_RING_USED         0x08u  /* Job was handled via io_uring */
+
+#ifdef NS_WRITER_IO_URING
+/*
+ * The following structure maintains the io_uring instance of a writer
+ * thread.
+ */
+typedef struct WriterRing {
+    int                  fd;          /* Ring fd, NS_INVALID_FD when not used */
+    int                  eventFd;     /* eventfd signaled on completions */
+    unsigned int         sqEntries;
+    unsigned int        *sqHead;
+    unsigned int        *sqTail;
+    unsigned int         sqMask;
+    unsigned int        *sqArray;
+    struct io_uring_sqe *sqes;
+    unsigned int        *cqHead;
+    unsigned int        *cqTail;
+    unsigned int         cqMask;
+    struct io_uring_cqe *cqes;
+    void                *sqRing;
+    void                *cqRing;
+    size_t               sqRingSize;
+    size_t               cqRingSize;  /* 0, when mapped together with the SQ ring */
+    size_t               sqesSize;
+    unsigned int         toSubmit;    /* Prepared, but not yet submitted SQEs */
+    unsigned int         inflight;    /* Submitted operations without completion */
+} WriterRing;
+#endif
+
 /*
  * Async writer definitions
  */
@@ -274,31 +373,72 @@ static Ns_ReturnCode SockQueue(Sock *sockPtr, const Ns_Time *timePtr)
 
 static Sock *SockNew(Driver *drvPtr)
     NS_GNUC_NONNULL(1) NS_GNUC_RETURNS_NONNULL;
+static void  SlabInit(DrvSlab *slabPtr, const char *prefix, const char *threadName, size_t linkOffset)
+    NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(2) NS_GNUC_NONNULL(3);
+static void *SlabGet(DrvSlab *slabPtr)
+    NS_GNUC_NONNULL(1);
+static void  SlabPut(DrvSlab *slabPtr, void *objPtr)
+    NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(2);
+static Tcl_Obj *SlabStatsObj(DrvSlab *slabPtr)
+    NS_GNUC_NONNULL(1) NS_GNUC_RETURNS_NONNULL;
 static void  SockRelease(Sock *sockPtr, SockState reason, int err)
     NS_GNUC_NONNULL(1);
+static void  SockSetIdle(Sock *sockPtr, bool idle)
+    NS_GNUC_NONNULL(1);
+static size_t SockBytes(const Sock *sockPtr) NS_GNUC_NONNULL(1) NS_GNUC_PURE;
 
 static void  SockError(Sock *sockPtr, SockState reason, int err)
     NS_GNUC_NONNULL(1);
 static void  SockSendResponse(Sock *sockPtr, int statusCode, const char *errMsg, const char *headers)
     NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(3);
+static void  SockConstructConn(Sock *sockPtr, int statusCode, Conn *connPtr)
+    NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(3);
 static void  SockTrigger(NS_SOCKET sock);
 static void  SockTimeout(Sock *sockPtr, const Ns_Time *nowPtr, const Ns_Time *timeout)
     NS_GNUC_NONNULL(1);
+static void  SockPark(Sock *sockPtr, Sock **listPtrPtr, SockWheel *wheelPtr, PollData *pdata)
+    NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(3) NS_GNUC_NONNULL(4);
+static void  WheelInit(SockWheel *wheelPtr, const Ns_Time *nowPtr)
+    NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(2);
+static void  WheelAdd(SockWheel *wheelPtr, Sock *sockPtr)
+    NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(2);
+static void  WheelRemove(Sock *sockPtr)
+    NS_GNUC_NONNULL(1);
+static uint64_t WheelTick(const Ns_Time *timePtr, bool roundUp)
+    NS_GNUC_NONNULL(1);
+static unsigned int WheelFirstBit(uint64_t bits)
+    NS_GNUC_CONST;
+static Sock *WheelExpire(SockWheel *wheelPtr, const Ns_Time *nowPtr, Sock *listPtr)
+    NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(2);
+static Sock *WheelReady(SockWheel *wheelPtr, const PollData *pdata, int nrEvents, Sock *listPtr)
+    NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(2);
+static Sock *WheelDrain(SockWheel *wheelPtr, Sock *listPtr)
+    NS_GNUC_NONNULL(1);
+static void  WheelPoll(const SockWheel *wheelPtr, PollData *pdata)
+    NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(2);
+static int   WheelTimeout(const SockWheel *wheelPtr, const Ns_Time *nowPtr)
+    NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(2);
 static void  SockClose(Sock *sockPtr, int keep)
     NS_GNUC_NONNULL(1);
 static SockState SockRead(Sock *sockPtr, int spooler, const Ns_Time *timePtr)
     NS_GNUC_NONNULL(1);
 static SockState SockParse(Sock *sockPtr)
     NS_GNUC_NONNULL(1);
+static SockState SockHttp2Start(Sock *sockPtr)
+    NS_GNUC_NONNULL(1);
+static void SockHttp2Dispatch(Sock *sockPtr, const Ns_Time *nowPtr, Sock **waitPtrPtr)
+    NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(2) NS_GNUC_NONNULL(3);
 static void SockPoll(Sock *sockPtr, short type, PollData *pdata)
     NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(3);
+static void SockPollSuspend(Sock *sockPtr, PollData *pdata)
+    NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(2);
 static void SockSpoolerQueue(Driver *drvPtr, Sock *sockPtr)
     NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(2);
 static void SpoolerQueueStart(SpoolerQueue *queuePtr, Ns_ThreadProc *proc)
     NS_GNUC_NONNULL(2);
 static void SpoolerQueueStop(SpoolerQueue *queuePtr, const Ns_Time *timeoutPtr, const char *name)
     NS_GNUC_NONNULL(2) NS_GNUC_NONNULL(3);
-static void PollCreate(PollData *pdata)
+static void PollCreate(PollData *pdata, NsPollBackend backend)
     NS_GNUC_NONNULL(1);
 static void PollFree(PollData *pdata)
     NS_GNUC_NONNULL(1);
@@ -306,8 +446,16 @@ static void PollReset(PollData *pdata)
     NS_GNUC_NONNULL(1);
 static NS_POLL_NFDS_TYPE PollSet(PollData *pdata, NS_SOCKET sock, short type, const Ns_Time *timeoutPtr)
     NS_GNUC_NONNULL(1);
-static int PollWait(const PollData *pdata, int timeout)
+static void PollUpdateTimeout(PollData *pdata, const Ns_Time *timeoutPtr)
     NS_GNUC_NONNULL(1);
+static int PollWait(PollData *pdata, int timeout)
+    NS_GNUC_NONNULL(1);
+static short PollSockEvents(const PollData *pdata, Sock *sockPtr)
+    NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(2);
+static void PollSockRemove(PollData *pdata, Sock *sockPtr)
+    NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(2);
+static const char *PollBackendName(NsPollBackend backend)
+    NS_GNUC_CONST;
 static SockState ChunkedDecode(Request *reqPtr, bool update)
     NS_GNUC_NONNULL(1);
 static WriterSock *WriterSockRequire(const Conn *connPtr)
@@ -316,11 +464,50 @@ static void WriterSockRelease(WriterSock *wrSockPtr)
     NS_GNUC_NONNULL(1);
 static SpoolerState WriterReadFromSpool(WriterSock *curPtr)
     NS_GNUC_NONNULL(1);
+static unsigned char *WriterSpoolCompact(WriterSock *curPtr, size_t *maxsizePtr)
+    NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(2);
+static size_t WriterSpoolReadSize(const WriterSock *curPtr, size_t toRead)
+    NS_GNUC_NONNULL(1);
+static void WriterSpoolReadDone(WriterSock *curPtr, size_t n)
+    NS_GNUC_NONNULL(1);
 static SpoolerState WriterSend(WriterSock *curPtr, int *err)
     NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(2);
+static bool WriterSendFileUsable(const WriterSock *curPtr)
+    NS_GNUC_NONNULL(1) NS_GNUC_PURE;
+static SpoolerState WriterSendFile(WriterSock *curPtr, int *err)
+    NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(2);
+#ifdef NS_WRITER_IO_URING
+static Ns_ReturnCode WriterRingInit(WriterRing *ringPtr, unsigned int entries)
+    NS_GNUC_NONNULL(1);
+static void WriterRingFree(WriterRing *ringPtr)
+    NS_GNUC_NONNULL(1);
+static bool WriterRingUsable(const WriterRing *ringPtr, const WriterSock *curPtr)
+    NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(2) NS_GNUC_PURE;
+static int WriterRingEnter(WriterRing *ringPtr, unsigned int minComplete)
+    NS_GNUC_NONNULL(1);
+static void WriterRingPrepare(WriterRing *ringPtr, WriterSock *curPtr, unsigned int op,
+                              void *bufPtr, size_t length)
+    NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(2) NS_GNUC_NONNULL(4);
+static void WriterRingSchedule(WriterRing *ringPtr, WriterSock *curPtr)
+    NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(2);
+static unsigned int WriterRingReap(WriterRing *ringPtr)
+    NS_GNUC_NONNULL(1);
+static void WriterRingFlush(WriterRing *ringPtr)
+    NS_GNUC_NONNULL(1);
+static void WriterRingDrain(WriterRing *ringPtr)
+    NS_GNUC_NONNULL(1);
+static WriterSock *WriterRingCollect(SpoolerQueue *queuePtr, WriterSock *writePtr, PollData *pdata)
+    NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(3);
+#endif
 
 static Ns_ReturnCode WriterSetupStreamingMode(Conn *connPtr, const struct iovec *bufs, int nbufs, int *fdPtr)
     NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(4);
+static int WriterInitialRateLimit(const ConnPool *poolPtr, const DrvWriter *wrPtr, int rateLimit)
+    NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(2) NS_GNUC_PURE;
+static void WriterSockFileInit(WriterSock *wrSockPtr, const DrvWriter *wrPtr, int fd, size_t nsend, size_t headerSize)
+    NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(2);
+static void WriterSockSubmit(DrvWriter *wrPtr, WriterSock *wrSockPtr, const char *requestLine)
+    NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(2) NS_GNUC_NONNULL(3);
 static void WriterSockFileVecCleanup(const WriterSock *wrSockPtr)
     NS_GNUC_NONNULL(1);
 static int WriterGetMemunitFromDict(Tcl_Interp *interp, Tcl_Obj *dictObj, Tcl_Obj *keyObj,
@@ -336,8 +523,8 @@ static const char *GetSockStateName(SockState sockState) NS_GNUC_PURE;
 
 static size_t EndOfHeader(Sock *sockPtr)
     NS_GNUC_NONNULL(1);
-static  Request *RequestNew(void)
-    NS_GNUC_RETURNS_NONNULL;
+static  Request *RequestNew(Driver *drvPtr)
+    NS_GNUC_NONNULL(1) NS_GNUC_RETURNS_NONNULL;
 static void RequestFree(Sock *sockPtr)
     NS_GNUC_NONNULL(1);
 static void LogBuffer(Ns_LogSeverity severity, const char *msg, const char *buffer, size_t len)
@@ -387,9 +574,8 @@ bool NsWriterBandwidthManagement = NS_FALSE;
 
 static Ns_LogSeverity   WriterDebug;        /* Severity at which to log verbose debugging. */
 static Ns_LogSeverity   DriverDebug;        /* Severity at which to log verbose debugging. */
-static Ns_Mutex         reqLock     = NULL; /* Lock for allocated Request structure pool */
+static Ns_Mutex         reqLock     = NULL; /* Lock for setting up the async log writer */
 static Ns_Mutex         writerlock  = NULL; /* Lock updating streaming information in the writer */
-static Request         *firstReqPtr = NULL; /* Allocated request structures kept in a pool */
 static Driver          *firstDrvPtr = NULL; /* First in list of all drivers */
 
 #define Push(x, xs) ((x)->nextPtr = (xs), (xs) = (x))
@@ -498,7 +684,7 @@ NsInitDrivers(void)
     Ns_LogNsSetDebug = Ns_CreateLogSeverity("Debug(nsset)");
     Ns_MutexInit(&reqLock);
     Ns_MutexInit(&writerlock);
-    Ns_MutexSetName2(&reqLock, "ns:driver", "requestpool");
+    Ns_MutexSetName2(&reqLock, "ns:driver", "asyncwriter");
     Ns_MutexSetName2(&writerlock, "ns:writer", "stream");
 }
 
@@ -1271,6 +1457,9 @@ DriverInit(const char *server, const char *moduleName, const char *threadName,
     Ns_MutexInit(&drvPtr->writer.lock);
     Ns_MutexSetName2(&drvPtr->writer.lock, "ns:drv:writer", threadName);
 
+    SlabInit(&drvPtr->sockSlab, "ns:drv:sockslab", threadName, offsetof(Sock, nextPtr));
+    SlabInit(&drvPtr->requestSlab, "ns:drv:requestslab", threadName, offsetof(Request, nextPtr));
+
     if (ns_sockpair(drvPtr->trigger) != 0) {
         Ns_Fatal("ns_sockpair() failed: %s", ns_sockstrerror(ns_sockerrno));
     }
@@ -1333,6 +1522,60 @@ DriverInit(const char *server, const char *moduleName, const char *threadName,
                                                                 "0MB", 0, 0, INT_MAX);
     drvPtr->recvTimeout = drvPtr->recvwait;
 
+    /*
+     * Event notification mechanism for the driver, spooler and writer
+     * threads of this driver. epoll is only available on Linux;
+     * otherwise, poll() is used.
+     */
+    {
+#ifdef HAVE_SYS_EPOLL_H
+        const char *backend = Ns_ConfigString(section, "pollbackend", "epoll");
+#else
+        const char *backend = Ns_ConfigString(section, "pollbackend", "poll");
+#endif
+        if (STREQ(backend, "epoll")) {
+            drvPtr->pollBackend = NS_POLL_BACKEND_EPOLL;
+        } else {
+            if (!STREQ(backend, "poll")) {
+                Ns_Log(Warning, "parameter %s pollbackend: invalid value '%s'; "
+                       "valid are: poll, epoll; using poll",
+                       section, backend);
+            }
+            drvPtr->pollBackend = NS_POLL_BACKEND_POLL;
+        }
+#ifndef HAVE_SYS_EPOLL_H
+        if (drvPtr->pollBackend != NS_POLL_BACKEND_POLL) {
+            Ns_Log(Warning, "parameter %s pollbackend %s is not supported by the operating system; using poll",
+                   section, backend);
+            drvPtr->pollBackend = NS_POLL_BACKEND_POLL;
+        }
+#endif
+    }
+
+    /*
+     * HTTP/2 is detected via the client connection preface. It requires
+     * that the request is read by the driver thread.
+     */
+    drvPtr->http2           = Ns_ConfigBool(section, "http2", NS_FALSE);
+    drvPtr->http2maxstreams = Ns_ConfigIntRange(section, "http2maxstreams", 100, 1, INT_MAX);
+
+    /*
+     * In lean keepalive mode, idle connections hold just the Sock
+     * structure. Request buffers are trimmed to the read-ahead size when
+     * returned, and TLS drivers release their record buffers.
+     */
+    drvPtr->leanKeepalive   = Ns_ConfigBool(section, "leankeepalive", NS_FALSE);
+    if (drvPtr->http2) {
+        if (!NsHttp2Supported()) {
+            Ns_Log(Warning, "parameter %s http2: server was compiled without HTTP/2 support", section);
+            drvPtr->http2 = NS_FALSE;
+        } else if ((drvPtr->opts & NS_DRIVER_ASYNC) == 0u
+                   || (drvPtr->opts & (NS_DRIVER_UDP|NS_DRIVER_NOPARSE)) != 0u) {
+            Ns_Log(Warning, "parameter %s http2: not supported by driver %s", section, moduleName);
+            drvPtr->http2 = NS_FALSE;
+        }
+    }
+
     drvPtr->nextPtr = firstDrvPtr;
     firstDrvPtr = drvPtr;
 
@@ -1430,6 +1673,7 @@ DriverInit(const char *server, const char *moduleName, const char *threadName,
             Ns_MutexSetName2(&queuePtr->lock, buffer, "queue");
             Ns_CondInit(&queuePtr->cond);
             queuePtr->id = i;
+            queuePtr->pollBackend = drvPtr->pollBackend;
             Push(queuePtr, spPtr->firstPtr);
         }
     } else {
@@ -1452,9 +1696,29 @@ DriverInit(const char *server, const char *moduleName, const char *threadName,
         wrPtr->rateLimit = Ns_ConfigIntRange(section, "writerratelimit", 0, 0, INT_MAX);
         wrPtr->doStream = Ns_ConfigBool(section, "writerstreaming", NS_FALSE)
             ? NS_WRITER_STREAM_ACTIVE : NS_WRITER_STREAM_NONE;
+        wrPtr->iouring = Ns_ConfigBool(section, "writeriouring", NS_FALSE);
+        if (wrPtr->iouring) {
+#ifdef NS_WRITER_IO_URING
+            /*
+             * Data sent via io_uring bypasses the send callback of the
+             * driver, so this is only possible for clear text over stream
+             * sockets.
+             */
+            if ((drvPtr->opts & (NS_DRIVER_SSL|NS_DRIVER_UDP)) != 0u) {
+                Ns_Log(Warning, "parameter %s writeriouring is not supported by driver %s",
+                       section, moduleName);
+                wrPtr->iouring = NS_FALSE;
+            }
+#else
+            Ns_Log(Warning, "parameter %s writeriouring is not supported by this build",
+                   section);
+            wrPtr->iouring = NS_FALSE;
+#endif
+        }
         Ns_Log(Notice, "%s: enable %d writer thread(s) "
-               "for downloads >= %" PRIdz " bytes, bufsize=%" PRIdz " bytes, HTML streaming %d",
-               threadName, wrPtr->threads, wrPtr->writersize, wrPtr->bufsize, wrPtr->doStream);
+               "for downloads >= %" PRIdz " bytes, bufsize=%" PRIdz " bytes, HTML streaming %d, io_uring %d",
+               threadName, wrPtr->threads, wrPtr->writersize, wrPtr->bufsize, wrPtr->doStream,
+               wrPtr->iouring);
 
         for (i = 0; i < wrPtr->threads; i++) {
             SpoolerQueue *queuePtr = ns_calloc(1u, sizeof(SpoolerQueue));
@@ -1464,6 +1728,8 @@ DriverInit(const char *server, const char *moduleName, const char *threadName,
             Ns_MutexSetName2(&queuePtr->lock, buffer, "queue");
             Ns_CondInit(&queuePtr->cond);
             queuePtr->id = i;
+            queuePtr->pollBackend = drvPtr->pollBackend;
+            queuePtr->iouring = wrPtr->iouring;
             Push(queuePtr, wrPtr->firstPtr);
         }
     } else {
@@ -1753,6 +2019,15 @@ DriverInfoObjCmd(ClientData UNUSED(clientData), Tcl_Interp *interp, TCL_SIZE_T o
                     Tcl_ListObjAppendElement(interp, listObj, Tcl_NewStringObj(NS_EMPTY_STRING, 0));
                 }
 
+                Tcl_ListObjAppendElement(interp, listObj, Tcl_NewStringObj("pollbackend", 11));
+                Tcl_ListObjAppendElement(interp, listObj, Tcl_NewStringObj(PollBackendName(drvPtr->pollBackend),
+                                                                           TCL_INDEX_NONE));
+
+                Tcl_ListObjAppendElement(interp, listObj, Tcl_NewStringObj("http2", 5));
+                Tcl_ListObjAppendElement(interp, listObj, Tcl_NewBooleanObj(drvPtr->http2));
+
+                Tcl_ListObjAppendElement(interp, listObj, Tcl_NewStringObj("leankeepalive", 13));
+                Tcl_ListObjAppendElement(interp, listObj, Tcl_NewBooleanObj(drvPtr->leanKeepalive));
 
                 Tcl_ListObjAppendElement(interp, resultObj, listObj);
             }
@@ -1796,8 +2071,8 @@ DriverStatsObjCmd(ClientData UNUSED(clientData), Tcl_Interp *interp, TCL_SIZE_T
         result = TCL_ERROR;
 
     } else {
-        const Driver *drvPtr;
-        Tcl_Obj      *resultObj = Tcl_NewListObj(0, NULL);
+        Driver   *drvPtr;
+        Tcl_Obj  *resultObj = Tcl_NewListObj(0, NULL);
 
         /*
          * Iterate over all drivers and collect results.
@@ -1828,6 +2103,27 @@ DriverStatsObjCmd(ClientData UNUSED(clientData), Tcl_Interp *interp, TCL_SIZE_T
             Tcl_ListObjAppendElement(interp, listObj, Tcl_NewStringObj("errors", 6));
             Tcl_ListObjAppendElement(interp, listObj, Tcl_NewWideIntObj(drvPtr->stats.errors));
 
+            Tcl_ListObjAppendElement(interp, listObj, Tcl_NewStringObj("http2streams", 12));
+            Tcl_ListObjAppendElement(interp, listObj, Tcl_NewWideIntObj(drvPtr->stats.http2streams));
+
+            Tcl_ListObjAppendElement(interp, listObj, Tcl_NewStringObj("fastpath", 8));
+            Tcl_ListObjAppendElement(interp, listObj, Tcl_NewWideIntObj(drvPtr->stats.fastpath));
+
+            Tcl_ListObjAppendElement(interp, listObj, Tcl_NewStringObj("idle", 4));
+            Tcl_ListObjAppendElement(interp, listObj, Tcl_NewWideIntObj((Tcl_WideInt)drvPtr->stats.idle));
+
+            Tcl_ListObjAppendElement(interp, listObj, Tcl_NewStringObj("idlebytes", 9));
+            Tcl_ListObjAppendElement(interp, listObj,
+                                     Tcl_NewWideIntObj(drvPtr->stats.idle > 0u
+                                                       ? (Tcl_WideInt)(drvPtr->stats.idleBytes / drvPtr->stats.idle)
+                                                       : 0));
+
+            Tcl_ListObjAppendElement(interp, listObj, Tcl_NewStringObj("sockslab", 8));
+            Tcl_ListObjAppendElement(interp, listObj, SlabStatsObj(&drvPtr->sockSlab));
+
+            Tcl_ListObjAppendElement(interp, listObj, Tcl_NewStringObj("requestslab", 11));
+            Tcl_ListObjAppendElement(interp, listObj, SlabStatsObj(&drvPtr->requestSlab));
+
             Tcl_ListObjAppendElement(interp, resultObj, listObj);
         }
         Tcl_SetObjResult(interp, resultObj);
@@ -2164,6 +2460,53 @@ NsSockClose(Sock *sockPtr, int keep)
 }
 
 
+/*
+ *----------------------------------------------------------------------
+ *
+ * NsSockKeepAlive --
+ *
+ *      Should the connection be kept open after delivering a response
+ *      with the given content length directly from the driver thread. The
+ *      rules follow the default rules of the connection threads.
+ *
+ * Results:
+ *      NS_TRUE if keep-alive is allowed, NS_FALSE otherwise.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+bool
+NsSockKeepAlive(const Sock *sockPtr, size_t contentLength)
+{
+    const Driver     *drvPtr;
+    const Ns_Request *requestPtr;
+    const char       *connection;
+    bool              result = NS_FALSE;
+
+    NS_NONNULL_ASSERT(sockPtr != NULL);
+    assert(sockPtr->reqPtr != NULL);
+
+    drvPtr = sockPtr->drvPtr;
+    requestPtr = &sockPtr->reqPtr->request;
+    connection = Ns_SetIGet(sockPtr->reqPtr->headers, "connection");
+
+    if ((drvPtr->keepwait.sec > 0 || drvPtr->keepwait.usec > 0)
+        && (drvPtr->keepmaxdownloadsize == 0u
+            || contentLength <= drvPtr->keepmaxdownloadsize)
+        ) {
+        if (requestPtr->version == 1.0) {
+            result = (connection != NULL && strncasecmp(connection, "keep-alive", 10u) == 0);
+        } else {
+            result = (connection == NULL || strncasecmp(connection, "close", 5u) != 0);
+        }
+    }
+    return result;
+}
+
+
 /*
  *----------------------------------------------------------------------
  *
@@ -2262,7 +2605,15 @@ NsDriverRecv(Sock *sockPtr, struct iovec *bufs, int nbufs, Ns_Time *timeoutPtr)
 
     drvPtr = sockPtr->drvPtr;
 
-    if (likely(drvPtr->recvProc != NULL)) {
+    if (unlikely(sockPtr->h2StreamPtr != NULL)) {
+        /*
+         * The request of an HTTP/2 stream is received completely by the
+         * driver, there is nothing more to read.
+         */
+        sockPtr->recvSockState = NS_SOCK_DONE;
+        result = 0;
+
+    } else if (likely(drvPtr->recvProc != NULL)) {
         result = (*drvPtr->recvProc)((Ns_Sock *) sockPtr, bufs, nbufs, timeoutPtr, 0u);
     } else {
         Ns_Log(Warning, "driver: no recvProc registered for driver %s", drvPtr->threadName);
@@ -2303,7 +2654,10 @@ NsDriverSend(Sock *sockPtr, const struct iovec *bufs, int nbufs, unsigned int fl
 
     NS_NONNULL_ASSERT(drvPtr != NULL);
 
-    if (likely(drvPtr->sendProc != NULL)) {
+    if (unlikely(sockPtr->h2StreamPtr != NULL)) {
+        sent = NsHttp2Send(sockPtr, bufs, nbufs);
+
+    } else if (likely(drvPtr->sendProc != NULL)) {
         sockPtr->sendCount ++;
         sent = (*drvPtr->sendProc)((Ns_Sock *) sockPtr, bufs, nbufs, flags);
         if (unlikely(sent == -1)) {
@@ -2360,7 +2714,9 @@ NsDriverSendFile(Sock *sockPtr, Ns_FileVec *bufs, int nbufs, unsigned int flags)
 
     NS_NONNULL_ASSERT(drvPtr != NULL);
 
-    if (drvPtr->sendFileProc != NULL) {
+    if (unlikely(sockPtr->h2StreamPtr != NULL)) {
+        sent = NsHttp2SendFile(sockPtr, bufs, nbufs);
+    } else if (drvPtr->sendFileProc != NULL) {
         sent = (*drvPtr->sendFileProc)((Ns_Sock *)sockPtr, bufs, nbufs, flags);
     } else {
         sent = Ns_SockSendFileBufs((Ns_Sock *)sockPtr, bufs, nbufs, flags);
@@ -2467,10 +2823,18 @@ DriverThread(void *arg)
     unsigned int   flags;
     Sock          *sockPtr, *nextPtr, *closePtr = NULL, *waitPtr = NULL, *readPtr = NULL;
     PollData       pdata;
+    SockWheel      readWheel, closeWheel;
 
     Ns_ThreadSetName("-driver:%s-", drvPtr->threadName);
     Ns_Log(Notice, "starting %s", drvPtr->threadName);
 
+    /*
+     * From now on, this thread serves the slabs of the driver without
+     * locking.
+     */
+    drvPtr->sockSlab.owner = Ns_ThreadId();
+    drvPtr->requestSlab.owner = drvPtr->sockSlab.owner;
+
     flags = DRIVER_STARTED;
 
     {
@@ -2544,8 +2908,10 @@ DriverThread(void *arg)
      * connections are complete and gracefully closed.
      */
 
-    PollCreate(&pdata);
+    PollCreate(&pdata, drvPtr->pollBackend);
     Ns_GetTime(&now);
+    WheelInit(&readWheel, &now);
+    WheelInit(&closeWheel, &now);
     stopping = ((flags & DRIVER_SHUTDOWN) != 0u);
 
     if (!stopping) {
@@ -2574,21 +2940,26 @@ DriverThread(void *arg)
         }
 
         /*
-         * If there are any closing or read-ahead sockets, set the bits
-         * and determine the minimum relative timeout.
+         * Set the bits for the sockets, which have to be checked on every
+         * spin (HTTP/2 connections, pipelined requests) and determine
+         * their minimum relative timeout. The idle read-ahead, keep-alive
+         * and closing sockets are kept in the timing wheels, which provide
+         * the time of their next deadline directly. In epoll mode, these
+         * sockets are registered already; in poll() mode, they have to be
+         * added to the pfds array.
          *
          * TODO: the various poll timeouts should probably be configurable.
          */
 
-        if (readPtr == NULL && closePtr == NULL) {
-            pollTimeout = 10 * 1000;
-        } else {
+        pollTimeout = -1;
+        if (readPtr != NULL) {
 
             for (sockPtr = readPtr; sockPtr != NULL; sockPtr = sockPtr->nextPtr) {
-                SockPoll(sockPtr, (short)POLLIN, &pdata);
-            }
-            for (sockPtr = closePtr; sockPtr != NULL; sockPtr = sockPtr->nextPtr) {
-                SockPoll(sockPtr, (short)POLLIN, &pdata);
+                if (sockPtr->h2ConnPtr != NULL && NsHttp2WantWrite(sockPtr->h2ConnPtr)) {
+                    SockPoll(sockPtr, (short)(POLLIN|POLLOUT), &pdata);
+                } else {
+                    SockPoll(sockPtr, (short)POLLIN, &pdata);
+                }
             }
 
             if (Ns_DiffTime(&pdata.timeout, &now, &diff) > 0)  {
@@ -2604,6 +2975,27 @@ DriverThread(void *arg)
                 pollTimeout = 0;
             }
         }
+#ifdef HAVE_SYS_EPOLL_H
+        if (pdata.epfd == NS_INVALID_FD)
+#endif
+        {
+            WheelPoll(&readWheel, &pdata);
+            WheelPoll(&closeWheel, &pdata);
+        }
+        {
+            int wheelTimeout = WheelTimeout(&readWheel, &now);
+
+            if (wheelTimeout >= 0 && (pollTimeout < 0 || wheelTimeout < pollTimeout)) {
+                pollTimeout = wheelTimeout;
+            }
+            wheelTimeout = WheelTimeout(&closeWheel, &now);
+            if (wheelTimeout >= 0 && (pollTimeout < 0 || wheelTimeout < pollTimeout)) {
+                pollTimeout = wheelTimeout;
+            }
+        }
+        if (pollTimeout < 0) {
+            pollTimeout = 10 * 1000;
+        }
 
         nrWaiting = PollWait(&pdata, pollTimeout);
         reanimation = PollIn(&pdata, 0);
@@ -2639,22 +3031,34 @@ DriverThread(void *arg)
         }
 
         /*
-         * Update the current time and drain and/or release any
-         * closing sockets.
+         * Update the current time and take the sockets with events or
+         * expired deadlines out of the timing wheels. Sockets remaining
+         * in the wheels are not touched in this spin.
          */
         Ns_GetTime(&now);
 
+        closePtr = WheelReady(&closeWheel, &pdata, nrWaiting, NULL);
+        closePtr = WheelExpire(&closeWheel, &now, closePtr);
+        readPtr = WheelReady(&readWheel, &pdata, nrWaiting, readPtr);
+        readPtr = WheelExpire(&readWheel, &now, readPtr);
+
+        /*
+         * Drain and/or release the closing sockets.
+         */
         if (closePtr != NULL) {
             sockPtr  = closePtr;
             closePtr = NULL;
             while (sockPtr != NULL) {
+                short revents = PollSockEvents(&pdata, sockPtr);
+
                 nextPtr = sockPtr->nextPtr;
-                if (unlikely(PollHup(&pdata, sockPtr->pidx))) {
+                if (unlikely((revents & POLLHUP) == POLLHUP)) {
                     /*
                      * Peer has closed the connection
                      */
+                    PollSockRemove(&pdata, sockPtr);
                     SockRelease(sockPtr, SOCK_CLOSE, 0);
-                } else if (likely(PollIn(&pdata, sockPtr->pidx))) {
+                } else if (likely((revents & POLLIN) == POLLIN)) {
                     /*
                      * Got some data
                      */
@@ -2662,18 +3066,20 @@ DriverThread(void *arg)
                     if (received <= 0) {
                         Ns_Log(DriverDebug, "poll closewait pollin; sockrelease SOCK_READERROR (sock %d)",
                                sockPtr->sock);
+                        PollSockRemove(&pdata, sockPtr);
                         SockRelease(sockPtr, SOCK_READERROR, 0);
                     } else {
-                        Push(sockPtr, closePtr);
+                        SockPark(sockPtr, NULL, &closeWheel, &pdata);
                     }
                 } else if (Ns_DiffTime(&sockPtr->timeout, &now, &diff) <= 0) {
                     /* no PollHup, no PollIn, maybe timeout */
                     Ns_Log(DriverDebug, "poll closewait timeout; sockrelease SOCK_CLOSETIMEOUT (sock %d)",
                            sockPtr->sock);
+                    PollSockRemove(&pdata, sockPtr);
                     SockRelease(sockPtr, SOCK_CLOSETIMEOUT, 0);
                 } else {
                     /* too early, keep waiting */
-                    Push(sockPtr, closePtr);
+                    SockPark(sockPtr, NULL, &closeWheel, &pdata);
                 }
                 sockPtr = nextPtr;
             }
@@ -2687,25 +3093,49 @@ DriverThread(void *arg)
         readPtr = NULL;
 
         while (likely(sockPtr != NULL)) {
+            short revents = PollSockEvents(&pdata, sockPtr);
+
             nextPtr = sockPtr->nextPtr;
 
-            if (unlikely(PollHup(&pdata, sockPtr->pidx))) {
+            if (unlikely((revents & POLLHUP) == POLLHUP)) {
                 /*
                  * Peer has closed the connection
                  */
                 Ns_Log(DriverDebug, "Peer has closed %p", (void*)sockPtr);
+                PollSockRemove(&pdata, sockPtr);
                 SockRelease(sockPtr, SOCK_CLOSE, 0);
 
-            } else if (unlikely(!PollIn(&pdata, sockPtr->pidx))
+            } else if (sockPtr->h2ConnPtr != NULL && (revents & POLLIN) != POLLIN) {
+                /*
+                 * HTTP/2 connection without input: send pending output
+                 * (the socket might have become writable, or a connection
+                 * thread has produced data). The keepalive timeout
+                 * applies only to idle connections.
+                 */
+                if (NsHttp2Flush(sockPtr->h2ConnPtr) != NS_OK) {
+                    PollSockRemove(&pdata, sockPtr);
+                    SockRelease(sockPtr, SOCK_CLOSE, 0);
+                } else if (NsHttp2Busy(sockPtr->h2ConnPtr)) {
+                    SockTimeout(sockPtr, &now, &drvPtr->keepwait);
+                    Push(sockPtr, readPtr);
+                } else if (Ns_DiffTime(&sockPtr->timeout, &now, &diff) <= 0) {
+                    PollSockRemove(&pdata, sockPtr);
+                    SockRelease(sockPtr, SOCK_READTIMEOUT, 0);
+                } else {
+                    Push(sockPtr, readPtr);
+                }
+
+            } else if (unlikely((revents & POLLIN) != POLLIN)
                        && ((sockPtr->reqPtr == NULL) || (sockPtr->reqPtr->leftover == 0u))) {
                 /*
                  * Got no data for this sockPtr.
                  */
                 Ns_Log(DriverDebug, "Got no data for this sockPtr %p", (void*)sockPtr);
                 if (Ns_DiffTime(&sockPtr->timeout, &now, &diff) <= 0) {
+                    PollSockRemove(&pdata, sockPtr);
                     SockRelease(sockPtr, SOCK_READTIMEOUT, 0);
                 } else {
-                    Push(sockPtr, readPtr);
+                    SockPark(sockPtr, &readPtr, &readWheel, &pdata);
                 }
 
             } else {
@@ -2715,11 +3145,20 @@ DriverThread(void *arg)
                  */
                 assert(drvPtr == sockPtr->drvPtr);
                 Ns_Log(DriverDebug, "Got some data for this sockPtr %p", (void*)sockPtr);
+                SockSetIdle(sockPtr, NS_FALSE);
 
                 if (likely((drvPtr->opts & NS_DRIVER_ASYNC) != 0u)) {
                     SockState s = SockRead(sockPtr, 0, &now);
                     Ns_Log(DriverDebug, "SockRead on %p returned %s", (void*)sockPtr, GetSockStateName(s));
 
+                    /*
+                     * Unless more data is expected, the sock leaves the
+                     * set of monitored sockets of this thread.
+                     */
+                    if (s != SOCK_MORE) {
+                        PollSockRemove(&pdata, sockPtr);
+                    }
+
                     /*
                      * Queue for connection processing if ready.
                      */
@@ -2731,9 +3170,14 @@ DriverThread(void *arg)
                         break;
 
                     case SOCK_MORE:
-                        drvPtr->stats.partial++;
-                        SockTimeout(sockPtr, &now, &drvPtr->recvwait);
-                        Push(sockPtr, readPtr);
+                        if (sockPtr->h2ConnPtr != NULL) {
+                            SockHttp2Dispatch(sockPtr, &now, &waitPtr);
+                            SockTimeout(sockPtr, &now, &drvPtr->keepwait);
+                        } else {
+                            drvPtr->stats.partial++;
+                            SockTimeout(sockPtr, &now, &drvPtr->recvwait);
+                        }
+                        SockPark(sockPtr, &readPtr, &readWheel, &pdata);
                         break;
 
                     case SOCK_READY:
@@ -2785,6 +3229,7 @@ DriverThread(void *arg)
                     /*
                      * Potentially blocking driver, NS_DRIVER_ASYNC is not defined
                      */
+                    PollSockRemove(&pdata, sockPtr);
                     if (Ns_DiffTime(&sockPtr->timeout, &now, &diff) <= 0) {
                         drvPtr->stats.errors++;
                         Ns_Log(Notice, "read-ahead has some data, no async sock read ===== diff time %ld",
@@ -2856,9 +3301,14 @@ DriverThread(void *arg)
                             break;
 
                         case SOCK_MORE:
-                            drvPtr->stats.partial++;
-                            SockTimeout(sockPtr, &now, &drvPtr->recvwait);
-                            Push(sockPtr, readPtr);
+                            if (sockPtr->h2ConnPtr != NULL) {
+                                SockHttp2Dispatch(sockPtr, &now, &waitPtr);
+                                SockTimeout(sockPtr, &now, &drvPtr->keepwait);
+                            } else {
+                                drvPtr->stats.partial++;
+                                SockTimeout(sockPtr, &now, &drvPtr->recvwait);
+                            }
+                            SockPark(sockPtr, &readPtr, &readWheel, &pdata);
                             break;
 
                         case SOCK_READY:
@@ -2938,7 +3388,7 @@ DriverThread(void *arg)
          */
         while (sockPtr != NULL) {
             nextPtr = sockPtr->nextPtr;
-            if (sockPtr->keep) {
+            if (sockPtr->keep && sockPtr->sock != NS_INVALID_SOCKET) {
 
                 assert(drvPtr == sockPtr->drvPtr);
 
@@ -2947,7 +3397,8 @@ DriverThread(void *arg)
                        sockPtr->sock);
 
                 SockTimeout(sockPtr, &now, &drvPtr->keepwait);
-                Push(sockPtr, readPtr);
+                SockSetIdle(sockPtr, (sockPtr->h2ConnPtr == NULL));
+                SockPark(sockPtr, &readPtr, &readWheel, &pdata);
             } else {
 
                 /*
@@ -2971,7 +3422,7 @@ DriverThread(void *arg)
                     Ns_Log(DriverDebug, "setting closewait " NS_TIME_FMT " for socket %d",
                            (int64_t)drvPtr->closewait.sec,  drvPtr->closewait.usec, sockPtr->sock);
                     SockTimeout(sockPtr, &now, &drvPtr->closewait);
-                    Push(sockPtr, closePtr);
+                    SockPark(sockPtr, NULL, &closeWheel, &pdata);
                 }
             }
             sockPtr = nextPtr;
@@ -2992,6 +3443,7 @@ DriverThread(void *arg)
     }
 
     PollFree(&pdata);
+    readPtr = WheelDrain(&readWheel, readPtr);
 
     {
         Tcl_HashSearch search;
@@ -3025,11 +3477,45 @@ DriverThread(void *arg)
     Ns_MutexUnlock(&drvPtr->lock);
 }
 
+/*
+ *----------------------------------------------------------------------
+ *
+ * PollCreate --
+ *
+ *      Initialize the PollData structure for the specified event
+ *      notification backend. When the epoll backend is requested but
+ *      cannot be used, fall back to poll().
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Might create an epoll instance.
+ *
+ *----------------------------------------------------------------------
+ */
+
 static void
-PollCreate(PollData *pdata)
+PollCreate(PollData *pdata, NsPollBackend backend)
 {
     NS_NONNULL_ASSERT(pdata != NULL);
     memset(pdata, 0, sizeof(PollData));
+
+#ifdef HAVE_SYS_EPOLL_H
+    pdata->epfd = NS_INVALID_FD;
+    if (backend != NS_POLL_BACKEND_POLL) {
+        pdata->epfd = epoll_create1(EPOLL_CLOEXEC);
+        if (pdata->epfd == NS_INVALID_FD) {
+            Ns_Log(Warning, "PollCreate: epoll_create1() failed: %s; falling back to poll()",
+                   strerror(errno));
+        } else {
+            pdata->maxevents = 100u;
+            pdata->events = ns_malloc(pdata->maxevents * sizeof(struct epoll_event));
+        }
+    }
+#else
+    (void)backend;
+#endif
 }
 
 static void
@@ -3037,6 +3523,12 @@ PollFree(PollData *pdata)
 {
     NS_NONNULL_ASSERT(pdata != NULL);
     ns_free(pdata->pfds);
+#ifdef HAVE_SYS_EPOLL_H
+    if (pdata->epfd != NS_INVALID_FD) {
+        (void) ns_close(pdata->epfd);
+    }
+    ns_free(pdata->events);
+#endif
     memset(pdata, 0, sizeof(PollData));
 }
 
@@ -3049,6 +3541,30 @@ PollReset(PollData *pdata)
     pdata->timeout.usec = 0;
 }
 
+/*
+ *----------------------------------------------------------------------
+ *
+ * PollUpdateTimeout --
+ *
+ *      Check for a new minimum timeout for the next spin.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Might update pdata->timeout.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+PollUpdateTimeout(PollData *pdata, const Ns_Time *timeoutPtr)
+{
+    if (timeoutPtr != NULL && Ns_DiffTime(timeoutPtr, &pdata->timeout, NULL) < 0) {
+        pdata->timeout = *timeoutPtr;
+    }
+}
+
 static NS_POLL_NFDS_TYPE
 PollSet(PollData *pdata, NS_SOCKET sock, short type, const Ns_Time *timeoutPtr)
 {
@@ -3062,6 +3578,27 @@ PollSet(PollData *pdata, NS_SOCKET sock, short type, const Ns_Time *timeoutPtr)
         pdata->pfds = ns_realloc(pdata->pfds, pdata->maxfds * sizeof(struct pollfd));
     }
 
+#ifdef HAVE_SYS_EPOLL_H
+    /*
+     * In epoll mode, the entries of the pfds array are registered only
+     * once. The fixed fds are always set in the same order at the begin of
+     * a spin, so the index identifies the fd. The index is used as event
+     * data to distinguish these entries from the registered socks.
+     */
+    if (pdata->epfd != NS_INVALID_FD
+        && (pdata->nfds >= pdata->nfixed || pdata->pfds[pdata->nfds].fd != sock)
+        ) {
+        struct epoll_event ev;
+
+        ev.events = (uint32_t)type;
+        ev.data.u64 = (uint64_t)pdata->nfds;
+        if (epoll_ctl(pdata->epfd, EPOLL_CTL_ADD, sock, &ev) != 0) {
+            Ns_Log(Error, "PollSet: epoll_ctl() on fd %d failed: %s", sock, strerror(errno));
+        }
+        pdata->nfixed = pdata->nfds + 1u;
+    }
+#endif
+
     /*
      * Set the next pollfd struct with this socket.
      */
@@ -3070,30 +3607,62 @@ PollSet(PollData *pdata, NS_SOCKET sock, short type, const Ns_Time *timeoutPtr)
     pdata->pfds[pdata->nfds].events = type;
     pdata->pfds[pdata->nfds].revents = 0;
 
-    /*
-     * Check for new minimum timeout.
-     */
-
-    if (timeoutPtr != NULL && Ns_DiffTime(timeoutPtr, &pdata->timeout, NULL) < 0) {
-        pdata->timeout = *timeoutPtr;
-    }
+    PollUpdateTimeout(pdata, timeoutPtr);
 
     return pdata->nfds++;
 }
 
 static int
-PollWait(const PollData *pdata, int timeout)
+PollWait(PollData *pdata, int timeout)
 {
     int n;
 
     NS_NONNULL_ASSERT(pdata != NULL);
 
-    do {
-        n = ns_poll(pdata->pfds, pdata->nfds, timeout);
-    } while (n < 0  && errno == NS_EINTR);
+#ifdef HAVE_SYS_EPOLL_H
+    if (pdata->epfd != NS_INVALID_FD) {
+        int i;
+
+        if (unlikely(pdata->nfixed + pdata->nsocks > pdata->maxevents)) {
+            pdata->maxevents = pdata->nfixed + pdata->nsocks + 100u;
+            pdata->events = ns_realloc(pdata->events, pdata->maxevents * sizeof(struct epoll_event));
+        }
+
+        do {
+            n = epoll_wait(pdata->epfd, pdata->events, (int)pdata->maxevents, timeout);
+        } while (n < 0  && errno == NS_EINTR);
+
+        if (n < 0) {
+            Ns_Fatal("PollWait: epoll_wait() failed: %s", strerror(errno));
+        }
+
+        /*
+         * Distribute the events to the pfds array (fixed fds) or to the
+         * registered socks. The EPOLL* event bits have the same values
+         * as the POLL* bits.
+         */
+        for (i = 0; i < n; i++) {
+            const struct epoll_event *evPtr = &pdata->events[i];
+            short revents = (short)(evPtr->events & (EPOLLIN|EPOLLOUT|EPOLLERR|EPOLLHUP));
+
+            if (evPtr->data.u64 < (uint64_t)pdata->nfixed) {
+                pdata->pfds[evPtr->data.u64].revents = revents;
+            } else {
+                Sock *sockPtr = (Sock *)(uintptr_t)evPtr->data.u64;
 
-    if (n < 0) {
-        Ns_Fatal("PollWait: ns_poll() failed: %s", ns_sockstrerror(ns_sockerrno));
+                sockPtr->revents = revents;
+            }
+        }
+    } else
+#endif
+    {
+        do {
+            n = ns_poll(pdata->pfds, pdata->nfds, timeout);
+        } while (n < 0  && errno == NS_EINTR);
+
+        if (n < 0) {
+            Ns_Fatal("PollWait: ns_poll() failed: %s", ns_sockstrerror(ns_sockerrno));
+        }
     }
     return n;
 }
@@ -3101,46 +3670,151 @@ PollWait(const PollData *pdata, int timeout)
 /*
  *----------------------------------------------------------------------
  *
- * RequestNew
+ * PollSockEvents --
  *
- *      Allocates or reuses a "Request" struct. The struct might be reused
- *      from the pool or freshly allocated. Counterpart of RequestFree().
+ *      Return the events reported for the Sock by the last PollWait().
+ *      In poll() mode, the index of the Sock is checked to belong to the
+ *      current spin, since e.g. writer socks are not polled in every spin.
  *
  * Results:
- *      None
+ *      Poll event bits (POLLIN, POLLOUT, POLLHUP, ...).
  *
  * Side effects:
- *      None
+ *      In epoll mode, the events are consumed.
  *
  *----------------------------------------------------------------------
  */
 
-static Request *
-RequestNew(void)
+static short
+PollSockEvents(const PollData *pdata, Sock *sockPtr)
 {
-    Request *reqPtr;
-    bool     reuseRequest = NS_TRUE;
+    short revents = 0;
 
-    /*
-     * Try to get a request from the pool of allocated Requests.
-     */
-    Ns_MutexLock(&reqLock);
-    reqPtr = firstReqPtr;
-    if (likely(reqPtr != NULL)) {
-        firstReqPtr = reqPtr->nextPtr;
-    } else {
-        reuseRequest = NS_FALSE;
+    NS_NONNULL_ASSERT(pdata != NULL);
+    NS_NONNULL_ASSERT(sockPtr != NULL);
+
+#ifdef HAVE_SYS_EPOLL_H
+    if (pdata->epfd != NS_INVALID_FD) {
+        revents = sockPtr->revents;
+        sockPtr->revents = 0;
+    } else
+#endif
+    if ((unsigned int)sockPtr->pidx < pdata->nfds
+        && pdata->pfds[sockPtr->pidx].fd == sockPtr->sock) {
+        revents = pdata->pfds[sockPtr->pidx].revents;
     }
-    Ns_MutexUnlock(&reqLock);
 
-    if (reuseRequest) {
-        Ns_Log(DriverDebug, "RequestNew reuses a Request");
+    return revents;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * PollSockRemove --
+ *
+ *      Remove the Sock from the set of monitored sockets. This has to be
+ *      called, before the Sock is passed to a different thread or
+ *      released. In poll() mode, this is a no-op.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Might deregister the socket from the epoll instance.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+PollSockRemove(PollData *pdata, Sock *sockPtr)
+{
+    NS_NONNULL_ASSERT(pdata != NULL);
+    NS_NONNULL_ASSERT(sockPtr != NULL);
+
+#ifdef HAVE_SYS_EPOLL_H
+    if (pdata->epfd != NS_INVALID_FD && sockPtr->pollEvents != 0u) {
+        struct epoll_event ev = {0u, {NULL}};
+
+        if (epoll_ctl(pdata->epfd, EPOLL_CTL_DEL, sockPtr->sock, &ev) != 0 && errno != EBADF) {
+            Ns_Log(Warning, "PollSockRemove: epoll_ctl() on sock %d failed: %s",
+                   sockPtr->sock, strerror(errno));
+        }
+        sockPtr->pollEvents = 0u;
+        sockPtr->pollDataPtr = NULL;
+        sockPtr->revents = 0;
+        pdata->nsocks--;
+    }
+#else
+    (void)pdata;
+    (void)sockPtr;
+#endif
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * PollBackendName --
+ *
+ *      Return the name of the event notification backend as used in the
+ *      configuration file.
+ *
+ * Results:
+ *      String.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static const char *
+PollBackendName(NsPollBackend backend)
+{
+    const char *result = "poll";
+
+    switch (backend) {
+    case NS_POLL_BACKEND_POLL:  result = "poll"; break;
+    case NS_POLL_BACKEND_EPOLL: result = "epoll"; break;
     }
+    return result;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * RequestNew
+ *
+ *      Allocates or reuses a "Request" struct. The struct might be reused
+ *      from the request slab of the driver or freshly allocated.
+ *      Counterpart of RequestFree().
+ *
+ * Results:
+ *      None
+ *
+ * Side effects:
+ *      None
+ *
+ *----------------------------------------------------------------------
+ */
+
+static Request *
+RequestNew(Driver *drvPtr)
+{
+    Request *reqPtr;
+
+    NS_NONNULL_ASSERT(drvPtr != NULL);
 
     /*
-     * In case we failed, allocate a new Request.
+     * Try to get a request from the request slab of the driver.
      */
-    if (reqPtr == NULL) {
+    reqPtr = SlabGet(&drvPtr->requestSlab);
+    if (likely(reqPtr != NULL)) {
+        Ns_Log(DriverDebug, "RequestNew reuses a Request");
+
+    } else {
+        /*
+         * In case we failed, allocate a new Request.
+         */
         Ns_Log(DriverDebug, "RequestNew gets a fresh Request");
         reqPtr = ns_calloc(1u, sizeof(Request));
         Tcl_DStringInit(&reqPtr->buffer);
@@ -3218,12 +3892,17 @@ RequestFree(Sock *sockPtr)
     } else {
         /*
          * Clean large buffers in order to avoid memory growth on huge
-         * uploads (when maxupload is huge)
+         * uploads (when maxupload is huge). In lean keepalive mode, keep
+         * no more than the read-ahead size in the request slab.
          */
+        const Driver *drvPtr = sockPtr->drvPtr;
+
         /*fprintf(stderr, "=== reuse buffer size %d avail %d dynamic %d\n",
                 reqPtr->buffer.length, reqPtr->buffer.spaceAvl,
                 reqPtr->buffer.string == reqPtr->buffer.staticSpace);*/
-        if (Tcl_DStringLength(&reqPtr->buffer) > 65536) {
+        if (drvPtr->leanKeepalive
+            ? (Tcl_WideInt)reqPtr->buffer.spaceAvl > drvPtr->readahead + 1
+            : Tcl_DStringLength(&reqPtr->buffer) > 65536) {
             Tcl_DStringFree(&reqPtr->buffer);
         } else {
             /*
@@ -3280,15 +3959,13 @@ RequestFree(Sock *sockPtr)
 
     if (!keep) {
         /*
-         * Push the reqPtr to the pool for reuse in other connections.
+         * Push the reqPtr to the request slab for reuse in other
+         * connections.
          */
         sockPtr->reqPtr = NULL;
 
-        Ns_MutexLock(&reqLock);
-        reqPtr->nextPtr = firstReqPtr;
-        firstReqPtr = reqPtr;
-        Ns_MutexUnlock(&reqLock);
-        Ns_Log(DriverDebug, "=== Push request structure %p in (to pool)",
+        SlabPut(&sockPtr->drvPtr->requestSlab, reqPtr);
+        Ns_Log(DriverDebug, "=== Push request structure %p in (to slab)",
                (void*)reqPtr);
 
     } else {
@@ -3331,6 +4008,15 @@ SockQueue(Sock *sockPtr, const Ns_Time *timePtr)
     if (likely(result == NS_OK)) {
         assert(sockPtr->servPtr != NULL || *sockPtr->reqPtr->request.method == 'B');
 
+        /*
+         * Answer the request directly from the micro-cache of the server
+         * or deliver a static file via the driver fast lane, when
+         * possible.
+         */
+        if (NsMicroCacheServe(sockPtr, timePtr) || NsFastPathDriver(sockPtr)) {
+            return NS_OK;
+        }
+
         /*
          *  Actual queueing. When we receive NS_ERROR or NS_TIMEOUT, the queuing
          *  did not succeed.
@@ -3370,7 +4056,78 @@ SockPoll(Sock *sockPtr, short type, PollData *pdata)
     NS_NONNULL_ASSERT(sockPtr != NULL);
     NS_NONNULL_ASSERT(pdata != NULL);
 
-    sockPtr->pidx = PollSet(pdata, sockPtr->sock, type, &sockPtr->timeout);
+    if (unlikely(sockPtr->sock == NS_INVALID_SOCKET)) {
+        /*
+         * The file descriptor was closed or handed over (e.g. to a
+         * connchan), there is nothing to monitor.
+         */
+        Ns_Log(DriverDebug, "SockPoll: ignore sock %p with invalid fd", (void*)sockPtr);
+    } else
+#ifdef HAVE_SYS_EPOLL_H
+    if (pdata->epfd != NS_INVALID_FD) {
+        /*
+         * The socket stays registered between spins; a system call is
+         * only necessary when the registered events change. A type of 0
+         * suspends monitoring, but keeps the registration.
+         */
+        unsigned int events = (unsigned int)(unsigned short)type | POLL_REGISTERED;
+
+        if (sockPtr->pollEvents != events) {
+            struct epoll_event ev;
+            int                op = (sockPtr->pollEvents == 0u) ? EPOLL_CTL_ADD : EPOLL_CTL_MOD;
+
+            ev.events = (uint32_t)(unsigned short)type;
+            ev.data.u64 = (uint64_t)(uintptr_t)sockPtr;
+            if (epoll_ctl(pdata->epfd, op, sockPtr->sock, &ev) != 0) {
+                Ns_Log(Error, "SockPoll: epoll_ctl() on sock %d failed: %s",
+                       sockPtr->sock, strerror(errno));
+            } else {
+                if (op == EPOLL_CTL_ADD) {
+                    pdata->nsocks++;
+                    sockPtr->pollDataPtr = pdata;
+                }
+                sockPtr->pollEvents = events;
+            }
+        }
+        PollUpdateTimeout(pdata, &sockPtr->timeout);
+    } else
+#endif
+    {
+        sockPtr->pidx = PollSet(pdata, sockPtr->sock, type, &sockPtr->timeout);
+    }
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * SockPollSuspend --
+ *
+ *      Stop reporting readiness events for a Sock, which is kept in the
+ *      list of the thread without being polled in this spin (e.g. a
+ *      throttled writer). With poll(), omitting the Sock from the pfds
+ *      array is sufficient; with epoll, the registration has to be
+ *      changed, since it persists between spins.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Might modify the epoll registration of the socket.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+SockPollSuspend(Sock *sockPtr, PollData *pdata)
+{
+    NS_NONNULL_ASSERT(sockPtr != NULL);
+    NS_NONNULL_ASSERT(pdata != NULL);
+
+#ifdef HAVE_SYS_EPOLL_H
+    if (pdata->epfd != NS_INVALID_FD) {
+        SockPoll(sockPtr, 0, pdata);
+    }
+#endif
 }
 
 /*
@@ -3397,171 +4154,105 @@ SockTimeout(Sock *sockPtr, const Ns_Time *nowPtr, const Ns_Time *timeout)
     Ns_IncrTime(&sockPtr->timeout, timeout->sec, timeout->usec);
 }
 
-
-
 /*
  *----------------------------------------------------------------------
  *
- * SockAccept --
+ * SockPark --
  *
- *      Accept and initialize a new Sock in sockPtrPtr.
+ *      Keep a Sock in the driver thread until new data arrives or its
+ *      deadline (sockPtr->timeout) expires. Idle socks are placed in the
+ *      provided timing wheel, such that the driver thread does not have
+ *      to visit them on every spin. When a list is provided, HTTP/2
+ *      connections and socks with pipelined leftover data, which have to
+ *      be checked on every spin, are pushed to this list instead.
  *
  * Results:
- *      SOCK_READY, SOCK_MORE, SOCK_SPOOL,
- *      SOCK_ERROR + NULL sockPtr.
+ *      None.
  *
  * Side effects:
- *      Read-ahead may be attempted on new socket.
+ *      In epoll mode, the socket is registered for readability.
  *
  *----------------------------------------------------------------------
  */
 
-static SockState
-SockAccept(Driver *drvPtr, NS_SOCKET sock, Sock **sockPtrPtr, const Ns_Time *nowPtr)
+static void
+SockPark(Sock *sockPtr, Sock **listPtrPtr, SockWheel *wheelPtr, PollData *pdata)
 {
-    Sock    *sockPtr;
-    SockState sockStatus;
-    NS_DRIVER_ACCEPT_STATUS status;
-
-    NS_NONNULL_ASSERT(drvPtr != NULL);
-
-    sockPtr = SockNew(drvPtr);
-
-    /*
-     * Accept the new connection.
-     */
-
-    status = DriverAccept(sockPtr, sock);
-
-    if (unlikely(status == NS_DRIVER_ACCEPT_ERROR)) {
-        sockStatus = SOCK_ERROR;
+    NS_NONNULL_ASSERT(sockPtr != NULL);
+    NS_NONNULL_ASSERT(wheelPtr != NULL);
+    NS_NONNULL_ASSERT(pdata != NULL);
 
+    if (listPtrPtr != NULL
+        && (sockPtr->h2ConnPtr != NULL
+            || (sockPtr->reqPtr != NULL && sockPtr->reqPtr->leftover > 0u))
+        ) {
+        Push(sockPtr, *listPtrPtr);
+    } else {
+        WheelAdd(wheelPtr, sockPtr);
+#ifdef HAVE_SYS_EPOLL_H
         /*
-         * We reach the place frequently, especially on Linux, when we try to
-         * accept multiple connection in one sweep. Usually, the errno is
-         * NS_EAGAIN.
+         * In poll() mode, the socks of the wheel are added to the pfds
+         * array by WheelPoll() before every wait.
          */
-
-        Ns_MutexLock(&drvPtr->lock);
-        sockPtr->nextPtr = drvPtr->sockPtr;
-        drvPtr->sockPtr = sockPtr;
-        Ns_MutexUnlock(&drvPtr->lock);
-        /*fprintf(stderr, "=== NS_DRIVER_ACCEPT_ERROR drv %p got %p\n", (void*)drvPtr, (void*)sockPtr);*/
-
-        sockPtr = NULL;
-
-    } else {
-        sockPtr->acceptTime = *nowPtr;
-        drvPtr->queuesize++;
-
-        if (status == NS_DRIVER_ACCEPT_DATA) {
-
-            /*
-             * If there is already data present then read it without
-             * polling if we're in async mode.
-             */
-
-            if ((drvPtr->opts & NS_DRIVER_ASYNC) != 0u) {
-                sockStatus = SockRead(sockPtr, 0, nowPtr);
-                if ((int)sockStatus < 0) {
-                    Ns_Log(DriverDebug, "SockRead returned error %s",
-                           GetSockStateName(sockStatus));
-
-                    SockRelease(sockPtr, sockStatus, errno);
-                    sockStatus = SOCK_ERROR;
-                    sockPtr = NULL;
-                }
-            } else {
-
-                /*
-                 * Queue this socket without reading, NsGetRequest() in the
-                 * connection thread will perform actual reading of the
-                 * request.
-                 */
-                sockStatus = SOCK_READY;
-            }
-        } else if (status == NS_DRIVER_ACCEPT_QUEUE) {
-
-            /*
-             *  We need to call RequestNew() to make sure socket has request
-             *  structure allocated, otherwise NsGetRequest() will call
-             *  SockRead() which is not what this driver wants.
-             */
-            if (sockPtr->reqPtr == NULL) {
-                sockPtr->reqPtr = RequestNew();
-            }
-            sockStatus = SOCK_READY;
-        } else {
-            sockStatus = SOCK_MORE;
+        if (pdata->epfd != NS_INVALID_FD) {
+            SockPoll(sockPtr, (short)POLLIN, pdata);
         }
+#endif
     }
-
-    *sockPtrPtr = sockPtr;
-
-    return sockStatus;
 }
 
-
 /*
  *----------------------------------------------------------------------
  *
- * SockNew --
+ * WheelTick, WheelFirstBit --
  *
- *      Allocate and/or initialize a Sock structure. Counterpart of
- *      SockRelease().
+ *      Helpers of the timing wheel: convert a time to ticks
+ *      (milliseconds), rounding deadlines up, and determine the lowest
+ *      bit set in a non-empty bitmap.
  *
  * Results:
- *      SockPtr
+ *      Tick resp. bit number.
  *
  * Side effects:
- *      Potentially new memory is allocated.
+ *      None.
  *
  *----------------------------------------------------------------------
  */
 
-static Sock *
-SockNew(Driver *drvPtr)
+static uint64_t
+WheelTick(const Ns_Time *timePtr, bool roundUp)
 {
-    Sock *sockPtr;
-
-    NS_NONNULL_ASSERT(drvPtr != NULL);
-
-    Ns_MutexLock(&drvPtr->lock);
-    sockPtr = drvPtr->sockPtr;
-    if (likely(sockPtr != NULL)) {
-        drvPtr->sockPtr = sockPtr->nextPtr;
-        sockPtr->keep   = NS_FALSE;
-        /*fprintf(stderr, "=== SockNew drv %p got %p set %p\n", (void*)drvPtr, (void*)sockPtr, (void*)drvPtr->sockPtr);*/
+    uint64_t result = 0u;
 
+    if (timePtr->sec >= 0) {
+        result = (uint64_t)timePtr->sec * 1000u
+            + (uint64_t)(timePtr->usec + (roundUp ? 999 : 0)) / 1000u;
     }
-    Ns_MutexUnlock(&drvPtr->lock);
+    return result;
+}
 
-    if (sockPtr == NULL) {
-        size_t sockSize = sizeof(Sock) + (nsconf.nextSlsId * sizeof(Ns_Callback *));
-        sockPtr = ns_calloc(1u, sockSize);
-        /*fprintf(stderr, "=== SockNew %p\n", (void*)sockPtr);*/
-        sockPtr->drvPtr = drvPtr;
-    } else {
-        sockPtr->tfd     = 0;
-        sockPtr->taddr   = NULL;
-        sockPtr->flags   = 0u;
-        sockPtr->arg     = NULL;
-        sockPtr->poolPtr = NULL;
-        sockPtr->recvSockState = NS_SOCK_NONE;
-        sockPtr->recvErrno = 0u;
-        sockPtr->sendErrno = 0u;
+static unsigned int
+WheelFirstBit(uint64_t bits)
+{
+#if defined(__GNUC__)
+    return (unsigned int)__builtin_ctzll(bits);
+#else
+    unsigned int result = 0u;
+
+    while ((bits & 1u) == 0u) {
+        bits >>= 1;
+        result++;
     }
-    return sockPtr;
+    return result;
+#endif
 }
 
-
 /*
  *----------------------------------------------------------------------
  *
- * SockRelease --
+ * WheelInit --
  *
- *      Close a socket and release the connection structure for
- *      reuse.
+ *      Initialize an empty timing wheel starting at the given time.
  *
  * Results:
  *      None.
@@ -3573,3020 +4264,4786 @@ SockNew(Driver *drvPtr)
  */
 
 static void
-SockRelease(Sock *sockPtr, SockState reason, int err)
+WheelInit(SockWheel *wheelPtr, const Ns_Time *nowPtr)
 {
-    Driver *drvPtr;
-
-    NS_NONNULL_ASSERT(sockPtr != NULL);
-
-    Ns_Log(DriverDebug, "SockRelease reason %s err %d (sock %d)",
-           GetSockStateName(reason), err, sockPtr->sock);
+    memset(wheelPtr, 0, sizeof(SockWheel));
+    wheelPtr->tick = WheelTick(nowPtr, NS_FALSE);
+}
 
-    if (reason == SOCK_ERROR) {
-        /*
-         * In case of early errors (e.g. SockSendResponse), try to provide a
-         * more specific error code rather than just 400.
-         */
-        Ns_Log(DriverDebug, "... flags %.6x", sockPtr->flags);
-        if ((sockPtr->flags & NS_CONN_ENTITYTOOLARGE) != 0) {
-            reason = SOCK_ENTITYTOOLARGE;
-        }
-    }
-
-    /*fprintf(stderr, "=== SockRelease %p\n", (void*)sockPtr);*/
+/*
+ *----------------------------------------------------------------------
+ *
+ * WheelAdd, WheelRemove --
+ *
+ *      Queue a Sock in the timing wheel based on its deadline
+ *      (sockPtr->timeout), or remove it from the wheel it was queued in.
+ *      Both operations are O(1).
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Updates the links of the Sock and the slots of the wheel.
+ *
+ *----------------------------------------------------------------------
+ */
 
-    drvPtr = sockPtr->drvPtr;
-    assert(drvPtr != NULL);
+static void
+WheelAdd(SockWheel *wheelPtr, Sock *sockPtr)
+{
+    uint64_t     expires, delta;
+    unsigned int level, idx;
+    Sock       **headPtr;
 
-    SockError(sockPtr, reason, err);
+    NS_NONNULL_ASSERT(wheelPtr != NULL);
+    NS_NONNULL_ASSERT(sockPtr != NULL);
+    assert(sockPtr->timerWheelPtr == NULL);
 
-    if (sockPtr->sock != NS_INVALID_SOCKET) {
-        SockClose(sockPtr, (int)NS_FALSE);
-    } else {
-        Ns_Log(DriverDebug, "SockRelease bypasses SockClose, since we have an invalid socket");
+    expires = WheelTick(&sockPtr->timeout, NS_TRUE);
+    if (expires < wheelPtr->tick) {
+        expires = wheelPtr->tick;
+    } else if (expires - wheelPtr->tick >= WHEEL_RANGE) {
+        expires = wheelPtr->tick + WHEEL_RANGE - 1u;
     }
-    NsSlsCleanup(sockPtr);
 
-    drvPtr->queuesize--;
+    delta = expires - wheelPtr->tick;
+    for (level = 0u; level < WHEEL_LEVELS - 1u; level++) {
+        if (delta < ((uint64_t)1u << (WHEEL_BITS * (level + 1u)))) {
+            break;
+        }
+    }
+    idx = (unsigned int)(expires >> (WHEEL_BITS * level)) & WHEEL_MASK;
 
-    if (sockPtr->reqPtr != NULL) {
-        Ns_Log(DriverDebug, "SockRelease calls RequestFree");
-        RequestFree(sockPtr);
+    headPtr = &wheelPtr->slots[level][idx];
+    sockPtr->timerPrevPtr = NULL;
+    sockPtr->timerNextPtr = *headPtr;
+    if (*headPtr != NULL) {
+        (*headPtr)->timerPrevPtr = sockPtr;
     }
+    *headPtr = sockPtr;
+    wheelPtr->occupied[level] |= ((uint64_t)1u << idx);
+    wheelPtr->count++;
 
-    Ns_MutexLock(&drvPtr->lock);
-    sockPtr->nextPtr = drvPtr->sockPtr;
-    drvPtr->sockPtr  = sockPtr;
-    Ns_MutexUnlock(&drvPtr->lock);
-    /*fprintf(stderr, "=== SockRelease drv %p got %p\n", (void*)drvPtr, (void*)sockPtr);*/
+    sockPtr->timerWheelPtr = wheelPtr;
+    sockPtr->timerSlot = level * WHEEL_SLOTS + idx;
+}
+
+static void
+WheelRemove(Sock *sockPtr)
+{
+    SockWheel   *wheelPtr;
+    unsigned int level, idx;
+
+    NS_NONNULL_ASSERT(sockPtr != NULL);
 
+    wheelPtr = sockPtr->timerWheelPtr;
+    assert(wheelPtr != NULL);
+
+    level = sockPtr->timerSlot / WHEEL_SLOTS;
+    idx = sockPtr->timerSlot & WHEEL_MASK;
+
+    if (sockPtr->timerPrevPtr != NULL) {
+        sockPtr->timerPrevPtr->timerNextPtr = sockPtr->timerNextPtr;
+    } else {
+        wheelPtr->slots[level][idx] = sockPtr->timerNextPtr;
+        if (sockPtr->timerNextPtr == NULL) {
+            wheelPtr->occupied[level] &= ~((uint64_t)1u << idx);
+        }
+    }
+    if (sockPtr->timerNextPtr != NULL) {
+        sockPtr->timerNextPtr->timerPrevPtr = sockPtr->timerPrevPtr;
+    }
+    wheelPtr->count--;
+    sockPtr->timerWheelPtr = NULL;
 }
 
-
 /*
  *----------------------------------------------------------------------
  *
- * SockError --
+ * WheelExpire --
  *
- *      Log error message for given socket
- *      reuse.
+ *      Advance the timing wheel to the given time. Socks of higher
+ *      levels are cascaded down when the lower levels wrap around, the
+ *      socks of the reached level 0 slots have expired. Ticks without
+ *      socks in level 0 are skipped up to the next cascade, therefore the
+ *      costs do not depend on the number of queued socks.
  *
  * Results:
- *      None.
+ *      Provided list extended by the expired socks (linked via nextPtr).
  *
  * Side effects:
- *      None.
+ *      Expired socks are removed from the wheel.
  *
  *----------------------------------------------------------------------
  */
 
-static void
-SockError(Sock *sockPtr, SockState reason, int err)
+static Sock *
+WheelExpire(SockWheel *wheelPtr, const Ns_Time *nowPtr, Sock *listPtr)
 {
-    const char *errMsg = NULL;
+    uint64_t now;
 
-    NS_NONNULL_ASSERT(sockPtr != NULL);
-
-    switch (reason) {
-    case SOCK_READY: NS_FALL_THROUGH; /* fall through */
-    case SOCK_SPOOL: NS_FALL_THROUGH; /* fall through */
-    case SOCK_MORE:  NS_FALL_THROUGH; /* fall through */
-    case SOCK_CLOSE: NS_FALL_THROUGH; /* fall through */
-    case SOCK_CLOSETIMEOUT:
-        /* This is normal, never log. */
-        break;
-
-    case SOCK_READTIMEOUT:
-        /*
-         * For this case, whether this is acceptable or not
-         * depends upon whether this sock was a keep-alive
-         * that we were allowing to 'linger'.
-         */
-        if (!sockPtr->keep) {
-            errMsg = "Timeout during read";
-        }
-        break;
-
-    case SOCK_WRITETIMEOUT:
-        errMsg = "Timeout during write";
-        break;
-
-    case SOCK_READERROR:
-        errMsg = "Unable to read request";
-        break;
-
-    case SOCK_WRITEERROR:
-        errMsg = "Unable to write request";
-        break;
-
-    case SOCK_SHUTERROR:
-        errMsg = "Unable to shutdown socket";
-        break;
+    NS_NONNULL_ASSERT(wheelPtr != NULL);
+    NS_NONNULL_ASSERT(nowPtr != NULL);
 
-    case SOCK_BADREQUEST:
-        errMsg = "Bad Request";
-        SockSendResponse(sockPtr, 400, errMsg, NULL);
-        break;
+    now = WheelTick(nowPtr, NS_FALSE);
 
-    case SOCK_TOOMANYHEADERS:
-        errMsg = "Too Many Request Headers";
-        SockSendResponse(sockPtr, 414, errMsg, NULL);
-        break;
+    while (wheelPtr->tick <= now && wheelPtr->count > 0u) {
+        unsigned int idx = (unsigned int)wheelPtr->tick & WHEEL_MASK;
+        Sock        *sockPtr, *nextPtr;
 
-    case SOCK_BADHEADER:
-        errMsg = "Invalid Request Header";
-        SockSendResponse(sockPtr, 400, errMsg, NULL);
-        break;
+        if (idx == 0u) {
+            unsigned int level;
 
-    case SOCK_ENTITYTOOLARGE:
-        errMsg = "Request Entity Too Large";
-        SockSendResponse(sockPtr, 413, errMsg, NULL);
-        break;
+            for (level = 1u; level < WHEEL_LEVELS; level++) {
+                unsigned int slot = (unsigned int)(wheelPtr->tick >> (WHEEL_BITS * level)) & WHEEL_MASK;
 
-    case SOCK_ERROR:
-        errMsg = "Unknown Error";
-        SockSendResponse(sockPtr, 400, errMsg, NULL);
-        break;
+                sockPtr = wheelPtr->slots[level][slot];
+                wheelPtr->slots[level][slot] = NULL;
+                wheelPtr->occupied[level] &= ~((uint64_t)1u << slot);
+                for (; sockPtr != NULL; sockPtr = nextPtr) {
+                    nextPtr = sockPtr->timerNextPtr;
+                    sockPtr->timerWheelPtr = NULL;
+                    wheelPtr->count--;
+                    WheelAdd(wheelPtr, sockPtr);
+                }
+                if (slot != 0u) {
+                    break;
+                }
+            }
+        }
 
-    case SOCK_QUEUEFULL:
-        errMsg = "Service Unavailable";
-        if (sockPtr->poolPtr != NULL && sockPtr->poolPtr->wqueue.retryafter.sec > 0) {
-            char headers[14 + TCL_INTEGER_SPACE];
+        sockPtr = wheelPtr->slots[0][idx];
+        wheelPtr->slots[0][idx] = NULL;
+        wheelPtr->occupied[0] &= ~((uint64_t)1u << idx);
+        for (; sockPtr != NULL; sockPtr = nextPtr) {
+            nextPtr = sockPtr->timerNextPtr;
+            sockPtr->timerWheelPtr = NULL;
+            wheelPtr->count--;
+            if (Ns_DiffTime(&sockPtr->timeout, nowPtr, NULL) > 0) {
+                /*
+                 * Deadline was beyond the range of the wheel.
+                 */
+                WheelAdd(wheelPtr, sockPtr);
+            } else {
+                Push(sockPtr, listPtr);
+            }
+        }
 
-            snprintf(headers, sizeof(headers), "Retry-After: %" PRId64,
-                     (int64_t)sockPtr->poolPtr->wqueue.retryafter.sec);
-            SockSendResponse(sockPtr, 503, errMsg, headers);
+        if (wheelPtr->occupied[0] == 0u) {
+            wheelPtr->tick = MIN((wheelPtr->tick | WHEEL_MASK) + 1u, now + 1u);
         } else {
-            SockSendResponse(sockPtr, 503, errMsg, NULL);
+            wheelPtr->tick++;
         }
-        break;
     }
 
-    if (errMsg != NULL) {
-        char ipString[NS_IPADDR_SIZE];
-
-        Ns_Log(DriverDebug, "SockError: %s (%d: %s), sock: %d, peer: [%s]:%d, request: %.99s",
-               errMsg,
-               err, (err != 0) ? strerror(err) : NS_EMPTY_STRING,
-               sockPtr->sock,
-               ns_inet_ntop((struct sockaddr *)&(sockPtr->sa), ipString, sizeof(ipString)),
-               Ns_SockaddrGetPort((struct sockaddr *)&(sockPtr->sa)),
-               (sockPtr->reqPtr != NULL) ? sockPtr->reqPtr->buffer.string : NS_EMPTY_STRING);
+    if (wheelPtr->count == 0u && wheelPtr->tick <= now) {
+        wheelPtr->tick = now + 1u;
     }
+
+    return listPtr;
 }
-
+
 /*
  *----------------------------------------------------------------------
  *
- * NsAddNslogEntry --
- *
- *      Add an entry to the access log, when the request is not handled by the
- *      trace of a connection thread.
- *
- *      Applications:
- *       - direct replies from the driver thread (via SockSendResponse())
- *       - 100 CONTINUE,
- *       - cases where the TRACE is not called in the connection thread.
+ * WheelReady --
  *
- *       Currently, the function is just used for the first two cases.
+ *      Take the socks with events reported by the last PollWait() out of
+ *      the timing wheel. In epoll mode, only the returned events are
+ *      inspected, in poll() mode, all socks of the wheel are checked.
  *
  * Results:
- *      None.
+ *      Provided list extended by the ready socks (linked via nextPtr).
  *
  * Side effects:
- *      Potentially adding an entry to the access.log file.
+ *      Ready socks are removed from the wheel.
  *
  *----------------------------------------------------------------------
  */
-void
-NsAddNslogEntry(Sock *sockPtr, int statusCode, Ns_Conn *connPtr, const char *UNUSED(headers))
-{
-    bool isConnConstructed;
-    Conn conn;
 
-    NS_NONNULL_ASSERT(sockPtr != NULL);
+static Sock *
+WheelReady(SockWheel *wheelPtr, const PollData *pdata, int nrEvents, Sock *listPtr)
+{
+    NS_NONNULL_ASSERT(wheelPtr != NULL);
+    NS_NONNULL_ASSERT(pdata != NULL);
 
-    if (connPtr == NULL) {
-        /*
-         * We want to call LogTrace(), but we have no connPtr structure. The
-         * connection structure contains the relevant information for the
-         * access.log entry. If possible, construct a connPtr on the fly based
-         * on the information provided by sockPtr.
-         */
-        if (sockPtr->reqPtr != NULL && sockPtr->reqPtr->headers != NULL) {
-            const char *auth;
-            const NsServer *servPtr;
-            /*
-             * It is possible to create a connection structure on the
-             * fly.
-             */
-            isConnConstructed = NS_TRUE;
-            connPtr = (Ns_Conn *)&conn;
+#ifdef HAVE_SYS_EPOLL_H
+    if (pdata->epfd != NS_INVALID_FD) {
+        int i;
 
-            memset(&conn, 0, sizeof(conn));
+        for (i = 0; i < nrEvents; i++) {
+            const struct epoll_event *evPtr = &pdata->events[i];
 
-            conn.drvPtr             = sockPtr->drvPtr;
-            conn.reqPtr             = sockPtr->reqPtr;
-            conn.request            = sockPtr->reqPtr->request;
-            conn.headers            = conn.reqPtr->headers;
-            conn.responseStatus     = statusCode;
-            conn.acceptTime         = sockPtr->acceptTime;
-            conn.requestQueueTime   = sockPtr->acceptTime;
-            conn.requestDequeueTime = sockPtr->acceptTime;
-            conn.filterDoneTime     = sockPtr->acceptTime;
+            if (evPtr->data.u64 >= (uint64_t)pdata->nfixed) {
+                Sock *sockPtr = (Sock *)(uintptr_t)evPtr->data.u64;
 
-            /*
-             * We need the server to determine the poolPtr. When not already
-             * set in the sockPtr, we have to get it via driver and defMapPtr,
-             * since for global servers, drvPtr->servPtr == NULL.
-             */
-            servPtr = sockPtr->servPtr;
-            if (servPtr == NULL) {
-                servPtr = sockPtr->drvPtr->defMapPtr->servPtr;
+                if (sockPtr->timerWheelPtr == wheelPtr) {
+                    WheelRemove(sockPtr);
+                    Push(sockPtr, listPtr);
+                }
             }
-            conn.poolPtr = servPtr->pools.defaultPtr;
-
-            Ns_ConnSetPeer((Ns_Conn*)&conn,
-                           (struct sockaddr *)&(sockPtr->sa),
-                           (struct sockaddr *)&(sockPtr->clientsa)
-                           );
-            /*
-             * If the request managed to be parsed successfully by
-             * Ns_ParseHeader(), the request headers are set up. This is not
-             * the case when, e.g., the request line is already invalid.
-             * Even, when Ns_ParseHeader() fails during request parsing, we
-             * have a valid but empty Ns_Set for the headers.
-             *
-             * We could parse the provided header string into the output
-             * headers in the future.
-             */
-
-            Ns_Log(Debug, "AddNslogEntry headers: # %ld output headers %p",
-                   conn.headers->size, (void*)conn.outputheaders);
-            //Ns_SetPrint(NULL, conn.headers);
-
-            //auth = Ns_SetIGet(conn.headers, "authorization");
-            auth = sockPtr->extractedHeaderFields[NS_EXTRACTED_HEADER_AUTHORIZATION];
-            if (auth != NULL) {
-                NsParseAuth(&conn, auth);
+        }
+    } else
+#endif
+    {
+        unsigned int level, idx;
+
+        (void)nrEvents;
+        for (level = 0u; level < WHEEL_LEVELS; level++) {
+            for (idx = 0u; idx < WHEEL_SLOTS; idx++) {
+                Sock *sockPtr, *nextPtr;
+
+                for (sockPtr = wheelPtr->slots[level][idx]; sockPtr != NULL; sockPtr = nextPtr) {
+                    nextPtr = sockPtr->timerNextPtr;
+                    if (PollSockEvents(pdata, sockPtr) != 0) {
+                        WheelRemove(sockPtr);
+                        Push(sockPtr, listPtr);
+                    }
+                }
             }
-        } else {
-            /*
-             * We want to construct a connection structure, but we
-             * cannot fill it with the necessary information.  This
-             * means, that the function is called in a situation,
-             * where the initialization of the connection was not
-             * finished. In this case connPtr is still NULL;
-             */
-            Ns_Log(Warning, "--- non-trace access log entry: status code %d"
-                   " cannot add log entry; request provided %d headers provided %d",
-                   statusCode, sockPtr->reqPtr != NULL,
-                   sockPtr->reqPtr != NULL && sockPtr->reqPtr->headers != NULL);
-            isConnConstructed = NS_FALSE;
-            assert(connPtr == NULL);
         }
-    } else {
-        /*
-         * connPtr was provided.
-         */
-        assert(connPtr != NULL);
-        isConnConstructed = NS_FALSE;
-    }
-    if (connPtr != NULL) {
-        Ns_Log(Notice, "--- non-trace access log entry: constructed %d user '%s' \"%s\" %d %ld",
-               isConnConstructed,
-               Ns_ConnAuthUser(connPtr),
-               connPtr->request.line,
-               Ns_ConnResponseStatus(connPtr),
-               Ns_ConnContentSent(connPtr));
-        /*
-         * Finally call the trace proc LogTrace() with the provided or
-         * constructed connection.
-         */
-        NsRunSelectedTraces(connPtr, "nslog:conntrace");
     }
+
+    return listPtr;
 }
 
 /*
  *----------------------------------------------------------------------
  *
- * SockSendResponse --
+ * WheelDrain, WheelPoll --
  *
- *      Send an HTTP response directly to the client using the
- *      driver callback.
+ *      Remove all socks from the timing wheel, resp. add all socks of
+ *      the wheel to the pfds array (needed in poll() mode only).
  *
  * Results:
- *      None.
+ *      WheelDrain() returns the provided list extended by the socks.
  *
  * Side effects:
- *      May not sent the complete response to the client
- *      if encountering non-writable connection socket.
+ *      See above.
  *
  *----------------------------------------------------------------------
  */
 
-static void
-SockSendResponse(Sock *sockPtr, int statusCode, const char *errMsg, const char *headers)
+static Sock *
+WheelDrain(SockWheel *wheelPtr, Sock *listPtr)
 {
-    struct iovec iov[5];
-    char         firstline[32];
-    ssize_t      sent, tosend;
-    int          nbufs;
-
-    NS_NONNULL_ASSERT(sockPtr != NULL);
-    NS_NONNULL_ASSERT(errMsg != NULL);
+    unsigned int level, idx;
 
-    Ns_Log(Debug, "SockSendResponse finishes request with status code %d msg <%s> headers <%s>",
-           statusCode, errMsg, headers);
+    NS_NONNULL_ASSERT(wheelPtr != NULL);
 
-    NsAddNslogEntry(sockPtr, statusCode, NULL, headers);
+    for (level = 0u; level < WHEEL_LEVELS; level++) {
+        for (idx = 0u; idx < WHEEL_SLOTS; idx++) {
+            Sock *sockPtr, *nextPtr;
 
-    snprintf(firstline, sizeof(firstline), "HTTP/1.0 %d ", statusCode);
-    iov[0].iov_base = firstline;
-    iov[0].iov_len  = strlen(firstline);
-    iov[1].iov_base = (void *)errMsg;
-    iov[1].iov_len  = strlen(errMsg);
-    if (headers == NULL) {
-        iov[2].iov_base = (void *)"\r\n\r\n";
-        iov[2].iov_len  = 4u;
-        nbufs = 3;
-    } else {
-        iov[2].iov_base = (void *)"\r\n";
-        iov[2].iov_len  = 2u;
-        iov[3].iov_base = (char *)headers;
-        iov[3].iov_len  = strlen(headers);
-        iov[4].iov_base = (void *)"\r\n\r\n";
-        iov[4].iov_len  = 4u;
-        nbufs = 5;
-    }
-    tosend = (ssize_t)(iov[0].iov_len + iov[1].iov_len + iov[2].iov_len);
-    sent = NsDriverSend(sockPtr, iov, nbufs, 0u);
-    if (sent < tosend) {
-        Ns_Log(Warning, "Driver: partial write while sending response;"
-               " %" PRIdz " < %" PRIdz, sent, tosend);
+            for (sockPtr = wheelPtr->slots[level][idx]; sockPtr != NULL; sockPtr = nextPtr) {
+                nextPtr = sockPtr->timerNextPtr;
+                sockPtr->timerWheelPtr = NULL;
+                Push(sockPtr, listPtr);
+            }
+            wheelPtr->slots[level][idx] = NULL;
+        }
+        wheelPtr->occupied[level] = 0u;
     }
+    wheelPtr->count = 0u;
 
-    /*
-     * In case we have a request structure, complain in the system log about
-     * the bad request.
-     */
-    if (sockPtr->reqPtr != NULL) {
-        Request     *reqPtr = sockPtr->reqPtr;
-        const char  *requestLine = (reqPtr->request.line != NULL)
-            ? reqPtr->request.line
-            : NS_EMPTY_STRING;
-
-        /*
-         * Check, if bad request looks like a TLS handshake. If yes, there is
-         * no need to print out the received buffer.
-         */
-        if (unlikely(statusCode == 400)) {
-            char peer[NS_IPADDR_SIZE];
-            const char *bufferString = reqPtr->buffer.string;
+    return listPtr;
+}
 
-            (void)ns_inet_ntop((struct sockaddr *)&(sockPtr->sa), peer, NS_IPADDR_SIZE);
+static void
+WheelPoll(const SockWheel *wheelPtr, PollData *pdata)
+{
+    unsigned int level, idx;
 
-            if (bufferString[0] == (char)0x16 && bufferString[1] >= 3 && bufferString[2] == 1) {
-                Ns_Log(Warning, "invalid request %d (%s) from peer %s: received TLS handshake "
-                       "on a non-TLS connection",
-                       statusCode, errMsg, peer);
+    NS_NONNULL_ASSERT(wheelPtr != NULL);
+    NS_NONNULL_ASSERT(pdata != NULL);
 
-            } else {
-                Tcl_DString dsReqLine;
+    for (level = 0u; level < WHEEL_LEVELS; level++) {
+        uint64_t bits = wheelPtr->occupied[level];
 
-                /*
-                 * These are errors, which might need some investigation based
-                 * on based on details of the received buffer.
-                 */
-                Tcl_DStringInit(&dsReqLine);
-                Ns_Log(Warning, "invalid request: %d (%s) from peer %s request '%s'"
-                       " offsets: read %" PRIuz
-                       " write %" PRIuz " content %" PRIuz " avail %" PRIuz,
-                       statusCode, errMsg,
-                       peer,
-                       Ns_DStringAppendPrintable(&dsReqLine, NS_FALSE, NS_FALSE, requestLine, strlen(requestLine)),
-                       reqPtr->roff,
-                       reqPtr->woff,
-                       reqPtr->coff,
-                       reqPtr->avail);
-                Tcl_DStringFree(&dsReqLine);
+        while (bits != 0u) {
+            Sock *sockPtr;
 
-                LogBuffer(Warning, "REQ BUFFER", reqPtr->buffer.string, (size_t)reqPtr->buffer.length);
+            idx = WheelFirstBit(bits);
+            bits &= bits - 1u;
+            for (sockPtr = wheelPtr->slots[level][idx]; sockPtr != NULL; sockPtr = sockPtr->timerNextPtr) {
+                sockPtr->pidx = PollSet(pdata, sockPtr->sock, (short)POLLIN, NULL);
             }
-        } else if (statusCode >= 500) {
-            Ns_Log(Warning, "request returns %d (%s): %s", statusCode, errMsg, requestLine);
         }
-    } else {
-        Ns_Log(Warning, "invalid request: %d (%s) - no request information available",
-               statusCode, errMsg);
     }
 }
 
-
 /*
  *----------------------------------------------------------------------
  *
- * SockTrigger --
+ * WheelTimeout --
  *
- *      Wakeup DriversThread from blocking ns_poll().
+ *      Determine the time until the timing wheel has to be advanced next,
+ *      either since a level 0 slot with socks becomes due, or since a
+ *      non-empty slot of a higher level has to be cascaded. The costs are
+ *      constant, since only the bitmaps of the levels are inspected.
  *
  * Results:
- *      None.
+ *      Timeout in milliseconds, or -1 when the wheel is empty.
  *
  * Side effects:
- *      DriversThread will wake up.
+ *      None.
  *
  *----------------------------------------------------------------------
  */
 
-static void
-SockTrigger(NS_SOCKET sock)
+static int
+WheelTimeout(const SockWheel *wheelPtr, const Ns_Time *nowPtr)
 {
-    /*
-     * In case the trigger was not properly set up, ignore the triggering
-     * attempt. This might happen in some error conditions or during startup
-     * and shutdown.
-     */
-    if ((sock != 0) && send(sock, NS_EMPTY_STRING, 1, 0) != 1) {
-        const char *errstr = ns_sockstrerror(ns_sockerrno);
+    uint64_t     now, next = UINT64_MAX;
+    unsigned int level;
+    int          result = -1;
 
-        Ns_Log(Error, "driver: trigger send() failed: %s", errstr);
+    NS_NONNULL_ASSERT(wheelPtr != NULL);
+    NS_NONNULL_ASSERT(nowPtr != NULL);
+
+    if (wheelPtr->count > 0u) {
+        for (level = 0u; level < WHEEL_LEVELS; level++) {
+            uint64_t     bits = wheelPtr->occupied[level], base, tick;
+            unsigned int shift = WHEEL_BITS * level, rotate;
+
+            if (bits == 0u) {
+                continue;
+            }
+            /*
+             * "base" is the first slot number of this level not processed
+             * yet. Unless the tick is on a boundary of this level, the
+             * current slot was already cascaded.
+             */
+            base = wheelPtr->tick >> shift;
+            if ((wheelPtr->tick & (((uint64_t)1u << shift) - 1u)) != 0u) {
+                base++;
+            }
+            rotate = (unsigned int)base & WHEEL_MASK;
+            if (rotate != 0u) {
+                bits = (bits >> rotate) | (bits << (WHEEL_SLOTS - rotate));
+            }
+            tick = (base + WheelFirstBit(bits)) << shift;
+            if (tick < next) {
+                next = tick;
+            }
+        }
+
+        now = WheelTick(nowPtr, NS_FALSE);
+        if (next <= now) {
+            result = 0;
+        } else if (next - now > (uint64_t)INT_MAX) {
+            result = INT_MAX;
+        } else {
+            result = (int)(next - now);
+        }
     }
+
+    return result;
 }
 
+
+
 /*
  *----------------------------------------------------------------------
  *
- * SockClose --
+ * SockAccept --
  *
- *      Closes connection socket, does all cleanups. The input parameter
- *      "keep" might be NS_TRUE/NS_FALSE or -1 if undecided.
+ *      Accept and initialize a new Sock in sockPtrPtr.
  *
  * Results:
- *      None.
+ *      SOCK_READY, SOCK_MORE, SOCK_SPOOL,
+ *      SOCK_ERROR + NULL sockPtr.
  *
  * Side effects:
- *      None
+ *      Read-ahead may be attempted on new socket.
  *
  *----------------------------------------------------------------------
  */
 
-static void
-SockClose(Sock *sockPtr, int keep)
+static SockState
+SockAccept(Driver *drvPtr, NS_SOCKET sock, Sock **sockPtrPtr, const Ns_Time *nowPtr)
 {
-    NS_NONNULL_ASSERT(sockPtr != NULL);
+    Sock    *sockPtr;
+    SockState sockStatus;
+    NS_DRIVER_ACCEPT_STATUS status;
 
-    if (keep != 0) {
-        bool driverKeep = DriverKeep(sockPtr);
-        keep = (int)driverKeep;
-    }
-    if (keep == (int)NS_FALSE) {
-        DriverClose(sockPtr);
-    }
-    Ns_MutexLock(&sockPtr->drvPtr->lock);
-    sockPtr->keep = (bool)keep;
-    Ns_MutexUnlock(&sockPtr->drvPtr->lock);
+    NS_NONNULL_ASSERT(drvPtr != NULL);
+
+    sockPtr = SockNew(drvPtr);
 
     /*
-     * Unconditionally remove temporary file, connection thread
-     * should take care about very large uploads.
+     * Accept the new connection.
      */
 
-    if (sockPtr->tfile != NULL) {
-        unlink(sockPtr->tfile);
-        ns_free(sockPtr->tfile);
-        sockPtr->tfile = NULL;
+    status = DriverAccept(sockPtr, sock);
 
-        if (sockPtr->tfd > 0) {
-            /*
-             * Close and reset fd. The fd should be > 0 unless we are in error
-             * conditions.
-             */
-            (void) ns_close(sockPtr->tfd);
-        }
-        sockPtr->tfd = 0;
+    if (unlikely(status == NS_DRIVER_ACCEPT_ERROR)) {
+        sockStatus = SOCK_ERROR;
 
-    } else if (sockPtr->tfd > 0) {
         /*
-         * This must be a fd allocated via Ns_GetTemp();
+         * We reach the place frequently, especially on Linux, when we try to
+         * accept multiple connection in one sweep. Usually, the errno is
+         * NS_EAGAIN.
          */
-        Ns_ReleaseTemp(sockPtr->tfd);
-        sockPtr->tfd = 0;
-    }
 
-#ifndef _WIN32
-    /*
-     * Un-map temp file used for spooled content.
-     */
-    if (sockPtr->taddr != NULL) {
-        munmap(sockPtr->taddr, (size_t)sockPtr->tsize);
-        sockPtr->taddr = NULL;
+        SlabPut(&drvPtr->sockSlab, sockPtr);
+
+        sockPtr = NULL;
+
+    } else {
+        sockPtr->acceptTime = *nowPtr;
+        drvPtr->queuesize++;
+
+        if (status == NS_DRIVER_ACCEPT_DATA) {
+
+            /*
+             * If there is already data present then read it without
+             * polling if we're in async mode.
+             */
+
+            if ((drvPtr->opts & NS_DRIVER_ASYNC) != 0u) {
+                sockStatus = SockRead(sockPtr, 0, nowPtr);
+                if ((int)sockStatus < 0) {
+                    Ns_Log(DriverDebug, "SockRead returned error %s",
+                           GetSockStateName(sockStatus));
+
+                    SockRelease(sockPtr, sockStatus, errno);
+                    sockStatus = SOCK_ERROR;
+                    sockPtr = NULL;
+                }
+            } else {
+
+                /*
+                 * Queue this socket without reading, NsGetRequest() in the
+                 * connection thread will perform actual reading of the
+                 * request.
+                 */
+                sockStatus = SOCK_READY;
+            }
+        } else if (status == NS_DRIVER_ACCEPT_QUEUE) {
+
+            /*
+             *  We need to call RequestNew() to make sure socket has request
+             *  structure allocated, otherwise NsGetRequest() will call
+             *  SockRead() which is not what this driver wants.
+             */
+            if (sockPtr->reqPtr == NULL) {
+                sockPtr->reqPtr = RequestNew(sockPtr->drvPtr);
+            }
+            sockStatus = SOCK_READY;
+        } else {
+            sockStatus = SOCK_MORE;
+        }
     }
-#endif
+
+    *sockPtrPtr = sockPtr;
+
+    return sockStatus;
 }
 
 
 /*
  *----------------------------------------------------------------------
  *
- * ChunkedDecode --
+ * SockNew --
  *
- *      Reads the content from the incoming request buffer and tries
- *      to decode chunked encoding parts. The function can be called
- *      repeatedly and with incomplete input and overwrites the buffer
- *      with the decoded data optionally. The decoded data is always
- *      shorter than the encoded one.
+ *      Allocate and/or initialize a Sock structure. Counterpart of
+ *      SockRelease().
  *
  * Results:
- *      SOCK_READY when chunk was complete, SOCK_MORE when more data is
- *      required, or some error condition.
+ *      SockPtr
  *
  * Side effects:
- *      Updates the buffer if update is true (and adjusts
- *      reqPtr->chunkWriteOff).  Updates always reqPtr->chunkStartOff to allow
- *      incremental operations.
+ *      Potentially new memory is allocated.
  *
  *----------------------------------------------------------------------
  */
-static SockState
-ChunkedDecode(Request *reqPtr, bool update)
-{
-    const Tcl_DString *bufPtr;
-    const char        *end, *chunkStart;
-    SockState         result = SOCK_MORE;
 
-    NS_NONNULL_ASSERT(reqPtr != NULL);
+static Sock *
+SockNew(Driver *drvPtr)
+{
+    Sock *sockPtr;
 
-    bufPtr = &reqPtr->buffer;
-    end = bufPtr->string + bufPtr->length;
-    chunkStart = bufPtr->string + reqPtr->chunkStartOff;
+    NS_NONNULL_ASSERT(drvPtr != NULL);
 
-    while (reqPtr->chunkStartOff <  (size_t)bufPtr->length) {
-        char   *p = strstr(chunkStart, "\r\n"), *numberEnd;
-        long    chunkLength;
+    sockPtr = SlabGet(&drvPtr->sockSlab);
 
-        if (p == NULL) {
-            Ns_Log(DriverDebug, "ChunkedDecode: chunk did not find end-of-line");
-            result = SOCK_MORE;
-            break;
-        }
+    if (sockPtr == NULL) {
+        size_t sockSize = sizeof(Sock) + (nsconf.nextSlsId * sizeof(Ns_Callback *));
+        sockPtr = ns_calloc(1u, sockSize);
+        /*fprintf(stderr, "=== SockNew %p\n", (void*)sockPtr);*/
+        sockPtr->drvPtr = drvPtr;
+    } else {
+        sockPtr->keep    = NS_FALSE;
+        sockPtr->idle    = NS_FALSE;
+        sockPtr->idleBytes = 0u;
+        sockPtr->tfd     = 0;
+        sockPtr->taddr   = NULL;
+        sockPtr->flags   = 0u;
+        sockPtr->arg     = NULL;
+        sockPtr->poolPtr = NULL;
+        sockPtr->recvSockState = NS_SOCK_NONE;
+        sockPtr->recvErrno = 0u;
+        sockPtr->sendErrno = 0u;
+        sockPtr->pollEvents = 0u;
+        sockPtr->pollDataPtr = NULL;
+        sockPtr->revents = 0;
+        sockPtr->h2ConnPtr = NULL;
+        sockPtr->h2StreamPtr = NULL;
+        sockPtr->timerWheelPtr = NULL;
+    }
+    return sockPtr;
+}
 
-        *p = '\0';
-        chunkLength = strtol(chunkStart, &numberEnd, 16);
-        Ns_Log(DriverDebug, "ChunkedDecode: chunkLength %ld, <%s>", chunkLength, chunkStart);
-        *p = '\r';
-        if (chunkLength < 0) {
-            Ns_Log(Warning, "ChunkedDecode: negative chunk length");
-            result = SOCK_BADREQUEST;
-            break;
-        }
-        if (chunkStart == numberEnd) {
-            Ns_Log(Warning, "ChunkedDecode: invalid chunk length");
-            result = SOCK_BADREQUEST;
-            break;
-        }
-        if (p + 2 + chunkLength > end) {
-            Ns_Log(DriverDebug, "ChunkedDecode: chunk length past end of buffer");
-            result = SOCK_MORE;
-            break;
-        }
-        if (update) {
-            char *writeBuffer = bufPtr->string + reqPtr->chunkWriteOff;
+
 
-            memmove(writeBuffer, p + 2, (size_t)chunkLength);
-            reqPtr->chunkWriteOff += (size_t)chunkLength;
-            *(writeBuffer + chunkLength) = '\0';
+/*
+ *----------------------------------------------------------------------
+ *
+ * SlabInit --
+ *
+ *      Initialize a slab for recycling Sock or Request structures.
+ *      "linkOffset" is the offset of the "nextPtr" member, which chains
+ *      the free objects. The slab has no owner until the driver thread
+ *      claims it; until then, all operations go through the remote list.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Initializes the lock of the slab.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+SlabInit(DrvSlab *slabPtr, const char *prefix, const char *threadName, size_t linkOffset)
+{
+    NS_NONNULL_ASSERT(slabPtr != NULL);
+    NS_NONNULL_ASSERT(prefix != NULL);
+    NS_NONNULL_ASSERT(threadName != NULL);
+
+    memset(slabPtr, 0, sizeof(DrvSlab));
+    slabPtr->linkOffset = linkOffset;
+    Ns_MutexInit(&slabPtr->lock);
+    Ns_MutexSetName2(&slabPtr->lock, prefix, threadName);
+}
+
+#define SlabNext(slabPtr, objPtr) (*(void **)((char *)(objPtr) + (slabPtr)->linkOffset))
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * SlabGet --
+ *
+ *      Get a recycled object from the slab. The owning driver thread pops
+ *      from its local list without locking. When the local list is empty,
+ *      it takes over all objects freed by other threads in one batch.
+ *      Other threads pop single objects from the remote list.
+ *
+ * Results:
+ *      Recycled object or NULL, when the slab is empty. In the latter
+ *      case, the caller allocates a fresh object, which is accounted here.
+ *
+ * Side effects:
+ *      Might lock the remote list.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void *
+SlabGet(DrvSlab *slabPtr)
+{
+    void *objPtr;
+
+    NS_NONNULL_ASSERT(slabPtr != NULL);
+
+    if (likely(slabPtr->owner == Ns_ThreadId())) {
+        /*
+         * The remote list is filled by other threads; peek at it with an
+         * atomic load and take it over under the lock.
+         */
+        if (unlikely(slabPtr->localPtr == NULL) && NsAtomicLoad(&slabPtr->remotePtr) != NULL) {
+            Ns_MutexLock(&slabPtr->lock);
+            slabPtr->localPtr = slabPtr->remotePtr;
+            slabPtr->nrLocal = slabPtr->nrRemote;
+            slabPtr->remotePtr = NULL;
+            slabPtr->nrRemote = 0u;
+            Ns_MutexUnlock(&slabPtr->lock);
+            slabPtr->stats.reclaims++;
+        }
+        objPtr = slabPtr->localPtr;
+        if (likely(objPtr != NULL)) {
+            slabPtr->localPtr = SlabNext(slabPtr, objPtr);
+            slabPtr->nrLocal--;
+            slabPtr->stats.reused++;
+        } else {
+            slabPtr->stats.allocated++;
         }
-        reqPtr->chunkStartOff += (size_t)(p - chunkStart) + 4u + (size_t)chunkLength;
-        chunkStart = bufPtr->string + reqPtr->chunkStartOff;
-        result = SOCK_READY;
+    } else {
+        Ns_MutexLock(&slabPtr->lock);
+        objPtr = slabPtr->remotePtr;
+        if (objPtr != NULL) {
+            slabPtr->remotePtr = SlabNext(slabPtr, objPtr);
+            slabPtr->nrRemote--;
+        } else {
+            slabPtr->stats.foreign++;
+        }
+        Ns_MutexUnlock(&slabPtr->lock);
     }
 
-    return result;
+    return objPtr;
 }
 
-
+
 /*
  *----------------------------------------------------------------------
  *
- * SockRead --
+ * SlabPut --
  *
- *      Read content from the given Sock, processing the input as
- *      necessary.  This is the core callback routine designed to
- *      either be called repeatedly within the DriverThread during
- *      an async read-ahead or in a blocking loop in NsGetRequest()
- *      at the start of connection processing.
+ *      Return an object to the slab. Objects freed by the owning driver
+ *      thread go to the local list, others to the remote list.
  *
  * Results:
- *      SOCK_READY: Request is ready for processing.
- *      SOCK_MORE:  More input is required.
- *      SOCK_ERROR: Client drop or timeout.
- *      SOCK_SPOOL: Pass input handling to spooler
- *      SOCK_CLOSE: peer closed connection
- *      SOCK_BADREQUEST
- *      SOCK_BADHEADER
- *      SOCK_TOOMANYHEADERS
+ *      None.
  *
  * Side effects:
- *      The Request structure will be built up for use by the
- *      connection thread.  Also, before returning SOCK_READY,
- *      the next byte to read mark and bytes available are set
- *      to the beginning of the content, just beyond the headers.
+ *      Might lock the remote list.
  *
- *      Contents may be spooled into temp file and mmap-ed
+ *----------------------------------------------------------------------
+ */
+
+static void
+SlabPut(DrvSlab *slabPtr, void *objPtr)
+{
+    NS_NONNULL_ASSERT(slabPtr != NULL);
+    NS_NONNULL_ASSERT(objPtr != NULL);
+
+    if (likely(slabPtr->owner == Ns_ThreadId())) {
+        SlabNext(slabPtr, objPtr) = slabPtr->localPtr;
+        slabPtr->localPtr = objPtr;
+        slabPtr->nrLocal++;
+    } else {
+        Ns_MutexLock(&slabPtr->lock);
+        SlabNext(slabPtr, objPtr) = slabPtr->remotePtr;
+        slabPtr->remotePtr = objPtr;
+        slabPtr->nrRemote++;
+        slabPtr->stats.remoteFrees++;
+        Ns_MutexUnlock(&slabPtr->lock);
+    }
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * SlabStatsObj --
+ *
+ *      Return the occupancy of the slab as a Tcl dict. The counters
+ *      maintained by the owner are read without locking and are therefore
+ *      only approximate while the driver is busy.
+ *
+ * Results:
+ *      Tcl_Obj with a dict.
+ *
+ * Side effects:
+ *      None.
  *
  *----------------------------------------------------------------------
  */
 
-static SockState
-SockRead(Sock *sockPtr, int spooler, const Ns_Time *timePtr)
+static Tcl_Obj *
+SlabStatsObj(DrvSlab *slabPtr)
 {
-    const Driver       *drvPtr;
-    Request      *reqPtr;
-    Tcl_DString  *bufPtr;
-    struct iovec  buf;
-    char          tbuf[16384];
-    size_t        buflen, nread;
-    ssize_t       n;
-    SockState     resultState;
+    Tcl_Obj    *resultObj = Tcl_NewListObj(0, NULL);
+    size_t      allocated, nrFree;
+    Tcl_WideInt remoteFrees;
+
+    NS_NONNULL_ASSERT(slabPtr != NULL);
+
+    Ns_MutexLock(&slabPtr->lock);
+    allocated = slabPtr->stats.allocated + slabPtr->stats.foreign;
+    nrFree = slabPtr->nrLocal + slabPtr->nrRemote;
+    remoteFrees = slabPtr->stats.remoteFrees;
+    Ns_MutexUnlock(&slabPtr->lock);
+
+    Tcl_ListObjAppendElement(NULL, resultObj, Tcl_NewStringObj("allocated", 9));
+    Tcl_ListObjAppendElement(NULL, resultObj, Tcl_NewWideIntObj((Tcl_WideInt)allocated));
+    Tcl_ListObjAppendElement(NULL, resultObj, Tcl_NewStringObj("free", 4));
+    Tcl_ListObjAppendElement(NULL, resultObj, Tcl_NewWideIntObj((Tcl_WideInt)nrFree));
+    Tcl_ListObjAppendElement(NULL, resultObj, Tcl_NewStringObj("inuse", 5));
+    Tcl_ListObjAppendElement(NULL, resultObj,
+                             Tcl_NewWideIntObj(allocated > nrFree ? (Tcl_WideInt)(allocated - nrFree) : 0));
+    Tcl_ListObjAppendElement(NULL, resultObj, Tcl_NewStringObj("reused", 6));
+    Tcl_ListObjAppendElement(NULL, resultObj, Tcl_NewWideIntObj(slabPtr->stats.reused));
+    Tcl_ListObjAppendElement(NULL, resultObj, Tcl_NewStringObj("remotefrees", 11));
+    Tcl_ListObjAppendElement(NULL, resultObj, Tcl_NewWideIntObj(remoteFrees));
+    Tcl_ListObjAppendElement(NULL, resultObj, Tcl_NewStringObj("reclaims", 8));
+    Tcl_ListObjAppendElement(NULL, resultObj, Tcl_NewWideIntObj(slabPtr->stats.reclaims));
+
+    return resultObj;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * SockRelease --
+ *
+ *      Close a socket and release the connection structure for
+ *      reuse.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+SockRelease(Sock *sockPtr, SockState reason, int err)
+{
+    Driver *drvPtr;
 
     NS_NONNULL_ASSERT(sockPtr != NULL);
-    drvPtr = sockPtr->drvPtr;
 
-    tbuf[0] = '\0';
+    Ns_Log(DriverDebug, "SockRelease reason %s err %d (sock %d)",
+           GetSockStateName(reason), err, sockPtr->sock);
 
-    /*
-     * In case of "keepwait", the accept time is not meaningful and
-     * reset to 0. In such cases, update "acceptTime" to the actual
-     * begin of a request. This part is intended for async drivers.
-     */
-    if (sockPtr->acceptTime.sec == 0) {
-        assert(timePtr != NULL);
-        sockPtr->acceptTime = *timePtr;
+    if (reason == SOCK_ERROR) {
+        /*
+         * In case of early errors (e.g. SockSendResponse), try to provide a
+         * more specific error code rather than just 400.
+         */
+        Ns_Log(DriverDebug, "... flags %.6x", sockPtr->flags);
+        if ((sockPtr->flags & NS_CONN_ENTITYTOOLARGE) != 0) {
+            reason = SOCK_ENTITYTOOLARGE;
+        }
     }
 
-    /*
-     * Initialize request structure if needed.
-     */
-    if (sockPtr->reqPtr == NULL) {
-        sockPtr->reqPtr = RequestNew();
-    }
+    /*fprintf(stderr, "=== SockRelease %p\n", (void*)sockPtr);*/
+
+    drvPtr = sockPtr->drvPtr;
+    assert(drvPtr != NULL);
+
+    SockError(sockPtr, reason, err);
 
     /*
-     * On the first read, attempt to read-ahead "bufsize" bytes.
-     * Otherwise, read only the number of bytes left in the
-     * content.
+     * The socket has to leave the epoll set before its file descriptor is
+     * closed; otherwise, the stale registration would be used for the
+     * next socket reusing the Sock structure.
      */
+    if (sockPtr->pollDataPtr != NULL) {
+        PollSockRemove(sockPtr->pollDataPtr, sockPtr);
+    }
 
-    reqPtr = sockPtr->reqPtr;
-    bufPtr = &reqPtr->buffer;
-    if (reqPtr->length == 0u) {
-        nread = drvPtr->bufsize;
+    if (sockPtr->sock != NS_INVALID_SOCKET) {
+        SockClose(sockPtr, (int)NS_FALSE);
     } else {
-        nread = reqPtr->length - reqPtr->avail;
+        Ns_Log(DriverDebug, "SockRelease bypasses SockClose, since we have an invalid socket");
     }
+    NsSlsCleanup(sockPtr);
 
-    /*
-     * Grow the buffer to include space for the next bytes.
-     */
+    drvPtr->queuesize--;
+    SockSetIdle(sockPtr, NS_FALSE);
 
-    buflen = (size_t)bufPtr->length;
-    n = (ssize_t)(buflen + nread);
-    if (unlikely(n > drvPtr->maxinput)) {
-        n = (ssize_t)drvPtr->maxinput;
-        nread = (size_t)n - buflen;
-        if (nread == 0u) {
-            Ns_Log(DriverDebug, "SockRead: maxinput reached %" TCL_LL_MODIFIER "d",
-                   drvPtr->maxinput);
-            return SOCK_ERROR;
-        }
+    if (sockPtr->reqPtr != NULL) {
+        Ns_Log(DriverDebug, "SockRelease calls RequestFree");
+        RequestFree(sockPtr);
     }
 
-    /*
-     * Use temp file for content larger than "readahead" bytes.
-     */
-#ifndef _WIN32
-    if (reqPtr->coff > 0u                     /* We are in the content part (after the header) */
-        && !reqPtr->chunkStartOff             /* Never spool chunked encoded data since we decode in memory */
-        && reqPtr->length > (size_t)drvPtr->readahead /* We need more data */
-        && sockPtr->tfd <= 0                  /* We have no spool fd */
-        ) {
-        const DrvSpooler *spPtr = &drvPtr->spooler;
-
-        Ns_Log(DriverDebug, "SockRead: require temporary file for content spooling (length %" PRIuz" > readahead "
-               "%" TCL_LL_MODIFIER "d)",
-               reqPtr->length, drvPtr->readahead);
+    SlabPut(&drvPtr->sockSlab, sockPtr);
 
-        /*
-         * In driver mode send this Sock to the spooler thread if
-         * it is running
-         */
+}
 
-        if (spooler == 0 && spPtr->threads > 0) {
-            return SOCK_SPOOL;
-        }
+
 
-        /*
-         * If "maxupload" is specified and content size exceeds the configured
-         * values, spool uploads into normal temp file (not deleted).  We do
-         * not want to map such large files into memory.
-         */
-        if (drvPtr->maxupload > 0
-            && reqPtr->length > (size_t)drvPtr->maxupload
-            ) {
-            size_t tfileLength = strlen(drvPtr->uploadpath) + 16u;
-
-            sockPtr->tfile = ns_malloc(tfileLength);
-            snprintf(sockPtr->tfile, tfileLength, "%s/%d.XXXXXX", drvPtr->uploadpath, sockPtr->sock);
-            sockPtr->tfd = ns_mkstemp(sockPtr->tfile);
-            if (sockPtr->tfd == NS_INVALID_FD) {
-                Ns_Log(Error, "SockRead: cannot create spool file with template '%s': %s",
-                       sockPtr->tfile, strerror(errno));
-            }
-        } else {
-            /*
-             * Get a temporary fd. These FDs are used for mmapping.
-             */
-
-            sockPtr->tfd = Ns_GetTemp();
-        }
-
-        if (unlikely(sockPtr->tfd == NS_INVALID_FD)) {
-            Ns_Log(DriverDebug, "SockRead: spool fd invalid");
-            return SOCK_ERROR;
-        }
-
-        n = (ssize_t)((size_t)bufPtr->length - reqPtr->coff);
-        assert(n >= 0);
-        if (ns_write(sockPtr->tfd, bufPtr->string + reqPtr->coff, (size_t)n) != n) {
-            return SOCK_WRITEERROR;
-        }
-        Tcl_DStringSetLength(bufPtr, 0);
-    }
-#endif
-    if (sockPtr->tfd > 0) {
-        buf.iov_base = tbuf;
-        buf.iov_len = MIN(nread, sizeof(tbuf));
-    } else {
-        Tcl_DStringSetLength(bufPtr, (TCL_SIZE_T)(buflen + nread));
-        buf.iov_base = bufPtr->string + reqPtr->woff;
-        buf.iov_len = nread;
-    }
-
-    if (reqPtr->leftover > 0u) {
-        /*
-         * There is some leftover in the buffer, don't read but take the
-         * leftover instead as input.
-         */
-        n = (ssize_t)reqPtr->leftover;
-        reqPtr->leftover = 0u;
-        buflen = 0u;
-        Ns_Log(DriverDebug, "SockRead receive from leftover %" PRIdz " bytes", n);
-    } else {
-        /*
-         * Receive actually some data from the driver.
-         */
-        n = NsDriverRecv(sockPtr, &buf, 1, NULL);
-        Ns_Log(DriverDebug, "SockRead receive from network %" PRIdz " bytes sockState %.2x",
-               n, (int)sockPtr->recvSockState);
-    }
-
-    {
-        Ns_SockState nsSockState = sockPtr->recvSockState;
-        /*
-         * The nsSockState has one of the following values, when provided:
-         *
-         *      NS_SOCK_READ, NS_SOCK_DONE, NS_SOCK_AGAIN, NS_SOCK_EXCEPTION,
-         *      NS_SOCK_TIMEOUT
-         */
-        switch (nsSockState) {
-        case NS_SOCK_TIMEOUT:  NS_FALL_THROUGH; /* fall through */
-        case NS_SOCK_EXCEPTION:
-            return SOCK_READERROR;
-        case NS_SOCK_AGAIN:
-            Tcl_DStringSetLength(bufPtr, (TCL_SIZE_T)buflen);
-            return SOCK_MORE;
-        case NS_SOCK_DONE:
-            return SOCK_CLOSE;
-        case NS_SOCK_READ:
-            break;
-
-        case NS_SOCK_CANCEL:  NS_FALL_THROUGH; /* fall through */
-        case NS_SOCK_EXIT:    NS_FALL_THROUGH; /* fall through */
-        case NS_SOCK_INIT:    NS_FALL_THROUGH; /* fall through */
-        case NS_SOCK_WRITE:
-            Ns_Log(Warning, "SockRead received unexpected state %.2x from driver", nsSockState);
-            return SOCK_READERROR;
-
-        case NS_SOCK_NONE:
-            /*
-             * Old style state management based on "n" and "errno", which is
-             * more fragile. We keep there for old-style drivers.
-             */
-            if (n < 0) {
-                Tcl_DStringSetLength(bufPtr, (TCL_SIZE_T)buflen);
-                /*
-                 * The driver returns -1 when the peer closed the connection, but
-                 * clears the errno such we can distinguish from error conditions.
-                 */
-                if (errno == 0) {
-                    return SOCK_CLOSE;
-                }
-                return SOCK_READERROR;
-            }
+/*
+ *----------------------------------------------------------------------
+ *
+ * SockSetIdle --
+ *
+ *      Mark a socket as idle keepalive connection or clear this mark,
+ *      and keep the count of idle connections of the driver and the
+ *      bytes held by them up to date. Called only from the driver thread.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Updates drvPtr->stats.idle and drvPtr->stats.idleBytes.
+ *
+ *----------------------------------------------------------------------
+ */
 
-            if (n == 0) {
-                Tcl_DStringSetLength(bufPtr, (TCL_SIZE_T)buflen);
-                return SOCK_MORE;
-            }
-            break;
+static void
+SockSetIdle(Sock *sockPtr, bool idle)
+{
+    NS_NONNULL_ASSERT(sockPtr != NULL);
 
-        }
-    }
+    if (sockPtr->idle != idle) {
+        Driver *drvPtr = sockPtr->drvPtr;
 
-    if (sockPtr->tfd > 0) {
-        if (ns_write(sockPtr->tfd, tbuf, (size_t)n) != n) {
-            return SOCK_WRITEERROR;
+        sockPtr->idle = idle;
+        if (idle) {
+            sockPtr->idleBytes = SockBytes(sockPtr);
+            drvPtr->stats.idle++;
+            drvPtr->stats.idleBytes += sockPtr->idleBytes;
+        } else {
+            drvPtr->stats.idle--;
+            drvPtr->stats.idleBytes -= sockPtr->idleBytes;
+            sockPtr->idleBytes = 0u;
         }
-    } else {
-        Tcl_DStringSetLength(bufPtr, (TCL_SIZE_T)(buflen + (size_t)n));
-    }
-
-    reqPtr->woff  += (size_t)n;
-    reqPtr->avail += (size_t)n;
-
-    /*
-     * This driver needs raw buffer, it is binary or non-HTTP request
-     */
-
-    if ((drvPtr->opts & NS_DRIVER_NOPARSE) != 0u) {
-        return SOCK_READY;
     }
-
-    resultState = SockParse(sockPtr);
-
-    return resultState;
 }
 
 
-/*----------------------------------------------------------------------
+/*
+ *----------------------------------------------------------------------
  *
- * LogBuffer --
+ * SockBytes --
  *
- *      Debug function to output buffer content when the provided severity is
- *      enabled. The function prints just visible characters and space as is
- *      and prints the hex code otherwise.
+ *      Return the number of bytes held by a Sock: the Sock structure
+ *      including its SLS slots, and the Request with its dynamically
+ *      allocated buffer, when a Request is still attached (e.g. due to
+ *      pipelined data). Requests returned to the request slab and the
+ *      record buffers of TLS libraries are not included.
  *
  * Results:
- *      None.
+ *      Number of bytes.
  *
  * Side effects:
- *      Writes to the system log file.
+ *      None.
  *
  *----------------------------------------------------------------------
  */
-static void
-LogBuffer(Ns_LogSeverity severity, const char *msg, const char *buffer, size_t len)
-{
-    Tcl_DString ds;
 
-    NS_NONNULL_ASSERT(msg != NULL);
-    NS_NONNULL_ASSERT(buffer != NULL);
-
-    if (Ns_LogSeverityEnabled(severity)) {
+static size_t
+SockBytes(const Sock *sockPtr)
+{
+    size_t         result;
+    const Request *reqPtr;
 
-        Tcl_DStringInit(&ds);
-        Tcl_DStringAppend(&ds, msg, TCL_INDEX_NONE);
-        Tcl_DStringAppend(&ds, ": ", 2);
-        (void)Ns_DStringAppendPrintable(&ds, NS_FALSE, NS_FALSE, buffer, len);
+    NS_NONNULL_ASSERT(sockPtr != NULL);
 
-        Ns_Log(severity, "%s", ds.string);
-        Tcl_DStringFree(&ds);
+    result = sizeof(Sock) + (nsconf.nextSlsId * sizeof(Ns_Callback *));
+    reqPtr = sockPtr->reqPtr;
+    if (reqPtr != NULL) {
+        result += sizeof(Request);
+        if (reqPtr->buffer.string != reqPtr->buffer.staticSpace) {
+            result += (size_t)reqPtr->buffer.spaceAvl;
+        }
     }
+    return result;
 }
 
 
-/*----------------------------------------------------------------------
+/*
+ *----------------------------------------------------------------------
  *
- * EndOfHeader --
+ * SockError --
  *
- *      Function to be called (once), when end of header is reached. At this
- *      time, all request header lines were parsed already correctly.
+ *      Log error message for given socket
+ *      reuse.
  *
  * Results:
  *      None.
  *
  * Side effects:
- *      Update various reqPtr fields and signal certain facts and error
- *      conditions via sockPtr->flags. In error conditions, sockPtr->keep is
- *      set to NS_FALSE.
+ *      None.
  *
  *----------------------------------------------------------------------
  */
-static size_t
-EndOfHeader(Sock *sockPtr)
+
+static void
+SockError(Sock *sockPtr, SockState reason, int err)
 {
-    Request      *reqPtr;
-    const char   *s;
+    const char *errMsg = NULL;
 
     NS_NONNULL_ASSERT(sockPtr != NULL);
 
-    reqPtr = sockPtr->reqPtr;
-    assert(reqPtr != NULL);
-
-    reqPtr->chunkStartOff = 0u;
-
-    /*
-     * Check for "expect: 100-continue" and clear flag in case we have
-     * pipelining.
-     */
-    sockPtr->flags &= ~(NS_CONN_CONTINUE);
-    //s = Ns_SetIGet(reqPtr->headers, "expect");
-    s = sockPtr->extractedHeaderFields[NS_EXTRACTED_HEADER_EXPECT];
-    if (s != NULL) {
-        if (*s == '1' && *(s+1) == '0' && *(s+2) == '0' && *(s+3) == '-') {
-            char *scratch = ns_strdup(s+4);
+    switch (reason) {
+    case SOCK_READY: NS_FALL_THROUGH; /* fall through */
+    case SOCK_SPOOL: NS_FALL_THROUGH; /* fall through */
+    case SOCK_MORE:  NS_FALL_THROUGH; /* fall through */
+    case SOCK_CLOSE: NS_FALL_THROUGH; /* fall through */
+    case SOCK_CLOSETIMEOUT:
+        /* This is normal, never log. */
+        break;
 
-            Ns_StrToLower(scratch);
-            if (STREQ(scratch, "continue")) {
-                sockPtr->flags |= NS_CONN_CONTINUE;
-            }
-            ns_free(scratch);
+    case SOCK_READTIMEOUT:
+        /*
+         * For this case, whether this is acceptable or not
+         * depends upon whether this sock was a keep-alive
+         * that we were allowing to 'linger'.
+         */
+        if (!sockPtr->keep) {
+            errMsg = "Timeout during read";
         }
-    }
+        break;
 
-    /*
-     * Handle content-length, which might be provided or not.
-     * Clear length specific error flags.
-     */
-    sockPtr->flags &= ~(NS_CONN_ENTITYTOOLARGE);
-    //s = Ns_SetIGet(reqPtr->headers, "content-length");
-    s = sockPtr->extractedHeaderFields[NS_EXTRACTED_HEADER_CONTENT_LENGTH];
-    if (s == NULL) {
-        s = Ns_SetIGet(reqPtr->headers, "transfer-encoding");
+    case SOCK_WRITETIMEOUT:
+        errMsg = "Timeout during write";
+        break;
 
-        if (s != NULL) {
-            /* Lower case is in the standard, capitalized by macOS */
-            if (STREQ(s, "chunked") || STREQ(s, "Chunked")) {
-                Tcl_WideInt expected;
+    case SOCK_READERROR:
+        errMsg = "Unable to read request";
+        break;
 
-                reqPtr->chunkStartOff = reqPtr->roff;
-                reqPtr->chunkWriteOff = reqPtr->chunkStartOff;
-                reqPtr->contentLength = 0u;
+    case SOCK_WRITEERROR:
+        errMsg = "Unable to write request";
+        break;
 
-                /*
-                 * We need reqPtr->expectedLength for safely terminating read loop.
-                 */
-                s = Ns_SetIGet(reqPtr->headers, "x-expected-entity-length");
+    case SOCK_SHUTERROR:
+        errMsg = "Unable to shutdown socket";
+        break;
 
-                if ((s != NULL)
-                    && (Ns_StrToWideInt(s, &expected) == NS_OK)
-                    && (expected > 0) ) {
-                    reqPtr->expectedLength = (size_t)expected;
-                }
-                s = NULL;
-            }
-        }
-    }
+    case SOCK_BADREQUEST:
+        errMsg = "Bad Request";
+        SockSendResponse(sockPtr, 400, errMsg, NULL);
+        break;
 
-    /*
-     * In case a valid and meaningful headers determining the content length
-     * was provided, the string with the content length ("s") is not NULL.
-     */
-    if (s != NULL) {
-        Tcl_WideInt length;
+    case SOCK_TOOMANYHEADERS:
+        errMsg = "Too Many Request Headers";
+        SockSendResponse(sockPtr, 414, errMsg, NULL);
+        break;
 
-        if ((Ns_StrToWideInt(s, &length) == NS_OK) && (length > 0)) {
-            reqPtr->length = (size_t)length;
-            /*
-             * Handle too large input requests.
-             */
-            if (reqPtr->length > (size_t)sockPtr->drvPtr->maxinput) {
+    case SOCK_BADHEADER:
+        errMsg = "Invalid Request Header";
+        SockSendResponse(sockPtr, 400, errMsg, NULL);
+        break;
 
-                Ns_Log(Warning, "SockParse: request too large, length=%"
-                       PRIdz ", maxinput=%" TCL_LL_MODIFIER "d",
-                       reqPtr->length, sockPtr->drvPtr->maxinput);
+    case SOCK_ENTITYTOOLARGE:
+        errMsg = "Request Entity Too Large";
+        SockSendResponse(sockPtr, 413, errMsg, NULL);
+        break;
 
-                sockPtr->keep = NS_FALSE;
-                sockPtr->flags |= NS_CONN_ENTITYTOOLARGE;
+    case SOCK_ERROR:
+        errMsg = "Unknown Error";
+        SockSendResponse(sockPtr, 400, errMsg, NULL);
+        break;
 
-            }
-            reqPtr->contentLength = (size_t)length;
+    case SOCK_QUEUEFULL:
+        errMsg = "Service Unavailable";
+        if (sockPtr->poolPtr != NULL && sockPtr->poolPtr->wqueue.retryafter.sec > 0) {
+            char headers[14 + TCL_INTEGER_SPACE];
+
+            snprintf(headers, sizeof(headers), "Retry-After: %" PRId64,
+                     (int64_t)sockPtr->poolPtr->wqueue.retryafter.sec);
+            SockSendResponse(sockPtr, 503, errMsg, headers);
+        } else {
+            SockSendResponse(sockPtr, 503, errMsg, NULL);
         }
+        break;
     }
 
-    /*
-     * Compression format handling: parse information from request headers
-     * indicating allowed compression formats for quick access.
-     *
-     * Clear compression accepted flag
-     */
-    sockPtr->flags &= ~(NS_CONN_ZIPACCEPTED|NS_CONN_BROTLIACCEPTED);
+    if (errMsg != NULL) {
+        char ipString[NS_IPADDR_SIZE];
 
-    s = Ns_SetIGet(reqPtr->headers, "accept-encoding");
-    if (s != NULL) {
-        bool gzipAccept, brotliAccept;
+        Ns_Log(DriverDebug, "SockError: %s (%d: %s), sock: %d, peer: [%s]:%d, request: %.99s",
+               errMsg,
+               err, (err != 0) ? strerror(err) : NS_EMPTY_STRING,
+               sockPtr->sock,
+               ns_inet_ntop((struct sockaddr *)&(sockPtr->sa), ipString, sizeof(ipString)),
+               Ns_SockaddrGetPort((struct sockaddr *)&(sockPtr->sa)),
+               (sockPtr->reqPtr != NULL) ? sockPtr->reqPtr->buffer.string : NS_EMPTY_STRING);
+    }
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * SockConstructConn --
+ *
+ *      Construct a connection structure on the fly from the information
+ *      provided by sockPtr, such that the access log trace can be called
+ *      for requests not handled by a connection thread. The request
+ *      headers of the sockPtr must be set up.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Might parse the authorization header field.
+ *
+ *----------------------------------------------------------------------
+ */
+static void
+SockConstructConn(Sock *sockPtr, int statusCode, Conn *connPtr)
+{
+    const char     *auth;
+    const NsServer *servPtr;
 
-        /*
-         * Get allowed compression formats from "accept-encoding" headers.
-         */
-        NsParseAcceptEncoding(reqPtr->request.version, s, &gzipAccept, &brotliAccept);
-        if (gzipAccept || brotliAccept) {
-            /*
-             * Don't allow compression formats for Range requests.
-             */
-            s = Ns_SetIGet(reqPtr->headers, "range");
-            if (s == NULL) {
-                if (gzipAccept) {
-                    sockPtr->flags |= NS_CONN_ZIPACCEPTED;
-                }
-                if (brotliAccept) {
-                    sockPtr->flags |= NS_CONN_BROTLIACCEPTED;
-                }
-            }
-        }
+    NS_NONNULL_ASSERT(sockPtr != NULL);
+    NS_NONNULL_ASSERT(connPtr != NULL);
+    assert(sockPtr->reqPtr != NULL);
+    assert(sockPtr->reqPtr->headers != NULL);
+
+    memset(connPtr, 0, sizeof(Conn));
+
+    connPtr->drvPtr             = sockPtr->drvPtr;
+    connPtr->reqPtr             = sockPtr->reqPtr;
+    connPtr->request            = sockPtr->reqPtr->request;
+    connPtr->headers            = connPtr->reqPtr->headers;
+    connPtr->responseStatus     = statusCode;
+    connPtr->acceptTime         = sockPtr->acceptTime;
+    connPtr->requestQueueTime   = sockPtr->acceptTime;
+    connPtr->requestDequeueTime = sockPtr->acceptTime;
+    connPtr->filterDoneTime     = sockPtr->acceptTime;
+
+    /*
+     * We need the server to determine the poolPtr. When not already
+     * set in the sockPtr, we have to get it via driver and defMapPtr,
+     * since for global servers, drvPtr->servPtr == NULL.
+     */
+    servPtr = sockPtr->servPtr;
+    if (servPtr == NULL) {
+        servPtr = sockPtr->drvPtr->defMapPtr->servPtr;
     }
+    connPtr->poolPtr = servPtr->pools.defaultPtr;
 
+    Ns_ConnSetPeer((Ns_Conn*)connPtr,
+                   (struct sockaddr *)&(sockPtr->sa),
+                   (struct sockaddr *)&(sockPtr->clientsa)
+                   );
     /*
-     * Determine the peer address for clients coming via reverse proxy
-     * servers, based on the content of the "x-forwarded-for" header. If
-     * trusted reverse proxy servers are specified, accept the field only from
-     * these.
+     * If the request managed to be parsed successfully by
+     * Ns_ParseHeader(), the request headers are set up. This is not
+     * the case when, e.g., the request line is already invalid.
+     * Even, when Ns_ParseHeader() fails during request parsing, we
+     * have a valid but empty Ns_Set for the headers.
+     *
+     * We could parse the provided header string into the output
+     * headers in the future.
      */
 
-    s = Ns_SetIGet(reqPtr->headers, "x-forwarded-for");
-    if (s != NULL && !strcasecmp(s, "unknown")) {
-        s = NULL;
-    }
-    if (s != NULL
-        && nsconf.reverseproxymode.trustedservers != NULL
-        && !Ns_SockaddrTrustedReverseProxy((struct sockaddr *)&sockPtr->sa)) {
-        s = NULL;
+    Ns_Log(Debug, "AddNslogEntry headers: # %ld output headers %p",
+           connPtr->headers->size, (void*)connPtr->outputheaders);
+    //Ns_SetPrint(NULL, connPtr->headers);
+
+    //auth = Ns_SetIGet(connPtr->headers, "authorization");
+    auth = sockPtr->extractedHeaderFields[NS_EXTRACTED_HEADER_AUTHORIZATION];
+    if (auth != NULL) {
+        NsParseAuth(connPtr, auth);
     }
+}
 
-    if (s != NULL) {
-        int success;
+/*
+ *----------------------------------------------------------------------
+ *
+ * NsAddNslogEntry --
+ *
+ *      Add an entry to the access log, when the request is not handled by the
+ *      trace of a connection thread.
+ *
+ *      Applications:
+ *       - direct replies from the driver thread (via SockSendResponse())
+ *       - 100 CONTINUE,
+ *       - cases where the TRACE is not called in the connection thread.
+ *
+ *       Currently, the function is just used for the first two cases.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Potentially adding an entry to the access.log file.
+ *
+ *----------------------------------------------------------------------
+ */
+void
+NsAddNslogEntry(Sock *sockPtr, int statusCode, Ns_Conn *connPtr, const char *UNUSED(headers))
+{
+    bool isConnConstructed;
+    Conn conn;
+
+    NS_NONNULL_ASSERT(sockPtr != NULL);
 
+    if (connPtr == NULL) {
         /*
-         * Try to parse the whole string as an IP address,.
+         * We want to call LogTrace(), but we have no connPtr structure. The
+         * connection structure contains the relevant information for the
+         * access.log entry. If possible, construct a connPtr on the fly based
+         * on the information provided by sockPtr.
          */
-        success = ns_inet_pton((struct sockaddr *)&sockPtr->clientsa, s);
-        if (success > 0) {
+        if (sockPtr->reqPtr != NULL && sockPtr->reqPtr->headers != NULL) {
             /*
-             * We have a valid address. If skipping of non-public servers is
-             * enabled, check if this address is public (i.e., not suited for
-             * geo-location tracking etc.)
+             * It is possible to create a connection structure on the
+             * fly.
              */
-            if (nsconf.reverseproxymode.skipnonpublic
-                && !Ns_SockaddrPublicIpAddress((struct sockaddr *)&sockPtr->clientsa)) {
-                s = NULL;
-            }
-
+            isConnConstructed = NS_TRUE;
+            SockConstructConn(sockPtr, statusCode, &conn);
+            connPtr = (Ns_Conn *)&conn;
         } else {
             /*
-             * Parsing the string was not successful. Now try to process the string of
-             * multiple, comma separated addresses. Since strtok() might be
-             * destructive on the input string, we apply it on a copy.
-             */
-            char *parseString = ns_strdup(s);
-            char *token = ns_strtok(parseString, ", ");
-
-            //Ns_Log(Notice, "parse IP string <%s>", s);
-           /*
-             * Depending on the configuration of trusted reverse proxy
-             * servers, we apply a different strategy.
+             * We want to construct a connection structure, but we
+             * cannot fill it with the necessary information.  This
+             * means, that the function is called in a situation,
+             * where the initialization of the connection was not
+             * finished. In this case connPtr is still NULL;
              */
-            if (nsconf.reverseproxymode.trustedservers != NULL) {
-                Ns_DList dl, *dlPtr = &dl;
-                size_t   i;
-
-                /*
-                 * When trusted reverse proxies are configured, process the
-                 * list of values from right to left, until an address from a
-                 * non-trusted reverseproxy is found. This way, we skip
-                 * trusted servers in the chain and treat the first address
-                 * found as the address of the client.
-                 */
-                Ns_DListInit(dlPtr);
+            Ns_Log(Warning, "--- non-trace access log entry: status code %d"
+                   " cannot add log entry; request provided %d headers provided %d",
+                   statusCode, sockPtr->reqPtr != NULL,
+                   sockPtr->reqPtr != NULL && sockPtr->reqPtr->headers != NULL);
+            isConnConstructed = NS_FALSE;
+            assert(connPtr == NULL);
+        }
+    } else {
+        /*
+         * connPtr was provided.
+         */
+        assert(connPtr != NULL);
+        isConnConstructed = NS_FALSE;
+    }
+    if (connPtr != NULL) {
+        Ns_Log(Notice, "--- non-trace access log entry: constructed %d user '%s' \"%s\" %d %ld",
+               isConnConstructed,
+               Ns_ConnAuthUser(connPtr),
+               connPtr->request.line,
+               Ns_ConnResponseStatus(connPtr),
+               Ns_ConnContentSent(connPtr));
+        /*
+         * Finally call the trace proc LogTrace() with the provided or
+         * constructed connection.
+         */
+        NsRunSelectedTraces(connPtr, "nslog:conntrace");
+    }
+}
 
-                while (token != NULL) {
-                    Ns_DListAppend(dlPtr, token);
-                    token = ns_strtok(NULL, ", ");
-                }
-                //Ns_Log(Notice, "... parsed IP string into %ld tokens", dlPtr->size);
-                for (i = dlPtr->size; i > 0; i--) {
-                    token = (char *)dlPtr->data[i - 1];
+/*
+ *----------------------------------------------------------------------
+ *
+ * NsSockAccessLog --
+ *
+ *      Add an access log entry for a request answered completely by the
+ *      driver (e.g. static files delivered via the driver fast lane). In
+ *      contrast to NsAddNslogEntry(), this is a regular case, which is not
+ *      reported in the system log.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Potentially adding an entry to the access.log file.
+ *
+ *----------------------------------------------------------------------
+ */
+void
+NsSockAccessLog(Sock *sockPtr, ConnPool *poolPtr, int statusCode, size_t contentSent)
+{
+    Conn conn;
 
-                    success = ns_inet_pton((struct sockaddr *)&sockPtr->clientsa, token);
-                    if (success <= 0) {
-                        /*
-                         * The chunk before the comma was not a valid IP address.
-                         */
-                        Ns_Log(Warning, "invalid content in x-forwarded-for header: '%s'", token);
-                        break;
-                    }
-                    if (i == 1) {
-                        /*
-                         * The last entry, check only skipnonpublic if necessary
-                         */
-                        if (nsconf.reverseproxymode.skipnonpublic
-                            && !Ns_SockaddrPublicIpAddress((struct sockaddr *)&sockPtr->clientsa)) {
-                            Ns_Log(Debug, "... skip last non-public token %s", token);
-                            success = -1;
-                        }
-                    } else if (!Ns_SockaddrTrustedReverseProxy((struct sockaddr *)&sockPtr->clientsa)) {
+    NS_NONNULL_ASSERT(sockPtr != NULL);
+    NS_NONNULL_ASSERT(poolPtr != NULL);
+
+    SockConstructConn(sockPtr, statusCode, &conn);
+    conn.poolPtr = poolPtr;
+    conn.nContentSent = contentSent;
+    NsRunSelectedTraces((Ns_Conn *)&conn, "nslog:conntrace");
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * SockSendResponse --
+ *
+ *      Send an HTTP response directly to the client using the
+ *      driver callback.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      May not sent the complete response to the client
+ *      if encountering non-writable connection socket.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+SockSendResponse(Sock *sockPtr, int statusCode, const char *errMsg, const char *headers)
+{
+    struct iovec iov[5];
+    char         firstline[32];
+    ssize_t      sent, tosend;
+    int          nbufs;
+
+    NS_NONNULL_ASSERT(sockPtr != NULL);
+    NS_NONNULL_ASSERT(errMsg != NULL);
+
+    Ns_Log(Debug, "SockSendResponse finishes request with status code %d msg <%s> headers <%s>",
+           statusCode, errMsg, headers);
+
+    NsAddNslogEntry(sockPtr, statusCode, NULL, headers);
+
+    snprintf(firstline, sizeof(firstline), "HTTP/1.0 %d ", statusCode);
+    iov[0].iov_base = firstline;
+    iov[0].iov_len  = strlen(firstline);
+    iov[1].iov_base = (void *)errMsg;
+    iov[1].iov_len  = strlen(errMsg);
+    if (headers == NULL) {
+        iov[2].iov_base = (void *)"\r\n\r\n";
+        iov[2].iov_len  = 4u;
+        nbufs = 3;
+    } else {
+        iov[2].iov_base = (void *)"\r\n";
+        iov[2].iov_len  = 2u;
+        iov[3].iov_base = (char *)headers;
+        iov[3].iov_len  = strlen(headers);
+        iov[4].iov_base = (void *)"\r\n\r\n";
+        iov[4].iov_len  = 4u;
+        nbufs = 5;
+    }
+    tosend = (ssize_t)(iov[0].iov_len + iov[1].iov_len + iov[2].iov_len);
+    sent = NsDriverSend(sockPtr, iov, nbufs, 0u);
+    if (sent < tosend) {
+        Ns_Log(Warning, "Driver: partial write while sending response;"
+               " %" PRIdz " < %" PRIdz, sent, tosend);
+    }
+
+    /*
+     * In case we have a request structure, complain in the system log about
+     * the bad request.
+     */
+    if (sockPtr->reqPtr != NULL) {
+        Request     *reqPtr = sockPtr->reqPtr;
+        const char  *requestLine = (reqPtr->request.line != NULL)
+            ? reqPtr->request.line
+            : NS_EMPTY_STRING;
+
+        /*
+         * Check, if bad request looks like a TLS handshake. If yes, there is
+         * no need to print out the received buffer.
+         */
+        if (unlikely(statusCode == 400)) {
+            char peer[NS_IPADDR_SIZE];
+            const char *bufferString = reqPtr->buffer.string;
+
+            (void)ns_inet_ntop((struct sockaddr *)&(sockPtr->sa), peer, NS_IPADDR_SIZE);
+
+            if (bufferString[0] == (char)0x16 && bufferString[1] >= 3 && bufferString[2] == 1) {
+                Ns_Log(Warning, "invalid request %d (%s) from peer %s: received TLS handshake "
+                       "on a non-TLS connection",
+                       statusCode, errMsg, peer);
 
-                        /*Ns_Log(Notice, "... token %s not trusted, skipnonpublic %d public %d", token,
-                               nsconf.reverseproxymode.skipnonpublic,
-                               Ns_SockaddrPublicIpAddress((struct sockaddr *)&sockPtr->clientsa));*/
-                        /*
-                         * It is not a trusted reverse proxy. Do we want to
-                         * skip non-public addresses?
-                         */
-                        if (nsconf.reverseproxymode.skipnonpublic
-                            && !Ns_SockaddrPublicIpAddress((struct sockaddr *)&sockPtr->clientsa)) {
-                            Ns_Log(Debug, "... skip non-public token %s", token);
-                            success = -1;
-                        } else {
-                            /*
-                             * Accept token, since skipnonpublic is false
-                             */
-                            break;
-                        }
-                    } else {
-                        Ns_Log(Debug, "... skip trusted token %s ", token);
-                        success = -1;
-                    }
-                }
-                Ns_DListFree(dlPtr);
             } else {
+                Tcl_DString dsReqLine;
 
                 /*
-                 * No trusted severs were configured. Here we assume that the
-                 * data we get from the proxy server can be trusted. We get
-                 * the first (leftmost) IP address from a comma separated list
-                 * (classical, default NaviServer behaviour).
+                 * These are errors, which might need some investigation based
+                 * on based on details of the received buffer.
                  */
+                Tcl_DStringInit(&dsReqLine);
+                Ns_Log(Warning, "invalid request: %d (%s) from peer %s request '%s'"
+                       " offsets: read %" PRIuz
+                       " write %" PRIuz " content %" PRIuz " avail %" PRIuz,
+                       statusCode, errMsg,
+                       peer,
+                       Ns_DStringAppendPrintable(&dsReqLine, NS_FALSE, NS_FALSE, requestLine, strlen(requestLine)),
+                       reqPtr->roff,
+                       reqPtr->woff,
+                       reqPtr->coff,
+                       reqPtr->avail);
+                Tcl_DStringFree(&dsReqLine);
+
+                LogBuffer(Warning, "REQ BUFFER", reqPtr->buffer.string, (size_t)reqPtr->buffer.length);
+            }
+        } else if (statusCode >= 500) {
+            Ns_Log(Warning, "request returns %d (%s): %s", statusCode, errMsg, requestLine);
+        }
+    } else {
+        Ns_Log(Warning, "invalid request: %d (%s) - no request information available",
+               statusCode, errMsg);
+    }
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * SockTrigger --
+ *
+ *      Wakeup DriversThread from blocking ns_poll().
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      DriversThread will wake up.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+SockTrigger(NS_SOCKET sock)
+{
+    /*
+     * In case the trigger was not properly set up, ignore the triggering
+     * attempt. This might happen in some error conditions or during startup
+     * and shutdown.
+     */
+    if ((sock != 0) && send(sock, NS_EMPTY_STRING, 1, 0) != 1) {
+        const char *errstr = ns_sockstrerror(ns_sockerrno);
+
+        Ns_Log(Error, "driver: trigger send() failed: %s", errstr);
+    }
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * SockClose --
+ *
+ *      Closes connection socket, does all cleanups. The input parameter
+ *      "keep" might be NS_TRUE/NS_FALSE or -1 if undecided.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      None
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+SockClose(Sock *sockPtr, int keep)
+{
+    NS_NONNULL_ASSERT(sockPtr != NULL);
+
+    if (sockPtr->h2StreamPtr != NULL) {
+        /*
+         * An HTTP/2 stream shares the socket with the connection, finish
+         * just the stream.
+         */
+        NsHttp2StreamClose(sockPtr);
+        sockPtr->sock = NS_INVALID_SOCKET;
+        keep = (int)NS_FALSE;
+
+    } else {
+        if (sockPtr->h2ConnPtr != NULL) {
+            NsHttp2ConnClose(sockPtr->h2ConnPtr);
+            sockPtr->h2ConnPtr = NULL;
+            keep = (int)NS_FALSE;
+        }
+        if (keep != 0) {
+            bool driverKeep = DriverKeep(sockPtr);
+            keep = (int)driverKeep;
+        }
+        if (keep == (int)NS_FALSE) {
+            DriverClose(sockPtr);
+        }
+    }
+    Ns_MutexLock(&sockPtr->drvPtr->lock);
+    sockPtr->keep = (bool)keep;
+    Ns_MutexUnlock(&sockPtr->drvPtr->lock);
+
+    /*
+     * Unconditionally remove temporary file, connection thread
+     * should take care about very large uploads.
+     */
+
+    if (sockPtr->tfile != NULL) {
+        unlink(sockPtr->tfile);
+        ns_free(sockPtr->tfile);
+        sockPtr->tfile = NULL;
+
+        if (sockPtr->tfd > 0) {
+            /*
+             * Close and reset fd. The fd should be > 0 unless we are in error
+             * conditions.
+             */
+            (void) ns_close(sockPtr->tfd);
+        }
+        sockPtr->tfd = 0;
+
+    } else if (sockPtr->tfd > 0) {
+        /*
+         * This must be a fd allocated via Ns_GetTemp();
+         */
+        Ns_ReleaseTemp(sockPtr->tfd);
+        sockPtr->tfd = 0;
+    }
+
+#ifndef _WIN32
+    /*
+     * Un-map temp file used for spooled content.
+     */
+    if (sockPtr->taddr != NULL) {
+        munmap(sockPtr->taddr, (size_t)sockPtr->tsize);
+        sockPtr->taddr = NULL;
+    }
+#endif
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * ChunkedDecode --
+ *
+ *      Reads the content from the incoming request buffer and tries
+ *      to decode chunked encoding parts. The function can be called
+ *      repeatedly and with incomplete input and overwrites the buffer
+ *      with the decoded data optionally. The decoded data is always
+ *      shorter than the encoded one.
+ *
+ * Results:
+ *      SOCK_READY when chunk was complete, SOCK_MORE when more data is
+ *      required, or some error condition.
+ *
+ * Side effects:
+ *      Updates the buffer if update is true (and adjusts
+ *      reqPtr->chunkWriteOff).  Updates always reqPtr->chunkStartOff to allow
+ *      incremental operations.
+ *
+ *----------------------------------------------------------------------
+ */
+static SockState
+ChunkedDecode(Request *reqPtr, bool update)
+{
+    const Tcl_DString *bufPtr;
+    const char        *end, *chunkStart;
+    SockState         result = SOCK_MORE;
+
+    NS_NONNULL_ASSERT(reqPtr != NULL);
+
+    bufPtr = &reqPtr->buffer;
+    end = bufPtr->string + bufPtr->length;
+    chunkStart = bufPtr->string + reqPtr->chunkStartOff;
+
+    while (reqPtr->chunkStartOff <  (size_t)bufPtr->length) {
+        char   *p = strstr(chunkStart, "\r\n"), *numberEnd;
+        long    chunkLength;
+
+        if (p == NULL) {
+            Ns_Log(DriverDebug, "ChunkedDecode: chunk did not find end-of-line");
+            result = SOCK_MORE;
+            break;
+        }
+
+        *p = '\0';
+        chunkLength = strtol(chunkStart, &numberEnd, 16);
+        Ns_Log(DriverDebug, "ChunkedDecode: chunkLength %ld, <%s>", chunkLength, chunkStart);
+        *p = '\r';
+        if (chunkLength < 0) {
+            Ns_Log(Warning, "ChunkedDecode: negative chunk length");
+            result = SOCK_BADREQUEST;
+            break;
+        }
+        if (chunkStart == numberEnd) {
+            Ns_Log(Warning, "ChunkedDecode: invalid chunk length");
+            result = SOCK_BADREQUEST;
+            break;
+        }
+        if (p + 2 + chunkLength > end) {
+            Ns_Log(DriverDebug, "ChunkedDecode: chunk length past end of buffer");
+            result = SOCK_MORE;
+            break;
+        }
+        if (update) {
+            char *writeBuffer = bufPtr->string + reqPtr->chunkWriteOff;
+
+            memmove(writeBuffer, p + 2, (size_t)chunkLength);
+            reqPtr->chunkWriteOff += (size_t)chunkLength;
+            *(writeBuffer + chunkLength) = '\0';
+        }
+        reqPtr->chunkStartOff += (size_t)(p - chunkStart) + 4u + (size_t)chunkLength;
+        chunkStart = bufPtr->string + reqPtr->chunkStartOff;
+        result = SOCK_READY;
+    }
+
+    return result;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * SockRead --
+ *
+ *      Read content from the given Sock, processing the input as
+ *      necessary.  This is the core callback routine designed to
+ *      either be called repeatedly within the DriverThread during
+ *      an async read-ahead or in a blocking loop in NsGetRequest()
+ *      at the start of connection processing.
+ *
+ * Results:
+ *      SOCK_READY: Request is ready for processing.
+ *      SOCK_MORE:  More input is required.
+ *      SOCK_ERROR: Client drop or timeout.
+ *      SOCK_SPOOL: Pass input handling to spooler
+ *      SOCK_CLOSE: peer closed connection
+ *      SOCK_BADREQUEST
+ *      SOCK_BADHEADER
+ *      SOCK_TOOMANYHEADERS
+ *
+ * Side effects:
+ *      The Request structure will be built up for use by the
+ *      connection thread.  Also, before returning SOCK_READY,
+ *      the next byte to read mark and bytes available are set
+ *      to the beginning of the content, just beyond the headers.
+ *
+ *      Contents may be spooled into temp file and mmap-ed
+ *
+ *----------------------------------------------------------------------
+ */
+
+static SockState
+SockRead(Sock *sockPtr, int spooler, const Ns_Time *timePtr)
+{
+    const Driver       *drvPtr;
+    Request      *reqPtr;
+    Tcl_DString  *bufPtr;
+    struct iovec  buf;
+    char          tbuf[16384];
+    size_t        buflen, nread;
+    ssize_t       n;
+    SockState     resultState;
+
+    NS_NONNULL_ASSERT(sockPtr != NULL);
+    drvPtr = sockPtr->drvPtr;
+
+    tbuf[0] = '\0';
+
+    /*
+     * In case of "keepwait", the accept time is not meaningful and
+     * reset to 0. In such cases, update "acceptTime" to the actual
+     * begin of a request. This part is intended for async drivers.
+     */
+    if (sockPtr->acceptTime.sec == 0) {
+        assert(timePtr != NULL);
+        sockPtr->acceptTime = *timePtr;
+    }
+
+    /*
+     * Input of an HTTP/2 connection is processed by the HTTP/2 engine;
+     * complete requests are dispatched by the caller.
+     */
+    if (sockPtr->h2ConnPtr != NULL) {
+        return (NsHttp2Read(sockPtr->h2ConnPtr, NULL, 0u) == NS_OK) ? SOCK_MORE : SOCK_CLOSE;
+    }
+
+    /*
+     * Initialize request structure if needed.
+     */
+    if (sockPtr->reqPtr == NULL) {
+        sockPtr->reqPtr = RequestNew(sockPtr->drvPtr);
+    }
+
+    /*
+     * On the first read, attempt to read-ahead "bufsize" bytes.
+     * Otherwise, read only the number of bytes left in the
+     * content.
+     */
+
+    reqPtr = sockPtr->reqPtr;
+    bufPtr = &reqPtr->buffer;
+    if (reqPtr->length == 0u) {
+        nread = drvPtr->bufsize;
+    } else {
+        nread = reqPtr->length - reqPtr->avail;
+    }
+
+    /*
+     * Grow the buffer to include space for the next bytes.
+     */
+
+    buflen = (size_t)bufPtr->length;
+    n = (ssize_t)(buflen + nread);
+    if (unlikely(n > drvPtr->maxinput)) {
+        n = (ssize_t)drvPtr->maxinput;
+        nread = (size_t)n - buflen;
+        if (nread == 0u) {
+            Ns_Log(DriverDebug, "SockRead: maxinput reached %" TCL_LL_MODIFIER "d",
+                   drvPtr->maxinput);
+            return SOCK_ERROR;
+        }
+    }
+
+    /*
+     * Use temp file for content larger than "readahead" bytes.
+     */
+#ifndef _WIN32
+    if (reqPtr->coff > 0u                     /* We are in the content part (after the header) */
+        && !reqPtr->chunkStartOff             /* Never spool chunked encoded data since we decode in memory */
+        && reqPtr->length > (size_t)drvPtr->readahead /* We need more data */
+        && sockPtr->tfd <= 0                  /* We have no spool fd */
+        ) {
+        const DrvSpooler *spPtr = &drvPtr->spooler;
+
+        Ns_Log(DriverDebug, "SockRead: require temporary file for content spooling (length %" PRIuz" > readahead "
+               "%" TCL_LL_MODIFIER "d)",
+               reqPtr->length, drvPtr->readahead);
+
+        /*
+         * In driver mode send this Sock to the spooler thread if
+         * it is running
+         */
+
+        if (spooler == 0 && spPtr->threads > 0) {
+            return SOCK_SPOOL;
+        }
+
+        /*
+         * If "maxupload" is specified and content size exceeds the configured
+         * values, spool uploads into normal temp file (not deleted).  We do
+         * not want to map such large files into memory.
+         */
+        if (drvPtr->maxupload > 0
+            && reqPtr->length > (size_t)drvPtr->maxupload
+            ) {
+            size_t tfileLength = strlen(drvPtr->uploadpath) + 16u;
+
+            sockPtr->tfile = ns_malloc(tfileLength);
+            snprintf(sockPtr->tfile, tfileLength, "%s/%d.XXXXXX", drvPtr->uploadpath, sockPtr->sock);
+            sockPtr->tfd = ns_mkstemp(sockPtr->tfile);
+            if (sockPtr->tfd == NS_INVALID_FD) {
+                Ns_Log(Error, "SockRead: cannot create spool file with template '%s': %s",
+                       sockPtr->tfile, strerror(errno));
+            }
+        } else {
+            /*
+             * Get a temporary fd. These FDs are used for mmapping.
+             */
+
+            sockPtr->tfd = Ns_GetTemp();
+        }
+
+        if (unlikely(sockPtr->tfd == NS_INVALID_FD)) {
+            Ns_Log(DriverDebug, "SockRead: spool fd invalid");
+            return SOCK_ERROR;
+        }
+
+        n = (ssize_t)((size_t)bufPtr->length - reqPtr->coff);
+        assert(n >= 0);
+        if (ns_write(sockPtr->tfd, bufPtr->string + reqPtr->coff, (size_t)n) != n) {
+            return SOCK_WRITEERROR;
+        }
+        Tcl_DStringSetLength(bufPtr, 0);
+    }
+#endif
+    if (sockPtr->tfd > 0) {
+        buf.iov_base = tbuf;
+        buf.iov_len = MIN(nread, sizeof(tbuf));
+    } else {
+        Tcl_DStringSetLength(bufPtr, (TCL_SIZE_T)(buflen + nread));
+        buf.iov_base = bufPtr->string + reqPtr->woff;
+        buf.iov_len = nread;
+    }
+
+    if (reqPtr->leftover > 0u) {
+        /*
+         * There is some leftover in the buffer, don't read but take the
+         * leftover instead as input.
+         */
+        n = (ssize_t)reqPtr->leftover;
+        reqPtr->leftover = 0u;
+        buflen = 0u;
+        Ns_Log(DriverDebug, "SockRead receive from leftover %" PRIdz " bytes", n);
+    } else {
+        /*
+         * Receive actually some data from the driver.
+         */
+        n = NsDriverRecv(sockPtr, &buf, 1, NULL);
+        Ns_Log(DriverDebug, "SockRead receive from network %" PRIdz " bytes sockState %.2x",
+               n, (int)sockPtr->recvSockState);
+    }
+
+    {
+        Ns_SockState nsSockState = sockPtr->recvSockState;
+        /*
+         * The nsSockState has one of the following values, when provided:
+         *
+         *      NS_SOCK_READ, NS_SOCK_DONE, NS_SOCK_AGAIN, NS_SOCK_EXCEPTION,
+         *      NS_SOCK_TIMEOUT
+         */
+        switch (nsSockState) {
+        case NS_SOCK_TIMEOUT:  NS_FALL_THROUGH; /* fall through */
+        case NS_SOCK_EXCEPTION:
+            return SOCK_READERROR;
+        case NS_SOCK_AGAIN:
+            Tcl_DStringSetLength(bufPtr, (TCL_SIZE_T)buflen);
+            return SOCK_MORE;
+        case NS_SOCK_DONE:
+            return SOCK_CLOSE;
+        case NS_SOCK_READ:
+            break;
+
+        case NS_SOCK_CANCEL:  NS_FALL_THROUGH; /* fall through */
+        case NS_SOCK_EXIT:    NS_FALL_THROUGH; /* fall through */
+        case NS_SOCK_INIT:    NS_FALL_THROUGH; /* fall through */
+        case NS_SOCK_WRITE:
+            Ns_Log(Warning, "SockRead received unexpected state %.2x from driver", nsSockState);
+            return SOCK_READERROR;
+
+        case NS_SOCK_NONE:
+            /*
+             * Old style state management based on "n" and "errno", which is
+             * more fragile. We keep there for old-style drivers.
+             */
+            if (n < 0) {
+                Tcl_DStringSetLength(bufPtr, (TCL_SIZE_T)buflen);
+                /*
+                 * The driver returns -1 when the peer closed the connection, but
+                 * clears the errno such we can distinguish from error conditions.
+                 */
+                if (errno == 0) {
+                    return SOCK_CLOSE;
+                }
+                return SOCK_READERROR;
+            }
+
+            if (n == 0) {
+                Tcl_DStringSetLength(bufPtr, (TCL_SIZE_T)buflen);
+                return SOCK_MORE;
+            }
+            break;
+
+        }
+    }
+
+    if (sockPtr->tfd > 0) {
+        if (ns_write(sockPtr->tfd, tbuf, (size_t)n) != n) {
+            return SOCK_WRITEERROR;
+        }
+    } else {
+        Tcl_DStringSetLength(bufPtr, (TCL_SIZE_T)(buflen + (size_t)n));
+    }
+
+    reqPtr->woff  += (size_t)n;
+    reqPtr->avail += (size_t)n;
+
+    /*
+     * This driver needs raw buffer, it is binary or non-HTTP request
+     */
+
+    if ((drvPtr->opts & NS_DRIVER_NOPARSE) != 0u) {
+        return SOCK_READY;
+    }
+
+    /*
+     * Check for the HTTP/2 client connection preface at the begin of a
+     * connection, either via ALPN "h2" or with prior knowledge.
+     */
+    if (drvPtr->http2
+        && reqPtr->request.line == NULL
+        && reqPtr->roff == 0u
+        && sockPtr->tfd <= 0
+        ) {
+        int preface = NsHttp2Preface(bufPtr->string, reqPtr->avail);
+
+        if (preface == 0) {
+            return SOCK_MORE;
+        } else if (preface == 1) {
+            return SockHttp2Start(sockPtr);
+        }
+    }
+
+    resultState = SockParse(sockPtr);
+
+    return resultState;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * SockHttp2Start --
+ *
+ *      Switch a connection socket to HTTP/2 after the client connection
+ *      preface was received. The data read so far (including the
+ *      preface) is passed to the HTTP/2 engine; afterwards, the socket
+ *      keeps no Request structure. The requests of the streams are
+ *      handled via SockHttp2Dispatch().
+ *
+ * Results:
+ *      SOCK_MORE or SOCK_CLOSE.
+ *
+ * Side effects:
+ *      Creates an HTTP/2 session for the socket.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static SockState
+SockHttp2Start(Sock *sockPtr)
+{
+    Request  *reqPtr;
+    SockState result = SOCK_MORE;
+
+    NS_NONNULL_ASSERT(sockPtr != NULL);
+
+    reqPtr = sockPtr->reqPtr;
+    assert(reqPtr != NULL);
+
+    sockPtr->h2ConnPtr = NsHttp2ConnNew(sockPtr);
+    if (sockPtr->h2ConnPtr == NULL) {
+        result = SOCK_CLOSE;
+    } else if (NsHttp2Read(sockPtr->h2ConnPtr, reqPtr->buffer.string, reqPtr->avail) != NS_OK) {
+        result = SOCK_CLOSE;
+    }
+    Ns_Log(DriverDebug, "SockHttp2Start sock %d: %s", sockPtr->sock, GetSockStateName(result));
+
+    reqPtr->avail = 0u;
+    sockPtr->keep = NS_FALSE;
+    RequestFree(sockPtr);
+
+    /*
+     * Idle HTTP/2 connections are closed silently after the keepalive
+     * timeout.
+     */
+    sockPtr->keep = NS_TRUE;
+
+    return result;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * SockHttp2Dispatch --
+ *
+ *      Create for every complete request received on an HTTP/2
+ *      connection a Sock with its own Request and queue it for processing
+ *      by a connection thread. Streams which cannot be queued are added
+ *      to the wait list.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Queues requests, might send error responses.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+SockHttp2Dispatch(Sock *sockPtr, const Ns_Time *nowPtr, Sock **waitPtrPtr)
+{
+    Driver        *drvPtr;
+    NsHttp2Stream *streamPtr;
+
+    NS_NONNULL_ASSERT(sockPtr != NULL);
+    NS_NONNULL_ASSERT(nowPtr != NULL);
+    NS_NONNULL_ASSERT(waitPtrPtr != NULL);
+
+    drvPtr = sockPtr->drvPtr;
+
+    while ((streamPtr = NsHttp2NextRequest(sockPtr->h2ConnPtr)) != NULL) {
+        Sock     *streamSockPtr = SockNew(drvPtr);
+        SockState s;
+
+        streamSockPtr->sock = sockPtr->sock;
+        memcpy(&streamSockPtr->sa, &sockPtr->sa, sizeof(sockPtr->sa));
+        streamSockPtr->acceptTime = *nowPtr;
+        streamSockPtr->reqPtr = RequestNew(drvPtr);
+        drvPtr->queuesize++;
+        drvPtr->stats.http2streams++;
+
+        if (NsHttp2StreamAttach(streamPtr, streamSockPtr)) {
+            Request *reqPtr = streamSockPtr->reqPtr;
+
+            reqPtr->woff = reqPtr->avail = (size_t)reqPtr->buffer.length;
+            s = SockParse(streamSockPtr);
+            if (s == SOCK_MORE) {
+                /*
+                 * The request is complete; the content length does not
+                 * match the received data.
+                 */
+                s = SOCK_BADREQUEST;
+            }
+        } else {
+            s = SOCK_ENTITYTOOLARGE;
+        }
+        Ns_Log(DriverDebug, "SockHttp2Dispatch sock %d: stream request %s",
+               sockPtr->sock, GetSockStateName(s));
+
+        if (s == SOCK_READY) {
+            if (SockQueue(streamSockPtr, nowPtr) == NS_TIMEOUT) {
+                Push(streamSockPtr, *waitPtrPtr);
+            }
+        } else {
+            SockRelease(streamSockPtr, s, 0);
+        }
+    }
+}
+
+
+
+/*----------------------------------------------------------------------
+ *
+ * LogBuffer --
+ *
+ *      Debug function to output buffer content when the provided severity is
+ *      enabled. The function prints just visible characters and space as is
+ *      and prints the hex code otherwise.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Writes to the system log file.
+ *
+ *----------------------------------------------------------------------
+ */
+static void
+LogBuffer(Ns_LogSeverity severity, const char *msg, const char *buffer, size_t len)
+{
+    Tcl_DString ds;
+
+    NS_NONNULL_ASSERT(msg != NULL);
+    NS_NONNULL_ASSERT(buffer != NULL);
+
+    if (Ns_LogSeverityEnabled(severity)) {
+
+        Tcl_DStringInit(&ds);
+        Tcl_DStringAppend(&ds, msg, TCL_INDEX_NONE);
+        Tcl_DStringAppend(&ds, ": ", 2);
+        (void)Ns_DStringAppendPrintable(&ds, NS_FALSE, NS_FALSE, buffer, len);
+
+        Ns_Log(severity, "%s", ds.string);
+        Tcl_DStringFree(&ds);
+    }
+}
+
+
+/*----------------------------------------------------------------------
+ *
+ * EndOfHeader --
+ *
+ *      Function to be called (once), when end of header is reached. At this
+ *      time, all request header lines were parsed already correctly.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Update various reqPtr fields and signal certain facts and error
+ *      conditions via sockPtr->flags. In error conditions, sockPtr->keep is
+ *      set to NS_FALSE.
+ *
+ *----------------------------------------------------------------------
+ */
+static size_t
+EndOfHeader(Sock *sockPtr)
+{
+    Request      *reqPtr;
+    const char   *s;
+
+    NS_NONNULL_ASSERT(sockPtr != NULL);
+
+    reqPtr = sockPtr->reqPtr;
+    assert(reqPtr != NULL);
+
+    reqPtr->chunkStartOff = 0u;
+
+    /*
+     * Check for "expect: 100-continue" and clear flag in case we have
+     * pipelining.
+     */
+    sockPtr->flags &= ~(NS_CONN_CONTINUE);
+    //s = Ns_SetIGet(reqPtr->headers, "expect");
+    s = sockPtr->extractedHeaderFields[NS_EXTRACTED_HEADER_EXPECT];
+    if (s != NULL) {
+        if (*s == '1' && *(s+1) == '0' && *(s+2) == '0' && *(s+3) == '-') {
+            char *scratch = ns_strdup(s+4);
+
+            Ns_StrToLower(scratch);
+            if (STREQ(scratch, "continue")) {
+                sockPtr->flags |= NS_CONN_CONTINUE;
+            }
+            ns_free(scratch);
+        }
+    }
+
+    /*
+     * Handle content-length, which might be provided or not.
+     * Clear length specific error flags.
+     */
+    sockPtr->flags &= ~(NS_CONN_ENTITYTOOLARGE);
+    //s = Ns_SetIGet(reqPtr->headers, "content-length");
+    s = sockPtr->extractedHeaderFields[NS_EXTRACTED_HEADER_CONTENT_LENGTH];
+    if (s == NULL) {
+        s = Ns_SetIGet(reqPtr->headers, "transfer-encoding");
+
+        if (s != NULL) {
+            /* Lower case is in the standard, capitalized by macOS */
+            if (STREQ(s, "chunked") || STREQ(s, "Chunked")) {
+                Tcl_WideInt expected;
+
+                reqPtr->chunkStartOff = reqPtr->roff;
+                reqPtr->chunkWriteOff = reqPtr->chunkStartOff;
+                reqPtr->contentLength = 0u;
+
+                /*
+                 * We need reqPtr->expectedLength for safely terminating read loop.
+                 */
+                s = Ns_SetIGet(reqPtr->headers, "x-expected-entity-length");
+
+                if ((s != NULL)
+                    && (Ns_StrToWideInt(s, &expected) == NS_OK)
+                    && (expected > 0) ) {
+                    reqPtr->expectedLength = (size_t)expected;
+                }
+                s = NULL;
+            }
+        }
+    }
+
+    /*
+     * In case a valid and meaningful headers determining the content length
+     * was provided, the string with the content length ("s") is not NULL.
+     */
+    if (s != NULL) {
+        Tcl_WideInt length;
+
+        if ((Ns_StrToWideInt(s, &length) == NS_OK) && (length > 0)) {
+            reqPtr->length = (size_t)length;
+            /*
+             * Handle too large input requests.
+             */
+            if (reqPtr->length > (size_t)sockPtr->drvPtr->maxinput) {
+
+                Ns_Log(Warning, "SockParse: request too large, length=%"
+                       PRIdz ", maxinput=%" TCL_LL_MODIFIER "d",
+                       reqPtr->length, sockPtr->drvPtr->maxinput);
+
+                sockPtr->keep = NS_FALSE;
+                sockPtr->flags |= NS_CONN_ENTITYTOOLARGE;
+
+            }
+            reqPtr->contentLength = (size_t)length;
+        }
+    }
+
+    /*
+     * Compression format handling: parse information from request headers
+     * indicating allowed compression formats for quick access.
+     *
+     * Clear compression accepted flag
+     */
+    sockPtr->flags &= ~(NS_CONN_ZIPACCEPTED|NS_CONN_BROTLIACCEPTED|NS_CONN_ZSTDACCEPTED);
+
+    s = Ns_SetIGet(reqPtr->headers, "accept-encoding");
+    if (s != NULL) {
+        bool gzipAccept, brotliAccept, zstdAccept;
+
+        /*
+         * Get allowed compression formats from "accept-encoding" headers.
+         */
+        NsParseAcceptEncoding(reqPtr->request.version, s, &gzipAccept, &brotliAccept, &zstdAccept);
+        if (gzipAccept || brotliAccept || zstdAccept) {
+            /*
+             * Don't allow compression formats for Range requests.
+             */
+            s = Ns_SetIGet(reqPtr->headers, "range");
+            if (s == NULL) {
+                if (gzipAccept) {
+                    sockPtr->flags |= NS_CONN_ZIPACCEPTED;
+                }
+                if (brotliAccept) {
+                    sockPtr->flags |= NS_CONN_BROTLIACCEPTED;
+                }
+                if (zstdAccept) {
+                    sockPtr->flags |= NS_CONN_ZSTDACCEPTED;
+                }
+            }
+        }
+    }
+
+    /*
+     * Determine the peer address for clients coming via reverse proxy
+     * servers, based on the content of the "x-forwarded-for" header. If
+     * trusted reverse proxy servers are specified, accept the field only from
+     * these.
+     */
+
+    s = Ns_SetIGet(reqPtr->headers, "x-forwarded-for");
+    if (s != NULL && !strcasecmp(s, "unknown")) {
+        s = NULL;
+    }
+    if (s != NULL
+        && nsconf.reverseproxymode.trustedservers != NULL
+        && !Ns_SockaddrTrustedReverseProxy((struct sockaddr *)&sockPtr->sa)) {
+        s = NULL;
+    }
+
+    if (s != NULL) {
+        int success;
+
+        /*
+         * Try to parse the whole string as an IP address,.
+         */
+        success = ns_inet_pton((struct sockaddr *)&sockPtr->clientsa, s);
+        if (success > 0) {
+            /*
+             * We have a valid address. If skipping of non-public servers is
+             * enabled, check if this address is public (i.e., not suited for
+             * geo-location tracking etc.)
+             */
+            if (nsconf.reverseproxymode.skipnonpublic
+                && !Ns_SockaddrPublicIpAddress((struct sockaddr *)&sockPtr->clientsa)) {
+                s = NULL;
+            }
+
+        } else {
+            /*
+             * Parsing the string was not successful. Now try to process the string of
+             * multiple, comma separated addresses. Since strtok() might be
+             * destructive on the input string, we apply it on a copy.
+             */
+            char *parseString = ns_strdup(s);
+            char *token = ns_strtok(parseString, ", ");
+
+            //Ns_Log(Notice, "parse IP string <%s>", s);
+           /*
+             * Depending on the configuration of trusted reverse proxy
+             * servers, we apply a different strategy.
+             */
+            if (nsconf.reverseproxymode.trustedservers != NULL) {
+                Ns_DList dl, *dlPtr = &dl;
+                size_t   i;
+
+                /*
+                 * When trusted reverse proxies are configured, process the
+                 * list of values from right to left, until an address from a
+                 * non-trusted reverseproxy is found. This way, we skip
+                 * trusted servers in the chain and treat the first address
+                 * found as the address of the client.
+                 */
+                Ns_DListInit(dlPtr);
+
+                while (token != NULL) {
+                    Ns_DListAppend(dlPtr, token);
+                    token = ns_strtok(NULL, ", ");
+                }
+                //Ns_Log(Notice, "... parsed IP string into %ld tokens", dlPtr->size);
+                for (i = dlPtr->size; i > 0; i--) {
+                    token = (char *)dlPtr->data[i - 1];
+
+                    success = ns_inet_pton((struct sockaddr *)&sockPtr->clientsa, token);
+                    if (success <= 0) {
+                        /*
+                         * The chunk before the comma was not a valid IP address.
+                         */
+                        Ns_Log(Warning, "invalid content in x-forwarded-for header: '%s'", token);
+                        break;
+                    }
+                    if (i == 1) {
+                        /*
+                         * The last entry, check only skipnonpublic if necessary
+                         */
+                        if (nsconf.reverseproxymode.skipnonpublic
+                            && !Ns_SockaddrPublicIpAddress((struct sockaddr *)&sockPtr->clientsa)) {
+                            Ns_Log(Debug, "... skip last non-public token %s", token);
+                            success = -1;
+                        }
+                    } else if (!Ns_SockaddrTrustedReverseProxy((struct sockaddr *)&sockPtr->clientsa)) {
+
+                        /*Ns_Log(Notice, "... token %s not trusted, skipnonpublic %d public %d", token,
+                               nsconf.reverseproxymode.skipnonpublic,
+                               Ns_SockaddrPublicIpAddress((struct sockaddr *)&sockPtr->clientsa));*/
+                        /*
+                         * It is not a trusted reverse proxy. Do we want to
+                         * skip non-public addresses?
+                         */
+                        if (nsconf.reverseproxymode.skipnonpublic
+                            && !Ns_SockaddrPublicIpAddress((struct sockaddr *)&sockPtr->clientsa)) {
+                            Ns_Log(Debug, "... skip non-public token %s", token);
+                            success = -1;
+                        } else {
+                            /*
+                             * Accept token, since skipnonpublic is false
+                             */
+                            break;
+                        }
+                    } else {
+                        Ns_Log(Debug, "... skip trusted token %s ", token);
+                        success = -1;
+                    }
+                }
+                Ns_DListFree(dlPtr);
+            } else {
+
+                /*
+                 * No trusted severs were configured. Here we assume that the
+                 * data we get from the proxy server can be trusted. We get
+                 * the first (leftmost) IP address from a comma separated list
+                 * (classical, default NaviServer behaviour).
+                 */
+
+                while (token != NULL) {
+                    /*Ns_Log(Notice, "check token '%s' in classic case, skipnonpublic %d",
+                      token, nsconf.reverseproxymode.skipnonpublic);*/
+
+                    success = ns_inet_pton((struct sockaddr *)&sockPtr->clientsa, token);
+                    if (success <= 0) {
+                        /*
+                         * The chunk before the comma was not a valid IP address.
+                         */
+                        Ns_Log(Warning, "invalid content in x-forwarded-for header: '%s'", token);
+                        break;
+                    }
+                    if (nsconf.reverseproxymode.skipnonpublic) {
+                        if (Ns_SockaddrPublicIpAddress((struct sockaddr *)&sockPtr->clientsa)) {
+                            break;
+                        }
+                        success = -1;
+                        Ns_Log(Debug, "... skipping token '%s'", token);
+                    } else {
+                        break;
+                    }
+                    /*
+                     * Continue to the next token.
+                     */
+                    token = ns_strtok(NULL, ", ");
+                }
+            }
+            ns_free(parseString);
+        }
+        Ns_Log(Debug, "x-forwarded-for: accept IP address from '%s' -> %d",
+               (s == NULL ? "(null)" : s), success);
+
+        if (success <= 0) {
+            s = NULL;
+        }
+    }
+    if (s == NULL) {
+        memset(&sockPtr->clientsa, 0, sizeof(struct NS_SOCKADDR_STORAGE));
+    }
+
+    /*
+     * Set up request length for spooling and further read operations
+     */
+    if (reqPtr->contentLength != 0u) {
+        /*
+         * content-length was provided, use it
+         */
+        reqPtr->length = reqPtr->contentLength;
+    }
+
+    return reqPtr->roff;
+}
+
+
+/*----------------------------------------------------------------------
+ *
+ * SockParse --
+ *
+ *      Construct the given conn by parsing input buffer until end of
+ *      headers.  Return SOCK_READY when finished parsing.
+ *
+ * Results:
+ *      SOCK_READY:  Conn is ready for processing.
+ *      SOCK_MORE:   More input is required.
+ *      SOCK_ERROR:  Malformed request.
+ *      SOCK_BADREQUEST
+ *      SOCK_BADHEADER
+ *      SOCK_TOOMANYHEADERS
+ *
+ * Side effects:
+ *      An Ns_Request and/or Ns_Set may be allocated.
+ *      Ns_Conn buffer management offsets updated.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static SockState
+SockParse(Sock *sockPtr)
+{
+    const Tcl_DString  *bufPtr;
+    const Driver       *drvPtr;
+    Request            *reqPtr;
+    char                save;
+    SockState           result;
+
+    NS_NONNULL_ASSERT(sockPtr != NULL);
+    drvPtr = sockPtr->drvPtr;
+
+    NsUpdateProgress((Ns_Sock *) sockPtr);
+
+    reqPtr = sockPtr->reqPtr;
+    bufPtr = &reqPtr->buffer;
+
+    /*
+     * Scan lines (header) until start of content (body-part)
+     */
+
+    while (reqPtr->coff == 0u) {
+        char        *s, *e;
+        size_t       cnt;
+        NsHeaderScan scan;
+
+        /*
+         * Find the next header line. The scan determines as well the
+         * position of the field separator and invalid bytes in the line.
+         */
+        s = bufPtr->string + reqPtr->roff;
+        e = NsHeaderScanLine(s, reqPtr->avail, &scan);
+
+        if (unlikely(e == NULL)) {
+            /*
+             * Input not yet newline terminated - request more data.
+             */
+            return SOCK_MORE;
+        }
+
+        /*
+         * Check for max single line overflows.
+         *
+         * Previous versions if the driver returned here directly an
+         * error code, which was handled via HTTP error message
+         * provided via SockError(). However, the SockError() handling
+         * closes the connection immediately. This has the
+         * consequence, that the HTTP client might never see the error
+         * message, since the request was not yet fully transmitted,
+         * but it will see a "broken pipe: 13" message instead. We
+         * read now the full request and return the message via
+         * ConnRunRequest().
+         */
+
+        if (unlikely((e - s) > drvPtr->maxline)) {
+            sockPtr->keep = NS_FALSE;
+            if (reqPtr->request.line == NULL) {
+                Ns_Log(DriverDebug, "SockParse: maxline reached of %d bytes",
+                       drvPtr->maxline);
+                sockPtr->flags = NS_CONN_REQUESTURITOOLONG;
+                Ns_Log(Warning, "request line is too long (%d bytes)", (int)(e - s));
+            } else {
+                sockPtr->flags = NS_CONN_LINETOOLONG;
+                Ns_Log(Warning, "request header line is too long (%d bytes)", (int)(e - s));
+            }
+        }
+
+        /*
+         * Update next read pointer to end of this line.
+         */
+        cnt = (size_t)(e - s) + 1u;
+        reqPtr->roff  += cnt;
+        reqPtr->avail -= cnt;
+
+        /*
+         * Adjust end pointer to the last content character before the line
+         * terminator.
+         */
+        if (likely(e > s) && likely(*(e-1) == '\r')) {
+            --e;
+        }
+
+        /*
+         * Check for end of headers in case we have not done it yet.
+         */
+        if (unlikely(e == s) && (reqPtr->coff == 0u)) {
+            /*
+             * We are at end of headers.
+             */
+            if (CheckSingletonHeaderFields(sockPtr) == NS_ERROR) {
+                return SOCK_BADREQUEST;
+            }
+            /*Ns_Log(Notice, "Extracted HOST <%s>",
+              sockPtr->extractedHeaderFields[NS_EXTRACTED_HEADER_HOST]);*/
+
+            reqPtr->coff = EndOfHeader(sockPtr);
+            if (Ns_LogSeverityEnabled(Ns_LogRequestDebug)) {
+                Tcl_DString ds;
+
+                Tcl_DStringInit(&ds);
+                Ns_SetFormat(&ds, reqPtr->headers, NS_TRUE, "  ", ": ");
+                Ns_Log(Ns_LogRequestDebug, "received %s", ds.string);
+                Tcl_DStringFree(&ds);
+            }
+
+            /*
+             * In cases the client sent "expect: 100-continue", report back that
+             * everything is fine with the headers.
+             */
+            if ((sockPtr->flags & NS_CONN_CONTINUE) != 0u) {
+
+                Ns_Log(Ns_LogRequestDebug, "honoring 100-continue");
+
+                /*
+                 * In case, the request entity (body) was too large, we can
+                 * return immediately the error message, when the client has
+                 * flagged this via "Expect:". Otherwise we have to read the
+                 * full request (although it is too large) to drain the
+                 * channel. Otherwise, the server might close the connection
+                 * *before* it has received full request with its body from
+                 * the client. We just keep the flag and let
+                 * Ns_ConnRunRequest() handle the error message.
+                 */
+                if ((sockPtr->flags & NS_CONN_ENTITYTOOLARGE) != 0u) {
+                    Ns_Log(Ns_LogRequestDebug, "100-continue: entity too large");
+
+                    return SOCK_ENTITYTOOLARGE;
+
+                    /*
+                     * We have no other error message flagged (future ones
+                     * have to be handled here).
+                     */
+                } else {
+                    struct iovec iov[1];
+                    ssize_t      sent;
+
+                    /*
+                     * Reply with "100 continue".
+                     */
+                    Ns_Log(Ns_LogRequestDebug, "100-continue: reply CONTINUE");
+                    NsAddNslogEntry(sockPtr, 100, NULL, NULL);
+                    Ns_Log(Notice, "**** 100-continue line <%s>", sockPtr->reqPtr->request.line);
+
+                    iov[0].iov_base = (char *)"HTTP/1.1 100 Continue\r\n\r\n";
+                    iov[0].iov_len = strlen(iov[0].iov_base);
+
+                    sent = Ns_SockSendBufs((Ns_Sock *)sockPtr, iov, 1,
+                                           NULL, 0u);
+                    if (sent != (ssize_t)iov[0].iov_len) {
+                        Ns_Log(Warning, "could not deliver response: 100 Continue");
+                        /*
+                         * Should we bail out here?
+                         */
+                    }
+                }
+            }
+        } else {
+            /*
+             * We have the request-line or a header line to process.
+             */
+            save = *e;
+            *e = '\0';
+
+            if (unlikely(scan.invalid != NULL)) {
+                /*
+                 * Control characters (e.g. NUL or a bare CR) are not
+                 * allowed in the request line or in header fields.
+                 */
+                Ns_Log(Warning, "SockParse (%d): invalid character 0x%02x in request %s line",
+                       sockPtr->sock, UCHAR(*scan.invalid),
+                       reqPtr->request.line == NULL ? "start" : "header");
+                return (reqPtr->request.line == NULL) ? SOCK_BADREQUEST : SOCK_BADHEADER;
+            }
+
+            if (unlikely(reqPtr->request.line == NULL)) {
+                /*
+                 * There is no request-line set. The received line must the
+                 * the request-line.
+                 */
+                Ns_Log(DriverDebug, "SockParse (%d): parse request line <%s>", sockPtr->sock, s);
+
+                if (Ns_ParseRequest(&reqPtr->request, s, (size_t)(e-s)) == NS_ERROR) {
+                    /*
+                     * Invalid request.
+                     */
+                    return SOCK_BADREQUEST;
+                }
+
+                /*
+                 * HTTP 0.9 did not have an HTTP-version number or request headers
+                 * and no empty line terminating the request header.
+                 */
+                if (unlikely(reqPtr->request.version < 1.0)) {
+                    /*
+                     * Pre-HTTP/1.0 request.
+                     */
+                    reqPtr->coff = reqPtr->roff;
+                    Ns_Log(Notice, "pre-HTTP/1.0 request <%s>", reqPtr->request.line);
+                }
+
+            } else {
+                Ns_ReturnCode status;
+
+                if (likely(scan.colon != NULL) && likely(CHARTYPE(space, *s) == 0)) {
+                    /*
+                     * Regular header field, the separator is already known.
+                     */
+                    (void) NsParseHeaderField(reqPtr->headers, s, scan.colon, Preserve);
+                    status = NS_OK;
+                } else {
+                    /*
+                     * Continuation line or malformed header.
+                     */
+                    status = Ns_ParseHeader(reqPtr->headers, s, NULL, Preserve, NULL);
+                }
+
+                if (status != NS_OK) {
+                    /*
+                     * Invalid header.
+                     */
+                    return SOCK_BADHEADER;
+                }
+
+                /*
+                 * Check for max number of headers
+                 */
+                if (unlikely(Ns_SetSize(reqPtr->headers) > (size_t)drvPtr->maxheaders)) {
+                    Ns_Log(DriverDebug, "SockParse (%d): maxheaders reached of %d bytes",
+                           sockPtr->sock, drvPtr->maxheaders);
+                    return SOCK_TOOMANYHEADERS;
+                }
+            }
+
+            *e = save;
+        }
+    }
+
+    if (unlikely(reqPtr->request.line == NULL)) {
+        /*
+         * We are at end of headers, but we have not parsed a request line
+         * (maybe just two linefeeds).
+         */
+        return SOCK_BADREQUEST;
+    }
+
+
+    /*
+     * We are in the request body.
+     */
+    assert(reqPtr->coff > 0u);
+    assert(reqPtr->request.line != NULL);
+
+    /*
+     * Check if all content has arrived.
+     */
+    Ns_Log(DriverDebug, "=== length < avail (length %" PRIuz
+           ", avail %" PRIuz ") tfd %d tfile %p chunkStartOff %" PRIuz,
+           reqPtr->length, reqPtr->avail, sockPtr->tfd,
+           (void *)sockPtr->tfile, reqPtr->chunkStartOff);
+
+    if (reqPtr->chunkStartOff != 0u) {
+        /*
+         * Chunked encoding was provided.
+         */
+        SockState chunkState;
+        size_t    currentContentLength;
+
+        chunkState = ChunkedDecode(reqPtr, NS_TRUE);
+        currentContentLength = reqPtr->chunkWriteOff - reqPtr->coff;
+
+        /*
+         * A chunk might be complete, but it might not be the last
+         * chunk from the client. The best thing would be to be able
+         * to read until EOF here. In cases, where the (optional)
+         * "expectedLength" was provided by the client, we terminate
+         * depending on that information
+         */
+        if ((chunkState == SOCK_MORE)
+            || (reqPtr->expectedLength != 0u && currentContentLength < reqPtr->expectedLength)) {
+            /*
+             * ChunkedDecode wants more data.
+             */
+            return SOCK_MORE;
+
+        } else if (chunkState != SOCK_READY) {
+            return chunkState;
+        }
+        /*
+         * ChunkedDecode has enough data.
+         */
+        reqPtr->length = (size_t)currentContentLength;
+    }
+
+    if (reqPtr->avail < reqPtr->length) {
+        Ns_Log(DriverDebug, "SockRead wait for more input");
+        /*
+         * Wait for more input.
+         */
+        return SOCK_MORE;
+    }
+
+    Ns_Log(Dev, "=== all required data is available (avail %" PRIuz", length %" PRIuz ", "
+           "readahead %" TCL_LL_MODIFIER "d maxupload %" TCL_LL_MODIFIER "d) tfd %d",
+           reqPtr->avail, reqPtr->length, drvPtr->readahead, drvPtr->maxupload,
+           sockPtr->tfd);
+
+    /*
+     * We have all required data in the receive buffer or in a temporary file.
+     *
+     * - Uploads > "readahead": these are put into temporary files.
+     *
+     * - Uploads > "maxupload": these are put into temporary files
+     *   without mmapping, no content parsing will be performed in memory.
+     */
+    result = SOCK_READY;
+
+    if (sockPtr->tfile != NULL) {
+        reqPtr->content = NULL;
+        reqPtr->next = NULL;
+        reqPtr->avail = 0u;
+        Ns_Log(DriverDebug, "content spooled to file: size %" PRIdz ", file %s",
+               reqPtr->length, sockPtr->tfile);
+        /*
+         * Nothing more to do, return via SOCK_READY;
+         */
+    } else {
+
+        /*
+         * Uploads < "maxupload" are spooled to files and mmapped in order to
+         * provide the usual interface via [ns_conn content].
+         */
+        if (sockPtr->tfd > 0) {
+#ifdef _WIN32
+            /*
+             * For _WIN32, tfd should never be set, since tfd-spooling is not
+             * implemented for windows.
+             */
+            assert(0);
+#else
+            int prot = PROT_READ | PROT_WRITE;
+            /*
+             * Add a byte to make sure, the string termination with \0 below falls
+             * always into the mmapped area. On some older OSes this might lead to
+             * crashes when we hitting page boundaries.
+             */
+            ssize_t rc = ns_write(sockPtr->tfd, "\0", 1);
+            if (rc == -1) {
+                Ns_Log(Error, "socket: could not append terminating 0-byte");
+            }
+            sockPtr->tsize = reqPtr->length + 1;
+            sockPtr->taddr = mmap(0, sockPtr->tsize, prot, MAP_PRIVATE,
+                                  sockPtr->tfd, 0);
+            if (sockPtr->taddr == MAP_FAILED) {
+                sockPtr->taddr = NULL;
+                result = SOCK_ERROR;
+
+            } else {
+                reqPtr->content = sockPtr->taddr;
+                Ns_Log(Debug, "content spooled to mmapped file: readahead=%"
+                       TCL_LL_MODIFIER "d, filesize=%" PRIdz,
+                       drvPtr->readahead, sockPtr->tsize);
+            }
+#endif
+        } else {
+            /*
+             * Set the content the begin of the remaining buffer (content offset).
+             * This happens as well when reqPtr->contentLength is 0, but it is
+             * needed for chunked input processing.
+             */
+            reqPtr->content = bufPtr->string + reqPtr->coff;
+            Ns_Log(DriverDebug, "driver sets  reqPtr->content (len %zu) to '%s'", reqPtr->contentLength, reqPtr->content);
+        }
+        reqPtr->next = reqPtr->content;
+
+        /*
+         * Add a terminating NUL character. The content might be from the receive
+         * buffer (Tcl_DString) or from the mmapped file. Non-mmapped files are handled
+         * above.
+         */
+        if (reqPtr->length > 0u) {
+            Ns_Log(DriverDebug, "SockRead adds null terminating character at content[%" PRIuz "]", reqPtr->length);
+
+            reqPtr->savedChar = reqPtr->content[reqPtr->length];
+            reqPtr->content[reqPtr->length] = '\0';
+            if (sockPtr->taddr == NULL) {
+                LogBuffer(DriverDebug, "UPDATED BUFFER", sockPtr->reqPtr->buffer.string, (size_t)reqPtr->buffer.length);
+            }
+        }
+    }
+
+    return result;
+}
+
+
+static bool
+NormalizeHostEntry(Tcl_DString *hostDs, Driver *drvPtr, Ns_Request *requestPtr)
+{
+    char *hostStart, *portStart, *end;
+    bool  success = NS_TRUE;
+
+    NS_NONNULL_ASSERT(hostDs != NULL);
+    NS_NONNULL_ASSERT(drvPtr != NULL);
+
+    Ns_Log(Debug, "NormalizeHostEntry <%s> reqPtr %p", hostDs->string, (void*)requestPtr);
+
+    if (!Ns_HttpParseHost2(hostDs->string, NS_FALSE, &hostStart, &portStart, &end)) {
+        Ns_Log(Warning, "Cannot parse provided host header field <%s>", hostDs->string);
+        success = NS_FALSE;
+    } else {
+        bool   ipLiteral, stripDot = NS_FALSE;
+        size_t hostlen;
+
+        /*
+         * Remove trailing dot of host header field, since RFC 2976 allows fully
+         * qualified "absolute" DNS names in host fields (see e.g. §3.2.2).
+         *
+         */
+        hostlen = strlen(hostStart);
+
+        if (hostStart[hostlen-1] == '.') {
+            hostStart[hostlen-1] = 0;
+            stripDot = NS_TRUE;
+        }
+
+        /*
+         * For proxy and CONNECT requests, we have host and port already set. Leave
+         * host and port as it is.
+         */
+        if (requestPtr != NULL && requestPtr->requestType == NS_REQUEST_TYPE_PLAIN) {
+
+            //assert(requestPtr->host == NULL);
+            if (requestPtr->host != NULL) {
+                Ns_Log(Warning, "NormalizeHostEntry called with host already set to '%s'"
+                       " in a plain request (new host header '%s')", requestPtr->host, hostDs->string);
+                ns_free((char *)requestPtr->host);
+            }
+
+            requestPtr->host = ns_strdup(hostStart);
+            requestPtr->port = (portStart != NULL
+                                ? (unsigned short)strtol(portStart, NULL, 10)
+                                : drvPtr->port);
+        }
+
+        /*
+         * In IP-literal notation, we have to care about surrounding square
+         * braces.
+         */
+        ipLiteral = (hostStart != hostDs->string);
+
+        if (portStart == NULL) {
+            /*
+             * No port provided
+             */
+            if (ipLiteral) {
+                /*
+                 * Undo NUL chars from Ns_HttpParseHost2, do not check for last
+                 * character.
+                 */
+                hostDs->string[hostDs->length - 1] = ']';
+            } else {
+                /*
+                 * Dropped dot at end of hostname.
+                 */
+                if (stripDot) {
+                    Tcl_DStringSetLength(hostDs, hostDs->length - 1);
+                }
+            }
+            Ns_DStringPrintf(hostDs, ":%hu", drvPtr->port);
+        } else {
+            /*
+             * Port provided.
+             */
+            *(portStart-1) = ':';
+            if (ipLiteral) {
+                /*
+                 * Undo NUL chars from Ns_HttpParseHost2, do not check for last
+                 * character.
+                 */
+                *(portStart -2) = ']';
+            } else {
+                if (stripDot) {
+                    /*
+                     * Dropped dot at end of hostname.
+                     */
+                    memmove(portStart-2, portStart-1,
+                            (size_t)(hostDs->length + 1 - (portStart - hostDs->string)));
+                    Tcl_DStringSetLength(hostDs, hostDs->length - 1);
+                }
+            }
+        }
+    }
+
+    return success;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * DriverLookupHost --
+ *
+ *      Lookup the specified hostname in the virtual hosts mapping table.
+ *
+ * Results:
+ *      ServerMap entry or NULL.
+ *
+ * Side effects:
+ *
+ *      None.
+ *
+ *----------------------------------------------------------------------
+ */
+static const ServerMap *
+DriverLookupHost(Tcl_DString *hostDs, Ns_Request *requestPtr, Driver *drvPtr)
+{
+    const ServerMap     *result = NULL;
+    const Tcl_HashEntry *hPtr;
+
+    NS_NONNULL_ASSERT(hostDs != NULL);
+    NS_NONNULL_ASSERT(drvPtr != NULL);
+
+    Ns_Log(Debug, "driver lookup parse <%s>", hostDs->string);
+
+    if (!NormalizeHostEntry(hostDs, drvPtr, requestPtr)) {
+        Ns_Log(Warning, "Cannot parse provided host header field <%s>", hostDs->string);
+        return NULL;
+    }
+
+    /*
+     * Convert the normalized host header field to lowercase before hash
+     * lookup.
+     */
+    Ns_StrToLower(hostDs->string);
+    Ns_Log(Debug, "host table lookup <%s>", hostDs->string);
+
+    hPtr = Tcl_FindHashEntry(&drvPtr->hosts, hostDs->string);
+    Ns_Log(Debug, "DriverLookupHost module '%s' host '%s' => %p",
+           drvPtr->moduleName, hostDs->string, (void*)hPtr);
+
+    if (hPtr != NULL) {
+        /*
+         * Request with provided host header field could be resolved against a
+         * certain server.
+         */
+        result = Tcl_GetHashValue(hPtr);
+
+    } else {
+        /*
+         * Host header field content is not found in the mapping table.
+         */
+        Ns_Log(Debug,
+               "cannot lookup host header content '%s' in virtual hosts "
+               "table of driver '%s', fall back to default "
+               "(default mapping or driver data)",
+               hostDs->string, drvPtr->moduleName);
+
+        if (Ns_LogSeverityEnabled(Debug)) {
+            Tcl_HashEntry  *hPtr2;
+            Tcl_HashSearch  search;
+
+            hPtr2 = Tcl_FirstHashEntry(&drvPtr->hosts, &search);
+            while (hPtr2 != NULL) {
+                Ns_Log(Notice, "... host entry: '%s'",
+                       (char *)Tcl_GetHashKey(&drvPtr->hosts, hPtr2));
+                hPtr2 = Tcl_NextHashEntry(&search);
+            }
+        }
+    }
+    return result;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * NsDriverLookupHostCtx --
+ *
+ *      Lookup the NS_TLS_SSL_CTX matching to hostName. This function is only
+ *      called in https drivers, where SNI can be used.
+ *
+ * Results:
+ *      NS_TLS_SSL_CTX entry or NULL.
+ *
+ * Side effects:
+ *
+ *      None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+NS_TLS_SSL_CTX *
+NsDriverLookupHostCtx(Tcl_DString *hostDs, const char *hostName, const Ns_Driver *drvPtr)
+{
+    const ServerMap *mapPtr;
+    Driver *driver = (Driver *)drvPtr;
+
+    NS_NONNULL_ASSERT(hostDs != NULL);
+    NS_NONNULL_ASSERT(drvPtr != NULL);
+
+    mapPtr = DriverLookupHost(hostDs, NULL, driver);
+
+    if (mapPtr == NULL && hostName != NULL) {
+        const char *vhostcertificates, *section = driver->path;
+
+        /*
+         * Try to get from the driver the value of the configuration variable
+         * "vhostcertificates".
+         */
+        vhostcertificates = Ns_ConfigGetValue(section, "vhostcertificates");
+        Ns_Log(Debug, "SSL_serverNameCB %s/vhostcertificates -> '%s'", section, vhostcertificates);
+
+        if (vhostcertificates != NULL) {
+            Tcl_DString dsFileName, *dsPtr = &dsFileName;
+            NsServer   *servPtr = driver->servPtr;
+            struct stat st;
+
+            if (servPtr == NULL && driver->defMapPtr != NULL) {
+                servPtr = driver->defMapPtr->servPtr;
+            }
+            Tcl_DStringInit(dsPtr);
+            Tcl_DStringAppend(dsPtr, vhostcertificates, TCL_INDEX_NONE);
+            Tcl_DStringAppend(dsPtr, "/", 1);
+            Tcl_DStringAppend(dsPtr, hostName, TCL_INDEX_NONE);
+            Tcl_DStringAppend(dsPtr, ".pem", 4);
+
+            if (stat(dsPtr->string, &st) != 0) {
+                Ns_Log(Notice, "SSL_serverNameCB pem file does not exist: '%s'", dsPtr->string);
+            } else if (servPtr == NULL) {
+                Ns_Log(Notice, "SSL_serverNameCB driver %s has no configured defaultserver,"
+                       " ignoring vhostcertificates", section);
+            } else {
+                NS_TLS_SSL_CTX *ctx = NULL;
+                int             result;
+
+                Ns_Log(Debug, "SSL_serverNameCB pem file exists: '%s'", dsPtr->string);
+
+                result = Ns_TLS_CtxServerCreate(NULL, dsPtr->string,
+                                                NULL /*caFile*/, NULL /*caPath*/,
+                                                Ns_ConfigBool(section, "verify", 0),
+                                                Ns_ConfigGetValue(section, "ciphers"),
+                                                Ns_ConfigGetValue(section, "ciphersuites"),
+                                                Ns_ConfigGetValue(section, "protocols"),
+                                                &ctx);
+                Ns_Log(Debug, "SSL_serverNameCB load cert -> ctx %p'", (void*)ctx);
+
+                if (result == TCL_OK) {
+                    Tcl_DString dsHostPort, *dsHostPortPtr = &dsHostPort;
+
+                    Ns_Log(Notice, "SSL_serverNameCB pem file loaded: '%s'", dsPtr->string);
+                    /*
+                     * We need here just the TLS_Ctx, and not the full server
+                     * init as in nsssl as provided by Ns_TLS_CtxServerInit(),
+                     * with "app_data" as (NsSSLConfig *drvCfgPtr;) ?
+                     */
+                    assert(ctx != NULL);
+
+                    Tcl_DStringInit(dsHostPortPtr);
+                    (void) Ns_DStringPrintf(dsHostPortPtr, "%s:%hu", hostName, driver->port);
+
+                    Tcl_DStringSetLength(dsPtr, 0);
+                    /*
+                     * Register this name to be used with the configure or
+                     * default server. Since this happens in a driver thread,
+                     * no lock is required, even when with multiple driver
+                     * threads, since these have different driver structures.
+                     */
+                    mapPtr = ServerMapEntryAdd(dsPtr, dsHostPortPtr->string,
+                                               servPtr,
+                                               driver, ctx, NS_FALSE);
+
+                    Tcl_DStringFree(dsHostPortPtr);
+                }
+            }
+            Tcl_DStringFree(dsPtr);
+        }
+    }
+
+    return (mapPtr != NULL) ? mapPtr->ctx : NULL;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * CheckSingletonHeaderFields --
+ *
+ *      Check if the singleton request header fields are provided only once.
+ *      Certain header field values, which are often used are extracted into
+ *      "extractedHeaderFields".
+ *
+ *      Note that these strings are only guaranteed to be correct as long the
+ *      underlying Ns_Set is not changed. This typically the case just in the
+ *      driver.
+ *
+ * Results:
+ *      NS_OK or NS_ERROR when duplicates are found,
+ *
+ * Side effects:
+ *
+ *      sockPtr->extractedHeaderFields is updated.
+ *
+ *----------------------------------------------------------------------
+ */
+static Ns_ReturnCode
+CheckSingletonHeaderFields(Sock *sockPtr)
+{
+    size_t        i, idx;
+    Ns_Set       *headers = sockPtr->reqPtr->headers;
+    int           counts[Ns_NrElements(singletonRequestHeaderFields)] = {0};
+    const char **singletonFields = sockPtr->extractedHeaderFields;
+
+    memset(sockPtr->extractedHeaderFields, 0, sizeof(sockPtr->extractedHeaderFields));
+    /*
+     * Iterate just once over the host header fields. This is more efficient,
+     * than for calling for all of these fields Ns_Set*Get functions, since
+     * these iterate as well over the header fields.
+     */
+    for (idx = 0u; idx < headers->size; idx++) {
+        const char *name       = headers->fields[idx].name;
+        char        first_char = (CHARTYPE(lower, *name) != 0) ? *name : CHARCONV(lower, *name);
+
+        for (i = 0; i < Ns_NrElements(singletonRequestHeaderFields); i++) {
+            const char *singletonName = singletonRequestHeaderFields[i].name;
+            int         cmp;
+
+            /*
+             * Call strcasecmp() only, when the first char is equal.
+             */
+            if (first_char != *singletonName) {
+                continue;
+            }
+            cmp = strcasecmp(singletonName, name);
+            //Ns_Log(Notice, "cmd %s vs %s -> %d",name, singletonName, cmp);
 
-                while (token != NULL) {
-                    /*Ns_Log(Notice, "check token '%s' in classic case, skipnonpublic %d",
-                      token, nsconf.reverseproxymode.skipnonpublic);*/
+            if (cmp == 0) {
+                if (++counts[i] > 1) {
+                    Ns_Log(Warning, "request header field \"%s\" is provided more than once. Request: \"%s\"\n",
+                           singletonName, sockPtr->reqPtr->request.line);
+                    return NS_ERROR;
 
-                    success = ns_inet_pton((struct sockaddr *)&sockPtr->clientsa, token);
-                    if (success <= 0) {
-                        /*
-                         * The chunk before the comma was not a valid IP address.
-                         */
-                        Ns_Log(Warning, "invalid content in x-forwarded-for header: '%s'", token);
-                        break;
-                    }
-                    if (nsconf.reverseproxymode.skipnonpublic) {
-                        if (Ns_SockaddrPublicIpAddress((struct sockaddr *)&sockPtr->clientsa)) {
-                            break;
-                        }
-                        success = -1;
-                        Ns_Log(Debug, "... skipping token '%s'", token);
-                    } else {
-                        break;
-                    }
-                    /*
-                     * Continue to the next token.
-                     */
-                    token = ns_strtok(NULL, ", ");
                 }
+                if (singletonRequestHeaderFields[i].extract != NS_EXTRACTED_NONE) {
+                    singletonFields[singletonRequestHeaderFields[i].extract] = headers->fields[idx].value;
+                }
+                break;
+            } else if (cmp > 0) {
+                /*
+                 * The fields in singletonRequestHeaderFields are
+                 * sorted. Later values can't match.
+                 */
+                break;
             }
-            ns_free(parseString);
-        }
-        Ns_Log(Debug, "x-forwarded-for: accept IP address from '%s' -> %d",
-               (s == NULL ? "(null)" : s), success);
-
-        if (success <= 0) {
-            s = NULL;
         }
     }
-    if (s == NULL) {
-        memset(&sockPtr->clientsa, 0, sizeof(struct NS_SOCKADDR_STORAGE));
-    }
-
-    /*
-     * Set up request length for spooling and further read operations
-     */
-    if (reqPtr->contentLength != 0u) {
-        /*
-         * content-length was provided, use it
-         */
-        reqPtr->length = reqPtr->contentLength;
-    }
-
-    return reqPtr->roff;
+    return NS_OK;
 }
 
 
-/*----------------------------------------------------------------------
+/*
+ *----------------------------------------------------------------------
  *
- * SockParse --
+ * SockSetServer --
  *
- *      Construct the given conn by parsing input buffer until end of
- *      headers.  Return SOCK_READY when finished parsing.
+ *      Set virtual server from driver context or Host header.
  *
  * Results:
- *      SOCK_READY:  Conn is ready for processing.
- *      SOCK_MORE:   More input is required.
- *      SOCK_ERROR:  Malformed request.
- *      SOCK_BADREQUEST
- *      SOCK_BADHEADER
- *      SOCK_TOOMANYHEADERS
+ *      void.
  *
  * Side effects:
- *      An Ns_Request and/or Ns_Set may be allocated.
- *      Ns_Conn buffer management offsets updated.
+ *
+ *      Updates sockPtr->servPtr. In case an invalid server set, or the
+ *      required host field in HTTP/1.1 is missing the HTTP-method is set to
+ *      the constant "BAD".
  *
  *----------------------------------------------------------------------
  */
 
-static SockState
-SockParse(Sock *sockPtr)
+static Ns_ReturnCode
+SockSetServer(Sock *sockPtr)
 {
-    const Tcl_DString  *bufPtr;
-    const Driver       *drvPtr;
-    Request            *reqPtr;
-    char                save;
-    SockState           result;
+    const char      *host = NULL;
+    Request         *reqPtr;
+    Driver          *drvPtr;
+    const ServerMap *mapPtr = NULL;
 
     NS_NONNULL_ASSERT(sockPtr != NULL);
-    drvPtr = sockPtr->drvPtr;
-
-    NsUpdateProgress((Ns_Sock *) sockPtr);
 
     reqPtr = sockPtr->reqPtr;
-    bufPtr = &reqPtr->buffer;
-
-    /*
-     * Scan lines (header) until start of content (body-part)
-     */
-
-    while (reqPtr->coff == 0u) {
-        char *s, *e;
-        size_t cnt;
+    assert(reqPtr != NULL);
 
+    if (reqPtr->request.host != NULL && reqPtr->request.requestType == NS_REQUEST_TYPE_PLAIN) {
         /*
-         * Find the next header line.
+         * This is transitional code, for the case, we have missed something,
+         * when, e.g., a vulnerability checker fires at us with invalid
+         * requests.
          */
-        s = bufPtr->string + reqPtr->roff;
-        e = memchr(s, INTCHAR('\n'), reqPtr->avail);
+        Ns_Log(Notice, "REQPTR: SockSetServer reqPtr %p with host %p of sockPtr %p line '%s'"
+               " (should not happen)",
+               (void*)reqPtr,
+               (void*)reqPtr->request.host,
+               (void*)sockPtr,
+               reqPtr->request.line);
+    }
 
-        if (unlikely(e == NULL)) {
-            /*
-             * Input not yet newline terminated - request more data.
-             */
-            return SOCK_MORE;
-        }
+    drvPtr = sockPtr->drvPtr;
+    assert(drvPtr != NULL);
+
+    sockPtr->servPtr  = drvPtr->servPtr;
+    sockPtr->location = NULL;
 
+    host = sockPtr->extractedHeaderFields[NS_EXTRACTED_HEADER_HOST];
+    if (host == NULL && (reqPtr->request.version >= 1.1)) {
         /*
-         * Check for max single line overflows.
-         *
-         * Previous versions if the driver returned here directly an
-         * error code, which was handled via HTTP error message
-         * provided via SockError(). However, the SockError() handling
-         * closes the connection immediately. This has the
-         * consequence, that the HTTP client might never see the error
-         * message, since the request was not yet fully transmitted,
-         * but it will see a "broken pipe: 13" message instead. We
-         * read now the full request and return the message via
-         * ConnRunRequest().
+         * HTTP/1.1 requires host header
          */
+        Ns_Log(Warning, "request header field \"Host\" is missing in HTTP/1.1 request: \"%s\"\n",
+               reqPtr->request.line);
+        goto bad_request;
+    }
 
-        if (unlikely((e - s) > drvPtr->maxline)) {
-            sockPtr->keep = NS_FALSE;
-            if (reqPtr->request.line == NULL) {
-                Ns_Log(DriverDebug, "SockParse: maxline reached of %d bytes",
-                       drvPtr->maxline);
-                sockPtr->flags = NS_CONN_REQUESTURITOOLONG;
-                Ns_Log(Warning, "request line is too long (%d bytes)", (int)(e - s));
-            } else {
-                sockPtr->flags = NS_CONN_LINETOOLONG;
-                Ns_Log(Warning, "request header line is too long (%d bytes)", (int)(e - s));
-            }
-        }
+    if (host != NULL) {
+        Tcl_DString hostDs;
 
         /*
-         * Update next read pointer to end of this line.
+         * DriverLookupHost() requires a writable string in the form of a
+         * Tcl_DString.
          */
-        cnt = (size_t)(e - s) + 1u;
-        reqPtr->roff  += cnt;
-        reqPtr->avail -= cnt;
+        Tcl_DStringInit(&hostDs);
+        Tcl_DStringAppend(&hostDs, host, TCL_INDEX_NONE);
+        mapPtr = DriverLookupHost(&hostDs, &sockPtr->reqPtr->request, drvPtr);
+        Tcl_DStringFree(&hostDs);
 
-        /*
-         * Adjust end pointer to the last content character before the line
-         * terminator.
-         */
-        if (likely(e > s) && likely(*(e-1) == '\r')) {
-            --e;
-        }
+        Ns_Log(DriverDebug, "SockSetServer: host '%s' request line '%s' servPtr %p",
+               host, reqPtr->request.line, (void*)sockPtr->servPtr);
+    } else {
+        Ns_Log(DriverDebug, "SockSetServer: no host header field available, request line '%s' servPtr %p",
+               reqPtr->request.line, (void*)sockPtr->servPtr);
+    }
 
+    if (mapPtr == NULL && sockPtr->servPtr == NULL) {
         /*
-         * Check for end of headers in case we have not done it yet.
+         * The driver is installed globally, fall back to the default server,
+         * which has to be defined in this case.
          */
-        if (unlikely(e == s) && (reqPtr->coff == 0u)) {
-            /*
-             * We are at end of headers.
-             */
-            if (CheckSingletonHeaderFields(sockPtr) == NS_ERROR) {
-                return SOCK_BADREQUEST;
-            }
-            /*Ns_Log(Notice, "Extracted HOST <%s>",
-              sockPtr->extractedHeaderFields[NS_EXTRACTED_HEADER_HOST]);*/
-
-            reqPtr->coff = EndOfHeader(sockPtr);
-            if (Ns_LogSeverityEnabled(Ns_LogRequestDebug)) {
-                Tcl_DString ds;
-
-                Tcl_DStringInit(&ds);
-                Ns_SetFormat(&ds, reqPtr->headers, NS_TRUE, "  ", ": ");
-                Ns_Log(Ns_LogRequestDebug, "received %s", ds.string);
-                Tcl_DStringFree(&ds);
-            }
-
-            /*
-             * In cases the client sent "expect: 100-continue", report back that
-             * everything is fine with the headers.
-             */
-            if ((sockPtr->flags & NS_CONN_CONTINUE) != 0u) {
-
-                Ns_Log(Ns_LogRequestDebug, "honoring 100-continue");
-
-                /*
-                 * In case, the request entity (body) was too large, we can
-                 * return immediately the error message, when the client has
-                 * flagged this via "Expect:". Otherwise we have to read the
-                 * full request (although it is too large) to drain the
-                 * channel. Otherwise, the server might close the connection
-                 * *before* it has received full request with its body from
-                 * the client. We just keep the flag and let
-                 * Ns_ConnRunRequest() handle the error message.
-                 */
-                if ((sockPtr->flags & NS_CONN_ENTITYTOOLARGE) != 0u) {
-                    Ns_Log(Ns_LogRequestDebug, "100-continue: entity too large");
-
-                    return SOCK_ENTITYTOOLARGE;
-
-                    /*
-                     * We have no other error message flagged (future ones
-                     * have to be handled here).
-                     */
-                } else {
-                    struct iovec iov[1];
-                    ssize_t      sent;
-
-                    /*
-                     * Reply with "100 continue".
-                     */
-                    Ns_Log(Ns_LogRequestDebug, "100-continue: reply CONTINUE");
-                    NsAddNslogEntry(sockPtr, 100, NULL, NULL);
-                    Ns_Log(Notice, "**** 100-continue line <%s>", sockPtr->reqPtr->request.line);
+        mapPtr = drvPtr->defMapPtr;
+        Ns_Log(Debug, "SockSetServer: get default map entry %p", (void*)mapPtr);
+    }
 
-                    iov[0].iov_base = (char *)"HTTP/1.1 100 Continue\r\n\r\n";
-                    iov[0].iov_len = strlen(iov[0].iov_base);
+    if (mapPtr != NULL) {
+        /*
+         * Get server and location from the configured mapping.
+         */
+        if (sockPtr->servPtr == NULL) {
+            sockPtr->servPtr  = mapPtr->servPtr;
+        }
+        sockPtr->location = ns_strncopy(mapPtr->location, mapPtr->locationLength);
+        Ns_Log(Debug, "SockSetServer: get location from mapping '%s'", sockPtr->location);
+    } else {
+        /*
+         * There is no configured mapping.
+         */
+        if (sockPtr->servPtr == NULL) {
+            Ns_Log(Warning, "cannot determine server for request: \"%s\" (host \"%s\")\n",
+                   reqPtr->request.line, host);
+            goto bad_request;
+        }
+        /*
+         * Could not lookup the virtual host, get the default location from
+         * the driver or from local side of the socket connection.
+         */
+        Ns_Log(Debug, "SockSetServer: there is no predefined mapping for server '%s'", host);
 
-                    sent = Ns_SockSendBufs((Ns_Sock *)sockPtr, iov, 1,
-                                           NULL, 0u);
-                    if (sent != (ssize_t)iov[0].iov_len) {
-                        Ns_Log(Warning, "could not deliver response: 100 Continue");
-                        /*
-                         * Should we bail out here?
-                         */
-                    }
-                }
-            }
+        if (drvPtr->location != NULL) {
+            sockPtr->location = ns_strncopy(drvPtr->location, drvPtr->locationLength);
+            Ns_Log(Debug, "SockSetServer: there is no virtual host mapping for host '%s',"
+                   "fall back to configured location '%s'",
+                   host, drvPtr->location);
         } else {
-            /*
-             * We have the request-line or a header line to process.
-             */
-            save = *e;
-            *e = '\0';
+            Tcl_DString    locationDs;
+            const char    *hostName = NULL;
+            unsigned short hostPort = 0;
 
-            if (unlikely(reqPtr->request.line == NULL)) {
-                /*
-                 * There is no request-line set. The received line must the
-                 * the request-line.
-                 */
-                Ns_Log(DriverDebug, "SockParse (%d): parse request line <%s>", sockPtr->sock, s);
+            Tcl_DStringInit(&locationDs);
 
-                if (Ns_ParseRequest(&reqPtr->request, s, (size_t)(e-s)) == NS_ERROR) {
+            if (reqPtr != NULL) {
+                hostName = reqPtr->request.host;
+                hostPort = reqPtr->request.port;
+            }
+            Ns_HttpLocationString(&locationDs,
+                                  drvPtr->protocol,
+                                  hostName != NULL ? hostName : Ns_SockGetAddr((Ns_Sock *)sockPtr),
+                                  hostPort != 0 ? hostPort : Ns_SockGetPort((Ns_Sock *)sockPtr),
+                                  drvPtr->defport);
+            sockPtr->location = ns_strncopy(locationDs.string, locationDs.length);
+            if (hostName != NULL && sockPtr->servPtr != NULL) {
+                Ns_Log(Notice, "SockSetServer: serving request to server '%s'"
+                       " with untrusted location '%s'",
+                       sockPtr->servPtr->server, sockPtr->location);
+                if (drvPtr->server != NULL) {
                     /*
-                     * Invalid request.
+                     * Per-server network driver
                      */
-                    return SOCK_BADREQUEST;
-                }
-
-                /*
-                 * HTTP 0.9 did not have an HTTP-version number or request headers
-                 * and no empty line terminating the request header.
-                 */
-                if (unlikely(reqPtr->request.version < 1.0)) {
+                    Ns_Log(Notice, "... consider loading driver %s globally in section"
+                           "'ns/modules' and add 'ns_param %s %s' to section 'ns/module/%s/servers'",
+                           drvPtr->moduleName, drvPtr->server, hostName, /*hostPort,*/ drvPtr->moduleName);
+                } else {
                     /*
-                     * Pre-HTTP/1.0 request.
+                     * Global network driver
                      */
-                    reqPtr->coff = reqPtr->roff;
-                    Ns_Log(Notice, "pre-HTTP/1.0 request <%s>", reqPtr->request.line);
-                }
-
-            } else if (Ns_ParseHeader(reqPtr->headers, s, NULL, Preserve, NULL) != NS_OK) {
-                /*
-                 * Invalid header.
-                 */
-                return SOCK_BADHEADER;
-
-            } else {
-                /*
-                 * Check for max number of headers
-                 */
-
-                if (unlikely(Ns_SetSize(reqPtr->headers) > (size_t)drvPtr->maxheaders)) {
-                    Ns_Log(DriverDebug, "SockParse (%d): maxheaders reached of %d bytes",
-                           sockPtr->sock, drvPtr->maxheaders);
-                    return SOCK_TOOMANYHEADERS;
+                    Ns_Log(Notice, "... consider adding 'ns_param %s %s' to section 'ns/module/%s/servers'",
+                           sockPtr->servPtr->server, hostName, /*hostPort,*/ drvPtr->moduleName);
                 }
             }
-
-            *e = save;
         }
-    }
 
-    if (unlikely(reqPtr->request.line == NULL)) {
-        /*
-         * We are at end of headers, but we have not parsed a request line
-         * (maybe just two linefeeds).
-         */
-        return SOCK_BADREQUEST;
+        Ns_Log(DriverDebug, "SockSetServer: get location from driver '%s'", sockPtr->location);
     }
 
-
     /*
-     * We are in the request body.
+     * Since the URLencoding can be set per server, we need the server
+     * assignment to check the validity of the request URL.
+     *
+     * In some error conditions (e.g. from nssmtpd) the reqPtr->request.*
+     * members might be NULL.
      */
-    assert(reqPtr->coff > 0u);
-    assert(reqPtr->request.line != NULL);
+    if (likely(sockPtr->servPtr != NULL)
+        && NsEncodingIsUtf8(sockPtr->servPtr->encoding.urlEncoding)
+        && reqPtr->request.url != NULL
+        ) {
+        if (!Ns_Valid_UTF8((const unsigned char *)reqPtr->request.url,
+                           strlen(reqPtr->request.url), NULL)) {
+            Ns_Log(Warning, "Invalid UTF-8 encoding in url '%s'",
+                   reqPtr->request.url);
+            goto bad_request;
+        }
+    }
+
+    Ns_Log(DriverDebug, "SockSetServer host '%s' request line '%s' final location '%s'",
+           host, reqPtr->request.line, sockPtr->location);
+    return NS_OK;
+
+ bad_request:
+    Ns_Log(DriverDebug, "SockSetServer sets method to BAD");
+    ns_free((char *)reqPtr->request.method);
+    reqPtr->request.method = ns_strdup("BAD");
+    return NS_ERROR;
+}
+
+/*
+ *======================================================================
+ *  Spooler Thread: Receive asynchronously from the client socket
+ *======================================================================
+ */
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * SpoolerThread --
+ *
+ *      Spooling socket driver thread.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Connections are accepted on the configured listen sockets,
+ *      placed on the run queue to be serviced, and gracefully
+ *      closed when done.  Async sockets have the entire request read
+ *      here before queuing as well.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+SpoolerThread(void *arg)
+{
+    SpoolerQueue  *queuePtr = (SpoolerQueue*)arg;
+    char           charBuffer[1];
+    int            pollTimeout;
+    bool           stopping = NS_FALSE;
+    Sock          *sockPtr, *nextPtr, *waitPtr = NULL, *readPtr = NULL;
+    Ns_Time        now, diff;
+    const Driver  *drvPtr;
+    PollData       pdata;
+
+    Ns_ThreadSetName("-spooler%d-", queuePtr->id);
+    queuePtr->threadName = Ns_ThreadGetName();
 
     /*
-     * Check if all content has arrived.
+     * Loop forever until signaled to shut down and all
+     * connections are complete and gracefully closed.
      */
-    Ns_Log(DriverDebug, "=== length < avail (length %" PRIuz
-           ", avail %" PRIuz ") tfd %d tfile %p chunkStartOff %" PRIuz,
-           reqPtr->length, reqPtr->avail, sockPtr->tfd,
-           (void *)sockPtr->tfile, reqPtr->chunkStartOff);
-
-    if (reqPtr->chunkStartOff != 0u) {
-        /*
-         * Chunked encoding was provided.
-         */
-        SockState chunkState;
-        size_t    currentContentLength;
 
-        chunkState = ChunkedDecode(reqPtr, NS_TRUE);
-        currentContentLength = reqPtr->chunkWriteOff - reqPtr->coff;
+    Ns_Log(Notice, "spooler%d: accepting connections", queuePtr->id);
 
-        /*
-         * A chunk might be complete, but it might not be the last
-         * chunk from the client. The best thing would be to be able
-         * to read until EOF here. In cases, where the (optional)
-         * "expectedLength" was provided by the client, we terminate
-         * depending on that information
-         */
-        if ((chunkState == SOCK_MORE)
-            || (reqPtr->expectedLength != 0u && currentContentLength < reqPtr->expectedLength)) {
-            /*
-             * ChunkedDecode wants more data.
-             */
-            return SOCK_MORE;
+    PollCreate(&pdata, queuePtr->pollBackend);
+    Ns_GetTime(&now);
 
-        } else if (chunkState != SOCK_READY) {
-            return chunkState;
-        }
-        /*
-         * ChunkedDecode has enough data.
-         */
-        reqPtr->length = (size_t)currentContentLength;
-    }
+    while (!stopping) {
 
-    if (reqPtr->avail < reqPtr->length) {
-        Ns_Log(DriverDebug, "SockRead wait for more input");
         /*
-         * Wait for more input.
+         * If there are any read sockets, set the bits
+         * and determine the minimum relative timeout.
          */
-        return SOCK_MORE;
-    }
 
-    Ns_Log(Dev, "=== all required data is available (avail %" PRIuz", length %" PRIuz ", "
-           "readahead %" TCL_LL_MODIFIER "d maxupload %" TCL_LL_MODIFIER "d) tfd %d",
-           reqPtr->avail, reqPtr->length, drvPtr->readahead, drvPtr->maxupload,
-           sockPtr->tfd);
+        PollReset(&pdata);
+        (void)PollSet(&pdata, queuePtr->pipe[0], (short)POLLIN, NULL);
 
-    /*
-     * We have all required data in the receive buffer or in a temporary file.
-     *
-     * - Uploads > "readahead": these are put into temporary files.
-     *
-     * - Uploads > "maxupload": these are put into temporary files
-     *   without mmapping, no content parsing will be performed in memory.
-     */
-    result = SOCK_READY;
+        if (readPtr == NULL) {
+            pollTimeout = 30 * 1000;
+        } else {
+            sockPtr = readPtr;
+            while (sockPtr != NULL) {
+                SockPoll(sockPtr, (short)POLLIN, &pdata);
+                sockPtr = sockPtr->nextPtr;
+            }
+            pollTimeout = -1;
+        }
 
-    if (sockPtr->tfile != NULL) {
-        reqPtr->content = NULL;
-        reqPtr->next = NULL;
-        reqPtr->avail = 0u;
-        Ns_Log(DriverDebug, "content spooled to file: size %" PRIdz ", file %s",
-               reqPtr->length, sockPtr->tfile);
         /*
-         * Nothing more to do, return via SOCK_READY;
+         * Select and drain the trigger pipe if necessary.
          */
-    } else {
 
-        /*
-         * Uploads < "maxupload" are spooled to files and mmapped in order to
-         * provide the usual interface via [ns_conn content].
-         */
-        if (sockPtr->tfd > 0) {
-#ifdef _WIN32
-            /*
-             * For _WIN32, tfd should never be set, since tfd-spooling is not
-             * implemented for windows.
-             */
-            assert(0);
-#else
-            int prot = PROT_READ | PROT_WRITE;
-            /*
-             * Add a byte to make sure, the string termination with \0 below falls
-             * always into the mmapped area. On some older OSes this might lead to
-             * crashes when we hitting page boundaries.
-             */
-            ssize_t rc = ns_write(sockPtr->tfd, "\0", 1);
-            if (rc == -1) {
-                Ns_Log(Error, "socket: could not append terminating 0-byte");
-            }
-            sockPtr->tsize = reqPtr->length + 1;
-            sockPtr->taddr = mmap(0, sockPtr->tsize, prot, MAP_PRIVATE,
-                                  sockPtr->tfd, 0);
-            if (sockPtr->taddr == MAP_FAILED) {
-                sockPtr->taddr = NULL;
-                result = SOCK_ERROR;
+        /*n =*/ (void) PollWait(&pdata, pollTimeout);
 
-            } else {
-                reqPtr->content = sockPtr->taddr;
-                Ns_Log(Debug, "content spooled to mmapped file: readahead=%"
-                       TCL_LL_MODIFIER "d, filesize=%" PRIdz,
-                       drvPtr->readahead, sockPtr->tsize);
-            }
-#endif
-        } else {
-            /*
-             * Set the content the begin of the remaining buffer (content offset).
-             * This happens as well when reqPtr->contentLength is 0, but it is
-             * needed for chunked input processing.
-             */
-            reqPtr->content = bufPtr->string + reqPtr->coff;
-            Ns_Log(DriverDebug, "driver sets  reqPtr->content (len %zu) to '%s'", reqPtr->contentLength, reqPtr->content);
+        if (PollIn(&pdata, 0) && unlikely(ns_recv(queuePtr->pipe[0], charBuffer, 1u, 0) != 1)) {
+            Ns_Fatal("spooler: trigger ns_recv() failed: %s",
+                     ns_sockstrerror(ns_sockerrno));
         }
-        reqPtr->next = reqPtr->content;
 
         /*
-         * Add a terminating NUL character. The content might be from the receive
-         * buffer (Tcl_DString) or from the mmapped file. Non-mmapped files are handled
-         * above.
+         * Attempt read-ahead of any new connections.
          */
-        if (reqPtr->length > 0u) {
-            Ns_Log(DriverDebug, "SockRead adds null terminating character at content[%" PRIuz "]", reqPtr->length);
 
-            reqPtr->savedChar = reqPtr->content[reqPtr->length];
-            reqPtr->content[reqPtr->length] = '\0';
-            if (sockPtr->taddr == NULL) {
-                LogBuffer(DriverDebug, "UPDATED BUFFER", sockPtr->reqPtr->buffer.string, (size_t)reqPtr->buffer.length);
-            }
-        }
-    }
+        Ns_GetTime(&now);
+        sockPtr = readPtr;
+        readPtr = NULL;
 
-    return result;
-}
+        while (sockPtr != NULL) {
+            short revents = PollSockEvents(&pdata, sockPtr);
 
+            nextPtr = sockPtr->nextPtr;
+            drvPtr  = sockPtr->drvPtr;
+            if (unlikely((revents & POLLHUP) == POLLHUP)) {
+                /*
+                 * Peer has closed the connection
+                 */
+                PollSockRemove(&pdata, sockPtr);
+                SockRelease(sockPtr, SOCK_CLOSE, 0);
 
-static bool
-NormalizeHostEntry(Tcl_DString *hostDs, Driver *drvPtr, Ns_Request *requestPtr)
-{
-    char *hostStart, *portStart, *end;
-    bool  success = NS_TRUE;
+            } else if ((revents & POLLIN) != POLLIN) {
+                /*
+                 * Got no data
+                 */
+                if (Ns_DiffTime(&sockPtr->timeout, &now, &diff) <= 0) {
+                    PollSockRemove(&pdata, sockPtr);
+                    SockRelease(sockPtr, SOCK_READTIMEOUT, 0);
+                    queuePtr->queuesize--;
+                } else {
+                    Push(sockPtr, readPtr);
+                }
+            } else {
+                /*
+                 * Got some data
+                 */
+                SockState n = SockRead(sockPtr, 1, &now);
 
-    NS_NONNULL_ASSERT(hostDs != NULL);
-    NS_NONNULL_ASSERT(drvPtr != NULL);
+                if (n != SOCK_MORE) {
+                    PollSockRemove(&pdata, sockPtr);
+                }
+                switch (n) {
+                case SOCK_MORE:
+                    SockTimeout(sockPtr, &now, &drvPtr->recvwait);
+                    Push(sockPtr, readPtr);
+                    break;
 
-    Ns_Log(Debug, "NormalizeHostEntry <%s> reqPtr %p", hostDs->string, (void*)requestPtr);
+                case SOCK_READY:
+                    assert(sockPtr->reqPtr != NULL);
+                    Ns_Log(DriverDebug, "spooler thread done with request");
+                    if (likely(SockSetServer(sockPtr) == NS_OK)) {
+                        Push(sockPtr, waitPtr);
+                    } else {
+                        SockRelease(sockPtr, SOCK_BADHEADER, 0);
+                        queuePtr->queuesize--;
+                    }
+                    break;
 
-    if (!Ns_HttpParseHost2(hostDs->string, NS_FALSE, &hostStart, &portStart, &end)) {
-        Ns_Log(Warning, "Cannot parse provided host header field <%s>", hostDs->string);
-        success = NS_FALSE;
-    } else {
-        bool   ipLiteral, stripDot = NS_FALSE;
-        size_t hostlen;
+                case SOCK_BADHEADER:      NS_FALL_THROUGH; /* fall through */
+                case SOCK_BADREQUEST:     NS_FALL_THROUGH; /* fall through */
+                case SOCK_CLOSE:          NS_FALL_THROUGH; /* fall through */
+                case SOCK_CLOSETIMEOUT:   NS_FALL_THROUGH; /* fall through */
+                case SOCK_ENTITYTOOLARGE: NS_FALL_THROUGH; /* fall through */
+                case SOCK_ERROR:          NS_FALL_THROUGH; /* fall through */
+                case SOCK_READERROR:      NS_FALL_THROUGH; /* fall through */
+                case SOCK_READTIMEOUT:    NS_FALL_THROUGH; /* fall through */
+                case SOCK_SHUTERROR:      NS_FALL_THROUGH; /* fall through */
+                case SOCK_SPOOL:          NS_FALL_THROUGH; /* fall through */
+                case SOCK_TOOMANYHEADERS: NS_FALL_THROUGH; /* fall through */
+                case SOCK_WRITEERROR:     NS_FALL_THROUGH; /* fall through */
+                case SOCK_QUEUEFULL:      NS_FALL_THROUGH; /* fall through */
+                case SOCK_WRITETIMEOUT:
+                    SockRelease(sockPtr, n, errno);
+                    queuePtr->queuesize--;
+                    break;
+                }
+            }
+            sockPtr = nextPtr;
+        }
 
         /*
-         * Remove trailing dot of host header field, since RFC 2976 allows fully
-         * qualified "absolute" DNS names in host fields (see e.g. §3.2.2).
-         *
+         * Attempt to queue any pending connection
+         * after reversing the list to ensure oldest
+         * connections are tried first.
          */
-        hostlen = strlen(hostStart);
 
-        if (hostStart[hostlen-1] == '.') {
-            hostStart[hostlen-1] = 0;
-            stripDot = NS_TRUE;
+        if (waitPtr != NULL) {
+            sockPtr = NULL;
+            while ((nextPtr = waitPtr) != NULL) {
+                waitPtr = nextPtr->nextPtr;
+                Push(nextPtr, sockPtr);
+            }
+            while (sockPtr != NULL) {
+                Ns_ReturnCode status;
+
+                nextPtr = sockPtr->nextPtr;
+                status = NsQueueConn(sockPtr, &now);
+                if (status == NS_TIMEOUT) {
+                    Push(sockPtr, waitPtr);
+                } else {
+                    if (status == NS_ERROR) {
+                        SockRelease(sockPtr, SOCK_QUEUEFULL, 0);
+                    }
+                    queuePtr->queuesize--;
+                }
+                sockPtr = nextPtr;
+            }
         }
 
         /*
-         * For proxy and CONNECT requests, we have host and port already set. Leave
-         * host and port as it is.
+         * Add more connections from the spooler queue
          */
-        if (requestPtr != NULL && requestPtr->requestType == NS_REQUEST_TYPE_PLAIN) {
 
-            //assert(requestPtr->host == NULL);
-            if (requestPtr->host != NULL) {
-                Ns_Log(Warning, "NormalizeHostEntry called with host already set to '%s'"
-                       " in a plain request (new host header '%s')", requestPtr->host, hostDs->string);
-                ns_free((char *)requestPtr->host);
+        Ns_MutexLock(&queuePtr->lock);
+        if (waitPtr == NULL) {
+            sockPtr = (Sock*)queuePtr->sockPtr;
+            queuePtr->sockPtr = NULL;
+            while (sockPtr != NULL) {
+                nextPtr = sockPtr->nextPtr;
+                drvPtr  = sockPtr->drvPtr;
+                SockTimeout(sockPtr, &now, &drvPtr->recvwait);
+                Push(sockPtr, readPtr);
+                queuePtr->queuesize++;
+                sockPtr = nextPtr;
             }
-
-            requestPtr->host = ns_strdup(hostStart);
-            requestPtr->port = (portStart != NULL
-                                ? (unsigned short)strtol(portStart, NULL, 10)
-                                : drvPtr->port);
         }
 
         /*
-         * In IP-literal notation, we have to care about surrounding square
-         * braces.
+         * Check for shutdown
          */
-        ipLiteral = (hostStart != hostDs->string);
 
-        if (portStart == NULL) {
+        stopping = queuePtr->shutdown;
+        Ns_MutexUnlock(&queuePtr->lock);
+    }
+    PollFree(&pdata);
+
+    Ns_Log(Notice, "exiting");
+
+    Ns_MutexLock(&queuePtr->lock);
+    queuePtr->stopped = NS_TRUE;
+    Ns_CondBroadcast(&queuePtr->cond);
+    Ns_MutexUnlock(&queuePtr->lock);
+}
+
+static void
+SpoolerQueueStart(SpoolerQueue *queuePtr, Ns_ThreadProc *proc)
+{
+    NS_NONNULL_ASSERT(proc != NULL);
+
+    while (queuePtr != NULL) {
+        if (ns_sockpair(queuePtr->pipe) != 0) {
+            Ns_Fatal("ns_sockpair() failed: %s", ns_sockstrerror(ns_sockerrno));
+        }
+        Ns_ThreadCreate(proc, queuePtr, 0, &queuePtr->thread);
+        queuePtr = queuePtr->nextPtr;
+    }
+}
+
+static void
+SpoolerQueueStop(SpoolerQueue *queuePtr, const Ns_Time *timeoutPtr, const char *name)
+{
+
+    NS_NONNULL_ASSERT(timeoutPtr != NULL);
+    NS_NONNULL_ASSERT(name != NULL);
+
+    while (queuePtr != NULL) {
+        Ns_ReturnCode status;
+
+        Ns_MutexLock(&queuePtr->lock);
+        if (!queuePtr->stopped && !queuePtr->shutdown) {
+            Ns_Log(Debug, "%s%d: triggering shutdown pipe %d", name, queuePtr->id, queuePtr->pipe[1]);
+            queuePtr->shutdown = NS_TRUE;
             /*
-             * No port provided
-             */
-            if (ipLiteral) {
-                /*
-                 * Undo NUL chars from Ns_HttpParseHost2, do not check for last
-                 * character.
-                 */
-                hostDs->string[hostDs->length - 1] = ']';
+             * In case queuePtr->pipe was not properly set up, the value of
+             * pipe[1] will be zero. In such cases, not try to send data to
+             * this pipe.
+             */
+            if (queuePtr->pipe[1] != 0) {
+                Ns_Log(Debug, "%s%d: triggering shutdown Trigger pipe %d", name, queuePtr->id, queuePtr->pipe[1]);
+                SockTrigger(queuePtr->pipe[1]);
             } else {
-                /*
-                 * Dropped dot at end of hostname.
-                 */
-                if (stripDot) {
-                    Tcl_DStringSetLength(hostDs, hostDs->length - 1);
-                }
+                queuePtr->stopped = NS_TRUE;
             }
-            Ns_DStringPrintf(hostDs, ":%hu", drvPtr->port);
+        }
+        status = NS_OK;
+        while (!queuePtr->stopped && status == NS_OK) {
+            status = Ns_CondTimedWait(&queuePtr->cond, &queuePtr->lock, timeoutPtr);
+        }
+        if (status != NS_OK) {
+            Ns_Log(Warning, "%s%d: timeout waiting for shutdown", name, queuePtr->id);
         } else {
-            /*
-             * Port provided.
-             */
-            *(portStart-1) = ':';
-            if (ipLiteral) {
-                /*
-                 * Undo NUL chars from Ns_HttpParseHost2, do not check for last
-                 * character.
-                 */
-                *(portStart -2) = ']';
+            /*Ns_Log(Notice, "%s%d: shutdown complete", name, queuePtr->id);*/
+            if (queuePtr->thread != NULL) {
+                Ns_ThreadJoin(&queuePtr->thread, NULL);
+                queuePtr->thread = NULL;
             } else {
-                if (stripDot) {
-                    /*
-                     * Dropped dot at end of hostname.
-                     */
-                    memmove(portStart-2, portStart-1,
-                            (size_t)(hostDs->length + 1 - (portStart - hostDs->string)));
-                    Tcl_DStringSetLength(hostDs, hostDs->length - 1);
-                }
+                Ns_Log(Notice, "%s%d: shutdown: thread already gone", name, queuePtr->id);
             }
+            ns_sockclose(queuePtr->pipe[0]);
+            ns_sockclose(queuePtr->pipe[1]);
         }
+        Ns_MutexUnlock(&queuePtr->lock);
+        queuePtr = queuePtr->nextPtr;
     }
-
-    return success;
 }
 
 /*
  *----------------------------------------------------------------------
  *
- * DriverLookupHost --
+ * SockSpoolerQueue --
  *
- *      Lookup the specified hostname in the virtual hosts mapping table.
+ *    Adds the specified socket to the spooler queue using a round-robin
+ *    scheduling strategy across available spooler threads. This function
+ *    locks the global spooler structure to select the next spooler thread,
+ *    appends the socket to that thread's queue, and logs the operation.
+ *    If the target spooler queue was previously empty, the function triggers
+ *    the spooler thread to wake up and process the queued socket.
  *
- * Results:
- *      ServerMap entry or NULL.
+ * Parameters:
+ *    drvPtr  - Pointer to the Driver structure that holds the spooler thread list.
+ *    sockPtr - Pointer to the Sock structure representing the socket to be queued.
  *
- * Side effects:
+ * Results:
+ *    None.
  *
- *      None.
+ * Side Effects:
+ *    - Updates the current spooler pointer in the Driver structure.
+ *    - Modifies the spooler thread's queue by adding a new socket.
+ *    - May trigger a spooler thread via SockTrigger() if the queue was empty.
  *
  *----------------------------------------------------------------------
  */
-static const ServerMap *
-DriverLookupHost(Tcl_DString *hostDs, Ns_Request *requestPtr, Driver *drvPtr)
+static void
+SockSpoolerQueue(Driver *drvPtr, Sock *sockPtr)
 {
-    const ServerMap     *result = NULL;
-    const Tcl_HashEntry *hPtr;
+    bool          trigger = NS_FALSE;
+    SpoolerQueue *queuePtr;
 
-    NS_NONNULL_ASSERT(hostDs != NULL);
     NS_NONNULL_ASSERT(drvPtr != NULL);
-
-    Ns_Log(Debug, "driver lookup parse <%s>", hostDs->string);
-
-    if (!NormalizeHostEntry(hostDs, drvPtr, requestPtr)) {
-        Ns_Log(Warning, "Cannot parse provided host header field <%s>", hostDs->string);
-        return NULL;
-    }
-
+    NS_NONNULL_ASSERT(sockPtr != NULL);
     /*
-     * Convert the normalized host header field to lowercase before hash
-     * lookup.
+     * Get the next spooler thread from the list; spooler requests are
+     * distributed round-robin among all available spooler threads.
      */
-    Ns_StrToLower(hostDs->string);
-    Ns_Log(Debug, "host table lookup <%s>", hostDs->string);
 
-    hPtr = Tcl_FindHashEntry(&drvPtr->hosts, hostDs->string);
-    Ns_Log(Debug, "DriverLookupHost module '%s' host '%s' => %p",
-           drvPtr->moduleName, hostDs->string, (void*)hPtr);
+    Ns_MutexLock(&drvPtr->spooler.lock);
+    if (drvPtr->spooler.curPtr == NULL) {
+        drvPtr->spooler.curPtr = drvPtr->spooler.firstPtr;
+    }
+    queuePtr = drvPtr->spooler.curPtr;
+    drvPtr->spooler.curPtr = drvPtr->spooler.curPtr->nextPtr;
+    Ns_MutexUnlock(&drvPtr->spooler.lock);
 
-    if (hPtr != NULL) {
-        /*
-         * Request with provided host header field could be resolved against a
-         * certain server.
-         */
-        result = Tcl_GetHashValue(hPtr);
+    Ns_Log(Debug, "Spooler: %d: started fd=%d: %" PRIdz " bytes",
+           queuePtr->id, sockPtr->sock, sockPtr->reqPtr->length);
 
-    } else {
-        /*
-         * Host header field content is not found in the mapping table.
-         */
-        Ns_Log(Debug,
-               "cannot lookup host header content '%s' in virtual hosts "
-               "table of driver '%s', fall back to default "
-               "(default mapping or driver data)",
-               hostDs->string, drvPtr->moduleName);
+    Ns_MutexLock(&queuePtr->lock);
+    if (queuePtr->sockPtr == NULL) {
+        trigger = NS_TRUE;
+    }
+    Push(sockPtr, queuePtr->sockPtr);
+    Ns_MutexUnlock(&queuePtr->lock);
 
-        if (Ns_LogSeverityEnabled(Debug)) {
-            Tcl_HashEntry  *hPtr2;
-            Tcl_HashSearch  search;
+    /*
+     * Wake up spooler thread if the queue was empty.
+     */
 
-            hPtr2 = Tcl_FirstHashEntry(&drvPtr->hosts, &search);
-            while (hPtr2 != NULL) {
-                Ns_Log(Notice, "... host entry: '%s'",
-                       (char *)Tcl_GetHashKey(&drvPtr->hosts, hPtr2));
-                hPtr2 = Tcl_NextHashEntry(&search);
-            }
-        }
+    if (trigger) {
+        SockTrigger(queuePtr->pipe[1]);
     }
-    return result;
 }
 
+/*
+ *======================================================================
+ *  Writer Thread: Write asynchronously to the client socket
+ *======================================================================
+ */
+
 /*
  *----------------------------------------------------------------------
  *
- * NsDriverLookupHostCtx --
+ * NsWriterLock, NsWriterUnlock --
  *
- *      Lookup the NS_TLS_SSL_CTX matching to hostName. This function is only
- *      called in https drivers, where SNI can be used.
+ *       Provide an API for locking and unlocking context information
+ *       for streaming asynchronous writer jobs.  The locks are just
+ *       needed for managing linkage between "connPtr" and a writer
+ *       entry. The lock operations are rather infrequent and the
+ *       lock duration is very short, such that at a single global
+ *       appears sufficient.
  *
  * Results:
- *      NS_TLS_SSL_CTX entry or NULL.
+ *      None
  *
  * Side effects:
- *
- *      None.
+ *      Change Mutex state.
  *
  *----------------------------------------------------------------------
  */
+void NsWriterLock(void) {
+    Ns_MutexLock(&writerlock);
+}
 
-NS_TLS_SSL_CTX *
-NsDriverLookupHostCtx(Tcl_DString *hostDs, const char *hostName, const Ns_Driver *drvPtr)
-{
-    const ServerMap *mapPtr;
-    Driver *driver = (Driver *)drvPtr;
-
-    NS_NONNULL_ASSERT(hostDs != NULL);
-    NS_NONNULL_ASSERT(drvPtr != NULL);
-
-    mapPtr = DriverLookupHost(hostDs, NULL, driver);
-
-    if (mapPtr == NULL && hostName != NULL) {
-        const char *vhostcertificates, *section = driver->path;
-
-        /*
-         * Try to get from the driver the value of the configuration variable
-         * "vhostcertificates".
-         */
-        vhostcertificates = Ns_ConfigGetValue(section, "vhostcertificates");
-        Ns_Log(Debug, "SSL_serverNameCB %s/vhostcertificates -> '%s'", section, vhostcertificates);
-
-        if (vhostcertificates != NULL) {
-            Tcl_DString dsFileName, *dsPtr = &dsFileName;
-            NsServer   *servPtr = driver->servPtr;
-            struct stat st;
-
-            if (servPtr == NULL && driver->defMapPtr != NULL) {
-                servPtr = driver->defMapPtr->servPtr;
-            }
-            Tcl_DStringInit(dsPtr);
-            Tcl_DStringAppend(dsPtr, vhostcertificates, TCL_INDEX_NONE);
-            Tcl_DStringAppend(dsPtr, "/", 1);
-            Tcl_DStringAppend(dsPtr, hostName, TCL_INDEX_NONE);
-            Tcl_DStringAppend(dsPtr, ".pem", 4);
-
-            if (stat(dsPtr->string, &st) != 0) {
-                Ns_Log(Notice, "SSL_serverNameCB pem file does not exist: '%s'", dsPtr->string);
-            } else if (servPtr == NULL) {
-                Ns_Log(Notice, "SSL_serverNameCB driver %s has no configured defaultserver,"
-                       " ignoring vhostcertificates", section);
-            } else {
-                NS_TLS_SSL_CTX *ctx = NULL;
-                int             result;
-
-                Ns_Log(Debug, "SSL_serverNameCB pem file exists: '%s'", dsPtr->string);
-
-                result = Ns_TLS_CtxServerCreate(NULL, dsPtr->string,
-                                                NULL /*caFile*/, NULL /*caPath*/,
-                                                Ns_ConfigBool(section, "verify", 0),
-                                                Ns_ConfigGetValue(section, "ciphers"),
-                                                Ns_ConfigGetValue(section, "ciphersuites"),
-                                                Ns_ConfigGetValue(section, "protocols"),
-                                                &ctx);
-                Ns_Log(Debug, "SSL_serverNameCB load cert -> ctx %p'", (void*)ctx);
-
-                if (result == TCL_OK) {
-                    Tcl_DString dsHostPort, *dsHostPortPtr = &dsHostPort;
-
-                    Ns_Log(Notice, "SSL_serverNameCB pem file loaded: '%s'", dsPtr->string);
-                    /*
-                     * We need here just the TLS_Ctx, and not the full server
-                     * init as in nsssl as provided by Ns_TLS_CtxServerInit(),
-                     * with "app_data" as (NsSSLConfig *drvCfgPtr;) ?
-                     */
-                    assert(ctx != NULL);
-
-                    Tcl_DStringInit(dsHostPortPtr);
-                    (void) Ns_DStringPrintf(dsHostPortPtr, "%s:%hu", hostName, driver->port);
-
-                    Tcl_DStringSetLength(dsPtr, 0);
-                    /*
-                     * Register this name to be used with the configure or
-                     * default server. Since this happens in a driver thread,
-                     * no lock is required, even when with multiple driver
-                     * threads, since these have different driver structures.
-                     */
-                    mapPtr = ServerMapEntryAdd(dsPtr, dsHostPortPtr->string,
-                                               servPtr,
-                                               driver, ctx, NS_FALSE);
-
-                    Tcl_DStringFree(dsHostPortPtr);
-                }
-            }
-            Tcl_DStringFree(dsPtr);
-        }
-    }
-
-    return (mapPtr != NULL) ? mapPtr->ctx : NULL;
+void NsWriterUnlock(void) {
+    Ns_MutexUnlock(&writerlock);
 }
 
 /*
  *----------------------------------------------------------------------
  *
- * CheckSingletonHeaderFields --
- *
- *      Check if the singleton request header fields are provided only once.
- *      Certain header field values, which are often used are extracted into
- *      "extractedHeaderFields".
+ * WriterSockFileVecCleanup --
  *
- *      Note that these strings are only guaranteed to be correct as long the
- *      underlying Ns_Set is not changed. This typically the case just in the
- *      driver.
+ *      Cleanup function for FileVec array in WriterSock structure.
  *
  * Results:
- *      NS_OK or NS_ERROR when duplicates are found,
+ *      None.
  *
  * Side effects:
- *
- *      sockPtr->extractedHeaderFields is updated.
+ *      Closing potentially file descriptors, freeing Ns_FileVec memory.
  *
  *----------------------------------------------------------------------
  */
-static Ns_ReturnCode
-CheckSingletonHeaderFields(Sock *sockPtr)
-{
-    size_t        i, idx;
-    Ns_Set       *headers = sockPtr->reqPtr->headers;
-    int           counts[Ns_NrElements(singletonRequestHeaderFields)] = {0};
-    const char **singletonFields = sockPtr->extractedHeaderFields;
+static void
+WriterSockFileVecCleanup(const WriterSock *wrSockPtr) {
 
-    memset(sockPtr->extractedHeaderFields, 0, sizeof(sockPtr->extractedHeaderFields));
-    /*
-     * Iterate just once over the host header fields. This is more efficient,
-     * than for calling for all of these fields Ns_Set*Get functions, since
-     * these iterate as well over the header fields.
-     */
-    for (idx = 0u; idx < headers->size; idx++) {
-        const char *name       = headers->fields[idx].name;
-        char        first_char = (CHARTYPE(lower, *name) != 0) ? *name : CHARCONV(lower, *name);
+    NS_NONNULL_ASSERT(wrSockPtr != NULL);
 
-        for (i = 0; i < Ns_NrElements(singletonRequestHeaderFields); i++) {
-            const char *singletonName = singletonRequestHeaderFields[i].name;
-            int         cmp;
+    if ( wrSockPtr->c.file.nbufs > 0) {
+        TCL_SIZE_T i;
+
+        Ns_Log(DriverDebug, "WriterSockRelease nbufs %" PRITcl_Size,
+               wrSockPtr->c.file.nbufs);
 
+        for (i = 0; i < wrSockPtr->c.file.nbufs; i++) {
             /*
-             * Call strcasecmp() only, when the first char is equal.
+             * The fd of c.file.currentbuf is always the same as
+             * wrSockPtr->fd and therefore already closed at this point.
              */
-            if (first_char != *singletonName) {
-                continue;
-            }
-            cmp = strcasecmp(singletonName, name);
-            //Ns_Log(Notice, "cmd %s vs %s -> %d",name, singletonName, cmp);
-
-            if (cmp == 0) {
-                if (++counts[i] > 1) {
-                    Ns_Log(Warning, "request header field \"%s\" is provided more than once. Request: \"%s\"\n",
-                           singletonName, sockPtr->reqPtr->request.line);
-                    return NS_ERROR;
+            if ( (i != wrSockPtr->c.file.currentbuf)
+                 && (wrSockPtr->c.file.bufs[i].fd != NS_INVALID_FD) ) {
 
-                }
-                if (singletonRequestHeaderFields[i].extract != NS_EXTRACTED_NONE) {
-                    singletonFields[singletonRequestHeaderFields[i].extract] = headers->fields[idx].value;
-                }
-                break;
-            } else if (cmp > 0) {
-                /*
-                 * The fields in singletonRequestHeaderFields are
-                 * sorted. Later values can't match.
-                 */
-                break;
+                Ns_Log(DriverDebug, "WriterSockRelease must close fd %d",
+                       wrSockPtr->c.file.bufs[i].fd);
+                ns_close(wrSockPtr->c.file.bufs[i].fd);
             }
         }
+        ns_free(wrSockPtr->c.file.bufs);
     }
-    return NS_OK;
+    ns_free(wrSockPtr->c.file.buf);
 }
 
 
 /*
  *----------------------------------------------------------------------
  *
- * SockSetServer --
+ * WriterSockRequire, WriterSockRelease --
  *
- *      Set virtual server from driver context or Host header.
+ *      Management functions for WriterSocks. WriterSockRequire() and
+ *      WriterSockRelease() are responsible for obtaining and
+ *      freeing "WriterSock" structures. When shuch a structure is finally
+ *      released, it is removed from the queue, the socket is
+ *      closed and the memory is freed.
  *
  * Results:
- *      void.
+ *      WriterSockRequire() returns a WriterSock from a connection,
+ *      the other functions return nothing.
  *
  * Side effects:
- *
- *      Updates sockPtr->servPtr. In case an invalid server set, or the
- *      required host field in HTTP/1.1 is missing the HTTP-method is set to
- *      the constant "BAD".
+ *      Updating reference counters, closing socket, freeing memory.
  *
  *----------------------------------------------------------------------
  */
 
-static Ns_ReturnCode
-SockSetServer(Sock *sockPtr)
-{
-    const char      *host = NULL;
-    Request         *reqPtr;
-    Driver          *drvPtr;
-    const ServerMap *mapPtr = NULL;
-
-    NS_NONNULL_ASSERT(sockPtr != NULL);
+static WriterSock *
+WriterSockRequire(const Conn *connPtr) {
+    WriterSock *wrSockPtr;
 
-    reqPtr = sockPtr->reqPtr;
-    assert(reqPtr != NULL);
+    NS_NONNULL_ASSERT(connPtr != NULL);
 
-    if (reqPtr->request.host != NULL && reqPtr->request.requestType == NS_REQUEST_TYPE_PLAIN) {
-        /*
-         * This is transitional code, for the case, we have missed something,
-         * when, e.g., a vulnerability checker fires at us with invalid
-         * requests.
-         */
-        Ns_Log(Notice, "REQPTR: SockSetServer reqPtr %p with host %p of sockPtr %p line '%s'"
-               " (should not happen)",
-               (void*)reqPtr,
-               (void*)reqPtr->request.host,
-               (void*)sockPtr,
-               reqPtr->request.line);
+    NsWriterLock();
+    wrSockPtr = (WriterSock *)connPtr->strWriter;
+    if (wrSockPtr != NULL) {
+        wrSockPtr->refCount ++;
     }
+    NsWriterUnlock();
+    return wrSockPtr;
+}
 
-    drvPtr = sockPtr->drvPtr;
-    assert(drvPtr != NULL);
-
-    sockPtr->servPtr  = drvPtr->servPtr;
-    sockPtr->location = NULL;
+static void
+WriterSockRelease(WriterSock *wrSockPtr) {
+    SpoolerQueue *queuePtr;
 
-    host = sockPtr->extractedHeaderFields[NS_EXTRACTED_HEADER_HOST];
-    if (host == NULL && (reqPtr->request.version >= 1.1)) {
-        /*
-         * HTTP/1.1 requires host header
-         */
-        Ns_Log(Warning, "request header field \"Host\" is missing in HTTP/1.1 request: \"%s\"\n",
-               reqPtr->request.line);
-        goto bad_request;
-    }
+    NS_NONNULL_ASSERT(wrSockPtr != NULL);
 
-    if (host != NULL) {
-        Tcl_DString hostDs;
+    wrSockPtr->refCount --;
 
-        /*
-         * DriverLookupHost() requires a writable string in the form of a
-         * Tcl_DString.
-         */
-        Tcl_DStringInit(&hostDs);
-        Tcl_DStringAppend(&hostDs, host, TCL_INDEX_NONE);
-        mapPtr = DriverLookupHost(&hostDs, &sockPtr->reqPtr->request, drvPtr);
-        Tcl_DStringFree(&hostDs);
+    Ns_Log(DriverDebug, "WriterSockRelease %p refCount %d keep %d",
+           (void *)wrSockPtr, wrSockPtr->refCount, wrSockPtr->keep);
 
-        Ns_Log(DriverDebug, "SockSetServer: host '%s' request line '%s' servPtr %p",
-               host, reqPtr->request.line, (void*)sockPtr->servPtr);
-    } else {
-        Ns_Log(DriverDebug, "SockSetServer: no host header field available, request line '%s' servPtr %p",
-               reqPtr->request.line, (void*)sockPtr->servPtr);
+    if (wrSockPtr->refCount > 0) {
+        return;
     }
 
-    if (mapPtr == NULL && sockPtr->servPtr == NULL) {
-        /*
-         * The driver is installed globally, fall back to the default server,
-         * which has to be defined in this case.
-         */
-        mapPtr = drvPtr->defMapPtr;
-        Ns_Log(Debug, "SockSetServer: get default map entry %p", (void*)mapPtr);
-    }
+    Ns_Log(DriverDebug,
+           "Writer: closed sock %d, file fd %d, error %d/%d, "
+           "sent=%" TCL_LL_MODIFIER "d, flags=%X",
+           wrSockPtr->sockPtr->sock, wrSockPtr->fd,
+           wrSockPtr->status, wrSockPtr->err,
+           wrSockPtr->nsent, wrSockPtr->flags);
 
-    if (mapPtr != NULL) {
-        /*
-         * Get server and location from the configured mapping.
-         */
-        if (sockPtr->servPtr == NULL) {
-            sockPtr->servPtr  = mapPtr->servPtr;
-        }
-        sockPtr->location = ns_strncopy(mapPtr->location, mapPtr->locationLength);
-        Ns_Log(Debug, "SockSetServer: get location from mapping '%s'", sockPtr->location);
-    } else {
-        /*
-         * There is no configured mapping.
-         */
-        if (sockPtr->servPtr == NULL) {
-            Ns_Log(Warning, "cannot determine server for request: \"%s\" (host \"%s\")\n",
-                   reqPtr->request.line, host);
-            goto bad_request;
-        }
-        /*
-         * Could not lookup the virtual host, get the default location from
-         * the driver or from local side of the socket connection.
-         */
-        Ns_Log(Debug, "SockSetServer: there is no predefined mapping for server '%s'", host);
+    NsPoolAddBytesSent(wrSockPtr->poolPtr, wrSockPtr->nsent);
 
-        if (drvPtr->location != NULL) {
-            sockPtr->location = ns_strncopy(drvPtr->location, drvPtr->locationLength);
-            Ns_Log(Debug, "SockSetServer: there is no virtual host mapping for host '%s',"
-                   "fall back to configured location '%s'",
-                   host, drvPtr->location);
-        } else {
-            Tcl_DString    locationDs;
-            const char    *hostName = NULL;
-            unsigned short hostPort = 0;
+    if (wrSockPtr->doStream != NS_WRITER_STREAM_NONE) {
+        Conn *connPtr;
 
-            Tcl_DStringInit(&locationDs);
+        NsWriterLock();
+        connPtr = wrSockPtr->connPtr;
+        if (connPtr != NULL && connPtr->strWriter != NULL) {
+            connPtr->strWriter = NULL;
+        }
+        NsWriterUnlock();
 
-            if (reqPtr != NULL) {
-                hostName = reqPtr->request.host;
-                hostPort = reqPtr->request.port;
-            }
-            Ns_HttpLocationString(&locationDs,
-                                  drvPtr->protocol,
-                                  hostName != NULL ? hostName : Ns_SockGetAddr((Ns_Sock *)sockPtr),
-                                  hostPort != 0 ? hostPort : Ns_SockGetPort((Ns_Sock *)sockPtr),
-                                  drvPtr->defport);
-            sockPtr->location = ns_strncopy(locationDs.string, locationDs.length);
-            if (hostName != NULL && sockPtr->servPtr != NULL) {
-                Ns_Log(Notice, "SockSetServer: serving request to server '%s'"
-                       " with untrusted location '%s'",
-                       sockPtr->servPtr->server, sockPtr->location);
-                if (drvPtr->server != NULL) {
-                    /*
-                     * Per-server network driver
-                     */
-                    Ns_Log(Notice, "... consider loading driver %s globally in section"
-                           "'ns/modules' and add 'ns_param %s %s' to section 'ns/module/%s/servers'",
-                           drvPtr->moduleName, drvPtr->server, hostName, /*hostPort,*/ drvPtr->moduleName);
-                } else {
-                    /*
-                     * Global network driver
-                     */
-                    Ns_Log(Notice, "... consider adding 'ns_param %s %s' to section 'ns/module/%s/servers'",
-                           sockPtr->servPtr->server, hostName, /*hostPort,*/ drvPtr->moduleName);
-                }
-            }
+        /*
+         * In case, writer streams are activated for this wrSockPtr, make sure
+         * to release the temporary file. See thread Naviserver Open Files on the
+         * sourceforge mailing list (starting July 2019).
+         */
+        if (wrSockPtr->doStream == NS_WRITER_STREAM_FINISH) {
+            Ns_ReleaseTemp(wrSockPtr->fd);
         }
-
-        Ns_Log(DriverDebug, "SockSetServer: get location from driver '%s'", sockPtr->location);
     }
 
     /*
-     * Since the URLencoding can be set per server, we need the server
-     * assignment to check the validity of the request URL.
-     *
-     * In some error conditions (e.g. from nssmtpd) the reqPtr->request.*
-     * members might be NULL.
+     * Remove the entry from the queue and decrement counter
      */
-    if (likely(sockPtr->servPtr != NULL)
-        && NsEncodingIsUtf8(sockPtr->servPtr->encoding.urlEncoding)
-        && reqPtr->request.url != NULL
-        ) {
-        if (!Ns_Valid_UTF8((const unsigned char *)reqPtr->request.url,
-                           strlen(reqPtr->request.url), NULL)) {
-            Ns_Log(Warning, "Invalid UTF-8 encoding in url '%s'",
-                   reqPtr->request.url);
-            goto bad_request;
+    queuePtr = wrSockPtr->queuePtr;
+    if (queuePtr->curPtr == wrSockPtr) {
+        queuePtr->curPtr = wrSockPtr->nextPtr;
+        queuePtr->queuesize--;
+    } else {
+        WriterSock *curPtr, *lastPtr = queuePtr->curPtr;
+
+        for (curPtr = (lastPtr != NULL) ? lastPtr->nextPtr : NULL;
+             curPtr != NULL;
+             lastPtr = curPtr, curPtr = curPtr->nextPtr
+             ) {
+            if (curPtr == wrSockPtr) {
+                lastPtr->nextPtr = wrSockPtr->nextPtr;
+                queuePtr->queuesize--;
+                break;
+            }
         }
     }
 
-    Ns_Log(DriverDebug, "SockSetServer host '%s' request line '%s' final location '%s'",
-           host, reqPtr->request.line, sockPtr->location);
-    return NS_OK;
+    if ((wrSockPtr->err != 0) || (wrSockPtr->status != SPOOLER_OK)) {
+        TCL_SIZE_T i;
+        /*
+         * Lookup the matching sockState from the spooler state. The array has
+         * just 5 elements, on average, just 2 comparisons are needed (since
+         * OK is at the end).
+         */
+        for (i = 0; i < Ns_NrElements(spoolerStateMap); i++) {
+            if (spoolerStateMap[i].spoolerState == wrSockPtr->status) {
+                SockError(wrSockPtr->sockPtr, spoolerStateMap[i].sockState, wrSockPtr->err);
+                break;
+            }
+        }
+        NsSockClose(wrSockPtr->sockPtr, (int)NS_FALSE);
+    } else {
+        NsSockClose(wrSockPtr->sockPtr, (int)wrSockPtr->keep);
+    }
+    ns_free(wrSockPtr->clientData);
 
- bad_request:
-    Ns_Log(DriverDebug, "SockSetServer sets method to BAD");
-    ns_free((char *)reqPtr->request.method);
-    reqPtr->request.method = ns_strdup("BAD");
-    return NS_ERROR;
+    if (wrSockPtr->fd != NS_INVALID_FD) {
+        if (wrSockPtr->doStream != NS_WRITER_STREAM_FINISH) {
+            (void) ns_close(wrSockPtr->fd);
+        }
+        WriterSockFileVecCleanup(wrSockPtr);
+
+    } else if (wrSockPtr->c.mem.bufs != NULL) {
+        if (wrSockPtr->c.mem.fmap.addr != NULL) {
+            NsMemUmap(&wrSockPtr->c.mem.fmap);
+
+        } else {
+            int i;
+            for (i = 0; i < wrSockPtr->c.mem.nbufs; i++) {
+                ns_free((char *)wrSockPtr->c.mem.bufs[i].iov_base);
+            }
+        }
+        if (wrSockPtr->c.mem.bufs != wrSockPtr->c.mem.preallocated_bufs) {
+            ns_free(wrSockPtr->c.mem.bufs);
+        }
+    }
+    ns_free(wrSockPtr->headerString);
+    ns_free(wrSockPtr);
 }
 
-/*
- *======================================================================
- *  Spooler Thread: Receive asynchronously from the client socket
- *======================================================================
- */
 
 /*
  *----------------------------------------------------------------------
  *
- * SpoolerThread --
+ * WriterReadFromSpool --
  *
- *      Spooling socket driver thread.
+ *      Utility function of the WriterThread to read blocks from a
+ *      file into the output buffer of the writer. It handles
+ *      left overs from previous send attempts and takes care for
+ *      locking in case simultaneous reading and writing from the
+ *      same file.
  *
  * Results:
  *      None.
  *
  * Side effects:
- *      Connections are accepted on the configured listen sockets,
- *      placed on the run queue to be serviced, and gracefully
- *      closed when done.  Async sockets have the entire request read
- *      here before queuing as well.
+ *      Fills up curPtr->c.file.buf and updates counters/sizes.
  *
  *----------------------------------------------------------------------
  */
 
-static void
-SpoolerThread(void *arg)
-{
-    SpoolerQueue  *queuePtr = (SpoolerQueue*)arg;
-    char           charBuffer[1];
-    int            pollTimeout;
-    bool           stopping = NS_FALSE;
-    Sock          *sockPtr, *nextPtr, *waitPtr = NULL, *readPtr = NULL;
-    Ns_Time        now, diff;
-    const Driver  *drvPtr;
-    PollData       pdata;
-
-    Ns_ThreadSetName("-spooler%d-", queuePtr->id);
-    queuePtr->threadName = Ns_ThreadGetName();
-
-    /*
-     * Loop forever until signaled to shut down and all
-     * connections are complete and gracefully closed.
-     */
-
-    Ns_Log(Notice, "spooler%d: accepting connections", queuePtr->id);
-
-    PollCreate(&pdata);
-    Ns_GetTime(&now);
-
-    while (!stopping) {
-
-        /*
-         * If there are any read sockets, set the bits
-         * and determine the minimum relative timeout.
-         */
-
-        PollReset(&pdata);
-        (void)PollSet(&pdata, queuePtr->pipe[0], (short)POLLIN, NULL);
-
-        if (readPtr == NULL) {
-            pollTimeout = 30 * 1000;
-        } else {
-            sockPtr = readPtr;
-            while (sockPtr != NULL) {
-                SockPoll(sockPtr, (short)POLLIN, &pdata);
-                sockPtr = sockPtr->nextPtr;
-            }
-            pollTimeout = -1;
-        }
-
-        /*
-         * Select and drain the trigger pipe if necessary.
-         */
-
-        /*n =*/ (void) PollWait(&pdata, pollTimeout);
-
-        if (PollIn(&pdata, 0) && unlikely(ns_recv(queuePtr->pipe[0], charBuffer, 1u, 0) != 1)) {
-            Ns_Fatal("spooler: trigger ns_recv() failed: %s",
-                     ns_sockstrerror(ns_sockerrno));
-        }
+static SpoolerState
+WriterReadFromSpool(WriterSock *curPtr) {
+    NsWriterStreamState doStream;
+    SpoolerState        status = SPOOLER_OK;
+    size_t              maxsize, toRead;
+    unsigned char      *bufPtr;
 
-        /*
-         * Attempt read-ahead of any new connections.
-         */
+    NS_NONNULL_ASSERT(curPtr != NULL);
 
-        Ns_GetTime(&now);
-        sockPtr = readPtr;
-        readPtr = NULL;
+    doStream = curPtr->doStream;
+    if (doStream != NS_WRITER_STREAM_NONE) {
+        Ns_MutexLock(&curPtr->c.file.fdlock);
+        toRead = curPtr->c.file.toRead;
+        Ns_MutexUnlock(&curPtr->c.file.fdlock);
+    } else {
+        toRead = curPtr->c.file.toRead;
 
-        while (sockPtr != NULL) {
-            nextPtr = sockPtr->nextPtr;
-            drvPtr  = sockPtr->drvPtr;
-            if (unlikely(PollHup(&pdata, sockPtr->pidx))) {
-                /*
-                 * Peer has closed the connection
-                 */
-                SockRelease(sockPtr, SOCK_CLOSE, 0);
+        Ns_Log(DriverDebug, "### WriterReadFromSpool [%" PRITcl_Size
+               "]: fd %d tosend %lu files %" PRITcl_Size,
+               curPtr->c.file.currentbuf, curPtr->fd, toRead, curPtr->c.file.nbufs);
+    }
 
-            } else if (!PollIn(&pdata, sockPtr->pidx)) {
-                /*
-                 * Got no data
-                 */
-                if (Ns_DiffTime(&sockPtr->timeout, &now, &diff) <= 0) {
-                    SockRelease(sockPtr, SOCK_READTIMEOUT, 0);
-                    queuePtr->queuesize--;
-                } else {
-                    Push(sockPtr, readPtr);
-                }
-            } else {
-                /*
-                 * Got some data
-                 */
-                SockState n = SockRead(sockPtr, 1, &now);
-                switch (n) {
-                case SOCK_MORE:
-                    SockTimeout(sockPtr, &now, &drvPtr->recvwait);
-                    Push(sockPtr, readPtr);
-                    break;
+    bufPtr = WriterSpoolCompact(curPtr, &maxsize);
+    if (toRead > maxsize) {
+        toRead = maxsize;
+    }
 
-                case SOCK_READY:
-                    assert(sockPtr->reqPtr != NULL);
-                    Ns_Log(DriverDebug, "spooler thread done with request");
-                    if (likely(SockSetServer(sockPtr) == NS_OK)) {
-                        Push(sockPtr, waitPtr);
-                    } else {
-                        SockRelease(sockPtr, SOCK_BADHEADER, 0);
-                        queuePtr->queuesize--;
-                    }
-                    break;
+    /*
+     * Read content from the file into the buffer.
+     */
+    if (toRead > 0u) {
+        ssize_t n;
 
-                case SOCK_BADHEADER:      NS_FALL_THROUGH; /* fall through */
-                case SOCK_BADREQUEST:     NS_FALL_THROUGH; /* fall through */
-                case SOCK_CLOSE:          NS_FALL_THROUGH; /* fall through */
-                case SOCK_CLOSETIMEOUT:   NS_FALL_THROUGH; /* fall through */
-                case SOCK_ENTITYTOOLARGE: NS_FALL_THROUGH; /* fall through */
-                case SOCK_ERROR:          NS_FALL_THROUGH; /* fall through */
-                case SOCK_READERROR:      NS_FALL_THROUGH; /* fall through */
-                case SOCK_READTIMEOUT:    NS_FALL_THROUGH; /* fall through */
-                case SOCK_SHUTERROR:      NS_FALL_THROUGH; /* fall through */
-                case SOCK_SPOOL:          NS_FALL_THROUGH; /* fall through */
-                case SOCK_TOOMANYHEADERS: NS_FALL_THROUGH; /* fall through */
-                case SOCK_WRITEERROR:     NS_FALL_THROUGH; /* fall through */
-                case SOCK_QUEUEFULL:      NS_FALL_THROUGH; /* fall through */
-                case SOCK_WRITETIMEOUT:
-                    SockRelease(sockPtr, n, errno);
-                    queuePtr->queuesize--;
-                    break;
-                }
-            }
-            sockPtr = nextPtr;
+        if (doStream != NS_WRITER_STREAM_NONE) {
+            /*
+             * In streaming mode, the connection thread writes to the
+             * spool file and the writer thread reads from the same
+             * file.  Therefore, we have to re-adjust the current
+             * read/writer position, which might be changed by the
+             * other thread. These positions have to be locked, since
+             * seeking might be subject to race conditions. Here we
+             * set the read pointer to the position after the last
+             * send operation.
+             */
+            Ns_MutexLock(&curPtr->c.file.fdlock);
+            (void) ns_lseek(curPtr->fd, (off_t)curPtr->nsent, SEEK_SET);
         }
 
-        /*
-         * Attempt to queue any pending connection
-         * after reversing the list to ensure oldest
-         * connections are tried first.
-         */
+        n = ns_read(curPtr->fd, bufPtr, WriterSpoolReadSize(curPtr, toRead));
 
-        if (waitPtr != NULL) {
-            sockPtr = NULL;
-            while ((nextPtr = waitPtr) != NULL) {
-                waitPtr = nextPtr->nextPtr;
-                Push(nextPtr, sockPtr);
-            }
-            while (sockPtr != NULL) {
-                nextPtr = sockPtr->nextPtr;
-                if (NsQueueConn(sockPtr, &now) == NS_TIMEOUT) {
-                    Push(sockPtr, waitPtr);
-                } else {
-                    queuePtr->queuesize--;
-                }
-                sockPtr = nextPtr;
-            }
+        if (n <= 0) {
+            status = SPOOLER_READERROR;
+        } else {
+            /*
+             * curPtr->c.file.toRead is still protected by
+             * curPtr->c.file.fdlock when needed (in streaming mode).
+             */
+            WriterSpoolReadDone(curPtr, (size_t)n);
         }
 
-        /*
-         * Add more connections from the spooler queue
-         */
-
-        Ns_MutexLock(&queuePtr->lock);
-        if (waitPtr == NULL) {
-            sockPtr = (Sock*)queuePtr->sockPtr;
-            queuePtr->sockPtr = NULL;
-            while (sockPtr != NULL) {
-                nextPtr = sockPtr->nextPtr;
-                drvPtr  = sockPtr->drvPtr;
-                SockTimeout(sockPtr, &now, &drvPtr->recvwait);
-                Push(sockPtr, readPtr);
-                queuePtr->queuesize++;
-                sockPtr = nextPtr;
-            }
+        if (doStream != NS_WRITER_STREAM_NONE) {
+            Ns_MutexUnlock(&curPtr->c.file.fdlock);
         }
+    }
 
-        /*
-         * Check for shutdown
-         */
+    return status;
+}
 
-        stopping = queuePtr->shutdown;
-        Ns_MutexUnlock(&queuePtr->lock);
-    }
-    PollFree(&pdata);
+/*
+ *----------------------------------------------------------------------
+ *
+ * WriterSpoolCompact --
+ *
+ *      When bufsize > 0 we have a leftover from previous send. In such
+ *      cases, move the leftover to the front of the buffer, such that the
+ *      reminder of the buffer can be filled with new data from the file.
+ *
+ * Results:
+ *      Position in the buffer for the next read operation; the number of
+ *      bytes available at this position is returned in maxsizePtr.
+ *
+ * Side effects:
+ *      Might move buffer content, resets curPtr->c.file.bufoffset.
+ *
+ *----------------------------------------------------------------------
+ */
 
-    Ns_Log(Notice, "exiting");
+static unsigned char *
+WriterSpoolCompact(WriterSock *curPtr, size_t *maxsizePtr)
+{
+    unsigned char *bufPtr  = curPtr->c.file.buf;
+    size_t         maxsize = curPtr->c.file.maxsize;
 
-    Ns_MutexLock(&queuePtr->lock);
-    queuePtr->stopped = NS_TRUE;
-    Ns_CondBroadcast(&queuePtr->cond);
-    Ns_MutexUnlock(&queuePtr->lock);
+    if (curPtr->c.file.bufsize > 0u) {
+        Ns_Log(DriverDebug,
+               "### WriterReadFromSpool %p %.6x leftover %" PRIdz " offset %ld",
+               (void *)curPtr,
+               curPtr->flags,
+               curPtr->c.file.bufsize,
+               (long)curPtr->c.file.bufoffset);
+        if (likely(curPtr->c.file.bufoffset > 0)) {
+            memmove(curPtr->c.file.buf,
+                    curPtr->c.file.buf + curPtr->c.file.bufoffset,
+                    curPtr->c.file.bufsize);
+        }
+        bufPtr = curPtr->c.file.buf + curPtr->c.file.bufsize;
+        maxsize -= curPtr->c.file.bufsize;
+    }
+    curPtr->c.file.bufoffset = 0;
+    *maxsizePtr = maxsize;
+
+    return bufPtr;
 }
 
-static void
-SpoolerQueueStart(SpoolerQueue *queuePtr, Ns_ThreadProc *proc)
+/*
+ *----------------------------------------------------------------------
+ *
+ * WriterSpoolReadSize --
+ *
+ *      Determine the number of bytes for the next read operation from the
+ *      spool file. When working on an Ns_FileVec, the read operation is
+ *      limited to the current segment.
+ *
+ * Results:
+ *      Number of bytes to read.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static size_t
+WriterSpoolReadSize(const WriterSock *curPtr, size_t toRead)
 {
-    NS_NONNULL_ASSERT(proc != NULL);
+    size_t result = toRead;
 
-    while (queuePtr != NULL) {
-        if (ns_sockpair(queuePtr->pipe) != 0) {
-            Ns_Fatal("ns_sockpair() failed: %s", ns_sockstrerror(ns_sockerrno));
+    if (curPtr->c.file.nbufs > 0) {
+        size_t wantRead = curPtr->c.file.bufs[curPtr->c.file.currentbuf].length;
+
+        if (wantRead < toRead) {
+            result = wantRead;
         }
-        Ns_ThreadCreate(proc, queuePtr, 0, &queuePtr->thread);
-        queuePtr = queuePtr->nextPtr;
     }
+    return result;
 }
 
+/*
+ *----------------------------------------------------------------------
+ *
+ * WriterSpoolReadDone --
+ *
+ *      Update the buffer and file state after "n" bytes were read from
+ *      the spool file. When working on an Ns_FileVec and the current
+ *      segment is exhausted, switch to the next segment.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Updates counters, might close the fd of the current segment.
+ *
+ *----------------------------------------------------------------------
+ */
+
 static void
-SpoolerQueueStop(SpoolerQueue *queuePtr, const Ns_Time *timeoutPtr, const char *name)
+WriterSpoolReadDone(WriterSock *curPtr, size_t n)
 {
+    if (curPtr->c.file.nbufs > 0) {
+        /*
+         * Working on an Ns_FileVec.
+         */
+        TCL_SIZE_T currentbuf = curPtr->c.file.currentbuf;
+        size_t     wantRead = curPtr->c.file.bufs[currentbuf].length;
 
-    NS_NONNULL_ASSERT(timeoutPtr != NULL);
-    NS_NONNULL_ASSERT(name != NULL);
+        Ns_Log(DriverDebug, "### WriterReadFromSpool [%" PRITcl_Size
+               "] (nbufs %" PRITcl_Size
+               "): read from fd %d got %lu (remain %lu)",
+               currentbuf, curPtr->c.file.nbufs, curPtr->fd, n, wantRead);
 
-    while (queuePtr != NULL) {
-        Ns_ReturnCode status;
+        /*
+         * Reduce the remaining length in the Ns_FileVec for the
+         * next iteration.
+         */
+        curPtr->c.file.bufs[currentbuf].length -= n;
 
-        Ns_MutexLock(&queuePtr->lock);
-        if (!queuePtr->stopped && !queuePtr->shutdown) {
-            Ns_Log(Debug, "%s%d: triggering shutdown pipe %d", name, queuePtr->id, queuePtr->pipe[1]);
-            queuePtr->shutdown = NS_TRUE;
+        if (n < wantRead) {
             /*
-             * In case queuePtr->pipe was not properly set up, the value of
-             * pipe[1] will be zero. In such cases, not try to send data to
-             * this pipe.
+             * Partial read on a segment.
              */
-            if (queuePtr->pipe[1] != 0) {
-                Ns_Log(Debug, "%s%d: triggering shutdown Trigger pipe %d", name, queuePtr->id, queuePtr->pipe[1]);
-                SockTrigger(queuePtr->pipe[1]);
-            } else {
-                queuePtr->stopped = NS_TRUE;
-            }
-        }
-        status = NS_OK;
-        while (!queuePtr->stopped && status == NS_OK) {
-            status = Ns_CondTimedWait(&queuePtr->cond, &queuePtr->lock, timeoutPtr);
-        }
-        if (status != NS_OK) {
-            Ns_Log(Warning, "%s%d: timeout waiting for shutdown", name, queuePtr->id);
-        } else {
-            /*Ns_Log(Notice, "%s%d: shutdown complete", name, queuePtr->id);*/
-            if (queuePtr->thread != NULL) {
-                Ns_ThreadJoin(&queuePtr->thread, NULL);
-                queuePtr->thread = NULL;
-            } else {
-                Ns_Log(Notice, "%s%d: shutdown: thread already gone", name, queuePtr->id);
-            }
-            ns_sockclose(queuePtr->pipe[0]);
-            ns_sockclose(queuePtr->pipe[1]);
+            Ns_Log(DriverDebug, "### WriterReadFromSpool [%" PRITcl_Size
+                   "] (nbufs %" PRITcl_Size
+                   "): partial read on fd %d (got %lu)",
+                   currentbuf, curPtr->c.file.nbufs,
+                   curPtr->fd, n);
+
+        } else if (currentbuf < curPtr->c.file.nbufs - 1 /* && (n == wantRead) */) {
+            /*
+             * All read from this segment, setup next read.
+             */
+            ns_close(curPtr->fd);
+            curPtr->c.file.bufs[currentbuf].fd = NS_INVALID_FD;
+
+            curPtr->c.file.currentbuf ++;
+            curPtr->fd = curPtr->c.file.bufs[curPtr->c.file.currentbuf].fd;
+
+            Ns_Log(DriverDebug, "### WriterReadFromSpool switch to [%" PRITcl_Size
+                   "] fd %d",
+                   curPtr->c.file.currentbuf, curPtr->fd);
         }
-        Ns_MutexUnlock(&queuePtr->lock);
-        queuePtr = queuePtr->nextPtr;
     }
+
+    curPtr->c.file.toRead -= n;
+    curPtr->c.file.bufsize += n;
 }
 
 /*
  *----------------------------------------------------------------------
  *
- * SockSpoolerQueue --
- *
- *    Adds the specified socket to the spooler queue using a round-robin
- *    scheduling strategy across available spooler threads. This function
- *    locks the global spooler structure to select the next spooler thread,
- *    appends the socket to that thread's queue, and logs the operation.
- *    If the target spooler queue was previously empty, the function triggers
- *    the spooler thread to wake up and process the queued socket.
+ * WriterSend --
  *
- * Parameters:
- *    drvPtr  - Pointer to the Driver structure that holds the spooler thread list.
- *    sockPtr - Pointer to the Sock structure representing the socket to be queued.
+ *      Utility function of the WriterThread to send content to the client. It
+ *      handles partial write operations from the lower level driver
+ *      infrastructure.
  *
  * Results:
- *    None.
+ *      either NS_OK or SOCK_ERROR;
  *
- * Side Effects:
- *    - Updates the current spooler pointer in the Driver structure.
- *    - Modifies the spooler thread's queue by adding a new socket.
- *    - May trigger a spooler thread via SockTrigger() if the queue was empty.
+ * Side effects:
+ *      Sends data, might reshuffle iovec.
  *
  *----------------------------------------------------------------------
  */
-static void
-SockSpoolerQueue(Driver *drvPtr, Sock *sockPtr)
-{
-    bool          trigger = NS_FALSE;
-    SpoolerQueue *queuePtr;
 
-    NS_NONNULL_ASSERT(drvPtr != NULL);
-    NS_NONNULL_ASSERT(sockPtr != NULL);
+static SpoolerState
+WriterSend(WriterSock *curPtr, int *err) {
+    const struct iovec *bufs;
+    struct iovec        vbuf;
+    int                 nbufs;
+    SpoolerState        status = SPOOLER_OK;
+    size_t              toWrite;
+    ssize_t             n;
+
+    NS_NONNULL_ASSERT(curPtr != NULL);
+    NS_NONNULL_ASSERT(err != NULL);
+
     /*
-     * Get the next spooler thread from the list; spooler requests are
-     * distributed round-robin among all available spooler threads.
+     * Prepare send operation
      */
+    if (curPtr->fd != NS_INVALID_FD) {
+        /*
+         * We have a valid file descriptor, send data from file.
+         *
+         * Prepare sending a single buffer with curPtr->c.file.bufsize bytes
+         * from the curPtr->c.file.buf to the client.
+         */
+        vbuf.iov_len = curPtr->c.file.bufsize;
+        vbuf.iov_base = (void *)curPtr->c.file.buf;
+        bufs = &vbuf;
+        nbufs = 1;
+        toWrite = curPtr->c.file.bufsize;
+    } else {
+        int i;
 
-    Ns_MutexLock(&drvPtr->spooler.lock);
-    if (drvPtr->spooler.curPtr == NULL) {
-        drvPtr->spooler.curPtr = drvPtr->spooler.firstPtr;
-    }
-    queuePtr = drvPtr->spooler.curPtr;
-    drvPtr->spooler.curPtr = drvPtr->spooler.curPtr->nextPtr;
-    Ns_MutexUnlock(&drvPtr->spooler.lock);
+        /*
+         * Prepare sending multiple memory buffers.  Get length of remaining
+         * buffers.
+         */
+        toWrite = 0u;
+        for (i = 0; i < curPtr->c.mem.nsbufs; i ++) {
+            toWrite += curPtr->c.mem.sbufs[i].iov_len;
+        }
+        Ns_Log(DriverDebug,
+               "### Writer wants to send remainder nbufs %d len %" PRIdz,
+               curPtr->c.mem.nsbufs, toWrite);
+
+        /*
+         * Add buffers from the source and fill structure up to max
+         */
+        while (curPtr->c.mem.bufIdx  < curPtr->c.mem.nbufs &&
+               curPtr->c.mem.sbufIdx < UIO_SMALLIOV) {
+            const struct iovec *vPtr = &curPtr->c.mem.bufs[curPtr->c.mem.bufIdx];
 
-    Ns_Log(Debug, "Spooler: %d: started fd=%d: %" PRIdz " bytes",
-           queuePtr->id, sockPtr->sock, sockPtr->reqPtr->length);
+            if (vPtr->iov_len > 0u && vPtr->iov_base != NULL) {
 
-    Ns_MutexLock(&queuePtr->lock);
-    if (queuePtr->sockPtr == NULL) {
-        trigger = NS_TRUE;
+                Ns_Log(DriverDebug,
+                       "### Writer copies source %d to scratch %d len %" PRIiovlen,
+                       curPtr->c.mem.bufIdx, curPtr->c.mem.sbufIdx, vPtr->iov_len);
+
+                toWrite += Ns_SetVec(curPtr->c.mem.sbufs, curPtr->c.mem.sbufIdx++,
+                                     vPtr->iov_base, vPtr->iov_len);
+                curPtr->c.mem.nsbufs++;
+            }
+            curPtr->c.mem.bufIdx++;
+        }
+
+        bufs  = curPtr->c.mem.sbufs;
+        nbufs = curPtr->c.mem.nsbufs;
+        Ns_Log(DriverDebug, "### Writer wants to send %d bufs size %" PRIdz,
+               nbufs, toWrite);
     }
-    Push(sockPtr, queuePtr->sockPtr);
-    Ns_MutexUnlock(&queuePtr->lock);
 
     /*
-     * Wake up spooler thread if the queue was empty.
+     * Perform the actual send operation.
      */
+    n = NsDriverSend(curPtr->sockPtr, bufs, nbufs, 0u);
 
-    if (trigger) {
-        SockTrigger(queuePtr->pipe[1]);
+    if (n == -1) {
+        *err = ns_sockerrno;
+        status = SPOOLER_WRITEERROR;
+    } else {
+        /*
+         * We have sent zero or more bytes.
+         */
+        if (curPtr->doStream != NS_WRITER_STREAM_NONE) {
+            Ns_MutexLock(&curPtr->c.file.fdlock);
+            curPtr->size -= (size_t)n;
+            Ns_MutexUnlock(&curPtr->c.file.fdlock);
+        } else {
+            curPtr->size -= (size_t)n;
+        }
+        curPtr->nsent += n;
+        curPtr->sockPtr->timeout.sec = 0;
+
+        if (curPtr->fd != NS_INVALID_FD) {
+            /*
+             * File-descriptor based send operation. Reduce the (remaining)
+             * buffer size the amount of data sent and adjust the buffer
+             * offset. For partial send operations, this will lead to a
+             * remaining buffer size > 0.
+             */
+            curPtr->c.file.bufsize -= (size_t)n;
+            curPtr->c.file.bufoffset = (off_t)n;
+
+        } else {
+            if (n < (ssize_t)toWrite) {
+                /*
+                 * We have a partial transmit from the iovec
+                 * structure. We have to compact it to fill content in
+                 * the next round.
+                 */
+                curPtr->c.mem.sbufIdx = Ns_ResetVec(curPtr->c.mem.sbufs, curPtr->c.mem.nsbufs, (size_t)n);
+                curPtr->c.mem.nsbufs -= curPtr->c.mem.sbufIdx;
+
+                memmove(curPtr->c.mem.sbufs, curPtr->c.mem.sbufs + curPtr->c.mem.sbufIdx,
+                        /* move the iovecs to the start of the scratch buffers */
+                        sizeof(struct iovec) * (size_t)curPtr->c.mem.nsbufs);
+            }
+        }
     }
-}
 
-/*
- *======================================================================
- *  Writer Thread: Write asynchronously to the client socket
- *======================================================================
- */
+    return status;
+}
 
 /*
  *----------------------------------------------------------------------
  *
- * NsWriterLock, NsWriterUnlock --
+ * WriterSendFileUsable --
  *
- *       Provide an API for locking and unlocking context information
- *       for streaming asynchronous writer jobs.  The locks are just
- *       needed for managing linkage between "connPtr" and a writer
- *       entry. The lock operations are rather infrequent and the
- *       lock duration is very short, such that at a single global
- *       appears sufficient.
+ *      Check, whether the file content of the writer job can be passed
+ *      directly to the send-file proc of the driver instead of reading
+ *      it into the writer buffer. This is the case for TLS connections
+ *      with active kernel TLS send offload, where SSL_sendfile() avoids
+ *      copying the content through user space.
  *
  * Results:
- *      None
+ *      Boolean value.
  *
  * Side effects:
- *      Change Mutex state.
+ *      None.
  *
  *----------------------------------------------------------------------
  */
-void NsWriterLock(void) {
-    Ns_MutexLock(&writerlock);
-}
 
-void NsWriterUnlock(void) {
-    Ns_MutexUnlock(&writerlock);
+static bool
+WriterSendFileUsable(const WriterSock *curPtr)
+{
+    const Sock *sockPtr = curPtr->sockPtr;
+
+    return (curPtr->fd != NS_INVALID_FD
+            && curPtr->doStream == NS_WRITER_STREAM_NONE
+            && (sockPtr->flags & NS_CONN_SSL_KTLS) != 0u
+            && sockPtr->drvPtr->sendFileProc != NULL
+            && sockPtr->h2StreamPtr == NULL);
 }
 
 /*
  *----------------------------------------------------------------------
  *
- * WriterSockFileVecCleanup --
+ * WriterSendFile --
  *
- *      Cleanup function for FileVec array in WriterSock structure.
+ *      Utility function of the WriterThread to send content from the
+ *      spool file via NsDriverSendFile(). A leftover in the writer
+ *      buffer (e.g. the response header) is sent first, followed by the
+ *      next chunk of the current file segment starting at the current
+ *      file position.
  *
  * Results:
- *      None.
+ *      SPOOLER_OK or SPOOLER_WRITEERROR.
  *
  * Side effects:
- *      Closing potentially file descriptors, freeing Ns_FileVec memory.
+ *      Sends data, advances the file position.
  *
  *----------------------------------------------------------------------
  */
-static void
-WriterSockFileVecCleanup(const WriterSock *wrSockPtr) {
 
-    NS_NONNULL_ASSERT(wrSockPtr != NULL);
+static SpoolerState
+WriterSendFile(WriterSock *curPtr, int *err)
+{
+    Ns_FileVec     bufs[2];
+    int            nbufs = 0;
+    size_t         maxsize, toSend, leftover;
+    off_t          offset;
+    ssize_t        n;
+    SpoolerState   status = SPOOLER_OK;
 
-    if ( wrSockPtr->c.file.nbufs > 0) {
-        TCL_SIZE_T i;
+    (void) WriterSpoolCompact(curPtr, &maxsize);
+    leftover = curPtr->c.file.bufsize;
+    if (leftover > 0u) {
+        (void) Ns_SetFileVec(bufs, nbufs++, NS_INVALID_FD, curPtr->c.file.buf, 0, leftover);
+    }
 
-        Ns_Log(DriverDebug, "WriterSockRelease nbufs %" PRITcl_Size,
-               wrSockPtr->c.file.nbufs);
+    toSend = WriterSpoolReadSize(curPtr, MIN(curPtr->c.file.toRead, curPtr->c.file.maxsize));
+    offset = ns_lseek(curPtr->fd, 0, SEEK_CUR);
+    if (toSend > 0u && offset != -1) {
+        (void) Ns_SetFileVec(bufs, nbufs++, curPtr->fd, NULL, offset, toSend);
+    }
 
-        for (i = 0; i < wrSockPtr->c.file.nbufs; i++) {
+    n = (nbufs > 0) ? NsDriverSendFile(curPtr->sockPtr, bufs, nbufs, 0u) : 0;
+    Ns_Log(DriverDebug, "### Writer %p sendfile fd %d offset %" PROTd " leftover %" PRIdz
+           " toSend %" PRIdz " => %" PRIdz,
+           (void *)curPtr, curPtr->fd, offset, leftover, toSend, n);
+
+    if (n == -1 || offset == -1) {
+        *err = ns_sockerrno;
+        status = SPOOLER_WRITEERROR;
+    } else {
+        size_t fromBuffer = MIN((size_t)n, leftover);
+        size_t fromFile = (size_t)n - fromBuffer;
+
+        curPtr->c.file.bufsize -= fromBuffer;
+        curPtr->c.file.bufoffset = (off_t)fromBuffer;
+
+        if (fromFile > 0u) {
             /*
-             * The fd of c.file.currentbuf is always the same as
-             * wrSockPtr->fd and therefore already closed at this point.
+             * The file content was not read via the buffer; advance the
+             * file position like a read() would do.
              */
-            if ( (i != wrSockPtr->c.file.currentbuf)
-                 && (wrSockPtr->c.file.bufs[i].fd != NS_INVALID_FD) ) {
-
-                Ns_Log(DriverDebug, "WriterSockRelease must close fd %d",
-                       wrSockPtr->c.file.bufs[i].fd);
-                ns_close(wrSockPtr->c.file.bufs[i].fd);
-            }
+            (void) ns_lseek(curPtr->fd, offset + (off_t)fromFile, SEEK_SET);
+            WriterSpoolReadDone(curPtr, fromFile);
+            curPtr->c.file.bufsize -= fromFile;
         }
-        ns_free(wrSockPtr->c.file.bufs);
+        curPtr->size -= (size_t)n;
+        curPtr->nsent += n;
+        curPtr->sockPtr->timeout.sec = 0;
     }
-    ns_free(wrSockPtr->c.file.buf);
-}
 
+    return status;
+}
 
+#ifdef NS_WRITER_IO_URING
 /*
  *----------------------------------------------------------------------
  *
- * WriterSockRequire, WriterSockRelease --
+ * WriterRingInit --
  *
- *      Management functions for WriterSocks. WriterSockRequire() and
- *      WriterSockRelease() are responsible for obtaining and
- *      freeing "WriterSock" structures. When shuch a structure is finally
- *      released, it is removed from the queue, the socket is
- *      closed and the memory is freed.
+ *      Create the io_uring instance of a writer thread and map its
+ *      submission and completion queues. The raw system call interface
+ *      is used, such that no additional library is required. An eventfd
+ *      is registered with the ring, which becomes readable when
+ *      completions are posted; the writer thread polls it together with
+ *      the sockets.
  *
  * Results:
- *      WriterSockRequire() returns a WriterSock from a connection,
- *      the other functions return nothing.
+ *      NS_OK or NS_ERROR, when the io_uring could not be set up. In the
+ *      latter case, the writer thread falls back to regular I/O.
  *
  * Side effects:
- *      Updating reference counters, closing socket, freeing memory.
+ *      Creates file descriptors and memory mappings.
  *
  *----------------------------------------------------------------------
  */
 
-static WriterSock *
-WriterSockRequire(const Conn *connPtr) {
-    WriterSock *wrSockPtr;
-
-    NS_NONNULL_ASSERT(connPtr != NULL);
-
-    NsWriterLock();
-    wrSockPtr = (WriterSock *)connPtr->strWriter;
-    if (wrSockPtr != NULL) {
-        wrSockPtr->refCount ++;
-    }
-    NsWriterUnlock();
-    return wrSockPtr;
-}
-
-static void
-WriterSockRelease(WriterSock *wrSockPtr) {
-    SpoolerQueue *queuePtr;
-
-    NS_NONNULL_ASSERT(wrSockPtr != NULL);
-
-    wrSockPtr->refCount --;
-
-    Ns_Log(DriverDebug, "WriterSockRelease %p refCount %d keep %d",
-           (void *)wrSockPtr, wrSockPtr->refCount, wrSockPtr->keep);
-
-    if (wrSockPtr->refCount > 0) {
-        return;
-    }
-
-    Ns_Log(DriverDebug,
-           "Writer: closed sock %d, file fd %d, error %d/%d, "
-           "sent=%" TCL_LL_MODIFIER "d, flags=%X",
-           wrSockPtr->sockPtr->sock, wrSockPtr->fd,
-           wrSockPtr->status, wrSockPtr->err,
-           wrSockPtr->nsent, wrSockPtr->flags);
+static Ns_ReturnCode
+WriterRingInit(WriterRing *ringPtr, unsigned int entries)
+{
+    struct io_uring_params params;
+    Ns_ReturnCode          status = NS_ERROR;
+    int                    fd;
 
-    NsPoolAddBytesSent(wrSockPtr->poolPtr, wrSockPtr->nsent);
+    NS_NONNULL_ASSERT(ringPtr != NULL);
 
-    if (wrSockPtr->doStream != NS_WRITER_STREAM_NONE) {
-        Conn *connPtr;
+    memset(ringPtr, 0, sizeof(WriterRing));
+    ringPtr->fd = NS_INVALID_FD;
+    ringPtr->eventFd = NS_INVALID_FD;
+    memset(&params, 0, sizeof(params));
 
-        NsWriterLock();
-        connPtr = wrSockPtr->connPtr;
-        if (connPtr != NULL && connPtr->strWriter != NULL) {
-            connPtr->strWriter = NULL;
-        }
-        NsWriterUnlock();
+    fd = (int)syscall(__NR_io_uring_setup, entries, &params);
+    if (fd < 0) {
+        Ns_Log(Warning, "writer: io_uring_setup() failed: %s; using regular I/O",
+               strerror(errno));
 
-        /*
-         * In case, writer streams are activated for this wrSockPtr, make sure
-         * to release the temporary file. See thread Naviserver Open Files on the
-         * sourceforge mailing list (starting July 2019).
-         */
-        if (wrSockPtr->doStream == NS_WRITER_STREAM_FINISH) {
-            Ns_ReleaseTemp(wrSockPtr->fd);
-        }
-    }
+    } else if ((params.features & IORING_FEAT_RW_CUR_POS) == 0u) {
+        Ns_Log(Warning, "writer: io_uring does not support reads from the current"
+               " file position; using regular I/O");
+        (void) ns_close(fd);
 
-    /*
-     * Remove the entry from the queue and decrement counter
-     */
-    queuePtr = wrSockPtr->queuePtr;
-    if (queuePtr->curPtr == wrSockPtr) {
-        queuePtr->curPtr = wrSockPtr->nextPtr;
-        queuePtr->queuesize--;
     } else {
-        WriterSock *curPtr, *lastPtr = queuePtr->curPtr;
+        char *sqRing, *cqRing;
 
-        for (curPtr = (lastPtr != NULL) ? lastPtr->nextPtr : NULL;
-             curPtr != NULL;
-             lastPtr = curPtr, curPtr = curPtr->nextPtr
-             ) {
-            if (curPtr == wrSockPtr) {
-                lastPtr->nextPtr = wrSockPtr->nextPtr;
-                queuePtr->queuesize--;
-                break;
-            }
+        ringPtr->sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+        ringPtr->cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+        ringPtr->sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+        if ((params.features & IORING_FEAT_SINGLE_MMAP) != 0u) {
+            ringPtr->sqRingSize = MAX(ringPtr->sqRingSize, ringPtr->cqRingSize);
+            ringPtr->cqRingSize = 0u;
         }
-    }
 
-    if ((wrSockPtr->err != 0) || (wrSockPtr->status != SPOOLER_OK)) {
-        TCL_SIZE_T i;
-        /*
-         * Lookup the matching sockState from the spooler state. The array has
-         * just 5 elements, on average, just 2 comparisons are needed (since
-         * OK is at the end).
-         */
-        for (i = 0; i < Ns_NrElements(spoolerStateMap); i++) {
-            if (spoolerStateMap[i].spoolerState == wrSockPtr->status) {
-                SockError(wrSockPtr->sockPtr, spoolerStateMap[i].sockState, wrSockPtr->err);
-                break;
+        ringPtr->sqRing = mmap(NULL, ringPtr->sqRingSize, PROT_READ|PROT_WRITE,
+                               MAP_SHARED|MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+        if (ringPtr->cqRingSize > 0u && ringPtr->sqRing != MAP_FAILED) {
+            ringPtr->cqRing = mmap(NULL, ringPtr->cqRingSize, PROT_READ|PROT_WRITE,
+                                   MAP_SHARED|MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        } else {
+            ringPtr->cqRing = ringPtr->sqRing;
+        }
+        ringPtr->sqes = mmap(NULL, ringPtr->sqesSize, PROT_READ|PROT_WRITE,
+                             MAP_SHARED|MAP_POPULATE, fd, IORING_OFF_SQES);
+
+        if (ringPtr->sqRing == MAP_FAILED
+            || ringPtr->cqRing == MAP_FAILED
+            || ringPtr->sqes == MAP_FAILED) {
+            Ns_Log(Warning, "writer: mapping io_uring queues failed: %s; using regular I/O",
+                   strerror(errno));
+            if (ringPtr->sqes != MAP_FAILED) {
+                (void) munmap(ringPtr->sqes, ringPtr->sqesSize);
             }
-        }
-        NsSockClose(wrSockPtr->sockPtr, (int)NS_FALSE);
-    } else {
-        NsSockClose(wrSockPtr->sockPtr, (int)wrSockPtr->keep);
-    }
-    ns_free(wrSockPtr->clientData);
-
-    if (wrSockPtr->fd != NS_INVALID_FD) {
-        if (wrSockPtr->doStream != NS_WRITER_STREAM_FINISH) {
-            (void) ns_close(wrSockPtr->fd);
-        }
-        WriterSockFileVecCleanup(wrSockPtr);
-
-    } else if (wrSockPtr->c.mem.bufs != NULL) {
-        if (wrSockPtr->c.mem.fmap.addr != NULL) {
-            NsMemUmap(&wrSockPtr->c.mem.fmap);
+            if (ringPtr->cqRingSize > 0u && ringPtr->cqRing != MAP_FAILED) {
+                (void) munmap(ringPtr->cqRing, ringPtr->cqRingSize);
+            }
+            if (ringPtr->sqRing != MAP_FAILED) {
+                (void) munmap(ringPtr->sqRing, ringPtr->sqRingSize);
+            }
+            (void) ns_close(fd);
 
-        } else {
-            int i;
-            for (i = 0; i < wrSockPtr->c.mem.nbufs; i++) {
-                ns_free((char *)wrSockPtr->c.mem.bufs[i].iov_base);
+        } else {
+            sqRing = ringPtr->sqRing;
+            cqRing = ringPtr->cqRing;
+
+            ringPtr->sqEntries = params.sq_entries;
+            ringPtr->sqHead    = (unsigned int *)(void *)(sqRing + params.sq_off.head);
+            ringPtr->sqTail    = (unsigned int *)(void *)(sqRing + params.sq_off.tail);
+            ringPtr->sqMask    = *(unsigned int *)(void *)(sqRing + params.sq_off.ring_mask);
+            ringPtr->sqArray   = (unsigned int *)(void *)(sqRing + params.sq_off.array);
+
+            ringPtr->cqHead    = (unsigned int *)(void *)(cqRing + params.cq_off.head);
+            ringPtr->cqTail    = (unsigned int *)(void *)(cqRing + params.cq_off.tail);
+            ringPtr->cqMask    = *(unsigned int *)(void *)(cqRing + params.cq_off.ring_mask);
+            ringPtr->cqes      = (struct io_uring_cqe *)(void *)(cqRing + params.cq_off.cqes);
+
+            ringPtr->fd = fd;
+            ringPtr->eventFd = eventfd(0u, EFD_NONBLOCK|EFD_CLOEXEC);
+            if (ringPtr->eventFd == NS_INVALID_FD
+                || syscall(__NR_io_uring_register, fd, IORING_REGISTER_EVENTFD,
+                           &ringPtr->eventFd, 1) < 0) {
+                Ns_Log(Warning, "writer: registering eventfd with io_uring failed: %s;"
+                       " using regular I/O", strerror(errno));
+                WriterRingFree(ringPtr);
+            } else {
+                status = NS_OK;
             }
         }
-        if (wrSockPtr->c.mem.bufs != wrSockPtr->c.mem.preallocated_bufs) {
-            ns_free(wrSockPtr->c.mem.bufs);
-        }
     }
-    ns_free(wrSockPtr->headerString);
-    ns_free(wrSockPtr);
+
+    return status;
 }
 
+static void
+WriterRingFree(WriterRing *ringPtr)
+{
+    NS_NONNULL_ASSERT(ringPtr != NULL);
+
+    if (ringPtr->fd != NS_INVALID_FD) {
+        (void) munmap(ringPtr->sqes, ringPtr->sqesSize);
+        if (ringPtr->cqRingSize > 0u) {
+            (void) munmap(ringPtr->cqRing, ringPtr->cqRingSize);
+        }
+        (void) munmap(ringPtr->sqRing, ringPtr->sqRingSize);
+        (void) ns_close(ringPtr->fd);
+        ringPtr->fd = NS_INVALID_FD;
+    }
+    if (ringPtr->eventFd != NS_INVALID_FD) {
+        (void) ns_close(ringPtr->eventFd);
+        ringPtr->eventFd = NS_INVALID_FD;
+    }
+}
 
 /*
  *----------------------------------------------------------------------
  *
- * WriterReadFromSpool --
+ * WriterRingUsable --
  *
- *      Utility function of the WriterThread to read blocks from a
- *      file into the output buffer of the writer. It handles
- *      left overs from previous send attempts and takes care for
- *      locking in case simultaneous reading and writing from the
- *      same file.
+ *      Check, whether the writer job can be handled via io_uring. This is
+ *      the case for file based jobs without streaming. Sending via the
+ *      ring bypasses the driver's send callback, therefore, only drivers
+ *      writing clear text to stream sockets are allowed (checked during
+ *      configuration).
  *
  * Results:
- *      None.
+ *      Boolean value.
  *
  * Side effects:
- *      Fills up curPtr->c.file.buf and updates counters/sizes.
+ *      None.
  *
  *----------------------------------------------------------------------
  */
 
-static SpoolerState
-WriterReadFromSpool(WriterSock *curPtr) {
-    NsWriterStreamState doStream;
-    SpoolerState        status = SPOOLER_OK;
-    size_t              maxsize, toRead;
-    unsigned char      *bufPtr;
+static bool
+WriterRingUsable(const WriterRing *ringPtr, const WriterSock *curPtr)
+{
+    return (ringPtr->fd != NS_INVALID_FD
+            && curPtr->fd != NS_INVALID_FD
+            && curPtr->doStream == NS_WRITER_STREAM_NONE);
+}
 
-    NS_NONNULL_ASSERT(curPtr != NULL);
+/*
+ *----------------------------------------------------------------------
+ *
+ * WriterRingEnter --
+ *
+ *      Submit the prepared SQEs to the kernel and optionally wait for
+ *      completions.
+ *
+ * Results:
+ *      Result of io_uring_enter(), -1 on error.
+ *
+ * Side effects:
+ *      Starts I/O operations. Ns_Fatal() on unexpected errors.
+ *
+ *----------------------------------------------------------------------
+ */
 
-    doStream = curPtr->doStream;
-    if (doStream != NS_WRITER_STREAM_NONE) {
-        Ns_MutexLock(&curPtr->c.file.fdlock);
-        toRead = curPtr->c.file.toRead;
-        Ns_MutexUnlock(&curPtr->c.file.fdlock);
-    } else {
-        toRead = curPtr->c.file.toRead;
+static int
+WriterRingEnter(WriterRing *ringPtr, unsigned int minComplete)
+{
+    int          n;
+    unsigned int flags = (minComplete > 0u) ? (unsigned int)IORING_ENTER_GETEVENTS : 0u;
 
-        Ns_Log(DriverDebug, "### WriterReadFromSpool [%" PRITcl_Size
-               "]: fd %d tosend %lu files %" PRITcl_Size,
-               curPtr->c.file.currentbuf, curPtr->fd, toRead, curPtr->c.file.nbufs);
+    do {
+        n = (int)syscall(__NR_io_uring_enter, ringPtr->fd, ringPtr->toSubmit, minComplete, flags, NULL, 0);
+    } while (n < 0 && errno == NS_EINTR);
+
+    if (n >= 0) {
+        ringPtr->toSubmit -= (unsigned int)n;
+    } else if (errno != EAGAIN && errno != EBUSY) {
+        Ns_Fatal("writer: io_uring_enter() failed: %s", strerror(errno));
     }
+    return n;
+}
 
-    maxsize = curPtr->c.file.maxsize;
-    bufPtr  = curPtr->c.file.buf;
+/*
+ *----------------------------------------------------------------------
+ *
+ * WriterRingPrepare --
+ *
+ *      Add an SQE for a read or send operation of a writer job to the
+ *      submission queue. The operation is submitted with the next call
+ *      of WriterRingEnter(). When the submission queue is full, the
+ *      pending SQEs are submitted immediately.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Sets the WRITER_RING_* flag of the operation in the WriterSock.
+ *
+ *----------------------------------------------------------------------
+ */
 
-    /*
-     * When bufsize > 0 we have a leftover from previous send. In such
-     * cases, move the leftover to the front, and fill the reminder of
-     * the buffer with new data from curPtr->c.
-     */
+static void
+WriterRingPrepare(WriterRing *ringPtr, WriterSock *curPtr, unsigned int op,
+                  void *bufPtr, size_t length)
+{
+    struct io_uring_sqe *sqePtr;
+    unsigned int         tail, idx;
 
-    if (curPtr->c.file.bufsize > 0u) {
-        Ns_Log(DriverDebug,
-               "### WriterReadFromSpool %p %.6x leftover %" PRIdz " offset %ld",
-               (void *)curPtr,
-               curPtr->flags,
-               curPtr->c.file.bufsize,
-               (long)curPtr->c.file.bufoffset);
-        if (likely(curPtr->c.file.bufoffset > 0)) {
-            memmove(curPtr->c.file.buf,
-                    curPtr->c.file.buf + curPtr->c.file.bufoffset,
-                    curPtr->c.file.bufsize);
-        }
-        bufPtr = curPtr->c.file.buf + curPtr->c.file.bufsize;
-        maxsize -= curPtr->c.file.bufsize;
-    }
-    if (toRead > maxsize) {
-        toRead = maxsize;
+    tail = *ringPtr->sqTail;
+    while (tail - __atomic_load_n(ringPtr->sqHead, __ATOMIC_ACQUIRE) >= ringPtr->sqEntries) {
+        (void) WriterRingEnter(ringPtr, 0u);
     }
+    idx = tail & ringPtr->sqMask;
+    sqePtr = &ringPtr->sqes[idx];
+    memset(sqePtr, 0, sizeof(struct io_uring_sqe));
 
-    /*
-     * Read content from the file into the buffer.
-     */
-    if (toRead > 0u) {
-        ssize_t n;
-
-        if (doStream != NS_WRITER_STREAM_NONE) {
-            /*
-             * In streaming mode, the connection thread writes to the
-             * spool file and the writer thread reads from the same
-             * file.  Therefore, we have to re-adjust the current
-             * read/writer position, which might be changed by the
-             * other thread. These positions have to be locked, since
-             * seeking might be subject to race conditions. Here we
-             * set the read pointer to the position after the last
-             * send operation.
-             */
-            Ns_MutexLock(&curPtr->c.file.fdlock);
-            (void) ns_lseek(curPtr->fd, (off_t)curPtr->nsent, SEEK_SET);
-        }
+    sqePtr->addr = (uint64_t)(uintptr_t)bufPtr;
+    sqePtr->len = (uint32_t)length;
+    sqePtr->user_data = (uint64_t)(uintptr_t)curPtr | op;
 
-        if (curPtr->c.file.nbufs == 0) {
-            /*
-             * Working on a single fd.
-             */
-            n = ns_read(curPtr->fd, bufPtr, toRead);
-
-        } else {
-            /*
-             * Working on an Ns_FileVec.
-             */
-            TCL_SIZE_T currentbuf = curPtr->c.file.currentbuf;
-            size_t wantRead = curPtr->c.file.bufs[currentbuf].length;
-            size_t segSize = (wantRead > toRead ? toRead : wantRead);
+    if (op == WRITER_RING_READ) {
+        /*
+         * Read from the current file position (offset -1), like read().
+         */
+        sqePtr->opcode = IORING_OP_READ;
+        sqePtr->fd = curPtr->fd;
+        sqePtr->off = (uint64_t)-1;
+    } else {
+        /*
+         * The socket was reported writable, so don't let the kernel wait
+         * for buffer space; a partial send is handled like with send().
+         * The completion might be posted nevertheless later than the
+         * submission, so the job has to wait for it like for a read.
+         */
+        sqePtr->opcode = IORING_OP_SEND;
+        sqePtr->fd = curPtr->sockPtr->sock;
+        sqePtr->msg_flags = MSG_DONTWAIT|MSG_NOSIGNAL;
+    }
+    curPtr->ringFlags |= (op | WRITER_RING_USED);
+    ringPtr->inflight++;
 
-            n = ns_read(curPtr->fd, bufPtr, segSize);
+    ringPtr->sqArray[idx] = idx;
+    __atomic_store_n(ringPtr->sqTail, tail + 1u, __ATOMIC_RELEASE);
+    ringPtr->toSubmit++;
+}
 
-            Ns_Log(DriverDebug, "### WriterReadFromSpool [%" PRITcl_Size
-                   "] (nbufs %" PRITcl_Size
-                   "): read from fd %d want %lu got %ld (remain %lu)",
-                   currentbuf, curPtr->c.file.nbufs, curPtr->fd,  segSize, n, wantRead);
+/*
+ *----------------------------------------------------------------------
+ *
+ * WriterRingSchedule --
+ *
+ *      Schedule the next operation for a writable writer job. Like
+ *      in the regular case, the buffer is filled from the spool file
+ *      before it is sent, but here, these two steps are asynchronous
+ *      operations, which are performed in different spins of the writer
+ *      thread.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Prepares an SQE.
+ *
+ *----------------------------------------------------------------------
+ */
 
-            if (n > 0) {
-                /*
-                 * Reduce the remaining length in the Ns_FileVec for the
-                 * next iteration.
-                 */
-                curPtr->c.file.bufs[currentbuf].length -= (size_t)n;
+static void
+WriterRingSchedule(WriterRing *ringPtr, WriterSock *curPtr)
+{
+    size_t         maxsize, toRead;
+    unsigned char *bufPtr;
 
-                if ((size_t)n < wantRead) {
-                    /*
-                     * Partial read on a segment.
-                     */
-                    Ns_Log(DriverDebug, "### WriterReadFromSpool [%" PRITcl_Size
-                           "] (nbufs %" PRITcl_Size
-                           "): partial read on fd %d (got %ld)",
-                           currentbuf, curPtr->c.file.nbufs,
-                           curPtr->fd, n);
+    bufPtr = WriterSpoolCompact(curPtr, &maxsize);
+    toRead = MIN(curPtr->c.file.toRead, maxsize);
 
-                } else if (currentbuf < curPtr->c.file.nbufs - 1 /* && (n == wantRead) */) {
-                    /*
-                     * All read from this segment, setup next read.
-                     */
-                    ns_close(curPtr->fd);
-                    curPtr->c.file.bufs[currentbuf].fd = NS_INVALID_FD;
+    if (toRead > 0u && (curPtr->ringFlags & WRITER_RING_FILLED) == 0u) {
+        WriterRingPrepare(ringPtr, curPtr, WRITER_RING_READ,
+                          bufPtr, WriterSpoolReadSize(curPtr, toRead));
+    } else {
+        curPtr->ringFlags &= ~WRITER_RING_FILLED;
+        WriterRingPrepare(ringPtr, curPtr, WRITER_RING_SEND,
+                          curPtr->c.file.buf, curPtr->c.file.bufsize);
+    }
+}
 
-                    curPtr->c.file.currentbuf ++;
-                    curPtr->fd = curPtr->c.file.bufs[curPtr->c.file.currentbuf].fd;
+/*
+ *----------------------------------------------------------------------
+ *
+ * WriterRingReap --
+ *
+ *      Process the completions available in the completion queue. The
+ *      results are recorded in the WriterSock like WriterReadFromSpool()
+ *      and WriterSend() do. When a send operation has drained the buffer
+ *      and there is more to read, the next read is prepared right away,
+ *      such that the disk I/O overlaps with the transmission of other
+ *      jobs.
+ *
+ * Results:
+ *      Number of processed completions.
+ *
+ * Side effects:
+ *      Updates the state of the writer jobs.
+ *
+ *----------------------------------------------------------------------
+ */
 
-                    Ns_Log(DriverDebug, "### WriterReadFromSpool switch to [%" PRITcl_Size
-                           "] fd %d",
-                           curPtr->c.file.currentbuf, curPtr->fd);
-                }
+static unsigned int
+WriterRingReap(WriterRing *ringPtr)
+{
+    unsigned int head, tail, count = 0u;
+
+    head = *ringPtr->cqHead;
+    tail = __atomic_load_n(ringPtr->cqTail, __ATOMIC_ACQUIRE);
+
+    while (head != tail) {
+        const struct io_uring_cqe *cqePtr = &ringPtr->cqes[head & ringPtr->cqMask];
+        unsigned int               op = (unsigned int)(cqePtr->user_data & WRITER_RING_OPS);
+        WriterSock                *curPtr = (WriterSock *)(uintptr_t)(cqePtr->user_data & ~(uint64_t)WRITER_RING_OPS);
+        int                        res = cqePtr->res;
+
+        head++;
+        count++;
+        ringPtr->inflight--;
+        curPtr->ringFlags &= ~op;
+
+        if (op == WRITER_RING_READ) {
+            Ns_Log(DriverDebug, "### Writer %p io_uring read fd %d returned %d",
+                   (void *)curPtr, curPtr->fd, res);
+            if (res <= 0) {
+                curPtr->ringStatus = SPOOLER_READERROR;
+                curPtr->ringErr = -res;
+            } else {
+                WriterSpoolReadDone(curPtr, (size_t)res);
+                curPtr->ringFlags |= WRITER_RING_FILLED;
             }
-        }
-
-        if (n <= 0) {
-            status = SPOOLER_READERROR;
         } else {
-            /*
-             * curPtr->c.file.toRead is still protected by
-             * curPtr->c.file.fdlock when needed (in streaming mode).
-             */
-            curPtr->c.file.toRead -= (size_t)n;
-            curPtr->c.file.bufsize += (size_t)n;
-        }
-
-        if (doStream != NS_WRITER_STREAM_NONE) {
-            Ns_MutexUnlock(&curPtr->c.file.fdlock);
+            Ns_Log(DriverDebug, "### Writer %p io_uring send sock %d returned %d",
+                   (void *)curPtr, curPtr->sockPtr->sock, res);
+            if (res == -EAGAIN) {
+                res = 0;
+            }
+            if (res < 0) {
+                curPtr->ringStatus = SPOOLER_WRITEERROR;
+                curPtr->ringErr = -res;
+            } else {
+                curPtr->size -= (size_t)res;
+                curPtr->nsent += res;
+                curPtr->sockPtr->timeout.sec = 0;
+                curPtr->c.file.bufsize -= (size_t)res;
+                curPtr->c.file.bufoffset = (off_t)res;
+
+                if (curPtr->c.file.bufsize == 0u && curPtr->c.file.toRead > 0u) {
+                    WriterRingSchedule(ringPtr, curPtr);
+                }
+            }
         }
     }
+    __atomic_store_n(ringPtr->cqHead, head, __ATOMIC_RELEASE);
 
-    return status;
+    return count;
 }
 
 /*
  *----------------------------------------------------------------------
  *
- * WriterSend --
+ * WriterRingFlush --
  *
- *      Utility function of the WriterThread to send content to the client. It
- *      handles partial write operations from the lower level driver
- *      infrastructure.
+ *      Submit all prepared operations of this spin with a single system
+ *      call without waiting for completions. The completions are
+ *      reaped in a later spin of the writer thread, which is woken up
+ *      via the eventfd registered with the ring.
  *
  * Results:
- *      either NS_OK or SOCK_ERROR;
+ *      None.
  *
  * Side effects:
- *      Sends data, might reshuffle iovec.
+ *      Starts I/O operations.
  *
  *----------------------------------------------------------------------
  */
 
-static SpoolerState
-WriterSend(WriterSock *curPtr, int *err) {
-    const struct iovec *bufs;
-    struct iovec        vbuf;
-    int                 nbufs;
-    SpoolerState        status = SPOOLER_OK;
-    size_t              toWrite;
-    ssize_t             n;
-
-    NS_NONNULL_ASSERT(curPtr != NULL);
-    NS_NONNULL_ASSERT(err != NULL);
-
-    /*
-     * Prepare send operation
-     */
-    if (curPtr->fd != NS_INVALID_FD) {
-        /*
-         * We have a valid file descriptor, send data from file.
-         *
-         * Prepare sending a single buffer with curPtr->c.file.bufsize bytes
-         * from the curPtr->c.file.buf to the client.
-         */
-        vbuf.iov_len = curPtr->c.file.bufsize;
-        vbuf.iov_base = (void *)curPtr->c.file.buf;
-        bufs = &vbuf;
-        nbufs = 1;
-        toWrite = curPtr->c.file.bufsize;
-    } else {
-        int i;
-
-        /*
-         * Prepare sending multiple memory buffers.  Get length of remaining
-         * buffers.
-         */
-        toWrite = 0u;
-        for (i = 0; i < curPtr->c.mem.nsbufs; i ++) {
-            toWrite += curPtr->c.mem.sbufs[i].iov_len;
-        }
-        Ns_Log(DriverDebug,
-               "### Writer wants to send remainder nbufs %d len %" PRIdz,
-               curPtr->c.mem.nsbufs, toWrite);
-
-        /*
-         * Add buffers from the source and fill structure up to max
-         */
-        while (curPtr->c.mem.bufIdx  < curPtr->c.mem.nbufs &&
-               curPtr->c.mem.sbufIdx < UIO_SMALLIOV) {
-            const struct iovec *vPtr = &curPtr->c.mem.bufs[curPtr->c.mem.bufIdx];
-
-            if (vPtr->iov_len > 0u && vPtr->iov_base != NULL) {
-
-                Ns_Log(DriverDebug,
-                       "### Writer copies source %d to scratch %d len %" PRIiovlen,
-                       curPtr->c.mem.bufIdx, curPtr->c.mem.sbufIdx, vPtr->iov_len);
-
-                toWrite += Ns_SetVec(curPtr->c.mem.sbufs, curPtr->c.mem.sbufIdx++,
-                                     vPtr->iov_base, vPtr->iov_len);
-                curPtr->c.mem.nsbufs++;
-            }
-            curPtr->c.mem.bufIdx++;
+static void
+WriterRingFlush(WriterRing *ringPtr)
+{
+    while (ringPtr->toSubmit > 0u) {
+        if (WriterRingEnter(ringPtr, 0u) < 0) {
+            /*
+             * EAGAIN or EBUSY: the kernel has to post completions first.
+             */
+            (void) WriterRingEnter(ringPtr, 1u);
+            (void) WriterRingReap(ringPtr);
         }
-
-        bufs  = curPtr->c.mem.sbufs;
-        nbufs = curPtr->c.mem.nsbufs;
-        Ns_Log(DriverDebug, "### Writer wants to send %d bufs size %" PRIdz,
-               nbufs, toWrite);
     }
+}
 
-    /*
-     * Perform the actual send operation.
-     */
-    n = NsDriverSend(curPtr->sockPtr, bufs, nbufs, 0u);
+/*
+ *----------------------------------------------------------------------
+ *
+ * WriterRingDrain --
+ *
+ *      Wait for all operations in flight. This is used when the writer
+ *      thread terminates, since the buffers of the operations must stay
+ *      valid until the kernel is done with them.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Might block.
+ *
+ *----------------------------------------------------------------------
+ */
 
-    if (n == -1) {
-        *err = ns_sockerrno;
-        status = SPOOLER_WRITEERROR;
-    } else {
-        /*
-         * We have sent zero or more bytes.
-         */
-        if (curPtr->doStream != NS_WRITER_STREAM_NONE) {
-            Ns_MutexLock(&curPtr->c.file.fdlock);
-            curPtr->size -= (size_t)n;
-            Ns_MutexUnlock(&curPtr->c.file.fdlock);
-        } else {
-            curPtr->size -= (size_t)n;
+static void
+WriterRingDrain(WriterRing *ringPtr)
+{
+    if (ringPtr->fd != NS_INVALID_FD) {
+        WriterRingFlush(ringPtr);
+        while (ringPtr->inflight > 0u) {
+            (void) WriterRingEnter(ringPtr, 1u);
+            (void) WriterRingReap(ringPtr);
+            WriterRingFlush(ringPtr);
         }
-        curPtr->nsent += n;
-        curPtr->sockPtr->timeout.sec = 0;
+    }
+}
 
-        if (curPtr->fd != NS_INVALID_FD) {
-            /*
-             * File-descriptor based send operation. Reduce the (remaining)
-             * buffer size the amount of data sent and adjust the buffer
-             * offset. For partial send operations, this will lead to a
-             * remaining buffer size > 0.
-             */
-            curPtr->c.file.bufsize -= (size_t)n;
-            curPtr->c.file.bufoffset = (off_t)n;
+/*
+ *----------------------------------------------------------------------
+ *
+ * WriterRingCollect --
+ *
+ *      Release the writer jobs handled via io_uring, which are finished or
+ *      failed after the completions of this spin.
+ *
+ * Results:
+ *      Updated list of writer jobs.
+ *
+ * Side effects:
+ *      Might release writer jobs.
+ *
+ *----------------------------------------------------------------------
+ */
 
-        } else {
-            if (n < (ssize_t)toWrite) {
-                /*
-                 * We have a partial transmit from the iovec
-                 * structure. We have to compact it to fill content in
-                 * the next round.
-                 */
-                curPtr->c.mem.sbufIdx = Ns_ResetVec(curPtr->c.mem.sbufs, curPtr->c.mem.nsbufs, (size_t)n);
-                curPtr->c.mem.nsbufs -= curPtr->c.mem.sbufIdx;
+static WriterSock *
+WriterRingCollect(SpoolerQueue *queuePtr, WriterSock *writePtr, PollData *pdata)
+{
+    WriterSock *curPtr, *nextPtr, *resultPtr = NULL;
 
-                memmove(curPtr->c.mem.sbufs, curPtr->c.mem.sbufs + curPtr->c.mem.sbufIdx,
-                        /* move the iovecs to the start of the scratch buffers */
-                        sizeof(struct iovec) * (size_t)curPtr->c.mem.nsbufs);
-            }
+    Ns_MutexLock(&queuePtr->lock);
+    for (curPtr = writePtr; curPtr != NULL; curPtr = nextPtr) {
+        nextPtr = curPtr->nextPtr;
+
+        if ((curPtr->ringFlags & (WRITER_RING_USED|WRITER_RING_OPS)) == WRITER_RING_USED
+            && (curPtr->ringStatus != SPOOLER_OK || curPtr->size == 0u)
+            ) {
+            Ns_Log(DriverDebug,
+                   "Writer %p fd %d io_uring done (status %d) => RELEASE",
+                   (void *)curPtr, curPtr->sockPtr->sock, (int)curPtr->ringStatus);
+            curPtr->status = curPtr->ringStatus;
+            curPtr->err    = curPtr->ringErr;
+            PollSockRemove(pdata, curPtr->sockPtr);
+            WriterSockRelease(curPtr);
+        } else {
+            Push(curPtr, resultPtr);
         }
     }
+    Ns_MutexUnlock(&queuePtr->lock);
 
-    return status;
+    return resultPtr;
 }
+#endif /* NS_WRITER_IO_URING */
 
 /*
  *----------------------------------------------------------------------
@@ -6974,7 +9431,8 @@ BandwidthComputeSleepTimeMs(const WriterSock *w)
  *
  * Side Effects:
  *      Calls ComputeSleepTimeMs for each writer.
- *      May call SockPoll to register sockets for POLLOUT.
+ *      May call SockPoll to register sockets for POLLOUT, or
+ *      SockPollSuspend for writers, which should not be woken up.
  *      Logs debug information about each writer’s send rate and sleep time.
  *
  *----------------------------------------------------------------------
@@ -6996,15 +9454,25 @@ BandwidthAdjustPollForWriters(WriterSock *writers, PollData *pdata)
                cur->rateLimit,
                sleepMs);
 
-        if (cur->size > 0) {
+        if ((cur->ringFlags & WRITER_RING_OPS) != 0u) {
+            /*
+             * Waiting for an io_uring operation; its completion wakes up
+             * the thread.
+             */
+            SockPollSuspend(cur->sockPtr, pdata);
+        } else if (cur->size > 0) {
             if (sleepMs <= 0) {
                 SockPoll(cur->sockPtr, POLLOUT, pdata);
                 timeout = -1;
             } else {
+                SockPollSuspend(cur->sockPtr, pdata);
                 timeout = MIN(sleepMs, timeout);
             }
-        } else if (cur->doStream == NS_WRITER_STREAM_FINISH) {
-            timeout = -1;
+        } else {
+            SockPollSuspend(cur->sockPtr, pdata);
+            if (cur->doStream == NS_WRITER_STREAM_FINISH) {
+                timeout = -1;
+            }
         }
     }
 
@@ -7040,6 +9508,9 @@ WriterThread(void *arg)
     WriterSock     *curPtr, *nextPtr, *writePtr = NULL;
     PollData        pdata;
     Tcl_HashTable   pools;     /* used for accumulating bandwidth per pool */
+#ifdef NS_WRITER_IO_URING
+    WriterRing      ring;
+#endif
 
     Ns_ThreadSetName("-writer%d-", queuePtr->id);
     queuePtr->threadName = Ns_ThreadGetName();
@@ -7052,7 +9523,15 @@ WriterThread(void *arg)
      */
 
     Ns_Log(Notice, "writer%d: accepting connections", queuePtr->id);
-    PollCreate(&pdata);
+    PollCreate(&pdata, queuePtr->pollBackend);
+
+#ifdef NS_WRITER_IO_URING
+    ring.fd = NS_INVALID_FD;
+    ring.eventFd = NS_INVALID_FD;
+    if (queuePtr->iouring && WriterRingInit(&ring, 256u) == NS_OK) {
+        Ns_Log(Notice, "writer%d: using io_uring for file based jobs", queuePtr->id);
+    }
+#endif
 
     while (!stopping) {
         char charBuffer[1];
@@ -7063,6 +9542,11 @@ WriterThread(void *arg)
 
         PollReset(&pdata);
         (void)PollSet(&pdata, queuePtr->pipe[0], (short)POLLIN, NULL);
+#ifdef NS_WRITER_IO_URING
+        if (ring.fd != NS_INVALID_FD) {
+            (void)PollSet(&pdata, ring.eventFd, (short)POLLIN, NULL);
+        }
+#endif
 
         if (writePtr == NULL) {
             pollTimeout = 30 * 1000;
@@ -7085,6 +9569,18 @@ WriterThread(void *arg)
             Ns_Fatal("writer: trigger ns_recv() failed: %s",
                      ns_sockstrerror(ns_sockerrno));
         }
+#ifdef NS_WRITER_IO_URING
+        if (ring.fd != NS_INVALID_FD) {
+            uint64_t completions;
+
+            if (PollIn(&pdata, 1)
+                && read(ring.eventFd, &completions, sizeof(completions)) < 0
+                && errno != EAGAIN) {
+                Ns_Fatal("writer: reading io_uring eventfd failed: %s", strerror(errno));
+            }
+            (void) WriterRingReap(&ring);
+        }
+#endif
 
         /*
          * Write to all available sockets
@@ -7096,9 +9592,11 @@ WriterThread(void *arg)
         while (curPtr != NULL) {
             NsWriterStreamState doStream;
             SpoolerState        spoolerState = SPOOLER_OK;
+            short               revents;
 
             nextPtr = curPtr->nextPtr;
             sockPtr = curPtr->sockPtr;
+            revents = PollSockEvents(&pdata, sockPtr);
             err = 0;
 
             /*
@@ -7107,7 +9605,18 @@ WriterThread(void *arg)
              */
             doStream = curPtr->doStream;
 
-            if (unlikely(PollHup(&pdata, sockPtr->pidx))) {
+            if ((curPtr->ringFlags & WRITER_RING_OPS) != 0u) {
+                /*
+                 * An io_uring operation is in flight, the job has to wait
+                 * for its completion.
+                 */
+                Ns_Log(DriverDebug, "### Writer %p waits for io_uring operation", (void *)curPtr);
+
+            } else if (unlikely(curPtr->ringStatus != SPOOLER_OK)) {
+                spoolerState = curPtr->ringStatus;
+                err = curPtr->ringErr;
+
+            } else if (unlikely((revents & POLLHUP) == POLLHUP)) {
                 Ns_Log(DriverDebug, "### Writer %p reached POLLHUP fd %d", (void *)curPtr, sockPtr->sock);
                 spoolerState = SPOOLER_CLOSE;
                 err = 0;
@@ -7115,7 +9624,7 @@ WriterThread(void *arg)
                 curPtr->infoPtr->currentPoolRate += curPtr->currentRate;
 
 
-            } else if (likely(PollOut(&pdata, sockPtr->pidx)) || (doStream == NS_WRITER_STREAM_FINISH)) {
+            } else if (likely((revents & POLLOUT) == POLLOUT) || (doStream == NS_WRITER_STREAM_FINISH)) {
                 /*
                  * The socket is writable, we can compute the rate, when
                  * something was sent already and some kind of rate limiting
@@ -7158,17 +9667,34 @@ WriterThread(void *arg)
                         spoolerState = SPOOLER_CLOSE;
                     }
                 } else {
-                    /*
-                     * If size > 0, there is still something to send.
-                     * If we are spooling from a file, read some data
-                     * from the (spool) file and place it into curPtr->c.file.buf.
-                     */
-                    if (curPtr->fd != NS_INVALID_FD) {
-                        spoolerState = WriterReadFromSpool(curPtr);
-                    }
+#ifdef NS_WRITER_IO_URING
+                    if (WriterRingUsable(&ring, curPtr)) {
+                        /*
+                         * Read or send asynchronously; the operations of
+                         * all jobs are submitted together after this loop.
+                         */
+                        WriterRingSchedule(&ring, curPtr);
+                    } else
+#endif
+                    if (WriterSendFileUsable(curPtr)) {
+                        /*
+                         * Let the driver send the file content without
+                         * reading it into the writer buffer.
+                         */
+                        spoolerState = WriterSendFile(curPtr, &err);
+                    } else {
+                        /*
+                         * If size > 0, there is still something to send.
+                         * If we are spooling from a file, read some data
+                         * from the (spool) file and place it into curPtr->c.file.buf.
+                         */
+                        if (curPtr->fd != NS_INVALID_FD) {
+                            spoolerState = WriterReadFromSpool(curPtr);
+                        }
 
-                    if (spoolerState == SPOOLER_OK) {
-                        spoolerState = WriterSend(curPtr, &err);
+                        if (spoolerState == SPOOLER_OK) {
+                            spoolerState = WriterSend(curPtr, &err);
+                        }
                     }
                 }
             } else {
@@ -7206,6 +9732,7 @@ WriterThread(void *arg)
                     Ns_Log(DriverDebug,
                            "Writer %p done OK (size %" PRIdz ") => RELEASE",
                            (void *)curPtr, curPtr->size);
+                    PollSockRemove(&pdata, sockPtr);
                     WriterSockRelease(curPtr);
                 }
             } else {
@@ -7217,12 +9744,20 @@ WriterThread(void *arg)
                        (void *)curPtr, curPtr->sockPtr->sock, (int)spoolerState);
                 curPtr->status = spoolerState;
                 curPtr->err    = err;
+                PollSockRemove(&pdata, sockPtr);
                 WriterSockRelease(curPtr);
             }
             Ns_MutexUnlock(&queuePtr->lock);
             curPtr = nextPtr;
         }
 
+#ifdef NS_WRITER_IO_URING
+        if (ring.fd != NS_INVALID_FD) {
+            WriterRingFlush(&ring);
+            writePtr = WriterRingCollect(queuePtr, writePtr, &pdata);
+        }
+#endif
+
         /*
          * Add more sockets to the writer queue
          */
@@ -7251,6 +9786,10 @@ WriterThread(void *arg)
          */
         stopping = queuePtr->shutdown;
     }
+#ifdef NS_WRITER_IO_URING
+    WriterRingDrain(&ring);
+    WriterRingFree(&ring);
+#endif
     PollFree(&pdata);
 
     /*
@@ -7464,9 +10003,7 @@ NsWriterQueue(Ns_Conn *conn, size_t nsend,
 {
     Conn          *connPtr;
     WriterSock    *wrSockPtr;
-    SpoolerQueue  *queuePtr;
     DrvWriter     *wrPtr;
-    bool           trigger = NS_FALSE;
     size_t         headerSize;
     Ns_ReturnCode  status = NS_OK;
     Ns_FileVec    *fbufs = NULL;
@@ -7495,6 +10032,14 @@ NsWriterQueue(Ns_Conn *conn, size_t nsend,
             Ns_Log(DriverDebug, "NsWriterQueue: no writer threads configured");
             status = NS_ERROR;
 
+        } else if (connPtr->sockPtr->h2StreamPtr != NULL) {
+            /*
+             * The output of HTTP/2 streams has to be framed, it is sent by
+             * the connection thread.
+             */
+            Ns_Log(DriverDebug, "NsWriterQueue: not used for HTTP/2 streams");
+            status = NS_ERROR;
+
         } else if (nsend < (size_t)wrPtr->writersize && !everysize && connPtr->fd == 0) {
             Ns_Log(DriverDebug, "NsWriterQueue: file is too small(%" PRIdz " < %" PRIdz ")",
                    nsend, wrPtr->writersize);
@@ -7600,23 +10145,7 @@ NsWriterQueue(Ns_Conn *conn, size_t nsend,
     /*
      * Take the rate limit from the connection.
      */
-    wrSockPtr->rateLimit = connPtr->rateLimit;
-    if (wrSockPtr->rateLimit == -1) {
-        /*
-         * The value was not specified via connection. Use either the pool
-         * limit as a base for the computation or fall back to the driver
-         * default value.
-         */
-        if (connPtr->poolPtr->rate.poolLimit > 0) {
-            /*
-             * Very optimistic start value, but values will float through via
-             * bandwidth management.
-             */
-            wrSockPtr->rateLimit = connPtr->poolPtr->rate.poolLimit / 2;
-        } else {
-            wrSockPtr->rateLimit = wrPtr->rateLimit;
-        }
-    }
+    wrSockPtr->rateLimit = WriterInitialRateLimit(connPtr->poolPtr, wrPtr, connPtr->rateLimit);
     Ns_Log(WriterDebug, "### Writer(%d): initial rate limit %d KB/s",
            wrSockPtr->sockPtr->sock, wrSockPtr->rateLimit);
 
@@ -7650,7 +10179,6 @@ NsWriterQueue(Ns_Conn *conn, size_t nsend,
     if (fd != NS_INVALID_FD) {
         /* maybe add mmap support for files (fd != NS_INVALID_FD) */
 
-        wrSockPtr->fd = fd;
         wrSockPtr->c.file.bufs = fbufs;
         wrSockPtr->c.file.nbufs = nfbufs;
 
@@ -7659,34 +10187,7 @@ NsWriterQueue(Ns_Conn *conn, size_t nsend,
                " bufsize %" PRIdz,
                fd, nsend, nfbufs, wrPtr->bufsize);
 
-        if (unlikely(headerSize >= wrPtr->bufsize)) {
-            /*
-             * We have a header which is larger than bufsize; place it
-             * as "leftover" and use the headerString as buffer for file
-             * reads (rather rare case)
-             */
-            wrSockPtr->c.file.buf = (unsigned char *)wrSockPtr->headerString;
-            wrSockPtr->c.file.maxsize = headerSize;
-            wrSockPtr->c.file.bufsize = headerSize;
-            wrSockPtr->headerString = NULL;
-        } else if (headerSize > 0u) {
-            /*
-             * We have a header that fits into the bufsize; place it
-             * as "leftover" at the end of the buffer.
-             */
-            wrSockPtr->c.file.buf = ns_malloc(wrPtr->bufsize);
-            memcpy(wrSockPtr->c.file.buf, wrSockPtr->headerString, headerSize);
-            wrSockPtr->c.file.bufsize = headerSize;
-            wrSockPtr->c.file.maxsize = wrPtr->bufsize;
-            ns_free(wrSockPtr->headerString);
-            wrSockPtr->headerString = NULL;
-        } else {
-            assert(wrSockPtr->headerString == NULL);
-            wrSockPtr->c.file.buf = ns_malloc(wrPtr->bufsize);
-            wrSockPtr->c.file.maxsize = wrPtr->bufsize;
-        }
-        wrSockPtr->c.file.bufoffset = 0;
-        wrSockPtr->c.file.toRead = nsend;
+        WriterSockFileInit(wrSockPtr, wrPtr, fd, nsend, headerSize);
 
     } else if (bufs != NULL) {
         int i, j, headerbufs = (headerSize > 0u ? 1 : 0);
@@ -7790,10 +10291,220 @@ NsWriterQueue(Ns_Conn *conn, size_t nsend,
         connPtr->nContentSent = nsend - headerSize;
     }
 
+    WriterSockSubmit(wrPtr, wrSockPtr, connPtr->request.line);
+
+    return NS_OK;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * NsWriterQueueSock --
+ *
+ *      Submit the delivery of a response to the writer queue for a
+ *      request, which was answered directly by the driver thread without
+ *      a connection (see NsFastPathDriver() and NsMicroCacheServe()). The
+ *      content of the memory buffers is copied and sent first, followed
+ *      by "size" bytes from the file descriptor, when it is valid. The
+ *      writer takes over the socket and closes the file descriptor when
+ *      done.
+ *
+ * Results:
+ *      NS_OK when the writer thread takes care of the delivery, NS_ERROR
+ *      when no writer thread is configured for the driver. In the latter
+ *      case, the caller remains responsible for the socket and the file
+ *      descriptor.
+ *
+ * Side effects:
+ *      Adding a job to the writer queue.
+ *
+ *----------------------------------------------------------------------
+ */
+
+Ns_ReturnCode
+NsWriterQueueSock(Sock *sockPtr, ConnPool *poolPtr, const struct iovec *bufs, int nbufs,
+                  int fd, size_t size, bool keep)
+{
+    DrvWriter  *wrPtr;
+    WriterSock *wrSockPtr;
+    char       *buffer;
+    size_t      length = 0u;
+    int         i;
+
+    NS_NONNULL_ASSERT(sockPtr != NULL);
+    NS_NONNULL_ASSERT(poolPtr != NULL);
+    NS_NONNULL_ASSERT(bufs != NULL);
+
+    wrPtr = &sockPtr->drvPtr->writer;
+    if (unlikely(wrPtr->threads == 0)) {
+        Ns_Log(DriverDebug, "NsWriterQueueSock: no writer threads configured");
+        return NS_ERROR;
+    }
+
+    poolPtr->stats.spool++;
+
     /*
-     * Get the next writer thread from the list, all writer requests are
-     * rotated between all writer threads
+     * Copy the memory buffers into a single buffer owned by the writer
+     * job. For file deliveries, this is the header string.
      */
+    for (i = 0; i < nbufs; i++) {
+        length += bufs[i].iov_len;
+    }
+    buffer = ns_malloc(length + 1u);
+    length = 0u;
+    for (i = 0; i < nbufs; i++) {
+        memcpy(buffer + length, bufs[i].iov_base, bufs[i].iov_len);
+        length += bufs[i].iov_len;
+    }
+    buffer[length] = '\0';
+
+    wrSockPtr = (WriterSock *)ns_calloc(1u, sizeof(WriterSock));
+    wrSockPtr->sockPtr = sockPtr;
+    wrSockPtr->poolPtr = poolPtr;
+    wrSockPtr->sockPtr->timeout.sec = 0;
+    wrSockPtr->refCount = 1;
+    wrSockPtr->rateLimit = WriterInitialRateLimit(poolPtr, wrPtr, -1);
+    wrSockPtr->startTime = sockPtr->acceptTime;
+    wrSockPtr->keep = keep;
+
+    if (fd != NS_INVALID_FD) {
+        wrSockPtr->size = size + length;
+        if (length > 0u) {
+            wrSockPtr->headerString = buffer;
+        } else {
+            ns_free(buffer);
+        }
+        WriterSockFileInit(wrSockPtr, wrPtr, fd, size, length);
+    } else {
+        /*
+         * The buffer is freed via c.mem.bufs when the job is released.
+         */
+        wrSockPtr->size = length;
+        wrSockPtr->fd = NS_INVALID_FD;
+        wrSockPtr->c.mem.bufs = wrSockPtr->c.mem.preallocated_bufs;
+        wrSockPtr->c.mem.nbufs = 1;
+        (void) Ns_SetVec(wrSockPtr->c.mem.bufs, 0, buffer, length);
+    }
+    WriterSockSubmit(wrPtr, wrSockPtr, sockPtr->reqPtr->request.line);
+
+    return NS_OK;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * WriterInitialRateLimit --
+ *
+ *      Determine the initial rate limit for a writer job. When the value
+ *      was not specified (-1), use either the pool limit as a base for the
+ *      computation or fall back to the driver default value.
+ *
+ * Results:
+ *      Rate limit in KB/s.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+WriterInitialRateLimit(const ConnPool *poolPtr, const DrvWriter *wrPtr, int rateLimit)
+{
+    if (rateLimit == -1) {
+        if (poolPtr->rate.poolLimit > 0) {
+            /*
+             * Very optimistic start value, but values will float through via
+             * bandwidth management.
+             */
+            rateLimit = poolPtr->rate.poolLimit / 2;
+        } else {
+            rateLimit = wrPtr->rateLimit;
+        }
+    }
+    return rateLimit;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * WriterSockFileInit --
+ *
+ *      Set up a writer job for sending "nsend" bytes from a file
+ *      descriptor. A header string of the writer job is moved into the
+ *      file buffer, such it is sent before the file content.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Allocates the file buffer.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+WriterSockFileInit(WriterSock *wrSockPtr, const DrvWriter *wrPtr, int fd, size_t nsend, size_t headerSize)
+{
+    wrSockPtr->fd = fd;
+
+    if (unlikely(headerSize >= wrPtr->bufsize)) {
+        /*
+         * We have a header which is larger than bufsize; place it
+         * as "leftover" and use the headerString as buffer for file
+         * reads (rather rare case)
+         */
+        wrSockPtr->c.file.buf = (unsigned char *)wrSockPtr->headerString;
+        wrSockPtr->c.file.maxsize = headerSize;
+        wrSockPtr->c.file.bufsize = headerSize;
+        wrSockPtr->headerString = NULL;
+    } else if (headerSize > 0u) {
+        /*
+         * We have a header that fits into the bufsize; place it
+         * as "leftover" at the end of the buffer.
+         */
+        wrSockPtr->c.file.buf = ns_malloc(wrPtr->bufsize);
+        memcpy(wrSockPtr->c.file.buf, wrSockPtr->headerString, headerSize);
+        wrSockPtr->c.file.bufsize = headerSize;
+        wrSockPtr->c.file.maxsize = wrPtr->bufsize;
+        ns_free(wrSockPtr->headerString);
+        wrSockPtr->headerString = NULL;
+    } else {
+        assert(wrSockPtr->headerString == NULL);
+        wrSockPtr->c.file.buf = ns_malloc(wrPtr->bufsize);
+        wrSockPtr->c.file.maxsize = wrPtr->bufsize;
+    }
+    wrSockPtr->c.file.bufoffset = 0;
+    wrSockPtr->c.file.toRead = nsend;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * WriterSockSubmit --
+ *
+ *      Add a fully set up writer job to the queue of the next writer
+ *      thread. All writer requests are rotated between all writer
+ *      threads.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Wakes up the writer thread.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+WriterSockSubmit(DrvWriter *wrPtr, WriterSock *wrSockPtr, const char *requestLine)
+{
+    SpoolerQueue *queuePtr;
+    bool          trigger = NS_FALSE;
 
     Ns_MutexLock(&wrPtr->lock);
     if (wrPtr->curPtr == NULL) {
@@ -7807,9 +10518,9 @@ NsWriterQueue(Ns_Conn *conn, size_t nsend,
            "size=%" PRIdz ", flags=%X, rate %d KB/s: %s",
            wrSockPtr->sockPtr->sock,
            queuePtr->id, wrSockPtr->fd,
-           nsend, wrSockPtr->flags,
+           wrSockPtr->size, wrSockPtr->flags,
            wrSockPtr->rateLimit,
-           connPtr->request.line);
+           requestLine);
 
     /*
      * Now add new writer socket to the writer thread's queue
@@ -7831,8 +10542,6 @@ NsWriterQueue(Ns_Conn *conn, size_t nsend,
     if (trigger) {
         SockTrigger(queuePtr->pipe[1]);
     }
-
-    return NS_OK;
 }
 
 /*
@@ -8933,7 +11642,7 @@ AsyncWriterThread(void *arg)
      * Allocate and initialize controlling variables
      */
 
-    PollCreate(&pdata);
+    PollCreate(&pdata, NS_POLL_BACKEND_POLL);
 
     /*
      * Loop forever until signaled to shutdown and all
@@ -9527,7 +12236,7 @@ NSDriverClientOpen(Tcl_Interp *interp, const char *driverName,
                 ? drvPtr->servPtr
                 : NsGetInterpData(interp)->servPtr;
 
-            sockPtr->reqPtr = RequestNew();
+            sockPtr->reqPtr = RequestNew(sockPtr->drvPtr);
 
             Ns_GetTime(&sockPtr->acceptTime);
             reqPtr = sockPtr->reqPtr;
@@ -9617,7 +12326,7 @@ NSDriverSockNew(Tcl_Interp *interp, NS_SOCKET sock,
             : NsGetInterpData(interp)->servPtr;
 
         sockPtr->sock = sock;
-        sockPtr->reqPtr = RequestNew();
+        sockPtr->reqPtr = RequestNew(sockPtr->drvPtr);
 
         // peerAddr is missing
 
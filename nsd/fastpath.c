@@ -37,6 +37,29 @@ typedef struct {
     char   bytes[1];  /* Grown to actual file size. */
 } File;
 
+/*
+ * The following structure defines a memory mapped file stored in a shard
+ * of the mmap cache. The mapped region is shared by the cache and all
+ * connections and writer threads delivering it, the reference count is
+ * protected by the lock of the shard.
+ */
+
+typedef struct MappedFile {
+    time_t                 mtime;
+    size_t                 size;
+    dev_t                  dev;
+    ino_t                  ino;
+    int                    refcnt;
+    struct MmapShard      *shardPtr;
+    FileMap                map;
+} MappedFile;
+
+typedef struct MmapShard {
+    Ns_Cache     *cache;
+    unsigned long hits;
+    unsigned long misses;
+} MmapShard;
+
 
 /*
  * Local functions defined in this file
@@ -45,6 +68,15 @@ typedef struct {
 static void DecrEntry(File *filePtr)
     NS_GNUC_NONNULL(1);
 
+static MappedFile *MmapCacheGet(const char *fileName, const struct stat *stPtr)
+    NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(2);
+
+static void DecrMapped(MappedFile *mapPtr)
+    NS_GNUC_NONNULL(1);
+
+static void MmapCacheStats(Tcl_DString *dsPtr, bool reset)
+    NS_GNUC_NONNULL(1);
+
 static bool UrlIs(const char *server, const char *url, bool isDir)
     NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(2);
 
@@ -54,6 +86,15 @@ static Ns_ReturnCode FastGetRestart(Ns_Conn *conn, const char *page)
 static Ns_ReturnCode FastReturn(Ns_Conn *conn, int statusCode, const char *mimeType, const char *fileName)
     NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(4);
 
+static bool DriverUrl(const NsServer *servPtr, const char *url)
+    NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(2) NS_GNUC_PURE;
+
+static bool DriverReturnFile(Sock *sockPtr, const char *fileName, const struct stat *stPtr, bool isHead)
+    NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(2) NS_GNUC_NONNULL(3);
+
+static void DriverAppendHeaders(Tcl_DString *dsPtr, const Ns_Set *headers, const Ns_Set *otherHeaders)
+    NS_GNUC_NONNULL(1);
+
 static int  CompressExternalFile(Tcl_Interp *interp, const char *cmdName, const char *fileName, const char *gzFileName)
     NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(2) NS_GNUC_NONNULL(3) NS_GNUC_NONNULL(4);
 
@@ -72,6 +113,8 @@ CheckStaticCompressedDelivery(
 
 
 static Ns_Callback FreeEntry;
+static Ns_Callback FreeMapped;
+static Ns_Callback ReleaseMapped;
 static Ns_ServerInitProc ConfigServerFastpath;
 
 
@@ -82,10 +125,15 @@ static Ns_ServerInitProc ConfigServerFastpath;
 static Ns_Cache *cache = NULL;                /* Global cache of pages for all virtual servers.     */
 static int       maxentry;                    /* Maximum size of an individual entry in the cache.  */
 static bool      useMmap = NS_FALSE;          /* Use the mmap() system call to read data from disk. */
+static MmapShard *mmapShards = NULL;          /* Shards of the cache of mapped files.                */
+static int        nMmapShards;                /* Number of mmap cache shards.                        */
+static size_t     mmapMaxEntry;               /* Maximum size of an individual mapped file.          */
 static bool      useGzip = NS_FALSE;          /* Use gzip delivery if possible                      */
 static bool      useGzipRefresh = NS_FALSE;   /* Update outdated gzip files automatically via ::ns_gzipfile */
 static bool      useBrotli = NS_FALSE;        /* Use brotli delivery if possible                      */
 static bool      useBrotliRefresh = NS_FALSE; /* Update outdated brotli files automatically via ::ns_brotlifile */
+static bool      useZstd = NS_FALSE;          /* Use zstd delivery if possible                        */
+static bool      useZstdRefresh = NS_FALSE;   /* Update outdated zstd files automatically via ::ns_zstdfile */
 
 
 
@@ -116,6 +164,8 @@ NsConfigFastpath(void)
     useGzipRefresh = Ns_ConfigBool(section, "gzip_refresh", NS_FALSE);
     useBrotli = Ns_ConfigBool(section, "brotli_static", NS_FALSE);
     useBrotliRefresh = Ns_ConfigBool(section, "brotli_refresh", NS_FALSE);
+    useZstd = Ns_ConfigBool(section, "zstd_static", NS_FALSE);
+    useZstdRefresh = Ns_ConfigBool(section, "zstd_refresh", NS_FALSE);
 
     if (Ns_ConfigBool(section, "cache", NS_FALSE)) {
         size_t size = (size_t)Ns_ConfigMemUnitRange(section, "cachemaxsize", "10MB",
@@ -123,6 +173,36 @@ NsConfigFastpath(void)
         cache = Ns_CacheCreateSz("ns:fastpath", TCL_STRING_KEYS, size, FreeEntry);
         maxentry = (int)Ns_ConfigMemUnitRange(section, "cachemaxentry", "8KB", 8192, 8, INT_MAX);
     }
+
+    if (Ns_ConfigBool(section, "mmapcache", NS_FALSE)) {
+        Tcl_DString ds;
+        size_t      size, shardSize;
+        int         i;
+
+        size = (size_t)Ns_ConfigMemUnitRange(section, "mmapcachemaxsize", "256MB",
+                                             256*1024*1024, 1024*1024, LLONG_MAX);
+        nMmapShards = Ns_ConfigIntRange(section, "mmapcacheshards", 8, 1, 256);
+        mmapMaxEntry = (size_t)Ns_ConfigMemUnitRange(section, "mmapcachemaxentry", "16MB",
+                                                     16*1024*1024, 1024, LLONG_MAX);
+        /*
+         * A single file must fit into a shard, otherwise it would evict
+         * all other entries of the shard.
+         */
+        shardSize = size / (size_t)nMmapShards;
+        if (mmapMaxEntry > shardSize) {
+            Ns_Log(Notice, "fastpath: mmapcachemaxentry reduced to the shard size %" PRIuz, shardSize);
+            mmapMaxEntry = shardSize;
+        }
+        mmapShards = ns_calloc((size_t)nMmapShards, sizeof(MmapShard));
+
+        Tcl_DStringInit(&ds);
+        for (i = 0; i < nMmapShards; i++) {
+            Tcl_DStringSetLength(&ds, 0);
+            Ns_DStringPrintf(&ds, "ns:fastpath:mmap:%d", i);
+            mmapShards[i].cache = Ns_CacheCreateSz(ds.string, TCL_STRING_KEYS, shardSize, FreeMapped);
+        }
+        Tcl_DStringFree(&ds);
+    }
     /*
      * Register the fastpath initialization for every server.
      */
@@ -198,6 +278,12 @@ ConfigServerFastpath(const char *server)
         servPtr->fastpath.dirproc = ns_strcopy(Ns_ConfigString(section, "directoryproc", "_ns_dirlist"));
         servPtr->fastpath.diradp  = ns_strcopy(Ns_ConfigString(section, "directoryadp", NULL));
 
+        p = Ns_ConfigString(section, "driverurls", NULL);
+        if (p != NULL && Tcl_SplitList(NULL, p, &servPtr->fastpath.driverc,
+                                       &servPtr->fastpath.driverv) != TCL_OK) {
+            Ns_Log(Error, "fastpath[%s]: driverurls is not a list: %s", server, p);
+        }
+
         Ns_RegisterRequest2(NULL, server, "GET", "/",  Ns_FastPathProc, NULL, NULL, 0u, NULL);
         Ns_RegisterRequest2(NULL, server, "HEAD", "/", Ns_FastPathProc, NULL, NULL, 0u, NULL);
         Ns_RegisterRequest2(NULL, server, "POST", "/", Ns_FastPathProc, NULL, NULL, 0u, NULL);
@@ -278,7 +364,7 @@ Ns_FastPathProc(const void *UNUSED(arg), Ns_Conn *conn)
     Tcl_DStringInit(&ds);
 
     if ((NsUrlToFile(&ds, servPtr, url) != NS_OK)
-        || (Ns_Stat(ds.string, &connPtr->fileInfo) == NS_FALSE)) {
+        || (NsStatCached(ds.string, &connPtr->fileInfo) == NS_FALSE)) {
         goto notfound;
     }
 
@@ -306,7 +392,7 @@ Ns_FastPathProc(const void *UNUSED(arg), Ns_Conn *conn)
             }
             Ns_DStringVarAppend(&ds, "/", servPtr->fastpath.dirv[i], NS_SENTINEL);
 
-            if ((stat(ds.string, &connPtr->fileInfo) == 0)
+            if (NsStatCached(ds.string, &connPtr->fileInfo)
                 && S_ISREG(connPtr->fileInfo.st_mode)
                 ) {
                 Ns_Log(Debug, "FastPathProc checks [%" PRITcl_Size "] '%s' -> found",
@@ -360,6 +446,337 @@ Ns_FastPathProc(const void *UNUSED(arg), Ns_Conn *conn)
 }
 
 
+/*
+ *----------------------------------------------------------------------
+ *
+ * NsFastPathDriver --
+ *
+ *      Try to deliver a static file directly from the driver thread,
+ *      without queuing the request to a connection pool. This is only
+ *      done for GET and HEAD requests to URLs below one of the prefixes
+ *      configured via "driverurls", when the request would be handled by
+ *      Ns_FastPathProc() anyway, and no filters, authorization callbacks,
+ *      custom url2file or serverroot procs are involved. The decision,
+ *      whether the request can be handled here, is conservative:
+ *      everything special (ranges, entity tags, compressed delivery,
+ *      directories, missing files, ...) is left to the connection
+ *      threads.
+ *
+ * Results:
+ *      NS_TRUE, when the request was answered and the socket was handed
+ *      to the writer or back for closing or keep-alive.
+ *
+ * Side effects:
+ *      Sends the response to the client and writes the access log entry.
+ *
+ *----------------------------------------------------------------------
+ */
+
+bool
+NsFastPathDriver(Sock *sockPtr)
+{
+    static const char *const skipHeaders[] = {
+        "authorization", "range", "if-range", "if-match", "if-none-match",
+        "if-unmodified-since", "transfer-encoding", NULL
+    };
+    NsServer         *servPtr;
+    const Request    *reqPtr;
+    const Ns_Request *requestPtr;
+    bool              isHead, success = NS_FALSE;
+    size_t            i;
+
+    NS_NONNULL_ASSERT(sockPtr != NULL);
+
+    servPtr = sockPtr->servPtr;
+    reqPtr = sockPtr->reqPtr;
+    if (servPtr == NULL
+        || servPtr->fastpath.driverc == 0
+        || reqPtr == NULL
+        || sockPtr->h2ConnPtr != NULL
+        || sockPtr->h2StreamPtr != NULL
+        || sockPtr->drvPtr->requestProc != NULL
+        || servPtr->pools.shutdown
+        ) {
+        return NS_FALSE;
+    }
+
+    requestPtr = &reqPtr->request;
+    if (requestPtr->method == NULL
+        || requestPtr->url == NULL
+        || requestPtr->version < 1.0
+        || reqPtr->length > 0u
+        || reqPtr->contentLength > 0u
+        || !DriverUrl(servPtr, requestPtr->url)
+        ) {
+        return NS_FALSE;
+    }
+
+    isHead = STREQ(requestPtr->method, "HEAD");
+    if (!isHead && !STREQ(requestPtr->method, "GET")) {
+        return NS_FALSE;
+    }
+
+    for (i = 0u; skipHeaders[i] != NULL; i++) {
+        if (Ns_SetIGet(reqPtr->headers, skipHeaders[i]) != NULL) {
+            return NS_FALSE;
+        }
+    }
+    if ((useGzip || useBrotli || useZstd)
+        && Ns_SetIGet(reqPtr->headers, "accept-encoding") != NULL) {
+        return NS_FALSE;
+    }
+
+    if (servPtr->request.firstRequestAuthPtr == NULL
+        && !NsFiltersMatch(servPtr, requestPtr->method, requestPtr->url)
+        ) {
+        NsUrlSpaceContext ctx;
+        Ns_OpProc        *proc;
+        Ns_Callback      *deleteCallback;
+        void             *arg;
+        unsigned int      flags;
+
+        NsUrlSpaceContextInit(&ctx, sockPtr, reqPtr->headers);
+        NsGetRequest2(servPtr, requestPtr->method, requestPtr->url,
+                      0u, NS_URLSPACE_DEFAULT, NsUrlSpaceContextFilterEval, &ctx,
+                      &proc, &deleteCallback, &arg, &flags);
+
+        if (proc == Ns_FastPathProc) {
+            Tcl_DString ds;
+            struct stat st;
+
+            Tcl_DStringInit(&ds);
+            if (NsUrlToFileDriver(&ds, servPtr, Ns_SetIGet(reqPtr->headers, "host"), requestPtr->url)
+                && NsStatCached(ds.string, &st)
+                && S_ISREG(st.st_mode)
+                ) {
+                success = DriverReturnFile(sockPtr, ds.string, &st, isHead);
+            }
+            Tcl_DStringFree(&ds);
+        }
+    }
+
+    return success;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * DriverUrl --
+ *
+ *      Check, if the URL is below one of the URL prefixes configured for
+ *      delivery via the driver.
+ *
+ * Results:
+ *      Boolean value.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static bool
+DriverUrl(const NsServer *servPtr, const char *url)
+{
+    TCL_SIZE_T i;
+    bool       result = NS_FALSE;
+
+    for (i = 0; i < servPtr->fastpath.driverc; i++) {
+        const char *prefix = servPtr->fastpath.driverv[i];
+        size_t      prefixLength = strlen(prefix);
+
+        while (prefixLength > 0u && prefix[prefixLength - 1u] == '/') {
+            prefixLength--;
+        }
+        if (strncmp(url, prefix, prefixLength) == 0
+            && (url[prefixLength] == '/' || url[prefixLength] == '\0')
+            ) {
+            result = NS_TRUE;
+            break;
+        }
+    }
+    return result;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * DriverReturnFile --
+ *
+ *      Answer a request for a regular file from the driver thread. The
+ *      driver thread sends only what the socket accepts without blocking
+ *      (e.g. the header of HEAD requests and "304 Not Modified"
+ *      responses); the remainder and the file content are delivered via
+ *      the writer thread.
+ *
+ * Results:
+ *      NS_TRUE, when the request was answered; NS_FALSE, when the request
+ *      has to be passed to the connection threads.
+ *
+ * Side effects:
+ *      Sends the response to the client and writes the access log entry.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static bool
+DriverReturnFile(Sock *sockPtr, const char *fileName, const struct stat *stPtr, bool isHead)
+{
+    NsServer   *servPtr = sockPtr->servPtr;
+    ConnPool   *poolPtr;
+    Tcl_DString ds;
+    const char *since;
+    size_t      length = (size_t)stPtr->st_size;
+    int         statusCode = 200, fd = NS_INVALID_FD;
+    bool        keep;
+
+    /*
+     * Without writer threads, the response would have to be sent by the
+     * driver thread itself, which must not block. Leave this to the
+     * connection threads.
+     */
+    if (sockPtr->drvPtr->writer.threads == 0) {
+        return NS_FALSE;
+    }
+
+    since = Ns_SetIGet(sockPtr->reqPtr->headers, "if-modified-since");
+    if (servPtr->opts.modsince
+        && since != NULL
+        && Ns_ParseHttpTime(since) >= stPtr->st_mtime
+        ) {
+        statusCode = 304;
+        length = 0u;
+
+    } else if (!isHead) {
+        fd = ns_open(fileName, O_RDONLY | O_BINARY | O_CLOEXEC, 0);
+        if (fd == NS_INVALID_FD) {
+            return NS_FALSE;
+        }
+    }
+
+    poolPtr = NsPoolLookup(sockPtr);
+    if (poolPtr == NULL) {
+        poolPtr = servPtr->pools.defaultPtr;
+    }
+    keep = NsSockKeepAlive(sockPtr, length);
+
+    Tcl_DStringInit(&ds);
+    Ns_DStringPrintf(&ds, "HTTP/%.1f %d %s\r\n",
+                     MIN(sockPtr->reqPtr->request.version, 1.1),
+                     statusCode, NsHttpStatusPhrase(statusCode));
+    if (!servPtr->opts.stealthmode) {
+        Ns_DStringVarAppend(&ds, "Server: ", Ns_InfoServerName(), "/", Ns_InfoServerVersion(), "\r\n",
+                            NS_SENTINEL);
+    }
+    Tcl_DStringAppend(&ds, "Date: ", 6);
+    (void)Ns_HttpTime(&ds, NULL);
+    Tcl_DStringAppend(&ds, "\r\nlast-modified: ", 17);
+    (void)Ns_HttpTime(&ds, &stPtr->st_mtime);
+    Tcl_DStringAppend(&ds, "\r\n", 2);
+    if (statusCode == 200) {
+        Ns_DStringPrintf(&ds, "content-type: %s\r\ncontent-length: %" PRIdz "\r\n",
+                         Ns_GetMimeType(fileName), length);
+    }
+    DriverAppendHeaders(&ds, servPtr->opts.extraHeaders, NULL);
+    DriverAppendHeaders(&ds, sockPtr->drvPtr->extraHeaders, servPtr->opts.extraHeaders);
+    Ns_DStringPrintf(&ds, "connection: %s\r\n\r\n", keep ? "keep-alive" : "close");
+
+    /*
+     * Keep the statistics and the access log consistent with requests
+     * processed by the connection threads. The log entry has to be written
+     * before the writer thread takes over the socket.
+     */
+    sockPtr->drvPtr->stats.received++;
+    sockPtr->drvPtr->stats.fastpath++;
+#ifdef NS_HAVE_ATOMIC_BUILTINS
+    (void) __atomic_fetch_add(&poolPtr->stats.processed, 1u, __ATOMIC_RELAXED);
+#else
+    Ns_MutexLock(&servPtr->pools.lock);
+    poolPtr->stats.processed++;
+    Ns_MutexUnlock(&servPtr->pools.lock);
+#endif
+    NsSockAccessLog(sockPtr, poolPtr, statusCode, (fd != NS_INVALID_FD) ? length : 0u);
+
+    Ns_Log(Debug, "fastpath: driver delivers '%s' status %d size %" PRIdz,
+           fileName, statusCode, length);
+
+    if (fd != NS_INVALID_FD) {
+        struct iovec header;
+
+        (void) Ns_SetVec(&header, 0, ds.string, (size_t)ds.length);
+        if (NsWriterQueueSock(sockPtr, poolPtr, &header, 1, fd, length, keep) != NS_OK) {
+            (void) ns_close(fd);
+            NsSockClose(sockPtr, (int)NS_FALSE);
+        }
+    } else {
+        struct iovec buf;
+        ssize_t      sent;
+
+        /*
+         * Send only what the socket accepts right now; the driver thread
+         * must not block on a client, which does not read.
+         */
+        (void) Ns_SetVec(&buf, 0, ds.string, (size_t)ds.length);
+        sent = NsDriverSend(sockPtr, &buf, 1, 0u);
+
+        if (sent == (ssize_t)ds.length) {
+            NsSockClose(sockPtr, (int)keep);
+        } else if (sent >= 0) {
+            (void) Ns_ResetVec(&buf, 1, (size_t)sent);
+            if (NsWriterQueueSock(sockPtr, poolPtr, &buf, 1,
+                                  NS_INVALID_FD, 0u, keep) != NS_OK) {
+                NsSockClose(sockPtr, (int)NS_FALSE);
+            }
+        } else {
+            NsSockClose(sockPtr, (int)NS_FALSE);
+        }
+        NsPoolAddBytesSent(poolPtr, (Tcl_WideInt)MAX(sent, 0));
+    }
+    Tcl_DStringFree(&ds);
+
+    return NS_TRUE;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * DriverAppendHeaders --
+ *
+ *      Append the header fields of the provided set to the response
+ *      header, unless the field is contained in otherHeaders, which have
+ *      the higher priority.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Updates the DString.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+DriverAppendHeaders(Tcl_DString *dsPtr, const Ns_Set *headers, const Ns_Set *otherHeaders)
+{
+    if (headers != NULL) {
+        size_t i;
+
+        for (i = 0u; i < Ns_SetSize(headers); i++) {
+            const char *key = Ns_SetKey(headers, i), *value = Ns_SetValue(headers, i);
+
+            if (key != NULL && value != NULL
+                && (otherHeaders == NULL || Ns_SetIFind(otherHeaders, key) == -1)
+                ) {
+                Ns_DStringVarAppend(dsPtr, key, ": ", value, "\r\n", NS_SENTINEL);
+            }
+        }
+    }
+}
+
+
 /*
  *----------------------------------------------------------------------
  *
@@ -423,7 +840,7 @@ UrlIs(const char *server, const char *url, bool isDir)
 
     Tcl_DStringInit(&ds);
     if (Ns_UrlToFile(&ds, server, url) == NS_OK
-        && stat(ds.string, &st) == 0
+        && NsStatCached(ds.string, &st)
         && ((isDir && S_ISDIR(st.st_mode))
             || (!isDir && S_ISREG(st.st_mode)))) {
         is = NS_TRUE;
@@ -562,7 +979,7 @@ CheckStaticCompressedDelivery(
     //fprintf(stderr, "=== check compressed file <%s> compressed <%s>\n", fileName, compressedFileName);
 
 
-    if (Ns_Stat(compressedFileName, &gzStat)) {
+    if (NsStatCached(compressedFileName, &gzStat)) {
         Ns_ConnCondSetHeadersSz(conn, "vary", 4, "accept-encoding", 15);
         //fprintf(stderr, "=== we have the file <%s> compressed <%s>\n", fileName, compressedFileName);
 
@@ -578,7 +995,8 @@ CheckStaticCompressedDelivery(
              * compressed file (e.g. rezip the source).
              */
             if (CompressExternalFile(Ns_GetConnInterp(conn), cmdName, fileName, compressedFileName) == TCL_OK) {
-                (void)Ns_Stat(compressedFileName, &gzStat);
+                NsStatCacheInvalidate(compressedFileName);
+                (void)NsStatCached(compressedFileName, &gzStat);
             }
         }
         if (gzStat.st_mtime >= connPtr->fileInfo.st_mtime) {
@@ -678,6 +1096,13 @@ FastReturn(Ns_Conn *conn, int statusCode, const char *mimeType, const char *file
                                                            fileName, "br", 2u);
     }
 
+    if (compressedFileName == NULL && useZstd && (connPtr->flags & NS_CONN_ZSTDACCEPTED) != 0u) {
+        Tcl_DStringSetLength(dsPtr, 0);
+        compressedFileName = CheckStaticCompressedDelivery(conn, dsPtr, useZstdRefresh,
+                                                           ".zst", "::ns_zstdfile",
+                                                           fileName, "zstd", 4u);
+    }
+
     if (compressedFileName == NULL && useGzip && (connPtr->flags & NS_CONN_ZIPACCEPTED) != 0u) {
         Tcl_DStringSetLength(dsPtr, 0);
         compressedFileName = CheckStaticCompressedDelivery(conn, dsPtr, useGzipRefresh,
@@ -702,11 +1127,38 @@ FastReturn(Ns_Conn *conn, int statusCode, const char *mimeType, const char *file
 
     /*
      * Depending on the size of the content and state of the fastpath
-     * cache, either return the data directly, or cache it first and
-     * return the cached copy.
+     * caches, either return the data directly, or cache it first and
+     * return the cached copy. Files too large for the fastpath cache are
+     * delivered from the mmap cache, when configured.
      */
 
-    if ((cache == NULL)
+    if (mmapShards != NULL
+        && (cache == NULL || connPtr->fileInfo.st_size > maxentry)
+        && connPtr->fileInfo.st_size > 0
+        && (size_t)connPtr->fileInfo.st_size <= mmapMaxEntry
+        && connPtr->fileInfo.st_ctime < (time_t)(connPtr->acceptTime.sec - 1)
+        ) {
+        MappedFile *mapPtr = MmapCacheGet(fileName, &connPtr->fileInfo);
+
+        if (mapPtr == NULL) {
+            goto notfound;
+        }
+        /*
+         * Deliver the shared region like a private mapping. The writer
+         * thread or NsMemUmap() below releases the reference instead of
+         * unmapping.
+         */
+        connPtr->fmap = mapPtr->map;
+        connPtr->fmap.releaseProc = ReleaseMapped;
+        connPtr->fmap.releaseArg = mapPtr;
+        status = Ns_ConnReturnData(conn, statusCode, connPtr->fmap.addr,
+                                   (ssize_t)connPtr->fmap.size, mimeType);
+        if ((connPtr->flags & NS_CONN_SENT_VIA_WRITER) == 0u) {
+            NsMemUmap(&connPtr->fmap);
+        }
+        connPtr->fmap.addr = NULL;
+
+    } else if ((cache == NULL)
         || (connPtr->fileInfo.st_size > maxentry)
         || (connPtr->fileInfo.st_ctime >= (time_t)(connPtr->acceptTime.sec - 1))
         ) {
@@ -956,6 +1408,220 @@ FreeEntry(void *arg)
 }
 
 
+/*
+ *----------------------------------------------------------------------
+ *
+ * MmapCacheGet --
+ *
+ *      Return the mapped region of the file from the mmap cache. The
+ *      entry is validated against the current mtime, size and inode of
+ *      the file, new or outdated entries are mapped. The caller receives
+ *      a reference, which has to be released via ReleaseMapped().
+ *
+ * Results:
+ *      Mapped file or NULL, when the file could not be mapped.
+ *
+ * Side effects:
+ *      Might map the file and evict the least recently used entries of
+ *      the shard.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static MappedFile *
+MmapCacheGet(const char *fileName, const struct stat *stPtr)
+{
+    MmapShard           *shardPtr;
+    Ns_Entry            *entry;
+    MappedFile          *mapPtr;
+    const unsigned char *p;
+    unsigned int         hash = 0u;
+    int                  isNew;
+
+    NS_NONNULL_ASSERT(fileName != NULL);
+    NS_NONNULL_ASSERT(stPtr != NULL);
+
+    for (p = (const unsigned char *)fileName; *p != UCHAR('\0'); p++) {
+        hash += (hash << 3) + *p;
+    }
+    shardPtr = &mmapShards[hash % (unsigned int)nMmapShards];
+
+    Ns_CacheLock(shardPtr->cache);
+    entry = Ns_CacheWaitCreateEntry(shardPtr->cache, fileName, &isNew, NULL);
+
+    if (isNew == 0) {
+        mapPtr = Ns_CacheGetValue(entry);
+        if (mapPtr != NULL
+            && (mapPtr->mtime != stPtr->st_mtime
+                || mapPtr->size != (size_t)stPtr->st_size
+                || mapPtr->dev  != (dev_t)stPtr->st_dev
+                || mapPtr->ino  != stPtr->st_ino)
+            ) {
+            Ns_CacheUnsetValue(entry);
+            mapPtr = NULL;
+            isNew = 1;
+        }
+    } else {
+        mapPtr = NULL;
+    }
+
+    if (isNew != 0) {
+        shardPtr->misses++;
+
+        /*
+         * Map the file without holding the lock. Concurrent requests for
+         * the same file wait in Ns_CacheWaitCreateEntry().
+         */
+        Ns_CacheUnlock(shardPtr->cache);
+        mapPtr = ns_malloc(sizeof(MappedFile));
+        mapPtr->refcnt   = 1;
+        mapPtr->size     = (size_t)stPtr->st_size;
+        mapPtr->mtime    = stPtr->st_mtime;
+        mapPtr->dev      = stPtr->st_dev;
+        mapPtr->ino      = stPtr->st_ino;
+        mapPtr->shardPtr = shardPtr;
+        if (NsMemMap(fileName, mapPtr->size, NS_MMAP_READ, &mapPtr->map) != NS_OK) {
+            ns_free(mapPtr);
+            mapPtr = NULL;
+        }
+        Ns_CacheLock(shardPtr->cache);
+        entry = Ns_CacheCreateEntry(shardPtr->cache, fileName, &isNew);
+        if (mapPtr != NULL) {
+            Ns_CacheSetValueSz(entry, mapPtr, mapPtr->size);
+        } else {
+            Ns_CacheDeleteEntry(entry);
+        }
+        Ns_CacheBroadcast(shardPtr->cache);
+    } else {
+        shardPtr->hits++;
+    }
+    if (mapPtr != NULL) {
+        ++mapPtr->refcnt;
+    }
+    Ns_CacheUnlock(shardPtr->cache);
+
+    return mapPtr;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * DecrMapped --
+ *
+ *      Decrement reference count of a mapped file, unmap it when it is
+ *      not used anymore. The caller must hold the lock of the shard.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Might unmap the file.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+DecrMapped(MappedFile *mapPtr)
+{
+    NS_NONNULL_ASSERT(mapPtr != NULL);
+
+    if (--mapPtr->refcnt == 0) {
+        NsMemUmap(&mapPtr->map);
+        ns_free(mapPtr);
+    }
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * FreeMapped, ReleaseMapped --
+ *
+ *      FreeMapped() is the cache-free callback of the mmap cache shards.
+ *      ReleaseMapped() releases the reference of a connection or writer
+ *      thread (called via NsMemUmap()).
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Might unmap the file.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+FreeMapped(void *arg)
+{
+    DecrMapped((MappedFile *)arg);
+}
+
+static void
+ReleaseMapped(void *arg)
+{
+    MappedFile *mapPtr = arg;
+    Ns_Cache   *shardCache = mapPtr->shardPtr->cache;
+
+    Ns_CacheLock(shardCache);
+    DecrMapped(mapPtr);
+    Ns_CacheUnlock(shardCache);
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * MmapCacheStats --
+ *
+ *      Append the statistics of the mmap cache summed over all shards in
+ *      form of a dict to the provided Tcl_DString.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      With "reset", the counters are set to zero.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+MmapCacheStats(Tcl_DString *dsPtr, bool reset)
+{
+    size_t        size = 0u, entries = 0u, maxSize = 0u;
+    unsigned long hits = 0u, misses = 0u;
+    int           i;
+
+    NS_NONNULL_ASSERT(dsPtr != NULL);
+
+    for (i = 0; i < nMmapShards; i++) {
+        MmapShard      *shardPtr = &mmapShards[i];
+        Ns_CacheSearch  search;
+        const Ns_Entry *entry;
+
+        Ns_CacheLock(shardPtr->cache);
+        entry = Ns_CacheFirstEntry(shardPtr->cache, &search);
+        while (entry != NULL) {
+            size += Ns_CacheGetSize(entry);
+            entries++;
+            entry = Ns_CacheNextEntry(&search);
+        }
+        maxSize += Ns_CacheGetMaxSize(shardPtr->cache);
+        hits += shardPtr->hits;
+        misses += shardPtr->misses;
+        if (reset) {
+            shardPtr->hits = shardPtr->misses = 0u;
+        }
+        Ns_CacheUnlock(shardPtr->cache);
+    }
+    Ns_DStringPrintf(dsPtr, "shards %d maxsize %" PRIuz " maxentry %" PRIuz
+                     " size %" PRIuz " entries %" PRIuz " hits %lu missed %lu hitrate %.2f",
+                     nMmapShards, maxSize, mmapMaxEntry, size, entries, hits, misses,
+                     (hits + misses) > 0u ? (double)hits * 100.0 / (double)(hits + misses) : 0.0);
+}
+
+
 
 /*
  *----------------------------------------------------------------------
@@ -965,6 +1631,7 @@ FreeEntry(void *arg)
  *      Implements "ns_fastpath_cache_stats".  The command returns
  *      stats on a cache. The size and expiry time of each entry in
  *      the cache is also appended if the -contents switch is given.
+ *      With -mmap, the stats of the mmap cache are returned.
  *
  * Results:
  *      Tcl result.
@@ -977,9 +1644,10 @@ FreeEntry(void *arg)
 int
 NsTclFastPathCacheStatsObjCmd(ClientData UNUSED(clientData), Tcl_Interp *interp, TCL_SIZE_T objc, Tcl_Obj *const* objv)
 {
-    int         contents = (int)NS_FALSE, reset = (int)NS_FALSE, result = TCL_OK;
+    int         contents = (int)NS_FALSE, mmapStats = (int)NS_FALSE, reset = (int)NS_FALSE, result = TCL_OK;
     Ns_ObjvSpec opts[] = {
         {"-contents", Ns_ObjvBool,  &contents, INT2PTR(NS_TRUE)},
+        {"-mmap",     Ns_ObjvBool,  &mmapStats, INT2PTR(NS_TRUE)},
         {"-reset",    Ns_ObjvBool,  &reset,    INT2PTR(NS_TRUE)},
         {NULL, NULL, NULL, NULL}
     };
@@ -987,6 +1655,15 @@ NsTclFastPathCacheStatsObjCmd(ClientData UNUSED(clientData), Tcl_Interp *interp,
     if (Ns_ParseObjv(opts, NULL, interp, 1, objc, objv) != NS_OK) {
         result = TCL_ERROR;
 
+    } else if (mmapStats != 0) {
+        if (mmapShards != NULL) {
+            Tcl_DString ds;
+
+            Tcl_DStringInit(&ds);
+            MmapCacheStats(&ds, (reset != 0));
+            Tcl_DStringResult(interp, &ds);
+        }
+
     } else if (cache != NULL) {
         Tcl_DString     ds;
         Ns_CacheSearch  search;
@@ -305,6 +305,48 @@ NsRunFilters(Ns_Conn *conn, Ns_FilterType why)
 }
 
 
+/*
+ *----------------------------------------------------------------------
+ * NsFiltersMatch --
+ *
+ *      Check, whether any filter (pre-auth, post-auth or trace) might
+ *      apply to the given method and URL. Context constraints of the
+ *      filters are not evaluated, so the result is conservative.
+ *
+ * Results:
+ *      NS_TRUE if a filter matches, NS_FALSE otherwise.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+bool
+NsFiltersMatch(NsServer *servPtr, const char *method, const char *url)
+{
+    const Filter *fPtr;
+    bool          result = NS_FALSE;
+
+    NS_NONNULL_ASSERT(servPtr != NULL);
+    NS_NONNULL_ASSERT(method != NULL);
+    NS_NONNULL_ASSERT(url != NULL);
+
+    FilterLock(servPtr, NS_READ);
+    for (fPtr = servPtr->filter.firstFilterPtr; fPtr != NULL; fPtr = fPtr->nextPtr) {
+        if ((Tcl_StringMatch(method, fPtr->method) != 0)
+            && (Tcl_StringMatch(url, fPtr->url) != 0)
+            ) {
+            result = NS_TRUE;
+            break;
+        }
+    }
+    FilterUnlock(servPtr);
+
+    return result;
+}
+
+
 /*
  *----------------------------------------------------------------------
  * Ns_RegisterServerTrace --
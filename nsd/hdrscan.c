@@ -0,0 +1,473 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ *
+ */
+
+/*
+ * hdrscan.c --
+ *
+ *      Tokenizer for the request line and header lines of HTTP/1.x
+ *      requests as used by the driver. A single pass over the receive
+ *      buffer determines the end of the line, the first colon (the
+ *      separator of field name and field value) and the first byte not
+ *      permitted in a header line (control characters except HTAB, DEL
+ *      and bare CR, see RFC 9110 section 5.5 and RFC 9112 section 2.2).
+ *
+ *      The buffer is processed 16 bytes (SSE2, NEON) or 32 bytes (AVX2)
+ *      at a time. The AVX2 variant is selected at startup when the CPU
+ *      supports it; on other platforms a scalar implementation is used.
+ */
+
+#include "nsd.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__SSE2__))
+# define NS_HDRSCAN_SSE2 1
+# include <emmintrin.h>
+#elif defined(__GNUC__) && (defined(__ARM_NEON) || defined(__ARM_NEON__)) && defined(__aarch64__)
+# define NS_HDRSCAN_NEON 1
+# include <arm_neon.h>
+#endif
+
+#if defined(NS_HDRSCAN_SSE2) && defined(__x86_64__) && (defined(__clang__) || (__GNUC__ >= 5))
+# define NS_HDRSCAN_AVX2 1
+# include <immintrin.h>
+#endif
+
+/*
+ * Character classes of the scalar tokenizer.
+ */
+#define HS_NEWLINE 0x01u
+#define HS_COLON   0x02u
+#define HS_INVALID 0x04u
+
+typedef char *(HeaderScanProc)(char *line, size_t length, NsHeaderScan *scanPtr);
+
+/*
+ * Local functions defined in this file
+ */
+
+static char *ScanScalar(char *p, const char *end, NsHeaderScan *scanPtr)
+    NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(2) NS_GNUC_NONNULL(3);
+
+static HeaderScanProc ScanGeneric;
+
+#if defined(NS_HDRSCAN_SSE2) || defined(NS_HDRSCAN_NEON)
+static NS_INLINE char *ScanBlock(char *p, uint64_t newlineMask, uint64_t colonMask, uint64_t invalidMask,
+                                  unsigned int shift, NsHeaderScan *scanPtr)
+    NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(6);
+#endif
+
+#ifdef NS_HDRSCAN_SSE2
+static HeaderScanProc ScanSSE2;
+#endif
+#ifdef NS_HDRSCAN_AVX2
+static HeaderScanProc ScanAVX2;
+#endif
+#ifdef NS_HDRSCAN_NEON
+static HeaderScanProc ScanNEON;
+#endif
+
+/*
+ * Static variables defined in this file
+ */
+
+static unsigned char charClass[256];
+static HeaderScanProc *scanProc = ScanGeneric;
+static const char *scanName = "scalar";
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * NsInitHeaderScan --
+ *
+ *      Initialize the character classes of the scalar tokenizer and
+ *      select the fastest implementation supported by the CPU.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+NsInitHeaderScan(void)
+{
+    unsigned int c;
+
+    for (c = 0u; c < 0x20u; c++) {
+        charClass[c] = HS_INVALID;
+    }
+    charClass[0x7fu] = HS_INVALID;
+    charClass[UCHAR('\t')] = 0u;
+    charClass[UCHAR('\n')] = HS_NEWLINE;
+    charClass[UCHAR(':')] = HS_COLON;
+
+#if defined(NS_HDRSCAN_SSE2)
+    scanProc = ScanSSE2;
+    scanName = "sse2";
+#elif defined(NS_HDRSCAN_NEON)
+    scanProc = ScanNEON;
+    scanName = "neon";
+#endif
+#ifdef NS_HDRSCAN_AVX2
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        scanProc = ScanAVX2;
+        scanName = "avx2";
+    }
+#endif
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * NsHeaderScanName --
+ *
+ *      Return the name of the active tokenizer implementation.
+ *
+ * Results:
+ *      "avx2", "sse2", "neon" or "scalar".
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+const char *
+NsHeaderScanName(void)
+{
+    return scanName;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * NsHeaderScanLine --
+ *
+ *      Scan a request line or header line starting at "line" for at most
+ *      "length" bytes.
+ *
+ * Results:
+ *      Pointer to the terminating newline character or NULL, when the
+ *      buffer does not contain a newline. When a newline was found,
+ *      scanPtr->colon points to the first colon of the line (or is NULL)
+ *      and scanPtr->invalid points to the first invalid byte of the line
+ *      (or is NULL). A CR directly preceding the newline is not invalid.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+char *
+NsHeaderScanLine(char *line, size_t length, NsHeaderScan *scanPtr)
+{
+    char *newline;
+
+    NS_NONNULL_ASSERT(line != NULL);
+    NS_NONNULL_ASSERT(scanPtr != NULL);
+
+    scanPtr->colon = NULL;
+    scanPtr->invalid = NULL;
+
+    newline = (*scanProc)(line, length, scanPtr);
+    if (newline != NULL
+        && scanPtr->invalid == newline - 1
+        && *scanPtr->invalid == '\r') {
+        scanPtr->invalid = NULL;
+    }
+    return newline;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * ScanScalar, ScanGeneric --
+ *
+ *      Byte-wise tokenizer. ScanScalar() is used as well for the tail of
+ *      the buffer by the vectorized implementations.
+ *
+ * Results:
+ *      Pointer to the newline or NULL.
+ *
+ * Side effects:
+ *      Updates the first colon and invalid byte in scanPtr.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static char *
+ScanScalar(char *p, const char *end, NsHeaderScan *scanPtr)
+{
+    for (; p < end; p++) {
+        unsigned int cls = charClass[UCHAR(*p)];
+
+        if (likely(cls == 0u)) {
+            continue;
+        }
+        if (cls == HS_NEWLINE) {
+            return p;
+        }
+        if (cls == HS_COLON) {
+            if (scanPtr->colon == NULL) {
+                scanPtr->colon = p;
+            }
+        } else if (scanPtr->invalid == NULL) {
+            scanPtr->invalid = p;
+        }
+    }
+    return NULL;
+}
+
+static char *
+ScanGeneric(char *line, size_t length, NsHeaderScan *scanPtr)
+{
+    return ScanScalar(line, line + length, scanPtr);
+}
+
+
+#if defined(NS_HDRSCAN_SSE2) || defined(NS_HDRSCAN_NEON)
+/*
+ *----------------------------------------------------------------------
+ *
+ * ScanBlock --
+ *
+ *      Evaluate the match masks of one block. Each byte of the block is
+ *      represented by (1 << shift) bits of the masks.
+ *
+ * Results:
+ *      Pointer to the newline or NULL, when the block contains no newline.
+ *
+ * Side effects:
+ *      Updates the first colon and invalid byte in scanPtr.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static NS_INLINE char *
+ScanBlock(char *p, uint64_t newlineMask, uint64_t colonMask, uint64_t invalidMask,
+          unsigned int shift, NsHeaderScan *scanPtr)
+{
+    if (newlineMask != 0u) {
+        /*
+         * Consider only the bytes before the newline.
+         */
+        uint64_t before = (newlineMask & (~newlineMask + 1u)) - 1u;
+
+        colonMask &= before;
+        invalidMask &= before;
+    }
+    if (colonMask != 0u && scanPtr->colon == NULL) {
+        scanPtr->colon = p + ((unsigned int)__builtin_ctzll(colonMask) >> shift);
+    }
+    if (invalidMask != 0u && scanPtr->invalid == NULL) {
+        scanPtr->invalid = p + ((unsigned int)__builtin_ctzll(invalidMask) >> shift);
+    }
+    return (newlineMask != 0u)
+        ? p + ((unsigned int)__builtin_ctzll(newlineMask) >> shift)
+        : NULL;
+}
+#endif
+
+
+#ifdef NS_HDRSCAN_SSE2
+/*
+ *----------------------------------------------------------------------
+ *
+ * ScanSSE2 --
+ *
+ *      Tokenizer processing 16 bytes per iteration with SSE2.
+ *
+ * Results:
+ *      Pointer to the newline or NULL.
+ *
+ * Side effects:
+ *      Updates the first colon and invalid byte in scanPtr.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static char *
+ScanSSE2(char *line, size_t length, NsHeaderScan *scanPtr)
+{
+    const __m128i newline = _mm_set1_epi8('\n');
+    const __m128i colon   = _mm_set1_epi8(':');
+    const __m128i tab     = _mm_set1_epi8('\t');
+    const __m128i del     = _mm_set1_epi8(0x7f);
+    const __m128i ctl     = _mm_set1_epi8(0x1f);
+    char         *p = line;
+    const char   *end = line + length;
+
+    while ((size_t)(end - p) >= 16u) {
+        __m128i  v = _mm_loadu_si128((const __m128i *)(const void *)p);
+        __m128i  isNewline = _mm_cmpeq_epi8(v, newline);
+        __m128i  isInvalid = _mm_cmpeq_epi8(_mm_min_epu8(v, ctl), v);
+        uint64_t newlineMask, colonMask, invalidMask;
+
+        isInvalid = _mm_or_si128(_mm_andnot_si128(_mm_or_si128(isNewline, _mm_cmpeq_epi8(v, tab)),
+                                                  isInvalid),
+                                 _mm_cmpeq_epi8(v, del));
+
+        newlineMask = (uint64_t)(unsigned int)_mm_movemask_epi8(isNewline);
+        colonMask   = (uint64_t)(unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(v, colon));
+        invalidMask = (uint64_t)(unsigned int)_mm_movemask_epi8(isInvalid);
+
+        if ((newlineMask | colonMask | invalidMask) != 0u) {
+            char *e = ScanBlock(p, newlineMask, colonMask, invalidMask, 0u, scanPtr);
+
+            if (e != NULL) {
+                return e;
+            }
+        }
+        p += 16;
+    }
+    return ScanScalar(p, end, scanPtr);
+}
+#endif
+
+
+#ifdef NS_HDRSCAN_AVX2
+/*
+ *----------------------------------------------------------------------
+ *
+ * ScanAVX2 --
+ *
+ *      Tokenizer processing 32 bytes per iteration with AVX2. The
+ *      function is compiled for AVX2 independent of the compiler flags
+ *      and used only when the CPU supports it.
+ *
+ * Results:
+ *      Pointer to the newline or NULL.
+ *
+ * Side effects:
+ *      Updates the first colon and invalid byte in scanPtr.
+ *
+ *----------------------------------------------------------------------
+ */
+
+__attribute__((target("avx2")))
+static char *
+ScanAVX2(char *line, size_t length, NsHeaderScan *scanPtr)
+{
+    const __m256i newline = _mm256_set1_epi8('\n');
+    const __m256i colon   = _mm256_set1_epi8(':');
+    const __m256i tab     = _mm256_set1_epi8('\t');
+    const __m256i del     = _mm256_set1_epi8(0x7f);
+    const __m256i ctl     = _mm256_set1_epi8(0x1f);
+    char         *p = line;
+    const char   *end = line + length;
+
+    while ((size_t)(end - p) >= 32u) {
+        __m256i  v = _mm256_loadu_si256((const __m256i *)(const void *)p);
+        __m256i  isNewline = _mm256_cmpeq_epi8(v, newline);
+        __m256i  isInvalid = _mm256_cmpeq_epi8(_mm256_min_epu8(v, ctl), v);
+        uint64_t newlineMask, colonMask, invalidMask;
+
+        isInvalid = _mm256_or_si256(_mm256_andnot_si256(_mm256_or_si256(isNewline, _mm256_cmpeq_epi8(v, tab)),
+                                                        isInvalid),
+                                    _mm256_cmpeq_epi8(v, del));
+
+        newlineMask = (uint64_t)(uint32_t)_mm256_movemask_epi8(isNewline);
+        colonMask   = (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, colon));
+        invalidMask = (uint64_t)(uint32_t)_mm256_movemask_epi8(isInvalid);
+
+        if ((newlineMask | colonMask | invalidMask) != 0u) {
+            char *e = ScanBlock(p, newlineMask, colonMask, invalidMask, 0u, scanPtr);
+
+            if (e != NULL) {
+                _mm256_zeroupper();
+                return e;
+            }
+        }
+        p += 32;
+    }
+
+    /*
+     * Clear the upper halves of the YMM registers before continuing with
+     * (or returning to) legacy SSE code to avoid state transition
+     * penalties.
+     */
+    _mm256_zeroupper();
+    return ScanSSE2(p, (size_t)(end - p), scanPtr);
+}
+#endif
+
+
+#ifdef NS_HDRSCAN_NEON
+/*
+ *----------------------------------------------------------------------
+ *
+ * ScanNEON --
+ *
+ *      Tokenizer processing 16 bytes per iteration with NEON. Since NEON
+ *      has no movemask operation, the comparison results are narrowed to
+ *      64-bit masks with 4 bits per byte.
+ *
+ * Results:
+ *      Pointer to the newline or NULL.
+ *
+ * Side effects:
+ *      Updates the first colon and invalid byte in scanPtr.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static NS_INLINE uint64_t
+NeonMask(uint8x16_t v)
+{
+    return vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(v), 4)), 0);
+}
+
+static char *
+ScanNEON(char *line, size_t length, NsHeaderScan *scanPtr)
+{
+    const uint8x16_t newline = vdupq_n_u8(UCHAR('\n'));
+    const uint8x16_t colon   = vdupq_n_u8(UCHAR(':'));
+    const uint8x16_t tab     = vdupq_n_u8(UCHAR('\t'));
+    const uint8x16_t del     = vdupq_n_u8(0x7fu);
+    const uint8x16_t ctl     = vdupq_n_u8(0x1fu);
+    char            *p = line;
+    const char      *end = line + length;
+
+    while ((size_t)(end - p) >= 16u) {
+        uint8x16_t v = vld1q_u8((const uint8_t *)p);
+        uint8x16_t isNewline = vceqq_u8(v, newline);
+        uint8x16_t isInvalid = vorrq_u8(vbicq_u8(vcleq_u8(v, ctl),
+                                                 vorrq_u8(isNewline, vceqq_u8(v, tab))),
+                                        vceqq_u8(v, del));
+        uint64_t   newlineMask = NeonMask(isNewline);
+        uint64_t   colonMask   = NeonMask(vceqq_u8(v, colon));
+        uint64_t   invalidMask = NeonMask(isInvalid);
+
+        if ((newlineMask | colonMask | invalidMask) != 0u) {
+            char *e = ScanBlock(p, newlineMask, colonMask, invalidMask, 2u, scanPtr);
+
+            if (e != NULL) {
+                return e;
+            }
+        }
+        p += 16;
+    }
+    return ScanScalar(p, end, scanPtr);
+}
+#endif
+
+/*
+ * Local Variables:
+ * mode: c
+ * c-basic-offset: 4
+ * fill-column: 78
+ * indent-tabs-mode: nil
+ * End:
+ */
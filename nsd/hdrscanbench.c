@@ -0,0 +1,246 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ *
+ */
+
+/*
+ * hdrscanbench.c --
+ *
+ *      Microbenchmark comparing the request header tokenizer of hdrscan.c
+ *      with the previous approach of the driver (memchr() for the line
+ *      end, strchr() for the separator in Ns_ParseHeader()). The program
+ *      is not built by default, use
+ *
+ *          make -C nsd hdrscanbench
+ *          LD_LIBRARY_PATH=nsd:nsthread ./nsd/hdrscanbench ?iterations?
+ */
+
+#include "nsd.h"
+
+/*
+ * Local functions defined in this file
+ */
+
+static size_t TokenizeLegacy(char *buffer, size_t length);
+static size_t TokenizeScan(char *buffer, size_t length);
+static void   ParseLegacy(char *buffer, size_t length, Ns_Set *set);
+static void   ParseScan(char *buffer, size_t length, Ns_Set *set);
+static void   Report(const char *label, const Ns_Time *startPtr, long iterations, size_t bytes);
+
+/*
+ * Typical request of a browser.
+ */
+
+static const char *const request =
+    "GET /forums/message-view?message_id=4711&return_url=%2fforums%2f HTTP/1.1\r\n"
+    "Host: www.example.com\r\n"
+    "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:131.0) Gecko/20100101 Firefox/131.0\r\n"
+    "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,*/*;q=0.8\r\n"
+    "Accept-Language: en-US,en;q=0.7,de;q=0.3\r\n"
+    "Accept-Encoding: gzip, deflate, br, zstd\r\n"
+    "Referer: https://www.example.com/forums/forum-view?forum_id=42\r\n"
+    "Connection: keep-alive\r\n"
+    "Cookie: ad_session_id=\"1234567,0,0 {830 1729100000 C3B1D8F87E6F2A71}\"; "
+    "ad_user_login=\"1234567,1729000000,3A44F0 {830 0 9C3A0D1E2F}\"\r\n"
+    "Upgrade-Insecure-Requests: 1\r\n"
+    "Sec-Fetch-Dest: document\r\n"
+    "Sec-Fetch-Mode: navigate\r\n"
+    "Sec-Fetch-Site: same-origin\r\n"
+    "Sec-Fetch-User: ?1\r\n"
+    "Priority: u=0, i\r\n"
+    "\r\n";
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * TokenizeLegacy, TokenizeScan --
+ *
+ *      Determine line ends and field separators of all header lines.
+ *
+ * Results:
+ *      Sum of the separator offsets (to keep the work observable).
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static size_t
+TokenizeLegacy(char *buffer, size_t length)
+{
+    char  *s = buffer, *e;
+    size_t sum = 0u;
+
+    while ((e = memchr(s, INTCHAR('\n'), length - (size_t)(s - buffer))) != NULL && e - s > 1) {
+        const char *sep;
+
+        *e = '\0';
+        sep = strchr(s, INTCHAR(':'));
+        if (sep != NULL) {
+            sum += (size_t)(sep - s);
+        }
+        *e = '\n';
+        s = e + 1;
+    }
+    return sum;
+}
+
+static size_t
+TokenizeScan(char *buffer, size_t length)
+{
+    char        *s = buffer, *e;
+    size_t       sum = 0u;
+    NsHeaderScan scan;
+
+    while ((e = NsHeaderScanLine(s, length - (size_t)(s - buffer), &scan)) != NULL && e - s > 1) {
+        if (scan.colon != NULL) {
+            sum += (size_t)(scan.colon - s);
+        }
+        s = e + 1;
+    }
+    return sum;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * ParseLegacy, ParseScan --
+ *
+ *      Tokenize the header lines and add the fields to an Ns_Set, like
+ *      SockParse() does.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Fills the provided set.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+ParseLegacy(char *buffer, size_t length, Ns_Set *set)
+{
+    char *s = strchr(buffer, INTCHAR('\n')) + 1, *e;
+
+    while ((e = memchr(s, INTCHAR('\n'), length - (size_t)(s - buffer))) != NULL && e - s > 1) {
+        e[-1] = '\0';
+        (void) Ns_ParseHeader(set, s, NULL, Preserve, NULL);
+        e[-1] = '\r';
+        s = e + 1;
+    }
+}
+
+static void
+ParseScan(char *buffer, size_t length, Ns_Set *set)
+{
+    char        *s = strchr(buffer, INTCHAR('\n')) + 1, *e;
+    NsHeaderScan scan;
+
+    while ((e = NsHeaderScanLine(s, length - (size_t)(s - buffer), &scan)) != NULL && e - s > 1) {
+        e[-1] = '\0';
+        if (scan.colon != NULL && scan.invalid == NULL) {
+            (void) NsParseHeaderField(set, s, scan.colon, Preserve);
+        }
+        e[-1] = '\r';
+        s = e + 1;
+    }
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * Report --
+ *
+ *      Print the time per request and the throughput since startPtr.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Output to stdout.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+Report(const char *label, const Ns_Time *startPtr, long iterations, size_t bytes)
+{
+    Ns_Time now, diff;
+    double  seconds;
+
+    Ns_GetTime(&now);
+    (void) Ns_DiffTime(&now, startPtr, &diff);
+    seconds = (double)diff.sec + (double)diff.usec / 1000000.0;
+
+    printf("%-28s %8.1f ns/request %8.1f MB/s\n", label,
+           seconds * 1e9 / (double)iterations,
+           (double)bytes * (double)iterations / seconds / 1e6);
+}
+
+
+int
+main(int argc, char *const*argv)
+{
+    long    i, iterations = 2000000;
+    size_t  length = strlen(request), sum = 0u;
+    char   *buffer;
+    Ns_Set *set;
+    Ns_Time start;
+
+    if (argc > 1) {
+        iterations = strtol(argv[1], NULL, 10);
+    }
+    Tcl_FindExecutable(argv[0]);
+    Nsd_LibInit();
+    buffer = ns_strdup(request);
+    set = Ns_SetCreate(NS_SET_NAME_REQUEST);
+    printf("request of %" PRIuz " bytes, %ld iterations, tokenizer %s\n",
+           length, iterations, NsHeaderScanName());
+
+    Ns_GetTime(&start);
+    for (i = 0; i < iterations; i++) {
+        sum += TokenizeLegacy(buffer, length);
+    }
+    Report("tokenize memchr/strchr", &start, iterations, length);
+
+    Ns_GetTime(&start);
+    for (i = 0; i < iterations; i++) {
+        sum -= TokenizeScan(buffer, length);
+    }
+    Report("tokenize NsHeaderScanLine", &start, iterations, length);
+
+    Ns_GetTime(&start);
+    for (i = 0; i < iterations; i++) {
+        ParseLegacy(buffer, length, set);
+        Ns_SetTrunc(set, 0u);
+    }
+    Report("parse Ns_ParseHeader", &start, iterations, length);
+
+    Ns_GetTime(&start);
+    for (i = 0; i < iterations; i++) {
+        ParseScan(buffer, length, set);
+        Ns_SetTrunc(set, 0u);
+    }
+    Report("parse NsHeaderScanLine", &start, iterations, length);
+
+    Ns_SetFree(set);
+    ns_free(buffer);
+
+    return (sum == 0u) ? 0 : 1;
+}
+
+/*
+ * Local Variables:
+ * mode: c
+ * c-basic-offset: 4
+ * fill-column: 78
+ * indent-tabs-mode: nil
+ * End:
+ */
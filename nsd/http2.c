@@ -0,0 +1,1717 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ *
+ */
+
+
+/*
+ * http2.c --
+ *
+ *      HTTP/2 protocol engine of the driver. The framing, HPACK header
+ *      compression, stream multiplexing and flow control are handled by
+ *      nghttp2. Every stream is converted into an HTTP/1-style request,
+ *      which is parsed and queued by the driver as an ordinary Sock with
+ *      its own Request. The connection threads write HTTP/1-style replies
+ *      into the stream Sock; the header block is converted into an HTTP/2
+ *      HEADERS frame and the body is sent in DATA frames over the socket
+ *      of the connection.
+ *
+ *      All operations on the nghttp2 session and on the connection socket
+ *      are performed under the lock of the NsHttp2Conn structure, since
+ *      the driver thread (reading) and multiple connection threads
+ *      (sending) use the same session concurrently. The socket is
+ *      nonblocking; output not accepted by the kernel is kept in a pending
+ *      buffer, and the driver thread is asked to poll for writability.
+ */
+
+#include "nsd.h"
+
+static const char http2Preface[] = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+
+#ifdef HAVE_NGHTTP2
+
+#include <nghttp2/nghttp2.h>
+
+/*
+ * Starting with nghttp2 1.60, the functions using ssize_t are deprecated
+ * in favor of the variants using nghttp2_ssize.
+ */
+#if NGHTTP2_VERSION_NUM >= 0x013c00
+typedef nghttp2_ssize          H2Size;
+typedef nghttp2_data_provider2 H2DataProvider;
+# define H2SessionMemRecv      nghttp2_session_mem_recv2
+# define H2SessionMemSend      nghttp2_session_mem_send2
+# define H2SubmitResponse      nghttp2_submit_response2
+#else
+typedef ssize_t                H2Size;
+typedef nghttp2_data_provider  H2DataProvider;
+# define H2SessionMemRecv      nghttp2_session_mem_recv
+# define H2SessionMemSend      nghttp2_session_mem_send
+# define H2SubmitResponse      nghttp2_submit_response
+#endif
+
+/*
+ * Flags of an NsHttp2Stream. A stream is freed, when none of the flags
+ * OPEN, ATTACHED and QUEUED is set.
+ */
+#define H2_STREAM_OPEN          0x001u  /* Stream is known by the nghttp2 session */
+#define H2_STREAM_ATTACHED      0x002u  /* Stream is attached to a Sock */
+#define H2_STREAM_QUEUED        0x004u  /* Stream is in the list of complete requests */
+#define H2_STREAM_HEADERS       0x008u  /* Response headers were submitted */
+#define H2_STREAM_EOF           0x010u  /* No more response data will be added */
+#define H2_STREAM_DEFERRED      0x020u  /* Data provider waits for response data */
+#define H2_STREAM_TOOLARGE      0x040u  /* Request body exceeds "maxinput" */
+#define H2_STREAM_HOST          0x080u  /* Request has a "host" header field */
+#define H2_STREAM_CLENGTH       0x100u  /* Request has a "content-length" header field */
+
+/*
+ * Response data buffered per stream, before a sending connection thread
+ * has to wait for the peer.
+ */
+#define H2_STREAM_HIGHWATER     65536
+
+struct NsHttp2Stream {
+    struct NsHttp2Stream *nextPtr;      /* Next stream of the connection */
+    struct NsHttp2Stream *prevPtr;      /* Previous stream of the connection */
+    struct NsHttp2Stream *readyPtr;     /* Next in list of complete requests */
+    struct NsHttp2Conn   *h2Ptr;        /* Connection of the stream */
+    int32_t               id;           /* Stream identifier */
+    unsigned int          flags;        /* H2_STREAM_* flags */
+    size_t                bodyLength;   /* Received number of body bytes */
+    char                 *method;       /* Value of ":method" */
+    char                 *path;         /* Value of ":path" */
+    char                 *authority;    /* Value of ":authority" */
+    Tcl_DString           headers;      /* Request header fields, afterwards the response header block */
+    Tcl_DString           data;         /* Request body, afterwards the response body not yet framed */
+    size_t                dataOffset;   /* Offset of unframed response data */
+};
+
+struct NsHttp2Conn {
+    Ns_Mutex              lock;         /* Protects the session and the socket */
+    Ns_Cond               cond;         /* Signaled, when response data was framed */
+    nghttp2_session      *session;      /* nghttp2 server session */
+    Sock                 *sockPtr;      /* Connection socket */
+    Driver               *drvPtr;       /* Driver of the connection */
+    struct NsHttp2Stream *firstPtr;     /* All streams of the connection */
+    struct NsHttp2Stream *readyPtr;     /* First complete request */
+    struct NsHttp2Stream *readyTailPtr; /* Last complete request */
+    Tcl_DString           pending;      /* Framed output, not yet accepted by the socket */
+    size_t                pendingOffset;/* Offset of output in pending not yet sent */
+    int                   refCount;     /* The driver plus the attached streams */
+    int                   nrStreams;    /* Number of not yet freed streams */
+    bool                  closed;       /* The session is terminated */
+};
+
+/*
+ * Local functions defined in this file
+ */
+static NsHttp2Stream *StreamNew(NsHttp2Conn *h2Ptr, int32_t id)
+    NS_GNUC_NONNULL(1) NS_GNUC_RETURNS_NONNULL;
+static void StreamRelease(NsHttp2Stream *streamPtr)
+    NS_GNUC_NONNULL(1);
+static bool ConnRelease(NsHttp2Conn *h2Ptr)
+    NS_GNUC_NONNULL(1);
+static void ConnFree(NsHttp2Conn *h2Ptr)
+    NS_GNUC_NONNULL(1);
+static Ns_ReturnCode Feed(NsHttp2Conn *h2Ptr, const char *buffer, size_t length)
+    NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(2);
+static Ns_ReturnCode Flush(NsHttp2Conn *h2Ptr)
+    NS_GNUC_NONNULL(1);
+static ssize_t SocketSend(NsHttp2Conn *h2Ptr, const char *buffer, size_t length)
+    NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(2);
+static Ns_ReturnCode AppendResponse(NsHttp2Stream *streamPtr, const char *buffer, size_t length)
+    NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(2);
+static Ns_ReturnCode SubmitResponse(NsHttp2Stream *streamPtr, size_t headerLength)
+    NS_GNUC_NONNULL(1);
+static bool SkipResponseHeader(const char *name, size_t length)
+    NS_GNUC_NONNULL(1) NS_GNUC_PURE;
+
+static int OnBeginHeaders(nghttp2_session *session, const nghttp2_frame *frame, void *userData);
+static int OnHeader(nghttp2_session *session, const nghttp2_frame *frame,
+                    const uint8_t *name, size_t namelen, const uint8_t *value, size_t valuelen,
+                    uint8_t flags, void *userData);
+static int OnDataChunkRecv(nghttp2_session *session, uint8_t flags, int32_t streamId,
+                           const uint8_t *data, size_t len, void *userData);
+static int OnFrameRecv(nghttp2_session *session, const nghttp2_frame *frame, void *userData);
+static int OnStreamClose(nghttp2_session *session, int32_t streamId, uint32_t errorCode, void *userData);
+static H2Size StreamDataRead(nghttp2_session *session, int32_t streamId, uint8_t *buf, size_t length,
+                             uint32_t *dataFlags, nghttp2_data_source *source, void *userData);
+
+#endif /* HAVE_NGHTTP2 */
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * NsHttp2Supported --
+ *
+ *      Check, whether the server was compiled with HTTP/2 support.
+ *
+ * Results:
+ *      Boolean value.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+bool
+NsHttp2Supported(void)
+{
+#ifdef HAVE_NGHTTP2
+    return NS_TRUE;
+#else
+    return NS_FALSE;
+#endif
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * NsHttp2Preface --
+ *
+ *      Check, whether the received data starts with the HTTP/2 client
+ *      connection preface. This is the case for TLS connections, where
+ *      "h2" was negotiated via ALPN, and for cleartext connections with
+ *      prior knowledge.
+ *
+ * Results:
+ *      1 when the buffer starts with the full preface, 0 when the buffer
+ *      is a prefix of the preface (more data is needed), -1 otherwise.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+int
+NsHttp2Preface(const char *buffer, size_t length)
+{
+    int result;
+
+    NS_NONNULL_ASSERT(buffer != NULL);
+
+    if (length >= NS_HTTP2_PREFACE_LENGTH) {
+        result = (memcmp(buffer, http2Preface, NS_HTTP2_PREFACE_LENGTH) == 0) ? 1 : -1;
+    } else {
+        result = (memcmp(buffer, http2Preface, length) == 0) ? 0 : -1;
+    }
+    return result;
+}
+
+#ifdef HAVE_NGHTTP2
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * NsHttp2ConnNew --
+ *
+ *      Create an HTTP/2 server session for the given connection socket
+ *      and queue the initial SETTINGS frame. The session is owned by the
+ *      driver until NsHttp2ConnClose() is called.
+ *
+ * Results:
+ *      HTTP/2 connection or NULL when the session could not be created.
+ *
+ * Side effects:
+ *      Memory allocation.
+ *
+ *----------------------------------------------------------------------
+ */
+
+NsHttp2Conn *
+NsHttp2ConnNew(Sock *sockPtr)
+{
+    NsHttp2Conn                *h2Ptr;
+    nghttp2_session_callbacks  *callbacks;
+    nghttp2_settings_entry      settings[1];
+    int                         rc;
+
+    NS_NONNULL_ASSERT(sockPtr != NULL);
+
+    h2Ptr = ns_calloc(1u, sizeof(NsHttp2Conn));
+    h2Ptr->sockPtr = sockPtr;
+    h2Ptr->drvPtr = sockPtr->drvPtr;
+    h2Ptr->refCount = 1;
+    Tcl_DStringInit(&h2Ptr->pending);
+    Ns_MutexInit(&h2Ptr->lock);
+    Ns_MutexSetName2(&h2Ptr->lock, "ns:h2", sockPtr->drvPtr->threadName);
+    Ns_CondInit(&h2Ptr->cond);
+
+    if (nghttp2_session_callbacks_new(&callbacks) != 0) {
+        ConnFree(h2Ptr);
+        return NULL;
+    }
+    nghttp2_session_callbacks_set_on_begin_headers_callback(callbacks, OnBeginHeaders);
+    nghttp2_session_callbacks_set_on_header_callback(callbacks, OnHeader);
+    nghttp2_session_callbacks_set_on_data_chunk_recv_callback(callbacks, OnDataChunkRecv);
+    nghttp2_session_callbacks_set_on_frame_recv_callback(callbacks, OnFrameRecv);
+    nghttp2_session_callbacks_set_on_stream_close_callback(callbacks, OnStreamClose);
+
+    rc = nghttp2_session_server_new(&h2Ptr->session, callbacks, h2Ptr);
+    nghttp2_session_callbacks_del(callbacks);
+
+    if (rc != 0) {
+        Ns_Log(Error, "http2: cannot create session: %s", nghttp2_strerror(rc));
+        h2Ptr->session = NULL;
+        ConnFree(h2Ptr);
+        return NULL;
+    }
+
+    settings[0].settings_id = NGHTTP2_SETTINGS_MAX_CONCURRENT_STREAMS;
+    settings[0].value = (uint32_t)sockPtr->drvPtr->http2maxstreams;
+    rc = nghttp2_submit_settings(h2Ptr->session, NGHTTP2_FLAG_NONE, settings, 1u);
+    if (rc != 0) {
+        Ns_Log(Warning, "http2: cannot submit settings: %s", nghttp2_strerror(rc));
+    }
+
+    return h2Ptr;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * NsHttp2ConnClose --
+ *
+ *      Terminate the HTTP/2 session of a connection socket, which is about
+ *      to be closed by the driver. Streams currently processed by
+ *      connection threads keep the structure alive, but their output is
+ *      discarded.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Tries to send a GOAWAY frame, wakes up waiting senders and frees
+ *      the session.
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+NsHttp2ConnClose(NsHttp2Conn *h2Ptr)
+{
+    NsHttp2Stream *streamPtr, *nextPtr;
+    bool           free;
+
+    NS_NONNULL_ASSERT(h2Ptr != NULL);
+
+    Ns_MutexLock(&h2Ptr->lock);
+    if (!h2Ptr->closed) {
+        /*
+         * Best effort; the socket is nonblocking.
+         */
+        (void)nghttp2_session_terminate_session(h2Ptr->session, NGHTTP2_NO_ERROR);
+        (void)Flush(h2Ptr);
+        h2Ptr->closed = NS_TRUE;
+    }
+    h2Ptr->sockPtr = NULL;
+    Ns_CondBroadcast(&h2Ptr->cond);
+
+    /*
+     * The session is gone, no further nghttp2 callbacks will refer to the
+     * streams.
+     */
+    for (streamPtr = h2Ptr->firstPtr; streamPtr != NULL; streamPtr = nextPtr) {
+        nextPtr = streamPtr->nextPtr;
+        streamPtr->flags &= ~(H2_STREAM_OPEN|H2_STREAM_QUEUED);
+        StreamRelease(streamPtr);
+    }
+    h2Ptr->readyPtr = h2Ptr->readyTailPtr = NULL;
+    nghttp2_session_del(h2Ptr->session);
+    h2Ptr->session = NULL;
+
+    free = ConnRelease(h2Ptr);
+    Ns_MutexUnlock(&h2Ptr->lock);
+
+    if (free) {
+        ConnFree(h2Ptr);
+    }
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * NsHttp2Read --
+ *
+ *      Process input of an HTTP/2 connection. The optionally provided
+ *      buffer (data read already by the driver) is processed first,
+ *      then the socket is read until it would block. Finally, the
+ *      produced output (e.g. SETTINGS acknowledgments, WINDOW_UPDATE
+ *      frames) is sent. Complete requests can be obtained afterwards via
+ *      NsHttp2NextRequest().
+ *
+ * Results:
+ *      NS_OK or NS_ERROR, when the connection should be closed.
+ *
+ * Side effects:
+ *      Reads from the socket, invokes the nghttp2 callbacks.
+ *
+ *----------------------------------------------------------------------
+ */
+
+Ns_ReturnCode
+NsHttp2Read(NsHttp2Conn *h2Ptr, const char *buffer, size_t length)
+{
+    Ns_ReturnCode status = NS_OK;
+
+    NS_NONNULL_ASSERT(h2Ptr != NULL);
+
+    Ns_MutexLock(&h2Ptr->lock);
+    if (h2Ptr->closed) {
+        status = NS_ERROR;
+
+    } else if (buffer != NULL && length > 0u) {
+        status = Feed(h2Ptr, buffer, length);
+    }
+
+    while (status == NS_OK) {
+        char         readBuffer[16384];
+        struct iovec iov;
+        ssize_t      n;
+        Ns_SockState sockState;
+
+        (void)Ns_SetVec(&iov, 0, readBuffer, sizeof(readBuffer));
+        n = NsDriverRecv(h2Ptr->sockPtr, &iov, 1, NULL);
+        sockState = h2Ptr->sockPtr->recvSockState;
+
+        if (n > 0) {
+            status = Feed(h2Ptr, readBuffer, (size_t)n);
+        } else if (sockState == NS_SOCK_AGAIN) {
+            break;
+        } else {
+            /*
+             * EOF or error.
+             */
+            status = NS_ERROR;
+        }
+    }
+
+    if (status == NS_OK) {
+        status = Flush(h2Ptr);
+    }
+    if (status == NS_OK
+        && nghttp2_session_want_read(h2Ptr->session) == 0
+        && nghttp2_session_want_write(h2Ptr->session) == 0
+        && h2Ptr->pending.length == 0
+        ) {
+        /*
+         * The session was terminated by GOAWAY.
+         */
+        status = NS_ERROR;
+    }
+    if (status != NS_OK) {
+        h2Ptr->closed = NS_TRUE;
+        Ns_CondBroadcast(&h2Ptr->cond);
+    }
+    Ns_MutexUnlock(&h2Ptr->lock);
+
+    return status;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * NsHttp2Flush --
+ *
+ *      Send pending output of an HTTP/2 connection, typically called by
+ *      the driver thread, when the socket became writable.
+ *
+ * Results:
+ *      NS_OK or NS_ERROR, when the connection should be closed.
+ *
+ * Side effects:
+ *      Writes to the socket.
+ *
+ *----------------------------------------------------------------------
+ */
+
+Ns_ReturnCode
+NsHttp2Flush(NsHttp2Conn *h2Ptr)
+{
+    Ns_ReturnCode status;
+
+    NS_NONNULL_ASSERT(h2Ptr != NULL);
+
+    Ns_MutexLock(&h2Ptr->lock);
+    status = Flush(h2Ptr);
+    Ns_MutexUnlock(&h2Ptr->lock);
+
+    return status;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * NsHttp2WantWrite --
+ *
+ *      Check, whether the connection has output, which was not accepted
+ *      by the socket so far.
+ *
+ * Results:
+ *      Boolean value.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+bool
+NsHttp2WantWrite(NsHttp2Conn *h2Ptr)
+{
+    bool result;
+
+    NS_NONNULL_ASSERT(h2Ptr != NULL);
+
+    Ns_MutexLock(&h2Ptr->lock);
+    result = (!h2Ptr->closed && (size_t)h2Ptr->pending.length > h2Ptr->pendingOffset);
+    Ns_MutexUnlock(&h2Ptr->lock);
+
+    return result;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * NsHttp2Busy --
+ *
+ *      Check, whether the connection has active streams or pending
+ *      output. A busy connection is not subject to the keepalive
+ *      timeout.
+ *
+ * Results:
+ *      Boolean value.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+bool
+NsHttp2Busy(NsHttp2Conn *h2Ptr)
+{
+    bool result;
+
+    NS_NONNULL_ASSERT(h2Ptr != NULL);
+
+    Ns_MutexLock(&h2Ptr->lock);
+    result = (!h2Ptr->closed
+              && (h2Ptr->nrStreams > 0
+                  || (size_t)h2Ptr->pending.length > h2Ptr->pendingOffset));
+    Ns_MutexUnlock(&h2Ptr->lock);
+
+    return result;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * NsHttp2NextRequest --
+ *
+ *      Return the next stream with a complete request. Streams reset by
+ *      the peer in the meantime are skipped. The returned stream has to
+ *      be passed to NsHttp2StreamAttach().
+ *
+ * Results:
+ *      Stream or NULL, when no complete request is available.
+ *
+ * Side effects:
+ *      The stream is marked as attached.
+ *
+ *----------------------------------------------------------------------
+ */
+
+NsHttp2Stream *
+NsHttp2NextRequest(NsHttp2Conn *h2Ptr)
+{
+    NsHttp2Stream *streamPtr;
+
+    NS_NONNULL_ASSERT(h2Ptr != NULL);
+
+    Ns_MutexLock(&h2Ptr->lock);
+    while ((streamPtr = h2Ptr->readyPtr) != NULL) {
+        h2Ptr->readyPtr = streamPtr->readyPtr;
+        if (h2Ptr->readyPtr == NULL) {
+            h2Ptr->readyTailPtr = NULL;
+        }
+        streamPtr->readyPtr = NULL;
+        streamPtr->flags &= ~H2_STREAM_QUEUED;
+
+        if ((streamPtr->flags & H2_STREAM_OPEN) != 0u) {
+            streamPtr->flags |= H2_STREAM_ATTACHED;
+            h2Ptr->refCount++;
+            break;
+        }
+        StreamRelease(streamPtr);
+    }
+    Ns_MutexUnlock(&h2Ptr->lock);
+
+    return streamPtr;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * NsHttp2StreamAttach --
+ *
+ *      Attach a stream to a fresh Sock and fill the request buffer of the
+ *      Sock with an equivalent HTTP/1-style request, such that it can be
+ *      parsed and processed like every other request. The request line
+ *      uses the protocol version "HTTP/2.0".
+ *
+ * Results:
+ *      NS_FALSE, when the request body exceeded "maxinput" and was
+ *      discarded, NS_TRUE otherwise.
+ *
+ * Side effects:
+ *      Request buffer of the Sock is filled. The buffers of the stream
+ *      are reused for the response.
+ *
+ *----------------------------------------------------------------------
+ */
+
+bool
+NsHttp2StreamAttach(NsHttp2Stream *streamPtr, Sock *sockPtr)
+{
+    NsHttp2Conn *h2Ptr;
+    Tcl_DString *bufPtr;
+    bool         success;
+
+    NS_NONNULL_ASSERT(streamPtr != NULL);
+    NS_NONNULL_ASSERT(sockPtr != NULL);
+    assert(sockPtr->reqPtr != NULL);
+
+    h2Ptr = streamPtr->h2Ptr;
+    bufPtr = &sockPtr->reqPtr->buffer;
+
+    Ns_MutexLock(&h2Ptr->lock);
+    sockPtr->h2StreamPtr = streamPtr;
+
+    Tcl_DStringSetLength(bufPtr, 0);
+    Tcl_DStringAppend(bufPtr, streamPtr->method != NULL ? streamPtr->method : "GET", TCL_INDEX_NONE);
+    Tcl_DStringAppend(bufPtr, " ", 1);
+    Tcl_DStringAppend(bufPtr, streamPtr->path != NULL ? streamPtr->path : "/", TCL_INDEX_NONE);
+    Tcl_DStringAppend(bufPtr, " HTTP/2.0\r\n", 11);
+    if (streamPtr->authority != NULL && (streamPtr->flags & H2_STREAM_HOST) == 0u) {
+        Ns_DStringVarAppend(bufPtr, "host: ", streamPtr->authority, "\r\n", NS_SENTINEL);
+    }
+    Tcl_DStringAppend(bufPtr, streamPtr->headers.string, streamPtr->headers.length);
+    if (streamPtr->bodyLength > 0u && (streamPtr->flags & H2_STREAM_CLENGTH) == 0u) {
+        Ns_DStringPrintf(bufPtr, "content-length: %" PRIuz "\r\n", streamPtr->bodyLength);
+    }
+    Tcl_DStringAppend(bufPtr, "\r\n", 2);
+
+    success = ((streamPtr->flags & H2_STREAM_TOOLARGE) == 0u);
+    if (success) {
+        Tcl_DStringAppend(bufPtr, streamPtr->data.string, streamPtr->data.length);
+    }
+
+    Tcl_DStringSetLength(&streamPtr->headers, 0);
+    Tcl_DStringFree(&streamPtr->data);
+    streamPtr->dataOffset = 0u;
+    Ns_MutexUnlock(&h2Ptr->lock);
+
+    return success;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * NsHttp2StreamClose --
+ *
+ *      Finish the response of the stream associated with the given Sock
+ *      and detach the stream. When no response header was sent, the
+ *      stream is reset.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Might send the final DATA frame, might free the stream and the
+ *      connection structure.
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+NsHttp2StreamClose(Sock *sockPtr)
+{
+    NsHttp2Stream *streamPtr;
+    NsHttp2Conn   *h2Ptr;
+    bool           free, wakeup = NS_FALSE;
+
+    NS_NONNULL_ASSERT(sockPtr != NULL);
+
+    streamPtr = sockPtr->h2StreamPtr;
+    assert(streamPtr != NULL);
+    h2Ptr = streamPtr->h2Ptr;
+
+    Ns_MutexLock(&h2Ptr->lock);
+    sockPtr->h2StreamPtr = NULL;
+    streamPtr->flags |= H2_STREAM_EOF;
+
+    if (!h2Ptr->closed && (streamPtr->flags & H2_STREAM_OPEN) != 0u) {
+        if ((streamPtr->flags & H2_STREAM_HEADERS) == 0u) {
+            Ns_Log(Notice, "http2: stream %d closed without response", streamPtr->id);
+            (void)nghttp2_submit_rst_stream(h2Ptr->session, NGHTTP2_FLAG_NONE,
+                                            streamPtr->id, NGHTTP2_INTERNAL_ERROR);
+        } else if ((streamPtr->flags & H2_STREAM_DEFERRED) != 0u) {
+            streamPtr->flags &= ~H2_STREAM_DEFERRED;
+            (void)nghttp2_session_resume_data(h2Ptr->session, streamPtr->id);
+        }
+        if (Flush(h2Ptr) == NS_OK) {
+            wakeup = ((size_t)h2Ptr->pending.length > h2Ptr->pendingOffset);
+        } else {
+            wakeup = NS_TRUE;
+        }
+    }
+    /*
+     * The stream might have been closed by the session during Flush(),
+     * it is freed here, when it is no longer attached.
+     */
+    streamPtr->flags &= ~H2_STREAM_ATTACHED;
+    StreamRelease(streamPtr);
+    free = ConnRelease(h2Ptr);
+    if (wakeup) {
+        NsWakeupDriver(h2Ptr->drvPtr);
+    }
+    Ns_MutexUnlock(&h2Ptr->lock);
+
+    if (free) {
+        ConnFree(h2Ptr);
+    }
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * NsHttp2Send --
+ *
+ *      Send an HTTP/1-style response (or a part of it) on the stream
+ *      associated with the Sock. The header block is converted into a
+ *      HEADERS frame, the rest is buffered and sent in DATA frames as
+ *      permitted by the flow control of the peer. When too much data is
+ *      buffered, the calling thread waits up to "sendwait" for the peer.
+ *
+ * Results:
+ *      Number of bytes accepted (all bytes) or -1 on error.
+ *
+ * Side effects:
+ *      Writes to the connection socket.
+ *
+ *----------------------------------------------------------------------
+ */
+
+ssize_t
+NsHttp2Send(Sock *sockPtr, const struct iovec *bufs, int nbufs)
+{
+    NsHttp2Stream *streamPtr;
+    NsHttp2Conn   *h2Ptr;
+    ssize_t        result = 0;
+    bool           wakeup = NS_FALSE;
+    int            i;
+
+    NS_NONNULL_ASSERT(sockPtr != NULL);
+
+    streamPtr = sockPtr->h2StreamPtr;
+    assert(streamPtr != NULL);
+    h2Ptr = streamPtr->h2Ptr;
+
+    Ns_MutexLock(&h2Ptr->lock);
+    for (i = 0; i < nbufs && result != -1; i++) {
+        if (h2Ptr->closed || (streamPtr->flags & H2_STREAM_OPEN) == 0u) {
+            result = -1;
+        } else if (bufs[i].iov_len > 0u) {
+            if (AppendResponse(streamPtr, bufs[i].iov_base, bufs[i].iov_len) == NS_OK) {
+                result += (ssize_t)bufs[i].iov_len;
+            } else {
+                result = -1;
+            }
+        }
+    }
+    if (!h2Ptr->closed) {
+        if (Flush(h2Ptr) == NS_OK) {
+            wakeup = ((size_t)h2Ptr->pending.length > h2Ptr->pendingOffset);
+        } else {
+            result = -1;
+            wakeup = NS_TRUE;
+        }
+        if (wakeup) {
+            NsWakeupDriver(h2Ptr->drvPtr);
+        }
+    }
+    Ns_MutexUnlock(&h2Ptr->lock);
+
+    if (result == -1) {
+        sockPtr->sendErrno = (unsigned long)ECONNRESET;
+    }
+    return result;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * NsHttp2SendFile --
+ *
+ *      Send file buffers on the stream associated with the Sock. Since
+ *      the data has to be framed, the file content is read into memory
+ *      and sent via NsHttp2Send().
+ *
+ * Results:
+ *      Number of bytes sent or -1 on error.
+ *
+ * Side effects:
+ *      Reads from the files, writes to the connection socket.
+ *
+ *----------------------------------------------------------------------
+ */
+
+ssize_t
+NsHttp2SendFile(Sock *sockPtr, const Ns_FileVec *bufs, int nbufs)
+{
+    ssize_t result = 0;
+    int     i;
+
+    NS_NONNULL_ASSERT(sockPtr != NULL);
+    NS_NONNULL_ASSERT(bufs != NULL);
+
+    for (i = 0; i < nbufs && result != -1; i++) {
+        off_t  offset = bufs[i].offset;
+        size_t toSend = bufs[i].length;
+
+        if (bufs[i].fd < 0) {
+            struct iovec iov;
+
+            if (toSend > 0u) {
+                (void)Ns_SetVec(&iov, 0, bufs[i].buffer + offset, toSend);
+                result = (NsHttp2Send(sockPtr, &iov, 1) == -1) ? -1 : result + (ssize_t)toSend;
+            }
+            continue;
+        }
+
+        while (toSend > 0u) {
+            char         buffer[16384];
+            struct iovec iov;
+            ssize_t      nread;
+
+            nread = pread(bufs[i].fd, buffer, MIN(toSend, sizeof(buffer)), offset);
+            if (nread <= 0) {
+                result = -1;
+                break;
+            }
+            (void)Ns_SetVec(&iov, 0, buffer, (size_t)nread);
+            if (NsHttp2Send(sockPtr, &iov, 1) == -1) {
+                result = -1;
+                break;
+            }
+            result += nread;
+            offset += (off_t)nread;
+            toSend -= (size_t)nread;
+        }
+    }
+
+    return result;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * StreamNew --
+ *
+ *      Allocate a stream structure and add it to the connection.
+ *
+ * Results:
+ *      Stream.
+ *
+ * Side effects:
+ *      Memory allocation.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static NsHttp2Stream *
+StreamNew(NsHttp2Conn *h2Ptr, int32_t id)
+{
+    NsHttp2Stream *streamPtr;
+
+    NS_NONNULL_ASSERT(h2Ptr != NULL);
+
+    streamPtr = ns_calloc(1u, sizeof(NsHttp2Stream));
+    streamPtr->h2Ptr = h2Ptr;
+    streamPtr->id = id;
+    streamPtr->flags = H2_STREAM_OPEN;
+    Tcl_DStringInit(&streamPtr->headers);
+    Tcl_DStringInit(&streamPtr->data);
+
+    streamPtr->nextPtr = h2Ptr->firstPtr;
+    if (h2Ptr->firstPtr != NULL) {
+        h2Ptr->firstPtr->prevPtr = streamPtr;
+    }
+    h2Ptr->firstPtr = streamPtr;
+    h2Ptr->nrStreams++;
+
+    return streamPtr;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * StreamRelease --
+ *
+ *      Free the stream, when it is neither known by the session, nor
+ *      attached to a Sock, nor waiting to be dispatched. Must be called
+ *      with the connection locked.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Might free memory.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+StreamRelease(NsHttp2Stream *streamPtr)
+{
+    NS_NONNULL_ASSERT(streamPtr != NULL);
+
+    if ((streamPtr->flags & (H2_STREAM_OPEN|H2_STREAM_ATTACHED|H2_STREAM_QUEUED)) == 0u) {
+        NsHttp2Conn *h2Ptr = streamPtr->h2Ptr;
+
+        if (streamPtr->prevPtr != NULL) {
+            streamPtr->prevPtr->nextPtr = streamPtr->nextPtr;
+        } else {
+            h2Ptr->firstPtr = streamPtr->nextPtr;
+        }
+        if (streamPtr->nextPtr != NULL) {
+            streamPtr->nextPtr->prevPtr = streamPtr->prevPtr;
+        }
+        h2Ptr->nrStreams--;
+
+        ns_free(streamPtr->method);
+        ns_free(streamPtr->path);
+        ns_free(streamPtr->authority);
+        Tcl_DStringFree(&streamPtr->headers);
+        Tcl_DStringFree(&streamPtr->data);
+        ns_free(streamPtr);
+    }
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * ConnRelease, ConnFree --
+ *
+ *      Decrement the reference count of the connection structure (with
+ *      the connection locked) and free the structure (unlocked) when
+ *      ConnRelease() returned NS_TRUE.
+ *
+ * Results:
+ *      ConnRelease returns NS_TRUE, when the structure has to be freed.
+ *
+ * Side effects:
+ *      Free memory.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static bool
+ConnRelease(NsHttp2Conn *h2Ptr)
+{
+    NS_NONNULL_ASSERT(h2Ptr != NULL);
+
+    return (--h2Ptr->refCount == 0);
+}
+
+static void
+ConnFree(NsHttp2Conn *h2Ptr)
+{
+    NS_NONNULL_ASSERT(h2Ptr != NULL);
+
+    if (h2Ptr->session != NULL) {
+        nghttp2_session_del(h2Ptr->session);
+    }
+    Tcl_DStringFree(&h2Ptr->pending);
+    Ns_CondDestroy(&h2Ptr->cond);
+    Ns_MutexDestroy(&h2Ptr->lock);
+    ns_free(h2Ptr);
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * Feed --
+ *
+ *      Pass received data to the nghttp2 session. Must be called with the
+ *      connection locked.
+ *
+ * Results:
+ *      NS_OK or NS_ERROR on protocol errors.
+ *
+ * Side effects:
+ *      Invokes the nghttp2 callbacks.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static Ns_ReturnCode
+Feed(NsHttp2Conn *h2Ptr, const char *buffer, size_t length)
+{
+    H2Size        rc;
+    Ns_ReturnCode status = NS_OK;
+
+    NS_NONNULL_ASSERT(h2Ptr != NULL);
+    NS_NONNULL_ASSERT(buffer != NULL);
+
+    rc = H2SessionMemRecv(h2Ptr->session, (const uint8_t *)buffer, length);
+    if (rc < 0) {
+        Ns_Log(Notice, "http2: cannot process input: %s", nghttp2_strerror((int)rc));
+        /*
+         * Try to tell the peer about the problem.
+         */
+        (void)Flush(h2Ptr);
+        status = NS_ERROR;
+    }
+    return status;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * SocketSend --
+ *
+ *      Write framed data to the connection socket via the driver.
+ *
+ * Results:
+ *      Number of bytes written (might be 0), or -1 on error.
+ *
+ * Side effects:
+ *      Writes to the socket.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static ssize_t
+SocketSend(NsHttp2Conn *h2Ptr, const char *buffer, size_t length)
+{
+    struct iovec iov;
+
+    NS_NONNULL_ASSERT(h2Ptr != NULL);
+    NS_NONNULL_ASSERT(buffer != NULL);
+
+    (void)Ns_SetVec(&iov, 0, buffer, length);
+    return NsDriverSend(h2Ptr->sockPtr, &iov, 1, 0u);
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * Flush --
+ *
+ *      Send the pending output and the output produced by the nghttp2
+ *      session until the socket would block. Must be called with the
+ *      connection locked.
+ *
+ * Results:
+ *      NS_OK or NS_ERROR.
+ *
+ * Side effects:
+ *      Writes to the socket, output not accepted by the socket is kept
+ *      in the pending buffer.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static Ns_ReturnCode
+Flush(NsHttp2Conn *h2Ptr)
+{
+    Ns_ReturnCode status = NS_OK;
+
+    NS_NONNULL_ASSERT(h2Ptr != NULL);
+
+    if (h2Ptr->closed) {
+        return NS_ERROR;
+    }
+
+    for (;;) {
+        const uint8_t *data;
+        H2Size         length;
+        ssize_t        sent;
+
+        if ((size_t)h2Ptr->pending.length > h2Ptr->pendingOffset) {
+            size_t toSend = (size_t)h2Ptr->pending.length - h2Ptr->pendingOffset;
+
+            sent = SocketSend(h2Ptr, h2Ptr->pending.string + h2Ptr->pendingOffset, toSend);
+            if (sent == -1) {
+                status = NS_ERROR;
+                break;
+            }
+            h2Ptr->pendingOffset += (size_t)sent;
+            if ((size_t)sent < toSend) {
+                break;
+            }
+            Tcl_DStringSetLength(&h2Ptr->pending, 0);
+            h2Ptr->pendingOffset = 0u;
+        }
+
+        length = H2SessionMemSend(h2Ptr->session, &data);
+        if (length < 0) {
+            Ns_Log(Notice, "http2: cannot produce output: %s", nghttp2_strerror((int)length));
+            status = NS_ERROR;
+            break;
+        } else if (length == 0) {
+            break;
+        }
+
+        sent = SocketSend(h2Ptr, (const char *)data, (size_t)length);
+        if (sent == -1) {
+            status = NS_ERROR;
+            break;
+        }
+        if (sent < (ssize_t)length) {
+            Tcl_DStringAppend(&h2Ptr->pending, (const char *)data + sent, (TCL_SIZE_T)(length - sent));
+            break;
+        }
+    }
+
+    if (status != NS_OK) {
+        h2Ptr->closed = NS_TRUE;
+        Ns_CondBroadcast(&h2Ptr->cond);
+    }
+    return status;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * AppendResponse --
+ *
+ *      Add response bytes written by the connection thread to the
+ *      stream. Bytes up to the end of the header block are collected and
+ *      submitted as HEADERS frame, following bytes are buffered as
+ *      response body. Must be called with the connection locked.
+ *
+ * Results:
+ *      NS_OK or NS_ERROR.
+ *
+ * Side effects:
+ *      Might wait for the peer, when the buffered data exceeds the
+ *      high water mark.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static Ns_ReturnCode
+AppendResponse(NsHttp2Stream *streamPtr, const char *buffer, size_t length)
+{
+    NsHttp2Conn  *h2Ptr;
+    Ns_ReturnCode status = NS_OK;
+
+    NS_NONNULL_ASSERT(streamPtr != NULL);
+    NS_NONNULL_ASSERT(buffer != NULL);
+
+    h2Ptr = streamPtr->h2Ptr;
+
+    if ((streamPtr->flags & H2_STREAM_HEADERS) == 0u) {
+        Tcl_DString *dsPtr = &streamPtr->headers;
+        TCL_SIZE_T   start = (dsPtr->length > 3) ? dsPtr->length - 3 : 0;
+        const char  *end;
+
+        Tcl_DStringAppend(dsPtr, buffer, (TCL_SIZE_T)length);
+        end = strstr(dsPtr->string + start, "\r\n\r\n");
+        if (end != NULL) {
+            size_t headerLength = (size_t)(end - dsPtr->string) + 4u;
+
+            /*
+             * Data after the header block belongs to the body.
+             */
+            Tcl_DStringAppend(&streamPtr->data, dsPtr->string + headerLength,
+                              dsPtr->length - (TCL_SIZE_T)headerLength);
+            status = SubmitResponse(streamPtr, headerLength);
+        }
+    } else {
+        Ns_Time timeout;
+
+        Ns_GetTime(&timeout);
+        Ns_IncrTime(&timeout, h2Ptr->drvPtr->sendwait.sec, h2Ptr->drvPtr->sendwait.usec);
+
+        while (streamPtr->data.length - (TCL_SIZE_T)streamPtr->dataOffset >= H2_STREAM_HIGHWATER
+               && !h2Ptr->closed
+               && (streamPtr->flags & H2_STREAM_OPEN) != 0u) {
+            /*
+             * Give the driver the chance to send buffered data.
+             */
+            if (Flush(h2Ptr) == NS_OK && (size_t)h2Ptr->pending.length > h2Ptr->pendingOffset) {
+                NsWakeupDriver(h2Ptr->drvPtr);
+            }
+            if (streamPtr->data.length - (TCL_SIZE_T)streamPtr->dataOffset < H2_STREAM_HIGHWATER) {
+                break;
+            }
+            if (Ns_CondTimedWait(&h2Ptr->cond, &h2Ptr->lock, &timeout) != NS_OK) {
+                Ns_Log(Notice, "http2: stream %d: timeout while waiting for the peer", streamPtr->id);
+                status = NS_ERROR;
+                break;
+            }
+        }
+        if (status == NS_OK) {
+            if (h2Ptr->closed || (streamPtr->flags & H2_STREAM_OPEN) == 0u) {
+                status = NS_ERROR;
+            } else {
+                Tcl_DStringAppend(&streamPtr->data, buffer, (TCL_SIZE_T)length);
+            }
+        }
+    }
+
+    if (status == NS_OK
+        && (streamPtr->flags & H2_STREAM_DEFERRED) != 0u
+        && streamPtr->data.length > (TCL_SIZE_T)streamPtr->dataOffset) {
+        streamPtr->flags &= ~H2_STREAM_DEFERRED;
+        (void)nghttp2_session_resume_data(h2Ptr->session, streamPtr->id);
+    }
+
+    return status;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * SkipResponseHeader --
+ *
+ *      Check, whether a response header field (with lowercase name) is
+ *      connection-specific and must not be sent via HTTP/2 (RFC 9113,
+ *      section 8.2.2).
+ *
+ * Results:
+ *      Boolean value.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static bool
+SkipResponseHeader(const char *name, size_t length)
+{
+    static const char *const skip[] = {
+        "connection", "keep-alive", "proxy-connection", "transfer-encoding", "upgrade", NULL
+    };
+    int i;
+
+    NS_NONNULL_ASSERT(name != NULL);
+
+    for (i = 0; skip[i] != NULL; i++) {
+        if (length == strlen(skip[i]) && memcmp(name, skip[i], length) == 0) {
+            return NS_TRUE;
+        }
+    }
+    return NS_FALSE;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * SubmitResponse --
+ *
+ *      Convert the collected HTTP/1-style header block into header
+ *      fields and submit the response with a data provider reading from
+ *      the response buffer of the stream. Must be called with the
+ *      connection locked.
+ *
+ * Results:
+ *      NS_OK or NS_ERROR.
+ *
+ * Side effects:
+ *      Header names are converted to lowercase in place. Informational
+ *      (1xx) header blocks are dropped.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static Ns_ReturnCode
+SubmitResponse(NsHttp2Stream *streamPtr, size_t headerLength)
+{
+    NsHttp2Conn   *h2Ptr;
+    char          *p, *lineEnd, *end, statusString[4];
+    nghttp2_nv    *nva;
+    size_t         nvlen = 0u, maxnv = 1u;
+    long           statusCode;
+    H2DataProvider provider;
+    int            rc;
+    Ns_ReturnCode  status = NS_OK;
+
+    NS_NONNULL_ASSERT(streamPtr != NULL);
+
+    h2Ptr = streamPtr->h2Ptr;
+    p = streamPtr->headers.string;
+    end = p + headerLength;
+
+    /*
+     * The status line has the form "HTTP/1.1 200 OK".
+     */
+    lineEnd = strstr(p, "\r\n");
+    p = strchr(p, INTCHAR(' '));
+    if (p == NULL || p > lineEnd) {
+        Ns_Log(Warning, "http2: stream %d: invalid response status line", streamPtr->id);
+        return NS_ERROR;
+    }
+    statusCode = strtol(p + 1, NULL, 10);
+    if (statusCode < 100 || statusCode > 999) {
+        Ns_Log(Warning, "http2: stream %d: invalid response status code", streamPtr->id);
+        return NS_ERROR;
+    }
+    if (statusCode < 200) {
+        /*
+         * Informational responses are not passed to the client. Data
+         * after the header block was moved already to the body, so move
+         * it back for the next header block.
+         */
+        Tcl_DStringSetLength(&streamPtr->headers, 0);
+        Tcl_DStringAppend(&streamPtr->headers, streamPtr->data.string, streamPtr->data.length);
+        Tcl_DStringSetLength(&streamPtr->data, 0);
+        return NS_OK;
+    }
+    snprintf(statusString, sizeof(statusString), "%ld", statusCode);
+
+    for (p = lineEnd + 2; p < end; p++) {
+        if (*p == '\n') {
+            maxnv++;
+        }
+    }
+    nva = ns_malloc(sizeof(nghttp2_nv) * maxnv);
+    nva[nvlen].name = (uint8_t *)":status";
+    nva[nvlen].namelen = 7u;
+    nva[nvlen].value = (uint8_t *)statusString;
+    nva[nvlen].valuelen = strlen(statusString);
+    nva[nvlen].flags = NGHTTP2_NV_FLAG_NONE;
+    nvlen++;
+
+    for (p = lineEnd + 2; p < end && nvlen < maxnv; p = lineEnd + 2) {
+        char *colon, *value, *q;
+
+        lineEnd = strstr(p, "\r\n");
+        if (lineEnd == NULL || lineEnd == p) {
+            break;
+        }
+        colon = memchr(p, INTCHAR(':'), (size_t)(lineEnd - p));
+        if (colon == NULL || colon == p || *p == ' ' || *p == '\t') {
+            /*
+             * Invalid header line or obsolete line folding.
+             */
+            continue;
+        }
+        for (q = p; q < colon; q++) {
+            *q = CHARTYPE(upper, *q) != 0 ? (char)CHARCONV(lower, *q) : *q;
+        }
+        if (SkipResponseHeader(p, (size_t)(colon - p))) {
+            continue;
+        }
+        value = colon + 1;
+        while (value < lineEnd && (*value == ' ' || *value == '\t')) {
+            value++;
+        }
+        nva[nvlen].name = (uint8_t *)p;
+        nva[nvlen].namelen = (size_t)(colon - p);
+        nva[nvlen].value = (uint8_t *)value;
+        nva[nvlen].valuelen = (size_t)(lineEnd - value);
+        nva[nvlen].flags = NGHTTP2_NV_FLAG_NONE;
+        nvlen++;
+    }
+
+    provider.source.ptr = streamPtr;
+    provider.read_callback = StreamDataRead;
+
+    rc = H2SubmitResponse(h2Ptr->session, streamPtr->id, nva, nvlen, &provider);
+    ns_free(nva);
+
+    if (rc != 0) {
+        Ns_Log(Warning, "http2: stream %d: cannot submit response: %s",
+               streamPtr->id, nghttp2_strerror(rc));
+        status = NS_ERROR;
+    } else {
+        streamPtr->flags |= H2_STREAM_HEADERS;
+    }
+    Tcl_DStringFree(&streamPtr->headers);
+
+    return status;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * StreamDataRead --
+ *
+ *      nghttp2 data provider callback, copying buffered response data of
+ *      the stream into a DATA frame.
+ *
+ * Results:
+ *      Number of bytes copied or NGHTTP2_ERR_DEFERRED, when no data is
+ *      currently available.
+ *
+ * Side effects:
+ *      Wakes up a connection thread waiting for buffer space.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static H2Size
+StreamDataRead(nghttp2_session *UNUSED(session), int32_t UNUSED(streamId), uint8_t *buf, size_t length,
+               uint32_t *dataFlags, nghttp2_data_source *source, void *UNUSED(userData))
+{
+    NsHttp2Stream *streamPtr = source->ptr;
+    size_t         available, n;
+
+    available = (size_t)streamPtr->data.length - streamPtr->dataOffset;
+    if (available == 0u) {
+        if ((streamPtr->flags & H2_STREAM_EOF) != 0u) {
+            *dataFlags |= NGHTTP2_DATA_FLAG_EOF;
+            return 0;
+        }
+        streamPtr->flags |= H2_STREAM_DEFERRED;
+        return NGHTTP2_ERR_DEFERRED;
+    }
+
+    n = MIN(available, length);
+    memcpy(buf, streamPtr->data.string + streamPtr->dataOffset, n);
+    streamPtr->dataOffset += n;
+
+    if (streamPtr->dataOffset == (size_t)streamPtr->data.length) {
+        Tcl_DStringSetLength(&streamPtr->data, 0);
+        streamPtr->dataOffset = 0u;
+        if ((streamPtr->flags & H2_STREAM_EOF) != 0u) {
+            *dataFlags |= NGHTTP2_DATA_FLAG_EOF;
+        }
+    }
+    Ns_CondBroadcast(&streamPtr->h2Ptr->cond);
+
+    return (H2Size)n;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * OnBeginHeaders --
+ *
+ *      nghttp2 callback, called when a new request stream is opened by
+ *      the peer.
+ *
+ * Results:
+ *      0 (success).
+ *
+ * Side effects:
+ *      Creates a stream structure.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+OnBeginHeaders(nghttp2_session *session, const nghttp2_frame *frame, void *userData)
+{
+    if (frame->hd.type == NGHTTP2_HEADERS && frame->headers.cat == NGHTTP2_HCAT_REQUEST) {
+        NsHttp2Stream *streamPtr = StreamNew(userData, frame->hd.stream_id);
+
+        (void)nghttp2_session_set_stream_user_data(session, frame->hd.stream_id, streamPtr);
+    }
+    return 0;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * OnHeader --
+ *
+ *      nghttp2 callback, called for every received request header field.
+ *      Pseudo-header fields are kept for the request line, regular
+ *      fields are collected in HTTP/1 syntax. Trailer fields are
+ *      ignored.
+ *
+ * Results:
+ *      0 (success).
+ *
+ * Side effects:
+ *      Updates the stream structure.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+OnHeader(nghttp2_session *session, const nghttp2_frame *frame,
+         const uint8_t *name, size_t namelen, const uint8_t *value, size_t valuelen,
+         uint8_t UNUSED(flags), void *UNUSED(userData))
+{
+    NsHttp2Stream *streamPtr;
+
+    if (frame->hd.type != NGHTTP2_HEADERS || frame->headers.cat != NGHTTP2_HCAT_REQUEST) {
+        return 0;
+    }
+    streamPtr = nghttp2_session_get_stream_user_data(session, frame->hd.stream_id);
+    if (streamPtr == NULL) {
+        return 0;
+    }
+
+    if (namelen > 0u && name[0] == ':') {
+        char **valuePtr = NULL;
+
+        if (namelen == 7u && memcmp(name, ":method", 7u) == 0) {
+            valuePtr = &streamPtr->method;
+        } else if (namelen == 5u && memcmp(name, ":path", 5u) == 0) {
+            valuePtr = &streamPtr->path;
+        } else if (namelen == 10u && memcmp(name, ":authority", 10u) == 0) {
+            valuePtr = &streamPtr->authority;
+        }
+        if (valuePtr != NULL) {
+            ns_free(*valuePtr);
+            *valuePtr = ns_strncopy((const char *)value, (TCL_SIZE_T)valuelen);
+        }
+
+    } else {
+        if (namelen == 6u && memcmp(name, "expect", 6u) == 0) {
+            /*
+             * The complete request is received before it is processed,
+             * "100-continue" is meaningless.
+             */
+            return 0;
+        } else if (namelen == 4u && memcmp(name, "host", 4u) == 0) {
+            streamPtr->flags |= H2_STREAM_HOST;
+        } else if (namelen == 14u && memcmp(name, "content-length", 14u) == 0) {
+            streamPtr->flags |= H2_STREAM_CLENGTH;
+        }
+        Tcl_DStringAppend(&streamPtr->headers, (const char *)name, (TCL_SIZE_T)namelen);
+        Tcl_DStringAppend(&streamPtr->headers, ": ", 2);
+        Tcl_DStringAppend(&streamPtr->headers, (const char *)value, (TCL_SIZE_T)valuelen);
+        Tcl_DStringAppend(&streamPtr->headers, "\r\n", 2);
+    }
+    return 0;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * OnDataChunkRecv --
+ *
+ *      nghttp2 callback, called for received request body data. Data
+ *      exceeding "maxinput" is discarded; such requests are answered
+ *      with "413 Request Entity Too Large".
+ *
+ * Results:
+ *      0 (success).
+ *
+ * Side effects:
+ *      Updates the stream structure.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+OnDataChunkRecv(nghttp2_session *session, uint8_t UNUSED(flags), int32_t streamId,
+                const uint8_t *data, size_t len, void *userData)
+{
+    const NsHttp2Conn *h2Ptr = userData;
+    NsHttp2Stream     *streamPtr;
+
+    streamPtr = nghttp2_session_get_stream_user_data(session, streamId);
+    if (streamPtr != NULL) {
+        streamPtr->bodyLength += len;
+        if (streamPtr->bodyLength > (size_t)h2Ptr->drvPtr->maxinput) {
+            streamPtr->flags |= H2_STREAM_TOOLARGE;
+            Tcl_DStringFree(&streamPtr->data);
+        } else {
+            Tcl_DStringAppend(&streamPtr->data, (const char *)data, (TCL_SIZE_T)len);
+        }
+    }
+    return 0;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * OnFrameRecv --
+ *
+ *      nghttp2 callback, called for every received frame. When the peer
+ *      has finished sending a request, the stream is added to the list
+ *      of complete requests.
+ *
+ * Results:
+ *      0 (success).
+ *
+ * Side effects:
+ *      Updates the list of complete requests.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+OnFrameRecv(nghttp2_session *session, const nghttp2_frame *frame, void *userData)
+{
+    if ((frame->hd.type == NGHTTP2_HEADERS || frame->hd.type == NGHTTP2_DATA)
+        && (frame->hd.flags & NGHTTP2_FLAG_END_STREAM) != 0u) {
+        NsHttp2Conn   *h2Ptr = userData;
+        NsHttp2Stream *streamPtr;
+
+        streamPtr = nghttp2_session_get_stream_user_data(session, frame->hd.stream_id);
+        if (streamPtr != NULL
+            && (streamPtr->flags & (H2_STREAM_QUEUED|H2_STREAM_ATTACHED)) == 0u) {
+            streamPtr->flags |= H2_STREAM_QUEUED;
+            if (h2Ptr->readyTailPtr != NULL) {
+                h2Ptr->readyTailPtr->readyPtr = streamPtr;
+            } else {
+                h2Ptr->readyPtr = streamPtr;
+            }
+            h2Ptr->readyTailPtr = streamPtr;
+        }
+    }
+    return 0;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * OnStreamClose --
+ *
+ *      nghttp2 callback, called when a stream is closed, either after the
+ *      response was sent completely, or on a reset.
+ *
+ * Results:
+ *      0 (success).
+ *
+ * Side effects:
+ *      Might free the stream; wakes up a connection thread waiting for
+ *      buffer space of the stream.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+OnStreamClose(nghttp2_session *session, int32_t streamId, uint32_t errorCode, void *userData)
+{
+    NsHttp2Stream *streamPtr;
+
+    streamPtr = nghttp2_session_get_stream_user_data(session, streamId);
+    if (streamPtr != NULL) {
+        const NsHttp2Conn *h2Ptr = userData;
+
+        if (errorCode != NGHTTP2_NO_ERROR) {
+            Ns_Log(Debug, "http2: stream %d closed: %s", streamId, nghttp2_http2_strerror(errorCode));
+        }
+        streamPtr->flags &= ~H2_STREAM_OPEN;
+        Ns_CondBroadcast((Ns_Cond *)&h2Ptr->cond);
+        StreamRelease(streamPtr);
+    }
+    return 0;
+}
+
+#else /* HAVE_NGHTTP2 */
+
+/*
+ * Without nghttp2, the driver never enables HTTP/2 (see DriverInit), so
+ * the following functions are never called.
+ */
+
+NsHttp2Conn *
+NsHttp2ConnNew(Sock *UNUSED(sockPtr))
+{
+    return NULL;
+}
+
+void
+NsHttp2ConnClose(NsHttp2Conn *UNUSED(h2Ptr))
+{
+}
+
+Ns_ReturnCode
+NsHttp2Read(NsHttp2Conn *UNUSED(h2Ptr), const char *UNUSED(buffer), size_t UNUSED(length))
+{
+    return NS_ERROR;
+}
+
+Ns_ReturnCode
+NsHttp2Flush(NsHttp2Conn *UNUSED(h2Ptr))
+{
+    return NS_ERROR;
+}
+
+bool
+NsHttp2WantWrite(NsHttp2Conn *UNUSED(h2Ptr))
+{
+    return NS_FALSE;
+}
+
+bool
+NsHttp2Busy(NsHttp2Conn *UNUSED(h2Ptr))
+{
+    return NS_FALSE;
+}
+
+NsHttp2Stream *
+NsHttp2NextRequest(NsHttp2Conn *UNUSED(h2Ptr))
+{
+    return NULL;
+}
+
+bool
+NsHttp2StreamAttach(NsHttp2Stream *UNUSED(streamPtr), Sock *UNUSED(sockPtr))
+{
+    return NS_FALSE;
+}
+
+void
+NsHttp2StreamClose(Sock *sockPtr)
+{
+    sockPtr->h2StreamPtr = NULL;
+}
+
+ssize_t
+NsHttp2Send(Sock *UNUSED(sockPtr), const struct iovec *UNUSED(bufs), int UNUSED(nbufs))
+{
+    return -1;
+}
+
+ssize_t
+NsHttp2SendFile(Sock *UNUSED(sockPtr), const Ns_FileVec *UNUSED(bufs), int UNUSED(nbufs))
+{
+    return -1;
+}
+
+#endif /* HAVE_NGHTTP2 */
+
+/*
+ * Local Variables:
+ * mode: c
+ * c-basic-offset: 4
+ * fill-column: 78
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -879,7 +879,8 @@ NsTclInfoObjCmd(ClientData clientData, Tcl_Interp *interp, TCL_SIZE_T objc, Tcl_
     case IBuildinfoIdx:
         {
             Tcl_Obj *dictObj = Tcl_NewDictObj();
-            int defined_NDEBUG, defined_SYSTEM_MALLOC, defined_NS_WITH_DEPRECATED;
+            int defined_NDEBUG, defined_SYSTEM_MALLOC, defined_NS_WITH_DEPRECATED, defined_HAVE_BROTLI,
+                defined_HAVE_ZSTD;
 
             /*
              * Detect the compiler.
@@ -948,6 +949,34 @@ NsTclInfoObjCmd(ClientData clientData, Tcl_Interp *interp, TCL_SIZE_T objc, Tcl_
                            Tcl_NewStringObj("with_deprecated", 15),
                            Tcl_NewIntObj(defined_NS_WITH_DEPRECATED));
 
+            /*
+             * Compiled with support for on-the-fly Brotli compression?
+             */
+            defined_HAVE_BROTLI =
+#if defined(HAVE_BROTLI)
+                                         1
+#else
+                                         0
+#endif
+                ;
+            Tcl_DictObjPut(NULL, dictObj,
+                           Tcl_NewStringObj("with_brotli", 11),
+                           Tcl_NewIntObj(defined_HAVE_BROTLI));
+
+            /*
+             * Compiled with support for the zstd content encoding?
+             */
+            defined_HAVE_ZSTD =
+#if defined(HAVE_ZSTD)
+                                         1
+#else
+                                         0
+#endif
+                ;
+            Tcl_DictObjPut(NULL, dictObj,
+                           Tcl_NewStringObj("with_zstd", 9),
+                           Tcl_NewIntObj(defined_HAVE_ZSTD));
+
             /*
              * The nsd binary was built against this version of Tcl
              */
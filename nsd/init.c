@@ -70,6 +70,7 @@ Nsd_LibInit(void)
         NsInitTask();
         NsInitProcInfo();
         NsInitDrivers();
+        NsInitHeaderScan();
         NsInitQueue();
         NsInitSched();
         NsInitTclEnv();
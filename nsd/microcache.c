@@ -0,0 +1,867 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ *
+ */
+
+/*
+ * microcache.c --
+ *
+ *      Per-server cache of complete responses to GET requests. Responses
+ *      are stored by the connection threads when the application marks
+ *      them as cacheable for shared caches, and repeated requests are
+ *      answered directly from the driver thread without queueing them to
+ *      a connection pool.
+ */
+
+#include "nsd.h"
+
+/*
+ * The following structure defines a cached response. The data contains
+ * the header fields without status line, "Date" and "Connection" followed
+ * by the empty line and the body. Entries are reference counted, since the
+ * driver sends the data without holding the cache lock.
+ */
+
+typedef struct Response {
+    int     refcnt;
+    Ns_Time created;
+    size_t  bodyLength;
+    size_t  length;
+    char    data[1];  /* Grown to actual length. */
+} Response;
+
+/*
+ * Local functions defined in this file
+ */
+
+static bool MicroCacheKey(const NsServer *servPtr, const char *protocol, const Ns_Request *requestPtr,
+                          const Ns_Set *headers, size_t contentLength, Tcl_DString *dsPtr)
+    NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(2) NS_GNUC_NONNULL(3) NS_GNUC_NONNULL(4) NS_GNUC_NONNULL(6);
+
+static bool HeaderHasToken(const Ns_Set *headers, const char *key, const char *token)
+    NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(2) NS_GNUC_NONNULL(3);
+
+static bool ResponseTtl(const NsServer *servPtr, const Conn *connPtr, Ns_Time *ttlPtr)
+    NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(2) NS_GNUC_NONNULL(3);
+
+static void DecrResponse(Response *responsePtr)
+    NS_GNUC_NONNULL(1);
+
+static Ns_Callback FreeResponse;
+static Ns_ServerInitProc ConfigServerMicroCache;
+
+static TCL_OBJCMDPROC_T MicroCacheFlushObjCmd;
+static TCL_OBJCMDPROC_T MicroCacheStatsObjCmd;
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * NsConfigMicroCache --
+ *
+ *      Register the micro-cache initialization for every server.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+NsConfigMicroCache(void)
+{
+    NsRegisterServerInit(ConfigServerMicroCache);
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * ConfigServerMicroCache --
+ *
+ *      Load the config values for the specified server and create the
+ *      response cache, when a "maxsize" was configured.
+ *
+ * Results:
+ *      NS_OK or NS_ERROR for unknown servers.
+ *
+ * Side effects:
+ *      Updating the micro-cache configuration for the specified server.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static Ns_ReturnCode
+ConfigServerMicroCache(const char *server)
+{
+    NsServer     *servPtr = NsGetServer(server);
+    Ns_ReturnCode result = NS_OK;
+
+    if (unlikely(servPtr == NULL)) {
+        Ns_Log(Warning, "Could not configure microcache; server '%s' unknown", server);
+        result = NS_ERROR;
+
+    } else {
+        const char *section, *vary;
+        size_t      maxSize;
+
+        section = Ns_ConfigSectionPath(NULL, server, NULL, "microcache", NS_SENTINEL);
+        maxSize = (size_t)Ns_ConfigMemUnitRange(section, "maxsize", "0", 0, 0, INT_MAX);
+        servPtr->microcache.maxentry = (size_t)Ns_ConfigMemUnitRange(section, "maxentry", "32KB",
+                                                                     32 * 1024, 1024, INT_MAX);
+        Ns_ConfigTimeUnitRange(section, "ttl", "10s", 0, 1000, INT_MAX, 0,
+                               &servPtr->microcache.ttl);
+        servPtr->microcache.checkauth = Ns_ConfigBool(section, "checkauthorization", NS_TRUE);
+
+        vary = Ns_ConfigString(section, "vary", "accept-encoding");
+        if (Tcl_SplitList(NULL, vary, &servPtr->microcache.varyc,
+                          &servPtr->microcache.varyv) != TCL_OK) {
+            Ns_Log(Error, "microcache[%s]: vary is not a list: %s", server, vary);
+            servPtr->microcache.varyc = 0;
+            servPtr->microcache.varyv = NULL;
+        }
+
+        if (maxSize > 0u) {
+            Tcl_DString ds;
+
+            Tcl_DStringInit(&ds);
+            Ns_DStringVarAppend(&ds, "ns:microcache:", server, NS_SENTINEL);
+            servPtr->microcache.cache = Ns_CacheCreateSz(ds.string, TCL_STRING_KEYS,
+                                                         maxSize, FreeResponse);
+            Tcl_DStringFree(&ds);
+        }
+    }
+    return result;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * MicroCacheKey --
+ *
+ *      Compute the cache key of a request. The key consists of the
+ *      protocol, the host header field and the URL including the query,
+ *      followed by the values of the configured "vary" request header
+ *      fields, separated by newlines. Only GET requests without body,
+ *      credentials, ranges and conditions are eligible.
+ *
+ * Results:
+ *      NS_TRUE, when the request is eligible, the key is appended to the
+ *      provided Tcl_DString.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static bool
+MicroCacheKey(const NsServer *servPtr, const char *protocol, const Ns_Request *requestPtr,
+              const Ns_Set *headers, size_t contentLength, Tcl_DString *dsPtr)
+{
+    bool success = NS_FALSE;
+
+    if (requestPtr->method != NULL
+        && requestPtr->url != NULL
+        && STREQ(requestPtr->method, "GET")
+        && requestPtr->version >= 1.0
+        && contentLength == 0u
+        && Ns_SetIGet(headers, "authorization") == NULL
+        && Ns_SetIGet(headers, "cookie") == NULL
+        && Ns_SetIGet(headers, "range") == NULL
+        && Ns_SetIGet(headers, "if-none-match") == NULL
+        && Ns_SetIGet(headers, "if-modified-since") == NULL
+        ) {
+        const char *host = Ns_SetIGet(headers, "host");
+        TCL_SIZE_T  i, hostStart;
+
+        Ns_DStringVarAppend(dsPtr, protocol, "://", NS_SENTINEL);
+        hostStart = dsPtr->length;
+        Tcl_DStringAppend(dsPtr, host != NULL ? host : NS_EMPTY_STRING, TCL_INDEX_NONE);
+        Ns_StrToLower(dsPtr->string + hostStart);
+        Tcl_DStringAppend(dsPtr, requestPtr->url, TCL_INDEX_NONE);
+        if (requestPtr->query != NULL) {
+            Ns_DStringVarAppend(dsPtr, "?", requestPtr->query, NS_SENTINEL);
+        }
+        for (i = 0; i < servPtr->microcache.varyc; i++) {
+            const char *value = Ns_SetIGet(headers, servPtr->microcache.varyv[i]);
+
+            Ns_DStringVarAppend(dsPtr, "\n", value != NULL ? value : NS_EMPTY_STRING, NS_SENTINEL);
+        }
+        success = NS_TRUE;
+    }
+    return success;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * HeaderHasToken --
+ *
+ *      Check whether the comma separated value of the specified header
+ *      field contains the provided token (case-insensitive).
+ *
+ * Results:
+ *      Boolean value.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static bool
+HeaderHasToken(const Ns_Set *headers, const char *key, const char *token)
+{
+    const char *value = Ns_SetIGet(headers, key);
+    bool        success = NS_FALSE;
+
+    if (value != NULL) {
+        size_t tokenLength = strlen(token);
+
+        while (*value != '\0') {
+            while (*value == ',' || CHARTYPE(space, *value) != 0) {
+                value++;
+            }
+            if (strncasecmp(value, token, tokenLength) == 0
+                && (value[tokenLength] == '\0'
+                    || value[tokenLength] == ','
+                    || CHARTYPE(space, value[tokenLength]) != 0)) {
+                success = NS_TRUE;
+                break;
+            }
+            while (*value != '\0' && *value != ',') {
+                value++;
+            }
+        }
+    }
+    return success;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * NsMicroCacheConnKey --
+ *
+ *      Compute the micro-cache key for the request of a connection, when
+ *      the server has a micro-cache and the request is eligible.
+ *
+ * Results:
+ *      Key in memory owned by the caller or NULL.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+char *
+NsMicroCacheConnKey(const Conn *connPtr)
+{
+    const NsServer *servPtr;
+    char           *key = NULL;
+
+    NS_NONNULL_ASSERT(connPtr != NULL);
+
+    servPtr = connPtr->poolPtr->servPtr;
+    if (servPtr->microcache.cache != NULL
+        && connPtr->sockPtr != NULL
+        && connPtr->sockPtr->h2StreamPtr == NULL
+        ) {
+        Tcl_DString ds;
+
+        Tcl_DStringInit(&ds);
+        if (MicroCacheKey(servPtr, connPtr->drvPtr->protocol, &connPtr->request,
+                          connPtr->headers, connPtr->contentLength, &ds)) {
+            key = ns_strdup(ds.string);
+        }
+        Tcl_DStringFree(&ds);
+    }
+    return key;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * ResponseTtl --
+ *
+ *      Check whether the response of the connection may be stored in a
+ *      shared cache and determine its time to live. The application has
+ *      to opt in via a "Cache-Control" header field with "public",
+ *      "max-age" or "s-maxage". The time to live is bounded by the
+ *      configured "ttl".
+ *
+ * Results:
+ *      NS_TRUE, when the response is cacheable.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static bool
+ResponseTtl(const NsServer *servPtr, const Conn *connPtr, Ns_Time *ttlPtr)
+{
+    const Ns_Set *outputheaders = connPtr->outputheaders;
+    const char   *cacheControl, *vary;
+    bool          success = NS_FALSE;
+
+    cacheControl = Ns_SetIGet(outputheaders, "cache-control");
+    vary = Ns_SetIGet(outputheaders, "vary");
+
+    if (connPtr->responseStatus == 200
+        && cacheControl != NULL
+        && Ns_SetIGet(outputheaders, "set-cookie") == NULL
+        && !HeaderHasToken(outputheaders, "cache-control", "private")
+        && !HeaderHasToken(outputheaders, "cache-control", "no-store")
+        && !HeaderHasToken(outputheaders, "cache-control", "no-cache")
+        ) {
+        const char *p;
+        long        maxAge = -1;
+
+        *ttlPtr = servPtr->microcache.ttl;
+
+        /*
+         * "s-maxage" has precedence over "max-age" for shared caches.
+         */
+        p = strstr(cacheControl, "s-maxage=");
+        if (p != NULL) {
+            maxAge = strtol(p + 9, NULL, 10);
+        } else {
+            p = strstr(cacheControl, "max-age=");
+            if (p != NULL) {
+                maxAge = strtol(p + 8, NULL, 10);
+            }
+        }
+        if (maxAge >= 0) {
+            if (maxAge < (long)ttlPtr->sec) {
+                ttlPtr->sec = (time_t)maxAge;
+                ttlPtr->usec = 0;
+            }
+            success = (ttlPtr->sec > 0 || ttlPtr->usec > 0);
+        } else {
+            success = HeaderHasToken(outputheaders, "cache-control", "public");
+        }
+
+        /*
+         * The response must not vary on request header fields, which are
+         * not part of the key.
+         */
+        if (success && vary != NULL) {
+            Tcl_DString ds;
+            const char *field;
+
+            Tcl_DStringInit(&ds);
+            Tcl_DStringAppend(&ds, vary, TCL_INDEX_NONE);
+            field = ns_strtok(ds.string, ", \t");
+            while (success && field != NULL) {
+                TCL_SIZE_T i;
+
+                success = NS_FALSE;
+                for (i = 0; i < servPtr->microcache.varyc; i++) {
+                    if (strcasecmp(field, servPtr->microcache.varyv[i]) == 0) {
+                        success = NS_TRUE;
+                        break;
+                    }
+                }
+                field = ns_strtok(NULL, ", \t");
+            }
+            Tcl_DStringFree(&ds);
+        }
+    }
+    return success;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * NsMicroCacheStore --
+ *
+ *      Store a response, which was just sent in a single write operation,
+ *      in the micro-cache, when it is cacheable. The "Date" and
+ *      "Connection" header fields are dropped, since these are generated
+ *      on every delivery.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Might add an entry to the cache and prune older entries.
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+NsMicroCacheStore(Conn *connPtr, const char *header, size_t headerLength,
+                  const struct iovec *bufs, int nbufs, size_t bodyLength)
+{
+    NsServer *servPtr;
+    Ns_Time   ttl;
+
+    NS_NONNULL_ASSERT(connPtr != NULL);
+    NS_NONNULL_ASSERT(header != NULL);
+
+    servPtr = connPtr->poolPtr->servPtr;
+
+    if (connPtr->microcacheKey != NULL
+        && servPtr->microcache.cache != NULL
+        && connPtr->responseLength == (ssize_t)bodyLength
+        && headerLength + bodyLength <= servPtr->microcache.maxentry
+        && ResponseTtl(servPtr, connPtr, &ttl)
+        ) {
+        Response   *responsePtr;
+        const char *line, *end = header + headerLength;
+        char       *p;
+        Ns_Entry   *entry;
+        Ns_Time     expires;
+        int         i, isNew;
+
+        responsePtr = ns_malloc(sizeof(Response) + headerLength + bodyLength);
+        responsePtr->refcnt = 1;
+        responsePtr->bodyLength = bodyLength;
+        Ns_GetTime(&responsePtr->created);
+
+        /*
+         * Skip the status line and copy the header fields.
+         */
+        p = responsePtr->data;
+        line = strchr(header, INTCHAR('\n'));
+        line = (line != NULL) ? line + 1 : end;
+        while (line < end) {
+            const char *next = memchr(line, INTCHAR('\n'), (size_t)(end - line));
+            size_t      lineLength = (next != NULL) ? (size_t)(next - line) + 1u : (size_t)(end - line);
+
+            if (strncasecmp(line, "date:", 5u) != 0
+                && strncasecmp(line, "connection:", 11u) != 0) {
+                memcpy(p, line, lineLength);
+                p += lineLength;
+            }
+            line += lineLength;
+        }
+        for (i = 0; i < nbufs; i++) {
+            memcpy(p, bufs[i].iov_base, bufs[i].iov_len);
+            p += bufs[i].iov_len;
+        }
+        responsePtr->length = (size_t)(p - responsePtr->data);
+
+        expires = responsePtr->created;
+        Ns_IncrTime(&expires, ttl.sec, ttl.usec);
+
+        Ns_CacheLock(servPtr->microcache.cache);
+        entry = Ns_CacheCreateEntry(servPtr->microcache.cache, connPtr->microcacheKey, &isNew);
+        (void) Ns_CacheSetValueExpires(entry, responsePtr, responsePtr->length, &expires, 0, 0u, 0u);
+        servPtr->microcache.stats.stored++;
+        Ns_CacheUnlock(servPtr->microcache.cache);
+
+        Ns_Log(Debug, "microcache: stored %" PRIuz " bytes for %s",
+               responsePtr->length, connPtr->request.line);
+    }
+
+    /*
+     * Only the first write operation of a request can be stored.
+     */
+    ns_free(connPtr->microcacheKey);
+    connPtr->microcacheKey = NULL;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * NsMicroCacheServe --
+ *
+ *      Try to answer a complete request received by the driver from the
+ *      micro-cache of its server. This is called from the driver thread
+ *      before the request is queued to a connection pool. Since responses
+ *      delivered this way bypass filters and authorization, the fast path
+ *      is not used for URLs with filters, for requests with credentials
+ *      (Cookie or Authorization header, see MicroCacheKey()) and, unless
+ *      "checkauthorization" is turned off, when authorization procs are
+ *      registered. The driver thread sends only what the socket accepts
+ *      without blocking, the remainder is handed to a writer thread.
+ *
+ * Results:
+ *      NS_TRUE, when the request was answered and the socket was handed
+ *      back for closing or keep-alive.
+ *
+ * Side effects:
+ *      Sends the cached response to the client and writes the access log
+ *      entry.
+ *
+ *----------------------------------------------------------------------
+ */
+
+bool
+NsMicroCacheServe(Sock *sockPtr, const Ns_Time *nowPtr)
+{
+    NsServer         *servPtr;
+    const Ns_Request *requestPtr;
+    Tcl_DString       ds;
+    bool              success = NS_FALSE;
+
+    NS_NONNULL_ASSERT(sockPtr != NULL);
+    NS_NONNULL_ASSERT(nowPtr != NULL);
+
+    servPtr = sockPtr->servPtr;
+    if (servPtr == NULL
+        || servPtr->microcache.cache == NULL
+        || sockPtr->reqPtr == NULL
+        || sockPtr->h2ConnPtr != NULL
+        || sockPtr->h2StreamPtr != NULL
+        || sockPtr->drvPtr->requestProc != NULL
+        || sockPtr->drvPtr->writer.threads == 0
+        ) {
+        return NS_FALSE;
+    }
+
+    requestPtr = &sockPtr->reqPtr->request;
+    if (requestPtr->method == NULL
+        || requestPtr->url == NULL
+        || (servPtr->microcache.checkauth && servPtr->request.firstRequestAuthPtr != NULL)
+        || NsFiltersMatch(servPtr, requestPtr->method, requestPtr->url)
+        ) {
+        return NS_FALSE;
+    }
+
+    Tcl_DStringInit(&ds);
+
+    if (MicroCacheKey(servPtr, sockPtr->drvPtr->protocol, requestPtr,
+                      sockPtr->reqPtr->headers, sockPtr->reqPtr->length, &ds)
+        && !HeaderHasToken(sockPtr->reqPtr->headers, "cache-control", "no-cache")
+        && !HeaderHasToken(sockPtr->reqPtr->headers, "pragma", "no-cache")
+        ) {
+        Response       *responsePtr = NULL;
+        const Ns_Entry *entry;
+
+        Ns_CacheLock(servPtr->microcache.cache);
+        entry = Ns_CacheFindEntry(servPtr->microcache.cache, ds.string);
+        if (entry != NULL) {
+            responsePtr = Ns_CacheGetValue(entry);
+            responsePtr->refcnt++;
+            servPtr->microcache.stats.hits++;
+        } else {
+            servPtr->microcache.stats.misses++;
+        }
+        Ns_CacheUnlock(servPtr->microcache.cache);
+
+        if (responsePtr != NULL) {
+            struct iovec bufs[2];
+            Ns_Time      age;
+            ConnPool    *poolPtr;
+            size_t       toWrite;
+            ssize_t      sent;
+            bool         keep = NsSockKeepAlive(sockPtr, responsePtr->bodyLength);
+
+            (void) Ns_DiffTime(nowPtr, &responsePtr->created, &age);
+
+            Tcl_DStringSetLength(&ds, 0);
+            Ns_DStringPrintf(&ds, "HTTP/%.1f 200 OK\r\nDate: ",
+                             MIN(sockPtr->reqPtr->request.version, 1.1));
+            (void) Ns_HttpTime(&ds, NULL);
+            Ns_DStringPrintf(&ds, "\r\nAge: %" PRId64 "\r\nConnection: %s\r\n",
+                             (int64_t)MAX(age.sec, 0), keep ? "keep-alive" : "close");
+
+            toWrite = Ns_SetVec(bufs, 0, ds.string, (size_t)ds.length);
+            toWrite += Ns_SetVec(bufs, 1, responsePtr->data, responsePtr->length);
+
+            /*
+             * Keep the statistics and the access log consistent with
+             * requests processed by the connection threads. The log entry
+             * has to be written before a writer thread takes over the
+             * socket.
+             */
+            poolPtr = NsPoolLookup(sockPtr);
+            if (poolPtr == NULL) {
+                poolPtr = servPtr->pools.defaultPtr;
+            }
+            sockPtr->drvPtr->stats.received++;
+#ifdef NS_HAVE_ATOMIC_BUILTINS
+            (void) __atomic_fetch_add(&poolPtr->stats.processed, 1u, __ATOMIC_RELAXED);
+#else
+            Ns_MutexLock(&servPtr->pools.lock);
+            poolPtr->stats.processed++;
+            Ns_MutexUnlock(&servPtr->pools.lock);
+#endif
+            NsSockAccessLog(sockPtr, poolPtr, 200, responsePtr->bodyLength);
+
+            /*
+             * Send only what the socket accepts right now; the driver
+             * thread must not block on a slow client.
+             */
+            sent = NsDriverSend(sockPtr, bufs, 2, 0u);
+
+            Ns_Log(Debug, "microcache: sent %" PRIdz " of %" PRIdz " bytes from cache: %s",
+                   sent, toWrite, requestPtr->line);
+
+            if (sent == (ssize_t)toWrite) {
+                NsSockClose(sockPtr, keep);
+            } else if (sent >= 0) {
+                int idx = Ns_ResetVec(bufs, 2, (size_t)sent);
+
+                if (NsWriterQueueSock(sockPtr, poolPtr, &bufs[idx], 2 - idx,
+                                      NS_INVALID_FD, 0u, keep) != NS_OK) {
+                    NsSockClose(sockPtr, NS_FALSE);
+                }
+            } else {
+                NsSockClose(sockPtr, NS_FALSE);
+            }
+            NsPoolAddBytesSent(poolPtr, (Tcl_WideInt)MAX(sent, 0));
+
+            Ns_CacheLock(servPtr->microcache.cache);
+            DecrResponse(responsePtr);
+            Ns_CacheUnlock(servPtr->microcache.cache);
+
+            success = NS_TRUE;
+        }
+    }
+    Tcl_DStringFree(&ds);
+
+    return success;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * DecrResponse --
+ *
+ *      Decrement the reference count of a cached response and free it,
+ *      when it is not used anymore. Must be called with the cache lock
+ *      held.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Might free memory.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+DecrResponse(Response *responsePtr)
+{
+    NS_NONNULL_ASSERT(responsePtr != NULL);
+
+    if (--responsePtr->refcnt == 0) {
+        ns_free(responsePtr);
+    }
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * FreeResponse --
+ *
+ *      Cache-free callback: logically remove a response from the cache.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+FreeResponse(void *arg)
+{
+    Response *responsePtr = arg;
+
+    DecrResponse(responsePtr);
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * MicroCacheFlushObjCmd --
+ *
+ *      Implements "ns_microcache flush". Flush all cached responses or
+ *      the ones, where the protocol, host and URL part of the key
+ *      matches the provided glob pattern.
+ *
+ * Results:
+ *      Tcl result, number of flushed entries.
+ *
+ * Side effects:
+ *      Entries are removed from the cache.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+MicroCacheFlushObjCmd(ClientData clientData, Tcl_Interp *interp, TCL_SIZE_T objc, Tcl_Obj *const* objv)
+{
+    const NsInterp *itPtr = clientData;
+    char           *pattern = NULL;
+    int             result = TCL_OK;
+    Ns_ObjvSpec     args[] = {
+        {"?pattern", Ns_ObjvString, &pattern, NULL},
+        {NULL, NULL, NULL, NULL}
+    };
+
+    if (Ns_ParseObjv(NULL, args, interp, 2, objc, objv) != NS_OK) {
+        result = TCL_ERROR;
+
+    } else {
+        Ns_Cache *cache = itPtr->servPtr->microcache.cache;
+        int       count = 0;
+
+        if (cache != NULL) {
+            Ns_CacheSearch search;
+            Ns_Entry      *entry;
+            Tcl_DString    ds;
+
+            Tcl_DStringInit(&ds);
+            Ns_CacheLock(cache);
+            entry = Ns_CacheFirstEntry(cache, &search);
+            while (entry != NULL) {
+                bool match = NS_TRUE;
+
+                if (pattern != NULL) {
+                    const char *key = Ns_CacheKey(entry), *nl = strchr(key, INTCHAR('\n'));
+
+                    Tcl_DStringSetLength(&ds, 0);
+                    Tcl_DStringAppend(&ds, key, nl != NULL ? (TCL_SIZE_T)(nl - key) : TCL_INDEX_NONE);
+                    match = (Tcl_StringMatch(ds.string, pattern) != 0);
+                }
+                if (match) {
+                    Ns_CacheFlushEntry(entry);
+                    count++;
+                }
+                entry = Ns_CacheNextEntry(&search);
+            }
+            Ns_CacheUnlock(cache);
+            Tcl_DStringFree(&ds);
+        }
+        Tcl_SetObjResult(interp, Tcl_NewIntObj(count));
+    }
+    return result;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * MicroCacheStatsObjCmd --
+ *
+ *      Implements "ns_microcache stats". Returns the configuration and
+ *      usage statistics of the micro-cache of the current server as a
+ *      dict.
+ *
+ * Results:
+ *      Tcl result.
+ *
+ * Side effects:
+ *      With "-reset", the statistics are set to zero.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+MicroCacheStatsObjCmd(ClientData clientData, Tcl_Interp *interp, TCL_SIZE_T objc, Tcl_Obj *const* objv)
+{
+    NsInterp   *itPtr = clientData;
+    int         reset = (int)NS_FALSE, result = TCL_OK;
+    Ns_ObjvSpec opts[] = {
+        {"-reset", Ns_ObjvBool, &reset, INT2PTR(NS_TRUE)},
+        {NULL, NULL, NULL, NULL}
+    };
+
+    if (Ns_ParseObjv(opts, NULL, interp, 2, objc, objv) != NS_OK) {
+        result = TCL_ERROR;
+
+    } else {
+        NsServer      *servPtr = itPtr->servPtr;
+        Ns_Cache      *cache = servPtr->microcache.cache;
+        Tcl_DString    ds;
+        size_t         size = 0u, entries = 0u;
+        unsigned long  hits = 0u, misses = 0u, stored = 0u;
+
+        if (cache != NULL) {
+            Ns_CacheSearch  search;
+            const Ns_Entry *entry;
+
+            Ns_CacheLock(cache);
+            entry = Ns_CacheFirstEntry(cache, &search);
+            while (entry != NULL) {
+                size += Ns_CacheGetSize(entry);
+                entries++;
+                entry = Ns_CacheNextEntry(&search);
+            }
+            hits = servPtr->microcache.stats.hits;
+            misses = servPtr->microcache.stats.misses;
+            stored = servPtr->microcache.stats.stored;
+            if (reset != 0) {
+                memset(&servPtr->microcache.stats, 0, sizeof(servPtr->microcache.stats));
+            }
+            Ns_CacheUnlock(cache);
+        }
+
+        Tcl_DStringInit(&ds);
+        Ns_DStringPrintf(&ds, "enabled %d maxsize %" PRIuz " maxentry %" PRIuz " ttl ",
+                         cache != NULL,
+                         cache != NULL ? Ns_CacheGetMaxSize(cache) : 0u,
+                         servPtr->microcache.maxentry);
+        (void) Ns_DStringAppendTime(&ds, &servPtr->microcache.ttl);
+        Ns_DStringPrintf(&ds, " entries %" PRIuz " size %" PRIuz
+                         " hits %lu missed %lu stored %lu hitrate %.2f",
+                         entries, size, hits, misses, stored,
+                         (hits + misses) > 0u ? (double)hits * 100.0 / (double)(hits + misses) : 0.0);
+        Tcl_DStringResult(interp, &ds);
+    }
+    return result;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * NsTclMicroCacheObjCmd --
+ *
+ *      Implements "ns_microcache" with the subcommands "flush" and
+ *      "stats".
+ *
+ * Results:
+ *      Tcl result.
+ *
+ * Side effects:
+ *      Depends on the subcommand.
+ *
+ *----------------------------------------------------------------------
+ */
+
+int
+NsTclMicroCacheObjCmd(ClientData clientData, Tcl_Interp *interp, TCL_SIZE_T objc, Tcl_Obj *const* objv)
+{
+    const Ns_SubCmdSpec subcmds[] = {
+        {"flush", MicroCacheFlushObjCmd},
+        {"stats", MicroCacheStatsObjCmd},
+        {NULL, NULL}
+    };
+
+    return Ns_SubcmdObjv(subcmds, clientData, interp, objc, objv);
+}
+
+/*
+ * Local Variables:
+ * mode: c
+ * c-basic-offset: 4
+ * fill-column: 78
+ * indent-tabs-mode: nil
+ * End:
+ */
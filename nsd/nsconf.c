@@ -101,6 +101,9 @@ NsConfUpdate(void)
     NsConfigLog();
     NsConfigAdp();
     NsConfigFastpath();
+    NsConfigMicroCache();
+    NsConfigStatCache();
+    NsConfigCompress();
     NsConfigMimeTypes();
     NsConfigProgress();
     NsConfigDNS();
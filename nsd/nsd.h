@@ -21,6 +21,19 @@
 
 #define NS_TCLHTTP_CALLBACK_AS_STRING 1
 
+/*
+ * Compiler support for atomic operations, used for lock-free handoff between
+ * threads. Without these, the users fall back to mutexes.
+ */
+#if defined(__GNUC__) || defined(__clang__)
+# define NS_HAVE_ATOMIC_BUILTINS 1
+# define NsAtomicLoad(ptr)  __atomic_load_n((ptr), __ATOMIC_RELAXED)
+# define NsAtomicFence()    __atomic_thread_fence(__ATOMIC_SEQ_CST)
+#else
+# define NsAtomicLoad(ptr)  (*(ptr))
+# define NsAtomicFence()
+#endif
+
 /*
  * Constants
  */
@@ -67,6 +80,15 @@ typedef struct NsUrlSpaceContext {
 
 typedef struct _NsUrlSpaceContextSpec  NsUrlSpaceContextSpec;
 
+/*
+ * Content encodings of compressed responses
+ */
+typedef enum {
+    NS_COMPRESS_GZIP =             0,
+    NS_COMPRESS_BROTLI =           1,
+    NS_COMPRESS_ZSTD =             2
+} NsCompressEncoding;
+
 /*
  * Managing streaming output via writer
  */
@@ -227,8 +249,20 @@ typedef struct FileMap {
     HANDLE handle;              /* OS handle of the opened/mapped file */
     void *mapobj;               /* Mapping object (Win32 only) */
 #endif
+    Ns_Callback *releaseProc;   /* When set, called instead of unmapping a shared region */
+    void *releaseArg;
 } FileMap;
 
+/*
+ * The following enumerates the event notification mechanisms, which can be
+ * used by the driver, spooler, and writer threads.
+ */
+
+typedef enum {
+    NS_POLL_BACKEND_POLL =       0,  /* poll(): fd set is rebuilt on every spin */
+    NS_POLL_BACKEND_EPOLL =      1   /* Linux epoll, level-triggered */
+} NsPollBackend;
+
 /*
  * The following structure maintains a queue of sockets for
  * each writer or spooler thread
@@ -244,6 +278,8 @@ typedef struct SpoolerQueue {
     Ns_Thread            thread;      /* Running WriterThread/Spoolerthread */
     int                  id;          /* Queue id */
     int                  queuesize;   /* Number of active sockets in the queue */
+    NsPollBackend        pollBackend; /* Event notification mechanism of the thread */
+    bool                 iouring;     /* Writer thread uses io_uring for file I/O */
     const char          *threadName;  /* Name of the thread working on this queue */
     bool                 stopped;     /* Flag to indicate thread stopped */
     bool                 shutdown;    /* Flag to indicate shutdown */
@@ -328,6 +364,23 @@ typedef struct {
 
 
 
+/*
+ * HTTP/2 session of a connection socket and a single stream of such a
+ * session (see http2.c). The structures are opaque outside of http2.c.
+ */
+
+typedef struct NsHttp2Conn NsHttp2Conn;
+typedef struct NsHttp2Stream NsHttp2Stream;
+
+/*
+ * Result of scanning a request line or header line (see hdrscan.c).
+ */
+
+typedef struct NsHeaderScan {
+    char *colon;                  /* First colon in the line or NULL */
+    char *invalid;                /* First byte not allowed in a header line or NULL */
+} NsHeaderScan;
+
 /*
  * The following structure defines the entire request
  * including HTTP request line, headers, and content.
@@ -393,8 +446,33 @@ typedef struct {
     int                 threads;        /* Number of writer threads to run */
     int                 rateLimit;      /* Limit transmission rate in KB/s for a writer job */
     NsWriterStreamState doStream;       /* Activate writer for HTML streaming */
+    bool                iouring;        /* Use io_uring for file based writer jobs */
 } DrvWriter;
 
+/*
+ * DrvSlab is a per-driver-thread cache of recycled Sock or Request
+ * structures. The owning driver thread allocates from and frees into the
+ * local list without locking; frees from other threads go to the remote
+ * list, which the owner reclaims as a batch when its local list runs dry.
+ */
+
+typedef struct {
+    uintptr_t   owner;                  /* Thread id of the owning driver thread */
+    size_t      linkOffset;             /* Offset of the "nextPtr" member */
+    void       *localPtr;               /* Free objects, used only by the owner */
+    size_t      nrLocal;                /* Number of objects in localPtr */
+    Ns_Mutex    lock;                   /* Lock around the remote list */
+    void       *remotePtr;              /* Objects freed by other threads */
+    size_t      nrRemote;               /* Number of objects in remotePtr */
+    struct {
+        size_t      allocated;          /* Objects allocated by the owner */
+        size_t      foreign;            /* Objects allocated by other threads */
+        Tcl_WideInt reused;             /* Allocations served by the owner from the slab */
+        Tcl_WideInt remoteFrees;        /* Objects returned by other threads */
+        Tcl_WideInt reclaims;           /* Batches moved from the remote to the local list */
+    } stats;
+} DrvSlab;
+
 /*
  * ServerMap maintains Host header to server mappings, but is upaque for nsd.h
  */
@@ -466,6 +544,10 @@ typedef struct Driver {
     int sockacceptlog;                  /* Report, when more than this sockets are received in one step */
     int driverthreads;                  /* Number of identical driver threads to be created */
     unsigned int loggingFlags;          /* Logging control flags */
+    NsPollBackend pollBackend;          /* Event notification mechanism */
+    bool http2;                         /* Accept HTTP/2 connections */
+    bool leanKeepalive;                 /* Hold no buffers for idle keepalive connections */
+    int http2maxstreams;                /* Max concurrent streams per HTTP/2 connection */
 
     unsigned int flags;                 /* Driver state flags. */
     Ns_Thread thread;                   /* Thread id to join on shutdown. */
@@ -473,7 +555,8 @@ typedef struct Driver {
                                          * driver query, startup, and shutdown. */
     NS_SOCKET trigger[2];               /* Wakeup trigger pipe. */
 
-    struct Sock *sockPtr;               /* Free list of Sock structures */
+    DrvSlab sockSlab;                   /* Recycled Sock structures */
+    DrvSlab requestSlab;                /* Recycled Request structures */
     struct Sock *closePtr;              /* First conn ready for graceful close */
 
     DrvSpooler spooler;                 /* Tracks upload spooler threads */
@@ -485,6 +568,10 @@ typedef struct Driver {
         Tcl_WideInt partial;            /* Partial operations */
         Tcl_WideInt received;           /* Received requests */
         Tcl_WideInt errors;             /* Dropped requests due to errors */
+        Tcl_WideInt http2streams;       /* Requests received via HTTP/2 streams */
+        Tcl_WideInt fastpath;           /* Static files delivered by the driver */
+        size_t      idle;               /* Currently idle keepalive connections */
+        size_t      idleBytes;          /* Bytes held by the idle connections */
     } stats;
     Ns_DList ports;
     const char *libraryVersion;
@@ -536,8 +623,15 @@ typedef struct Sock {
 
     const char         *location;
     NS_POLL_NFDS_TYPE   pidx;             /* poll() index */
+    unsigned int        pollEvents;       /* Events registered in the kernel (epoll) */
+    struct PollData    *pollDataPtr;      /* Poll data of the thread with the registration (epoll) */
+    short               revents;          /* Events reported by last wait (epoll) */
     unsigned int        flags;            /* State flags used by driver */
     Ns_Time             timeout;
+    struct Sock        *timerNextPtr;     /* Links in the timing wheel of the driver thread */
+    struct Sock        *timerPrevPtr;
+    struct SockWheel   *timerWheelPtr;    /* Timing wheel containing the Sock, or NULL */
+    unsigned int        timerSlot;        /* Slot in the timing wheel (level * slots + index) */
     Request            *reqPtr;
 
     Ns_Time             acceptTime;
@@ -551,9 +645,13 @@ typedef struct Sock {
     Ns_SockState        recvSockState;    /* Results from the last recv operation */
     int                 tfd;              /* File descriptor with request contents */
     bool                keep;             /* Keep alive handling */
+    bool                idle;             /* Parked as idle keepalive connection */
+    size_t              idleBytes;        /* Bytes held while being idle */
     ssize_t             sendRejected;     /* handling of SSL_ERROR_WANT_WRITE */
     void               *sendRejectedBase; /* for retransmitting in case of SSL_ERROR_WANT_WRITE */
     size_t              sendCount;        // debugging
+    NsHttp2Conn        *h2ConnPtr;        /* HTTP/2 session, when the socket speaks HTTP/2 */
+    NsHttp2Stream      *h2StreamPtr;      /* HTTP/2 stream, when the Sock represents a stream */
     void               *sls[1];           /* Slots for sls storage */
 
 } Sock;
@@ -595,6 +693,46 @@ typedef struct NsLimits {
 
 } NsLimits;
 
+/*
+ * The following structure is a bounded multi-producer multi-consumer queue
+ * of pointers (see ring.c). The positions of producers and consumers are
+ * kept on separate cache lines.
+ */
+
+typedef struct NsRingCell {
+    size_t seq;
+    void  *data;
+} NsRingCell;
+
+typedef struct NsRing {
+    NsRingCell *cells;
+    size_t      mask;
+    size_t      enqueuePos;
+    char        pad[64 - sizeof(size_t)];
+    size_t      dequeuePos;
+    Ns_Mutex    lock;      /* used only without atomic builtins */
+} NsRing;
+
+/*
+ * The following structure maintains a request class of a connection pool.
+ * Requests are mapped to classes like to pools. The conn threads of the
+ * pool serve the classes in weighted fair order, requests of classes with
+ * a deadline are served earliest deadline first when they approach their
+ * deadline and are rejected when they have passed it.
+ */
+
+typedef struct ConnClass {
+    const char      *name;
+    struct ConnPool *poolPtr;
+    NsRing           ring;
+    Ns_Time          deadline;       /* zero means no deadline */
+    uint64_t         pass;           /* position in the stride schedule */
+    uint64_t         stride;
+    int              weight;
+    unsigned long    processed;
+    unsigned long    expired;
+} ConnClass;
+
 /*
  * The following structure maintains state for a connection
  * being processed.
@@ -622,6 +760,9 @@ typedef struct Conn {
     struct Conn *prevPtr;
     struct Conn *nextPtr;
     struct Sock *sockPtr;
+    bool queued;                 /* Waiting in the pool for a conn thread */
+    ConnClass *classPtr;         /* Request class, when the pool has classes */
+    char *microcacheKey;         /* Key for storing the response in the micro-cache */
 
     char peer[NS_IPADDR_SIZE];   /* Client peer address */
     char proxypeer[NS_IPADDR_SIZE]; /* Proxy peer address */
@@ -673,9 +814,11 @@ typedef struct Conn {
     NsWriterSock *strWriter;
     int rateLimit;          /* -1 undefined, 0 unlimited, otherwise KB/s */
 
-    Ns_CompressStream cStream;
+    Ns_CompressStream *cStreamPtr;      /* pooled compression stream, when compressing */
     int requestCompress;
     int compress;
+    NsCompressEncoding compressEncoding; /* content encoding of a compressed response */
+    int compressLevel;                   /* level for the content encoding */
 
     Ns_Set *query;
     Ns_Set *formData;
@@ -705,9 +848,7 @@ typedef enum {
 typedef struct ConnThreadArg {
     struct ConnPool      *poolPtr;
     struct Conn          *connPtr;
-    Ns_Cond               cond;        /* Cond for signaling this conn thread */
-    Ns_Mutex              lock;
-    struct ConnThreadArg *nextPtr;     /* used for the conn thread queue */
+    Ns_Mutex              lock;        /* Protects connPtr against "ns_server active" */
     ConnThreadState       state;
 } ConnThreadArg;
 
@@ -721,19 +862,19 @@ typedef struct ConnPool {
     struct NsServer *servPtr;
 
     /*
-     * The following struct maintains the active and waiting connection
-     * queues, the free conn list, the next conn id, and the number
-     * of waiting connects.
+     * The following struct maintains the ring of free conns and the ring of
+     * conns handed to the conn threads. "wait.num" counts the conns which
+     * were queued while no conn thread was idle. It is updated atomically,
+     * without atomic builtins it is protected by "lock".
      */
 
     struct {
-        Conn *freePtr;
-        int maxconns;
+        NsRing freeRing;
+        int    maxconns;
 
         struct {
-            Conn *firstPtr;
-            Conn *lastPtr;
-            int   num;
+            NsRing ring;
+            int    num;
         } wait;
 
         Ns_Cond  cond;
@@ -744,6 +885,21 @@ typedef struct ConnPool {
         bool     rejectoverrun;
     } wqueue;
 
+    /*
+     * The following struct maintains the request classes of the pool. When
+     * classes are configured, the conns are handed to the conn threads via
+     * the rings of the classes instead of "wqueue.wait.ring", "list[0]" is
+     * the default class. "lock" serializes the consumers and protects the
+     * schedule and the statistics of the classes.
+     */
+
+    struct {
+        Ns_Mutex   lock;
+        ConnClass *list;
+        int        num;
+        uint64_t   pass;             /* pass of the last served class */
+    } classes;
+
     /*
      * The following struct maintains the state of the threads.  Min and max
      * threads are determined at startup and then NsQueueConn ensures the
@@ -766,18 +922,58 @@ typedef struct ConnPool {
     } threads;
 
     /*
-     * The following struct maintains the state of the thread
-     * connection queue.  "nextPtr" points to the next available
-     * connection thread, "args" keeps the array of all configured
-     * connection structs, and "lock" is used for locking this queue.
+     * The following struct maintains the connection threads. "args" keeps
+     * the array of all configured connection thread slots. Idle threads
+     * park on "cond"; "lock" protects "cond", "threads.idle" and the
+     * thread states.
      */
 
     struct {
-        ConnThreadArg *nextPtr;
         ConnThreadArg *args;
+        Ns_Cond        cond;
         Ns_Mutex       lock;
     } tqueue;
 
+    /*
+     * The following struct maintains the adaptive thread controller
+     * ("threadcontrol adaptive"). It tracks the arrival rate, the service
+     * time and the queueing delay of the pool and derives the number of
+     * threads needed to keep the queueing delay below "target" (Little's
+     * law), extrapolating the arrival rate over the time needed to start a
+     * thread.
+     */
+
+    struct {
+        Ns_Mutex      lock;
+        bool          adaptive;
+        Ns_Time       target;
+        Ns_Time       windowStart;
+        unsigned long arrivals;      /* arrivals in the current window */
+        double        rate;          /* smoothed arrivals per second */
+        double        trend;         /* smoothed change of rate per second */
+        double        serviceTime;   /* smoothed seconds per request */
+        double        queueDelay;    /* smoothed queueing delay in seconds */
+        double        spawnTime;     /* smoothed seconds for starting a thread */
+        int           desired;
+    } autoscale;
+
+    /*
+     * The following struct maintains the CoDel controller, which sheds
+     * requests when their queueing delay stays above "target" for at least
+     * "interval". A zero "target" disables the controller.
+     */
+
+    struct {
+        Ns_Mutex     lock;
+        Ns_Time      target;
+        Ns_Time      interval;
+        Ns_Time      firstAbove;    /* end of the interval above target */
+        Ns_Time      dropNext;      /* earliest time for the next shed */
+        unsigned int count;         /* sheds in the current dropping state */
+        unsigned int lastCount;
+        bool         dropping;
+    } codel;
+
     /*
      * Track "statistics" such as counts or aggregated times.
      */
@@ -787,6 +983,7 @@ typedef struct ConnPool {
         unsigned long spool;
         unsigned long queued;
         unsigned long dropped;
+        unsigned long shed;
         unsigned long connthreads;
         Ns_Time acceptTime;          /* cumulated accept times */
         Ns_Time queueTime;           /* cumulated queue times */
@@ -872,8 +1069,29 @@ typedef struct NsServer {
         const char *diradp;
         Ns_UrlToFileProc *url2file;
         TCL_SIZE_T dirc;
+        const char **driverv;   /* URL prefixes delivered by the driver */
+        TCL_SIZE_T driverc;
     } fastpath;
 
+    /*
+     * The following struct maintains the response micro-cache, answering
+     * cacheable GET requests directly from the driver thread.
+     */
+
+    struct {
+        Ns_Cache    *cache;
+        size_t       maxentry;
+        Ns_Time      ttl;
+        bool         checkauth;
+        const char **varyv;
+        TCL_SIZE_T   varyc;
+        struct {
+            unsigned long hits;
+            unsigned long misses;
+            unsigned long stored;
+        } stats;
+    } microcache;
+
     /*
      * The following struct maintains virtual host config.
      */
@@ -952,6 +1170,8 @@ typedef struct NsServer {
         Tcl_HashTable     caches;
         Ns_RWLock         cachelock;
         uintptr_t         transactionEpoch;
+        const char       *snapshotfile;    /* nsv/cache snapshot loaded at startup */
+        int               snapshotthreads;
 
         /*
          * The following tracks synchronization
@@ -998,6 +1218,40 @@ typedef struct NsServer {
         int  minsize;   /* min size of response to compress, in bytes */
         bool enable;    /* on/off */
         bool preinit;   /* initialize the compression stream buffers in advance */
+        bool brotli;        /* use Brotli when accepted by the client */
+        int  brotliLevel;   /* Brotli quality 0-11 */
+        int  brotliWindow;  /* Brotli window size as log2, 10-24 */
+        int  brotliMinsize; /* min size of response to compress with Brotli */
+        bool zstd;          /* use zstd when accepted by the client */
+        int  zstdLevel;     /* zstd compression level 1-19 */
+        int  zstdMinsize;   /* min size of response to compress with zstd */
+
+        /*
+         * Adaptive compression ("compressadaptive"): under load, the
+         * compression levels are lowered step by step, and at the last
+         * step, responses smaller than "skipsize" are sent
+         * uncompressed. The load is the smoothed queueing delay and the
+         * percentage of busy connection threads of the compressed
+         * responses. The smoothed values, "step", "reduced" and
+         * "skipped" are accessed atomically; "lock" serializes only the
+         * periodic update of the step.
+         */
+        struct {
+            Ns_Mutex      lock;
+            bool          enable;
+            Ns_Time       delay;        /* queueing delay considered as overload */
+            Ns_Time       interval;     /* min time between step changes */
+            int           busy;         /* percentage of busy threads considered as overload */
+            int           skipsize;     /* at the last step, don't compress smaller responses */
+            int           step;         /* 0 means configured levels */
+            Tcl_WideInt   nextUpdate;   /* time of the next step update in microseconds */
+            double        queueDelay;   /* smoothed queueing delay in seconds */
+            double        busyPercent;  /* smoothed percentage of busy threads */
+            unsigned long lowered;
+            unsigned long raised;
+            unsigned long reduced;      /* responses compressed with lowered level */
+            unsigned long skipped;      /* responses not compressed due to load */
+        } adaptive;
     } compress;
 
     /*
@@ -1009,6 +1263,10 @@ typedef struct NsServer {
         struct Bucket *buckets;
         int nbuckets;
         bool rwlocks;
+        TCL_SIZE_T nreadmostly;
+        const char **readmostly;  /* Glob patterns of read-mostly arrays */
+        TCL_SIZE_T ncounters;
+        const char **counters;    /* Glob patterns of counter arrays */
     } nsv;
 
     /*
@@ -1269,6 +1527,7 @@ typedef struct _NsHttpChunk {
 #define NS_HTTP_HEADERS_PENDING    (1u<<10)
 #define NS_HTTP_PARTIAL_RESULTS    (1u<<11)
 #define NS_HTTP_OUTPUT_ERROR       (1u<<12)
+#define NS_HTTP_FLAG_ZSTD_ENCODING (1u<<13)
 
 /*
  * Definition of validity exceptions for accepting invalid peer certificates
@@ -1358,6 +1617,7 @@ NS_EXTERN TCL_OBJCMDPROC_T
     NsTclCertCtlObjCmd,
     NsTclChanObjCmd,
     NsTclCharsetsObjCmd,
+    NsTclCompressObjCmd,
     NsTclCondObjCmd,
     NsTclConfigObjCmd,
     NsTclConfigSectionObjCmd,
@@ -1418,6 +1678,7 @@ NS_EXTERN TCL_OBJCMDPROC_T
     NsTclLogObjCmd,
     NsTclLogRollObjCmd,
     NsTclMD5ObjCmd,
+    NsTclMicroCacheObjCmd,
     NsTclMkTempObjCmd,
     NsTclMkdTempObjCmd,
     NsTclModuleLoadObjCmd,
@@ -1502,6 +1763,7 @@ NS_EXTERN TCL_OBJCMDPROC_T
     NsTclShutdownObjCmd,
     NsTclSleepObjCmd,
     NsTclSlsObjCmd,
+    NsTclSnapshotObjCmd,
     NsTclSockAcceptObjCmd,
     NsTclSockCallbackObjCmd,
     NsTclSockCheckObjCmd,
@@ -1513,6 +1775,7 @@ NS_EXTERN TCL_OBJCMDPROC_T
     NsTclSockSetNonBlockingObjCmd,
     NsTclSocketPairObjCmd,
     NsTclStartContentObjCmd,
+    NsTclStatCacheObjCmd,
     NsTclStrcollObjCmd,
     NsTclStrftimeObjCmd,
     NsTclStripHtmlObjCmd,
@@ -1558,6 +1821,7 @@ NS_EXTERN void NsInitConf(void);
 NS_EXTERN void NsInitDNS(void);
 NS_EXTERN void NsInitDrivers(void);
 NS_EXTERN void NsInitFd(void);
+NS_EXTERN void NsInitHeaderScan(void);
 NS_EXTERN void NsInitHttptime(void);
 NS_EXTERN void NsInitInfo(void);
 NS_EXTERN void NsInitLimits(void);
@@ -1581,6 +1845,9 @@ NS_EXTERN void NsInitUrl2File(void);
 NS_EXTERN void NsConfigAdp(void);
 NS_EXTERN void NsConfigLog(void);
 NS_EXTERN void NsConfigFastpath(void);
+NS_EXTERN void NsConfigMicroCache(void);
+NS_EXTERN void NsConfigStatCache(void);
+NS_EXTERN void NsConfigCompress(void);
 NS_EXTERN void NsConfigMimeTypes(void);
 NS_EXTERN void NsConfigDNS(void);
 NS_EXTERN void NsConfigRedirects(void);
@@ -1717,6 +1984,22 @@ NS_EXTERN void NsConfigMarkAsRead(const char *section, size_t i) NS_GNUC_NONNULL
 NS_EXTERN const char *NsConfigRead(const char *file) NS_GNUC_MALLOC NS_GNUC_NONNULL(1);
 NS_EXTERN Ns_Set *NsConfigSectionGetFiltered(const char *section, char filter) NS_GNUC_NONNULL(1);
 
+/*
+ * compress.c
+ */
+NS_EXTERN void NsCompressBrotliEnd(Ns_CompressStream *cStream)
+    NS_GNUC_NONNULL(1);
+NS_EXTERN void NsCompressZstdEnd(Ns_CompressStream *cStream)
+    NS_GNUC_NONNULL(1);
+NS_EXTERN Ns_CompressStream *NsCompressStreamGet(void);
+NS_EXTERN void NsCompressStreamRelease(Ns_CompressStream *cStream)
+    NS_GNUC_NONNULL(1);
+NS_EXTERN void NsCompressPoolFill(int n);
+NS_EXTERN int NsCompressAdapt(NsServer *servPtr, const Conn *connPtr, size_t length, bool streaming)
+    NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(2);
+NS_EXTERN int NsCompressAdaptLevel(int level, int minLevel, int step)
+    NS_GNUC_CONST;
+
 /*
  * conn.c
  */
@@ -1808,6 +2091,12 @@ NS_EXTERN Request *NsGetRequest(Sock *sockPtr, const Ns_Time *nowPtr)
 NS_EXTERN void NsSockClose(Sock *sockPtr, int keep)
     NS_GNUC_NONNULL(1);
 
+NS_EXTERN bool NsSockKeepAlive(const Sock *sockPtr, size_t contentLength)
+    NS_GNUC_NONNULL(1);
+
+NS_EXTERN void NsSockAccessLog(Sock *sockPtr, ConnPool *poolPtr, int statusCode, size_t contentSent)
+    NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(2);
+
 NS_EXTERN void NsStopDrivers(void);
 NS_EXTERN void NsStopSpoolers(void);
 
@@ -1817,6 +2106,10 @@ NS_EXTERN void NsWriterLock(void);
 NS_EXTERN void NsWriterUnlock(void);
 NS_EXTERN void NsWriterFinish(NsWriterSock *wrSockPtr)
     NS_GNUC_NONNULL(1);
+NS_EXTERN Ns_ReturnCode NsWriterQueueSock(Sock *sockPtr, ConnPool *poolPtr,
+                                          const struct iovec *bufs, int nbufs,
+                                          int fd, size_t size, bool keep)
+    NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(2) NS_GNUC_NONNULL(3);
 
 /*
  * encoding.c
@@ -1833,9 +2126,17 @@ NS_EXTERN Ns_ReturnCode NsGetFallbackEncoding(Tcl_Interp *interp, NsServer *serv
                                               Tcl_Encoding *encodingPtr)
     NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(5);
 
+/*
+ * fastpath.c
+ */
+NS_EXTERN bool NsFastPathDriver(Sock *sockPtr)
+    NS_GNUC_NONNULL(1);
+
 /*
  * filter.c
  */
+NS_EXTERN bool NsFiltersMatch(NsServer *servPtr, const char *method, const char *url)
+    NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(2) NS_GNUC_NONNULL(3);
 NS_EXTERN void NsGetTraces(Tcl_DString *dsPtr, const NsServer *servPtr) NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(2);
 NS_EXTERN void NsGetFilters(Tcl_DString *dsPtr, const NsServer *servPtr) NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(2);
 
@@ -1845,6 +2146,58 @@ NS_EXTERN void NsRunTraces(Ns_Conn *conn) NS_GNUC_NONNULL(1);
 NS_EXTERN void NsRunSelectedTraces(Ns_Conn *conn, const char *traceProcDescription)
     NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(2);
 
+/*
+ * hdrscan.c
+ */
+NS_EXTERN char *NsHeaderScanLine(char *line, size_t length, NsHeaderScan *scanPtr)
+    NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(3);
+
+NS_EXTERN const char *NsHeaderScanName(void)
+    NS_GNUC_RETURNS_NONNULL;
+
+/*
+ * http2.c
+ */
+#define NS_HTTP2_PREFACE_LENGTH 24u
+
+NS_EXTERN bool NsHttp2Supported(void) NS_GNUC_CONST;
+
+NS_EXTERN int NsHttp2Preface(const char *buffer, size_t length)
+    NS_GNUC_NONNULL(1) NS_GNUC_PURE;
+
+NS_EXTERN NsHttp2Conn *NsHttp2ConnNew(Sock *sockPtr)
+    NS_GNUC_NONNULL(1);
+
+NS_EXTERN void NsHttp2ConnClose(NsHttp2Conn *h2Ptr)
+    NS_GNUC_NONNULL(1);
+
+NS_EXTERN Ns_ReturnCode NsHttp2Read(NsHttp2Conn *h2Ptr, const char *buffer, size_t length)
+    NS_GNUC_NONNULL(1);
+
+NS_EXTERN Ns_ReturnCode NsHttp2Flush(NsHttp2Conn *h2Ptr)
+    NS_GNUC_NONNULL(1);
+
+NS_EXTERN bool NsHttp2WantWrite(NsHttp2Conn *h2Ptr)
+    NS_GNUC_NONNULL(1);
+
+NS_EXTERN bool NsHttp2Busy(NsHttp2Conn *h2Ptr)
+    NS_GNUC_NONNULL(1);
+
+NS_EXTERN NsHttp2Stream *NsHttp2NextRequest(NsHttp2Conn *h2Ptr)
+    NS_GNUC_NONNULL(1);
+
+NS_EXTERN bool NsHttp2StreamAttach(NsHttp2Stream *streamPtr, Sock *sockPtr)
+    NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(2);
+
+NS_EXTERN void NsHttp2StreamClose(Sock *sockPtr)
+    NS_GNUC_NONNULL(1);
+
+NS_EXTERN ssize_t NsHttp2Send(Sock *sockPtr, const struct iovec *bufs, int nbufs)
+    NS_GNUC_NONNULL(1);
+
+NS_EXTERN ssize_t NsHttp2SendFile(Sock *sockPtr, const Ns_FileVec *bufs, int nbufs)
+    NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(2);
+
 /*
  * limits.c
  */
@@ -1925,6 +2278,69 @@ NS_EXTERN ns_funcptr_t NsGetProcFunction(const char *description) NS_GNUC_NONNUL
 NS_EXTERN void NsConfigProgress(void);
 NS_EXTERN void NsUpdateProgress(Ns_Sock *sock) NS_GNUC_NONNULL(1);
 
+/*
+ * microcache.c
+ */
+
+NS_EXTERN char *NsMicroCacheConnKey(const Conn *connPtr)
+    NS_GNUC_NONNULL(1);
+
+NS_EXTERN void NsMicroCacheStore(Conn *connPtr, const char *header, size_t headerLength,
+                                 const struct iovec *bufs, int nbufs, size_t bodyLength)
+    NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(2);
+
+NS_EXTERN bool NsMicroCacheServe(Sock *sockPtr, const Ns_Time *nowPtr)
+    NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(2);
+
+/*
+ * statcache.c
+ */
+
+NS_EXTERN bool NsStatCached(const char *path, struct stat *stPtr)
+    NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(2);
+
+NS_EXTERN void NsStatCacheInvalidate(const char *path)
+    NS_GNUC_NONNULL(1);
+
+/*
+ * snapshot.c
+ */
+
+#define NS_SNAPSHOT_NSV   1
+#define NS_SNAPSHOT_CACHE 2
+
+typedef struct NsSnapshotReader {
+    const unsigned char *next;
+    const unsigned char *end;
+    bool                 error;
+} NsSnapshotReader;
+
+NS_EXTERN void NsSnapshotPutInt(Tcl_DString *dsPtr, uint64_t value, size_t nbytes)
+    NS_GNUC_NONNULL(1);
+
+NS_EXTERN void NsSnapshotPutBytes(Tcl_DString *dsPtr, const char *bytes, size_t length)
+    NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(2);
+
+NS_EXTERN TCL_SIZE_T NsSnapshotBeginSection(Tcl_DString *dsPtr, int type, const char *name)
+    NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(3);
+
+NS_EXTERN void NsSnapshotEndSection(Tcl_DString *dsPtr, TCL_SIZE_T offset)
+    NS_GNUC_NONNULL(1);
+
+NS_EXTERN uint64_t NsSnapshotGetInt(NsSnapshotReader *readerPtr, size_t nbytes)
+    NS_GNUC_NONNULL(1);
+
+NS_EXTERN const char *NsSnapshotGetBytes(NsSnapshotReader *readerPtr, size_t *lengthPtr)
+    NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(2);
+
+NS_EXTERN Ns_ReturnCode NsSnapshotSave(NsServer *servPtr, const char *path, const char *nsvPattern,
+                                       const char *cachePattern, Tcl_DString *statsPtr)
+    NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(2) NS_GNUC_NONNULL(5);
+
+NS_EXTERN Ns_ReturnCode NsSnapshotLoad(NsServer *servPtr, const char *path, int nthreads,
+                                       Tcl_DString *statsPtr)
+    NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(2);
+
 /*
  * queue.c
  */
@@ -1934,12 +2350,18 @@ NS_EXTERN Ns_Set *NsHeaderSetGet(size_t size);
 NS_EXTERN Ns_ReturnCode NsQueueConn(Sock *sockPtr, const Ns_Time *nowPtr)
     NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(2);
 
+NS_EXTERN ConnPool *NsPoolLookup(Sock *sockPtr)
+    NS_GNUC_NONNULL(1);
+
 NS_EXTERN void NsEnsureRunningConnectionThreads(const NsServer *servPtr, ConnPool *poolPtr)
     NS_GNUC_NONNULL(1);
 
 NS_EXTERN void NsMapPool(ConnPool *poolPtr, const char *mapString, unsigned int flags)
     NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(2);
 
+NS_EXTERN void NsMapClass(ConnClass *classPtr, const char *mapString, unsigned int flags)
+    NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(2);
+
 NS_EXTERN const char *NsPoolName(const char *poolName)
         NS_GNUC_NONNULL(1) NS_GNUC_PURE;
 
@@ -1953,6 +2375,28 @@ NS_EXTERN void NsPoolAddBytesSent(ConnPool *poolPtr, Tcl_WideInt bytesSent)
     NS_GNUC_NONNULL(1);
 
 
+/*
+ * ring.c
+ */
+
+NS_EXTERN void NsRingInit(NsRing *ringPtr, size_t capacity, const char *prefix, const char *name)
+    NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(3) NS_GNUC_NONNULL(4);
+
+NS_EXTERN bool NsRingPush(NsRing *ringPtr, void *data)
+    NS_GNUC_NONNULL(1);
+
+NS_EXTERN void *NsRingPop(NsRing *ringPtr)
+    NS_GNUC_NONNULL(1);
+
+NS_EXTERN size_t NsRingCount(NsRing *ringPtr)
+    NS_GNUC_NONNULL(1);
+
+NS_EXTERN size_t NsRingSnapshot(NsRing *ringPtr, void **elements, size_t maxElements)
+    NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(2);
+
+NS_EXTERN void *NsRingPeek(NsRing *ringPtr)
+    NS_GNUC_NONNULL(1);
+
 /*
  * range.c
  */
@@ -1965,8 +2409,12 @@ NS_EXTERN int NsConnParseRange(Ns_Conn *conn, const char *type,
 /*
  * request.c
  */
-NS_EXTERN void NsParseAcceptEncoding(double version, const char *hdr, bool *gzipAcceptPtr, bool *brotliAcceptPtr)
-    NS_GNUC_NONNULL(2) NS_GNUC_NONNULL(3) NS_GNUC_NONNULL(4);
+NS_EXTERN void NsParseAcceptEncoding(double version, const char *hdr, bool *gzipAcceptPtr, bool *brotliAcceptPtr,
+                                     bool *zstdAcceptPtr)
+    NS_GNUC_NONNULL(2) NS_GNUC_NONNULL(3) NS_GNUC_NONNULL(4) NS_GNUC_NONNULL(5);
+
+NS_EXTERN size_t NsParseHeaderField(Ns_Set *set, char *line, char *sep, Ns_HeaderCaseDisposition disp)
+    NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(2) NS_GNUC_NONNULL(3);
 
 /*
  * return.c
@@ -2051,6 +2499,17 @@ NS_EXTERN void NsHexPrint(const char *msg, const unsigned char *octets, size_t o
 NS_EXTERN void NsStartTaskQueueShutdown(void);
 NS_EXTERN void NsWaitTaskQueueShutdown(const Ns_Time *toPtr);
 
+/*
+ * tclcache.c
+ */
+NS_EXTERN size_t NsTclCacheSnapshot(NsServer *servPtr, const char *pattern, Tcl_DString *dsPtr,
+                                    size_t *entriesPtr)
+    NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(2) NS_GNUC_NONNULL(3) NS_GNUC_NONNULL(4);
+
+NS_EXTERN Ns_ReturnCode NsTclCacheRestore(NsServer *servPtr, const char *name,
+                                          NsSnapshotReader *readerPtr, size_t *entriesPtr)
+    NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(2) NS_GNUC_NONNULL(3) NS_GNUC_NONNULL(4);
+
 /*
  * tclcmds.c
  */
@@ -2130,6 +2589,14 @@ NS_EXTERN void NsTclInitTimeType(void);
 NS_EXTERN struct Bucket *NsTclCreateBuckets(const NsServer *servPtr, int nbuckets)
     NS_GNUC_NONNULL(1);
 
+NS_EXTERN size_t NsTclNsvSnapshot(NsServer *servPtr, const char *pattern, Tcl_DString *dsPtr,
+                                  size_t *entriesPtr)
+    NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(2) NS_GNUC_NONNULL(3) NS_GNUC_NONNULL(4);
+
+NS_EXTERN Ns_ReturnCode NsTclNsvRestore(NsServer *servPtr, const char *name,
+                                        NsSnapshotReader *readerPtr, size_t *entriesPtr)
+    NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(2) NS_GNUC_NONNULL(3) NS_GNUC_NONNULL(4);
+
 
 #ifdef NS_WITH_DEPRECATED
 /*
@@ -2180,6 +2647,9 @@ NS_EXTERN void NsGetUrl2FileProcs(Tcl_DString *dsPtr, const char *server)
 NS_EXTERN Ns_ReturnCode NsUrlToFile(Tcl_DString *dsPtr, NsServer *servPtr, const char *url)
     NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(2) NS_GNUC_NONNULL(3);
 
+NS_EXTERN bool NsUrlToFileDriver(Tcl_DString *dsPtr, NsServer *servPtr, const char *host, const char *url)
+    NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(2) NS_GNUC_NONNULL(4);
+
 
 /*
  * urlspace.c
@@ -78,6 +78,14 @@
 # include <openssl/ssl.h>
 # include <openssl/err.h>
 
+/*
+ * Kernel TLS (kTLS) send offload, including SSL_sendfile(), is available
+ * since OpenSSL 3.0 when the library was built with kTLS support.
+ */
+# if defined(HAVE_OPENSSL_3) && defined(SSL_OP_ENABLE_KTLS) && !defined(OPENSSL_NO_KTLS)
+#  define HAVE_OPENSSL_KTLS 1
+# endif
+
 typedef struct NsSSLConfig {
     SSL_CTX    *ctx;
     Ns_Mutex    lock;
@@ -85,6 +93,8 @@ typedef struct NsSSLConfig {
     int         verify;
     int         deferaccept;  /* Enable the TCP_DEFER_ACCEPT optimization. */
     int         nodelay;      /* Enable the TCP_NODELAY optimization. */
+    int         ktls;         /* Enable kernel TLS offload (SSL_OP_ENABLE_KTLS). */
+    int         leankeepalive; /* Release TLS buffers of idle connections (SSL_MODE_RELEASE_BUFFERS). */
     DH         *dhKey512;     /* Fallback Diffie Hellman keys of length 512 */
     DH         *dhKey1024;    /* Fallback Diffie Hellman keys of length 1024 */
     DH         *dhKey2048;    /* Fallback Diffie Hellman keys of length 2048 */
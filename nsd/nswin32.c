@@ -590,6 +590,7 @@ NsMemMap(const char *path, size_t size, int mode, FileMap *mapPtr)
             mapPtr->handle = hndl;
             mapPtr->addr   = (void *) addr;
             mapPtr->size   = size;
+            mapPtr->releaseProc = NULL;
         }
     }
 
@@ -602,7 +603,8 @@ NsMemMap(const char *path, size_t size, int mode, FileMap *mapPtr)
  *
  * NsMemUmap --
  *
- *      Unmaps a file.
+ *      Unmaps a file. For shared regions, the release callback is
+ *      called instead.
  *
  * Results:
  *      None.
@@ -616,9 +618,13 @@ NsMemMap(const char *path, size_t size, int mode, FileMap *mapPtr)
 void
 NsMemUmap(const FileMap *mapPtr)
 {
-    UnmapViewOfFile((LPCVOID)mapPtr->addr);
-    (void)CloseHandle((HANDLE)mapPtr->mapobj);
-    (void)CloseHandle((HANDLE)mapPtr->handle);
+    if (mapPtr->releaseProc != NULL) {
+        (*mapPtr->releaseProc)(mapPtr->releaseArg);
+    } else {
+        UnmapViewOfFile((LPCVOID)mapPtr->addr);
+        (void)CloseHandle((HANDLE)mapPtr->mapobj);
+        (void)CloseHandle((HANDLE)mapPtr->handle);
+    }
 }
 
 
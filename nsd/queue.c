@@ -18,11 +18,16 @@
 
 #include "nsd.h"
 
+/*
+ * math.h is only needed for sqrt() in the CoDel control law.
+ */
+#include <math.h>
+
 /*
  * Local functions defined in this file
  */
 
-static void ConnRun(Conn *connPtr)
+static void ConnRun(Conn *connPtr, bool expired)
     NS_GNUC_NONNULL(1);
 
 static void CreateConnThread(ConnPool *poolPtr)
@@ -30,15 +35,46 @@ static void CreateConnThread(ConnPool *poolPtr)
 
 static void AppendConn(Tcl_DString *dsPtr, const Conn *connPtr, const char *state, bool checkforproxy)
     NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(3);
-static void AppendConnList(Tcl_DString *dsPtr, const Conn *firstPtr, const char *state, bool checkforproxy)
-    NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(3);
 
 static bool neededAdditionalConnectionThreads(const ConnPool *poolPtr)
     NS_GNUC_NONNULL(1);
 
+static void AutoscaleUpdate(ConnPool *poolPtr, const Ns_Time *nowPtr, bool arrival)
+    NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(2);
+
+static void AutoscaleSample(ConnPool *poolPtr, const Conn *connPtr, const Ns_Time *nowPtr)
+    NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(2) NS_GNUC_NONNULL(3);
+
+static int AutoscaleFloor(const ConnPool *poolPtr)
+    NS_GNUC_NONNULL(1) NS_GNUC_PURE;
+
+static bool CodelShed(ConnPool *poolPtr, const Ns_Time *nowPtr)
+    NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(2);
+
+static void CodelUpdate(ConnPool *poolPtr, const Conn *connPtr)
+    NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(2);
+
 static void WakeupConnThreads(ConnPool *poolPtr)
     NS_GNUC_NONNULL(1);
 
+static void WaitPush(ConnPool *poolPtr, Conn *connPtr)
+    NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(2);
+
+static Conn *WaitPop(ConnPool *poolPtr)
+    NS_GNUC_NONNULL(1);
+
+static size_t WaitCount(ConnPool *poolPtr)
+    NS_GNUC_NONNULL(1);
+
+static Conn *ClassesPop(ConnPool *poolPtr)
+    NS_GNUC_NONNULL(1);
+
+static bool ClassExpired(Conn *connPtr)
+    NS_GNUC_NONNULL(1);
+
+static ConnClass *ClassFind(const ConnPool *poolPtr, const char *name)
+    NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(2);
+
 static Ns_ReturnCode MapspecParse(Tcl_Interp *interp, Tcl_Obj *mapspecObj, char **method, char **url,
                                   NsUrlSpaceContextSpec **specPtr)
     NS_GNUC_NONNULL(2) NS_GNUC_NONNULL(3) NS_GNUC_NONNULL(4) NS_GNUC_NONNULL(5);
@@ -71,7 +107,11 @@ static int ServerMappedObjCmd(ClientData clientData, Tcl_Interp *interp, TCL_SIZ
     NS_GNUC_NONNULL(2) NS_GNUC_NONNULL(4) NS_GNUC_NONNULL(5);
 
 static int ServerUnmapObjCmd(ClientData clientData, Tcl_Interp *interp, TCL_SIZE_T objc, Tcl_Obj *const* objv,
-                             NsServer *servPtr, TCL_SIZE_T nargs)
+                             NsServer *servPtr, const ConnPool *poolPtr, TCL_SIZE_T nargs)
+    NS_GNUC_NONNULL(2) NS_GNUC_NONNULL(4) NS_GNUC_NONNULL(5) NS_GNUC_NONNULL(6);
+
+static int ServerClassesObjCmd(ClientData clientData, Tcl_Interp *interp, TCL_SIZE_T objc, Tcl_Obj *const* objv,
+                               ConnPool *poolPtr, TCL_SIZE_T nargs)
     NS_GNUC_NONNULL(2) NS_GNUC_NONNULL(4) NS_GNUC_NONNULL(5);
 
 static void ConnThreadSetName(const char *server, const char *pool, uintptr_t threadId, uintptr_t connId)
@@ -104,6 +144,7 @@ static Ns_ArgProc WalkCallback;
 
 static Ns_Tls argtls = NULL;
 static int    poolid = 0;
+static int    classid = 0;
 
 /*
  * Debugging stuff
@@ -112,12 +153,17 @@ static int    poolid = 0;
 
 #if 0
 static void ConnThreadQueuePrint(ConnPool *poolPtr, char *key) {
-    ConnThreadArg *aPtr;
+    int i;
 
-    fprintf(stderr, "%s: thread queue (idle %d): ", key, poolPtr->threads.idle);
+    fprintf(stderr, "%s: thread queue (idle %d, waiting %lu): ", key, poolPtr->threads.idle,
+            (unsigned long)WaitCount(poolPtr));
     Ns_MutexLock(&poolPtr->tqueue.lock);
-    for (aPtr = poolPtr->tqueue.nextPtr; aPtr; aPtr = aPtr->nextPtr) {
-        fprintf(stderr, "[%d] state %d, ", ThreadNr(poolPtr, aPtr), aPtr->state);
+    for (i = 0; i < poolPtr->threads.max; i++) {
+        const ConnThreadArg *aPtr = &poolPtr->tqueue.args[i];
+
+        if (aPtr->state == connThread_idle) {
+            fprintf(stderr, "[%d] state %d, ", ThreadNr(poolPtr, aPtr), aPtr->state);
+        }
     }
     Ns_MutexUnlock(&poolPtr->tqueue.lock);
     fprintf(stderr, "\n");
@@ -146,6 +192,7 @@ NsInitQueue(void)
 {
     Ns_TlsAlloc(&argtls, NULL);
     poolid = Ns_UrlSpecificAlloc();
+    classid = Ns_UrlSpecificAlloc();
 }
 
 
@@ -218,6 +265,48 @@ NsMapPool(ConnPool *poolPtr, const char *mapString, unsigned int flags)
     Tcl_DecrRefCount(mapspecObj);
 }
 
+/*
+ *----------------------------------------------------------------------
+ *
+ * NsMapClass --
+ *
+ *      Map a method/URL to the given request class of a pool.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Requests for given URL's will be serviced in the given class, when
+ *      they are mapped to the pool of the class.
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+NsMapClass(ConnClass *classPtr, const char *mapString, unsigned int flags)
+{
+    char                  *method, *url;
+    Tcl_Obj               *mapspecObj;
+    NsUrlSpaceContextSpec *specPtr;
+
+    NS_NONNULL_ASSERT(classPtr != NULL);
+    NS_NONNULL_ASSERT(mapString != NULL);
+
+    mapspecObj = Tcl_NewStringObj(mapString, TCL_INDEX_NONE);
+
+    Tcl_IncrRefCount(mapspecObj);
+    if (MapspecParse(NULL, mapspecObj, &method, &url, &specPtr) == NS_OK) {
+        Ns_UrlSpecificSet2(classPtr->poolPtr->servPtr->server, method, url, classid,
+                           classPtr, flags, NULL, specPtr);
+    } else {
+        Ns_Log(Warning,
+               "invalid mapspec '%s' for class %s; must be 2- or 3-element list "
+               "containing HTTP method, URL, and optionally a filtercontext",
+               mapString, classPtr->name);
+    }
+    Tcl_DecrRefCount(mapspecObj);
+}
+
 /*
  *----------------------------------------------------------------------
  *
@@ -380,7 +469,23 @@ neededAdditionalConnectionThreads(const ConnPool *poolPtr) {
      * - AND there are not yet max-threads running.
      *
      */
-    if ( (poolPtr->threads.creating == 0
+    if (poolPtr->autoscale.adaptive) {
+        /*
+         * In adaptive mode, create threads up to the number determined by
+         * the controller. Since "current" includes the threads being
+         * created, several threads can be started in parallel ahead of a
+         * predicted ramp.
+         */
+        wantCreate = (poolPtr->threads.current < poolPtr->threads.max
+                      && (poolPtr->threads.current < poolPtr->threads.min
+                          || poolPtr->threads.current < poolPtr->autoscale.desired));
+        if (wantCreate) {
+            Ns_MutexLock(&poolPtr->servPtr->pools.lock);
+            wantCreate = (!poolPtr->servPtr->pools.shutdown);
+            Ns_MutexUnlock(&poolPtr->servPtr->pools.lock);
+        }
+
+    } else if ( (poolPtr->threads.creating == 0
           || poolPtr->wqueue.wait.num > poolPtr->wqueue.highwatermark
           )
          && (poolPtr->threads.current < poolPtr->threads.min
@@ -419,6 +524,544 @@ neededAdditionalConnectionThreads(const ConnPool *poolPtr) {
 }
 
 
+/*
+ *----------------------------------------------------------------------
+ *
+ * AutoscaleUpdate --
+ *
+ *      Update the adaptive thread controller of a pool. Arrivals are
+ *      counted per window; at the end of each window, the smoothed arrival
+ *      rate and its trend are updated, and the number of desired threads
+ *      is recomputed:
+ *
+ *          rate'   = rate + max(trend, 0) * (spawnTime + window)
+ *          desired = ceil(rate' * serviceTime / utilization)
+ *
+ *      When the queueing delay is above the target, at least one more
+ *      thread than currently running is desired. The desired number
+ *      decreases by at most one thread per window to avoid thrashing,
+ *      since starting a thread requires a full interpreter
+ *      initialization.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Updates the controller state of the pool.
+ *
+ *----------------------------------------------------------------------
+ */
+
+#define AUTOSCALE_WINDOW       0.25  /* seconds */
+#define AUTOSCALE_ALPHA        0.3   /* weight of a new sample */
+#define AUTOSCALE_UTILIZATION  0.8   /* target utilization of the threads */
+
+static void
+AutoscaleUpdate(ConnPool *poolPtr, const Ns_Time *nowPtr, bool arrival)
+{
+    Ns_Time diff;
+    double  elapsed;
+
+    NS_NONNULL_ASSERT(poolPtr != NULL);
+    NS_NONNULL_ASSERT(nowPtr != NULL);
+
+    Ns_MutexLock(&poolPtr->autoscale.lock);
+    if (arrival) {
+        poolPtr->autoscale.arrivals++;
+    }
+    if (poolPtr->autoscale.windowStart.sec == 0) {
+        poolPtr->autoscale.windowStart = *nowPtr;
+    }
+    (void)Ns_DiffTime(nowPtr, &poolPtr->autoscale.windowStart, &diff);
+    elapsed = (double)diff.sec + (double)diff.usec / 1000000.0;
+
+    if (elapsed >= AUTOSCALE_WINDOW) {
+        double rate, busy, target;
+        int    needed, current = poolPtr->threads.current;
+
+        rate = (double)poolPtr->autoscale.arrivals / elapsed;
+        poolPtr->autoscale.trend += AUTOSCALE_ALPHA
+            * ((rate - poolPtr->autoscale.rate) / elapsed - poolPtr->autoscale.trend);
+        poolPtr->autoscale.rate += AUTOSCALE_ALPHA * (rate - poolPtr->autoscale.rate);
+        if (poolPtr->autoscale.arrivals == 0u) {
+            /*
+             * Without requests, there are no new samples of the queueing
+             * delay; let the old ones fade out.
+             */
+            poolPtr->autoscale.queueDelay *= (1.0 - AUTOSCALE_ALPHA);
+        }
+
+        rate = poolPtr->autoscale.rate;
+        if (poolPtr->autoscale.trend > 0.0) {
+            rate += poolPtr->autoscale.trend * (poolPtr->autoscale.spawnTime + AUTOSCALE_WINDOW);
+        }
+        busy = rate * poolPtr->autoscale.serviceTime / AUTOSCALE_UTILIZATION;
+        needed = (int)ceil(busy);
+
+        target = (double)poolPtr->autoscale.target.sec
+            + (double)poolPtr->autoscale.target.usec / 1000000.0;
+        if (poolPtr->autoscale.queueDelay > target && needed <= current) {
+            needed = current + 1;
+        }
+        if (needed < poolPtr->autoscale.desired) {
+            needed = poolPtr->autoscale.desired - 1;
+        }
+        if (needed > poolPtr->threads.max) {
+            needed = poolPtr->threads.max;
+        }
+        if (needed < poolPtr->threads.min) {
+            needed = poolPtr->threads.min;
+        }
+        if (needed != poolPtr->autoscale.desired) {
+            Ns_Log(Debug, "[%s pool %s] autoscale desired threads %d -> %d"
+                   " (rate %.1f/s trend %.1f/s2 service %.4fs delay %.4fs current %d)",
+                   poolPtr->servPtr->server, poolPtr->pool,
+                   poolPtr->autoscale.desired, needed,
+                   poolPtr->autoscale.rate, poolPtr->autoscale.trend,
+                   poolPtr->autoscale.serviceTime, poolPtr->autoscale.queueDelay,
+                   current);
+            poolPtr->autoscale.desired = needed;
+        }
+
+        poolPtr->autoscale.arrivals = 0u;
+        poolPtr->autoscale.windowStart = *nowPtr;
+    }
+    Ns_MutexUnlock(&poolPtr->autoscale.lock);
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * AutoscaleSample --
+ *
+ *      Feed the service time and the queueing delay of a finished request
+ *      into the adaptive thread controller.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Updates the controller state of the pool.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+AutoscaleSample(ConnPool *poolPtr, const Conn *connPtr, const Ns_Time *nowPtr)
+{
+    Ns_Time service, delay;
+
+    NS_NONNULL_ASSERT(poolPtr != NULL);
+    NS_NONNULL_ASSERT(connPtr != NULL);
+    NS_NONNULL_ASSERT(nowPtr != NULL);
+
+    (void)Ns_DiffTime(nowPtr, &connPtr->requestDequeueTime, &service);
+    (void)Ns_DiffTime(&connPtr->requestDequeueTime, &connPtr->requestQueueTime, &delay);
+
+    Ns_MutexLock(&poolPtr->autoscale.lock);
+    poolPtr->autoscale.serviceTime += AUTOSCALE_ALPHA
+        * ((double)service.sec + (double)service.usec / 1000000.0 - poolPtr->autoscale.serviceTime);
+    poolPtr->autoscale.queueDelay += AUTOSCALE_ALPHA
+        * ((double)delay.sec + (double)delay.usec / 1000000.0 - poolPtr->autoscale.queueDelay);
+    Ns_MutexUnlock(&poolPtr->autoscale.lock);
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * AutoscaleFloor --
+ *
+ *      Return the number of connection threads, which should not exit on
+ *      idle timeout.
+ *
+ * Results:
+ *      Number of threads.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+AutoscaleFloor(const ConnPool *poolPtr)
+{
+    NS_NONNULL_ASSERT(poolPtr != NULL);
+
+    if (poolPtr->autoscale.adaptive && poolPtr->autoscale.desired > poolPtr->threads.min) {
+        return poolPtr->autoscale.desired;
+    }
+    return poolPtr->threads.min;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * CodelEnabled --
+ *
+ *      Check, whether the CoDel controller is configured for the pool.
+ *
+ *----------------------------------------------------------------------
+ */
+#define CodelEnabled(poolPtr) \
+    ((poolPtr)->codel.target.sec != 0 || (poolPtr)->codel.target.usec != 0)
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * CodelUpdate --
+ *
+ *      Feed the queueing delay (sojourn time) of a dequeued connection into
+ *      the CoDel controller of the pool. When the delay stays above the
+ *      target for a full interval, the pool enters the dropping state, in
+ *      which the driver sheds arriving requests (see CodelShed()). A delay
+ *      below the target leaves the dropping state.
+ *
+ *      In contrast to classical CoDel, which drops at dequeue, the
+ *      requests are shed on arrival, since rejecting a request early is
+ *      much cheaper than dequeuing it into a connection thread.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Updates the CoDel state of the pool.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+CodelUpdate(ConnPool *poolPtr, const Conn *connPtr)
+{
+    Ns_Time sojourn;
+
+    NS_NONNULL_ASSERT(poolPtr != NULL);
+    NS_NONNULL_ASSERT(connPtr != NULL);
+
+    (void)Ns_DiffTime(&connPtr->requestDequeueTime, &connPtr->requestQueueTime, &sojourn);
+
+    Ns_MutexLock(&poolPtr->codel.lock);
+    if (Ns_DiffTime(&sojourn, &poolPtr->codel.target, NULL) < 0) {
+        poolPtr->codel.firstAbove.sec = 0;
+        poolPtr->codel.firstAbove.usec = 0;
+        poolPtr->codel.dropping = NS_FALSE;
+
+    } else if (poolPtr->codel.firstAbove.sec == 0 && poolPtr->codel.firstAbove.usec == 0) {
+        poolPtr->codel.firstAbove = connPtr->requestDequeueTime;
+        Ns_IncrTime(&poolPtr->codel.firstAbove,
+                    poolPtr->codel.interval.sec, poolPtr->codel.interval.usec);
+
+    } else if (!poolPtr->codel.dropping
+               && Ns_DiffTime(&connPtr->requestDequeueTime, &poolPtr->codel.firstAbove, NULL) >= 0) {
+        Ns_Time      recent;
+        unsigned int delta = poolPtr->codel.count - poolPtr->codel.lastCount;
+
+        /*
+         * Enter the dropping state. When we were dropping recently, resume
+         * with the previous shedding rate instead of starting over.
+         */
+        recent = poolPtr->codel.dropNext;
+        Ns_IncrTime(&recent, poolPtr->codel.interval.sec * 16, poolPtr->codel.interval.usec * 16);
+        if (delta > 1u && Ns_DiffTime(&connPtr->requestDequeueTime, &recent, NULL) < 0) {
+            poolPtr->codel.count = delta;
+        } else {
+            poolPtr->codel.count = 0u;
+        }
+        poolPtr->codel.lastCount = poolPtr->codel.count;
+        poolPtr->codel.dropNext = connPtr->requestDequeueTime;
+        poolPtr->codel.dropping = NS_TRUE;
+
+        Ns_Log(Notice, "[%s pool %s] queueing delay " NS_TIME_FMT " above target, start shedding requests",
+               poolPtr->servPtr->server, poolPtr->pool,
+               (int64_t)sojourn.sec, sojourn.usec);
+    }
+    Ns_MutexUnlock(&poolPtr->codel.lock);
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * CodelShed --
+ *
+ *      Decide, whether an arriving request should be shed. In the dropping
+ *      state, requests are shed at a rate increasing with the square root
+ *      of the number of sheds (CoDel control law). When nothing is waiting
+ *      for a connection thread, the dropping state is left.
+ *
+ * Results:
+ *      NS_TRUE when the request should be rejected.
+ *
+ * Side effects:
+ *      Updates the CoDel state and the "shed" statistics of the pool.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static bool
+CodelShed(ConnPool *poolPtr, const Ns_Time *nowPtr)
+{
+    bool shed = NS_FALSE;
+
+    NS_NONNULL_ASSERT(poolPtr != NULL);
+    NS_NONNULL_ASSERT(nowPtr != NULL);
+
+    if (NsAtomicLoad(&poolPtr->codel.dropping)) {
+        Ns_MutexLock(&poolPtr->codel.lock);
+        if (WaitCount(poolPtr) == 0u) {
+            poolPtr->codel.dropping = NS_FALSE;
+            poolPtr->codel.firstAbove.sec = 0;
+            poolPtr->codel.firstAbove.usec = 0;
+
+        } else if (poolPtr->codel.dropping
+                   && Ns_DiffTime(nowPtr, &poolPtr->codel.dropNext, NULL) >= 0) {
+            double interval;
+
+            shed = NS_TRUE;
+            poolPtr->codel.count++;
+            poolPtr->stats.shed++;
+
+            interval = (double)poolPtr->codel.interval.sec * 1000000.0
+                + (double)poolPtr->codel.interval.usec;
+            poolPtr->codel.dropNext = *nowPtr;
+            Ns_IncrTime(&poolPtr->codel.dropNext, 0,
+                        (long)(interval / sqrt((double)poolPtr->codel.count)));
+        }
+        Ns_MutexUnlock(&poolPtr->codel.lock);
+    }
+
+    return shed;
+}
+
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * WaitPush, WaitPop, WaitCount --
+ *
+ *      Hand a conn to the conn threads of the pool, take the next conn to
+ *      be served, and count the conns not yet taken by a thread. Without
+ *      request classes, the conns are passed via the lock-free wait ring,
+ *      otherwise via the rings of the classes.
+ *
+ * Results:
+ *      WaitPop returns a conn or NULL, WaitCount the number of conns.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+WaitPush(ConnPool *poolPtr, Conn *connPtr)
+{
+    NS_NONNULL_ASSERT(poolPtr != NULL);
+    NS_NONNULL_ASSERT(connPtr != NULL);
+
+    /*
+     * The rings hold all conns of the pool, so this cannot fail.
+     */
+    if (connPtr->classPtr == NULL) {
+        (void) NsRingPush(&poolPtr->wqueue.wait.ring, connPtr);
+    } else {
+        (void) NsRingPush(&connPtr->classPtr->ring, connPtr);
+    }
+}
+
+static Conn *
+WaitPop(ConnPool *poolPtr)
+{
+    NS_NONNULL_ASSERT(poolPtr != NULL);
+
+    return (poolPtr->classes.num == 0)
+        ? NsRingPop(&poolPtr->wqueue.wait.ring)
+        : ClassesPop(poolPtr);
+}
+
+static size_t
+WaitCount(ConnPool *poolPtr)
+{
+    size_t count;
+
+    NS_NONNULL_ASSERT(poolPtr != NULL);
+
+    if (poolPtr->classes.num == 0) {
+        count = NsRingCount(&poolPtr->wqueue.wait.ring);
+    } else {
+        int i;
+
+        count = 0u;
+        for (i = 0; i < poolPtr->classes.num; i++) {
+            count += NsRingCount(&poolPtr->classes.list[i].ring);
+        }
+    }
+    return count;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * ClassesPop --
+ *
+ *      Take the next conn from the request classes of a pool. The classes
+ *      are served in weighted fair order (stride scheduling): every class
+ *      advances its pass by a stride inversely proportional to its weight,
+ *      and the nonempty class with the smallest pass is served next. A
+ *      class cannot save up passes while it is empty. However, when the
+ *      oldest request of a class with a deadline has waited for more than
+ *      half of the deadline, the class with the earliest such deadline is
+ *      served first.
+ *
+ * Results:
+ *      Conn or NULL, when no conn is waiting.
+ *
+ * Side effects:
+ *      Updates the schedule and the statistics of the classes.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static Conn *
+ClassesPop(ConnPool *poolPtr)
+{
+    ConnClass *fairPtr = NULL, *urgentPtr = NULL, *classPtr;
+    Conn      *connPtr = NULL;
+    Ns_Time    now, urgentDeadline = {0, 0};
+    int        i;
+
+    NS_NONNULL_ASSERT(poolPtr != NULL);
+
+    Ns_GetTime(&now);
+    Ns_MutexLock(&poolPtr->classes.lock);
+    for (i = 0; i < poolPtr->classes.num; i++) {
+        const Conn *headPtr;
+
+        classPtr = &poolPtr->classes.list[i];
+        headPtr = NsRingPeek(&classPtr->ring);
+        if (headPtr == NULL) {
+            continue;
+        }
+        if (classPtr->pass < poolPtr->classes.pass) {
+            classPtr->pass = poolPtr->classes.pass;
+        }
+        if (fairPtr == NULL || classPtr->pass < fairPtr->pass) {
+            fairPtr = classPtr;
+        }
+        if (classPtr->deadline.sec > 0 || classPtr->deadline.usec > 0) {
+            Ns_Time deadline, half, waited;
+
+            (void) Ns_DiffTime(&now, &headPtr->requestQueueTime, &waited);
+            half.sec = classPtr->deadline.sec / 2;
+            half.usec = (classPtr->deadline.usec + (classPtr->deadline.sec % 2) * 1000000) / 2;
+
+            if (Ns_DiffTime(&waited, &half, NULL) >= 0) {
+                deadline = headPtr->requestQueueTime;
+                Ns_IncrTime(&deadline, classPtr->deadline.sec, classPtr->deadline.usec);
+                if (urgentPtr == NULL || Ns_DiffTime(&deadline, &urgentDeadline, NULL) < 0) {
+                    urgentPtr = classPtr;
+                    urgentDeadline = deadline;
+                }
+            }
+        }
+    }
+
+    classPtr = (urgentPtr != NULL) ? urgentPtr : fairPtr;
+    if (classPtr != NULL) {
+        connPtr = NsRingPop(&classPtr->ring);
+        if (connPtr != NULL) {
+            poolPtr->classes.pass = classPtr->pass;
+            classPtr->pass += classPtr->stride;
+            classPtr->processed++;
+        }
+    }
+    Ns_MutexUnlock(&poolPtr->classes.lock);
+
+    return connPtr;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * ClassExpired --
+ *
+ *      Check whether a conn has waited longer than the deadline of its
+ *      request class.
+ *
+ * Results:
+ *      Boolean value.
+ *
+ * Side effects:
+ *      Counts expired requests in the class.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static bool
+ClassExpired(Conn *connPtr)
+{
+    ConnClass *classPtr;
+    bool       expired = NS_FALSE;
+
+    NS_NONNULL_ASSERT(connPtr != NULL);
+
+    classPtr = connPtr->classPtr;
+    if (classPtr != NULL
+        && (classPtr->deadline.sec > 0 || classPtr->deadline.usec > 0)) {
+        Ns_Time waited;
+
+        (void) Ns_DiffTime(&connPtr->requestDequeueTime, &connPtr->requestQueueTime, &waited);
+        if (Ns_DiffTime(&waited, &classPtr->deadline, NULL) > 0) {
+            expired = NS_TRUE;
+            Ns_MutexLock(&classPtr->poolPtr->classes.lock);
+            classPtr->expired++;
+            Ns_MutexUnlock(&classPtr->poolPtr->classes.lock);
+        }
+    }
+    return expired;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * ClassFind --
+ *
+ *      Lookup a request class of a pool by name.
+ *
+ * Results:
+ *      Class or NULL, when the pool has no such class.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static ConnClass *
+ClassFind(const ConnPool *poolPtr, const char *name)
+{
+    int i;
+
+    NS_NONNULL_ASSERT(poolPtr != NULL);
+    NS_NONNULL_ASSERT(name != NULL);
+
+    for (i = 0; i < poolPtr->classes.num; i++) {
+        if (STREQ(poolPtr->classes.list[i].name, name)) {
+            return &poolPtr->classes.list[i];
+        }
+    }
+    return NULL;
+}
+
+
 /*
  *----------------------------------------------------------------------
  *
@@ -467,17 +1110,54 @@ NsEnsureRunningConnectionThreads(const NsServer *servPtr, ConnPool *poolPtr) {
     Ns_MutexUnlock(&poolPtr->threads.lock);
     Ns_MutexUnlock(&poolPtr->wqueue.lock);
 
-    if (create) {
-        Ns_Log(Notice, "NsEnsureRunningConnectionThreads wantCreate %d waiting %d idle %d current %d",
-               (int)create,
-               waitnum,
-               poolPtr->threads.idle,
-               poolPtr->threads.current);
-        CreateConnThread(poolPtr);
-    }
+    if (create) {
+        Ns_Log(Notice, "NsEnsureRunningConnectionThreads wantCreate %d waiting %d idle %d current %d",
+               (int)create,
+               waitnum,
+               poolPtr->threads.idle,
+               poolPtr->threads.current);
+        CreateConnThread(poolPtr);
+    }
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * NsPoolLookup --
+ *
+ *      Determine the connection pool mapped to the method and URL of the
+ *      request received via sockPtr.
+ *
+ * Results:
+ *      Connection pool or NULL, when no pool is mapped to the request
+ *      (i.e. the default pool is responsible).
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+ConnPool *
+NsPoolLookup(Sock *sockPtr)
+{
+    NsUrlSpaceContext ctx;
+
+    NS_NONNULL_ASSERT(sockPtr != NULL);
+    assert(sockPtr->reqPtr != NULL);
+    assert(sockPtr->servPtr != NULL);
+
+    NsUrlSpaceContextInit(&ctx, sockPtr, sockPtr->reqPtr->headers);
+    return Ns_UrlSpecificGet((Ns_Server*)sockPtr->servPtr,
+                             sockPtr->reqPtr->request.method,
+                             sockPtr->reqPtr->request.url,
+                             poolid, 0u, NS_URLSPACE_DEFAULT,
+                             NULL,
+                             NsUrlSpaceContextFilterEval, &ctx);
 }
 
-
+
 /*
  *----------------------------------------------------------------------
  *
@@ -499,11 +1179,11 @@ NsEnsureRunningConnectionThreads(const NsServer *servPtr, ConnPool *poolPtr) {
 Ns_ReturnCode
 NsQueueConn(Sock *sockPtr, const Ns_Time *nowPtr)
 {
-    ConnThreadArg *argPtr = NULL;
     NsServer      *servPtr;
     ConnPool      *poolPtr = NULL;
-    Conn          *connPtr = NULL;
-    bool           create = NS_FALSE;
+    ConnClass     *classPtr = NULL;
+    Conn          *connPtr;
+    bool           create = NS_FALSE, haveIdle = NS_FALSE;
     int            queued = NS_OK;
 
     NS_NONNULL_ASSERT(sockPtr != NULL);
@@ -527,15 +1207,7 @@ NsQueueConn(Sock *sockPtr, const Ns_Time *nowPtr)
     if ((sockPtr->poolPtr == NULL)
         && (sockPtr->reqPtr != NULL)
         && (sockPtr->reqPtr->request.method != NULL)) {
-        NsUrlSpaceContext ctx;
-
-        NsUrlSpaceContextInit(&ctx, sockPtr, sockPtr->reqPtr->headers);
-        poolPtr = Ns_UrlSpecificGet((Ns_Server*)servPtr,
-                                    sockPtr->reqPtr->request.method,
-                                    sockPtr->reqPtr->request.url,
-                                    poolid, 0u, NS_URLSPACE_DEFAULT,
-                                    NULL,
-                                    NsUrlSpaceContextFilterEval, &ctx);
+        poolPtr = NsPoolLookup(sockPtr);
         sockPtr->poolPtr = poolPtr;
 
     } else if (sockPtr->poolPtr != NULL) {
@@ -547,18 +1219,43 @@ NsQueueConn(Sock *sockPtr, const Ns_Time *nowPtr)
         poolPtr = servPtr->pools.defaultPtr;
     }
 
+    /*
+     * When the queueing delay of the pool is persistently too high, reject
+     * the request right away.
+     */
+    if (CodelEnabled(poolPtr) && CodelShed(poolPtr, nowPtr)) {
+        Ns_Log(Debug, "[%s pool %s] shed request, queueing delay above target",
+               servPtr->server, poolPtr->pool);
+        return NS_ERROR;
+    }
+
+    /*
+     * Select the request class, when the pool has classes. Requests not
+     * mapped to a class of this pool go to its default class.
+     */
+    if (poolPtr->classes.num > 0) {
+        if (sockPtr->reqPtr != NULL && sockPtr->reqPtr->request.method != NULL) {
+            NsUrlSpaceContext ctx;
+
+            NsUrlSpaceContextInit(&ctx, sockPtr, sockPtr->reqPtr->headers);
+            classPtr = Ns_UrlSpecificGet((Ns_Server*)servPtr,
+                                         sockPtr->reqPtr->request.method,
+                                         sockPtr->reqPtr->request.url,
+                                         classid, 0u, NS_URLSPACE_DEFAULT,
+                                         NULL,
+                                         NsUrlSpaceContextFilterEval, &ctx);
+        }
+        if (classPtr == NULL || classPtr->poolPtr != poolPtr) {
+            classPtr = &poolPtr->classes.list[0];
+        }
+    }
+
    /*
-    * We know the pool. Try to add connection into the queue of this pool
-    * (either into a free slot or into its waiting list, or, when everything
-    * fails signal an error or timeout (for retry attempts) to the caller.
+    * We know the pool. Try to get a free conn of this pool and hand it to
+    * the conn threads, or, when there is no free conn, signal an error or
+    * timeout (for retry attempts) to the caller.
     */
-    Ns_MutexLock(&poolPtr->wqueue.lock);
-    if (poolPtr->wqueue.freePtr != NULL) {
-        connPtr = poolPtr->wqueue.freePtr;
-        poolPtr->wqueue.freePtr = connPtr->nextPtr;
-        connPtr->nextPtr = NULL;
-    }
-    Ns_MutexUnlock(&poolPtr->wqueue.lock);
+    connPtr = NsRingPop(&poolPtr->wqueue.freeRing);
 
     if (likely(connPtr != NULL)) {
         /*
@@ -568,10 +1265,15 @@ NsQueueConn(Sock *sockPtr, const Ns_Time *nowPtr)
 
         /* ConnThreadQueuePrint(poolPtr, "driver");*/
 
+#ifdef NS_HAVE_ATOMIC_BUILTINS
+        connPtr->id = __atomic_fetch_add(&servPtr->pools.nextconnid, 1u, __ATOMIC_RELAXED);
+        (void) __atomic_fetch_add(&poolPtr->stats.processed, 1u, __ATOMIC_RELAXED);
+#else
         Ns_MutexLock(&servPtr->pools.lock);
         connPtr->id = servPtr->pools.nextconnid++;
         poolPtr->stats.processed++;
         Ns_MutexUnlock(&servPtr->pools.lock);
+#endif
 
         connPtr->requestQueueTime     = *nowPtr;
         connPtr->sockPtr              = sockPtr;
@@ -590,6 +1292,7 @@ NsQueueConn(Sock *sockPtr, const Ns_Time *nowPtr)
             connPtr->acceptTime       = sockPtr->acceptTime;
         }
         connPtr->rateLimit            = poolPtr->rate.defaultConnectionLimit;
+        connPtr->classPtr             = classPtr;
 
         /*
          * Reset members of sockPtr, which have been passed to connPtr.
@@ -599,49 +1302,58 @@ NsQueueConn(Sock *sockPtr, const Ns_Time *nowPtr)
         sockPtr->location             = NULL;
 
         /*
-         * Try to get an entry from the connection thread queue,
-         * and dequeue it when possible.
+         * When no connection thread is idle, the conn has to wait until
+         * some thread becomes available. Such conns are counted in
+         * "wait.num" and are reported as "queued".
          */
-        if (poolPtr->tqueue.nextPtr != NULL) {
-            Ns_MutexLock(&poolPtr->tqueue.lock);
-            if (poolPtr->tqueue.nextPtr != NULL) {
-                argPtr = poolPtr->tqueue.nextPtr;
-                poolPtr->tqueue.nextPtr = argPtr->nextPtr;
-            }
-            Ns_MutexUnlock(&poolPtr->tqueue.lock);
-        }
-
-        if (argPtr != NULL) {
-            /*
-             * We could obtain an idle thread. Dequeue the entry,
-             * such that no one else might grab it, and fill in the
-             * connPtr that should be run by this thread.
-             */
-
-            assert(argPtr->state == connThread_idle);
-            argPtr->connPtr = connPtr;
-
+        haveIdle = (NsAtomicLoad(&poolPtr->threads.idle) > 0);
+        if (!haveIdle) {
+            connPtr->queued = NS_TRUE;
+#ifdef NS_HAVE_ATOMIC_BUILTINS
+            (void) __atomic_fetch_add(&poolPtr->wqueue.wait.num, 1, __ATOMIC_RELAXED);
+            (void) __atomic_fetch_add(&poolPtr->stats.queued, 1u, __ATOMIC_RELAXED);
+#else
             Ns_MutexLock(&poolPtr->wqueue.lock);
-            Ns_MutexLock(&poolPtr->threads.lock);
-            create = neededAdditionalConnectionThreads(poolPtr);
-            Ns_MutexUnlock(&poolPtr->threads.lock);
+            poolPtr->wqueue.wait.num ++;
+            poolPtr->stats.queued++;
             Ns_MutexUnlock(&poolPtr->wqueue.lock);
+#endif
+        }
 
-        } else {
+        /*
+         * Hand the conn to the conn threads. The fence orders the push
+         * against reading the idle counter, which is incremented by a
+         * parking thread before it checks the ring a last time. Only the
+         * signal has to be performed under the lock, such that it cannot
+         * get lost between the last check of a parking thread and its
+         * wait on the condition.
+         */
+        WaitPush(poolPtr, connPtr);
+        NsAtomicFence();
+
+        if (NsAtomicLoad(&poolPtr->threads.idle) > 0) {
             /*
-             * There is no connection thread ready, so we add the
-             * connection to the waiting queue.
+             * Wake up exactly one parked thread.
              */
+            haveIdle = NS_TRUE;
+            Ns_MutexLock(&poolPtr->tqueue.lock);
+            Ns_CondSignal(&poolPtr->tqueue.cond);
+            Ns_MutexUnlock(&poolPtr->tqueue.lock);
+        }
+
+        /*
+         * Check the cheap necessary conditions for creating threads before
+         * taking the locks. When all threads are running, which is the
+         * case under load, no lock is needed.
+         */
+        if (poolPtr->autoscale.adaptive) {
+            AutoscaleUpdate(poolPtr, nowPtr, NS_TRUE);
+        }
+        if (NsAtomicLoad(&poolPtr->threads.current) < poolPtr->threads.max
+            && (NsAtomicLoad(&poolPtr->threads.current) < AutoscaleFloor(poolPtr)
+                || NsAtomicLoad(&poolPtr->wqueue.wait.num) > poolPtr->wqueue.lowwatermark)) {
             Ns_MutexLock(&poolPtr->wqueue.lock);
-            if (poolPtr->wqueue.wait.firstPtr == NULL) {
-                poolPtr->wqueue.wait.firstPtr = connPtr;
-            } else {
-                poolPtr->wqueue.wait.lastPtr->nextPtr = connPtr;
-            }
-            poolPtr->wqueue.wait.lastPtr = connPtr;
-            poolPtr->wqueue.wait.num ++;
             Ns_MutexLock(&poolPtr->threads.lock);
-            poolPtr->stats.queued++;
             create = neededAdditionalConnectionThreads(poolPtr);
             Ns_MutexUnlock(&poolPtr->threads.lock);
             Ns_MutexUnlock(&poolPtr->wqueue.lock);
@@ -679,35 +1391,9 @@ NsQueueConn(Sock *sockPtr, const Ns_Time *nowPtr)
             }
         }
 
-    } else if (argPtr != NULL) {
-        /*
-         * We have a connection thread ready.
-         *
-         * Perform lock just in the debugging case to avoid race condition.
-         */
-        if (Ns_LogSeverityEnabled(Debug)) {
-            int idle;
-
-            Ns_MutexLock(&poolPtr->threads.lock);
-            idle = poolPtr->threads.idle;
-            Ns_MutexUnlock(&poolPtr->threads.lock);
-
-            Ns_Log(Debug, "[%d] dequeue thread connPtr %p idle %d state %d create %d",
-                   ThreadNr(poolPtr, argPtr), (void *)connPtr, idle, argPtr->state, (int)create);
-        }
-
-        /*
-         * Signal the associated thread to start with this request.
-         */
-        Ns_MutexLock(&argPtr->lock);
-        Ns_CondSignal(&argPtr->cond);
-        Ns_MutexUnlock(&argPtr->lock);
-
-    } else {
-        if (Ns_LogSeverityEnabled(Debug)) {
-            Ns_Log(Debug, "add waiting connPtr %p => waiting %d create %d",
-                   (void *)connPtr, poolPtr->wqueue.wait.num, (int)create);
-        }
+    } else if (Ns_LogSeverityEnabled(Debug)) {
+        Ns_Log(Debug, "queue connPtr %p idle thread %d => waiting %d create %d",
+               (void *)connPtr, (int)haveIdle, poolPtr->wqueue.wait.num, (int)create);
     }
 
     if (create) {
@@ -978,6 +1664,69 @@ MapspecParse(Tcl_Interp *interp, Tcl_Obj *mapspecObj, char **method, char **url,
 }
 
 
+/*
+ *----------------------------------------------------------------------
+ *
+ * ServerClassesObjCmd, subcommand of NsTclServerObjCmd --
+ *
+ *    Implements "ns_server ... classes". Returns for every request class of
+ *    the pool a list of attribute value pairs with its configuration, the
+ *    number of waiting requests, and the numbers of processed and expired
+ *    requests.
+ *
+ * Results:
+ *    Tcl result.
+ *
+ * Side effects:
+ *    None.
+ *
+ *----------------------------------------------------------------------
+ */
+static int
+ServerClassesObjCmd(ClientData UNUSED(clientData), Tcl_Interp *interp, TCL_SIZE_T objc, Tcl_Obj *const* objv,
+                    ConnPool *poolPtr, TCL_SIZE_T nargs)
+{
+    int result = TCL_OK;
+
+    NS_NONNULL_ASSERT(interp != NULL);
+    NS_NONNULL_ASSERT(objv != NULL);
+    NS_NONNULL_ASSERT(poolPtr != NULL);
+
+    if (Ns_ParseObjv(NULL, NULL, interp, objc-nargs, objc, objv) != NS_OK) {
+        result = TCL_ERROR;
+    } else {
+        Tcl_Obj *listObj = Tcl_NewListObj(0, NULL);
+        int      i;
+
+        if (poolPtr->classes.num > 0) {
+            Ns_MutexLock(&poolPtr->classes.lock);
+            for (i = 0; i < poolPtr->classes.num; i++) {
+                ConnClass       *classPtr = &poolPtr->classes.list[i];
+                Tcl_Obj         *classObj = Tcl_NewListObj(0, NULL);
+
+                Tcl_ListObjAppendElement(interp, classObj, Tcl_NewStringObj("name", 4));
+                Tcl_ListObjAppendElement(interp, classObj, Tcl_NewStringObj(classPtr->name, TCL_INDEX_NONE));
+                Tcl_ListObjAppendElement(interp, classObj, Tcl_NewStringObj("weight", 6));
+                Tcl_ListObjAppendElement(interp, classObj, Tcl_NewIntObj(classPtr->weight));
+                Tcl_ListObjAppendElement(interp, classObj, Tcl_NewStringObj("deadline", 8));
+                Tcl_ListObjAppendElement(interp, classObj, Ns_TclNewTimeObj(&classPtr->deadline));
+                Tcl_ListObjAppendElement(interp, classObj, Tcl_NewStringObj("waiting", 7));
+                Tcl_ListObjAppendElement(interp, classObj,
+                                         Tcl_NewWideIntObj((Tcl_WideInt)NsRingCount(&classPtr->ring)));
+                Tcl_ListObjAppendElement(interp, classObj, Tcl_NewStringObj("processed", 9));
+                Tcl_ListObjAppendElement(interp, classObj, Tcl_NewWideIntObj((Tcl_WideInt)classPtr->processed));
+                Tcl_ListObjAppendElement(interp, classObj, Tcl_NewStringObj("expired", 7));
+                Tcl_ListObjAppendElement(interp, classObj, Tcl_NewWideIntObj((Tcl_WideInt)classPtr->expired));
+                Tcl_ListObjAppendElement(interp, listObj, classObj);
+            }
+            Ns_MutexUnlock(&poolPtr->classes.lock);
+        }
+        Tcl_SetObjResult(interp, listObj);
+    }
+    return result;
+}
+
+
 /*
  *----------------------------------------------------------------------
  *
@@ -999,7 +1748,10 @@ ServerMapObjCmd(ClientData UNUSED(clientData), Tcl_Interp *interp, TCL_SIZE_T ob
 {
     int             result = TCL_OK, noinherit = 0;
     Tcl_Obj        *mapspecObj = NULL;
+    char           *className = NULL;
+    ConnClass      *classPtr = NULL;
     Ns_ObjvSpec     lopts[] = {
+        {"-class",     Ns_ObjvString, &className, NULL},
         {"-noinherit", Ns_ObjvBool,   &noinherit, INT2PTR(NS_TRUE)},
         {NULL, NULL, NULL, NULL}
     };
@@ -1015,6 +1767,13 @@ ServerMapObjCmd(ClientData UNUSED(clientData), Tcl_Interp *interp, TCL_SIZE_T ob
 
     if (Ns_ParseObjv(lopts, args, interp, objc-nargs, objc, objv) != NS_OK) {
         result = TCL_ERROR;
+
+    } else if (className != NULL
+               && (classPtr = ClassFind(poolPtr, className)) == NULL) {
+        Ns_TclPrintfResult(interp, "pool '%s' has no class '%s'",
+                           NsPoolName(poolPtr->pool), className);
+        result = TCL_ERROR;
+
     } else if (mapspecObj != NULL) {
         char *method, *url;
         NsUrlSpaceContextSpec *specPtr = NULL;
@@ -1030,14 +1789,20 @@ ServerMapObjCmd(ClientData UNUSED(clientData), Tcl_Interp *interp, TCL_SIZE_T ob
             }
 
             Ns_MutexLock(&servPtr->urlspace.lock);
-            Ns_UrlSpecificSet2(servPtr->server, method, url, poolid, poolPtr, flags, NULL, specPtr);
+            if (classPtr != NULL) {
+                Ns_UrlSpecificSet2(servPtr->server, method, url, classid, classPtr, flags, NULL, specPtr);
+            } else {
+                Ns_UrlSpecificSet2(servPtr->server, method, url, poolid, poolPtr, flags, NULL, specPtr);
+            }
             Ns_MutexUnlock(&servPtr->urlspace.lock);
 
             Tcl_DStringInit(&ds);
-            Ns_Log(Notice, "pool[%s]: mapped %s %s%s -> %s",
+            Ns_Log(Notice, "pool[%s]: mapped %s %s%s -> %s%s%s",
                    servPtr->server, method, url,
                    (specPtr == NULL ? "" : NsUrlSpaceContextSpecAppend(&ds, specPtr)),
-                   poolPtr->pool);
+                   poolPtr->pool,
+                   (classPtr != NULL ? " class " : ""),
+                   (classPtr != NULL ? classPtr->name : ""));
             Tcl_DStringFree(&ds);
         }
 
@@ -1239,13 +2004,14 @@ ServerMappedObjCmd(ClientData UNUSED(clientData), Tcl_Interp *interp, TCL_SIZE_T
  */
 static int
 ServerUnmapObjCmd(ClientData UNUSED(clientData), Tcl_Interp *interp, TCL_SIZE_T objc, Tcl_Obj *const* objv,
-                  NsServer *servPtr, TCL_SIZE_T nargs)
+                  NsServer *servPtr, const ConnPool *poolPtr, TCL_SIZE_T nargs)
 {
     int          result = TCL_OK, noinherit = 0;
-    char        *method, *url;
+    char        *method, *url, *className = NULL;
     Tcl_Obj     *mapspecObj = NULL;
     NsUrlSpaceContextSpec *specPtr;
     Ns_ObjvSpec  lopts[] = {
+        {"-class",     Ns_ObjvString, &className, NULL},
         {"-noinherit", Ns_ObjvBool, &noinherit, INT2PTR(NS_TRUE)},
         {NULL, NULL, NULL, NULL}
     };
@@ -1257,9 +2023,14 @@ ServerUnmapObjCmd(ClientData UNUSED(clientData), Tcl_Interp *interp, TCL_SIZE_T
     NS_NONNULL_ASSERT(interp != NULL);
     NS_NONNULL_ASSERT(objv != NULL);
     NS_NONNULL_ASSERT(servPtr != NULL);
+    NS_NONNULL_ASSERT(poolPtr != NULL);
 
     if (Ns_ParseObjv(lopts, args, interp, objc-nargs, objc, objv) != NS_OK) {
         result = TCL_ERROR;
+    } else if (className != NULL && ClassFind(poolPtr, className) == NULL) {
+        Ns_TclPrintfResult(interp, "pool '%s' has no class '%s'",
+                           NsPoolName(poolPtr->pool), className);
+        result = TCL_ERROR;
     } else if (MapspecParse(interp, mapspecObj, &method, &url, &specPtr) != NS_OK) {
         result = TCL_ERROR;
     } else {
@@ -1274,7 +2045,8 @@ ServerUnmapObjCmd(ClientData UNUSED(clientData), Tcl_Interp *interp, TCL_SIZE_T
         flags |= NS_OP_ALLCONSTRAINTS;
 
         Ns_MutexLock(&servPtr->urlspace.lock);
-        data = Ns_UrlSpecificDestroy(servPtr->server,  method, url, poolid, flags);
+        data = Ns_UrlSpecificDestroy(servPtr->server,  method, url,
+                                     (className != NULL ? classid : poolid), flags);
         Ns_MutexUnlock(&servPtr->urlspace.lock);
 
         success = (data != NULL);
@@ -1316,26 +2088,59 @@ ServerListActive(Tcl_DString *dsPtr, ConnPool *poolPtr, bool checkforproxy)
     NS_NONNULL_ASSERT(dsPtr != NULL);
     NS_NONNULL_ASSERT(poolPtr != NULL);
 
-    Ns_MutexLock(&poolPtr->tqueue.lock);
     for (i = 0; i < poolPtr->threads.max; i++) {
-        const ConnThreadArg *argPtr = &poolPtr->tqueue.args[i];
+        ConnThreadArg *argPtr = &poolPtr->tqueue.args[i];
 
+        Ns_MutexLock(&argPtr->lock);
         if (argPtr->connPtr != NULL) {
-            AppendConnList(dsPtr, argPtr->connPtr, "running", checkforproxy);
+            AppendConn(dsPtr, argPtr->connPtr, "running", checkforproxy);
         }
+        Ns_MutexUnlock(&argPtr->lock);
     }
-    Ns_MutexUnlock(&poolPtr->tqueue.lock);
 }
 
 static void
 ServerListQueued(Tcl_DString *dsPtr, ConnPool *poolPtr)
 {
+    void   *stackConns[128], **conns = stackConns;
+    size_t   i, n, maxConns = (size_t)poolPtr->wqueue.maxconns;
+
     NS_NONNULL_ASSERT(dsPtr != NULL);
     NS_NONNULL_ASSERT(poolPtr != NULL);
 
+    /*
+     * The snapshot of the ring might contain conns already taken by a
+     * thread. A conn leaves the "queued" state under the wqueue lock before
+     * its thread touches it, so report only conns still flagged as queued.
+     * The snapshot fits on the stack for the default maxconnections,
+     * only larger pools need a buffer from the heap.
+     */
+    if (maxConns > (size_t)Ns_NrElements(stackConns)) {
+        conns = ns_malloc(sizeof(void *) * maxConns);
+    }
+    if (poolPtr->classes.num == 0) {
+        n = NsRingSnapshot(&poolPtr->wqueue.wait.ring, conns, maxConns);
+    } else {
+        int c;
+
+        n = 0u;
+        for (c = 0; c < poolPtr->classes.num; c++) {
+            n += NsRingSnapshot(&poolPtr->classes.list[c].ring, &conns[n], maxConns - n);
+        }
+    }
+
     Ns_MutexLock(&poolPtr->wqueue.lock);
-    AppendConnList(dsPtr, poolPtr->wqueue.wait.firstPtr, "queued", NS_FALSE);
+    for (i = 0u; i < n; i++) {
+        Conn *connPtr = conns[i];
+
+        if (connPtr->queued) {
+            AppendConn(dsPtr, connPtr, "queued", NS_FALSE);
+        }
+    }
     Ns_MutexUnlock(&poolPtr->wqueue.lock);
+    if (conns != stackConns) {
+        ns_free(conns);
+    }
 }
 
 
@@ -1456,7 +2261,7 @@ NsTclServerObjCmd(ClientData clientData, Tcl_Interp *interp, TCL_SIZE_T objc, Tc
 
     enum {
         SActiveIdx, SAllIdx, SAuthprocsIdx,
-        SConnectionRateLimitIdx, SConnectionsIdx,
+        SClassesIdx, SConnectionRateLimitIdx, SConnectionsIdx,
         SFiltersIdx,
         SHostsIdx,
 #ifdef NS_WITH_DEPRECATED
@@ -1478,6 +2283,7 @@ NsTclServerObjCmd(ClientData clientData, Tcl_Interp *interp, TCL_SIZE_T objc, Tc
         {"active",              (unsigned int)SActiveIdx},
         {"all",                 (unsigned int)SAllIdx},
         {"authprocs",           (unsigned int)SAuthprocsIdx},
+        {"classes",             (unsigned int)SClassesIdx},
         {"connectionratelimit", (unsigned int)SConnectionRateLimitIdx},
         {"connections",         (unsigned int)SConnectionsIdx},
         {"filters",             (unsigned int)SFiltersIdx},
@@ -1793,6 +2599,10 @@ NsTclServerObjCmd(ClientData clientData, Tcl_Interp *interp, TCL_SIZE_T objc, Tc
         break;
 #endif
 
+    case SClassesIdx:
+        result = ServerClassesObjCmd(clientData, interp, objc, objv, poolPtr, (TCL_SIZE_T)nargs);
+        break;
+
     case SMapIdx:
         result = ServerMapObjCmd(clientData, interp, objc, objv, servPtr, poolPtr, (TCL_SIZE_T)nargs);
         break;
@@ -1802,7 +2612,7 @@ NsTclServerObjCmd(ClientData clientData, Tcl_Interp *interp, TCL_SIZE_T objc, Tc
         break;
 
     case SUnmapIdx:
-        result = ServerUnmapObjCmd(clientData, interp, objc, objv, servPtr, (TCL_SIZE_T)nargs);
+        result = ServerUnmapObjCmd(clientData, interp, objc, objv, servPtr, poolPtr, (TCL_SIZE_T)nargs);
         break;
 
     case SMaxthreadsIdx:
@@ -1836,6 +2646,7 @@ NsTclServerObjCmd(ClientData clientData, Tcl_Interp *interp, TCL_SIZE_T objc, Tc
             Ns_DStringPrintf(dsPtr, "spools %lu ", poolPtr->stats.spool);
             Ns_DStringPrintf(dsPtr, "queued %lu ", poolPtr->stats.queued);
             Ns_DStringPrintf(dsPtr, "dropped %lu ", poolPtr->stats.dropped);
+            Ns_DStringPrintf(dsPtr, "shed %lu ", poolPtr->stats.shed);
             Ns_DStringPrintf(dsPtr, "sent %" TCL_LL_MODIFIER "d ", poolPtr->rate.bytesSent);
             Ns_DStringPrintf(dsPtr, "connthreads %lu", poolPtr->stats.connthreads);
 
@@ -1862,10 +2673,19 @@ NsTclServerObjCmd(ClientData clientData, Tcl_Interp *interp, TCL_SIZE_T objc, Tc
     case SThreadsIdx:
         if (Ns_ParseObjv(NULL, NULL, interp, objc-nargs, objc, objv) == NS_OK) {
             Ns_MutexLock(&poolPtr->threads.lock);
+            Ns_MutexLock(&poolPtr->autoscale.lock);
             Ns_TclPrintfResult(interp,
-                               "min %d max %d current %d idle %d stopping 0",
+                               "min %d max %d current %d idle %d stopping 0"
+                               " control %s desired %d arrivalrate %.2f trend %.2f"
+                               " servicetime %.6f queuedelay %.6f spawntime %.6f",
                                poolPtr->threads.min, poolPtr->threads.max,
-                               poolPtr->threads.current, poolPtr->threads.idle);
+                               poolPtr->threads.current, poolPtr->threads.idle,
+                               poolPtr->autoscale.adaptive ? "adaptive" : "watermark",
+                               AutoscaleFloor(poolPtr),
+                               poolPtr->autoscale.rate, poolPtr->autoscale.trend,
+                               poolPtr->autoscale.serviceTime, poolPtr->autoscale.queueDelay,
+                               poolPtr->autoscale.spawnTime);
+            Ns_MutexUnlock(&poolPtr->autoscale.lock);
             Ns_MutexUnlock(&poolPtr->threads.lock);
             result = TCL_OK;
         }
@@ -1966,21 +2786,10 @@ NsStartServer(const NsServer *servPtr)
 
 static void
 WakeupConnThreads(ConnPool *poolPtr) {
-    int i;
-
     NS_NONNULL_ASSERT(poolPtr != NULL);
 
     Ns_MutexLock(&poolPtr->tqueue.lock);
-    for (i = 0; i < poolPtr->threads.max; i++) {
-        ConnThreadArg *argPtr = &poolPtr->tqueue.args[i];
-
-        if (argPtr->state == connThread_idle) {
-            assert(argPtr->connPtr == NULL);
-            Ns_MutexLock(&argPtr->lock);
-            Ns_CondSignal(&argPtr->cond);
-            Ns_MutexUnlock(&argPtr->lock);
-        }
-    }
+    Ns_CondBroadcast(&poolPtr->tqueue.cond);
     Ns_MutexUnlock(&poolPtr->tqueue.lock);
 }
 
@@ -2032,7 +2841,7 @@ NsWaitServer(NsServer *servPtr, const Ns_Time *toPtr)
     Ns_MutexLock(&servPtr->pools.lock);
     while (poolPtr != NULL && status == NS_OK) {
         while (status == NS_OK &&
-               (poolPtr->wqueue.wait.firstPtr != NULL
+               (WaitCount(poolPtr) > 0u
                 || poolPtr->threads.current > 0)) {
             status = Ns_CondTimedWait(&poolPtr->wqueue.cond,
                                       &servPtr->pools.lock, toPtr);
@@ -2072,16 +2881,14 @@ NsWaitServer(NsServer *servPtr, const Ns_Time *toPtr)
 void
 NsConnArgProc(Tcl_DString *dsPtr, const void *arg)
 {
-    const ConnThreadArg *argPtr = arg;
+    ConnThreadArg *argPtr = (ConnThreadArg *)arg;
 
     NS_NONNULL_ASSERT(dsPtr != NULL);
 
     if (arg != NULL) {
-        ConnPool     *poolPtr = argPtr->poolPtr;
-
-        Ns_MutexLock(&poolPtr->tqueue.lock);
+        Ns_MutexLock(&argPtr->lock);
         AppendConn(dsPtr, argPtr->connPtr, "running", NS_FALSE);
-        Ns_MutexUnlock(&poolPtr->tqueue.lock);
+        Ns_MutexUnlock(&argPtr->lock);
     } else {
         Tcl_DStringAppendElement(dsPtr, NS_EMPTY_STRING);
     }
@@ -2199,6 +3006,12 @@ NsConnThread(void *arg)
         Ns_DiffTime(&end, &start, &diff);
         Ns_Log(Notice, "thread initialized (" NS_TIME_FMT " secs)",
                (int64_t)diff.sec, diff.usec);
+        if (poolPtr->autoscale.adaptive) {
+            Ns_MutexLock(&poolPtr->autoscale.lock);
+            poolPtr->autoscale.spawnTime += AUTOSCALE_ALPHA
+                * ((double)diff.sec + (double)diff.usec / 1000000.0 - poolPtr->autoscale.spawnTime);
+            Ns_MutexUnlock(&poolPtr->autoscale.lock);
+        }
         Ns_TclDeAllocateInterp(interp);
         argPtr->state = connThread_ready;
     }
@@ -2212,62 +3025,30 @@ NsConnThread(void *arg)
     for (;;) {
 
         /*
-         * We are ready to process requests. Pick it either a request
-         * from the waiting queue, or go to a waiting state and add
-         * yourself to the conn thread queue.
+         * We are ready to process requests. Take a conn from the ring, or
+         * park on the pool condition until the driver hands us one.
          */
         assert(argPtr->connPtr == NULL);
         assert(argPtr->state == connThread_ready);
 
-        if (poolPtr->wqueue.wait.firstPtr != NULL) {
-            connPtr = NULL;
-            Ns_MutexLock(wqueueLockPtr);
-            if (poolPtr->wqueue.wait.firstPtr != NULL) {
-                /*
-                 * There are waiting requests.  Pull the first connection of
-                 * the waiting list and assign it to the ConnThreadArg.
-                 */
-                connPtr = poolPtr->wqueue.wait.firstPtr;
-                poolPtr->wqueue.wait.firstPtr = connPtr->nextPtr;
-                if (poolPtr->wqueue.wait.lastPtr == connPtr) {
-                    poolPtr->wqueue.wait.lastPtr = NULL;
-                }
-                connPtr->nextPtr = NULL;
-                poolPtr->wqueue.wait.num --;
-            }
-            Ns_MutexUnlock(wqueueLockPtr);
-
-            argPtr->connPtr = connPtr;
-            fromQueue = NS_TRUE;
-        } else {
-            fromQueue = NS_FALSE;
-        }
+        connPtr = WaitPop(poolPtr);
+        fromQueue = (connPtr != NULL);
 
-        if (argPtr->connPtr == NULL) {
+        if (connPtr == NULL) {
             /*
-             * There is nothing urgent to do. We can add ourself to the
-             * conn thread queue.
+             * There is nothing urgent to do. Count ourself as idle before
+             * checking the ring a last time: the driver pushes the conn
+             * before it checks the idle counter, so either we see the conn
+             * here, or the driver sees us and signals the condition, which
+             * it can do only when we are waiting.
              */
-            Ns_MutexLock(threadsLockPtr);
-            poolPtr->threads.idle ++;
-            Ns_MutexUnlock(threadsLockPtr);
-
             Ns_MutexLock(tqueueLockPtr);
             argPtr->state = connThread_idle;
-            /*
-             * We put an entry into the thread queue. However, we must
-             * take care, that signals are not sent, before this thread
-             * is waiting for it. Therefore, we lock the connection
-             * thread specific lock right here, also the signal sending
-             * code uses the same lock.
-             */
-            Ns_MutexLock(&argPtr->lock);
-
-            argPtr->nextPtr = poolPtr->tqueue.nextPtr;
-            poolPtr->tqueue.nextPtr = argPtr;
-            Ns_MutexUnlock(tqueueLockPtr);
+            poolPtr->threads.idle ++;
+            NsAtomicFence();
 
-            while (!servPtr->pools.shutdown) {
+            while ((connPtr = WaitPop(poolPtr)) == NULL
+                   && !servPtr->pools.shutdown) {
 
                 Ns_GetTime(timePtr);
                 Ns_IncrTime(timePtr, timeout.sec, timeout.usec);
@@ -2275,27 +3056,29 @@ NsConnThread(void *arg)
                 /*
                  * Wait until someone wakes us up, or a timeout happens.
                  */
-                status = Ns_CondTimedWait(&argPtr->cond, &argPtr->lock, timePtr);
+                status = Ns_CondTimedWait(&poolPtr->tqueue.cond, tqueueLockPtr, timePtr);
 
                 if (unlikely(status == NS_TIMEOUT)) {
                     Ns_Log(Debug, "TIMEOUT");
-                    if (unlikely(argPtr->connPtr != NULL)) {
-                        /*
-                         * This should not happen: we had a timeout, but there
-                         * is a connection to be handled; when a connection
-                         * comes in, we get signaled and should see therefore
-                         * no timeout.  Maybe the signal was lost?
-                         */
-                        Ns_Log(Warning, "broadcast signal lost, resuming after timeout");
+                    if ((connPtr = WaitPop(poolPtr)) != NULL) {
                         status = NS_OK;
-
-                    } else if (poolPtr->threads.current <= poolPtr->threads.min) {
+                        break;
+                    }
+                    if (poolPtr->autoscale.adaptive) {
+                        AutoscaleUpdate(poolPtr, timePtr, NS_FALSE);
+                    }
+                    if (poolPtr->threads.current <= AutoscaleFloor(poolPtr)) {
                         /*
                          * We have a timeout, but we should not reduce the
-                         * number of threads below min-threads.
+                         * number of threads below min-threads (or below
+                         * the threads desired by the adaptive controller).
+                         * Run the idle callbacks without holding the lock;
+                         * the ring is checked again afterwards.
                          */
+                        Ns_MutexUnlock(tqueueLockPtr);
                         NsIdleCallback(servPtr);
-                        continue;
+                        Ns_MutexLock(tqueueLockPtr);
+                        status = NS_OK;
 
                     } else {
                         /*
@@ -2305,66 +3088,47 @@ NsConnThread(void *arg)
                         break;
                     }
                 }
-
-                if (likely(argPtr->connPtr != NULL)) {
-                    /*
-                     * We got something to do; therefore, leave this loop.
-                     */
-                    break;
-                }
-
-                Ns_Log(Debug, "Unexpected condition after CondTimedWait; maybe shutdown?");
-            }
-
-            Ns_MutexUnlock(&argPtr->lock);
-
-            assert(argPtr->state == connThread_idle);
-
-            if (argPtr->connPtr == NULL) {
-                /*
-                 * We were not signaled on purpose, so we have to dequeue
-                 * the current thread.
-                 */
-                ConnThreadArg *aPtr, **prevPtr;
-
-                Ns_MutexLock(tqueueLockPtr);
-                for (aPtr = poolPtr->tqueue.nextPtr, prevPtr = &poolPtr->tqueue.nextPtr;
-                     aPtr != NULL;
-                     prevPtr = &aPtr->nextPtr, aPtr = aPtr->nextPtr) {
-                    if (aPtr == argPtr) {
-                        /*
-                         * This request is for us.
-                         */
-                        *prevPtr = aPtr->nextPtr;
-                        argPtr->nextPtr = NULL;
-                        break;
-                    }
-                }
-                argPtr->state = connThread_busy;
-                Ns_MutexUnlock(tqueueLockPtr);
-            } else {
-                Ns_MutexLock(tqueueLockPtr);
-                argPtr->state = connThread_busy;
-                Ns_MutexUnlock(tqueueLockPtr);
             }
 
-            Ns_MutexLock(threadsLockPtr);
             poolPtr->threads.idle --;
-            Ns_MutexUnlock(threadsLockPtr);
+            argPtr->state = connThread_busy;
+            Ns_MutexUnlock(tqueueLockPtr);
 
-            if (servPtr->pools.shutdown) {
-                exitMsg = "shutdown pending";
-                break;
-            } else if (status == NS_TIMEOUT) {
-                exitMsg = "idle thread terminates";
+            if (connPtr == NULL) {
+                if (servPtr->pools.shutdown) {
+                    exitMsg = "shutdown pending";
+                } else {
+                    exitMsg = "idle thread terminates";
+                }
                 break;
             }
         }
 
+        if (connPtr->queued) {
+            /*
+             * The conn was waiting for a thread, it is not queued anymore.
+             */
+            Ns_MutexLock(wqueueLockPtr);
+            connPtr->queued = NS_FALSE;
+#ifdef NS_HAVE_ATOMIC_BUILTINS
+            (void) __atomic_fetch_sub(&poolPtr->wqueue.wait.num, 1, __ATOMIC_RELAXED);
+#else
+            poolPtr->wqueue.wait.num --;
+#endif
+            Ns_MutexUnlock(wqueueLockPtr);
+        }
+
+        Ns_MutexLock(&argPtr->lock);
+        argPtr->connPtr = connPtr;
+        Ns_MutexUnlock(&argPtr->lock);
+
         connPtr = argPtr->connPtr;
         assert(connPtr != NULL);
 
         Ns_GetTime(&connPtr->requestDequeueTime);
+        if (CodelEnabled(poolPtr)) {
+            CodelUpdate(poolPtr, connPtr);
+        }
 
         /*
          * Run the connection if possible (requires a valid sockPtr and a
@@ -2390,7 +3154,7 @@ NsConnThread(void *arg)
                  * closes finally the connection.
                  */
                 ConnThreadSetName(servPtr->server, poolPtr->pool, threadId, connPtr->id);
-                ConnRun(connPtr);
+                ConnRun(connPtr, ClassExpired(connPtr));
             }
         } else {
             /*
@@ -2405,22 +3169,28 @@ NsConnThread(void *arg)
          * since we are deallocating its content. This is especially important
          * for e.g. "ns_server active" since it accesses the header fields.
          */
-        Ns_MutexLock(tqueueLockPtr);
+        Ns_MutexLock(&argPtr->lock);
         connPtr->flags &= ~NS_CONN_CONFIGURED;
 
         /*
          * We are done with the headers, reset these for further reuse.
          */
         Ns_SetTrunc(connPtr->headers, 0);
+        argPtr->connPtr = NULL;
+        Ns_MutexUnlock(&argPtr->lock);
+
+        if (poolPtr->autoscale.adaptive) {
+            Ns_Time now;
+
+            Ns_GetTime(&now);
+            AutoscaleSample(poolPtr, connPtr, &now);
+        }
 
         argPtr->state = connThread_ready;
-        Ns_MutexUnlock(tqueueLockPtr);
 
         /*
-         * Push connection to the free list.
+         * Push connection to the free ring.
          */
-        argPtr->connPtr = NULL;
-
         if (connPtr->prevPtr != NULL) {
             connPtr->prevPtr->nextPtr = connPtr->nextPtr;
         }
@@ -2428,11 +3198,9 @@ NsConnThread(void *arg)
             connPtr->nextPtr->prevPtr = connPtr->prevPtr;
         }
         connPtr->prevPtr = NULL;
+        connPtr->nextPtr = NULL;
 
-        Ns_MutexLock(wqueueLockPtr);
-        connPtr->nextPtr = poolPtr->wqueue.freePtr;
-        poolPtr->wqueue.freePtr = connPtr;
-        Ns_MutexUnlock(wqueueLockPtr);
+        (void) NsRingPush(&poolPtr->wqueue.freeRing, connPtr);
 
         if (cpt != 0) {
             int waiting, idle, lowwater;
@@ -2440,16 +3208,13 @@ NsConnThread(void *arg)
             --ncons;
 
             /*
-             * Get a consistent snapshot of the controlling variables.
+             * Get a snapshot of the controlling variables. "waiting" are
+             * the conns not yet taken by any thread.
              */
-            Ns_MutexLock(wqueueLockPtr);
-            Ns_MutexLock(threadsLockPtr);
-            waiting  = poolPtr->wqueue.wait.num;
+            waiting  = (int)WaitCount(poolPtr);
             lowwater = poolPtr->wqueue.lowwatermark;
-            idle     = poolPtr->threads.idle;
-            current  = poolPtr->threads.current;
-            Ns_MutexUnlock(threadsLockPtr);
-            Ns_MutexUnlock(wqueueLockPtr);
+            idle     = NsAtomicLoad(&poolPtr->threads.idle);
+            current  = NsAtomicLoad(&poolPtr->threads.current);
 
             if (Ns_LogSeverityEnabled(Debug)) {
                 Ns_Time now, acceptTime, queueTime, filterTime, netRunTime, runTime, fullTime;
@@ -2599,6 +3364,8 @@ Ns_Set *NsHeaderSetGet(size_t size)
  * ConnRun --
  *
  *      Run the actual non-null request and close it finally the connection.
+ *      When "expired" is set, the request has exceeded the deadline of its
+ *      request class and is answered with 503 without running it.
  *
  * Results:
  *      None.
@@ -2609,7 +3376,7 @@ Ns_Set *NsHeaderSetGet(size_t size)
  *----------------------------------------------------------------------
  */
 static void
-ConnRun(Conn *connPtr)
+ConnRun(Conn *connPtr, bool expired)
 {
     Sock           *sockPtr;
     Ns_Conn        *conn;
@@ -2689,6 +3456,7 @@ ConnRun(Conn *connPtr)
     servPtr = connPtr->poolPtr->servPtr;
     Ns_ConnSetCompression(conn, servPtr->compress.enable ? servPtr->compress.level : 0);
     connPtr->compress = -1;
+    connPtr->compressEncoding = NS_COMPRESS_GZIP;
 
     connPtr->outputEncoding = servPtr->encoding.outputEncoding;
     connPtr->urlEncoding = servPtr->encoding.urlEncoding;
@@ -2727,7 +3495,19 @@ ConnRun(Conn *connPtr)
         conn->flags |= NS_CONN_SKIPBODY;
     }
 
-    if (sockPtr->drvPtr->requestProc != NULL) {
+    if (unlikely(expired)) {
+        /*
+         * The request has waited longer than the deadline of its request
+         * class; the client is likely gone or has given up. Do not run the
+         * request, just tell the client to try again later.
+         */
+        Ns_Log(Debug, "[%s pool %s] request class %s: deadline exceeded, reject %s",
+               servPtr->server, connPtr->poolPtr->pool, connPtr->classPtr->name,
+               connPtr->request.line);
+        Ns_GetTime(&connPtr->filterDoneTime);
+        status = Ns_ConnReturnUnavailable(conn);
+
+    } else if (sockPtr->drvPtr->requestProc != NULL) {
         /*
          * Run the driver's private handler
          */
@@ -2747,6 +3527,7 @@ ConnRun(Conn *connPtr)
         /*
          * Run classical HTTP requests
          */
+        connPtr->microcacheKey = NsMicroCacheConnKey(connPtr);
 
         status = NsRunFilters(conn, NS_FILTER_PRE_AUTH);
         Ns_GetTime(&connPtr->filterDoneTime);
@@ -2844,6 +3625,11 @@ ConnRun(Conn *connPtr)
     NsClsCleanup(connPtr);
     NsFreeConnInterp(connPtr);
 
+    if (connPtr->microcacheKey != NULL) {
+        ns_free(connPtr->microcacheKey);
+        connPtr->microcacheKey = NULL;
+    }
+
     /*
      * In case some leftover is in the buffer, signal the driver to
      * process the remaining bytes.
@@ -2869,9 +3655,22 @@ ConnRun(Conn *connPtr)
 
     (void) Ns_ConnClose(conn);
 
-    Ns_MutexLock(&connPtr->poolPtr->tqueue.lock);
-    connPtr->reqPtr = NULL;
-    Ns_MutexUnlock(&connPtr->poolPtr->tqueue.lock);
+    /*
+     * Return the compression stream to the pool. This resets as well the
+     * encoders of a response which was not finished.
+     */
+    if (connPtr->cStreamPtr != NULL) {
+        NsCompressStreamRelease(connPtr->cStreamPtr);
+        connPtr->cStreamPtr = NULL;
+    }
+
+    {
+        ConnThreadArg *argPtr = Ns_TlsGet(&argtls);
+
+        Ns_MutexLock(&argPtr->lock);
+        connPtr->reqPtr = NULL;
+        Ns_MutexUnlock(&argPtr->lock);
+    }
 
     /*
      * Deactivate stream writer, if defined
@@ -2985,8 +3784,6 @@ CreateConnThread(ConnPool *poolPtr)
 
         argPtr->poolPtr = poolPtr;
         argPtr->connPtr = NULL;
-        argPtr->nextPtr = NULL;
-        //argPtr->cond = NULL;
 
         Ns_ThreadCreate(NsConnThread, argPtr, 0, &thread);
     } else {
@@ -3090,34 +3887,6 @@ AppendConn(Tcl_DString *dsPtr, const Conn *connPtr, const char *state, bool chec
 }
 
 
-/*
- *----------------------------------------------------------------------
- *
- * AppendConnList --
- *
- *      Append list of connection data to a Tcl_DString.
- *
- * Results:
- *      None.
- *
- * Side effects:
- *      None.
- *
- *----------------------------------------------------------------------
- */
-
-static void
-AppendConnList(Tcl_DString *dsPtr, const Conn *firstPtr, const char *state, bool checkforproxy)
-{
-    NS_NONNULL_ASSERT(dsPtr != NULL);
-    NS_NONNULL_ASSERT(state != NULL);
-
-    while (firstPtr != NULL) {
-        AppendConn(dsPtr, firstPtr, state, checkforproxy);
-        firstPtr = firstPtr->nextPtr;
-    }
-}
-
 /*
  * Local Variables:
  * mode: c
@@ -807,31 +807,7 @@ Ns_ParseHeader(Ns_Set *set, const char *line, const char *prefix, Ns_HeaderCaseD
             status = NS_ERROR;
 
         } else {
-            const char *value;
-            char       *key;
-
-            *sep = '\0';
-            for (value = sep + 1; (*value != '\0') && CHARTYPE(space, *value) != 0; value++) {
-                ;
-            }
-            idx = Ns_SetPutSz(set, line, (TCL_SIZE_T)(sep - line), value, TCL_INDEX_NONE);
-            key = Ns_SetKey(set, idx);
-            if (disp == ToLower) {
-                while (*key != '\0') {
-                    if (CHARTYPE(upper, *key) != 0) {
-                        *key = CHARCONV(lower, *key);
-                    }
-                    ++key;
-                }
-            } else if (disp == ToUpper) {
-                while (*key != '\0') {
-                    if (CHARTYPE(lower, *key) != 0) {
-                        *key = CHARCONV(upper, *key);
-                    }
-                    ++key;
-                }
-            }
-            *sep = ':';
+            idx = NsParseHeaderField(set, (char *)line, sep, disp);
         }
 
         if (prefix != NULL) {
@@ -845,6 +821,62 @@ Ns_ParseHeader(Ns_Set *set, const char *line, const char *prefix, Ns_HeaderCaseD
     return status;
 }
 
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * NsParseHeaderField --
+ *
+ *    Add a header field to the given set, when the position of the
+ *    separating colon in the NUL-terminated line is already known (and
+ *    the line is not a continuation line).
+ *
+ * Results:
+ *    Index of the new field in the set.
+ *
+ * Side effects:
+ *    None
+ *
+ *----------------------------------------------------------------------
+ */
+
+size_t
+NsParseHeaderField(Ns_Set *set, char *line, char *sep, Ns_HeaderCaseDisposition disp)
+{
+    const char *value;
+    char       *key;
+    size_t      idx;
+
+    NS_NONNULL_ASSERT(set != NULL);
+    NS_NONNULL_ASSERT(line != NULL);
+    NS_NONNULL_ASSERT(sep != NULL);
+
+    *sep = '\0';
+    for (value = sep + 1; (*value != '\0') && CHARTYPE(space, *value) != 0; value++) {
+        ;
+    }
+    idx = Ns_SetPutSz(set, line, (TCL_SIZE_T)(sep - line), value, TCL_INDEX_NONE);
+    key = Ns_SetKey(set, idx);
+    if (disp == ToLower) {
+        while (*key != '\0') {
+            if (CHARTYPE(upper, *key) != 0) {
+                *key = CHARCONV(lower, *key);
+            }
+            ++key;
+        }
+    } else if (disp == ToUpper) {
+        while (*key != '\0') {
+            if (CHARTYPE(lower, *key) != 0) {
+                *key = CHARCONV(upper, *key);
+            }
+            ++key;
+        }
+    }
+    *sep = ':';
+
+    return idx;
+}
+
 
 /*
  *----------------------------------------------------------------------
@@ -1142,7 +1174,7 @@ GetEncodingFormat(const char *encodingString, const char *encodingFormat, size_t
  *
  * CompressAllow --
  *
- *      Handle quality values expressed explicitly (for gzip or brotli) in the
+ *      Handle quality values expressed explicitly (for gzip, brotli or zstd) in the
  *      header fields. Respect cases, where compression is forbidden via
  *      identy or default rules.
  *
@@ -1201,11 +1233,11 @@ CompressAllow(double compressQvalue, double identityQvalue, double starQvalue)
  *
  * NsParseAcceptEncoding --
  *
- *      Parse the accept-encoding line and return whether gzip
- *      encoding is accepted or not.
+ *      Parse the accept-encoding line and return whether the gzip,
+ *      brotli and zstd encodings are accepted or not.
  *
  * Results:
- *      The result is passed back in the last two arguments.
+ *      The result is passed back in the last three arguments.
  *
  * Side effects:
  *      None.
@@ -1213,25 +1245,29 @@ CompressAllow(double compressQvalue, double identityQvalue, double starQvalue)
  *----------------------------------------------------------------------
  */
 void
-NsParseAcceptEncoding(double version, const char *hdr, bool *gzipAcceptPtr, bool *brotliAcceptPtr)
+NsParseAcceptEncoding(double version, const char *hdr, bool *gzipAcceptPtr, bool *brotliAcceptPtr,
+                      bool *zstdAcceptPtr)
 {
-    double      gzipQvalue = -1.0, brotliQvalue = -1, starQvalue = -1.0, identityQvalue = -1.0;
-    bool        gzipAccept, brotliAccept;
-    const char *gzipFormat, *brotliFormat, *starFormat;
+    double      gzipQvalue = -1.0, brotliQvalue = -1, zstdQvalue = -1.0, starQvalue = -1.0, identityQvalue = -1.0;
+    bool        gzipAccept, brotliAccept, zstdAccept;
+    const char *gzipFormat, *brotliFormat, *zstdFormat, *starFormat;
 
     NS_NONNULL_ASSERT(hdr != NULL);
     NS_NONNULL_ASSERT(gzipAcceptPtr != NULL);
     NS_NONNULL_ASSERT(brotliAcceptPtr != NULL);
+    NS_NONNULL_ASSERT(zstdAcceptPtr != NULL);
 
     gzipFormat    = GetEncodingFormat(hdr, "gzip", 4u, &gzipQvalue);
     brotliFormat  = GetEncodingFormat(hdr, "br", 2u, &brotliQvalue);
+    zstdFormat    = GetEncodingFormat(hdr, "zstd", 4u, &zstdQvalue);
     starFormat    = GetEncodingFormat(hdr, "*", 1u, &starQvalue);
     (void)GetEncodingFormat(hdr, "identity", 8u, &identityQvalue);
 
     //fprintf(stderr, "hdr line <%s> gzipFormat <%s> brotliFormat <%s>\n", hdr, gzipFormat, brotliFormat);
-    if ((gzipFormat != NULL) || (brotliFormat != NULL)) {
+    if ((gzipFormat != NULL) || (brotliFormat != NULL) || (zstdFormat != NULL)) {
         gzipAccept   = CompressAllow(gzipQvalue, identityQvalue, starQvalue);
         brotliAccept = CompressAllow(brotliQvalue, identityQvalue, starQvalue);
+        zstdAccept   = CompressAllow(zstdQvalue, identityQvalue, starQvalue);
     } else if (starFormat != NULL) {
         /*
          * No compress format was specified, star matches everything, so as
@@ -1256,15 +1292,18 @@ NsParseAcceptEncoding(double version, const char *hdr, bool *gzipAcceptPtr, bool
             gzipAccept = (version >= 1.1);
         }
         /*
-         * The implicit rules are the same for gzip and brotli.
+         * The implicit rules are the same for gzip, brotli and zstd.
          */
         brotliAccept = gzipAccept;
+        zstdAccept = gzipAccept;
     } else {
         gzipAccept   = NS_FALSE;
         brotliAccept = NS_FALSE;
+        zstdAccept   = NS_FALSE;
     }
     *gzipAcceptPtr   = gzipAccept;
     *brotliAcceptPtr = brotliAccept;
+    *zstdAcceptPtr   = zstdAccept;
 }
 
 
@@ -738,7 +738,7 @@ Ns_ConnReturnNotice(Ns_Conn *conn, int status,
      * file evaluates without error, return it. Otherwise fall back to the
      * old-style hardcoded fallback.
      */
-    if (Ns_Stat(fileName, &fileInfo)) {
+    if (NsStatCached(fileName, &fileInfo)) {
         Tcl_Interp  *interp = Ns_GetConnInterp(conn);
         NsInterp    *itPtr = NsGetInterpData(interp);
         Tcl_Obj     *fileObj;
@@ -0,0 +1,348 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ *
+ */
+
+/*
+ * ring.c --
+ *
+ *      Bounded multi-producer multi-consumer queue of pointers, used for
+ *      handing connections from the driver threads to the connection
+ *      threads. Every cell carries a sequence number telling whether the
+ *      cell is ready for the next producer or consumer, so producers and
+ *      consumers synchronize on the cell and on a CAS of their position
+ *      only (D. Vyukov's bounded MPMC queue).
+ *
+ *      Without compiler support for atomic operations, the queue is
+ *      protected by a mutex.
+ */
+
+#include "nsd.h"
+
+#ifdef NS_HAVE_ATOMIC_BUILTINS
+# define RingLoad(ptr, order)        __atomic_load_n((ptr), (order))
+# define RingStore(ptr, value, order) __atomic_store_n((ptr), (value), (order))
+# define RingCAS(ptr, expPtr, value)  __atomic_compare_exchange_n((ptr), (expPtr), (value), NS_TRUE, \
+                                                                  __ATOMIC_RELAXED, __ATOMIC_RELAXED)
+#endif
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * NsRingInit --
+ *
+ *      Initialize a ring for at least "capacity" elements. The capacity
+ *      is rounded up to the next power of two.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Allocates memory for the cells.
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+NsRingInit(NsRing *ringPtr, size_t capacity, const char *prefix, const char *name)
+{
+    size_t size = 2u, i;
+
+    NS_NONNULL_ASSERT(ringPtr != NULL);
+    NS_NONNULL_ASSERT(prefix != NULL);
+    NS_NONNULL_ASSERT(name != NULL);
+
+    while (size < capacity) {
+        size <<= 1;
+    }
+    memset(ringPtr, 0, sizeof(NsRing));
+    ringPtr->cells = ns_calloc(size, sizeof(NsRingCell));
+    ringPtr->mask = size - 1u;
+    for (i = 0u; i < size; i++) {
+        ringPtr->cells[i].seq = i;
+    }
+    Ns_MutexInit(&ringPtr->lock);
+    Ns_MutexSetName2(&ringPtr->lock, prefix, name);
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * NsRingPush --
+ *
+ *      Append an element to the ring.
+ *
+ * Results:
+ *      NS_TRUE on success, NS_FALSE when the ring is full.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+bool
+NsRingPush(NsRing *ringPtr, void *data)
+{
+    NsRingCell *cellPtr;
+    size_t      pos;
+
+    NS_NONNULL_ASSERT(ringPtr != NULL);
+
+#ifdef NS_HAVE_ATOMIC_BUILTINS
+    pos = RingLoad(&ringPtr->enqueuePos, __ATOMIC_RELAXED);
+    for (;;) {
+        size_t   seq;
+        intptr_t dif;
+
+        cellPtr = &ringPtr->cells[pos & ringPtr->mask];
+        seq = RingLoad(&cellPtr->seq, __ATOMIC_ACQUIRE);
+        dif = (intptr_t)seq - (intptr_t)pos;
+        if (dif == 0) {
+            if (RingCAS(&ringPtr->enqueuePos, &pos, pos + 1u)) {
+                break;
+            }
+        } else if (dif < 0) {
+            return NS_FALSE;
+        } else {
+            pos = RingLoad(&ringPtr->enqueuePos, __ATOMIC_RELAXED);
+        }
+    }
+    cellPtr->data = data;
+    RingStore(&cellPtr->seq, pos + 1u, __ATOMIC_RELEASE);
+#else
+    Ns_MutexLock(&ringPtr->lock);
+    pos = ringPtr->enqueuePos;
+    cellPtr = &ringPtr->cells[pos & ringPtr->mask];
+    if (cellPtr->seq != pos) {
+        Ns_MutexUnlock(&ringPtr->lock);
+        return NS_FALSE;
+    }
+    ringPtr->enqueuePos = pos + 1u;
+    cellPtr->data = data;
+    cellPtr->seq = pos + 1u;
+    Ns_MutexUnlock(&ringPtr->lock);
+#endif
+    return NS_TRUE;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * NsRingPop --
+ *
+ *      Remove the oldest element from the ring.
+ *
+ * Results:
+ *      Element or NULL, when the ring is empty.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+void *
+NsRingPop(NsRing *ringPtr)
+{
+    NsRingCell *cellPtr;
+    size_t      pos;
+    void       *data;
+
+    NS_NONNULL_ASSERT(ringPtr != NULL);
+
+#ifdef NS_HAVE_ATOMIC_BUILTINS
+    pos = RingLoad(&ringPtr->dequeuePos, __ATOMIC_RELAXED);
+    for (;;) {
+        size_t   seq;
+        intptr_t dif;
+
+        cellPtr = &ringPtr->cells[pos & ringPtr->mask];
+        seq = RingLoad(&cellPtr->seq, __ATOMIC_ACQUIRE);
+        dif = (intptr_t)seq - (intptr_t)(pos + 1u);
+        if (dif == 0) {
+            if (RingCAS(&ringPtr->dequeuePos, &pos, pos + 1u)) {
+                break;
+            }
+        } else if (dif < 0) {
+            return NULL;
+        } else {
+            pos = RingLoad(&ringPtr->dequeuePos, __ATOMIC_RELAXED);
+        }
+    }
+    data = cellPtr->data;
+    RingStore(&cellPtr->seq, pos + ringPtr->mask + 1u, __ATOMIC_RELEASE);
+#else
+    Ns_MutexLock(&ringPtr->lock);
+    pos = ringPtr->dequeuePos;
+    cellPtr = &ringPtr->cells[pos & ringPtr->mask];
+    if (cellPtr->seq != pos + 1u) {
+        Ns_MutexUnlock(&ringPtr->lock);
+        return NULL;
+    }
+    ringPtr->dequeuePos = pos + 1u;
+    data = cellPtr->data;
+    cellPtr->seq = pos + ringPtr->mask + 1u;
+    Ns_MutexUnlock(&ringPtr->lock);
+#endif
+    return data;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * NsRingCount --
+ *
+ *      Return the number of elements in the ring. When other threads
+ *      operate on the ring, the result is just a snapshot.
+ *
+ * Results:
+ *      Number of elements.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+size_t
+NsRingCount(NsRing *ringPtr)
+{
+    size_t enqueuePos, dequeuePos;
+
+    NS_NONNULL_ASSERT(ringPtr != NULL);
+
+#ifdef NS_HAVE_ATOMIC_BUILTINS
+    dequeuePos = RingLoad(&ringPtr->dequeuePos, __ATOMIC_ACQUIRE);
+    enqueuePos = RingLoad(&ringPtr->enqueuePos, __ATOMIC_ACQUIRE);
+#else
+    Ns_MutexLock(&ringPtr->lock);
+    dequeuePos = ringPtr->dequeuePos;
+    enqueuePos = ringPtr->enqueuePos;
+    Ns_MutexUnlock(&ringPtr->lock);
+#endif
+    return (enqueuePos > dequeuePos) ? enqueuePos - dequeuePos : 0u;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * NsRingSnapshot --
+ *
+ *      Copy up to "maxElements" elements currently in the ring into the
+ *      provided array without removing them. A cell is read like a
+ *      seqlock: the sequence number is checked before and after reading
+ *      the data, cells which are updated concurrently are skipped. When
+ *      other threads operate on the ring, the snapshot might contain
+ *      elements which were removed in the meantime, so the caller has to
+ *      validate the elements. The elements themselves must stay valid
+ *      memory.
+ *
+ * Results:
+ *      Number of copied elements.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+size_t
+NsRingSnapshot(NsRing *ringPtr, void **elements, size_t maxElements)
+{
+    size_t pos, enqueuePos, n = 0u;
+
+    NS_NONNULL_ASSERT(ringPtr != NULL);
+    NS_NONNULL_ASSERT(elements != NULL);
+
+#ifdef NS_HAVE_ATOMIC_BUILTINS
+    pos = RingLoad(&ringPtr->dequeuePos, __ATOMIC_ACQUIRE);
+    enqueuePos = RingLoad(&ringPtr->enqueuePos, __ATOMIC_ACQUIRE);
+    for (; pos < enqueuePos && n < maxElements; pos++) {
+        const NsRingCell *cellPtr = &ringPtr->cells[pos & ringPtr->mask];
+
+        if (RingLoad(&cellPtr->seq, __ATOMIC_ACQUIRE) == pos + 1u) {
+            void *data = RingLoad(&cellPtr->data, __ATOMIC_RELAXED);
+
+            /*
+             * The data is only valid, when no consumer has released the
+             * cell while it was read.
+             */
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+            if (RingLoad(&cellPtr->seq, __ATOMIC_RELAXED) == pos + 1u) {
+                elements[n++] = data;
+            }
+        }
+    }
+#else
+    Ns_MutexLock(&ringPtr->lock);
+    enqueuePos = ringPtr->enqueuePos;
+    for (pos = ringPtr->dequeuePos; pos < enqueuePos && n < maxElements; pos++) {
+        elements[n++] = ringPtr->cells[pos & ringPtr->mask].data;
+    }
+    Ns_MutexUnlock(&ringPtr->lock);
+#endif
+    return n;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * NsRingPeek --
+ *
+ *      Return the oldest element of the ring without removing it. The
+ *      result is only reliable when the caller serializes all consumers
+ *      of the ring, since producers only append.
+ *
+ * Results:
+ *      Element or NULL, when the ring is empty.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+void *
+NsRingPeek(NsRing *ringPtr)
+{
+    const NsRingCell *cellPtr;
+    size_t            pos;
+    void             *data = NULL;
+
+    NS_NONNULL_ASSERT(ringPtr != NULL);
+
+#ifdef NS_HAVE_ATOMIC_BUILTINS
+    pos = RingLoad(&ringPtr->dequeuePos, __ATOMIC_RELAXED);
+    cellPtr = &ringPtr->cells[pos & ringPtr->mask];
+    if (RingLoad(&cellPtr->seq, __ATOMIC_ACQUIRE) == pos + 1u) {
+        data = cellPtr->data;
+    }
+#else
+    Ns_MutexLock(&ringPtr->lock);
+    pos = ringPtr->dequeuePos;
+    cellPtr = &ringPtr->cells[pos & ringPtr->mask];
+    if (cellPtr->seq == pos + 1u) {
+        data = cellPtr->data;
+    }
+    Ns_MutexUnlock(&ringPtr->lock);
+#endif
+    return data;
+}
+
+/*
+ * Local Variables:
+ * mode: c
+ * c-basic-offset: 4
+ * fill-column: 78
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -35,6 +35,9 @@ typedef struct ServerInit {
 static void CreatePool(NsServer *servPtr, const char *pool)
     NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(2);
 
+static void CreateClasses(ConnPool *poolPtr, const char *section, const char *prefix)
+    NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(2) NS_GNUC_NONNULL(3);
+
 
 /*
  * Static variables defined in this file.
@@ -443,6 +446,55 @@ NsInitServer(const char *server, Ns_ServerInitProc *initProc)
     servPtr->compress.minsize = (int)Ns_ConfigMemUnitRange(section, "compressminsize", NULL, 512, 0, INT_MAX);
     servPtr->compress.preinit = Ns_ConfigBool(section, "compresspreinit", NS_FALSE);
 
+    /*
+     * On-the-fly Brotli compression is used instead of gzip when enabled
+     * and accepted by the client.
+     */
+    servPtr->compress.brotli = Ns_ConfigBool(section, "brotlienable", NS_FALSE);
+#ifndef HAVE_BROTLI
+    if (servPtr->compress.brotli) {
+        Ns_Log(Warning, "init server %s: brotli is enabled, but no brotli support built in",
+               server);
+        servPtr->compress.brotli = NS_FALSE;
+    }
+#endif
+    servPtr->compress.brotliLevel = Ns_ConfigIntRange(section, "brotlilevel", 5, 0, 11);
+    servPtr->compress.brotliWindow = Ns_ConfigIntRange(section, "brotliwindow", 22, 10, 24);
+    servPtr->compress.brotliMinsize = (int)Ns_ConfigMemUnitRange(section, "brotliminsize", NULL,
+                                                                 servPtr->compress.minsize,
+                                                                 0, INT_MAX);
+
+    /*
+     * On-the-fly zstd compression, used when accepted by the client and
+     * Brotli is not used.
+     */
+    servPtr->compress.zstd = Ns_ConfigBool(section, "zstdenable", NS_FALSE);
+#ifndef HAVE_ZSTD
+    if (servPtr->compress.zstd) {
+        Ns_Log(Warning, "init server %s: zstd is enabled, but no zstd support built in",
+               server);
+        servPtr->compress.zstd = NS_FALSE;
+    }
+#endif
+    servPtr->compress.zstdLevel = Ns_ConfigIntRange(section, "zstdlevel", 3, 1, 19);
+    servPtr->compress.zstdMinsize = (int)Ns_ConfigMemUnitRange(section, "zstdminsize", NULL,
+                                                               servPtr->compress.minsize,
+                                                               0, INT_MAX);
+
+    /*
+     * Adaptive compression lowers the compression levels under load.
+     */
+    servPtr->compress.adaptive.enable = Ns_ConfigBool(section, "compressadaptive", NS_FALSE);
+    Ns_ConfigTimeUnitRange(section, "compressadaptivedelay", "20ms", 0, 1000, INT_MAX, 0,
+                           &servPtr->compress.adaptive.delay);
+    Ns_ConfigTimeUnitRange(section, "compressadaptiveinterval", "1s", 0, 0, INT_MAX, 0,
+                           &servPtr->compress.adaptive.interval);
+    servPtr->compress.adaptive.busy = Ns_ConfigIntRange(section, "compressadaptivebusy", 80, 1, 100);
+    servPtr->compress.adaptive.skipsize = (int)Ns_ConfigMemUnitRange(section, "compressadaptiveskipsize",
+                                                                     NULL, 16384, 0, INT_MAX);
+    Ns_MutexInit(&servPtr->compress.adaptive.lock);
+    Ns_MutexSetName2(&servPtr->compress.adaptive.lock, "nsd:compress", server);
+
     /*
      * Run the library init procs in the order they were registered.
      */
@@ -615,9 +667,9 @@ CreatePool(NsServer *servPtr, const char *pool)
      * before NsQueueConn begins to return NS_ERROR.
      *
      * If compression is enabled for this server and the "compresspreinit"
-     * parameter is set for this pool, also initialize the compression
-     * stream buffers.  This allocates a fair chunk of memory per connection,
-     * so skip it if not needed.  The streams will be initialized later
+     * parameter is set, also fill the pool of compression streams (see
+     * ns/compress poolsize). This allocates a fair chunk of memory per
+     * stream, so skip it if not needed.  The streams will be created later
      * if necessary.
      */
 
@@ -641,9 +693,32 @@ CreatePool(NsServer *servPtr, const char *pool)
     Ns_ConfigTimeUnitRange(section, "threadtimeout", "2m", 0, 0, INT_MAX, 0,
                            &poolPtr->threads.timeout);
 
+    /*
+     * With "threadcontrol adaptive", the number of connection threads
+     * follows the load to keep the queueing delay below "latencytarget",
+     * instead of reacting on the queue length.
+     */
+    {
+        const char *threadcontrol = Ns_ConfigString(section, "threadcontrol", "watermark");
+
+        if (STREQ(threadcontrol, "adaptive")) {
+            poolPtr->autoscale.adaptive = NS_TRUE;
+        } else if (!STREQ(threadcontrol, "watermark")) {
+            Ns_Log(Warning, "pool %s: invalid value '%s' for threadcontrol, using 'watermark'",
+                   NsPoolName(pool), threadcontrol);
+        }
+    }
+    Ns_ConfigTimeUnitRange(section, "latencytarget", "50ms", 0, 1000, INT_MAX, 0,
+                           &poolPtr->autoscale.target);
+    poolPtr->autoscale.desired = poolPtr->threads.min;
+
     poolPtr->wqueue.rejectoverrun = Ns_ConfigBool(section, "rejectoverrun", NS_FALSE);
     Ns_ConfigTimeUnitRange(section, "retryafter", "5s", 0, 0, INT_MAX, 0,
                            &poolPtr->wqueue.retryafter);
+    Ns_ConfigTimeUnitRange(section, "codeltarget", "0s", 0, 0, INT_MAX, 0,
+                           &poolPtr->codel.target);
+    Ns_ConfigTimeUnitRange(section, "codelinterval", "100ms", 0, 1000, INT_MAX, 0,
+                           &poolPtr->codel.interval);
 
     poolPtr->rate.defaultConnectionLimit =
         Ns_ConfigIntRange(section, "connectionratelimit", -1, -1, INT_MAX);
@@ -653,19 +728,15 @@ CreatePool(NsServer *servPtr, const char *pool)
     if (poolPtr->rate.poolLimit != -1) {
         NsWriterBandwidthManagement = NS_TRUE;
     }
-    for (n = 0; n < maxconns - 1; ++n) {
+    if (servPtr->compress.enable
+        && servPtr->compress.preinit) {
+        NsCompressPoolFill(maxconns);
+    }
+    for (n = 0; n < maxconns; ++n) {
         connPtr = &connBufPtr[n];
-        connPtr->nextPtr = &connBufPtr[n+1];
-        if (servPtr->compress.enable
-            && servPtr->compress.preinit) {
-            (void) Ns_CompressInit(&connPtr->cStream);
-        }
         connPtr->rateLimit = poolPtr->rate.defaultConnectionLimit;
     }
 
-    connBufPtr[n].nextPtr = NULL;
-    poolPtr->wqueue.freePtr = &connBufPtr[0];
-
     queueLength = maxconns - poolPtr->threads.max;
 
     highwatermark = Ns_ConfigIntRange(section, "highwatermark", 80, 0, 100);
@@ -708,25 +779,150 @@ CreatePool(NsServer *servPtr, const char *pool)
             snprintf(suffix, 64u, "connthread:%d", j);
             Ns_MutexInit(&poolPtr->tqueue.args[j].lock);
             Ns_MutexSetName2(&poolPtr->tqueue.args[j].lock, ds.string, suffix);
-            Ns_CondInit(&poolPtr->tqueue.args[j].cond);
         }
         Ns_MutexInit(&poolPtr->tqueue.lock);
         Ns_MutexSetName2(&poolPtr->tqueue.lock, ds.string, "tqueue");
+        Ns_CondInit(&poolPtr->tqueue.cond);
 
         Ns_MutexInit(&poolPtr->wqueue.lock);
         Ns_MutexSetName2(&poolPtr->wqueue.lock, ds.string, "wqueue");
         Ns_CondInit(&poolPtr->wqueue.cond);
 
+        /*
+         * Both rings can hold all conns of the pool, so pushing a conn
+         * never fails.
+         */
+        NsRingInit(&poolPtr->wqueue.freeRing, (size_t)maxconns, ds.string, "freering");
+        NsRingInit(&poolPtr->wqueue.wait.ring, (size_t)maxconns, ds.string, "waitring");
+        for (n = 0; n < maxconns; ++n) {
+            (void) NsRingPush(&poolPtr->wqueue.freeRing, &connBufPtr[n]);
+        }
+
         Ns_MutexInit(&poolPtr->threads.lock);
         Ns_MutexSetName2(&poolPtr->threads.lock, ds.string, "threads");
 
         Ns_MutexInit(&poolPtr->rate.lock);
         Ns_MutexSetName2(&poolPtr->rate.lock, ds.string, "ratelimit");
 
+        Ns_MutexInit(&poolPtr->codel.lock);
+        Ns_MutexSetName2(&poolPtr->codel.lock, ds.string, "codel");
+
+        Ns_MutexInit(&poolPtr->autoscale.lock);
+        Ns_MutexSetName2(&poolPtr->autoscale.lock, ds.string, "autoscale");
+
+        CreateClasses(poolPtr, section, ds.string);
+
         Tcl_DStringFree(&ds);
     }
 }
 
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * CreateClasses --
+ *
+ *      Create the request classes of a connection pool as listed in the
+ *      "classes" parameter of the pool. Every class is configured in its
+ *      own section below the pool section ("class/NAME") with a "weight",
+ *      an optional "deadline" and "map" parameters like for pools. The
+ *      class "default" receives all requests of the pool not mapped to
+ *      another class; it is created implicitly and can be configured like
+ *      other classes.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Requests for specified URL's will be handled in given class.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+CreateClasses(ConnPool *poolPtr, const char *section, const char *prefix)
+{
+    const char *classes;
+    Tcl_Obj    *listObj, **ov;
+    TCL_SIZE_T  oc = 0, i;
+    int         n = 1;
+
+    NS_NONNULL_ASSERT(poolPtr != NULL);
+    NS_NONNULL_ASSERT(section != NULL);
+    NS_NONNULL_ASSERT(prefix != NULL);
+
+    classes = Ns_ConfigString(section, "classes", NS_EMPTY_STRING);
+    if (*classes == '\0') {
+        return;
+    }
+
+    listObj = Tcl_NewStringObj(classes, TCL_INDEX_NONE);
+    Tcl_IncrRefCount(listObj);
+    if (Tcl_ListObjGetElements(NULL, listObj, &oc, &ov) != TCL_OK) {
+        Ns_Log(Warning, "pool %s: invalid list of classes '%s'",
+               NsPoolName(poolPtr->pool), classes);
+        oc = 0;
+    }
+
+    poolPtr->classes.list = ns_calloc((size_t)oc + 1u, sizeof(ConnClass));
+    poolPtr->classes.list[0].name = "default";
+
+    for (i = 0; i <= oc; i++) {
+        ConnClass  *classPtr;
+        const char *name, *classSection;
+        Ns_Set     *set;
+        size_t      j;
+
+        if (i == 0) {
+            classPtr = &poolPtr->classes.list[0];
+            name = classPtr->name;
+        } else {
+            name = Tcl_GetString(ov[i - 1]);
+            if (STREQ(name, "default")) {
+                continue;
+            }
+            classPtr = &poolPtr->classes.list[n++];
+            classPtr->name = ns_strdup(name);
+        }
+        classPtr->poolPtr = poolPtr;
+
+        if (*poolPtr->pool == '\0') {
+            classSection = Ns_ConfigGetPath(poolPtr->servPtr->server, NULL, "class", name, NS_SENTINEL);
+        } else {
+            classSection = Ns_ConfigGetPath(poolPtr->servPtr->server, NULL, "pool", poolPtr->pool,
+                                            "class", name, NS_SENTINEL);
+        }
+        classPtr->weight = Ns_ConfigIntRange(classSection, "weight", 1, 1, 1000);
+        classPtr->stride = 1000000u / (uint64_t)classPtr->weight;
+        Ns_ConfigTimeUnitRange(classSection, "deadline", "0s", 0, 0, INT_MAX, 0,
+                               &classPtr->deadline);
+        NsRingInit(&classPtr->ring, (size_t)poolPtr->wqueue.maxconns, prefix, name);
+
+        set = Ns_ConfigGetSection2(classSection, NS_FALSE);
+        for (j = 0u; set != NULL && j < Ns_SetSize(set); ++j) {
+            const char *key = Ns_SetKey(set, j);
+
+            if (STREQ(key, "map")
+                || STREQ(key, "map-inherit")) {
+                NsConfigMarkAsRead(classSection, j);
+                NsMapClass(classPtr, Ns_SetValue(set, j), 0u);
+            }
+            if (STREQ(key, "map-noinherit")) {
+                NsConfigMarkAsRead(classSection, j);
+                NsMapClass(classPtr, Ns_SetValue(set, j), NS_OP_NOINHERIT);
+            }
+        }
+        Ns_Log(Notice, "pool %s: class %s weight %d deadline " NS_TIME_FMT,
+               NsPoolName(poolPtr->pool), name, classPtr->weight,
+               (int64_t)classPtr->deadline.sec, classPtr->deadline.usec);
+    }
+    Tcl_DecrRefCount(listObj);
+
+    Ns_MutexInit(&poolPtr->classes.lock);
+    Ns_MutexSetName2(&poolPtr->classes.lock, prefix, "classes");
+    poolPtr->classes.num = n;
+}
+
 /*
  *----------------------------------------------------------------------
  *
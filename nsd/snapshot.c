@@ -0,0 +1,695 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ *
+ */
+
+/*
+ * snapshot.c --
+ *
+ *      Save the contents of nsv arrays and ns_cache caches into a snapshot
+ *      file and restore these, e.g. at startup before the drivers accept
+ *      requests.
+ *
+ *      A snapshot file starts with a magic string and the number of
+ *      sections. Every section contains a single array or cache and
+ *      consists of the section type, the name, the length of the section
+ *      body and the body, which is encoded by tclvar.c or tclcache.c.
+ *      Integers are stored in little-endian byte order, strings are
+ *      prefixed by their 32-bit length. Since the length of every section
+ *      is known, the sections of a memory-mapped snapshot file are
+ *      restored in parallel.
+ */
+
+#include "nsd.h"
+
+#define SNAPSHOT_MAGIC        "NSSNAP02"
+#define SNAPSHOT_MAGIC_LENGTH 8u
+
+/*
+ * Minimal size of a section: type (1 byte), name length (4 bytes) and body
+ * length (8 bytes).
+ */
+#define SNAPSHOT_SECTION_MINSIZE 13u
+
+/*
+ * The following structure describes a section of a mapped snapshot file.
+ */
+
+typedef struct Section {
+    int                  type;
+    const char          *name;
+    size_t               nameLength;
+    const unsigned char *body;
+    size_t               bodyLength;
+} Section;
+
+/*
+ * The following structure keeps the state of restoring a snapshot file,
+ * shared by the loader threads.
+ */
+
+typedef struct Restore {
+    NsServer      *servPtr;
+    const char    *path;
+    Section       *sections;
+    size_t         nsections;
+    size_t         next;       /* Next section to be restored. */
+    Ns_Mutex       lock;
+    size_t         arrays;
+    size_t         caches;
+    size_t         entries;
+    size_t         errors;
+} Restore;
+
+/*
+ * Local functions defined in this file
+ */
+
+static Ns_ThreadProc RestoreThread;
+static void RestoreSections(Restore *restorePtr)
+    NS_GNUC_NONNULL(1);
+
+static Ns_ReturnCode WriteFile(const char *path, const Tcl_DString *dsPtr)
+    NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(2);
+
+static TCL_OBJCMDPROC_T SnapshotSaveObjCmd;
+static TCL_OBJCMDPROC_T SnapshotLoadObjCmd;
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * NsSnapshotPutInt, NsSnapshotPutBytes --
+ *
+ *      Append an integer of "nbytes" bytes or a length-prefixed string to
+ *      a snapshot.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Extends the Tcl_DString.
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+NsSnapshotPutInt(Tcl_DString *dsPtr, uint64_t value, size_t nbytes)
+{
+    unsigned char buf[8];
+    size_t        i;
+
+    NS_NONNULL_ASSERT(dsPtr != NULL);
+
+    for (i = 0u; i < nbytes && i < sizeof(buf); i++) {
+        buf[i] = (unsigned char)(value & 0xffu);
+        value >>= 8;
+    }
+    Tcl_DStringAppend(dsPtr, (const char *)buf, (TCL_SIZE_T)i);
+}
+
+void
+NsSnapshotPutBytes(Tcl_DString *dsPtr, const char *bytes, size_t length)
+{
+    NS_NONNULL_ASSERT(dsPtr != NULL);
+    NS_NONNULL_ASSERT(bytes != NULL);
+
+    NsSnapshotPutInt(dsPtr, (uint64_t)length, 4u);
+    Tcl_DStringAppend(dsPtr, bytes, (TCL_SIZE_T)length);
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * NsSnapshotBeginSection, NsSnapshotEndSection --
+ *
+ *      Start a section of the given type and name, and fill in the
+ *      length of the section body when the section is complete.
+ *
+ * Results:
+ *      NsSnapshotBeginSection() returns the offset of the body length,
+ *      which has to be passed to NsSnapshotEndSection().
+ *
+ * Side effects:
+ *      Extends the Tcl_DString.
+ *
+ *----------------------------------------------------------------------
+ */
+
+TCL_SIZE_T
+NsSnapshotBeginSection(Tcl_DString *dsPtr, int type, const char *name)
+{
+    TCL_SIZE_T offset;
+
+    NS_NONNULL_ASSERT(dsPtr != NULL);
+    NS_NONNULL_ASSERT(name != NULL);
+
+    NsSnapshotPutInt(dsPtr, (uint64_t)type, 1u);
+    NsSnapshotPutBytes(dsPtr, name, strlen(name));
+    offset = dsPtr->length;
+    NsSnapshotPutInt(dsPtr, 0u, 8u);
+
+    return offset;
+}
+
+void
+NsSnapshotEndSection(Tcl_DString *dsPtr, TCL_SIZE_T offset)
+{
+    uint64_t length;
+    size_t   i;
+
+    NS_NONNULL_ASSERT(dsPtr != NULL);
+
+    length = (uint64_t)(dsPtr->length - offset - 8);
+    for (i = 0u; i < 8u; i++) {
+        dsPtr->string[offset + (TCL_SIZE_T)i] = (char)(length & 0xffu);
+        length >>= 8;
+    }
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * NsSnapshotGetInt, NsSnapshotGetBytes --
+ *
+ *      Read an integer of "nbytes" bytes or a length-prefixed string from
+ *      a snapshot. When the data is truncated, the error flag of the
+ *      reader is set.
+ *
+ * Results:
+ *      Integer value or pointer to the string (not NUL-terminated) and its
+ *      length in "lengthPtr". On errors, 0 or NULL is returned.
+ *
+ * Side effects:
+ *      Advances the reader.
+ *
+ *----------------------------------------------------------------------
+ */
+
+uint64_t
+NsSnapshotGetInt(NsSnapshotReader *readerPtr, size_t nbytes)
+{
+    uint64_t value = 0u;
+
+    NS_NONNULL_ASSERT(readerPtr != NULL);
+
+    if (readerPtr->error || (size_t)(readerPtr->end - readerPtr->next) < nbytes) {
+        readerPtr->error = NS_TRUE;
+    } else {
+        size_t i;
+
+        for (i = nbytes; i > 0u; i--) {
+            value = (value << 8) | readerPtr->next[i - 1u];
+        }
+        readerPtr->next += nbytes;
+    }
+    return value;
+}
+
+const char *
+NsSnapshotGetBytes(NsSnapshotReader *readerPtr, size_t *lengthPtr)
+{
+    const char *result = NULL;
+    size_t      length;
+
+    NS_NONNULL_ASSERT(readerPtr != NULL);
+    NS_NONNULL_ASSERT(lengthPtr != NULL);
+
+    length = (size_t)NsSnapshotGetInt(readerPtr, 4u);
+    if (!readerPtr->error) {
+        if ((size_t)(readerPtr->end - readerPtr->next) < length) {
+            readerPtr->error = NS_TRUE;
+        } else {
+            result = (const char *)readerPtr->next;
+            readerPtr->next += length;
+        }
+    }
+    *lengthPtr = (result != NULL) ? length : 0u;
+
+    return result;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * NsSnapshotSave --
+ *
+ *      Write the nsv arrays and caches of the server matching the provided
+ *      patterns (NULL means none) into a snapshot file. The file is
+ *      written under a temporary name and renamed afterwards, such that
+ *      an existing snapshot is replaced atomically.
+ *
+ * Results:
+ *      NS_OK or NS_ERROR, when the file could not be written.
+ *
+ * Side effects:
+ *      The number of saved arrays, caches and entries is appended to
+ *      "statsPtr" as a dict.
+ *
+ *----------------------------------------------------------------------
+ */
+
+Ns_ReturnCode
+NsSnapshotSave(NsServer *servPtr, const char *path, const char *nsvPattern,
+               const char *cachePattern, Tcl_DString *statsPtr)
+{
+    Tcl_DString   ds;
+    size_t        arrays = 0u, caches = 0u, entries = 0u;
+    Ns_ReturnCode status;
+
+    NS_NONNULL_ASSERT(servPtr != NULL);
+    NS_NONNULL_ASSERT(path != NULL);
+    NS_NONNULL_ASSERT(statsPtr != NULL);
+
+    Tcl_DStringInit(&ds);
+    Tcl_DStringAppend(&ds, SNAPSHOT_MAGIC, (TCL_SIZE_T)SNAPSHOT_MAGIC_LENGTH);
+    NsSnapshotPutInt(&ds, 0u, 4u);
+
+    if (nsvPattern != NULL) {
+        arrays = NsTclNsvSnapshot(servPtr, nsvPattern, &ds, &entries);
+    }
+    if (cachePattern != NULL) {
+        caches = NsTclCacheSnapshot(servPtr, cachePattern, &ds, &entries);
+    }
+
+    /*
+     * Fill in the number of sections.
+     */
+    {
+        uint64_t nsections = (uint64_t)(arrays + caches);
+        size_t   i;
+
+        for (i = 0u; i < 4u; i++) {
+            ds.string[SNAPSHOT_MAGIC_LENGTH + i] = (char)(nsections & 0xffu);
+            nsections >>= 8;
+        }
+    }
+
+    status = WriteFile(path, &ds);
+    if (status == NS_OK) {
+        Ns_DStringPrintf(statsPtr, "arrays %" PRIuz " caches %" PRIuz " entries %" PRIuz
+                         " bytes %" PRIuz,
+                         arrays, caches, entries, (size_t)ds.length);
+    }
+    Tcl_DStringFree(&ds);
+
+    return status;
+}
+
+static Ns_ReturnCode
+WriteFile(const char *path, const Tcl_DString *dsPtr)
+{
+    Tcl_DString   tmp;
+    int           fd, errorCode = 0;
+    Ns_ReturnCode status = NS_ERROR;
+
+    NS_NONNULL_ASSERT(path != NULL);
+    NS_NONNULL_ASSERT(dsPtr != NULL);
+
+    Tcl_DStringInit(&tmp);
+    Ns_DStringPrintf(&tmp, "%s.tmp", path);
+
+    fd = ns_open(tmp.string, O_WRONLY | O_CREAT | O_TRUNC | O_BINARY | O_CLOEXEC, 0644);
+    if (fd != NS_INVALID_FD) {
+        const char *p = dsPtr->string;
+        size_t      remaining = (size_t)dsPtr->length;
+
+        while (remaining > 0u) {
+            ssize_t written = ns_write(fd, p, remaining);
+
+            if (written <= 0) {
+                errorCode = (written < 0) ? errno : EIO;
+                break;
+            }
+            p += written;
+            remaining -= (size_t)written;
+        }
+        if (remaining > 0u) {
+            (void) ns_close(fd);
+        } else if (ns_close(fd) != 0 || rename(tmp.string, path) != 0) {
+            errorCode = errno;
+        } else {
+            status = NS_OK;
+        }
+        if (status != NS_OK) {
+            (void) unlink(tmp.string);
+        }
+    } else {
+        errorCode = errno;
+    }
+    if (status != NS_OK) {
+        Ns_Log(Error, "snapshot: could not write file '%s': %s", path, strerror(errorCode));
+        /*
+         * The callers report the cause via Tcl_PosixError().
+         */
+        errno = errorCode;
+    }
+    Tcl_DStringFree(&tmp);
+
+    return status;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * NsSnapshotLoad --
+ *
+ *      Restore the nsv arrays and caches from a snapshot file. The file is
+ *      memory mapped and its sections are restored by up to "nthreads"
+ *      threads in parallel. Existing cache entries are kept, expired
+ *      entries are skipped.
+ *
+ * Results:
+ *      NS_OK or NS_ERROR, when the file could not be read or is invalid.
+ *
+ * Side effects:
+ *      The number of restored arrays, caches and entries is appended to
+ *      "statsPtr" as a dict, when this is not NULL.
+ *
+ *----------------------------------------------------------------------
+ */
+
+Ns_ReturnCode
+NsSnapshotLoad(NsServer *servPtr, const char *path, int nthreads, Tcl_DString *statsPtr)
+{
+    struct stat      st;
+    FileMap          map;
+    Restore          restore;
+    NsSnapshotReader reader;
+    size_t           i, nsections;
+    Ns_ReturnCode    status = NS_OK;
+
+    NS_NONNULL_ASSERT(servPtr != NULL);
+    NS_NONNULL_ASSERT(path != NULL);
+
+    if (stat(path, &st) != 0) {
+        int errorCode = errno;
+
+        Ns_Log(Error, "snapshot: could not read file '%s': %s", path, strerror(errorCode));
+        errno = errorCode;
+        return NS_ERROR;
+    }
+    if ((size_t)st.st_size < SNAPSHOT_MAGIC_LENGTH + 4u
+        || NsMemMap(path, (size_t)st.st_size, NS_MMAP_READ, &map) != NS_OK) {
+        Ns_Log(Error, "snapshot: could not map file '%s'", path);
+        return NS_ERROR;
+    }
+
+    reader.next = map.addr;
+    reader.end = reader.next + st.st_size;
+    reader.error = NS_FALSE;
+
+    if (memcmp(reader.next, SNAPSHOT_MAGIC, SNAPSHOT_MAGIC_LENGTH) != 0) {
+        Ns_Log(Error, "snapshot: file '%s' is not a snapshot file", path);
+        NsMemUmap(&map);
+        return NS_ERROR;
+    }
+    reader.next += SNAPSHOT_MAGIC_LENGTH;
+    nsections = (size_t)NsSnapshotGetInt(&reader, 4u);
+
+    /*
+     * Check the number of sections against the size of the file before
+     * allocating the index, such that a corrupted header cannot trigger
+     * huge allocations.
+     */
+    if (nsections > (size_t)(reader.end - reader.next) / SNAPSHOT_SECTION_MINSIZE) {
+        Ns_Log(Error, "snapshot: file '%s' has an invalid number of sections: %" PRIuz,
+               path, nsections);
+        NsMemUmap(&map);
+        return NS_ERROR;
+    }
+
+    /*
+     * Build the index of the sections, such that these can be restored in
+     * parallel.
+     */
+    memset(&restore, 0, sizeof(restore));
+    restore.servPtr = servPtr;
+    restore.path = path;
+    restore.sections = ns_calloc(nsections > 0u ? nsections : 1u, sizeof(Section));
+    for (i = 0u; i < nsections && !reader.error; i++) {
+        Section *sectionPtr = &restore.sections[i];
+
+        sectionPtr->type = (int)NsSnapshotGetInt(&reader, 1u);
+        sectionPtr->name = NsSnapshotGetBytes(&reader, &sectionPtr->nameLength);
+        sectionPtr->bodyLength = (size_t)NsSnapshotGetInt(&reader, 8u);
+        if (!reader.error && (size_t)(reader.end - reader.next) >= sectionPtr->bodyLength) {
+            sectionPtr->body = reader.next;
+            reader.next += sectionPtr->bodyLength;
+        } else {
+            reader.error = NS_TRUE;
+        }
+    }
+
+    if (reader.error) {
+        Ns_Log(Error, "snapshot: file '%s' is truncated", path);
+        status = NS_ERROR;
+
+    } else {
+        restore.nsections = nsections;
+        Ns_MutexInit(&restore.lock);
+        Ns_MutexSetName2(&restore.lock, "ns:snapshot", servPtr->server);
+
+        if (nthreads > (int)nsections) {
+            nthreads = (int)nsections;
+        }
+        if (nthreads <= 1) {
+            RestoreSections(&restore);
+        } else {
+            Ns_Thread *threads = ns_calloc((size_t)nthreads, sizeof(Ns_Thread));
+            int        t;
+
+            for (t = 0; t < nthreads; t++) {
+                Ns_ThreadCreate(RestoreThread, &restore, 0, &threads[t]);
+            }
+            for (t = 0; t < nthreads; t++) {
+                Ns_ThreadJoin(&threads[t], NULL);
+            }
+            ns_free(threads);
+        }
+        Ns_MutexDestroy(&restore.lock);
+
+        if (restore.errors > 0u) {
+            status = NS_ERROR;
+        }
+        Ns_Log(Notice, "snapshot: restored %" PRIuz " arrays, %" PRIuz " caches, %" PRIuz
+               " entries from '%s'", restore.arrays, restore.caches, restore.entries, path);
+        if (statsPtr != NULL) {
+            Ns_DStringPrintf(statsPtr, "arrays %" PRIuz " caches %" PRIuz " entries %" PRIuz,
+                             restore.arrays, restore.caches, restore.entries);
+        }
+    }
+
+    ns_free(restore.sections);
+    NsMemUmap(&map);
+
+    return status;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * RestoreThread, RestoreSections --
+ *
+ *      Restore sections of the snapshot until all sections are taken.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Fills nsv arrays and caches.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+RestoreThread(void *arg)
+{
+    Ns_ThreadSetName("-snapshot-");
+    RestoreSections(arg);
+}
+
+static void
+RestoreSections(Restore *restorePtr)
+{
+    Tcl_DString name;
+
+    NS_NONNULL_ASSERT(restorePtr != NULL);
+
+    Tcl_DStringInit(&name);
+    for (;;) {
+        const Section   *sectionPtr;
+        NsSnapshotReader reader;
+        size_t           entries = 0u;
+        Ns_ReturnCode    status;
+
+        Ns_MutexLock(&restorePtr->lock);
+        sectionPtr = (restorePtr->next < restorePtr->nsections)
+            ? &restorePtr->sections[restorePtr->next++]
+            : NULL;
+        Ns_MutexUnlock(&restorePtr->lock);
+
+        if (sectionPtr == NULL) {
+            break;
+        }
+
+        Tcl_DStringSetLength(&name, 0);
+        Tcl_DStringAppend(&name, sectionPtr->name, (TCL_SIZE_T)sectionPtr->nameLength);
+        reader.next = sectionPtr->body;
+        reader.end = sectionPtr->body + sectionPtr->bodyLength;
+        reader.error = NS_FALSE;
+
+        switch (sectionPtr->type) {
+        case NS_SNAPSHOT_NSV:
+            status = NsTclNsvRestore(restorePtr->servPtr, name.string, &reader, &entries);
+            break;
+        case NS_SNAPSHOT_CACHE:
+            status = NsTclCacheRestore(restorePtr->servPtr, name.string, &reader, &entries);
+            break;
+        default:
+            status = NS_ERROR;
+            break;
+        }
+
+        if (status != NS_OK || reader.error) {
+            Ns_Log(Error, "snapshot: invalid section '%s' of type %d in file '%s'",
+                   name.string, sectionPtr->type, restorePtr->path);
+        }
+
+        Ns_MutexLock(&restorePtr->lock);
+        if (status != NS_OK || reader.error) {
+            restorePtr->errors++;
+        } else if (sectionPtr->type == NS_SNAPSHOT_NSV) {
+            restorePtr->arrays++;
+        } else {
+            restorePtr->caches++;
+        }
+        restorePtr->entries += entries;
+        Ns_MutexUnlock(&restorePtr->lock);
+    }
+    Tcl_DStringFree(&name);
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * NsTclSnapshotObjCmd --
+ *
+ *      Implements "ns_snapshot".
+ *
+ * Results:
+ *      Tcl result.
+ *
+ * Side effects:
+ *      Depends on subcommand.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+SnapshotSaveObjCmd(ClientData clientData, Tcl_Interp *interp, TCL_SIZE_T objc, Tcl_Obj *const* objv)
+{
+    const NsInterp *itPtr = clientData;
+    char           *path = NULL, *nsvPattern = NULL, *cachePattern = NULL;
+    int             result = TCL_OK;
+    Ns_ObjvSpec     opts[] = {
+        {"-nsv",   Ns_ObjvString, &nsvPattern,   NULL},
+        {"-cache", Ns_ObjvString, &cachePattern, NULL},
+        {"--",     Ns_ObjvBreak,  NULL,          NULL},
+        {NULL, NULL, NULL, NULL}
+    };
+    Ns_ObjvSpec     args[] = {
+        {"filename", Ns_ObjvString, &path, NULL},
+        {NULL, NULL, NULL, NULL}
+    };
+
+    if (Ns_ParseObjv(opts, args, interp, 2, objc, objv) != NS_OK) {
+        result = TCL_ERROR;
+
+    } else {
+        Tcl_DString ds;
+
+        /*
+         * Without patterns, save all arrays and caches.
+         */
+        if (nsvPattern == NULL && cachePattern == NULL) {
+            nsvPattern = (char *)"*";
+            cachePattern = (char *)"*";
+        }
+
+        Tcl_DStringInit(&ds);
+        if (NsSnapshotSave(itPtr->servPtr, path, nsvPattern, cachePattern, &ds) != NS_OK) {
+            Ns_TclPrintfResult(interp, "could not write snapshot file \"%s\": %s",
+                               path, Tcl_PosixError(interp));
+            Tcl_DStringFree(&ds);
+            result = TCL_ERROR;
+        } else {
+            Tcl_DStringResult(interp, &ds);
+        }
+    }
+    return result;
+}
+
+static int
+SnapshotLoadObjCmd(ClientData clientData, Tcl_Interp *interp, TCL_SIZE_T objc, Tcl_Obj *const* objv)
+{
+    const NsInterp   *itPtr = clientData;
+    char             *path = NULL;
+    int               nthreads = 4, result = TCL_OK;
+    Ns_ObjvValueRange threadsRange = {1, 64};
+    Ns_ObjvSpec       opts[] = {
+        {"-threads", Ns_ObjvInt,   &nthreads, &threadsRange},
+        {"--",       Ns_ObjvBreak, NULL,      NULL},
+        {NULL, NULL, NULL, NULL}
+    };
+    Ns_ObjvSpec       args[] = {
+        {"filename", Ns_ObjvString, &path, NULL},
+        {NULL, NULL, NULL, NULL}
+    };
+
+    if (Ns_ParseObjv(opts, args, interp, 2, objc, objv) != NS_OK) {
+        result = TCL_ERROR;
+
+    } else {
+        Tcl_DString ds;
+
+        Tcl_DStringInit(&ds);
+        if (NsSnapshotLoad(itPtr->servPtr, path, nthreads, &ds) != NS_OK) {
+            Ns_TclPrintfResult(interp, "could not load snapshot file \"%s\"", path);
+            Tcl_DStringFree(&ds);
+            result = TCL_ERROR;
+        } else {
+            Tcl_DStringResult(interp, &ds);
+        }
+    }
+    return result;
+}
+
+int
+NsTclSnapshotObjCmd(ClientData clientData, Tcl_Interp *interp, TCL_SIZE_T objc, Tcl_Obj *const* objv)
+{
+    const Ns_SubCmdSpec subcmds[] = {
+        {"load", SnapshotLoadObjCmd},
+        {"save", SnapshotSaveObjCmd},
+        {NULL, NULL}
+    };
+
+    return Ns_SubcmdObjv(subcmds, clientData, interp, objc, objv);
+}
+
+/*
+ * Local Variables:
+ * mode: c
+ * c-basic-offset: 4
+ * fill-column: 78
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,756 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ *
+ */
+
+/*
+ * statcache.c --
+ *
+ *      Process-wide cache of file metadata as returned by stat(),
+ *      including negative results. The cache is used for the file lookups
+ *      of the fastpath, the ADP page lookup and the driver fast lane.  It
+ *      is split into shards, each of them an Ns_Cache with its own lock.
+ *      Entries expire after a short TTL. When inotify is available, the
+ *      parent directories of cached paths are watched, and entries are
+ *      invalidated as soon as the file system reports a change.
+ */
+
+#include "nsd.h"
+
+#ifdef HAVE_SYS_INOTIFY_H
+# include <sys/inotify.h>
+#endif
+
+/*
+ * The following structure defines a cached stat() result. For negative
+ * entries, "err" contains the errno value of the failed stat() call.
+ */
+
+typedef struct StatEntry {
+    int         err;
+    struct stat st;
+} StatEntry;
+
+/*
+ * Every shard has its own cache and statistics, protected by the cache
+ * lock. The epoch is incremented on every invalidation and prevents that
+ * results of stat() calls overlapping with an invalidation are cached.
+ */
+
+typedef struct Shard {
+    Ns_Cache     *cache;
+    unsigned long epoch;
+    unsigned long hits;
+    unsigned long negative;
+    unsigned long misses;
+    unsigned long invalidated;
+} Shard;
+
+/*
+ * Local functions defined in this file
+ */
+
+static Shard *PathShard(const char *path)
+    NS_GNUC_NONNULL(1) NS_GNUC_RETURNS_NONNULL;
+
+static int FlushEntries(const char *pattern, const char *prefix, bool invalidate);
+
+#ifdef HAVE_SYS_INOTIFY_H
+static void WatchParent(const char *path)
+    NS_GNUC_NONNULL(1);
+
+static void WatchEvent(const struct inotify_event *eventPtr)
+    NS_GNUC_NONNULL(1);
+
+static Ns_ThreadProc WatchThread;
+#endif
+
+static TCL_OBJCMDPROC_T StatCacheFlushObjCmd;
+static TCL_OBJCMDPROC_T StatCacheStatsObjCmd;
+
+/*
+ * Local variables defined in this file.
+ */
+
+static struct {
+    Shard        *shards;
+    int           nshards;
+    Ns_Time       ttl;
+    size_t        maxSize;
+#ifdef HAVE_SYS_INOTIFY_H
+    bool          inotify;
+    int           fd;
+    Ns_Mutex      lock;
+    Tcl_HashTable dirs;     /* Watch descriptor per directory name */
+    Tcl_HashTable watches;  /* Directory name per watch descriptor */
+    unsigned long events;
+#endif
+} statCache;
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * NsConfigStatCache --
+ *
+ *      Load the config values of the stat cache and create the shards,
+ *      when a "ttl" was configured.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+NsConfigStatCache(void)
+{
+    const char *section;
+
+    section = Ns_ConfigSectionPath(NULL, NULL, NULL, "statcache", NS_SENTINEL);
+    Ns_ConfigTimeUnitRange(section, "ttl", "0s", 0, 0, INT_MAX, 0, &statCache.ttl);
+
+    if (statCache.ttl.sec > 0 || statCache.ttl.usec > 0) {
+        Tcl_DString ds;
+        int         i;
+
+        statCache.nshards = Ns_ConfigIntRange(section, "shards", 8, 1, 256);
+        statCache.maxSize = (size_t)Ns_ConfigMemUnitRange(section, "maxsize", "1MB",
+                                                          1024*1024, 1024, INT_MAX);
+        statCache.shards = ns_calloc((size_t)statCache.nshards, sizeof(Shard));
+
+        Tcl_DStringInit(&ds);
+        for (i = 0; i < statCache.nshards; i++) {
+            Tcl_DStringSetLength(&ds, 0);
+            Ns_DStringPrintf(&ds, "ns:statcache:%d", i);
+            statCache.shards[i].cache = Ns_CacheCreateSz(ds.string, TCL_STRING_KEYS,
+                                                         statCache.maxSize / (size_t)statCache.nshards,
+                                                         ns_free);
+        }
+        Tcl_DStringFree(&ds);
+
+#ifdef HAVE_SYS_INOTIFY_H
+        statCache.inotify = Ns_ConfigBool(section, "inotify", NS_TRUE);
+        statCache.fd = NS_INVALID_FD;
+        Ns_MutexInit(&statCache.lock);
+        Ns_MutexSetName(&statCache.lock, "ns:statcache:watch");
+        Tcl_InitHashTable(&statCache.dirs, TCL_STRING_KEYS);
+        Tcl_InitHashTable(&statCache.watches, TCL_ONE_WORD_KEYS);
+#endif
+    }
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * NsStatCached --
+ *
+ *      Variant of Ns_Stat() returning the file metadata from the stat
+ *      cache, when possible. Failed lookups are cached as well, errno is
+ *      set accordingly. When the stat cache is disabled, the function
+ *      is equivalent to Ns_Stat().
+ *
+ * Results:
+ *      NS_TRUE if stat() was successful, NS_FALSE otherwise.
+ *
+ * Side effects:
+ *      Might add an entry to the stat cache and a directory watch.
+ *
+ *----------------------------------------------------------------------
+ */
+
+bool
+NsStatCached(const char *path, struct stat *stPtr)
+{
+    Shard          *shardPtr;
+    const Ns_Entry *entry;
+    StatEntry      *statPtr;
+    unsigned long   epoch;
+    Ns_Time         expires;
+    int             err;
+
+    NS_NONNULL_ASSERT(path != NULL);
+    NS_NONNULL_ASSERT(stPtr != NULL);
+
+    if (statCache.shards == NULL) {
+        return Ns_Stat(path, stPtr);
+    }
+
+    shardPtr = PathShard(path);
+    Ns_CacheLock(shardPtr->cache);
+    entry = Ns_CacheFindEntry(shardPtr->cache, path);
+    if (entry != NULL) {
+        const StatEntry *cachedPtr = Ns_CacheGetValue(entry);
+
+        shardPtr->hits++;
+        err = cachedPtr->err;
+        if (err == 0) {
+            *stPtr = cachedPtr->st;
+        } else {
+            shardPtr->negative++;
+        }
+        Ns_CacheUnlock(shardPtr->cache);
+
+    } else {
+        shardPtr->misses++;
+        epoch = shardPtr->epoch;
+        Ns_CacheUnlock(shardPtr->cache);
+
+#ifdef HAVE_SYS_INOTIFY_H
+        if (statCache.inotify) {
+            WatchParent(path);
+        }
+#endif
+        /*
+         * Call stat() without holding the lock.
+         */
+        statPtr = ns_malloc(sizeof(StatEntry));
+        if (Ns_Stat(path, &statPtr->st)) {
+            statPtr->err = 0;
+            *stPtr = statPtr->st;
+        } else {
+            statPtr->err = (errno != 0) ? errno : ENOENT;
+        }
+        err = statPtr->err;
+
+        Ns_GetTime(&expires);
+        Ns_IncrTime(&expires, statCache.ttl.sec, statCache.ttl.usec);
+
+        Ns_CacheLock(shardPtr->cache);
+        if (shardPtr->epoch == epoch) {
+            Ns_Entry *newEntry;
+            int       isNew;
+
+            newEntry = Ns_CacheCreateEntry(shardPtr->cache, path, &isNew);
+            (void) Ns_CacheSetValueExpires(newEntry, statPtr, sizeof(StatEntry) + strlen(path),
+                                           &expires, 0, 0u, 0u);
+        } else {
+            /*
+             * The path was invalidated during the stat() call, so the
+             * result might be outdated already. Return it, but do not
+             * cache it.
+             */
+            ns_free(statPtr);
+        }
+        Ns_CacheUnlock(shardPtr->cache);
+    }
+
+    if (err != 0) {
+        errno = err;
+        return NS_FALSE;
+    }
+    return NS_TRUE;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * NsStatCacheInvalidate --
+ *
+ *      Remove the entry of the specified path from the stat cache. The
+ *      function has to be called after modifying a file, which might be
+ *      looked up via NsStatCached().
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Entry is removed from the cache.
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+NsStatCacheInvalidate(const char *path)
+{
+    NS_NONNULL_ASSERT(path != NULL);
+
+    if (statCache.shards != NULL) {
+        Shard    *shardPtr = PathShard(path);
+        Ns_Entry *entry;
+
+        Ns_CacheLock(shardPtr->cache);
+        entry = Ns_CacheFindEntry(shardPtr->cache, path);
+        if (entry != NULL) {
+            Ns_CacheFlushEntry(entry);
+            shardPtr->invalidated++;
+        }
+        shardPtr->epoch++;
+        Ns_CacheUnlock(shardPtr->cache);
+    }
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * PathShard --
+ *
+ *      Return the shard responsible for the specified path (FNV-1a hash
+ *      of the path).
+ *
+ * Results:
+ *      Shard.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static Shard *
+PathShard(const char *path)
+{
+    const unsigned char *p;
+    unsigned int         hash = 2166136261u;
+
+    for (p = (const unsigned char *)path; *p != UCHAR('\0'); p++) {
+        hash = (hash ^ *p) * 16777619u;
+    }
+    return &statCache.shards[hash % (unsigned int)statCache.nshards];
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * FlushEntries --
+ *
+ *      Remove all entries from the stat cache, optionally only the ones
+ *      matching the provided glob pattern and/or the ones for the
+ *      provided path and the paths below it.
+ *
+ * Results:
+ *      Number of flushed entries.
+ *
+ * Side effects:
+ *      Entries are removed from the cache.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+FlushEntries(const char *pattern, const char *prefix, bool invalidate)
+{
+    size_t prefixLength = (prefix != NULL) ? strlen(prefix) : 0u;
+    int    i, count = 0;
+
+    for (i = 0; i < statCache.nshards; i++) {
+        Shard          *shardPtr = &statCache.shards[i];
+        Ns_CacheSearch  search;
+        Ns_Entry       *entry;
+
+        Ns_CacheLock(shardPtr->cache);
+        entry = Ns_CacheFirstEntry(shardPtr->cache, &search);
+        while (entry != NULL) {
+            const char *key = Ns_CacheKey(entry);
+
+            if ((pattern == NULL || Tcl_StringMatch(key, pattern) != 0)
+                && (prefix == NULL
+                    || (strncmp(key, prefix, prefixLength) == 0
+                        && (key[prefixLength] == '/' || key[prefixLength] == '\0')))
+                ) {
+                Ns_CacheFlushEntry(entry);
+                count++;
+                if (invalidate) {
+                    shardPtr->invalidated++;
+                }
+            }
+            entry = Ns_CacheNextEntry(&search);
+        }
+        shardPtr->epoch++;
+        Ns_CacheUnlock(shardPtr->cache);
+    }
+    return count;
+}
+
+#ifdef HAVE_SYS_INOTIFY_H
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * WatchParent --
+ *
+ *      Add an inotify watch for the parent directory of the specified
+ *      path, unless it is watched already. The watch thread is started
+ *      together with the first watch.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Might start the watch thread.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+WatchParent(const char *path)
+{
+    const char *slash;
+
+    NS_NONNULL_ASSERT(path != NULL);
+
+    slash = strrchr(path, INTCHAR('/'));
+    if (slash != NULL && slash != path) {
+        Tcl_DString ds;
+
+        Tcl_DStringInit(&ds);
+        Tcl_DStringAppend(&ds, path, (TCL_SIZE_T)(slash - path));
+
+        Ns_MutexLock(&statCache.lock);
+        if (Tcl_FindHashEntry(&statCache.dirs, ds.string) == NULL) {
+
+            if (statCache.fd == NS_INVALID_FD) {
+                statCache.fd = inotify_init1(IN_CLOEXEC);
+                if (statCache.fd == NS_INVALID_FD) {
+                    Ns_Log(Warning, "statcache: inotify_init1 failed: %s; entries expire by TTL only",
+                           strerror(errno));
+                    statCache.inotify = NS_FALSE;
+                } else {
+                    Ns_ThreadCreate(WatchThread, NULL, 0, NULL);
+                }
+            }
+
+            if (statCache.fd != NS_INVALID_FD) {
+                int wd = inotify_add_watch(statCache.fd, ds.string,
+                                           IN_ATTRIB | IN_CLOSE_WRITE | IN_CREATE | IN_DELETE
+                                           | IN_DELETE_SELF | IN_MODIFY | IN_MOVE_SELF
+                                           | IN_MOVED_FROM | IN_MOVED_TO | IN_ONLYDIR);
+                if (wd >= 0) {
+                    Tcl_HashEntry *hPtr;
+                    int            isNew;
+
+                    hPtr = Tcl_CreateHashEntry(&statCache.dirs, ds.string, &isNew);
+                    Tcl_SetHashValue(hPtr, INT2PTR(wd));
+
+                    /*
+                     * Different names of the same directory (e.g. via
+                     * symbolic links) share the watch. Events are
+                     * reported under the first name, paths using other
+                     * names expire by the TTL.
+                     */
+                    hPtr = Tcl_CreateHashEntry(&statCache.watches, INT2PTR(wd), &isNew);
+                    if (isNew != 0) {
+                        Tcl_SetHashValue(hPtr, ns_strdup(ds.string));
+                    }
+                } else if (errno == ENOSPC) {
+                    Ns_Log(Warning, "statcache: inotify watch limit reached for %s;"
+                           " further entries expire by TTL only", ds.string);
+                    statCache.inotify = NS_FALSE;
+                }
+            }
+        }
+        Ns_MutexUnlock(&statCache.lock);
+        Tcl_DStringFree(&ds);
+    }
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * WatchEvent --
+ *
+ *      Invalidate the stat cache entries affected by an inotify event.
+ *      Events on directories invalidate the entries of all paths below
+ *      them.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Entries are removed from the cache, removed watches are
+ *      forgotten.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+WatchEvent(const struct inotify_event *eventPtr)
+{
+    Tcl_HashEntry *hPtr;
+    Tcl_DString    ds;
+
+    NS_NONNULL_ASSERT(eventPtr != NULL);
+
+    if ((eventPtr->mask & IN_Q_OVERFLOW) != 0u) {
+        Ns_Log(Notice, "statcache: inotify event queue overflow, flushing cache");
+        (void) FlushEntries(NULL, NULL, NS_TRUE);
+        return;
+    }
+
+    Tcl_DStringInit(&ds);
+    Ns_MutexLock(&statCache.lock);
+    statCache.events++;
+    hPtr = Tcl_FindHashEntry(&statCache.watches, INT2PTR(eventPtr->wd));
+    if (hPtr != NULL) {
+        Tcl_DStringAppend(&ds, Tcl_GetHashValue(hPtr), TCL_INDEX_NONE);
+
+        if ((eventPtr->mask & IN_IGNORED) != 0u) {
+            Tcl_HashSearch search;
+
+            /*
+             * The watch was removed, forget all names of the directory.
+             */
+            ns_free(Tcl_GetHashValue(hPtr));
+            Tcl_DeleteHashEntry(hPtr);
+
+            hPtr = Tcl_FirstHashEntry(&statCache.dirs, &search);
+            while (hPtr != NULL) {
+                if (PTR2INT(Tcl_GetHashValue(hPtr)) == eventPtr->wd) {
+                    Tcl_DeleteHashEntry(hPtr);
+                }
+                hPtr = Tcl_NextHashEntry(&search);
+            }
+        }
+    }
+    Ns_MutexUnlock(&statCache.lock);
+
+    if (ds.length > 0) {
+        if ((eventPtr->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED)) != 0u) {
+            (void) FlushEntries(NULL, ds.string, NS_TRUE);
+            if ((eventPtr->mask & IN_MOVE_SELF) != 0u) {
+                /*
+                 * The name of the watched directory is not valid anymore.
+                 */
+                (void) inotify_rm_watch(statCache.fd, eventPtr->wd);
+            }
+
+        } else if (eventPtr->len > 0u) {
+            Tcl_DStringAppend(&ds, "/", 1);
+            Tcl_DStringAppend(&ds, eventPtr->name, TCL_INDEX_NONE);
+
+            if ((eventPtr->mask & IN_ISDIR) != 0u) {
+                (void) FlushEntries(NULL, ds.string, NS_TRUE);
+            } else {
+                NsStatCacheInvalidate(ds.string);
+            }
+        }
+    }
+    Tcl_DStringFree(&ds);
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * WatchThread --
+ *
+ *      Read inotify events and invalidate the affected entries.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+WatchThread(void *UNUSED(arg))
+{
+    union {
+        struct inotify_event event;
+        char                 bytes[8192];
+    } buffer;
+
+    Ns_ThreadSetName("-statcache-");
+    Ns_Log(Notice, "statcache: watch thread started");
+
+    for (;;) {
+        const char *p;
+        ssize_t     n = read(statCache.fd, buffer.bytes, sizeof(buffer));
+
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            Ns_Log(Error, "statcache: reading inotify events failed: %s", strerror(errno));
+            break;
+        }
+        for (p = buffer.bytes; p < buffer.bytes + n; ) {
+            const struct inotify_event *eventPtr = (const struct inotify_event *)(const void *)p;
+
+            WatchEvent(eventPtr);
+            p += sizeof(struct inotify_event) + eventPtr->len;
+        }
+    }
+
+    statCache.inotify = NS_FALSE;
+    (void) FlushEntries(NULL, NULL, NS_FALSE);
+    Ns_Log(Notice, "statcache: watch thread exits");
+}
+#endif
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * StatCacheFlushObjCmd --
+ *
+ *      Implements "ns_statcache flush". Flush all entries or the ones,
+ *      where the path matches the provided glob pattern.
+ *
+ * Results:
+ *      Tcl result, number of flushed entries.
+ *
+ * Side effects:
+ *      Entries are removed from the cache.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+StatCacheFlushObjCmd(ClientData UNUSED(clientData), Tcl_Interp *interp, TCL_SIZE_T objc, Tcl_Obj *const* objv)
+{
+    char       *pattern = NULL;
+    int         result = TCL_OK;
+    Ns_ObjvSpec args[] = {
+        {"?pattern", Ns_ObjvString, &pattern, NULL},
+        {NULL, NULL, NULL, NULL}
+    };
+
+    if (Ns_ParseObjv(NULL, args, interp, 2, objc, objv) != NS_OK) {
+        result = TCL_ERROR;
+    } else {
+        Tcl_SetObjResult(interp, Tcl_NewIntObj(FlushEntries(pattern, NULL, NS_FALSE)));
+    }
+    return result;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * StatCacheStatsObjCmd --
+ *
+ *      Implements "ns_statcache stats". Returns the configuration and
+ *      the usage statistics summed over all shards as a dict.
+ *
+ * Results:
+ *      Tcl result.
+ *
+ * Side effects:
+ *      With "-reset", the statistics are set to zero.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+StatCacheStatsObjCmd(ClientData UNUSED(clientData), Tcl_Interp *interp, TCL_SIZE_T objc, Tcl_Obj *const* objv)
+{
+    int         reset = (int)NS_FALSE, result = TCL_OK;
+    Ns_ObjvSpec opts[] = {
+        {"-reset", Ns_ObjvBool, &reset, INT2PTR(NS_TRUE)},
+        {NULL, NULL, NULL, NULL}
+    };
+
+    if (Ns_ParseObjv(opts, NULL, interp, 2, objc, objv) != NS_OK) {
+        result = TCL_ERROR;
+
+    } else {
+        Tcl_DString   ds;
+        size_t        size = 0u, entries = 0u;
+        unsigned long hits = 0u, negative = 0u, misses = 0u, invalidated = 0u;
+        unsigned long events = 0u;
+        TCL_SIZE_T    watches = 0;
+        bool          inotify = NS_FALSE;
+        int           i;
+
+        for (i = 0; i < statCache.nshards; i++) {
+            Shard          *shardPtr = &statCache.shards[i];
+            Ns_CacheSearch  search;
+            const Ns_Entry *entry;
+
+            Ns_CacheLock(shardPtr->cache);
+            entry = Ns_CacheFirstEntry(shardPtr->cache, &search);
+            while (entry != NULL) {
+                size += Ns_CacheGetSize(entry);
+                entries++;
+                entry = Ns_CacheNextEntry(&search);
+            }
+            hits += shardPtr->hits;
+            negative += shardPtr->negative;
+            misses += shardPtr->misses;
+            invalidated += shardPtr->invalidated;
+            if (reset != 0) {
+                shardPtr->hits = shardPtr->negative = shardPtr->misses = shardPtr->invalidated = 0u;
+            }
+            Ns_CacheUnlock(shardPtr->cache);
+        }
+
+#ifdef HAVE_SYS_INOTIFY_H
+        if (statCache.shards != NULL) {
+            Ns_MutexLock(&statCache.lock);
+            inotify = statCache.inotify;
+            watches = statCache.watches.numEntries;
+            events = statCache.events;
+            if (reset != 0) {
+                statCache.events = 0u;
+            }
+            Ns_MutexUnlock(&statCache.lock);
+        }
+#endif
+
+        Tcl_DStringInit(&ds);
+        Ns_DStringPrintf(&ds, "enabled %d shards %d maxsize %" PRIuz " ttl ",
+                         statCache.shards != NULL, statCache.nshards, statCache.maxSize);
+        (void) Ns_DStringAppendTime(&ds, &statCache.ttl);
+        Ns_DStringPrintf(&ds, " inotify %d watches %" PRITcl_Size " events %lu"
+                         " entries %" PRIuz " size %" PRIuz
+                         " hits %lu negative %lu missed %lu invalidated %lu hitrate %.2f",
+                         inotify, watches, events, entries, size,
+                         hits, negative, misses, invalidated,
+                         (hits + misses) > 0u ? (double)hits * 100.0 / (double)(hits + misses) : 0.0);
+        Tcl_DStringResult(interp, &ds);
+    }
+    return result;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * NsTclStatCacheObjCmd --
+ *
+ *      Implements "ns_statcache" with the subcommands "flush" and
+ *      "stats".
+ *
+ * Results:
+ *      Tcl result.
+ *
+ * Side effects:
+ *      Depends on the subcommand.
+ *
+ *----------------------------------------------------------------------
+ */
+
+int
+NsTclStatCacheObjCmd(ClientData clientData, Tcl_Interp *interp, TCL_SIZE_T objc, Tcl_Obj *const* objv)
+{
+    const Ns_SubCmdSpec subcmds[] = {
+        {"flush", StatCacheFlushObjCmd},
+        {"stats", StatCacheStatsObjCmd},
+        {NULL, NULL}
+    };
+
+    return Ns_SubcmdObjv(subcmds, clientData, interp, objc, objv);
+}
+
+/*
+ * Local Variables:
+ * mode: c
+ * c-basic-offset: 4
+ * fill-column: 78
+ * indent-tabs-mode: nil
+ * End:
+ */
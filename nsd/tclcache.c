@@ -30,6 +30,22 @@ typedef struct TclCache {
     size_t      maxSize;  /* Maximum size of the entire cache. */
 } TclCache;
 
+/*
+ * Maximum number of shards of a cache.
+ */
+
+#define CACHE_MAXSHARDS 1024
+
+/*
+ * Eviction policies of caches.
+ */
+
+static Ns_ObjvTable cachePolicies[] = {
+    {"lru",     (unsigned int)NS_CACHE_POLICY_LRU},
+    {"tinylfu", (unsigned int)NS_CACHE_POLICY_TINYLFU},
+    {NULL,      0u}
+};
+
 
 /*
  * Local functions defined in this file
@@ -37,9 +53,9 @@ typedef struct TclCache {
 
 static int CacheAppendObjCmd(ClientData clientData, Tcl_Interp *interp, TCL_SIZE_T objc, Tcl_Obj *const* objv, bool append);
 
-static Ns_Entry *CreateEntry(const NsInterp *itPtr, TclCache *cPtr, const char *key,
+static Ns_Entry *CreateEntry(const NsInterp *itPtr, TclCache *cPtr, Ns_Cache *cache, const char *key,
                              int *newPtr, Ns_Time *timeoutPtr, const Ns_CacheTransactionStack *transactionStackPtr)
-    NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(2) NS_GNUC_NONNULL(3) NS_GNUC_NONNULL(4);
+    NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(2) NS_GNUC_NONNULL(3) NS_GNUC_NONNULL(4) NS_GNUC_NONNULL(5);
 
 static void SetEntry(NsInterp *itPtr, TclCache *cPtr, Ns_Entry *entry, Tcl_Obj *valObj, Ns_Time *expPtr, int cost)
     NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(2) NS_GNUC_NONNULL(3) NS_GNUC_NONNULL(4);
@@ -48,7 +64,7 @@ static bool noGlobChars(const char *pattern)
     NS_GNUC_NONNULL(1) NS_GNUC_PURE;
 
 static TclCache *TclCacheCreate(const char *name, size_t maxEntry, size_t maxSize,
-                                const Ns_Time *timeoutPtr, const Ns_Time *expPtr)
+                                const Ns_Time *timeoutPtr, const Ns_Time *expPtr, int nshards)
     NS_GNUC_NONNULL(1) NS_GNUC_RETURNS_NONNULL;
 
 static Tcl_Obj*GetCacheNames(NsServer *servPtr, bool withUncommittedEntries)
@@ -123,7 +139,8 @@ GetCacheNames(NsServer *servPtr, bool withUncommittedEntries) {
  *
  * TclCacheCreate --
  *
- *      Create a new Tcl cache.
+ *      Create a new Tcl cache, consisting of "nshards" shards, when
+ *      nshards is larger than 1.
  *
  * Results:
  *      TclCache *
@@ -136,14 +153,14 @@ GetCacheNames(NsServer *servPtr, bool withUncommittedEntries) {
 
 static TclCache *
 TclCacheCreate(const char *name, size_t maxEntry, size_t maxSize,
-               const Ns_Time *timeoutPtr, const Ns_Time *expPtr)
+               const Ns_Time *timeoutPtr, const Ns_Time *expPtr, int nshards)
 {
     TclCache *cPtr;
 
     NS_NONNULL_ASSERT(name != NULL);
 
     cPtr = ns_calloc(1u, sizeof(TclCache));
-    cPtr->cache = Ns_CacheCreateSz(name, TCL_STRING_KEYS, maxSize, ns_free);
+    cPtr->cache = Ns_CacheCreateSharded(name, TCL_STRING_KEYS, maxSize, nshards, ns_free);
     cPtr->maxEntry = maxEntry;
     cPtr->maxSize  = maxSize;
     if (timeoutPtr != NULL) {
@@ -177,14 +194,17 @@ int
 NsTclCacheCreateObjCmd(ClientData clientData, Tcl_Interp *interp, TCL_SIZE_T objc, Tcl_Obj *const* objv)
 {
     char        *name = NULL;
-    int         result = TCL_OK;
+    int         result = TCL_OK, nshards = 1, policy = (int)NS_CACHE_POLICY_LRU;
     Tcl_WideInt maxSize = 0, maxEntry = 0;
     Ns_Time    *timeoutPtr = NULL, *expPtr = NULL;
+    Ns_ObjvValueRange shardsRange = {1, CACHE_MAXSHARDS};
 
     Ns_ObjvSpec opts[] = {
         {"-timeout",  Ns_ObjvTime,    &timeoutPtr, NULL},
         {"-expires",  Ns_ObjvTime,    &expPtr,     NULL},
         {"-maxentry", Ns_ObjvMemUnit, &maxEntry,   NULL},
+        {"-shards",   Ns_ObjvInt,     &nshards,    &shardsRange},
+        {"-policy",   Ns_ObjvIndex,   &policy,     cachePolicies},
         {"--",        Ns_ObjvBreak,   NULL,        NULL},
         {NULL, NULL,  NULL, NULL}
     };
@@ -209,7 +229,9 @@ NsTclCacheCreateObjCmd(ClientData clientData, Tcl_Interp *interp, TCL_SIZE_T obj
         Ns_RWLockWrLock(&servPtr->tcl.cachelock);
         hPtr = Tcl_CreateHashEntry(&servPtr->tcl.caches, name, &isNew);
         if (isNew != 0) {
-            TclCache *cPtr = TclCacheCreate(name, (size_t)maxEntry, (size_t)maxSize, timeoutPtr, expPtr);
+            TclCache *cPtr = TclCacheCreate(name, (size_t)maxEntry, (size_t)maxSize, timeoutPtr, expPtr,
+                                            nshards);
+            Ns_CacheSetPolicy(cPtr->cache, (Ns_CachePolicy)policy);
             Tcl_SetHashValue(hPtr, cPtr);
         }
         Ns_RWLockUnlock(&servPtr->tcl.cachelock);
@@ -275,7 +297,7 @@ NsTclCacheExistsObjCmd(ClientData clientData, Tcl_Interp *interp, TCL_SIZE_T obj
  *
  *      Implements "ns_cache_configure".
  *      Configure a Tcl cache. Usage:
- *         ns_cache_configure /cache/ ?-timeout T1? ?-expires T2? ?-maxentry E? ?-maxsize S?
+ *         ns_cache_configure /cache/ ?-timeout T1? ?-expires T2? ?-maxentry E? ?-maxsize S? ?-policy P?
  *
  * Results:
  *      Tcl result.
@@ -292,6 +314,7 @@ NsTclCacheConfigureObjCmd(ClientData clientData, Tcl_Interp *interp, TCL_SIZE_T
     int         result = TCL_OK;
     TCL_SIZE_T  nargs = 0;
     Tcl_WideInt maxSize = 0, maxEntry = 0;
+    int         policy = -1;
     Ns_Time    *timeoutPtr = NULL, *expPtr = NULL;
     TclCache   *cPtr = NULL;
     Ns_ObjvSpec opts[] = {
@@ -299,6 +322,7 @@ NsTclCacheConfigureObjCmd(ClientData clientData, Tcl_Interp *interp, TCL_SIZE_T
         {"-expires",  Ns_ObjvTime,    &expPtr,     NULL},
         {"-maxentry", Ns_ObjvMemUnit, &maxEntry,   NULL},
         {"-maxsize",  Ns_ObjvMemUnit, &maxSize,    NULL},
+        {"-policy",   Ns_ObjvIndex,   &policy,     cachePolicies},
         {NULL, NULL,  NULL, NULL}
     };
     Ns_ObjvSpec args[] = {
@@ -350,6 +374,12 @@ NsTclCacheConfigureObjCmd(ClientData clientData, Tcl_Interp *interp, TCL_SIZE_T
         }
         Ns_RWLockUnlock(&servPtr->tcl.cachelock);
 
+        if (policy != -1) {
+            Ns_CacheLock(cPtr->cache);
+            Ns_CacheSetPolicy(cPtr->cache, (Ns_CachePolicy)policy);
+            Ns_CacheUnlock(cPtr->cache);
+        }
+
     } else /* if (nargs == 0) */ {
         /*
          * Return cache parameter values from the cache.
@@ -485,6 +515,7 @@ NsTclCacheEvalObjCmd(ClientData clientData, Tcl_Interp *interp, TCL_SIZE_T objc,
 
     } else {
         Ns_Entry                 *entry;
+        Ns_Cache                 *cache;
         NsInterp                 *itPtr;
         Ns_CacheTransactionStack *transactionStackPtr;
         int                       isNew;
@@ -495,6 +526,7 @@ NsTclCacheEvalObjCmd(ClientData clientData, Tcl_Interp *interp, TCL_SIZE_T objc,
 
         itPtr = clientData;
         transactionStackPtr = &itPtr->cacheTransactionStack;
+        cache = Ns_CacheShard(cPtr->cache, key);
 
         /*
          * CreateEntry waits for ongoing transactions. If it succeeds, it
@@ -502,7 +534,7 @@ NsTclCacheEvalObjCmd(ClientData clientData, Tcl_Interp *interp, TCL_SIZE_T objc,
          * provided cache value (isNew == 0) ... which might be from the
          * current transaction.
          */
-        entry = CreateEntry(itPtr, cPtr, key, &isNew, timeoutPtr, transactionStackPtr);
+        entry = CreateEntry(itPtr, cPtr, cache, key, &isNew, timeoutPtr, transactionStackPtr);
 
         if (unlikely(entry == NULL)) {
             status = TCL_ERROR;
@@ -514,7 +546,7 @@ NsTclCacheEvalObjCmd(ClientData clientData, Tcl_Interp *interp, TCL_SIZE_T objc,
             /*
              * We have a value for the cache entry, return it.
              */
-            Ns_CacheUnlock(cPtr->cache);
+            Ns_CacheUnlock(cache);
             Tcl_SetObjResult(interp, resultObj);
             status = TCL_OK;
 
@@ -534,7 +566,7 @@ NsTclCacheEvalObjCmd(ClientData clientData, Tcl_Interp *interp, TCL_SIZE_T objc,
             /*
              * Evaluate the cmd to obtain the cache value.
              */
-            Ns_CacheUnlock(cPtr->cache);
+            Ns_CacheUnlock(cache);
 
             Ns_GetTime(&start);
             status = CacheEval(interp, nargs, objc, objv);
@@ -542,7 +574,7 @@ NsTclCacheEvalObjCmd(ClientData clientData, Tcl_Interp *interp, TCL_SIZE_T objc,
 
             (void)Ns_DiffTime(&end, &start, &diff);
 
-            Ns_CacheLock(cPtr->cache);
+            Ns_CacheLock(cache);
             {
                 /*
                  * This is just a sanity check, hopefully transitional code.
@@ -550,7 +582,7 @@ NsTclCacheEvalObjCmd(ClientData clientData, Tcl_Interp *interp, TCL_SIZE_T objc,
                 Ns_Entry *entry2;
                 int isNew2 = 0;
 
-                entry2 = Ns_CacheCreateEntry(cPtr->cache, key, &isNew2);
+                entry2 = Ns_CacheCreateEntry(cache, key, &isNew2);
                 if (isNew2 != 0) {
                     Ns_Log(Warning, "==== cache %s key %s old entry %p"
                            " different from re-fetched entry %p",
@@ -592,8 +624,8 @@ NsTclCacheEvalObjCmd(ClientData clientData, Tcl_Interp *interp, TCL_SIZE_T objc,
                 SetEntry(itPtr, cPtr, entry, resultObj, expPtr,
                          (int)(diff.sec * 1000000 + diff.usec));
             }
-            Ns_CacheBroadcast(cPtr->cache);
-            Ns_CacheUnlock(cPtr->cache);
+            Ns_CacheBroadcast(cache);
+            Ns_CacheUnlock(cache);
         }
     }
     return status;
@@ -646,21 +678,22 @@ NsTclCacheIncrObjCmd(ClientData clientData, Tcl_Interp *interp, TCL_SIZE_T objc,
         result = TCL_ERROR;
     } else {
         Ns_CacheTransactionStack *transactionStackPtr = &itPtr->cacheTransactionStack;
-        Ns_Entry   *entry = CreateEntry(itPtr, cPtr, key, &isNew, timeoutPtr, transactionStackPtr);
+        Ns_Cache   *cache = Ns_CacheShard(cPtr->cache, key);
+        Ns_Entry   *entry = CreateEntry(itPtr, cPtr, cache, key, &isNew, timeoutPtr, transactionStackPtr);
         int         cur = 0;
 
         if (entry == NULL) {
             result = TCL_ERROR;
         } else if ((isNew == 0)
                    && (Tcl_GetInt(interp, Ns_CacheGetValueT(entry, transactionStackPtr), &cur) != TCL_OK)) {
-            Ns_CacheUnlock(cPtr->cache);
+            Ns_CacheUnlock(cache);
             result = TCL_ERROR;
         } else {
             Tcl_Obj *valObj = Tcl_NewIntObj(cur + incr);
 
             SetEntry(itPtr, cPtr, entry, valObj, expPtr, 0);
             Tcl_SetObjResult(interp, valObj);
-            Ns_CacheUnlock(cPtr->cache);
+            Ns_CacheUnlock(cache);
             result = TCL_OK;
         }
     }
@@ -728,12 +761,14 @@ CacheAppendObjCmd(ClientData clientData, Tcl_Interp *interp, TCL_SIZE_T objc, Tc
     } else {
         int                             isNew;
         Ns_Entry                       *entry;
+        Ns_Cache                       *cache;
         const Ns_CacheTransactionStack *transactionStackPtr = &itPtr->cacheTransactionStack;
 
         assert(cPtr != NULL);
         assert(key != NULL);
 
-        entry = CreateEntry(itPtr, cPtr, key, &isNew, timeoutPtr, transactionStackPtr);
+        cache = Ns_CacheShard(cPtr->cache, key);
+        entry = CreateEntry(itPtr, cPtr, cache, key, &isNew, timeoutPtr, transactionStackPtr);
         if (entry == NULL) {
             result = TCL_ERROR;
         } else {
@@ -756,7 +791,7 @@ CacheAppendObjCmd(ClientData clientData, Tcl_Interp *interp, TCL_SIZE_T objc, Tc
                 SetEntry(itPtr, cPtr, entry, valObj, expPtr, 0);
                 Tcl_SetObjResult(interp, valObj);
             }
-            Ns_CacheUnlock(cPtr->cache);
+            Ns_CacheUnlock(cache);
         }
     }
     return result;
@@ -859,6 +894,7 @@ NsTclCacheKeysObjCmd(ClientData clientData, Tcl_Interp *interp, TCL_SIZE_T objc,
 
     } else if (pattern != NULL && (exact != 0 || noGlobChars(pattern))) {
         Tcl_Obj  *listObj = Tcl_NewListObj(0, NULL);
+        Ns_Cache *cache;
 
         /*
          * If the provided pattern (key) contains no glob characters,
@@ -867,12 +903,13 @@ NsTclCacheKeysObjCmd(ClientData clientData, Tcl_Interp *interp, TCL_SIZE_T objc,
          * lookup is sufficient.
          */
         assert(cPtr != NULL);
-        Ns_CacheLock(cPtr->cache);
-        entry = Ns_CacheFindEntryT(cPtr->cache, pattern, transactionStackPtr);
+        cache = Ns_CacheShard(cPtr->cache, pattern);
+        Ns_CacheLock(cache);
+        entry = Ns_CacheFindEntryT(cache, pattern, transactionStackPtr);
         if (entry != NULL && Ns_CacheGetValueT(entry, transactionStackPtr) != NULL) {
             Tcl_ListObjAppendElement(interp, listObj, Tcl_NewStringObj(pattern, TCL_INDEX_NONE));
         }
-        Ns_CacheUnlock(cPtr->cache);
+        Ns_CacheUnlock(cache);
         Tcl_SetObjResult(interp, listObj);
 
     } else {
@@ -1060,14 +1097,16 @@ NsTclCacheGetObjCmd(ClientData clientData, Tcl_Interp *interp, TCL_SIZE_T objc,
 
     } else {
         const Ns_Entry  *entry;
+        Ns_Cache        *cache;
         Tcl_Obj         *resultObj;
         const NsInterp  *itPtr = clientData;
         const Ns_CacheTransactionStack *transactionStackPtr = &itPtr->cacheTransactionStack;
 
         assert(cPtr != NULL);
 
-        Ns_CacheLock(cPtr->cache);
-        entry = Ns_CacheFindEntryT(cPtr->cache, key, transactionStackPtr);
+        cache = Ns_CacheShard(cPtr->cache, key);
+        Ns_CacheLock(cache);
+        entry = Ns_CacheFindEntryT(cache, key, transactionStackPtr);
         if (entry != NULL) {
             void  *value = Ns_CacheGetValueT(entry, transactionStackPtr);
 
@@ -1079,7 +1118,7 @@ NsTclCacheGetObjCmd(ClientData clientData, Tcl_Interp *interp, TCL_SIZE_T objc,
         } else {
             resultObj = NULL;
         }
-        Ns_CacheUnlock(cPtr->cache);
+        Ns_CacheUnlock(cache);
 
         if (unlikely(varNameObj != NULL)) {
             Tcl_SetObjResult(interp, Tcl_NewBooleanObj(resultObj != NULL));
@@ -1213,20 +1252,18 @@ NsTclCacheStatsObjCmd(ClientData clientData, Tcl_Interp *interp, TCL_SIZE_T objc
  */
 
 static Ns_Entry *
-CreateEntry(const NsInterp *itPtr, TclCache *cPtr, const char *key, int *newPtr,
+CreateEntry(const NsInterp *itPtr, TclCache *cPtr, Ns_Cache *cache, const char *key, int *newPtr,
             Ns_Time *timeoutPtr, const Ns_CacheTransactionStack *transactionStackPtr)
 {
-    Ns_Cache *cache;
     Ns_Entry *entry;
     Ns_Time   t;
 
     NS_NONNULL_ASSERT(itPtr != NULL);
     NS_NONNULL_ASSERT(cPtr != NULL);
+    NS_NONNULL_ASSERT(cache != NULL);
     NS_NONNULL_ASSERT(key != NULL);
     NS_NONNULL_ASSERT(newPtr != NULL);
 
-    cache = cPtr->cache;
-
     if (timeoutPtr == NULL
         && (cPtr->timeout.sec > 0 || cPtr->timeout.usec > 0)) {
         timeoutPtr = Ns_AbsoluteTime(&t, &cPtr->timeout);
@@ -1673,6 +1710,207 @@ CacheTransactionFinishPop(NsInterp *itPtr, Tcl_Obj *listObj, bool commit, unsign
 }
 
 
+/*
+ *----------------------------------------------------------------------
+ *
+ * NsTclCacheSnapshot --
+ *
+ *      Append a snapshot section for every cache of the server matching
+ *      the provided pattern. A section contains the configuration of the
+ *      cache (including the number of shards and the eviction policy)
+ *      followed by the committed entries with their expiry times.
+ *
+ * Results:
+ *      Number of saved caches.
+ *
+ * Side effects:
+ *      Extends the Tcl_DString, increments "entriesPtr" by the number of
+ *      saved entries.
+ *
+ *----------------------------------------------------------------------
+ */
+
+size_t
+NsTclCacheSnapshot(NsServer *servPtr, const char *pattern, Tcl_DString *dsPtr, size_t *entriesPtr)
+{
+    const Tcl_HashEntry *hPtr;
+    Tcl_HashSearch       search;
+    size_t               count = 0u;
+
+    NS_NONNULL_ASSERT(servPtr != NULL);
+    NS_NONNULL_ASSERT(pattern != NULL);
+    NS_NONNULL_ASSERT(dsPtr != NULL);
+    NS_NONNULL_ASSERT(entriesPtr != NULL);
+
+    Ns_RWLockRdLock(&servPtr->tcl.cachelock);
+    for (hPtr = Tcl_FirstHashEntry(&servPtr->tcl.caches, &search);
+         hPtr != NULL;
+         hPtr = Tcl_NextHashEntry(&search)
+         ) {
+        const char     *name = Tcl_GetHashKey(&servPtr->tcl.caches, hPtr);
+        const TclCache *cPtr = Tcl_GetHashValue(hPtr);
+        const Ns_Entry *entry;
+        Ns_CacheSearch  cacheSearch;
+        TCL_SIZE_T      offset, countOffset;
+        uint64_t        nentries = 0u;
+        size_t          i;
+
+        if (Tcl_StringMatch(name, pattern) == 0) {
+            continue;
+        }
+        offset = NsSnapshotBeginSection(dsPtr, NS_SNAPSHOT_CACHE, name);
+        NsSnapshotPutInt(dsPtr, (uint64_t)cPtr->maxSize, 8u);
+        NsSnapshotPutInt(dsPtr, (uint64_t)cPtr->maxEntry, 8u);
+        NsSnapshotPutInt(dsPtr, (uint64_t)cPtr->timeout.sec, 8u);
+        NsSnapshotPutInt(dsPtr, (uint64_t)cPtr->timeout.usec, 4u);
+        NsSnapshotPutInt(dsPtr, (uint64_t)cPtr->expires.sec, 8u);
+        NsSnapshotPutInt(dsPtr, (uint64_t)cPtr->expires.usec, 4u);
+        NsSnapshotPutInt(dsPtr, (uint64_t)Ns_CacheGetShards(cPtr->cache), 4u);
+        NsSnapshotPutInt(dsPtr, (uint64_t)Ns_CacheGetPolicy(cPtr->cache), 1u);
+        countOffset = dsPtr->length;
+        NsSnapshotPutInt(dsPtr, 0u, 4u);
+
+        /*
+         * Ns_CacheFirstEntry() returns only committed entries which are
+         * not expired.
+         */
+        Ns_CacheLock(cPtr->cache);
+        for (entry = Ns_CacheFirstEntry(cPtr->cache, &cacheSearch);
+             entry != NULL;
+             entry = Ns_CacheNextEntry(&cacheSearch)
+             ) {
+            const char    *key = Ns_CacheKey(entry);
+            const Ns_Time *expPtr = Ns_CacheGetExpirey(entry);
+
+            NsSnapshotPutBytes(dsPtr, key, strlen(key));
+            NsSnapshotPutBytes(dsPtr, Ns_CacheGetValue(entry), Ns_CacheGetSize(entry));
+            NsSnapshotPutInt(dsPtr, (uint64_t)expPtr->sec, 8u);
+            NsSnapshotPutInt(dsPtr, (uint64_t)expPtr->usec, 4u);
+            nentries++;
+        }
+        Ns_CacheUnlock(cPtr->cache);
+
+        for (i = 0u; i < 4u; i++) {
+            dsPtr->string[countOffset + (TCL_SIZE_T)i] = (char)((nentries >> (8u * i)) & 0xffu);
+        }
+        NsSnapshotEndSection(dsPtr, offset);
+        *entriesPtr += (size_t)nentries;
+        count++;
+    }
+    Ns_RWLockUnlock(&servPtr->tcl.cachelock);
+
+    return count;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * NsTclCacheRestore --
+ *
+ *      Restore a cache from a snapshot section. When the cache does not
+ *      exist, it is created with the saved configuration, number of
+ *      shards and eviction policy. Entries already present in the cache
+ *      and expired entries are skipped.
+ *
+ * Results:
+ *      NS_OK or NS_ERROR, when the section is invalid.
+ *
+ * Side effects:
+ *      Adds entries to the cache, increments "entriesPtr" by the number of
+ *      restored entries.
+ *
+ *----------------------------------------------------------------------
+ */
+
+Ns_ReturnCode
+NsTclCacheRestore(NsServer *servPtr, const char *name, NsSnapshotReader *readerPtr, size_t *entriesPtr)
+{
+    Tcl_HashEntry *hPtr;
+    TclCache      *cPtr;
+    Ns_Time        timeout, expires, now;
+    size_t         maxSize, maxEntry, nentries, i;
+    int            isNew, nshards;
+    Ns_CachePolicy policy;
+    Tcl_DString    key;
+
+    NS_NONNULL_ASSERT(servPtr != NULL);
+    NS_NONNULL_ASSERT(name != NULL);
+    NS_NONNULL_ASSERT(readerPtr != NULL);
+    NS_NONNULL_ASSERT(entriesPtr != NULL);
+
+    maxSize = (size_t)NsSnapshotGetInt(readerPtr, 8u);
+    maxEntry = (size_t)NsSnapshotGetInt(readerPtr, 8u);
+    timeout.sec = (time_t)NsSnapshotGetInt(readerPtr, 8u);
+    timeout.usec = (long)NsSnapshotGetInt(readerPtr, 4u);
+    expires.sec = (time_t)NsSnapshotGetInt(readerPtr, 8u);
+    expires.usec = (long)NsSnapshotGetInt(readerPtr, 4u);
+    nshards = (int)NsSnapshotGetInt(readerPtr, 4u);
+    policy = (Ns_CachePolicy)NsSnapshotGetInt(readerPtr, 1u);
+    nentries = (size_t)NsSnapshotGetInt(readerPtr, 4u);
+    if (readerPtr->error
+        || nshards < 1 || nshards > CACHE_MAXSHARDS
+        || (policy != NS_CACHE_POLICY_LRU && policy != NS_CACHE_POLICY_TINYLFU)
+        ) {
+        return NS_ERROR;
+    }
+
+    Ns_RWLockWrLock(&servPtr->tcl.cachelock);
+    hPtr = Tcl_CreateHashEntry(&servPtr->tcl.caches, name, &isNew);
+    if (isNew != 0) {
+        cPtr = TclCacheCreate(name, maxEntry, maxSize, &timeout, &expires, nshards);
+        Ns_CacheSetPolicy(cPtr->cache, policy);
+        Tcl_SetHashValue(hPtr, cPtr);
+    } else {
+        cPtr = Tcl_GetHashValue(hPtr);
+    }
+    Ns_RWLockUnlock(&servPtr->tcl.cachelock);
+
+    Ns_GetTime(&now);
+    Tcl_DStringInit(&key);
+    Ns_CacheLock(cPtr->cache);
+    for (i = 0u; i < nentries; i++) {
+        const char *keyBytes, *valueBytes;
+        size_t      keyLength, valueLength;
+        Ns_Time     expiry;
+        Ns_Entry   *entry;
+
+        keyBytes = NsSnapshotGetBytes(readerPtr, &keyLength);
+        valueBytes = NsSnapshotGetBytes(readerPtr, &valueLength);
+        expiry.sec = (time_t)NsSnapshotGetInt(readerPtr, 8u);
+        expiry.usec = (long)NsSnapshotGetInt(readerPtr, 4u);
+        if (readerPtr->error) {
+            break;
+        }
+
+        if ((expiry.sec > 0 || expiry.usec > 0) && Ns_DiffTime(&expiry, &now, NULL) <= 0) {
+            continue;
+        }
+        if (cPtr->maxEntry > 0u && valueLength > cPtr->maxEntry) {
+            continue;
+        }
+        Tcl_DStringSetLength(&key, 0);
+        Tcl_DStringAppend(&key, keyBytes, (TCL_SIZE_T)keyLength);
+        entry = Ns_CacheCreateEntry(cPtr->cache, key.string, &isNew);
+        if (isNew != 0) {
+            char *value = ns_malloc(valueLength + 1u);
+
+            memcpy(value, valueBytes, valueLength);
+            value[valueLength] = '\0';
+            (void) Ns_CacheSetValueExpires(entry, value, valueLength,
+                                           (expiry.sec > 0 || expiry.usec > 0) ? &expiry : NULL,
+                                           0, cPtr->maxSize, 0u);
+            *entriesPtr += 1u;
+        }
+    }
+    Ns_CacheBroadcast(cPtr->cache);
+    Ns_CacheUnlock(cPtr->cache);
+    Tcl_DStringFree(&key);
+
+    return readerPtr->error ? NS_ERROR : NS_OK;
+}
+
+
 
 /*
  * Local Variables:
@@ -58,6 +58,7 @@ static const Cmd basicCmds[] = {
 #endif
     {"ns_certctl",               NsTclCertCtlObjCmd},
     {"ns_charsets",              NsTclCharsetsObjCmd},
+    {"ns_compress",              NsTclCompressObjCmd},
     {"ns_config",                NsTclConfigObjCmd},
     {"ns_configsection",         NsTclConfigSectionObjCmd},
     {"ns_configsections",        NsTclConfigSectionsObjCmd},
@@ -148,6 +149,7 @@ static const Cmd basicCmds[] = {
     {"ns_socknread",             NsTclSockNReadObjCmd},
     {"ns_sockopen",              NsTclSockOpenObjCmd},
     {"ns_sockselect",            NsTclSelectObjCmd},
+    {"ns_statcache",             NsTclStatCacheObjCmd},
     {"ns_strcoll",               NsTclStrcollObjCmd},
     {"ns_striphtml",             NsTclStripHtmlObjCmd},
     {"ns_symlink",               NsTclSymlinkObjCmd},
@@ -245,6 +247,7 @@ static const Cmd servCmds[] = {
     {"ns_limits_list",           NsTclListLimitsObjCmd},
     {"ns_limits_register",       NsTclRegisterLimitsObjCmd},
     {"ns_limits_set",            NsTclSetLimitsObjCmd},
+    {"ns_microcache",            NsTclMicroCacheObjCmd},
     {"ns_moduleload",            NsTclModuleLoadObjCmd},
     {"ns_mutex",                 NsTclMutexObjCmd},
     {"ns_normalizepath",         NsTclNormalizePathObjCmd},
@@ -284,6 +287,7 @@ static const Cmd servCmds[] = {
     {"ns_setcookie",             NsTclSetCookieObjCmd},
     {"ns_setgroup",              NsTclSetGroupObjCmd},
     {"ns_setuser",               NsTclSetUserObjCmd},
+    {"ns_snapshot",              NsTclSnapshotObjCmd},
 #ifdef NS_WITH_DEPRECATED
     {"ns_startcontent",          NsTclStartContentObjCmd},
 #endif
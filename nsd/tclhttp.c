@@ -494,7 +494,8 @@ DStringAppendHttpFlags(Tcl_DString *dsPtr, unsigned int flags)
         { NS_HTTP_STREAMING,          "STREAMING" },
         { NS_HTTP_CONNCHAN,           "CONNCHAN" },
         { NS_HTTP_HEADERS_PENDING,    "HDR_PENDING" },
-        { NS_HTTP_OUTPUT_ERROR,       "OUTPUT_ERROR" }
+        { NS_HTTP_OUTPUT_ERROR,       "OUTPUT_ERROR" },
+        { NS_HTTP_FLAG_ZSTD_ENCODING, "ZSTD" }
     };
 
     NS_NONNULL_ASSERT(dsPtr != NULL);
@@ -3396,11 +3397,11 @@ HttpGetResult(
          * We have a choice between binary and string objects.
          * Unfortunately, this is mostly whole lotta guess-work...
          */
-        if (unlikely((httpPtr->flags & NS_HTTP_FLAG_GZIP_ENCODING) != 0u)) {
+        if (unlikely((httpPtr->flags & (NS_HTTP_FLAG_GZIP_ENCODING|NS_HTTP_FLAG_ZSTD_ENCODING)) != 0u)) {
             if (unlikely((httpPtr->flags & NS_HTTP_FLAG_DECOMPRESS) == 0u)) {
 
                 /*
-                 * Gzipped but not inflated content
+                 * Compressed but not inflated content
                  * is automatically of a binary-type.
                  * This is pretty straight-forward.
                  */
@@ -3889,6 +3890,16 @@ HttpCheckSpool(
                 Ns_Log(Ns_LogTaskDebug, "HttpCheckSpool: %s: %s",
                        contentEncodingHeader, header);
             }
+#ifdef HAVE_ZSTD
+        } else if (header != NULL && Ns_Match(header, "zstd") != NULL) {
+            httpPtr->flags |= NS_HTTP_FLAG_ZSTD_ENCODING;
+            if ((httpPtr->flags & NS_HTTP_FLAG_DECOMPRESS) != 0u) {
+                httpPtr->compress = ns_calloc(1u, sizeof(Ns_CompressStream));
+                (void) Ns_ZstdDecompressInit(httpPtr->compress);
+                Ns_Log(Ns_LogTaskDebug, "HttpCheckSpool: %s: %s",
+                       contentEncodingHeader, header);
+            }
+#endif
         }
 
         Ns_MutexLock(&httpPtr->lock);
@@ -4549,7 +4560,11 @@ HttpConnect(
 #ifdef HAVE_ZLIB_H
     if (likely((httpPtr->flags & NS_HTTP_FLAG_DECOMPRESS) != 0u)) {
         if (hdrPtr == NULL || Ns_SetIFind(hdrPtr, acceptEncodingHeader) == -1) {
-            const char *acceptEncodings = "gzip, deflate";
+#ifdef HAVE_ZSTD
+            static const char acceptEncodings[] = "gzip, deflate, zstd";
+#else
+            static const char acceptEncodings[] = "gzip, deflate";
+#endif
 
             if (hdrPtr == NULL) {
                 hdrPtr = Ns_SetCreate(NULL);
@@ -4557,7 +4572,7 @@ HttpConnect(
             }
 
             Ns_SetPutSz(hdrPtr, acceptEncodingHeader, acceptEncodingHeaderLength,
-                        acceptEncodings, 13);
+                        acceptEncodings, (TCL_SIZE_T)(sizeof(acceptEncodings) - 1u));
         }
     }
 #endif
@@ -5477,7 +5492,7 @@ HttpAppendBuffer(
            size, httpPtr->flags);
 
     if (unlikely((httpPtr->flags & NS_HTTP_FLAG_DECOMPRESS) == 0u)
-        || likely((httpPtr->flags & NS_HTTP_FLAG_GZIP_ENCODING) == 0u)) {
+        || likely((httpPtr->flags & (NS_HTTP_FLAG_GZIP_ENCODING|NS_HTTP_FLAG_ZSTD_ENCODING)) == 0u)) {
 
         /*
          * Output raw content
@@ -5489,17 +5504,24 @@ HttpAppendBuffer(
 
     } else {
         char out[CHUNK_SIZE];
+        bool zstd = ((httpPtr->flags & NS_HTTP_FLAG_ZSTD_ENCODING) != 0u);
 
         out[0] = '\0';
 
         /*
          * Decompress content
          */
-        (void) Ns_InflateBufferInit(httpPtr->compress, buffer, size);
+        if (zstd) {
+            (void) Ns_ZstdDecompressBufferInit(httpPtr->compress, buffer, size);
+        } else {
+            (void) Ns_InflateBufferInit(httpPtr->compress, buffer, size);
+        }
         do {
             size_t ul = 0u;
 
-            result = Ns_InflateBuffer(httpPtr->compress, out, CHUNK_SIZE, &ul);
+            result = zstd
+                ? Ns_ZstdDecompressBuffer(httpPtr->compress, out, CHUNK_SIZE, &ul)
+                : Ns_InflateBuffer(httpPtr->compress, out, CHUNK_SIZE, &ul);
             if (HttpAppendRawBuffer(httpPtr, out, ul) == TCL_OK) {
                 bodySize += ul;
             } else {
@@ -5748,7 +5770,11 @@ HttpCleanupPerRequestData(
         httpPtr->spoolChan = NULL;
     }
     if (httpPtr->compress != NULL) {
-        (void)Ns_InflateEnd(httpPtr->compress);
+        if ((httpPtr->flags & NS_HTTP_FLAG_ZSTD_ENCODING) != 0u) {
+            (void)Ns_ZstdDecompressEnd(httpPtr->compress);
+        } else {
+            (void)Ns_InflateEnd(httpPtr->compress);
+        }
         ns_free((void *)httpPtr->compress);
         httpPtr->compress = NULL;
     }
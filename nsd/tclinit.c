@@ -309,8 +309,34 @@ ConfigServerTcl(const char *server)
 
         servPtr->nsv.rwlocks = Ns_ConfigBool(section, "nsvrwlocks", NS_TRUE);
         servPtr->nsv.nbuckets = Ns_ConfigIntRange(section, "nsvbuckets", 8, 1, INT_MAX);
+        p = Ns_ConfigGetValue(section, "nsvreadmostly");
+        if (p != NULL
+            && Tcl_SplitList(NULL, p, &servPtr->nsv.nreadmostly, &servPtr->nsv.readmostly) != TCL_OK) {
+            Ns_Log(Error, "config: nsvreadmostly is not a list: %s", p);
+        }
+        p = Ns_ConfigGetValue(section, "nsvcounters");
+        if (p != NULL
+            && Tcl_SplitList(NULL, p, &servPtr->nsv.ncounters, &servPtr->nsv.counters) != TCL_OK) {
+            Ns_Log(Error, "config: nsvcounters is not a list: %s", p);
+        }
+#ifndef NS_HAVE_ATOMIC_BUILTINS
+        if (servPtr->nsv.nreadmostly > 0 || servPtr->nsv.ncounters > 0) {
+            Ns_Log(Warning, "config: nsvreadmostly and nsvcounters require atomic operations, ignored");
+            servPtr->nsv.nreadmostly = 0;
+            servPtr->nsv.ncounters = 0;
+        }
+#endif
         servPtr->nsv.buckets = NsTclCreateBuckets(servPtr, servPtr->nsv.nbuckets);
 
+        /*
+         * Snapshot of nsv arrays and caches restored at startup.
+         */
+        if (Ns_ConfigGetValue(section, "snapshotfile") != NULL) {
+            servPtr->tcl.snapshotfile = Ns_ConfigFilename(section, "snapshotfile", 12, nsconf.home, "",
+                                                          NS_TRUE, NS_FALSE);
+        }
+        servPtr->tcl.snapshotthreads = Ns_ConfigIntRange(section, "snapshotthreads", 4, 1, 64);
+
         /*
          * Initialize the list of connection headers to log for Tcl errors.
          */
@@ -1762,7 +1788,8 @@ NsTclRunAtClose(NsInterp *itPtr)
  *      None.
  *
  * Side effects:
- *      Depends on init script (normally init.tcl).
+ *      Depends on init script (normally init.tcl). Restores the
+ *      configured snapshot of nsv arrays and caches.
  *
  *----------------------------------------------------------------------
  */
@@ -1788,6 +1815,20 @@ NsTclInitServer(const char *server)
             Ns_Fatal("tclinit: invalid init file: %s", Tcl_GetString(servPtr->tcl.initfile));
         }
         Ns_TclDeAllocateInterp(interp);
+
+        /*
+         * Restore the snapshot after the init script, such that caches
+         * created there keep their configuration, but before the drivers
+         * start to accept requests.
+         */
+        if (servPtr->tcl.snapshotfile != NULL) {
+            if (access(servPtr->tcl.snapshotfile, R_OK) != 0) {
+                Ns_Log(Notice, "tclinit: no snapshot file %s", servPtr->tcl.snapshotfile);
+            } else {
+                (void) NsSnapshotLoad(servPtr, servPtr->tcl.snapshotfile,
+                                      servPtr->tcl.snapshotthreads, NULL);
+            }
+        }
     }
     Ns_ThreadSetName("-main:%s-", server);
 }
@@ -13,10 +13,106 @@
  * tclvar.c --
  *
  *      Tcl shared variables.
+ *
+ *      Arrays matching the "nsvreadmostly" patterns of a server keep
+ *      additionally an immutable snapshot of their content, which is
+ *      replaced by the writers when releasing the write lock. Readers
+ *      access the snapshots via atomic pointers without locking. Replaced
+ *      snapshots are freed via epoch-based reclamation, when no reader can
+ *      access them anymore.
+ *
+ *      In arrays matching the "nsvcounters" patterns, keys incremented via
+ *      nsv_incr become counters kept in atomic 64-bit slots. Increments and
+ *      reads of existing counters do not lock. Before other operations on
+ *      such arrays, the current counter values are written to the table of
+ *      variables under the write lock, and changes of these values are
+ *      taken over when the lock is released.
  */
 
 #include "nsd.h"
 
+#ifdef NS_HAVE_ATOMIC_BUILTINS
+# define SnapshotLoad(ptr, order)         __atomic_load_n((ptr), (order))
+# define SnapshotStore(ptr, value, order) __atomic_store_n((ptr), (value), (order))
+# define SnapshotFetchAdd(ptr, value)     __atomic_fetch_add((ptr), (value), __ATOMIC_SEQ_CST)
+# define SnapshotFence()                  __atomic_thread_fence(__ATOMIC_SEQ_CST)
+# define SnapshotAddFetch(ptr, value)     __atomic_add_fetch((ptr), (value), __ATOMIC_SEQ_CST)
+#else
+/*
+ * Without atomic operations, read-mostly and counter arrays are disabled at
+ * configuration time (see tclinit.c), so the following are never used
+ * concurrently.
+ */
+# define SnapshotLoad(ptr, order)         (*(ptr))
+# define SnapshotStore(ptr, value, order) (*(ptr) = (value))
+# define SnapshotFetchAdd(ptr, value)     ((*(ptr))++)
+# define SnapshotFence()
+# define SnapshotAddFetch(ptr, value)     (*(ptr) += (value))
+#endif
+
+/*
+ * Results of the lock-free lookup in snapshots.
+ */
+
+#define SNAPSHOT_NONE     (-1)   /* Not a read-mostly array, lookup has to lock. */
+#define SNAPSHOT_NOTFOUND   0
+#define SNAPSHOT_FOUND      1
+
+#define NsvSnapshots(servPtr) ((servPtr)->nsv.nreadmostly > 0 || (servPtr)->nsv.ncounters > 0)
+
+/*
+ * The following structure defines an immutable hash table with string
+ * values, which is shared between threads without locking.
+ */
+
+typedef struct Snapshot {
+    Tcl_HashTable table;      /* Keys mapped to strings or Array pointers. */
+    bool          ownValues;  /* Values are strings owned by the snapshot. */
+} Snapshot;
+
+/*
+ * The following structure defines a counter, padded to and allocated at the
+ * start of a cache line (see CounterAlloc()) to avoid false sharing between
+ * counters incremented by different threads.
+ */
+
+#define COUNTER_ALIGNMENT 64
+
+typedef struct Counter {
+    Tcl_WideInt     value;    /* Current value, accessed atomically. */
+    Tcl_WideInt     synced;   /* Value last stored in the table of variables. */
+    struct Counter *nextPtr;  /* Used for retiring removed counters. */
+    char            pad[COUNTER_ALIGNMENT - 2 * sizeof(Tcl_WideInt) - sizeof(void *)];
+} Counter;
+
+/*
+ * The following structures implement epoch-based reclamation of retired
+ * snapshots and arrays. Every thread reading snapshots registers a Reader
+ * with the epoch in which it started the read operation.
+ */
+
+typedef struct Reader {
+    struct Reader *nextPtr;
+    unsigned long  active;    /* Epoch of the running read operation or 0. */
+    bool           inUse;     /* Reader is assigned to a thread. */
+} Reader;
+
+typedef struct Retired {
+    struct Retired *nextPtr;
+    void           *data;
+    Ns_FreeProc    *freeProc;
+    unsigned long   epoch;    /* Epoch, in which the data was retired. */
+} Retired;
+
+static struct {
+    Ns_Mutex      lock;       /* Protects the lists of readers and retired data. */
+    Ns_Tls        tls;
+    Reader       *readers;
+    Retired      *retired;
+    unsigned long epoch;
+    bool          initialized;
+} ebr;
+
 /*
  * The following structure defines a collection of arrays.
  * Only the arrays within a given bucket share a lock,
@@ -28,6 +124,7 @@ typedef struct Bucket {
     Ns_Mutex        mlock;
     Tcl_HashTable   arrays;
     const NsServer *servPtr;
+    Snapshot       *published;  /* Published read-mostly and counter arrays. */
 } Bucket;
 
 /*
@@ -40,6 +137,13 @@ typedef struct Array {
     Tcl_HashEntry *entryPtr;  /* Entry in bucket array table. */
     Tcl_HashTable  vars;      /* Table of variables. */
     long           locks;     /* Number of array locks */
+    Snapshot      *snapshot;  /* Published content of a read-mostly array. */
+    Tcl_HashTable  counters;  /* Counters of a counter array. */
+    Snapshot      *published; /* Published counters of a counter array. */
+    bool           readmostly;
+    bool           counting;
+    bool           countersChanged;
+    bool           writeLocked;
 } Array;
 
 
@@ -65,9 +169,70 @@ static void Flush(Array *arrayPtr)
 static Array *LockArray(const NsServer *servPtr, const char *arrayName, bool create, NS_RW rw)
     NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(2);
 
-static void UnlockArray(const Array *arrayPtr)
+static void UnlockArray(Array *arrayPtr)
+    NS_GNUC_NONNULL(1);
+
+static void DeleteArray(Array *arrayPtr)
+    NS_GNUC_NONNULL(1);
+
+static void FreeArray(Array *arrayPtr)
+    NS_GNUC_NONNULL(1);
+
+static bool MatchArray(const char **patterns, TCL_SIZE_T npatterns, const char *arrayName)
+    NS_GNUC_NONNULL(3);
+
+static void WriteLocked(Array *arrayPtr)
+    NS_GNUC_NONNULL(1);
+
+static void SyncCounters(Array *arrayPtr)
+    NS_GNUC_NONNULL(1);
+
+static Counter *ReconcileCounters(Array *arrayPtr)
+    NS_GNUC_NONNULL(1);
+
+static Counter *CounterAlloc(void)
+    NS_GNUC_RETURNS_NONNULL;
+static void CounterFree(void *arg)
+    NS_GNUC_NONNULL(1);
+
+static void PublishCounters(Array *arrayPtr)
+    NS_GNUC_NONNULL(1);
+
+static Reader *ReaderEnter(void);
+static void ReaderExit(Reader *readerPtr)
+    NS_GNUC_NONNULL(1);
+
+static Bucket *GetBucketFromObj(Tcl_Interp *interp, Tcl_Obj *arrayObj)
+    NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(2);
+
+static bool CounterIncr(Bucket *bucketPtr, const char *arrayName, const char *keyString,
+                        int incr, Tcl_WideInt *valuePtr)
+    NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(2) NS_GNUC_NONNULL(3) NS_GNUC_NONNULL(5);
+
+static Snapshot *SnapshotCreate(bool ownValues);
+static void SnapshotFree(void *arg)
+    NS_GNUC_NONNULL(1);
+
+static void PublishArray(Array *arrayPtr)
+    NS_GNUC_NONNULL(1);
+
+static void PublishBucket(Bucket *bucketPtr)
     NS_GNUC_NONNULL(1);
 
+static void Retire(void *data, Ns_FreeProc *freeProc)
+    NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(2);
+
+static Ns_FreeProc FreeRetiredArray;
+static Ns_TlsCleanup FreeReader;
+
+static int SnapshotGet(Bucket *bucketPtr, const char *arrayName, const char *keyString,
+                       Tcl_Obj **objPtr, Tcl_DString *dsPtr)
+    NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(2) NS_GNUC_NONNULL(3);
+
+static int SnapshotGetObj(Tcl_Interp *interp, Tcl_Obj *arrayObj, const char *keyString,
+                          Tcl_Obj **objPtr)
+    NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(2) NS_GNUC_NONNULL(3);
+
 static Array *LockArrayObj(Tcl_Interp *interp, Tcl_Obj *arrayObj, bool create, NS_RW rw)
     NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(2);
 
@@ -77,6 +242,9 @@ static Array *GetArray(Bucket *bucketPtr, const char *arrayName, bool create)
 static unsigned int BucketIndex(const char *arrayName)
     NS_GNUC_NONNULL(1) NS_GNUC_PURE;
 
+static Bucket *GetBucket(const NsServer *servPtr, const char *arrayName)
+    NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(2);
+
 static int GetArrayAndKey(Tcl_Interp *interp, Tcl_Obj *arrayObj, const char *keyString,
                           NS_RW rw, Array  **arrayPtrPtr, Tcl_Obj **objPtr)
     NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(2) NS_GNUC_NONNULL(3) NS_GNUC_NONNULL(5) NS_GNUC_NONNULL(6);
@@ -120,6 +288,7 @@ NsTclCreateBuckets(const NsServer *servPtr, int nbuckets)
         buckets[nbuckets].rwlock = NULL;
         buckets[nbuckets].mlock = NULL;
         buckets[nbuckets].servPtr = servPtr;
+        buckets[nbuckets].published = NULL;
         if (servPtr->nsv.rwlocks) {
             Ns_RWLockInit(&buckets[nbuckets].rwlock);
             Ns_RWLockSetName2(&buckets[nbuckets].rwlock, buf, servPtr->server);
@@ -129,6 +298,14 @@ NsTclCreateBuckets(const NsServer *servPtr, int nbuckets)
         }
     }
 
+    if (NsvSnapshots(servPtr) && !ebr.initialized) {
+        Ns_MutexInit(&ebr.lock);
+        Ns_MutexSetName(&ebr.lock, "nsv:snapshots");
+        Ns_TlsAlloc(&ebr.tls, FreeReader);
+        ebr.epoch = 1u;
+        ebr.initialized = NS_TRUE;
+    }
+
     return buckets;
 }
 
@@ -160,20 +337,25 @@ NsTclNsvGetObjCmd(ClientData UNUSED(clientData), Tcl_Interp *interp,
         result = TCL_ERROR;
 
     } else {
-        Array *arrayPtr = LockArrayObj(interp, objv[1], NS_FALSE, NS_READ);
+        Tcl_Obj    *resultObj = NULL;
+        const char *keyString = Tcl_GetString(objv[2]);
 
-        if (unlikely(arrayPtr == NULL)) {
-            result = TCL_ERROR;
+        if (SnapshotGetObj(interp, objv[1], keyString, &resultObj) == SNAPSHOT_NONE) {
+            Array *arrayPtr = LockArrayObj(interp, objv[1], NS_FALSE, NS_READ);
 
-        } else {
-            Tcl_Obj             *resultObj;
-            const Tcl_HashEntry *hPtr;
-            const char          *keyString = Tcl_GetString(objv[2]);
+            if (unlikely(arrayPtr == NULL)) {
+                result = TCL_ERROR;
 
-            hPtr = Tcl_CreateHashEntry(&arrayPtr->vars, keyString, NULL);
-            resultObj = likely(hPtr != NULL) ? Tcl_NewStringObj(Tcl_GetHashValue(hPtr), TCL_INDEX_NONE) : NULL;
-            UnlockArray(arrayPtr);
+            } else {
+                const Tcl_HashEntry *hPtr;
+
+                hPtr = Tcl_CreateHashEntry(&arrayPtr->vars, keyString, NULL);
+                resultObj = likely(hPtr != NULL) ? Tcl_NewStringObj(Tcl_GetHashValue(hPtr), TCL_INDEX_NONE) : NULL;
+                UnlockArray(arrayPtr);
+            }
+        }
 
+        if (result == TCL_OK) {
             if (objc == 3) {
                 if (likely(resultObj != NULL)) {
                     Tcl_SetObjResult(interp, resultObj);
@@ -222,15 +404,21 @@ NsTclNsvExistsObjCmd(ClientData UNUSED(clientData), Tcl_Interp *interp,
         Tcl_WrongNumArgs(interp, 1, objv, "/array/ /key/");
         result = TCL_ERROR;
     } else {
-        bool   exists = NS_FALSE;
-        Array *arrayPtr = LockArrayObj(interp, objv[1], NS_FALSE, NS_READ);
+        bool        exists = NS_FALSE;
+        const char *keyString = Tcl_GetString(objv[2]);
+        int         status = SnapshotGetObj(interp, objv[1], keyString, NULL);
 
-        if (likely(arrayPtr != NULL)) {
-            if (Tcl_CreateHashEntry(&arrayPtr->vars,
-                                    Tcl_GetString(objv[2]), NULL) != NULL) {
-                exists = NS_TRUE;
+        if (status == SNAPSHOT_NONE) {
+            Array *arrayPtr = LockArrayObj(interp, objv[1], NS_FALSE, NS_READ);
+
+            if (likely(arrayPtr != NULL)) {
+                if (Tcl_CreateHashEntry(&arrayPtr->vars, keyString, NULL) != NULL) {
+                    exists = NS_TRUE;
+                }
+                UnlockArray(arrayPtr);
             }
-            UnlockArray(arrayPtr);
+        } else {
+            exists = (status == SNAPSHOT_FOUND);
         }
         Tcl_SetObjResult(interp, Tcl_NewBooleanObj(exists));
         result = TCL_OK;
@@ -435,11 +623,19 @@ NsTclNsvIncrObjCmd(ClientData UNUSED(clientData), Tcl_Interp *interp,
 
     } else {
         Tcl_WideInt  current;
-        Array       *arrayPtr = LockArrayObj(interp, objv[1], NS_TRUE, NS_WRITE);
+        const char  *keyString = Tcl_GetString(objv[2]);
+        Bucket      *bucketPtr = GetBucketFromObj(interp, objv[1]);
 
-        assert(arrayPtr != NULL);
-        result = IncrVar(arrayPtr, Tcl_GetString(objv[2]), count, &current);
-        UnlockArray(arrayPtr);
+        if (bucketPtr != NULL
+            && CounterIncr(bucketPtr, Tcl_GetString(objv[1]), keyString, count, &current)) {
+            result = TCL_OK;
+        } else {
+            Array *arrayPtr = LockArrayObj(interp, objv[1], NS_TRUE, NS_WRITE);
+
+            assert(arrayPtr != NULL);
+            result = IncrVar(arrayPtr, keyString, count, &current);
+            UnlockArray(arrayPtr);
+        }
 
         if (likely(result == TCL_OK)) {
             Tcl_SetObjResult(interp, Tcl_NewWideIntObj(current));
@@ -627,8 +823,7 @@ NsTclNsvUnsetObjCmd(ClientData UNUSED(clientData), Tcl_Interp *interp,
                  * Delete the hash-table of this array and the entry in the
                  * table of array names.
                  */
-                Tcl_DeleteHashTable(&arrayPtr->vars);
-                Tcl_DeleteHashEntry(arrayPtr->entryPtr);
+                DeleteArray(arrayPtr);
             }
             UnlockArray(arrayPtr);
 
@@ -637,7 +832,7 @@ NsTclNsvUnsetObjCmd(ClientData UNUSED(clientData), Tcl_Interp *interp,
                  * Free the actual array data structure and invalidate the
                  * Tcl_Obj.
                  */
-                ns_free(arrayPtr);
+                FreeArray(arrayPtr);
                 Ns_TclSetTwoPtrValue(arrayObj, NULL, NULL, NULL);
             }
         }
@@ -1434,14 +1629,23 @@ Ns_VarGet(const char *server, const char *array, const char *keyString, Tcl_DStr
 
     servPtr = NsGetServer(server);
     if (likely(servPtr != NULL)) {
-        Array *arrayPtr = LockArray(servPtr, array, NS_FALSE, NS_READ);
-        if (likely(arrayPtr != NULL)) {
-            const Tcl_HashEntry *hPtr = Tcl_CreateHashEntry(&arrayPtr->vars, keyString, NULL);
-            if (likely(hPtr != NULL)) {
-                Tcl_DStringAppend(dsPtr, Tcl_GetHashValue(hPtr), TCL_INDEX_NONE);
-                status = NS_OK;
+        int found = SNAPSHOT_NONE;
+
+        if (NsvSnapshots(servPtr)) {
+            found = SnapshotGet(GetBucket(servPtr, array), array, keyString, NULL, dsPtr);
+        }
+        if (found == SNAPSHOT_NONE) {
+            Array *arrayPtr = LockArray(servPtr, array, NS_FALSE, NS_READ);
+            if (likely(arrayPtr != NULL)) {
+                const Tcl_HashEntry *hPtr = Tcl_CreateHashEntry(&arrayPtr->vars, keyString, NULL);
+                if (likely(hPtr != NULL)) {
+                    Tcl_DStringAppend(dsPtr, Tcl_GetHashValue(hPtr), TCL_INDEX_NONE);
+                    status = NS_OK;
+                }
+                UnlockArray(arrayPtr);
             }
-            UnlockArray(arrayPtr);
+        } else if (found == SNAPSHOT_FOUND) {
+            status = NS_OK;
         }
     }
     return status;
@@ -1476,13 +1680,22 @@ Ns_VarExists(const char *server, const char *array, const char *keyString)
 
     servPtr = NsGetServer(server);
     if (likely(servPtr != NULL)) {
-        Array *arrayPtr = LockArray(servPtr, array, NS_FALSE, NS_READ);
+        int found = SNAPSHOT_NONE;
 
-        if (likely(arrayPtr != NULL)) {
-            if (Tcl_CreateHashEntry(&arrayPtr->vars, keyString, NULL) != NULL) {
-                exists = NS_TRUE;
+        if (NsvSnapshots(servPtr)) {
+            found = SnapshotGet(GetBucket(servPtr, array), array, keyString, NULL, NULL);
+        }
+        if (found == SNAPSHOT_NONE) {
+            Array *arrayPtr = LockArray(servPtr, array, NS_FALSE, NS_READ);
+
+            if (likely(arrayPtr != NULL)) {
+                if (Tcl_CreateHashEntry(&arrayPtr->vars, keyString, NULL) != NULL) {
+                    exists = NS_TRUE;
+                }
+                UnlockArray(arrayPtr);
             }
-            UnlockArray(arrayPtr);
+        } else {
+            exists = (found == SNAPSHOT_FOUND);
         }
     }
     return exists;
@@ -1558,7 +1771,9 @@ Ns_VarIncr(const char *server, const char *array, const char *keyString, int inc
     NS_NONNULL_ASSERT(keyString != NULL);
 
     servPtr = NsGetServer(server);
-    if (likely(servPtr != NULL)) {
+    if (likely(servPtr != NULL)
+        && (servPtr->nsv.ncounters == 0
+            || !CounterIncr(GetBucket(servPtr, array), array, keyString, incr, &counter))) {
         Array *arrayPtr = LockArray(servPtr, array, NS_TRUE, NS_WRITE);
 
         if (likely(arrayPtr != NULL)) {
@@ -1664,15 +1879,181 @@ Ns_VarUnset(const char *server, const char *array, const char *keyString)
                 /* Error, no such key. */
             } else if (status == NS_OK && keyString == NULL) {
                 /* Finish deleting the entire array, same as in NsTclNsvUnsetObjCmd(). */
-                Tcl_DeleteHashTable(&arrayPtr->vars);
-                Tcl_DeleteHashEntry(arrayPtr->entryPtr);
+                DeleteArray(arrayPtr);
+                UnlockArray(arrayPtr);
+                FreeArray(arrayPtr);
+            } else {
+                UnlockArray(arrayPtr);
             }
-            UnlockArray(arrayPtr);
         }
     }
     return status;
 }
 
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * NsTclNsvSnapshot --
+ *
+ *      Append a snapshot section for every nsv array of the server
+ *      matching the provided pattern. The names of the arrays are
+ *      collected first, every array is then locked on its own while
+ *      its content is saved.
+ *
+ * Results:
+ *      Number of saved arrays.
+ *
+ * Side effects:
+ *      Extends the Tcl_DString, increments "entriesPtr" by the number of
+ *      saved entries.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+size_t
+NsTclNsvSnapshot(NsServer *servPtr, const char *pattern, Tcl_DString *dsPtr, size_t *entriesPtr)
+{
+    Tcl_Obj    *namesObj, **nameObjv;
+    TCL_SIZE_T  nameObjc, n;
+    size_t      count = 0u;
+    int         i;
+
+    NS_NONNULL_ASSERT(servPtr != NULL);
+    NS_NONNULL_ASSERT(pattern != NULL);
+    NS_NONNULL_ASSERT(dsPtr != NULL);
+    NS_NONNULL_ASSERT(entriesPtr != NULL);
+
+    namesObj = Tcl_NewListObj(0, NULL);
+    Tcl_IncrRefCount(namesObj);
+    for (i = 0; i < servPtr->nsv.nbuckets; i++) {
+        const Tcl_HashEntry *hPtr;
+        Tcl_HashSearch       search;
+        Bucket              *bucketPtr = &servPtr->nsv.buckets[i];
+
+        if (servPtr->nsv.rwlocks) {
+            Ns_RWLockRdLock(&bucketPtr->rwlock);
+        } else {
+            Ns_MutexLock(&bucketPtr->mlock);
+        }
+        for (hPtr = Tcl_FirstHashEntry(&bucketPtr->arrays, &search);
+             hPtr != NULL;
+             hPtr = Tcl_NextHashEntry(&search)
+             ) {
+            const char *arrayName = Tcl_GetHashKey(&bucketPtr->arrays, hPtr);
+
+            if (Tcl_StringMatch(arrayName, pattern) != 0) {
+                Tcl_ListObjAppendElement(NULL, namesObj, Tcl_NewStringObj(arrayName, TCL_INDEX_NONE));
+            }
+        }
+        if (servPtr->nsv.rwlocks) {
+            Ns_RWLockUnlock(&bucketPtr->rwlock);
+        } else {
+            Ns_MutexUnlock(&bucketPtr->mlock);
+        }
+    }
+
+    (void) Tcl_ListObjGetElements(NULL, namesObj, &nameObjc, &nameObjv);
+    for (n = 0; n < nameObjc; n++) {
+        const char *arrayName = Tcl_GetString(nameObjv[n]);
+        Array      *arrayPtr;
+
+        /*
+         * Counter arrays are write locked, such that the current values of
+         * the counters are in the table of variables.
+         */
+        arrayPtr = LockArray(servPtr, arrayName, NS_FALSE, NS_READ);
+        if (arrayPtr != NULL) {
+            const Tcl_HashEntry *hPtr;
+            Tcl_HashSearch       search;
+            TCL_SIZE_T           offset;
+
+            offset = NsSnapshotBeginSection(dsPtr, NS_SNAPSHOT_NSV, arrayName);
+            NsSnapshotPutInt(dsPtr, (uint64_t)arrayPtr->vars.numEntries, 4u);
+            for (hPtr = Tcl_FirstHashEntry(&arrayPtr->vars, &search);
+                 hPtr != NULL;
+                 hPtr = Tcl_NextHashEntry(&search)
+                 ) {
+                const char *keyString = Tcl_GetHashKey(&arrayPtr->vars, hPtr);
+                const char *value = Tcl_GetHashValue(hPtr);
+
+                NsSnapshotPutBytes(dsPtr, keyString, strlen(keyString));
+                NsSnapshotPutBytes(dsPtr, value, strlen(value));
+            }
+            *entriesPtr += (size_t)arrayPtr->vars.numEntries;
+            UnlockArray(arrayPtr);
+            NsSnapshotEndSection(dsPtr, offset);
+            count++;
+        }
+    }
+    Tcl_DecrRefCount(namesObj);
+
+    return count;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * NsTclNsvRestore --
+ *
+ *      Restore an nsv array from a snapshot section. Saved entries
+ *      overwrite entries with the same keys in an existing array.
+ *
+ * Results:
+ *      NS_OK or NS_ERROR, when the section is invalid.
+ *
+ * Side effects:
+ *      Array is created when necessary, increments "entriesPtr" by the
+ *      number of restored entries.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+Ns_ReturnCode
+NsTclNsvRestore(NsServer *servPtr, const char *name, NsSnapshotReader *readerPtr, size_t *entriesPtr)
+{
+    Array       *arrayPtr;
+    size_t       nentries, i;
+    Tcl_DString  key, value;
+
+    NS_NONNULL_ASSERT(servPtr != NULL);
+    NS_NONNULL_ASSERT(name != NULL);
+    NS_NONNULL_ASSERT(readerPtr != NULL);
+    NS_NONNULL_ASSERT(entriesPtr != NULL);
+
+    nentries = (size_t)NsSnapshotGetInt(readerPtr, 4u);
+    if (readerPtr->error) {
+        return NS_ERROR;
+    }
+
+    Tcl_DStringInit(&key);
+    Tcl_DStringInit(&value);
+    arrayPtr = LockArray(servPtr, name, NS_TRUE, NS_WRITE);
+    assert(arrayPtr != NULL);
+    for (i = 0u; i < nentries; i++) {
+        const char *keyBytes, *valueBytes;
+        size_t      keyLength, valueLength;
+
+        keyBytes = NsSnapshotGetBytes(readerPtr, &keyLength);
+        valueBytes = NsSnapshotGetBytes(readerPtr, &valueLength);
+        if (readerPtr->error) {
+            break;
+        }
+        Tcl_DStringSetLength(&key, 0);
+        Tcl_DStringAppend(&key, keyBytes, (TCL_SIZE_T)keyLength);
+        Tcl_DStringSetLength(&value, 0);
+        Tcl_DStringAppend(&value, valueBytes, (TCL_SIZE_T)valueLength);
+        SetVar(arrayPtr, key.string, value.string, valueLength);
+        *entriesPtr += 1u;
+    }
+    UnlockArray(arrayPtr);
+    Tcl_DStringFree(&key);
+    Tcl_DStringFree(&value);
+
+    return readerPtr->error ? NS_ERROR : NS_OK;
+}
+
 
 /*
  *-----------------------------------------------------------------------------
@@ -1705,6 +2086,12 @@ BucketIndex(const char *arrayName) {
     return idx;
 }
 
+static Bucket *
+GetBucket(const NsServer *servPtr, const char *arrayName)
+{
+    return &servPtr->nsv.buckets[BucketIndex(arrayName) % (unsigned int)servPtr->nsv.nbuckets];
+}
+
 
 /*
  *-----------------------------------------------------------------------------
@@ -1742,6 +2129,17 @@ GetArray(Bucket *bucketPtr, const char *arrayName, bool create) {
             arrayPtr->locks = 0;
             arrayPtr->bucketPtr = bucketPtr;
             arrayPtr->entryPtr = hPtr;
+            arrayPtr->snapshot = NULL;
+            arrayPtr->published = NULL;
+            arrayPtr->readmostly = MatchArray(bucketPtr->servPtr->nsv.readmostly,
+                                              bucketPtr->servPtr->nsv.nreadmostly, arrayName);
+            arrayPtr->counting = MatchArray(bucketPtr->servPtr->nsv.counters,
+                                            bucketPtr->servPtr->nsv.ncounters, arrayName);
+            arrayPtr->countersChanged = NS_FALSE;
+            arrayPtr->writeLocked = NS_FALSE;
+            if (arrayPtr->counting) {
+                Tcl_InitHashTable(&arrayPtr->counters, TCL_STRING_KEYS);
+            }
             Tcl_InitHashTable(&arrayPtr->vars, TCL_STRING_KEYS);
             Tcl_SetHashValue(hPtr, arrayPtr);
         }
@@ -1783,13 +2181,20 @@ static Array *
 LockArray(const NsServer *servPtr, const char *arrayName, bool create, NS_RW rw)
 {
     Bucket        *bucketPtr;
-    unsigned int   idx;
+    Array         *arrayPtr;
 
     NS_NONNULL_ASSERT(servPtr != NULL);
     NS_NONNULL_ASSERT(arrayName != NULL);
 
-    idx = BucketIndex(arrayName);
-    bucketPtr = &servPtr->nsv.buckets[idx % (unsigned int)servPtr->nsv.nbuckets];
+    /*
+     * Counter arrays are always write locked, since the values of the
+     * counters are written to the table of variables.
+     */
+    if (unlikely(servPtr->nsv.ncounters > 0)
+        && MatchArray(servPtr->nsv.counters, servPtr->nsv.ncounters, arrayName)) {
+        rw = NS_WRITE;
+    }
+    bucketPtr = GetBucket(servPtr, arrayName);
     if (servPtr->nsv.rwlocks) {
         if (rw == NS_READ) {
             Ns_RWLockRdLock(&bucketPtr->rwlock);
@@ -1800,14 +2205,43 @@ LockArray(const NsServer *servPtr, const char *arrayName, bool create, NS_RW rw)
         Ns_MutexLock(&bucketPtr->mlock);
     }
 
-    return GetArray(bucketPtr, arrayName, create);
+    arrayPtr = GetArray(bucketPtr, arrayName, create);
+    if (arrayPtr != NULL && rw == NS_WRITE) {
+        WriteLocked(arrayPtr);
+    }
+    return arrayPtr;
 }
 
 static void
-UnlockArray(const Array *arrayPtr)
+UnlockArray(Array *arrayPtr)
 {
     NS_NONNULL_ASSERT(arrayPtr != NULL);
 
+    /*
+     * The content of read-mostly arrays might have changed under the write
+     * lock, so publish a new snapshot before releasing the lock.
+     */
+    if (unlikely(arrayPtr->writeLocked)) {
+        arrayPtr->writeLocked = NS_FALSE;
+        if (arrayPtr->counting) {
+            Counter *removedPtr = ReconcileCounters(arrayPtr);
+
+            if (arrayPtr->countersChanged) {
+                arrayPtr->countersChanged = NS_FALSE;
+                PublishCounters(arrayPtr);
+            }
+            while (removedPtr != NULL) {
+                Counter *counterPtr = removedPtr;
+
+                removedPtr = counterPtr->nextPtr;
+                Retire(counterPtr, CounterFree);
+            }
+        }
+        if (arrayPtr->readmostly) {
+            PublishArray(arrayPtr);
+        }
+    }
+
     if (arrayPtr->bucketPtr->servPtr->nsv.rwlocks) {
         Ns_RWLockUnlock(&((arrayPtr)->bucketPtr->rwlock));
     } else {
@@ -1898,7 +2332,7 @@ SetVar(Array *arrayPtr, const char *keyString, const char *value, size_t len)
 static int
 IncrVar(Array *arrayPtr, const char *keyString, int incr, Tcl_WideInt *valuePtr)
 {
-    Tcl_HashEntry *hPtr;
+    Tcl_HashEntry *hPtr, *counterEntryPtr = NULL;
     int            isNew, status;
     Tcl_WideInt    counter = -1;
 
@@ -1907,8 +2341,20 @@ IncrVar(Array *arrayPtr, const char *keyString, int incr, Tcl_WideInt *valuePtr)
     NS_NONNULL_ASSERT(valuePtr != NULL);
 
     hPtr = Tcl_CreateHashEntry(&arrayPtr->vars, keyString, &isNew);
+    if (arrayPtr->counting) {
+        counterEntryPtr = Tcl_CreateHashEntry(&arrayPtr->counters, keyString, NULL);
+    }
+
+    if (counterEntryPtr != NULL) {
+        /*
+         * The counter might be incremented concurrently without the lock.
+         */
+        Counter *counterPtr = Tcl_GetHashValue(counterEntryPtr);
+
+        counter = SnapshotAddFetch(&counterPtr->value, (Tcl_WideInt)incr) - (Tcl_WideInt)incr;
+        status = TCL_OK;
 
-    if (isNew != 0) {
+    } else if (isNew != 0) {
         counter = 0;
         status = TCL_OK;
     } else {
@@ -1926,6 +2372,19 @@ IncrVar(Array *arrayPtr, const char *keyString, int incr, Tcl_WideInt *valuePtr)
         counter += incr;
         snprintf(buf, sizeof(buf), "%" TCL_LL_MODIFIER "d", counter);
         UpdateVar(hPtr, buf, strlen(buf));
+
+        if (counterEntryPtr != NULL) {
+            ((Counter *)Tcl_GetHashValue(counterEntryPtr))->synced = counter;
+
+        } else if (arrayPtr->counting) {
+            Counter *counterPtr = CounterAlloc();
+
+            counterPtr->value = counter;
+            counterPtr->synced = counter;
+            counterEntryPtr = Tcl_CreateHashEntry(&arrayPtr->counters, keyString, &isNew);
+            Tcl_SetHashValue(counterEntryPtr, counterPtr);
+            arrayPtr->countersChanged = NS_TRUE;
+        }
     }
     *valuePtr = counter;
 
@@ -2038,7 +2497,13 @@ LockArrayObj(Tcl_Interp *interp, Tcl_Obj *arrayObj, bool create, NS_RW rw)
 
     if (likely(Ns_TclGetOpaqueFromObj(arrayObj, arrayType, (void **) &bucketPtr) == TCL_OK)
         && bucketPtr != NULL) {
-        if (bucketPtr->servPtr->nsv.rwlocks) {
+        const NsServer *servPtr = bucketPtr->servPtr;
+
+        if (unlikely(servPtr->nsv.ncounters > 0)
+            && MatchArray(servPtr->nsv.counters, servPtr->nsv.ncounters, arrayName)) {
+            rw = NS_WRITE;
+        }
+        if (servPtr->nsv.rwlocks) {
             if (rw == NS_READ) {
                 Ns_RWLockRdLock(&bucketPtr->rwlock);
             } else {
@@ -2048,6 +2513,9 @@ LockArrayObj(Tcl_Interp *interp, Tcl_Obj *arrayObj, bool create, NS_RW rw)
             Ns_MutexLock(&bucketPtr->mlock);
         }
         arrayPtr = GetArray(bucketPtr, arrayName, create);
+        if (arrayPtr != NULL && rw == NS_WRITE) {
+            WriteLocked(arrayPtr);
+        }
     } else {
         const NsInterp *itPtr = NsGetInterpData(interp);
 
@@ -2070,6 +2538,772 @@ LockArrayObj(Tcl_Interp *interp, Tcl_Obj *arrayObj, bool create, NS_RW rw)
 
 
 
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * DeleteArray, FreeArray --
+ *
+ *      DeleteArray() removes an array from its bucket. It has to be called
+ *      while the bucket is write locked. After unlocking the bucket, the
+ *      Array structure has to be freed with FreeArray(). Read-mostly arrays
+ *      are freed when no reader can access these anymore.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects;
+ *      Frees memory.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+DeleteArray(Array *arrayPtr)
+{
+    NS_NONNULL_ASSERT(arrayPtr != NULL);
+
+    Tcl_DeleteHashTable(&arrayPtr->vars);
+    Tcl_DeleteHashEntry(arrayPtr->entryPtr);
+    arrayPtr->writeLocked = NS_FALSE;
+    if (arrayPtr->counting) {
+        /*
+         * The counters are freed together with the published table.
+         */
+        Tcl_DeleteHashTable(&arrayPtr->counters);
+    }
+    if (arrayPtr->snapshot != NULL || arrayPtr->published != NULL) {
+        PublishBucket(arrayPtr->bucketPtr);
+    }
+}
+
+static void
+FreeArray(Array *arrayPtr)
+{
+    NS_NONNULL_ASSERT(arrayPtr != NULL);
+
+    if (arrayPtr->readmostly || arrayPtr->counting) {
+        Retire(arrayPtr, FreeRetiredArray);
+    } else {
+        ns_free(arrayPtr);
+    }
+}
+
+static void
+FreeRetiredArray(void *arg)
+{
+    Array *arrayPtr = arg;
+
+    if (arrayPtr->snapshot != NULL) {
+        SnapshotFree(arrayPtr->snapshot);
+    }
+    if (arrayPtr->published != NULL) {
+        const Tcl_HashEntry *hPtr;
+        Tcl_HashSearch       search;
+
+        hPtr = Tcl_FirstHashEntry(&arrayPtr->published->table, &search);
+        while (hPtr != NULL) {
+            CounterFree(Tcl_GetHashValue(hPtr));
+            hPtr = Tcl_NextHashEntry(&search);
+        }
+        SnapshotFree(arrayPtr->published);
+    }
+    ns_free(arrayPtr);
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * MatchArray --
+ *
+ *      Check, whether the array name matches one of the provided patterns
+ *      (e.g. "nsvreadmostly" or "nsvcounters" of the server).
+ *
+ * Results:
+ *      Boolean.
+ *
+ * Side effects;
+ *      None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static bool
+MatchArray(const char **patterns, TCL_SIZE_T npatterns, const char *arrayName)
+{
+    TCL_SIZE_T i;
+    bool       result = NS_FALSE;
+
+    NS_NONNULL_ASSERT(arrayName != NULL);
+
+    for (i = 0; i < npatterns; i++) {
+        if (Tcl_StringMatch(arrayName, patterns[i]) != 0) {
+            result = NS_TRUE;
+            break;
+        }
+    }
+    return result;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * SnapshotCreate, SnapshotFree --
+ *
+ *      Create and free a snapshot table. When "ownValues" is true, the
+ *      values are strings freed together with the snapshot.
+ *
+ * Results:
+ *      SnapshotCreate() returns the new snapshot.
+ *
+ * Side effects;
+ *      Allocates or frees memory.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static Snapshot *
+SnapshotCreate(bool ownValues)
+{
+    Snapshot *snapshotPtr = ns_malloc(sizeof(Snapshot));
+
+    Tcl_InitHashTable(&snapshotPtr->table, TCL_STRING_KEYS);
+    snapshotPtr->ownValues = ownValues;
+
+    return snapshotPtr;
+}
+
+static void
+SnapshotFree(void *arg)
+{
+    Snapshot *snapshotPtr = arg;
+
+    if (snapshotPtr->ownValues) {
+        const Tcl_HashEntry *hPtr;
+        Tcl_HashSearch       search;
+
+        hPtr = Tcl_FirstHashEntry(&snapshotPtr->table, &search);
+        while (hPtr != NULL) {
+            ns_free(Tcl_GetHashValue(hPtr));
+            hPtr = Tcl_NextHashEntry(&search);
+        }
+    }
+    Tcl_DeleteHashTable(&snapshotPtr->table);
+    ns_free(snapshotPtr);
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * PublishArray, PublishBucket --
+ *
+ *      PublishArray() replaces the snapshot of a read-mostly array with a
+ *      copy of its current content. PublishCounters() replaces the table
+ *      of counters of a counter array. PublishBucket() replaces the table
+ *      of read-mostly and counter arrays of the bucket, which is used by
+ *      the readers to locate the arrays. Both functions have to be called while the bucket
+ *      is write locked. Multiple updates of an array under the same lock
+ *      result in a single new snapshot.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects;
+ *      The previous snapshot is retired.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+PublishArray(Array *arrayPtr)
+{
+    Snapshot            *snapshotPtr, *oldPtr;
+    const Tcl_HashEntry *hPtr;
+    Tcl_HashSearch       search;
+
+    NS_NONNULL_ASSERT(arrayPtr != NULL);
+
+    snapshotPtr = SnapshotCreate(NS_TRUE);
+    hPtr = Tcl_FirstHashEntry(&arrayPtr->vars, &search);
+    while (hPtr != NULL) {
+        Tcl_HashEntry *newPtr;
+        int            isNew;
+
+        newPtr = Tcl_CreateHashEntry(&snapshotPtr->table,
+                                     Tcl_GetHashKey(&arrayPtr->vars, hPtr), &isNew);
+        Tcl_SetHashValue(newPtr, ns_strdup(Tcl_GetHashValue(hPtr)));
+        hPtr = Tcl_NextHashEntry(&search);
+    }
+
+    oldPtr = arrayPtr->snapshot;
+    SnapshotStore(&arrayPtr->snapshot, snapshotPtr, __ATOMIC_SEQ_CST);
+    if (oldPtr != NULL) {
+        Retire(oldPtr, SnapshotFree);
+    } else {
+        /*
+         * First snapshot of the array, make it visible to the readers.
+         */
+        PublishBucket(arrayPtr->bucketPtr);
+    }
+}
+
+static void
+PublishCounters(Array *arrayPtr)
+{
+    Snapshot            *snapshotPtr, *oldPtr;
+    const Tcl_HashEntry *hPtr;
+    Tcl_HashSearch       search;
+
+    NS_NONNULL_ASSERT(arrayPtr != NULL);
+
+    snapshotPtr = SnapshotCreate(NS_FALSE);
+    hPtr = Tcl_FirstHashEntry(&arrayPtr->counters, &search);
+    while (hPtr != NULL) {
+        Tcl_HashEntry *newPtr;
+        int            isNew;
+
+        newPtr = Tcl_CreateHashEntry(&snapshotPtr->table,
+                                     Tcl_GetHashKey(&arrayPtr->counters, hPtr), &isNew);
+        Tcl_SetHashValue(newPtr, Tcl_GetHashValue(hPtr));
+        hPtr = Tcl_NextHashEntry(&search);
+    }
+
+    oldPtr = arrayPtr->published;
+    SnapshotStore(&arrayPtr->published, snapshotPtr, __ATOMIC_SEQ_CST);
+    if (oldPtr != NULL) {
+        Retire(oldPtr, SnapshotFree);
+    } else {
+        PublishBucket(arrayPtr->bucketPtr);
+    }
+}
+
+static void
+PublishBucket(Bucket *bucketPtr)
+{
+    Snapshot            *snapshotPtr, *oldPtr;
+    const Tcl_HashEntry *hPtr;
+    Tcl_HashSearch       search;
+
+    NS_NONNULL_ASSERT(bucketPtr != NULL);
+
+    snapshotPtr = SnapshotCreate(NS_FALSE);
+    hPtr = Tcl_FirstHashEntry(&bucketPtr->arrays, &search);
+    while (hPtr != NULL) {
+        Array *arrayPtr = Tcl_GetHashValue(hPtr);
+
+        if (arrayPtr->snapshot != NULL || arrayPtr->published != NULL) {
+            Tcl_HashEntry *newPtr;
+            int            isNew;
+
+            newPtr = Tcl_CreateHashEntry(&snapshotPtr->table,
+                                         Tcl_GetHashKey(&bucketPtr->arrays, hPtr), &isNew);
+            Tcl_SetHashValue(newPtr, arrayPtr);
+        }
+        hPtr = Tcl_NextHashEntry(&search);
+    }
+
+    oldPtr = bucketPtr->published;
+    SnapshotStore(&bucketPtr->published, snapshotPtr, __ATOMIC_SEQ_CST);
+    if (oldPtr != NULL) {
+        Retire(oldPtr, SnapshotFree);
+    }
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * WriteLocked, SyncCounters, ReconcileCounters --
+ *
+ *      WriteLocked() is called after an array was write locked. For
+ *      counter arrays, SyncCounters() writes the current values of the
+ *      counters to the table of variables, such that all operations
+ *      under the lock see these. When the lock is released,
+ *      ReconcileCounters() takes over changes of these values made under
+ *      the lock into the counters. Counters whose key was unset or whose
+ *      value is not an integer anymore are removed.
+ *
+ * Results:
+ *      ReconcileCounters() returns the list of removed counters, which have
+ *      to be retired after publishing the counters.
+ *
+ * Side effects;
+ *      Updates the table of variables and the counters.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+WriteLocked(Array *arrayPtr)
+{
+    NS_NONNULL_ASSERT(arrayPtr != NULL);
+
+    arrayPtr->writeLocked = NS_TRUE;
+    if (arrayPtr->counting) {
+        SyncCounters(arrayPtr);
+    }
+}
+
+static void
+SyncCounters(Array *arrayPtr)
+{
+    const Tcl_HashEntry *hPtr;
+    Tcl_HashSearch       search;
+
+    NS_NONNULL_ASSERT(arrayPtr != NULL);
+
+    hPtr = Tcl_FirstHashEntry(&arrayPtr->counters, &search);
+    while (hPtr != NULL) {
+        Counter    *counterPtr = Tcl_GetHashValue(hPtr);
+        Tcl_WideInt value = SnapshotLoad(&counterPtr->value, __ATOMIC_RELAXED);
+
+        if (value != counterPtr->synced) {
+            char buf[TCL_INTEGER_SPACE+2];
+            int  isNew;
+
+            snprintf(buf, sizeof(buf), "%" TCL_LL_MODIFIER "d", value);
+            UpdateVar(Tcl_CreateHashEntry(&arrayPtr->vars, Tcl_GetHashKey(&arrayPtr->counters, hPtr), &isNew),
+                      buf, strlen(buf));
+            counterPtr->synced = value;
+        }
+        hPtr = Tcl_NextHashEntry(&search);
+    }
+}
+
+static Counter *
+ReconcileCounters(Array *arrayPtr)
+{
+    Tcl_HashEntry  *hPtr;
+    Tcl_HashSearch  search;
+    Counter        *removedPtr = NULL;
+
+    NS_NONNULL_ASSERT(arrayPtr != NULL);
+
+    hPtr = Tcl_FirstHashEntry(&arrayPtr->counters, &search);
+    while (hPtr != NULL) {
+        Counter             *counterPtr = Tcl_GetHashValue(hPtr);
+        const Tcl_HashEntry *varPtr;
+        Tcl_WideInt          value;
+
+        varPtr = Tcl_CreateHashEntry(&arrayPtr->vars, Tcl_GetHashKey(&arrayPtr->counters, hPtr), NULL);
+        if (varPtr == NULL || Ns_StrToWideInt(Tcl_GetHashValue(varPtr), &value) != NS_OK) {
+            Tcl_DeleteHashEntry(hPtr);
+            counterPtr->nextPtr = removedPtr;
+            removedPtr = counterPtr;
+            arrayPtr->countersChanged = NS_TRUE;
+
+        } else if (value != counterPtr->synced) {
+            /*
+             * The value was set under the lock. Increments performed
+             * concurrently without the lock are considered to have
+             * happened before.
+             */
+            SnapshotStore(&counterPtr->value, value, __ATOMIC_RELAXED);
+            counterPtr->synced = value;
+        }
+        hPtr = Tcl_NextHashEntry(&search);
+    }
+    return removedPtr;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * Retire --
+ *
+ *      Register data, which is not reachable anymore for new readers, for
+ *      freeing. The data is stamped with the current epoch, which is
+ *      advanced afterwards. Data is freed, when all readers have started
+ *      their read operation in a later epoch.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects;
+ *      Frees retired data not accessed by readers anymore.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+Retire(void *data, Ns_FreeProc *freeProc)
+{
+    Retired       *retiredPtr, **nextPtrPtr, *freePtr = NULL;
+    const Reader  *readerPtr;
+    unsigned long  minEpoch = ULONG_MAX;
+
+    NS_NONNULL_ASSERT(data != NULL);
+    NS_NONNULL_ASSERT(freeProc != NULL);
+
+    retiredPtr = ns_malloc(sizeof(Retired));
+    retiredPtr->data = data;
+    retiredPtr->freeProc = freeProc;
+
+    Ns_MutexLock(&ebr.lock);
+    retiredPtr->epoch = SnapshotFetchAdd(&ebr.epoch, 1u);
+    retiredPtr->nextPtr = ebr.retired;
+    ebr.retired = retiredPtr;
+
+    for (readerPtr = ebr.readers; readerPtr != NULL; readerPtr = readerPtr->nextPtr) {
+        unsigned long active = SnapshotLoad(&readerPtr->active, __ATOMIC_SEQ_CST);
+
+        if (active != 0u && active < minEpoch) {
+            minEpoch = active;
+        }
+    }
+
+    nextPtrPtr = &ebr.retired;
+    while (*nextPtrPtr != NULL) {
+        retiredPtr = *nextPtrPtr;
+        if (retiredPtr->epoch < minEpoch) {
+            *nextPtrPtr = retiredPtr->nextPtr;
+            retiredPtr->nextPtr = freePtr;
+            freePtr = retiredPtr;
+        } else {
+            nextPtrPtr = &retiredPtr->nextPtr;
+        }
+    }
+    Ns_MutexUnlock(&ebr.lock);
+
+    while (freePtr != NULL) {
+        retiredPtr = freePtr;
+        freePtr = retiredPtr->nextPtr;
+        (*retiredPtr->freeProc)(retiredPtr->data);
+        ns_free(retiredPtr);
+    }
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * FreeReader --
+ *
+ *      TLS cleanup callback, release the Reader of an exiting thread for
+ *      reuse by other threads.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects;
+ *      None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+FreeReader(void *arg)
+{
+    Reader *readerPtr = arg;
+
+    Ns_MutexLock(&ebr.lock);
+    readerPtr->active = 0u;
+    readerPtr->inUse = NS_FALSE;
+    Ns_MutexUnlock(&ebr.lock);
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * ReaderEnter, ReaderExit --
+ *
+ *      Begin and end a read operation on published snapshots. ReaderEnter()
+ *      announces the epoch of the read operation before any snapshot
+ *      pointer is loaded. Data retired afterwards is stamped with at least
+ *      this epoch and is kept until ReaderExit() is called.
+ *
+ * Results:
+ *      ReaderEnter() returns the Reader of the calling thread.
+ *
+ * Side effects;
+ *      Registers a Reader for the calling thread on first use.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static Reader *
+ReaderEnter(void)
+{
+    Reader *readerPtr = Ns_TlsGet(&ebr.tls);
+
+    if (unlikely(readerPtr == NULL)) {
+        Ns_MutexLock(&ebr.lock);
+        for (readerPtr = ebr.readers; readerPtr != NULL; readerPtr = readerPtr->nextPtr) {
+            if (!readerPtr->inUse) {
+                break;
+            }
+        }
+        if (readerPtr == NULL) {
+            readerPtr = ns_calloc(1u, sizeof(Reader));
+            readerPtr->nextPtr = ebr.readers;
+            ebr.readers = readerPtr;
+        }
+        readerPtr->inUse = NS_TRUE;
+        Ns_MutexUnlock(&ebr.lock);
+        Ns_TlsSet(&ebr.tls, readerPtr);
+    }
+
+    SnapshotStore(&readerPtr->active, SnapshotLoad(&ebr.epoch, __ATOMIC_ACQUIRE), __ATOMIC_RELAXED);
+    SnapshotFence();
+
+    return readerPtr;
+}
+
+static void
+ReaderExit(Reader *readerPtr)
+{
+    SnapshotStore(&readerPtr->active, 0u, __ATOMIC_RELEASE);
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * SnapshotGet, SnapshotGetObj --
+ *
+ *      Lookup a key of a read-mostly array or a counter in the published
+ *      snapshots without locking. The value is returned either as a new
+ *      Tcl_Obj in "objPtr" or appended to "dsPtr", when these are not NULL.
+ *      SnapshotGetObj() determines the bucket from the array Tcl_Obj.
+ *
+ * Results:
+ *      SNAPSHOT_FOUND or SNAPSHOT_NOTFOUND, or SNAPSHOT_NONE, when the
+ *      lookup has to be performed under the lock.
+ *
+ * Side effects;
+ *      None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static int
+SnapshotGet(Bucket *bucketPtr, const char *arrayName, const char *keyString,
+            Tcl_Obj **objPtr, Tcl_DString *dsPtr)
+{
+    Reader              *readerPtr;
+    Snapshot            *snapshotPtr;
+    const Tcl_HashEntry *hPtr;
+    int                  result = SNAPSHOT_NONE;
+
+    NS_NONNULL_ASSERT(bucketPtr != NULL);
+    NS_NONNULL_ASSERT(arrayName != NULL);
+    NS_NONNULL_ASSERT(keyString != NULL);
+
+    if (SnapshotLoad(&bucketPtr->published, __ATOMIC_RELAXED) == NULL) {
+        return SNAPSHOT_NONE;
+    }
+
+    readerPtr = ReaderEnter();
+    snapshotPtr = SnapshotLoad(&bucketPtr->published, __ATOMIC_ACQUIRE);
+    hPtr = Tcl_CreateHashEntry(&snapshotPtr->table, arrayName, NULL);
+    if (hPtr != NULL) {
+        const Array *arrayPtr = Tcl_GetHashValue(hPtr);
+
+        snapshotPtr = SnapshotLoad(&arrayPtr->published, __ATOMIC_ACQUIRE);
+        hPtr = (snapshotPtr != NULL) ? Tcl_CreateHashEntry(&snapshotPtr->table, keyString, NULL) : NULL;
+        if (hPtr != NULL) {
+            const Counter *counterPtr = Tcl_GetHashValue(hPtr);
+            char           buf[TCL_INTEGER_SPACE+2];
+
+            snprintf(buf, sizeof(buf), "%" TCL_LL_MODIFIER "d",
+                     SnapshotLoad(&counterPtr->value, __ATOMIC_RELAXED));
+            if (objPtr != NULL) {
+                *objPtr = Tcl_NewStringObj(buf, TCL_INDEX_NONE);
+            }
+            if (dsPtr != NULL) {
+                Tcl_DStringAppend(dsPtr, buf, TCL_INDEX_NONE);
+            }
+            result = SNAPSHOT_FOUND;
+
+        } else if (arrayPtr->readmostly) {
+            snapshotPtr = SnapshotLoad(&arrayPtr->snapshot, __ATOMIC_ACQUIRE);
+            hPtr = (snapshotPtr != NULL) ? Tcl_CreateHashEntry(&snapshotPtr->table, keyString, NULL) : NULL;
+            if (hPtr != NULL) {
+                if (objPtr != NULL) {
+                    *objPtr = Tcl_NewStringObj(Tcl_GetHashValue(hPtr), TCL_INDEX_NONE);
+                }
+                if (dsPtr != NULL) {
+                    Tcl_DStringAppend(dsPtr, Tcl_GetHashValue(hPtr), TCL_INDEX_NONE);
+                }
+                result = SNAPSHOT_FOUND;
+            } else if (snapshotPtr != NULL) {
+                result = SNAPSHOT_NOTFOUND;
+            }
+        }
+    }
+
+    ReaderExit(readerPtr);
+
+    return result;
+}
+
+static int
+SnapshotGetObj(Tcl_Interp *interp, Tcl_Obj *arrayObj, const char *keyString, Tcl_Obj **objPtr)
+{
+    Bucket *bucketPtr;
+    int     result = SNAPSHOT_NONE;
+
+    NS_NONNULL_ASSERT(interp != NULL);
+    NS_NONNULL_ASSERT(arrayObj != NULL);
+    NS_NONNULL_ASSERT(keyString != NULL);
+
+    bucketPtr = GetBucketFromObj(interp, arrayObj);
+    if (bucketPtr != NULL) {
+        result = SnapshotGet(bucketPtr, Tcl_GetString(arrayObj), keyString, objPtr, NULL);
+    }
+    return result;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * CounterAlloc, CounterFree --
+ *
+ *      Allocate resp. free a counter. Counters are aligned to cache lines,
+ *      since the padding of the structure alone does not prevent a counter
+ *      from sharing a cache line with its neighbor.
+ *
+ * Results:
+ *      CounterAlloc() returns a zeroed counter.
+ *
+ * Side effects:
+ *      Allocates resp. frees memory.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static Counter *
+CounterAlloc(void)
+{
+    void *counterPtr;
+
+#ifdef _WIN32
+    counterPtr = _aligned_malloc(sizeof(Counter), COUNTER_ALIGNMENT);
+    if (counterPtr == NULL) {
+        Ns_Fatal("nsv: could not allocate counter");
+    }
+#else
+    if (posix_memalign(&counterPtr, COUNTER_ALIGNMENT, sizeof(Counter)) != 0) {
+        Ns_Fatal("nsv: could not allocate counter");
+    }
+#endif
+    memset(counterPtr, 0, sizeof(Counter));
+
+    return counterPtr;
+}
+
+static void
+CounterFree(void *arg)
+{
+#ifdef _WIN32
+    _aligned_free(arg);
+#else
+    free(arg);
+#endif
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * CounterIncr --
+ *
+ *      Increment an existing counter without locking.
+ *
+ * Results:
+ *      NS_TRUE, when the counter was incremented, NS_FALSE when the
+ *      increment has to be performed under the lock.
+ *
+ * Side effects;
+ *      The new value is returned in "valuePtr".
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static bool
+CounterIncr(Bucket *bucketPtr, const char *arrayName, const char *keyString,
+            int incr, Tcl_WideInt *valuePtr)
+{
+    Reader              *readerPtr;
+    Snapshot            *snapshotPtr;
+    const Tcl_HashEntry *hPtr;
+    bool                 success = NS_FALSE;
+
+    NS_NONNULL_ASSERT(bucketPtr != NULL);
+    NS_NONNULL_ASSERT(arrayName != NULL);
+    NS_NONNULL_ASSERT(keyString != NULL);
+    NS_NONNULL_ASSERT(valuePtr != NULL);
+
+    if (SnapshotLoad(&bucketPtr->published, __ATOMIC_RELAXED) == NULL) {
+        return NS_FALSE;
+    }
+
+    readerPtr = ReaderEnter();
+    snapshotPtr = SnapshotLoad(&bucketPtr->published, __ATOMIC_ACQUIRE);
+    hPtr = Tcl_CreateHashEntry(&snapshotPtr->table, arrayName, NULL);
+    if (hPtr != NULL) {
+        const Array *arrayPtr = Tcl_GetHashValue(hPtr);
+
+        snapshotPtr = SnapshotLoad(&arrayPtr->published, __ATOMIC_ACQUIRE);
+        if (snapshotPtr != NULL) {
+            hPtr = Tcl_CreateHashEntry(&snapshotPtr->table, keyString, NULL);
+            if (hPtr != NULL) {
+                Counter *counterPtr = Tcl_GetHashValue(hPtr);
+
+                *valuePtr = SnapshotAddFetch(&counterPtr->value, (Tcl_WideInt)incr);
+                success = NS_TRUE;
+            }
+        }
+    }
+    ReaderExit(readerPtr);
+
+    return success;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * GetBucketFromObj --
+ *
+ *      Determine the bucket of the array Tcl_Obj for lookups in snapshots.
+ *
+ * Results:
+ *      Bucket or NULL, when the server has neither read-mostly nor counter
+ *      arrays configured.
+ *
+ * Side effects;
+ *      None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static Bucket *
+GetBucketFromObj(Tcl_Interp *interp, Tcl_Obj *arrayObj)
+{
+    Bucket *bucketPtr;
+
+    NS_NONNULL_ASSERT(interp != NULL);
+    NS_NONNULL_ASSERT(arrayObj != NULL);
+
+    if (Ns_TclGetOpaqueFromObj(arrayObj, "nsv:array", (void **) &bucketPtr) != TCL_OK
+        || bucketPtr == NULL) {
+        const NsServer *servPtr = NsGetInterpData(interp)->servPtr;
+
+        bucketPtr = NsvSnapshots(servPtr) ? GetBucket(servPtr, Tcl_GetString(arrayObj)) : NULL;
+
+    } else if (!NsvSnapshots(bucketPtr->servPtr)) {
+        bucketPtr = NULL;
+    }
+    return bucketPtr;
+}
+
+
 /*
  *-----------------------------------------------------------------------------
  *
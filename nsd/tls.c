@@ -1831,7 +1831,8 @@ DrainErrorStack(Ns_LogSeverity severity, const char *errorContext, unsigned long
  * NsSSLConfigNew --
  *
  *      Creates a new NsSSLConfig structure and sets standard
- *      configuration parameters ("deferaccept", "nodelay", and "verify").
+ *      configuration parameters ("deferaccept", "nodelay", "ktls",
+ *      "leankeepalive", and "verify").
  *
  * Results:
  *      Pointer to a new NsSSLConfig.
@@ -1850,6 +1851,15 @@ NsSSLConfigNew(const char *section)
     cfgPtr->deferaccept  = Ns_ConfigBool(section, "deferaccept", NS_FALSE);
     cfgPtr->nodelay      = Ns_ConfigBool(section, "nodelay", NS_TRUE);
     cfgPtr->verify       = Ns_ConfigBool(section, "verify", 0);
+    cfgPtr->ktls         = Ns_ConfigBool(section, "ktls", NS_FALSE);
+    cfgPtr->leankeepalive = Ns_ConfigBool(section, "leankeepalive", NS_FALSE);
+#ifndef HAVE_OPENSSL_KTLS
+    if (cfgPtr->ktls) {
+        Ns_Log(Warning, "%s: ktls requested, but OpenSSL was built without kTLS support",
+               section);
+        cfgPtr->ktls = NS_FALSE;
+    }
+#endif
     cfgPtr->tlsKeyScript = Ns_ConfigGetValue(section, "tlskeyscript");
     if (cfgPtr->tlsKeyScript != NULL) {
         cfgPtr->tlsKeyScript = Ns_ConfigFilename(section, "tlskeyscript", 12,
@@ -2012,7 +2022,7 @@ Ns_TLS_CtxServerInit(const char *section, Tcl_Interp *interp,
         Ns_Log(Error, "nsssl: certificate parameter must be specified in the configuration file under %s", section);
         result = NS_ERROR;
     } else {
-        const char *ciphers, *ciphersuites, *protocols;
+        const char *ciphers, *ciphersuites, *protocols, *alpn = "http/1.1";
         Ns_DList dl, *dlPtr = &dl;
 
         /*
@@ -2026,6 +2036,15 @@ Ns_TLS_CtxServerInit(const char *section, Tcl_Interp *interp,
         ciphersuites = Ns_DListSaveString(dlPtr, Ns_ConfigGetValue(section, "ciphersuites"));
         protocols    = Ns_DListSaveString(dlPtr, Ns_ConfigGetValue(section, "protocols"));
 
+#ifdef HAVE_NGHTTP2
+        /*
+         * Offer HTTP/2 via ALPN, when it is enabled for the driver.
+         */
+        if (Ns_ConfigBool(section, "http2", NS_FALSE)) {
+            alpn = "h2,http/1.1";
+        }
+#endif
+
         Ns_Log(Debug, "Ns_TLS_CtxServerInit calls Ns_TLS_CtxServerCreate with app data %p",
                (void*) app_data);
 
@@ -2033,7 +2052,7 @@ Ns_TLS_CtxServerInit(const char *section, Tcl_Interp *interp,
                                            NULL /*caFile*/, NULL /*caPath*/,
                                            Ns_ConfigBool(section, "verify", 0),
                                            ciphers, ciphersuites, protocols,
-                                           "http/1.1",
+                                           alpn,
                                            app_data,
                                            ctxPtr);
         if (result == TCL_OK) {
@@ -2082,6 +2101,16 @@ Ns_TLS_CtxServerInit(const char *section, Tcl_Interp *interp,
              */
 #ifdef SSL_OP_NO_COMPRESSION
             SSL_CTX_set_options(*ctxPtr, SSL_OP_NO_COMPRESSION);
+#endif
+#ifdef HAVE_OPENSSL_KTLS
+            /*
+             * Let OpenSSL hand the record layer over to the kernel after
+             * the handshake, when the negotiated cipher is supported by
+             * the kernel. This allows zero-copy SSL_sendfile().
+             */
+            if (cfgPtr->ktls) {
+                SSL_CTX_set_options(*ctxPtr, SSL_OP_ENABLE_KTLS);
+            }
 #endif
             /*
              * Since EOF behavior of OpenSSL concerning EOF handling
@@ -337,6 +337,7 @@ NsMemMap(const char *path, size_t size, int mode, FileMap *mapPtr)
 
     ns_close(mapPtr->handle);
     mapPtr->size = size;
+    mapPtr->releaseProc = NULL;
 
     return NS_OK;
 }
@@ -347,7 +348,8 @@ NsMemMap(const char *path, size_t size, int mode, FileMap *mapPtr)
  *
  * NsMemUmap --
  *
- *      Unmaps a file.
+ *      Unmaps a file. For shared regions, the release callback is
+ *      called instead.
  *
  * Results:
  *      None.
@@ -362,7 +364,12 @@ void
 NsMemUmap(const FileMap *mapPtr)
 {
     NS_NONNULL_ASSERT(mapPtr != NULL);
-    munmap(mapPtr->addr, mapPtr->size);
+
+    if (mapPtr->releaseProc != NULL) {
+        (*mapPtr->releaseProc)(mapPtr->releaseArg);
+    } else {
+        munmap(mapPtr->addr, mapPtr->size);
+    }
 }
 
 
@@ -288,6 +288,59 @@ NsUrlToFile(Tcl_DString *dsPtr, NsServer *servPtr, const char *url)
     return status;
 }
 
+/*
+ *----------------------------------------------------------------------
+ *
+ * NsUrlToFileDriver --
+ *
+ *      Construct the filename that corresponds to a URL from the driver
+ *      thread, i.e. without a connection. This is only possible when the
+ *      URL is mapped via the default Ns_FastUrl2FileProc() and no
+ *      serverroot proc is registered, since both, custom url2file procs
+ *      and serverroot procs might require a connection and an
+ *      interpreter. The host is needed for virtual hosting.
+ *
+ * Results:
+ *      NS_TRUE when the filename was constructed, NS_FALSE otherwise.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+bool
+NsUrlToFileDriver(Tcl_DString *dsPtr, NsServer *servPtr, const char *host, const char *url)
+{
+    bool success = NS_FALSE;
+
+    NS_NONNULL_ASSERT(dsPtr != NULL);
+    NS_NONNULL_ASSERT(servPtr != NULL);
+    NS_NONNULL_ASSERT(url != NULL);
+
+    if (servPtr->fastpath.url2file == NULL && servPtr->vhost.serverRootProc == NULL) {
+        const Url2File *u2fPtr;
+
+        Ns_MutexLock(&ulock);
+        u2fPtr = Ns_UrlSpecificGet((Ns_Server*)servPtr, "x", url, uid, 0u,
+                                   NS_URLSPACE_DEFAULT, NULL, NULL, NULL);
+        success = (u2fPtr != NULL
+                   && u2fPtr->proc == Ns_FastUrl2FileProc
+                   && u2fPtr->arg == servPtr);
+        Ns_MutexUnlock(&ulock);
+
+        if (success && NsPageRoot(dsPtr, servPtr, host) != NULL) {
+            (void) Ns_MakePath(dsPtr, url, NS_SENTINEL);
+            while (dsPtr->length > 0 && dsPtr->string[dsPtr->length -1] == '/') {
+                Tcl_DStringSetLength(dsPtr, dsPtr->length -1);
+            }
+        } else {
+            success = NS_FALSE;
+        }
+    }
+    return success;
+}
+
 #ifdef NS_WITH_DEPRECATED
 /*
  *----------------------------------------------------------------------
@@ -56,6 +56,7 @@ static Ns_DriverListenProc Listen;
 static Ns_DriverAcceptProc Accept;
 static Ns_DriverRecvProc Recv;
 static Ns_DriverSendProc Send;
+static Ns_DriverSendFileProc SendFile;
 static Ns_DriverKeepProc Keep;
 static Ns_DriverConnInfoProc ConnInfo;
 static Ns_DriverCloseProc Close;
@@ -66,6 +67,11 @@ static void SSLLock(int mode, int n, const char *file, int line);
 static unsigned long SSLThreadId(void);
 #endif
 
+#ifdef HAVE_OPENSSL_KTLS
+static ssize_t SendFileKTLS(Ns_Sock *sock, SSL *ssl, int fd, off_t offset, size_t length)
+    NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(2);
+#endif
+
 /*
  * Static variables defined in this file.
  */
@@ -101,7 +107,7 @@ Ns_ModuleInit(const char *server, const char *module)
     init.acceptProc = Accept;
     init.recvProc = Recv;
     init.sendProc = Send;
-    init.sendFileProc = NULL;
+    init.sendFileProc = SendFile;
     init.keepProc = Keep;
     init.connInfoProc = ConnInfo;
     init.requestProc = NULL;
@@ -190,8 +196,8 @@ Ns_ModuleInit(const char *server, const char *module)
     Tcl_DStringFree(&ds);
 #endif
 
-    Ns_Log(Notice, "nsssl: version %s loaded, based on %s",
-           NSSSL_VERSION, init.libraryVersion);
+    Ns_Log(Notice, "nsssl: version %s loaded, based on %s (ktls %d)",
+           NSSSL_VERSION, init.libraryVersion, drvCfgPtr->ktls);
     return NS_OK;
 }
 
@@ -294,6 +300,14 @@ Accept(Ns_Sock *sock, NS_SOCKET listensock, struct sockaddr *sockaddrPtr, sockle
             SSL_set_fd(sslCtx->ssl, sock->sock);
             SSL_set_accept_state(sslCtx->ssl);
             SSL_set_app_data(sslCtx->ssl, sock);
+            if (drvCfgPtr->leankeepalive != 0) {
+                /*
+                 * Let OpenSSL free the read and write buffers whenever
+                 * they are empty, such that idle keepalive connections
+                 * do not hold them.
+                 */
+                SSL_set_mode(sslCtx->ssl, SSL_MODE_RELEASE_BUFFERS);
+            }
         }
         return NS_DRIVER_ACCEPT_DATA;
     }
@@ -370,6 +384,15 @@ Recv(Ns_Sock *sock, struct iovec *bufs, int nbufs,
 
     if (nRead > -1) {
         nRead = Ns_SSLRecvBufs2(sslCtx->ssl, bufs, nbufs, &sockState, &sslERRcode);
+#ifdef HAVE_OPENSSL_KTLS
+        /*
+         * After the handshake, tell the writer threads, whether file
+         * content can be sent via SSL_sendfile() (see SendFile()).
+         */
+        if (nRead > 0 && BIO_get_ktls_send(SSL_get_wbio(sslCtx->ssl))) {
+            (void)Ns_SockFlagAdd(sock, NS_CONN_SSL_KTLS);
+        }
+#endif
     }
     Ns_SockSetReceiveState(sock, sockState, sslERRcode);
 
@@ -481,6 +504,129 @@ Send(Ns_Sock *sock, const struct iovec *bufs, int nbufs, unsigned int UNUSED(fla
 }
 
 
+/*
+ *----------------------------------------------------------------------
+ *
+ * SendFile --
+ *
+ *      Send data from given file and memory buffers. When kernel TLS is
+ *      active for sending on this connection, file ranges are delivered
+ *      via SSL_sendfile() without copying the content through user
+ *      space. Otherwise, fall back to the generic implementation, which
+ *      reads the file content and sends it through the Send() proc.
+ *
+ * Results:
+ *      Total number of bytes sent, -1 on error.
+ *
+ * Side effects:
+ *      May block on disk read.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static ssize_t
+SendFile(Ns_Sock *sock, Ns_FileVec *bufs, int nbufs, unsigned int flags)
+{
+    ssize_t     sent;
+#ifdef HAVE_OPENSSL_KTLS
+    SSLContext *sslCtx = sock->arg;
+
+    if (sslCtx != NULL && BIO_get_ktls_send(SSL_get_wbio(sslCtx->ssl))) {
+        bool decork = Ns_SockCork(sock, NS_TRUE);
+        int  i;
+
+        sent = 0;
+        for (i = 0; i < nbufs; i++) {
+            size_t  length = bufs[i].length;
+            ssize_t n;
+
+            if (length == 0u) {
+                continue;
+            }
+            if (bufs[i].fd == NS_INVALID_FD) {
+                struct iovec iov;
+
+                (void) Ns_SetVec(&iov, 0, (char *)bufs[i].buffer + bufs[i].offset, length);
+                n = Send(sock, &iov, 1, 0u);
+            } else {
+                n = SendFileKTLS(sock, sslCtx->ssl, bufs[i].fd, bufs[i].offset, length);
+            }
+            if (n == -1) {
+                sent = -1;
+                break;
+            }
+            sent += n;
+            if ((size_t)n < length) {
+                break;
+            }
+        }
+
+        if (decork) {
+            Ns_SockCork(sock, NS_FALSE);
+        }
+    } else
+#endif
+    {
+        sent = Ns_SockSendFileBufs(sock, bufs, nbufs, flags);
+    }
+
+    return sent;
+}
+
+#ifdef HAVE_OPENSSL_KTLS
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * SendFileKTLS --
+ *
+ *      Send a single file range over a connection with active kernel TLS
+ *      send offload via SSL_sendfile().
+ *
+ * Results:
+ *      Number of bytes sent, -1 on error. A value smaller than "length"
+ *      is returned, when the socket would block.
+ *
+ * Side effects:
+ *      Sets NS_CONN_SSL_WANT_WRITE, when the socket would block.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static ssize_t
+SendFileKTLS(Ns_Sock *sock, SSL *ssl, int fd, off_t offset, size_t length)
+{
+    ssize_t sent;
+
+    NS_NONNULL_ASSERT(sock != NULL);
+    NS_NONNULL_ASSERT(ssl != NULL);
+
+    ERR_clear_error();
+    (void)Ns_SockFlagClear(sock, NS_CONN_SSL_WANT_WRITE);
+
+    sent = (ssize_t)SSL_sendfile(ssl, fd, offset, length, 0);
+    if (sent <= 0) {
+        int sslerr = SSL_get_error(ssl, (int)sent);
+
+        if (sslerr == SSL_ERROR_WANT_WRITE) {
+            (void)Ns_SockFlagAdd(sock, NS_CONN_SSL_WANT_WRITE);
+            sent = 0;
+        } else {
+            unsigned long errorCode = ERR_get_error();
+
+            Ns_Log(Debug, "nsssl: SSL_sendfile sock %d failed: errno %d sslerr %d errorCode %.8lx",
+                   sock->sock, errno, sslerr, errorCode);
+            Ns_SockSetSendErrno(sock, errorCode != 0u ? errorCode : (unsigned long)errno);
+            SSL_set_shutdown(ssl, SSL_RECEIVED_SHUTDOWN);
+            sent = -1;
+        }
+    }
+
+    return sent;
+}
+#endif
+
+
 /*
  *----------------------------------------------------------------------
  *
@@ -540,7 +686,7 @@ ConnInfo(Ns_Sock *sock)
 
     resultObj = Tcl_NewDictObj();
 
-    if (sock != NULL) {
+    if (sock != NULL && sock->arg != NULL) {
         SSLContext *sslCtx = sock->arg;
 
         Tcl_DictObjPut(NULL, resultObj,
@@ -552,6 +698,14 @@ ConnInfo(Ns_Sock *sock)
         Tcl_DictObjPut(NULL, resultObj,
                        Tcl_NewStringObj("servername", 10),
                        Tcl_NewStringObj(SSL_get_servername(sslCtx->ssl, TLSEXT_NAMETYPE_host_name), TCL_INDEX_NONE));
+        Tcl_DictObjPut(NULL, resultObj,
+                       Tcl_NewStringObj("ktls", 4),
+#ifdef HAVE_OPENSSL_KTLS
+                       Tcl_NewBooleanObj(BIO_get_ktls_send(SSL_get_wbio(sslCtx->ssl)) != 0)
+#else
+                       Tcl_NewBooleanObj(0)
+#endif
+                       );
     }
 
     return resultObj;
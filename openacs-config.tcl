@@ -421,6 +421,7 @@ if {[info exists httpport] && $httpport ne ""} {
         # ns_param	sendwait	30s	;# 30s, timeout for send operations
         # ns_param	closewait	2s	;# 2s, timeout for close on socket
         # ns_param	keepwait	2s	;# 5s, timeout for keep-alive
+        # ns_param	leankeepalive   true    ;# false; idle keep-alive connections hold no buffers
         # ns_param	nodelay         false   ;# true; deactivate TCP_NODELAY if Nagle algorithm is wanted
         # ns_param	keepalivemaxuploadsize    500kB  ;# 0, don't allow keep-alive for upload content larger than this
         # ns_param	keepalivemaxdownloadsize  1MB    ;# 0, don't allow keep-alive for download content larger than this
@@ -511,6 +512,9 @@ if {[info exists httpsport] && $httpsport ne ""} {
         # ns_param OCSPstapling on        ;# off; activate OCSP stapling
         # ns_param OCSPstaplingVerbose  on ;# off; make OCSP stapling more verbose
         # ns_param OCSPcheckInterval 15m   ;# default 5m; OCSP (re)check intervale
+        # ns_param ktls  true              ;# false; kernel TLS offload, enables zero-copy sendfile over HTTPS (Linux, OpenSSL 3)
+        # ns_param http2 true              ;# false; offer HTTP/2 via ALPN (requires nghttp2)
+        # ns_param leankeepalive true      ;# false; release TLS buffers of idle keep-alive connections
     }
     #
     # Define, which "host" (as supplied by the "host:" header field)
@@ -564,6 +568,10 @@ ns_section ns/fastpath {
     #ns_param        cachemaxsize        10MB       ;# default: 10MB
     #ns_param        cachemaxentry       100kB      ;# default: 8kB
     #ns_param        mmap                true       ;# default: false
+    #ns_param        mmapcache           true       ;# keep mapped regions of larger files; default: false
+    #ns_param        mmapcachemaxsize    2GB        ;# default: 256MB
+    #ns_param        mmapcachemaxentry   5MB        ;# default: 16MB
+    #ns_param        mmapcacheshards     16         ;# default: 8
     #ns_param        gzip_static         true       ;# check for static gzip; default: false
     #ns_param        gzip_refresh        true       ;# refresh stale .gz files on the fly using ::ns_gzipfile
     #ns_param        gzip_cmd            "/usr/bin/gzip -9"  ;# use for re-compressing
@@ -572,6 +580,29 @@ ns_section ns/fastpath {
     #ns_param        brotli_static       true       ;# check for static brotli files; default: false
     #ns_param        brotli_refresh      true       ;# refresh stale .br files on the fly using ::ns_brotlifile
     #ns_param        brotli_cmd          "/usr/bin/brotli -f -Z"  ;# use for re-compressing
+    #ns_param        zstd_static         true       ;# check for static zstd files; default: false
+    #ns_param        zstd_refresh        true       ;# refresh stale .zst files on the fly using ::ns_zstdfile
+    #ns_param        zstd_cmd            "/usr/bin/zstd -q -19"  ;# use for re-compressing
+}
+
+#---------------------------------------------------------------------
+# Compression streams: idle streams are kept in a pool shared by all
+# servers and reused for the next compressed response.
+#---------------------------------------------------------------------
+ns_section ns/compress {
+    #ns_param        poolsize            16         ;# default: 16, max idle streams
+}
+
+#---------------------------------------------------------------------
+# Stat cache: cache file metadata of fastpath and ADP lookups. On
+# Linux, changed files are invalidated via inotify, otherwise the
+# changes become visible after the ttl.
+#---------------------------------------------------------------------
+ns_section ns/statcache {
+    #ns_param        ttl                 2s         ;# default: 0s (disabled)
+    #ns_param        shards              8          ;# default: 8
+    #ns_param        maxsize             1MB        ;# default: 1MB
+    #ns_param        inotify             true       ;# default: true
 }
 
 #---------------------------------------------------------------------
@@ -597,11 +628,16 @@ ns_section ns/server/$server {
     # ns_param	maxconnections	100      ;# 100; number of allocated connection structures
     ns_param    rejectoverrun   true     ;# false (send 503 when queue overruns)
     #ns_param   retryafter      5s       ;# time for Retry-After in 503 cases
+    #ns_param   codeltarget     0s       ;# 0s; shed requests when queueing delay stays above (e.g. 50ms)
+    #ns_param   codelinterval   100ms    ;# 100ms; how long the delay may exceed codeltarget
     #ns_param   filterrwlocks   false    ;# default: true
 
     # ns_param	maxthreads	10       ;# 10; maximal number of connection threads
     ns_param	minthreads	2        ;# 1; minimal number of connection threads
 
+    #ns_param	threadcontrol	adaptive ;# watermark; "adaptive" scales threads by arrival rate and service time
+    #ns_param	latencytarget	50ms     ;# 50ms; queueing delay targeted by adaptive thread control
+    #ns_param	classes		{api reports} ;# request classes, configured in sections "ns/server/$server/class/NAME"
     #ns_param	connsperthread	1000     ;# 10000; number of connections (requests) handled per thread
     ;# Setting connsperthread to > 0 will cause the thread to
     ;# graciously exit, after processing that many requests, thus
@@ -622,7 +658,18 @@ ns_section ns/server/$server {
     ns_param	compressenable	on       ;# false, use "ns_conn compress" to override
     # ns_param	compresslevel	4        ;# 4, 1-9 where 9 is high compression, high overhead
     # ns_param	compressminsize	512      ;# Compress responses larger than this
-    # ns_param	compresspreinit true     ;# false, if true then initialize and allocate buffers at startup
+    # ns_param	compresspreinit true     ;# false, if true then fill the pool of compression streams at startup
+    # ns_param	brotlienable	on       ;# false, use Brotli instead of gzip when accepted by the client
+    # ns_param	brotlilevel	5        ;# 5, 0-11 where 11 is high compression, high overhead
+    # ns_param	brotliwindow	22       ;# 22, window size as log2, 10-24
+    # ns_param	brotliminsize	512      ;# compressminsize; Brotli compress responses larger than this
+    # ns_param	zstdenable	on       ;# false, use zstd instead of gzip when accepted by the client and Brotli is not used
+    # ns_param	zstdlevel	3        ;# 3, 1-19 where 19 is high compression, high overhead
+    # ns_param	zstdminsize	512      ;# compressminsize; zstd compress responses larger than this
+    # ns_param	compressadaptive true    ;# false, lower the compression levels under load
+    # ns_param	compressadaptivedelay 20ms    ;# 20ms, queueing delay considered as overload
+    # ns_param	compressadaptivebusy 80       ;# 80, percentage of busy connection threads considered as overload
+    # ns_param	compressadaptiveskipsize 16KB ;# 16KB, under max. load, send smaller responses uncompressed
 
     # Enable nicer directory listing (as handled by the OpenACS request processor)
     # ns_param	directorylisting	fancy	;# Can be simple or fancy
@@ -660,6 +707,11 @@ ns_section ns/server/$server {
 #       maxconnections
 #       rejectoverrun
 #       retryafter
+#       codeltarget
+#       codelinterval
+#       threadcontrol
+#       latencytarget
+#       classes
 #       maxthreads
 #       minthreads
 #       poolratelimit
@@ -778,6 +830,10 @@ ns_section ns/server/$server/tcl {
     ns_param	debug		$debug
     # ns_param	nsvbuckets	16       ;# default: 8
     # ns_param	nsvrwlocks      false    ;# default: true
+    # ns_param	nsvreadmostly   {}       ;# default: {}, glob patterns of arrays read without locks
+    # ns_param	nsvcounters     {}       ;# default: {}, glob patterns of arrays with lock-free counters
+    # ns_param	snapshotfile    $logdir/snapshot.bin ;# default: none, nsv/cache snapshot restored at startup
+    # ns_param	snapshotthreads 4        ;# default: 4
 
     # ns_param initcmds {
     #    ns_log notice "=== Hello World === server: [ns_info server]"
@@ -796,6 +852,25 @@ ns_section ns/server/$server/fastpath {
     #                                   ;# "fancy" or "none"; parameter for _ns_dirlist
     # ns_param	hidedotfiles      true  ;# default false; parameter for _ns_dirlist
     #
+    # Deliver static files below these URL prefixes directly from the
+    # driver thread via the writer threads, as long as no filters and
+    # no authorization callbacks are registered (default "").
+    #
+    # ns_param	driverurls        "/resources"
+    #
+}
+
+#---------------------------------------------------------------------
+# Response micro-cache: answer repeated GET requests for responses
+# marked as "Cache-Control: public" or with "max-age" directly from the
+# driver thread. Responses served from the micro-cache are not logged
+# in the access log.
+#---------------------------------------------------------------------
+ns_section ns/server/$server/microcache {
+    #ns_param	maxsize		10MB	;# default: 0 (disabled)
+    #ns_param	maxentry	32KB	;# default: 32KB
+    #ns_param	ttl		10s	;# default: 10s
+    #ns_param	vary		accept-encoding ;# default: accept-encoding
 }
 
 #---------------------------------------------------------------------
@@ -216,6 +216,12 @@ proc ns_brotlifile {source target} {
     exec {*}$brotliCmd < $source > $target
 }
 
+proc ns_zstdfile {source target} {
+    set zstdCmd [ns_config ns/fastpath zstd_cmd]
+    if {$zstdCmd eq ""} {error "no ns/fastpath zstd_cmd configured"}
+    exec {*}$zstdCmd < $source > $target
+}
+
 # Local variables:
 #    mode: tcl
 #    tcl-indent-level: 4